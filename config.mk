@@ -13,11 +13,14 @@ BIN=bin
 CLIENT=client
 CLIENT_SRC=$(SRC)/$(CLIENT)
 CLIENT_LIB_SRC=$(SRC)/$(CLIENT)/$(LIB)
+BROKER=broker
+BROKER_SRC=$(SRC)/$(BROKER)
+BROKER_LIB_SRC=$(SRC)/$(BROKER)/$(LIB)
 OUTPUT=output
 
 CC=gcc
 CCFLAGS=-I$(INC) -Wall -O
-LDFLAGS=-L$(LIB) -leclimqtt -leclimqttclient -leclimqttlog
+LDFLAGS=-L$(LIB) -leclimqttbridge -leclimqttsession -leclimqttfile -leclimqttdelta -leclimqttstream -leclimqttsink -leclimqttshm -leclimqtt -leclimqttclient -leclimqttseries -leclimqttlvc -leclimqttcodec -leclimqtturing -leclimqtttls -leclimqttsendq -leclimqtttransport -leclimqttnet -leclimqttpace -leclimqtttrace -leclimqttmetrics -leclimqttlog -leclimqttutf8 -leclimqtthash -lrt -lpthread -ldl
 AR=ar
 
 #********************** LOG **********************
@@ -44,12 +47,32 @@ ifeq (${LOG},ALL)
 	DEFINE= -D LOG_DEBUG -D LOG_DEBUG -D LOG_BULK
 endif
 
+#********************** TRACE **********************
+
+ifeq (${TRACE},USDT)
+	DEFINE+= -D ECLI_TRACE_USDT
+endif
+ifeq (${TRACE},CHROME)
+	DEFINE+= -D ECLI_TRACE_CHROME
+endif
+ifeq (${TRACE},ALL)
+	DEFINE+= -D ECLI_TRACE_USDT -D ECLI_TRACE_CHROME
+endif
+
+#********************** TLS **********************
+
+ifeq (${TLS},OPENSSL)
+	DEFINE+= -D ECLI_TLS_OPENSSL
+	LDFLAGS+= -lssl -lcrypto
+endif
+
 #********************** X86 ARCH **********************
 ifeq (${ARCH},x86)
 	BIN=bin/x86
 	LIB=lib/x86
 	OUTPUT=output/x86
 	CLIENT_LIB_SRC=$(SRC)/$(CLIENT)/lib
+	BROKER_LIB_SRC=$(SRC)/$(BROKER)/lib
 	AR=ar
 endif
 
@@ -59,6 +82,7 @@ ifeq (${ARCH},arm)
 	LIB=lib/arm
 	OUTPUT=output/arm
 	CLIENT_LIB_SRC=$(SRC)/$(CLIENT)/lib
+	BROKER_LIB_SRC=$(SRC)/$(BROKER)/lib
 	AR=ar
 endif
 
@@ -69,6 +93,7 @@ ifeq (${ARCH},nios2-uclinux)
 	LIB=lib/nios2-uclinux
 	OUTPUT=output/nios2-uclinux
 	CLIENT_LIB_SRC=$(SRC)/$(CLIENT)/lib
+	BROKER_LIB_SRC=$(SRC)/$(BROKER)/lib
 	CC=nios2-linux-uclibc-gcc
 	ELFFLAG=-elf2flt
 	CCFLAGS=-I$(INC) -Wall -O $(ELFFLAG)
@@ -80,6 +105,7 @@ ifeq (${ARCH},nios2-linux)
 	LIB=lib/nios2-linux
 	OUTPUT=output/nios2-linux
 	CLIENT_LIB_SRC=$(SRC)/$(CLIENT)/lib
+	BROKER_LIB_SRC=$(SRC)/$(BROKER)/lib
 	CC=nios2-linux-gnu-gcc
 	AR=nios2-linux-gnu-ar
 endif
@@ -88,20 +114,134 @@ endif
 #*************************** Compile objects ***************************/
 #***********************************************************************/
 
-$(BIN)/ecli_mqtt_pub: $(LIB)/libeclimqtt.a $(LIB)/libeclimqttclient.a $(LIB)/libeclimqttlog.a $(OUTPUT)/ecli_mqtt_pub.o
+$(BIN)/ecli_mqtt_pub: $(LIB)/libeclimqttbridge.a $(LIB)/libeclimqttsession.a $(LIB)/libeclimqttfile.a $(LIB)/libeclimqttdelta.a $(LIB)/libeclimqttstream.a $(LIB)/libeclimqttsink.a $(LIB)/libeclimqttshm.a $(LIB)/libeclimqtt.a $(LIB)/libeclimqttclient.a $(LIB)/libeclimqttseries.a $(LIB)/libeclimqttlvc.a $(LIB)/libeclimqttcodec.a $(LIB)/libeclimqtturing.a $(LIB)/libeclimqtttls.a $(LIB)/libeclimqttsendq.a $(LIB)/libeclimqtttransport.a $(LIB)/libeclimqttnet.a $(LIB)/libeclimqttpace.a $(LIB)/libeclimqttmetrics.a $(LIB)/libeclimqtttrace.a $(LIB)/libeclimqttlog.a $(LIB)/libeclimqttutf8.a $(LIB)/libeclimqtthash.a $(OUTPUT)/ecli_mqtt_pub.o
 	$(CC) $(DEFINE) $(OUTPUT)/ecli_mqtt_pub.o -o $(BIN)/ecli_mqtt_pub $(LDFLAGS) $(ELFFLAG)
 
-$(OUTPUT)/ecli_mqtt_pub.o: $(CLIENT_SRC)/ecli_mqtt_pub.c $(INC)/libeclimqtt.h $(INC)/libeclimqttclient.h $(INC)/libeclimqttlog.h
+$(OUTPUT)/ecli_mqtt_pub.o: $(CLIENT_SRC)/ecli_mqtt_pub.c $(INC)/libeclimqttbridge.h $(INC)/libeclimqttsession.h $(INC)/libeclimqttfile.h $(INC)/libeclimqttdelta.h $(INC)/libeclimqttstream.h $(INC)/libeclimqttsink.h $(INC)/libeclimqttshm.h $(INC)/libeclimqtt.h $(INC)/libeclimqttclient.h $(INC)/libeclimqttseries.h $(INC)/libeclimqttlvc.h $(INC)/libeclimqttcodec.h $(INC)/libeclimqtturing.h $(INC)/libeclimqtttls.h $(INC)/libeclimqttsendq.h $(INC)/libeclimqtttransport.h $(INC)/libeclimqttnet.h $(INC)/libeclimqttpace.h $(INC)/libeclimqttmetrics.h $(INC)/libeclimqtttrace.h $(INC)/libeclimqttlog.h $(INC)/libeclimqttutf8.h $(INC)/libeclimqtthash.h
 	$(CC) $(DEFINE) $(CCFLAGS) -c $(CLIENT_SRC)/ecli_mqtt_pub.c -o $(OUTPUT)/ecli_mqtt_pub.o
 
-$(BIN)/ecli_mqtt_sub: $(LIB)/libeclimqtt.a $(LIB)/libeclimqttclient.a $(LIB)/libeclimqttlog.a $(OUTPUT)/ecli_mqtt_sub.o
+$(BIN)/ecli_mqtt_sub: $(LIB)/libeclimqttbridge.a $(LIB)/libeclimqttsession.a $(LIB)/libeclimqttfile.a $(LIB)/libeclimqttdelta.a $(LIB)/libeclimqttstream.a $(LIB)/libeclimqttsink.a $(LIB)/libeclimqttshm.a $(LIB)/libeclimqtt.a $(LIB)/libeclimqttclient.a $(LIB)/libeclimqttseries.a $(LIB)/libeclimqttlvc.a $(LIB)/libeclimqttcodec.a $(LIB)/libeclimqtturing.a $(LIB)/libeclimqtttls.a $(LIB)/libeclimqttsendq.a $(LIB)/libeclimqtttransport.a $(LIB)/libeclimqttnet.a $(LIB)/libeclimqttpace.a $(LIB)/libeclimqttmetrics.a $(LIB)/libeclimqtttrace.a $(LIB)/libeclimqttlog.a $(LIB)/libeclimqttutf8.a $(LIB)/libeclimqtthash.a $(OUTPUT)/ecli_mqtt_sub.o
 	$(CC) $(DEFINE) $(OUTPUT)/ecli_mqtt_sub.o -o $(BIN)/ecli_mqtt_sub $(LDFLAGS) $(ELFFLAG)
 
-$(OUTPUT)/ecli_mqtt_sub.o: $(CLIENT_SRC)/ecli_mqtt_sub.c $(INC)/libeclimqtt.h $(INC)/libeclimqttclient.h $(INC)/libeclimqttlog.h
+$(OUTPUT)/ecli_mqtt_sub.o: $(CLIENT_SRC)/ecli_mqtt_sub.c $(INC)/libeclimqttbridge.h $(INC)/libeclimqttsession.h $(INC)/libeclimqttfile.h $(INC)/libeclimqttdelta.h $(INC)/libeclimqttstream.h $(INC)/libeclimqttsink.h $(INC)/libeclimqttshm.h $(INC)/libeclimqtt.h $(INC)/libeclimqttclient.h $(INC)/libeclimqttseries.h $(INC)/libeclimqttlvc.h $(INC)/libeclimqttcodec.h $(INC)/libeclimqtturing.h $(INC)/libeclimqtttls.h $(INC)/libeclimqttsendq.h $(INC)/libeclimqtttransport.h $(INC)/libeclimqttnet.h $(INC)/libeclimqttpace.h $(INC)/libeclimqttmetrics.h $(INC)/libeclimqtttrace.h $(INC)/libeclimqttlog.h $(INC)/libeclimqttutf8.h $(INC)/libeclimqtthash.h
 	$(CC) $(DEFINE) $(CCFLAGS) -c $(CLIENT_SRC)/ecli_mqtt_sub.c -o $(OUTPUT)/ecli_mqtt_sub.o
 
+$(BIN)/ecli_mqtt_sessions: $(LIB)/libeclimqttbridge.a $(LIB)/libeclimqttsession.a $(LIB)/libeclimqttfile.a $(LIB)/libeclimqttdelta.a $(LIB)/libeclimqttstream.a $(LIB)/libeclimqttsink.a $(LIB)/libeclimqttshm.a $(LIB)/libeclimqtt.a $(LIB)/libeclimqttclient.a $(LIB)/libeclimqttseries.a $(LIB)/libeclimqttlvc.a $(LIB)/libeclimqttcodec.a $(LIB)/libeclimqtturing.a $(LIB)/libeclimqtttls.a $(LIB)/libeclimqttsendq.a $(LIB)/libeclimqtttransport.a $(LIB)/libeclimqttnet.a $(LIB)/libeclimqttpace.a $(LIB)/libeclimqttmetrics.a $(LIB)/libeclimqtttrace.a $(LIB)/libeclimqttlog.a $(LIB)/libeclimqttutf8.a $(LIB)/libeclimqtthash.a $(OUTPUT)/ecli_mqtt_sessions.o
+	$(CC) $(DEFINE) $(OUTPUT)/ecli_mqtt_sessions.o -o $(BIN)/ecli_mqtt_sessions $(LDFLAGS) $(ELFFLAG)
+
+$(OUTPUT)/ecli_mqtt_sessions.o: $(CLIENT_SRC)/ecli_mqtt_sessions.c $(INC)/libeclimqttbridge.h $(INC)/libeclimqttsession.h $(INC)/libeclimqttfile.h $(INC)/libeclimqttdelta.h $(INC)/libeclimqttstream.h $(INC)/libeclimqttsink.h $(INC)/libeclimqttshm.h $(INC)/libeclimqtt.h $(INC)/libeclimqttclient.h $(INC)/libeclimqttseries.h $(INC)/libeclimqttlvc.h $(INC)/libeclimqttcodec.h $(INC)/libeclimqtturing.h $(INC)/libeclimqtttls.h $(INC)/libeclimqttsendq.h $(INC)/libeclimqtttransport.h $(INC)/libeclimqttnet.h $(INC)/libeclimqttpace.h $(INC)/libeclimqttmetrics.h $(INC)/libeclimqtttrace.h $(INC)/libeclimqttlog.h $(INC)/libeclimqttutf8.h $(INC)/libeclimqtthash.h
+	$(CC) $(DEFINE) $(CCFLAGS) -c $(CLIENT_SRC)/ecli_mqtt_sessions.c -o $(OUTPUT)/ecli_mqtt_sessions.o
+
+$(BIN)/ecli_mqtt_bridge: $(LIB)/libeclimqttbridge.a $(LIB)/libeclimqttsession.a $(LIB)/libeclimqttfile.a $(LIB)/libeclimqttdelta.a $(LIB)/libeclimqttstream.a $(LIB)/libeclimqttsink.a $(LIB)/libeclimqttshm.a $(LIB)/libeclimqtt.a $(LIB)/libeclimqttclient.a $(LIB)/libeclimqttseries.a $(LIB)/libeclimqttlvc.a $(LIB)/libeclimqttcodec.a $(LIB)/libeclimqtturing.a $(LIB)/libeclimqtttls.a $(LIB)/libeclimqttsendq.a $(LIB)/libeclimqtttransport.a $(LIB)/libeclimqttnet.a $(LIB)/libeclimqttpace.a $(LIB)/libeclimqttmetrics.a $(LIB)/libeclimqtttrace.a $(LIB)/libeclimqttlog.a $(LIB)/libeclimqttutf8.a $(LIB)/libeclimqtthash.a $(OUTPUT)/ecli_mqtt_bridge.o
+	$(CC) $(DEFINE) $(OUTPUT)/ecli_mqtt_bridge.o -o $(BIN)/ecli_mqtt_bridge $(LDFLAGS) $(ELFFLAG)
+
+$(OUTPUT)/ecli_mqtt_bridge.o: $(CLIENT_SRC)/ecli_mqtt_bridge.c $(INC)/libeclimqttbridge.h $(INC)/libeclimqttsession.h $(INC)/libeclimqttfile.h $(INC)/libeclimqttdelta.h $(INC)/libeclimqttstream.h $(INC)/libeclimqttsink.h $(INC)/libeclimqttshm.h $(INC)/libeclimqtt.h $(INC)/libeclimqttclient.h $(INC)/libeclimqttseries.h $(INC)/libeclimqttlvc.h $(INC)/libeclimqttcodec.h $(INC)/libeclimqtturing.h $(INC)/libeclimqtttls.h $(INC)/libeclimqttsendq.h $(INC)/libeclimqtttransport.h $(INC)/libeclimqttnet.h $(INC)/libeclimqttpace.h $(INC)/libeclimqttmetrics.h $(INC)/libeclimqtttrace.h $(INC)/libeclimqttlog.h $(INC)/libeclimqttutf8.h $(INC)/libeclimqtthash.h
+	$(CC) $(DEFINE) $(CCFLAGS) -c $(CLIENT_SRC)/ecli_mqtt_bridge.c -o $(OUTPUT)/ecli_mqtt_bridge.o
+
+$(BIN)/ecli_mqtt_hashbench: $(LIB)/libeclimqtthash.a $(OUTPUT)/ecli_mqtt_hashbench.o
+	$(CC) $(DEFINE) $(OUTPUT)/ecli_mqtt_hashbench.o -o $(BIN)/ecli_mqtt_hashbench -L$(LIB) -leclimqtthash -lpthread $(ELFFLAG)
+
+$(OUTPUT)/ecli_mqtt_hashbench.o: $(CLIENT_SRC)/ecli_mqtt_hashbench.c $(INC)/libeclimqtthash.h
+	$(CC) $(DEFINE) $(CCFLAGS) -c $(CLIENT_SRC)/ecli_mqtt_hashbench.c -o $(OUTPUT)/ecli_mqtt_hashbench.o
+
+$(BIN)/ecli_mqtt_utf8bench: $(LIB)/libeclimqttutf8.a $(OUTPUT)/ecli_mqtt_utf8bench.o
+	$(CC) $(DEFINE) $(OUTPUT)/ecli_mqtt_utf8bench.o -o $(BIN)/ecli_mqtt_utf8bench -L$(LIB) -leclimqttutf8 -lpthread $(ELFFLAG)
+
+$(OUTPUT)/ecli_mqtt_utf8bench.o: $(CLIENT_SRC)/ecli_mqtt_utf8bench.c $(INC)/libeclimqttutf8.h
+	$(CC) $(DEFINE) $(CCFLAGS) -c $(CLIENT_SRC)/ecli_mqtt_utf8bench.c -o $(OUTPUT)/ecli_mqtt_utf8bench.o
+
+$(BIN)/ecli_mqtt_broker: $(LIB)/libeclimqttbroker.a $(LIB)/libeclimqttbridge.a $(LIB)/libeclimqttsession.a $(LIB)/libeclimqttfile.a $(LIB)/libeclimqttdelta.a $(LIB)/libeclimqttstream.a $(LIB)/libeclimqttsink.a $(LIB)/libeclimqttshm.a $(LIB)/libeclimqtt.a $(LIB)/libeclimqttclient.a $(LIB)/libeclimqttseries.a $(LIB)/libeclimqttlvc.a $(LIB)/libeclimqttcodec.a $(LIB)/libeclimqtturing.a $(LIB)/libeclimqtttls.a $(LIB)/libeclimqttsendq.a $(LIB)/libeclimqtttransport.a $(LIB)/libeclimqttnet.a $(LIB)/libeclimqttpace.a $(LIB)/libeclimqttmetrics.a $(LIB)/libeclimqtttrace.a $(LIB)/libeclimqttlog.a $(LIB)/libeclimqttutf8.a $(LIB)/libeclimqtthash.a $(OUTPUT)/ecli_mqtt_broker.o
+	$(CC) $(DEFINE) $(OUTPUT)/ecli_mqtt_broker.o -o $(BIN)/ecli_mqtt_broker -L$(LIB) -leclimqttbroker $(LDFLAGS) $(ELFFLAG)
+
+$(OUTPUT)/ecli_mqtt_broker.o: $(BROKER_SRC)/ecli_mqtt_broker.c $(INC)/libeclimqttbroker.h $(INC)/libeclimqttbridge.h $(INC)/libeclimqttsession.h $(INC)/libeclimqttfile.h $(INC)/libeclimqttdelta.h $(INC)/libeclimqttstream.h $(INC)/libeclimqttsink.h $(INC)/libeclimqttshm.h $(INC)/libeclimqtt.h $(INC)/libeclimqttclient.h $(INC)/libeclimqttseries.h $(INC)/libeclimqttlvc.h $(INC)/libeclimqttcodec.h $(INC)/libeclimqtturing.h $(INC)/libeclimqtttls.h $(INC)/libeclimqttsendq.h $(INC)/libeclimqtttransport.h $(INC)/libeclimqttnet.h $(INC)/libeclimqttpace.h $(INC)/libeclimqttmetrics.h $(INC)/libeclimqtttrace.h $(INC)/libeclimqttlog.h $(INC)/libeclimqttutf8.h $(INC)/libeclimqtthash.h
+	$(CC) $(DEFINE) $(CCFLAGS) -c $(BROKER_SRC)/ecli_mqtt_broker.c -o $(OUTPUT)/ecli_mqtt_broker.o
+
+$(BIN)/ecli_mqtt_latency: $(LIB)/libeclimqttbridge.a $(LIB)/libeclimqttsession.a $(LIB)/libeclimqttfile.a $(LIB)/libeclimqttdelta.a $(LIB)/libeclimqttstream.a $(LIB)/libeclimqttsink.a $(LIB)/libeclimqttshm.a $(LIB)/libeclimqtt.a $(LIB)/libeclimqttclient.a $(LIB)/libeclimqttseries.a $(LIB)/libeclimqttlvc.a $(LIB)/libeclimqttcodec.a $(LIB)/libeclimqtturing.a $(LIB)/libeclimqtttls.a $(LIB)/libeclimqttsendq.a $(LIB)/libeclimqtttransport.a $(LIB)/libeclimqttnet.a $(LIB)/libeclimqttpace.a $(LIB)/libeclimqttmetrics.a $(LIB)/libeclimqtttrace.a $(LIB)/libeclimqttlog.a $(LIB)/libeclimqttutf8.a $(LIB)/libeclimqtthash.a $(OUTPUT)/ecli_mqtt_latency.o
+	$(CC) $(DEFINE) $(OUTPUT)/ecli_mqtt_latency.o -o $(BIN)/ecli_mqtt_latency $(LDFLAGS) $(ELFFLAG)
+
+$(OUTPUT)/ecli_mqtt_latency.o: $(CLIENT_SRC)/ecli_mqtt_latency.c $(INC)/libeclimqttbridge.h $(INC)/libeclimqttsession.h $(INC)/libeclimqttfile.h $(INC)/libeclimqttdelta.h $(INC)/libeclimqttstream.h $(INC)/libeclimqttsink.h $(INC)/libeclimqttshm.h $(INC)/libeclimqtt.h $(INC)/libeclimqttclient.h $(INC)/libeclimqttseries.h $(INC)/libeclimqttlvc.h $(INC)/libeclimqttcodec.h $(INC)/libeclimqtturing.h $(INC)/libeclimqtttls.h $(INC)/libeclimqttsendq.h $(INC)/libeclimqtttransport.h $(INC)/libeclimqttnet.h $(INC)/libeclimqttpace.h $(INC)/libeclimqttmetrics.h $(INC)/libeclimqtttrace.h $(INC)/libeclimqttlog.h $(INC)/libeclimqttutf8.h $(INC)/libeclimqtthash.h
+	$(CC) $(DEFINE) $(CCFLAGS) -c $(CLIENT_SRC)/ecli_mqtt_latency.c -o $(OUTPUT)/ecli_mqtt_latency.o
+
+$(BIN)/ecli_mqtt_brokerbench: $(OUTPUT)/ecli_mqtt_brokerbench.o
+	$(CC) $(DEFINE) $(OUTPUT)/ecli_mqtt_brokerbench.o -o $(BIN)/ecli_mqtt_brokerbench $(ELFFLAG)
+
+$(OUTPUT)/ecli_mqtt_brokerbench.o: $(BROKER_SRC)/ecli_mqtt_brokerbench.c $(INC)/libeclimqtt.h $(INC)/libeclimqttclient.h $(INC)/libeclimqttconf.h
+	$(CC) $(DEFINE) $(CCFLAGS) -c $(BROKER_SRC)/ecli_mqtt_brokerbench.c -o $(OUTPUT)/ecli_mqtt_brokerbench.o
+
 #***************************     Libraries    ***************************/
 
+$(LIB)/libeclimqttbroker.a: $(OUTPUT)/libeclimqttbroker.o
+	$(AR) rcs $(LIB)/libeclimqttbroker.a $(OUTPUT)/libeclimqttbroker.o
+
+$(OUTPUT)/libeclimqttbroker.o: $(BROKER_LIB_SRC)/libeclimqttbroker.c $(INC)/libeclimqttbroker.h $(INC)/libeclimqtt.h $(INC)/libeclimqtthash.h $(INC)/libeclimqttutf8.h
+	$(CC) $(DEFINE) $(CCFLAGS) -c $(BROKER_LIB_SRC)/libeclimqttbroker.c -o $(OUTPUT)/libeclimqttbroker.o
+
+$(LIB)/libeclimqttutf8.a: $(OUTPUT)/libeclimqttutf8.o
+	$(AR) rcs $(LIB)/libeclimqttutf8.a $(OUTPUT)/libeclimqttutf8.o
+
+$(OUTPUT)/libeclimqttutf8.o: $(CLIENT_LIB_SRC)/libeclimqttutf8.c $(INC)/libeclimqttutf8.h
+	$(CC) $(DEFINE) $(CCFLAGS) -c $(CLIENT_LIB_SRC)/libeclimqttutf8.c -o $(OUTPUT)/libeclimqttutf8.o
+
+$(LIB)/libeclimqtthash.a: $(OUTPUT)/libeclimqtthash.o
+	$(AR) rcs $(LIB)/libeclimqtthash.a $(OUTPUT)/libeclimqtthash.o
+
+$(OUTPUT)/libeclimqtthash.o: $(CLIENT_LIB_SRC)/libeclimqtthash.c $(INC)/libeclimqtthash.h
+	$(CC) $(DEFINE) $(CCFLAGS) -c $(CLIENT_LIB_SRC)/libeclimqtthash.c -o $(OUTPUT)/libeclimqtthash.o
+
+$(LIB)/libeclimqttfile.a: $(OUTPUT)/libeclimqttfile.o
+	$(AR) rcs $(LIB)/libeclimqttfile.a $(OUTPUT)/libeclimqttfile.o
+
+$(OUTPUT)/libeclimqttfile.o: $(CLIENT_LIB_SRC)/libeclimqttfile.c $(INC)/libeclimqttfile.h $(INC)/libeclimqtt.h
+	$(CC) $(DEFINE) $(CCFLAGS) -c $(CLIENT_LIB_SRC)/libeclimqttfile.c -o $(OUTPUT)/libeclimqttfile.o
+
+$(LIB)/libeclimqttdelta.a: $(OUTPUT)/libeclimqttdelta.o
+	$(AR) rcs $(LIB)/libeclimqttdelta.a $(OUTPUT)/libeclimqttdelta.o
+
+$(OUTPUT)/libeclimqttdelta.o: $(CLIENT_LIB_SRC)/libeclimqttdelta.c $(INC)/libeclimqttdelta.h $(INC)/libeclimqtt.h
+	$(CC) $(DEFINE) $(CCFLAGS) -c $(CLIENT_LIB_SRC)/libeclimqttdelta.c -o $(OUTPUT)/libeclimqttdelta.o
+
+$(LIB)/libeclimqttstream.a: $(OUTPUT)/libeclimqttstream.o
+	$(AR) rcs $(LIB)/libeclimqttstream.a $(OUTPUT)/libeclimqttstream.o
+
+$(OUTPUT)/libeclimqttstream.o: $(CLIENT_LIB_SRC)/libeclimqttstream.c $(INC)/libeclimqttstream.h $(INC)/libeclimqttseries.h $(INC)/libeclimqttsink.h $(INC)/libeclimqttshm.h $(INC)/libeclimqtt.h
+	$(CC) $(DEFINE) $(CCFLAGS) -c $(CLIENT_LIB_SRC)/libeclimqttstream.c -o $(OUTPUT)/libeclimqttstream.o
+
+$(LIB)/libeclimqttbridge.a: $(OUTPUT)/libeclimqttbridge.o
+	$(AR) rcs $(LIB)/libeclimqttbridge.a $(OUTPUT)/libeclimqttbridge.o
+
+$(OUTPUT)/libeclimqttbridge.o: $(CLIENT_LIB_SRC)/libeclimqttbridge.c $(INC)/libeclimqttbridge.h $(INC)/libeclimqtt.h $(INC)/libeclimqttutf8.h
+	$(CC) $(DEFINE) $(CCFLAGS) -c $(CLIENT_LIB_SRC)/libeclimqttbridge.c -o $(OUTPUT)/libeclimqttbridge.o
+
+$(LIB)/libeclimqttsession.a: $(OUTPUT)/libeclimqttsession.o
+	$(AR) rcs $(LIB)/libeclimqttsession.a $(OUTPUT)/libeclimqttsession.o
+
+$(OUTPUT)/libeclimqttsession.o: $(CLIENT_LIB_SRC)/libeclimqttsession.c $(INC)/libeclimqttsession.h $(INC)/libeclimqttseries.h $(INC)/libeclimqttsink.h $(INC)/libeclimqttshm.h $(INC)/libeclimqtt.h
+	$(CC) $(DEFINE) $(CCFLAGS) -c $(CLIENT_LIB_SRC)/libeclimqttsession.c -o $(OUTPUT)/libeclimqttsession.o
+
+$(LIB)/libeclimqttsink.a: $(OUTPUT)/libeclimqttsink.o
+	$(AR) rcs $(LIB)/libeclimqttsink.a $(OUTPUT)/libeclimqttsink.o
+
+$(OUTPUT)/libeclimqttsink.o: $(CLIENT_LIB_SRC)/libeclimqttsink.c $(INC)/libeclimqttsink.h $(INC)/libeclimqttshm.h $(INC)/libeclimqttclient.h
+	$(CC) $(DEFINE) $(CCFLAGS) -c $(CLIENT_LIB_SRC)/libeclimqttsink.c -o $(OUTPUT)/libeclimqttsink.o
+
+$(LIB)/libeclimqttshm.a: $(OUTPUT)/libeclimqttshm.o
+	$(AR) rcs $(LIB)/libeclimqttshm.a $(OUTPUT)/libeclimqttshm.o
+
+$(OUTPUT)/libeclimqttshm.o: $(CLIENT_LIB_SRC)/libeclimqttshm.c $(INC)/libeclimqttshm.h $(INC)/libeclimqttlog.h
+	$(CC) $(DEFINE) $(CCFLAGS) -c $(CLIENT_LIB_SRC)/libeclimqttshm.c -o $(OUTPUT)/libeclimqttshm.o
+
+$(LIB)/libeclimqttseries.a: $(OUTPUT)/libeclimqttseries.o
+	$(AR) rcs $(LIB)/libeclimqttseries.a $(OUTPUT)/libeclimqttseries.o
+
+$(OUTPUT)/libeclimqttseries.o: $(CLIENT_LIB_SRC)/libeclimqttseries.c $(INC)/libeclimqttseries.h $(INC)/libeclimqttclient.h
+	$(CC) $(DEFINE) $(CCFLAGS) -c $(CLIENT_LIB_SRC)/libeclimqttseries.c -o $(OUTPUT)/libeclimqttseries.o
+
+$(LIB)/libeclimqttlvc.a: $(OUTPUT)/libeclimqttlvc.o
+	$(AR) rcs $(LIB)/libeclimqttlvc.a $(OUTPUT)/libeclimqttlvc.o
+
+$(OUTPUT)/libeclimqttlvc.o: $(CLIENT_LIB_SRC)/libeclimqttlvc.c $(INC)/libeclimqttlvc.h $(INC)/libeclimqtthash.h
+	$(CC) $(DEFINE) $(CCFLAGS) -c $(CLIENT_LIB_SRC)/libeclimqttlvc.c -o $(OUTPUT)/libeclimqttlvc.o
+
 $(LIB)/libeclimqtt.a: $(OUTPUT)/libeclimqtt.o
 	$(AR) rcs $(LIB)/libeclimqtt.a $(OUTPUT)/libeclimqtt.o
 
@@ -111,9 +251,63 @@ $(OUTPUT)/libeclimqtt.o: $(CLIENT_LIB_SRC)/libeclimqtt.c $(INC)/libeclimqtt.h
 $(LIB)/libeclimqttclient.a: $(OUTPUT)/libeclimqttclient.o
 	$(AR) rcs $(LIB)/libeclimqttclient.a $(OUTPUT)/libeclimqttclient.o
 
-$(OUTPUT)/libeclimqttclient.o: $(CLIENT_LIB_SRC)/libeclimqttclient.c $(INC)/libeclimqttclient.h
+$(OUTPUT)/libeclimqttclient.o: $(CLIENT_LIB_SRC)/libeclimqttclient.c $(INC)/libeclimqttclient.h $(INC)/libeclimqttseries.h $(INC)/libeclimqttlvc.h $(INC)/libeclimqttutf8.h
 	$(CC) $(DEFINE) $(CCFLAGS) -c $(CLIENT_LIB_SRC)/libeclimqttclient.c -o $(OUTPUT)/libeclimqttclient.o
 
+$(LIB)/libeclimqttnet.a: $(OUTPUT)/libeclimqttnet.o
+	$(AR) rcs $(LIB)/libeclimqttnet.a $(OUTPUT)/libeclimqttnet.o
+
+$(OUTPUT)/libeclimqttnet.o: $(CLIENT_LIB_SRC)/libeclimqttnet.c $(INC)/libeclimqttnet.h $(INC)/libeclimqttmetrics.h
+	$(CC) $(DEFINE) $(CCFLAGS) -c $(CLIENT_LIB_SRC)/libeclimqttnet.c -o $(OUTPUT)/libeclimqttnet.o
+
+$(LIB)/libeclimqtttls.a: $(OUTPUT)/libeclimqtttls.o
+	$(AR) rcs $(LIB)/libeclimqtttls.a $(OUTPUT)/libeclimqtttls.o
+
+$(OUTPUT)/libeclimqtttls.o: $(CLIENT_LIB_SRC)/libeclimqtttls.c $(INC)/libeclimqtttls.h
+	$(CC) $(DEFINE) $(CCFLAGS) -c $(CLIENT_LIB_SRC)/libeclimqtttls.c -o $(OUTPUT)/libeclimqtttls.o
+
+$(LIB)/libeclimqttcodec.a: $(OUTPUT)/libeclimqttcodec.o
+	$(AR) rcs $(LIB)/libeclimqttcodec.a $(OUTPUT)/libeclimqttcodec.o
+
+$(OUTPUT)/libeclimqttcodec.o: $(CLIENT_LIB_SRC)/libeclimqttcodec.c $(INC)/libeclimqttcodec.h $(INC)/libeclimqttutf8.h
+	$(CC) $(DEFINE) $(CCFLAGS) -c $(CLIENT_LIB_SRC)/libeclimqttcodec.c -o $(OUTPUT)/libeclimqttcodec.o
+
+$(LIB)/libeclimqtturing.a: $(OUTPUT)/libeclimqtturing.o
+	$(AR) rcs $(LIB)/libeclimqtturing.a $(OUTPUT)/libeclimqtturing.o
+
+$(OUTPUT)/libeclimqtturing.o: $(CLIENT_LIB_SRC)/libeclimqtturing.c $(INC)/libeclimqtturing.h $(INC)/libeclimqtttransport.h $(INC)/libeclimqttmetrics.h
+	$(CC) $(DEFINE) $(CCFLAGS) -c $(CLIENT_LIB_SRC)/libeclimqtturing.c -o $(OUTPUT)/libeclimqtturing.o
+
+$(LIB)/libeclimqttsendq.a: $(OUTPUT)/libeclimqttsendq.o
+	$(AR) rcs $(LIB)/libeclimqttsendq.a $(OUTPUT)/libeclimqttsendq.o
+
+$(OUTPUT)/libeclimqttsendq.o: $(CLIENT_LIB_SRC)/libeclimqttsendq.c $(INC)/libeclimqttsendq.h $(INC)/libeclimqtttransport.h $(INC)/libeclimqttmetrics.h $(INC)/libeclimqttutf8.h
+	$(CC) $(DEFINE) $(CCFLAGS) -c $(CLIENT_LIB_SRC)/libeclimqttsendq.c -o $(OUTPUT)/libeclimqttsendq.o
+
+$(LIB)/libeclimqtttransport.a: $(OUTPUT)/libeclimqtttransport.o
+	$(AR) rcs $(LIB)/libeclimqtttransport.a $(OUTPUT)/libeclimqtttransport.o
+
+$(OUTPUT)/libeclimqtttransport.o: $(CLIENT_LIB_SRC)/libeclimqtttransport.c $(INC)/libeclimqtttransport.h
+	$(CC) $(DEFINE) $(CCFLAGS) -c $(CLIENT_LIB_SRC)/libeclimqtttransport.c -o $(OUTPUT)/libeclimqtttransport.o
+
+$(LIB)/libeclimqttpace.a: $(OUTPUT)/libeclimqttpace.o
+	$(AR) rcs $(LIB)/libeclimqttpace.a $(OUTPUT)/libeclimqttpace.o
+
+$(OUTPUT)/libeclimqttpace.o: $(CLIENT_LIB_SRC)/libeclimqttpace.c $(INC)/libeclimqttpace.h $(INC)/libeclimqttmetrics.h
+	$(CC) $(DEFINE) $(CCFLAGS) -c $(CLIENT_LIB_SRC)/libeclimqttpace.c -o $(OUTPUT)/libeclimqttpace.o
+
+$(LIB)/libeclimqttmetrics.a: $(OUTPUT)/libeclimqttmetrics.o
+	$(AR) rcs $(LIB)/libeclimqttmetrics.a $(OUTPUT)/libeclimqttmetrics.o
+
+$(OUTPUT)/libeclimqttmetrics.o: $(CLIENT_LIB_SRC)/libeclimqttmetrics.c $(INC)/libeclimqttmetrics.h
+	$(CC) $(DEFINE) $(CCFLAGS) -c $(CLIENT_LIB_SRC)/libeclimqttmetrics.c -o $(OUTPUT)/libeclimqttmetrics.o
+
+$(LIB)/libeclimqtttrace.a: $(OUTPUT)/libeclimqtttrace.o
+	$(AR) rcs $(LIB)/libeclimqtttrace.a $(OUTPUT)/libeclimqtttrace.o
+
+$(OUTPUT)/libeclimqtttrace.o: $(CLIENT_LIB_SRC)/libeclimqtttrace.c $(INC)/libeclimqtttrace.h $(INC)/libeclimqttmetrics.h
+	$(CC) $(DEFINE) $(CCFLAGS) -c $(CLIENT_LIB_SRC)/libeclimqtttrace.c -o $(OUTPUT)/libeclimqtttrace.o
+
 $(LIB)/libeclimqttlog.a: $(OUTPUT)/libeclimqttlog.o
 	$(AR) rcs $(LIB)/libeclimqttlog.a $(OUTPUT)/libeclimqttlog.o
 
@@ -125,4 +319,6 @@ set_properties:
 ifeq (${ARCH},nios2-uclinux)
 	nios2-linux-uclibc-flthdr -s 102400  $(BIN)/ecli_mqtt_pub
 	nios2-linux-uclibc-flthdr -s 102400  $(BIN)/ecli_mqtt_sub
+	nios2-linux-uclibc-flthdr -s 102400  $(BIN)/ecli_mqtt_sessions
+	nios2-linux-uclibc-flthdr -s 102400  $(BIN)/ecli_mqtt_bridge
 endif
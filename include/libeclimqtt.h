@@ -52,6 +52,7 @@
 /* FIXED HEADER FLAGS TO CONTROL PACKET TYPES  - SECOND BYTE */
 #define MQTT_CONNECT_FLAG             0       /* 0000 0000 */
 #define MQTT_CONNACK_FLAG             0       /* 0000 0000 */
+#define MQTT_CONNACK_SESS_PRESENT     1       /* 0000 0001 */
 #define MQTT_PUBLISH_DUP_FLAG      1<<3       /* 0000 1000 */
 #define MQTT_PUBLISH_QOS0_FLAG     0<<1       /* 0000 0000 */
 #define MQTT_PUBLISH_QOS1_FLAG     1<<1       /* 0000 0010 */
@@ -104,7 +105,7 @@ uint8_t eclimqtt_publish(ecli_broker_t *broker, ecli_conf_t *conf, uint8_t first
  * @param msg_len: chunk len.
  *
  */
-uint8_t eclimqtt_publish_data(ecli_broker_t *broker, ecli_conf_t *conf, const uint8_t *msg_buffer, uint32_t msg_len);
+uint8_t eclimqtt_publish_chunk(ecli_broker_t *broker, ecli_conf_t *conf, const uint8_t *msg_buffer, uint32_t msg_len);
 
 /**********************************************************************/
 /** Subscribe to topic.
@@ -0,0 +1,87 @@
+/***********************************************************************
+* FILENAME    :   libeclimqttbridge.h
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   Library header for the store-and-forward bridge between
+*                 a local and an upstream broker.
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <stdint.h>
+
+/**********************************************************************/
+
+#include <libeclimqtt.h>
+
+/**********************************************************************/
+
+#ifndef LIBECLIMQTTBRIDGE_H_
+#define LIBECLIMQTTBRIDGE_H_
+
+/**********************************************************************/
+/*
+ * Config file: keys before the first section are bridge keys and the
+ * defaults of both sides, [local] and [remote] sections hold the client
+ * keys of each side. Topic maps:
+ *   bridge=filter [out|in|both] [qos] [local_prefix] [remote_prefix]
+ * a message on local_prefix + topic, topic matching filter, goes to the
+ * remote broker as remote_prefix + topic (out) and the other way (in),
+ * "" is an empty prefix. Each side is one connection, subscribed to the
+ * filters of its direction with their QoS (0 or 1).
+ * Outgoing messages are encoded once, as the PUBLISH packets to send, in
+ * a ring of bridge_buffer bytes (mapped from bridge_store when set, kept
+ * across restarts). The local thread appends to the ring and acks a
+ * local QoS 1 message once it is there; with the ring full it stops
+ * reading and the local broker holds the messages. The remote thread
+ * writes contiguous packets straight from the ring, up to
+ * BRIDGE_BATCH_SIZE bytes per write, without waiting for acks while
+ * less than bridge_inflight QoS 1 messages are unacked. Ring space is
+ * freed when QoS 0 packets are written and QoS 1 ones acked (in order);
+ * after an outage packets from the oldest unacked one are sent again.
+ * Incoming messages are published to the local broker with QoS 0,
+ * dropped over its send queue high watermark. Out and in filters must
+ * not overlap (a message would loop).
+ */
+#define BRIDGE_LOCAL_SECTION  "[local]"
+#define BRIDGE_REMOTE_SECTION "[remote]"
+#define BRIDGE_MAPS_MAX       32
+#define BRIDGE_BUFFER_DEFAULT 16777216  /* Ring bytes, 16MB */
+#define BRIDGE_INFLIGHT_DEFAULT 256     /* Unacked upstream QoS 1 */
+#define BRIDGE_INFLIGHT_MAX   4096
+#define BRIDGE_BATCH_SIZE     65536     /* Upstream bytes per write */
+#define BRIDGE_READ_SIZE      65536     /* Read buffer, grows up to a max packet */
+#define BRIDGE_ACKS_SIZE      4096      /* Acks sent after a read */
+#define BRIDGE_STORE_MAGIC    0x45424731  /* "EBG1" */
+
+/*Map directions*/
+typedef enum {
+    BRIDGE_OUT  = 1,
+    BRIDGE_IN   = 2,
+    BRIDGE_BOTH = 3,
+} ecli_bridge_dir;
+
+/**********************************************************************/
+/** Read bridge keys, maps and sides of cfg_file, broker and conf hold
+ * the defaults of both sides. Returns number of maps, -1 on error.
+ *
+ * @param cfg_file: bridge config file.
+ * @param broker: default client connection info (global keys).
+ * @param conf: default user config options (global keys).
+ *
+ */
+int32_t eclibridge_load(const char *cfg_file, ecli_broker_t *broker, ecli_conf_t *conf);
+
+/**********************************************************************/
+/** Bridge both sides until eclibridge_stop, then disconnect them.
+ *
+ */
+uint8_t eclibridge_run(void);
+
+/**********************************************************************/
+/** Stop bridge (async signal safe).
+ *
+ */
+void eclibridge_stop(void);
+
+#endif
@@ -0,0 +1,134 @@
+/***********************************************************************
+* FILENAME    :   libeclimqttbroker.h
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   Library header for the embedded MQTT broker (one epoll
+*                 loop, topic trie, QoS 0/1, retained and will messages).
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <stdint.h>
+
+/**********************************************************************/
+
+#include <libeclimqtt.h>
+
+/**********************************************************************/
+
+#ifndef LIBECLIMQTTBROKER_H_
+#define LIBECLIMQTTBROKER_H_
+
+/**********************************************************************/
+/*
+ * One thread serves every connection from one epoll loop. Sockets are
+ * read into one shared buffer; only a connection with a partial packet
+ * keeps bytes of its own, so an idle connection costs its connection and
+ * session structs. A published message is stored once (refcounted) and
+ * queued to its subscribers; queued packets of a connection go out with
+ * one writev per loop pass, so a fan-out of N costs N writevs, not N
+ * copies. Subscriptions and retained messages live in a topic trie: a
+ * level is found by hash (parent, level), + and # children are kept
+ * apart, so a publish visits only the nodes that can match it.
+ * QoS 1 publishes are acked with PUBACK, QoS 2 with PUBREC/PUBCOMP, and
+ * delivered with QoS up to 1 (SUBACK grants 0 or 1). Up to max_inflight
+ * QoS 1 messages wait for the PUBACK of a subscriber, the others are kept
+ * in order; sessions without clean session keep subscriptions, unacked
+ * and new QoS 1 messages while offline. QoS 0 messages over queue_bytes
+ * of a slow subscriber are dropped. The will of a connection closed
+ * without DISCONNECT (keep alive x 1.5, error, taken over) is published.
+ * With a TLS=OPENSSL build, tls_listen sockets do the TLS handshake in
+ * the same loop (non-blocking SSL_accept); session tickets let clients
+ * resume, and records go through kernel TLS when the tls module is there.
+ */
+#define BROKER_LISTEN_MAX     8
+#define BROKER_CONNS_DEFAULT  10000
+#define BROKER_QUEUE_DEFAULT  1048576   /* QoS 0 bytes queued per connection */
+#define BROKER_INFLIGHT_DEFAULT 32      /* Unacked QoS 1 per subscriber */
+#define BROKER_PENDING_DEFAULT 1000     /* QoS 1 waiting per session */
+#define BROKER_PACKET_DEFAULT ( MAX_MSG_SIZE + 1024 )
+#define BROKER_EVENTS         256       /* epoll events per wait */
+#define BROKER_READ_BUF       65536     /* Shared socket read buffer */
+#define BROKER_IOV_MAX        64        /* Queued packets per writev */
+#define BROKER_LEVELS_MAX     64        /* Topic levels */
+#define BROKER_CONNECT_TIMEOUT 10       /* secs from accept to CONNECT */
+#define BROKER_TLS_PORT_DEFAULT 8883
+
+/*Broker options*/
+typedef struct {
+    char     listen[CLI_HOSTNAME_LEN];            /* host,[IPv6],unix:/path,unix:@name */
+    uint16_t port;
+    uint32_t max_conns;
+    uint32_t queue_bytes;                         /* QoS 0 bytes queued per connection */
+    uint32_t max_inflight;                        /* Unacked QoS 1 per subscriber */
+    uint32_t max_pending;                         /* QoS 1 waiting per session */
+    uint32_t max_packet;                          /* Bigger packets close the connection */
+    char     log_file[CLI_PATH_LEN];
+    char     tls_listen[CLI_HOSTNAME_LEN];        /* TLS listen list, empty no TLS */
+    uint16_t tls_port;
+    char     tls_cert[CLI_PATH_LEN];              /* PEM certificate chain */
+    char     tls_key[CLI_PATH_LEN];               /* PEM key, empty key in tls_cert */
+} ecli_broker_conf_t;
+
+/*Broker counters*/
+typedef struct {
+    uint32_t conns;                               /* Connected now */
+    uint32_t conns_max;
+    uint32_t sessions;
+    uint32_t retained;
+    uint64_t accepted;
+    uint64_t msgs_in;                             /* PUBLISH received */
+    uint64_t msgs_out;                            /* PUBLISH queued to subscribers */
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t dropped;                             /* QoS 0 over queue, QoS 1 over pending */
+    uint64_t wills;
+} ecli_broker_stats_t;
+
+/**********************************************************************/
+/** Set default options.
+ *
+ * @param conf: broker options.
+ *
+ */
+void eclibroker_defaults(ecli_broker_conf_t *conf);
+
+/**********************************************************************/
+/** Set option from key and value, returns -1 when key is not known.
+ *
+ * @param conf: broker options.
+ * @param key: option key.
+ * @param value: option value.
+ *
+ */
+int8_t eclibroker_set(ecli_broker_conf_t *conf, const char *key, const char *value);
+
+/**********************************************************************/
+/** Open listening sockets, returns -1 on error.
+ *
+ * @param conf: broker options.
+ *
+ */
+int8_t eclibroker_init(const ecli_broker_conf_t *conf);
+
+/**********************************************************************/
+/** Serve connections until eclibroker_stop.
+ *
+ */
+uint8_t eclibroker_run(void);
+
+/**********************************************************************/
+/** Stop event loop (async signal safe).
+ *
+ */
+void eclibroker_stop(void);
+
+/**********************************************************************/
+/** Get broker counters.
+ *
+ * @param stats: counters output.
+ *
+ */
+void eclibroker_stats(ecli_broker_stats_t *stats);
+
+#endif
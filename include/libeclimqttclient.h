@@ -17,6 +17,18 @@
 
 #include <libeclimqttconf.h>
 #include <libeclimqttlog.h>
+#include <libeclimqttmetrics.h>
+#include <libeclimqtttrace.h>
+#include <libeclimqttnet.h>
+#include <libeclimqtttransport.h>
+#include <libeclimqttsendq.h>
+#include <libeclimqtttls.h>
+#include <libeclimqtturing.h>
+#include <libeclimqttcodec.h>
+#include <libeclimqtthash.h>
+#include <libeclimqttutf8.h>
+#include <libeclimqttpace.h>
+#include <libeclimqttlvc.h>
 
 /**********************************************************************/
 
@@ -27,8 +39,8 @@
 /* Max size in msg transer */
 #define CLI_MAX_MSG_SIZE     MAX_MSG_SIZE
 
-#define CLI_CFGLINE_LEN      128
-#define CLI_HOSTNAME_LEN     25
+#define CLI_CFGLINE_LEN      512
+#define CLI_HOSTNAME_LEN     256   /* Broker list: host[:port],... */
 #define CLI_CLIENTID_LEN     255
 #define CLI_USERNAME_LEN     13
 #define CLI_PASSWORD_LEN     13
@@ -49,6 +61,7 @@
 #define CLI_MSG_TYPE( packet_buffer ) ( ( *packet_buffer & 0xF0 ) )
 #define CLI_QOS_TYPE( packet_buffer ) ( ( *packet_buffer & 0x06 ) >> 1 )
 #define CLI_MSG_QOS( packet_buffer )  ( ( *packet_buffer & 0x06 ) >> 1 )
+#define CLI_MSG_RETAIN( packet_buffer ) ( *packet_buffer & 0x01 )
 
 /**********************************************************************/
 /*Msg types*/
@@ -57,6 +70,24 @@ typedef enum {
     CLI_DATAFILE_MSG,
 } ecli_msg_type;
 
+/*Stream input record formats*/
+typedef enum {
+    CLI_STREAM_NONE = 0,
+    CLI_STREAM_LINE,
+    CLI_STREAM_LINE_TOPIC,
+    CLI_STREAM_LEN,
+    CLI_STREAM_LEN_TOPIC,
+} ecli_stream_mode;
+
+/*Subscriber output sinks*/
+typedef enum {
+    CLI_SINK_NONE = 0,
+    CLI_SINK_NDJSON,
+    CLI_SINK_LEN,
+    CLI_SINK_FILES,
+    CLI_SINK_SHM,
+} ecli_sink_mode;
+
 /*Error types*/
 typedef enum {
     CLI_NO_ERROR = 0,
@@ -93,7 +124,10 @@ typedef enum {
     CLI_IDEN_REJEC,               /** Identifier rejected CONNACK*/
     CLI_SERVER_UNAVAI,            /** Server unavailable CONNACK*/
     CLI_USER_PASS_BAD,            /** Bad user name or password CONNACK*/
-    CLI_NOT_AUTH                  /** Not authorized CONNACK*/
+    CLI_NOT_AUTH,                 /** Not authorized CONNACK*/
+    CLI_TLS_ERROR,                /** TLS handshake failed*/
+    CLI_TOPIC_ERROR,              /** Topic or filter not valid UTF-8, wildcards misused*/
+    CLI_UTF8_ERROR                /** Text payload not valid UTF-8*/
 } ecli_conn_msg;
 
 /**********************************************************************/
@@ -115,21 +149,65 @@ typedef struct {
     uint16_t sequence;                            /* Management */
     uint16_t alive;                               /* Management */
     uint16_t msg_id;                              /* Management */
-    int32_t  socketid;                            /* Conn data */
-    uint32_t (*send_data)(uint32_t socketid, const void* buffer, int32_t count);
+    ecli_transport_t transport;                   /* Conn data: tcp, tls, unix */
+    ecli_sendq_t sendq;                           /* Outbound bytes the socket did not take */
+    ecli_metrics_t *metrics;                      /* Counters & histograms */
+    uint8_t  *connect_packet;                     /* Cached CONNECT packet */
+    uint32_t connect_len;                         /* Cached CONNECT len */
+    uint8_t  session_present;                     /* Last CONNACK session present */
+    uint8_t  rx_buffer[CLI_BUF_SIZE];             /* Bytes read past last packet */
+    uint32_t rx_pending;                          /* rx_buffer bytes */
 } ecli_broker_t;
 
 /*User Configuration structure*/
 typedef struct {
-    char     broker_hostname[CLI_HOSTNAME_LEN]; /* Broker Hostname */
+    char     broker_hostname[CLI_HOSTNAME_LEN]; /* Broker list */
     char     msg_txt[CLI_MSG_LEN];              /* Text Message */
     char     datafile_path[CLI_PATH_LEN];       /* File Path */
+    char     log_file[CLI_PATH_LEN];            /* Log File Path */
+    char     metrics_file[CLI_PATH_LEN];        /* Metrics dump File Path */
+    uint32_t metrics_interval;                    /* Metrics dump period secs */
+    ecli_metrics_fmt metrics_fmt;                 /* Metrics dump format */
+    char     trace_file[CLI_PATH_LEN];          /* Chrome trace File Path */
     uint8_t  client_loop_flg;                     /* Read in a Loop - Flag */
     uint8_t  publish_online_flg;                  /* Publish Online message when first connect */
     uint8_t  ack_flg;                             /* ack flag */
     uint8_t  packet_buffer[CLI_BUF_SIZE];       /* Packet buffer part */
     uint16_t broker_port;                         /* Broker Port */
     int16_t persist_conn_time;                    /* Conn persistence time */
+    uint32_t connect_timeout;                     /* Connect timeout msecs, 0 no timeout */
+    uint32_t backoff_base;                        /* Reconnect backoff first window msecs */
+    uint32_t backoff_max;                         /* Reconnect backoff max window msecs */
+    uint32_t connect_stagger;                     /* Parallel connect attempts delay msecs */
+    uint32_t dns_refresh;                         /* Broker names refresh period secs */
+    uint8_t  tls;                                 /* Use TLS transport */
+    ecli_tls_conf_t tls_conf;                     /* TLS files & verification */
+    uint8_t  io_uring;                            /* Use io_uring I/O */
+    uint32_t uring_batch;                         /* Queued packets per io_uring submission */
+    uint32_t uring_flush_us;                      /* Max usecs a packet waits in the batch */
+    ecli_codec_conf_t codec_conf;                 /* Payload compression */
+    uint8_t  file_chunked;                        /* Resumable chunked file transfer */
+    uint32_t file_jobs;                           /* Sessions sending chunks */
+    uint32_t file_linger;                         /* Secs serving resume requests */
+    uint8_t  file_delta;                          /* Delta transfer of repeated file publishes */
+    uint32_t file_delta_key;                      /* Secs between full versions of a delta file */
+    ecli_hash_t checksum;                         /* Payload checksum trailer */
+    double   publish_rate;                        /* Loop msgs/sec, 0 no pacing */
+    uint32_t publish_burst;                       /* Msgs back to back when behind */
+    uint32_t publish_report;                      /* Secs between pace reports */
+    ecli_stream_mode stream_mode;                 /* Records from stdin, one connection */
+    ecli_sink_mode output_sink;                   /* Sub output written by a thread */
+    uint32_t sink_queue;                          /* Sink queue bytes */
+    uint32_t sendq_high;                          /* Send queue watermarks, bytes */
+    uint32_t sendq_low;
+    ecli_sendq_drop sendq_drop;                   /* QoS 0 drops over high watermark */
+    uint32_t sendq_lowat;                         /* TCP unsent bytes kept by kernel, 0 no limit */
+    uint32_t series;                              /* Samples per aggregated block, 0 no aggregation */
+    uint32_t series_ms;                           /* Block window msecs */
+    uint64_t lvc_size;                            /* Last value cache bytes, 0 no cache */
+    uint8_t  utf8_payload;                        /* Text payloads must be UTF-8 */
+    char     shm_name[CLI_PATH_LEN];              /* Shared memory ring of shm sink */
+    uint64_t shm_size;                            /* Shared memory ring bytes */
     ecli_msg_type  msg_type;                     /* Message Type (File or Txt)*/
 } ecli_conf_t;
 
@@ -143,6 +221,29 @@ typedef struct {
  */
 void ecli_get_conf( ecli_broker_t *broker, ecli_conf_t *conf, int argc, char* argv[] );
 
+/**********************************************************************/
+/** Set one config option from its key and value, returns -1 when key
+ * is not known.
+ *
+ * @param broker: structure that contains the client connection info with broker
+ * @param conf: structure that contains the user config options for broker conn.
+ * @param key: option name.
+ * @param value: option value.
+ *
+ */
+int8_t ecli_set_conf( ecli_broker_t *broker, ecli_conf_t *conf, const char *key, const char *value );
+
+/**********************************************************************/
+/** Get Key Value of line from Config file, empty key for blank and
+ * comment lines
+ *
+ * @param line: config line, changed.
+ * @param key: key return name
+ * @param value: return value
+ *
+ */
+void ecli_conf_value( char *line, char *key, char *value );
+
 /**********************************************************************/
 /** Set connection data & options
  *
@@ -153,14 +254,47 @@ void ecli_get_conf( ecli_broker_t *broker, ecli_conf_t *conf, int argc, char* ar
 uint8_t ecli_init( ecli_broker_t *broker, ecli_conf_t *conf );
 
 /**********************************************************************/
-/** Send packet function
+/** Get next reconnection delay, exponential backoff with full jitter
  *
- * @param socketid: socket id / file descriptor
+ * @param conf: structure that contains the user config options for broker conn.
+ * @param attempt: failed attempts so far
+ *
+ */
+uint32_t ecli_backoff_msecs( const ecli_conf_t *conf, uint32_t attempt );
+
+/**********************************************************************/
+/** Send packet to broker after queued ones, recording packet metrics.
+ * Returns count when written or queued, -1 on error.
+ *
+ * @param broker: structure that contains the client connection info with broker
  * @param buffer: packet buffer.
  * @param count: size of packet.
  *
  */
-uint32_t ecli_send( uint32_t socketid, const void* buffer, int32_t count );
+int32_t ecli_send_packet( ecli_broker_t *broker, const void* buffer, int32_t count );
+
+/**********************************************************************/
+/** Send packet in parts (gather, no copy), recording packet metrics.
+ *
+ * @param broker: structure that contains the client connection info with broker
+ * @param iov: packet parts, first one starts with fixed header.
+ * @param iovcnt: number of parts.
+ *
+ */
+int32_t ecli_sendv_packet( ecli_broker_t *broker, const struct iovec *iov, int32_t iovcnt );
+
+/**********************************************************************/
+/** Send packet with payload read from file, recording packet metrics.
+ *
+ * @param broker: structure that contains the client connection info with broker
+ * @param header: packet header (fixed & var header).
+ * @param header_len: size of header.
+ * @param fd: file descriptor, read from current offset.
+ * @param count: file bytes to send.
+ *
+ */
+int32_t ecli_send_file_packet( ecli_broker_t *broker, const void* header, int32_t header_len,
+                               int32_t fd, uint32_t count );
 
 /**********************************************************************/
 /** Read mqtt header from packet
@@ -176,6 +310,7 @@ uint32_t ecli_read_header( ecli_broker_t *broker, ecli_conf_t *conf );
 *
 * @param broker: structure that contains the client connection info with broker
 * @param conf: structure that contains the user config options for broker conn.
+* @param msg_buffer: payload output, CLI_MAX_MSG_SIZE bytes for CLI_DATAFILE_MSG, MAX_TXT_MSG_SIZE else
 *
 */
 uint32_t ecli_read_get_msg( ecli_broker_t *broker, ecli_conf_t *conf,
@@ -190,6 +325,16 @@ uint32_t ecli_read_get_msg( ecli_broker_t *broker, ecli_conf_t *conf,
 */
 uint8_t ecli_close(ecli_broker_t *broker);
 
+/**********************************************************************/
+/** Release what a connection keeps between reconnections: broker list
+* (and its resolver thread) and cached CONNECT. Call it once, after the
+* last ecli_close, on the broker that created the list.
+*
+* @param broker: structure that contains the client connection info with broker
+*
+*/
+void ecli_release(ecli_broker_t *broker);
+
 /**********************************************************************/
 /** Show message according to error
 *
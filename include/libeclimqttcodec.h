@@ -0,0 +1,121 @@
+/***********************************************************************
+* FILENAME    :   libeclimqttcodec.h
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   Library header for payload compression (LZ4, zstd and
+*                 zstd with trained dictionary).
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <stdint.h>
+
+/**********************************************************************/
+
+#ifndef LIBECLIMQTTCODEC_H_
+#define LIBECLIMQTTCODEC_H_
+
+/**********************************************************************/
+/*
+ * liblz4 / libzstd are loaded with dlopen when a codec is selected, the
+ * build does not need their headers and targets without them only lose
+ * compression. A compressed payload starts with a small header:
+ *   byte 0    : CODEC_MAGIC
+ *   byte 1    : CODEC_TAG | codec
+ *   byte 2..5 : original size, MQTT remaining length encoding (1-4 bytes)
+ * Payloads below the topic threshold, or that do not get smaller, are
+ * sent raw.
+ */
+#define CODEC_MAGIC           0xEC
+#define CODEC_TAG             0xC0
+#define CODEC_TAG_MASK        0xF0
+#define CODEC_HEADER_MAX      6
+#define CODEC_MIN_DEFAULT     64        /* bytes, smaller payloads sent raw */
+#define CODEC_LEVEL_DEFAULT   3         /* zstd level (lz4 acceleration 1) */
+#define CODEC_MAX_RULES       16        /* Per topic thresholds */
+#define CODEC_TOPIC_LEN       256
+#define CODEC_PATH_LEN        510
+#define CODEC_DICT_SIZE       16384     /* Trained dictionary max size */
+#define CODEC_TRAIN_SAMPLES   512       /* Payloads collected to train */
+#define CODEC_LZ4_LIB         "liblz4.so.1"
+#define CODEC_ZSTD_LIB        "libzstd.so.1"
+
+/**********************************************************************/
+/*Codecs, id on the wire*/
+typedef enum {
+    CODEC_NONE = 0,
+    CODEC_LZ4,
+    CODEC_ZSTD,
+    CODEC_ZSTD_DICT,                        /* zstd with dict_file */
+    CODEC_TRAIN                             /* Subscriber: collect payloads, write dict_file */
+} ecli_codec_t;
+
+/*Compression configuration*/
+typedef struct {
+    ecli_codec_t codec;                     /* Publisher codec, subscriber decodes any */
+    int32_t  level;                         /* zstd compression level */
+    uint32_t min_size;                      /* Threshold of topics without rule */
+    char     dict_file[CODEC_PATH_LEN];     /* zstd dictionary (optional) */
+} ecli_codec_conf_t;
+
+/**********************************************************************/
+/** Get codec from name ("lz4", "zstd", "train", "none").
+ *
+ * @param name: codec name.
+ *
+ */
+ecli_codec_t eclicodec_from_name(const char *name);
+
+/**********************************************************************/
+/** Add size threshold for topics matching filter, payloads smaller are
+ * sent raw. First matching rule is used.
+ *
+ * @param rule: "topic/filter/+/# min_bytes".
+ *
+ */
+int8_t eclicodec_rule(const char *rule);
+
+/**********************************************************************/
+/** Load codec libraries and dictionary.
+ *
+ * @param conf: compression configuration.
+ *
+ */
+int8_t eclicodec_init(const ecli_codec_conf_t *conf);
+
+/**********************************************************************/
+/** Compress payload of topic, returns compressed size with header or 0
+ * when it has to be sent raw (threshold, no gain, codec error).
+ *
+ * @param topic: publish topic.
+ * @param in: payload.
+ * @param len: payload size.
+ * @param out: output buffer, len bytes.
+ *
+ */
+uint32_t eclicodec_compress(const char *topic, const uint8_t *in, uint32_t len, uint8_t *out);
+
+/**********************************************************************/
+/** Decompress payload, returns original size, 0 when payload is not
+ * compressed (deliver as is) or -1 on error.
+ *
+ * @param in: payload.
+ * @param len: payload size.
+ * @param out: output buffer.
+ * @param out_size: output buffer size.
+ *
+ */
+int32_t eclicodec_decompress(const uint8_t *in, uint32_t len, uint8_t *out, uint32_t out_size);
+
+/**********************************************************************/
+/** Collect payload to train dictionary, when CODEC_TRAIN_SAMPLES are
+ * collected the dictionary is written to dict_file. Returns 1 when
+ * written, 0 collecting, -1 on error.
+ *
+ * @param in: payload.
+ * @param len: payload size.
+ *
+ */
+int8_t eclicodec_train(const uint8_t *in, uint32_t len);
+
+#endif
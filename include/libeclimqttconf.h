@@ -41,11 +41,28 @@
 #define CFG_FILE_FLAG_DEFAULT FALSE_FLAG
 #define BROKER_PORT_DEFAULT   1883
 #define PERSIST_CON_DEFAULT   0
+#define TLS_DEFAULT           FALSE_FLAG
+#define TLS_VERIFY_DEFAULT    TRUE_FLAG
+#define IO_URING_DEFAULT      FALSE_FLAG
+#define FILE_CHUNKED_DEFAULT  FALSE_FLAG
+#define FILE_JOBS_DEFAULT     1         /* Sessions sending chunks */
+#define FILE_JOBS_MAX         16
+#define FILE_LINGER_DEFAULT   30        /* secs serving resume requests */
+#define FILE_DELTA_DEFAULT    FALSE_FLAG
+#define FILE_DELTA_KEY_DEFAULT 30       /* secs between full versions of a delta file */
+#define SINK_QUEUE_DEFAULT    8388608   /* Sub output sink queue bytes, 8MB */
+#define SERIES_MS_DEFAULT     1000      /* Aggregated block window msecs */
+#define SHM_NAME_DEFAULT      "/ecli_mqtt"
+#define SHM_SIZE_DEFAULT      16777216  /* Shared memory ring bytes, 16MB */
+#define LISTEN_DEFAULT        "0.0.0.0" /* Broker listen list */
+#define CONNECT_TIMEOUT_DEFAULT 3000    /* msecs */
+#define BACKOFF_BASE_DEFAULT  100       /* msecs, first reconnection window */
+#define BACKOFF_MAX_DEFAULT   30000     /* msecs, max reconnection window */
 /* bytes (MQTT support up to 256Mb)*/
 //#define MAX_MSG_SIZE          268435456  /* 256MB for File messages */
 #define MAX_MSG_SIZE          4194304   /* 4MB for File messages */
 #define MAX_TXT_MSG_SIZE      1024      /* 1KB for Text messages */
-#define MAX_CHUNK_SIZE        102400    /* 100KB for chunk to transfer a file*/
+#define MAX_CHUNK_SIZE        1048576   /* 1MB max chunk to transfer a file*/
 /*Config File IDs*/
 #define BROKER_IP_ID          "broker_ip"
 #define BROKER_PORT_ID        "broker_port"
@@ -69,19 +86,136 @@
 #define ONLINE_MSG_ID         "publish_first_online"
 #define PERSIST_CON_ID        "persist_conn_time"
 #define FILE_TRANS_ID         "file_trans"
+#define LOG_FILE_ID           "log_file"
+#define METRICS_FILE_ID       "metrics_file"
+#define METRICS_INTERVAL_ID   "metrics_interval"
+#define METRICS_FORMAT_ID     "metrics_format"
+#define TRACE_FILE_ID         "trace_file"
+#define CONNECT_TIMEOUT_ID    "connect_timeout"
+#define BACKOFF_BASE_ID       "backoff_base"
+#define BACKOFF_MAX_ID        "backoff_max"
+#define CONNECT_STAGGER_ID    "connect_stagger"
+#define DNS_REFRESH_ID        "dns_refresh"
+#define TLS_ID                "tls"
+#define TLS_CA_ID             "tls_ca"
+#define TLS_CERT_ID           "tls_cert"
+#define TLS_KEY_ID            "tls_key"
+#define TLS_VERIFY_ID         "tls_verify"
+#define TLS_SESSION_ID        "tls_session_file"
+#define IO_URING_ID           "io_uring"
+#define URING_BATCH_ID        "uring_batch"
+#define URING_FLUSH_US_ID     "uring_flush_us"
+#define COMPRESS_ID           "compress"
+#define COMPRESS_LEVEL_ID     "compress_level"
+#define COMPRESS_MIN_ID       "compress_min"
+#define COMPRESS_DICT_ID      "compress_dict"
+#define COMPRESS_TOPIC_ID     "compress_topic"
+#define FILE_CHUNKED_ID       "file_chunked"
+#define FILE_JOBS_ID          "file_jobs"
+#define FILE_LINGER_ID        "file_linger"
+#define FILE_DELTA_ID         "file_delta"
+#define FILE_DELTA_KEY_ID     "file_delta_key"
+#define CHECKSUM_ID           "checksum"
+#define PUBLISH_RATE_ID       "publish_rate"
+#define PUBLISH_BURST_ID      "publish_burst"
+#define PUBLISH_REPORT_ID     "publish_report"
+#define STREAM_ID             "stream"
+/* Stream record formats */
+#define STREAM_LINE_NAME      "line"
+#define STREAM_LINE_TOPIC_NAME "line+topic"
+#define STREAM_LEN_NAME       "len"
+#define STREAM_LEN_TOPIC_NAME "len+topic"
+#define OUTPUT_SINK_ID        "output_sink"
+#define SINK_QUEUE_ID         "sink_queue"
+/* Sub output sinks */
+#define SINK_NDJSON_NAME      "ndjson"
+#define SINK_LEN_NAME         "len"
+#define SINK_FILES_NAME       "files"
+#define SINK_SHM_NAME         "shm"
+#define SENDQ_HIGH_ID         "sendq_high"
+#define SENDQ_LOW_ID          "sendq_low"
+#define SENDQ_DROP_ID         "sendq_drop"
+#define SENDQ_LOWAT_ID        "sendq_lowat"
+#define LANE_TOPIC_ID         "lane_topic"
+#define LANE_RATE_ID          "lane_rate"
+#define SERIES_ID             "series"
+#define SERIES_MS_ID          "series_ms"
+#define LVC_SIZE_ID           "lvc_size"
+#define UTF8_PAYLOAD_ID       "utf8_payload"
+#define SHM_NAME_ID           "shm_name"
+#define SHM_SIZE_ID           "shm_size"
+/* Broker keys */
+#define LISTEN_ID             "listen"
+#define LISTEN_PORT_ID        "listen_port"
+#define MAX_CONNS_ID          "max_conns"
+#define QUEUE_BYTES_ID        "queue_bytes"
+#define MAX_INFLIGHT_ID       "max_inflight"
+#define MAX_PENDING_ID        "max_pending"
+#define MAX_PACKET_ID         "max_packet"
+#define TLS_LISTEN_ID         "tls_listen"
+#define TLS_LISTEN_PORT_ID    "tls_listen_port"
+/* Send queue QoS 0 drop policies */
+#define SENDQ_NONE_NAME       "none"
+#define SENDQ_OLDEST_NAME     "oldest"
+#define SENDQ_NEWEST_NAME     "newest"
+/* Sessions runner keys ([session] sections) */
+#define SESSION_WORKERS_ID    "workers"
+#define SESSION_MODE_ID       "mode"
+#define SESSION_COUNT_ID      "count"
+#define SESSION_FIRST_ID      "first"
+#define SESSION_MSG_ID        "message"
+#define SESSION_PUB_NAME      "pub"
+#define SESSION_SUB_NAME      "sub"
+/* Bridge keys */
+#define BRIDGE_ID             "bridge"
+#define BRIDGE_BUFFER_ID      "bridge_buffer"
+#define BRIDGE_STORE_ID       "bridge_store"
+#define BRIDGE_INFLIGHT_ID    "bridge_inflight"
+#define BRIDGE_OUT_NAME       "out"
+#define BRIDGE_IN_NAME        "in"
+#define BRIDGE_BOTH_NAME      "both"
+#define BRIDGE_EMPTY_NAME     "\"\""
 /* Messages */
-#define CONN_TRY_MSG          "-- Trying to connect to broker server %s:%d..."
-#define CONNECTED_MSG          "Connected with broker %s:%d."
+#define CONN_TRY_MSG          "-- Trying to connect to broker servers [%s]..."
+#define CONNECTED_MSG          "Connected with broker %s (%s)."
+#define CONN_BACKOFF_MSG      "Waiting %u msecs before reconnecting..."
+#define SESS_PRESENT_MSG      "Session present, subscriptions kept by broker."
 #define CFG_FILE_MSG          "Using Config File [%s]..."
 #define TOPIC_MSG             "Topic: [%s] - "
 #define MSG_LEN_MSG           "Message Len: [%d] - "
 #define DATA_MSG              "Data: [ File ]"
+#define COMPRESSED_MSG        "Compressed [%u] to [%u] bytes"
 #define MESSAGE_MSG           "Message: [%s]"
 #define PUBLISH_MSG           "Publishing..."
 #define PUB_PKTLEN_MSG        "Packet Len [%d] bytes"
 #define PUB_MSGLEN_MSG        "Message Len [%d] bytes"
 #define PUBLISHED_MSG         "Published: Packet Len [%d] bytes"
 #define PING_MSG              "Sending Ping..."
+#define URING_FALLBACK_MSG    "io_uring not available, using socket I/O"
+#define URING_TLS_MSG         "io_uring not used with TLS, using socket I/O"
+#define FILE_SEND_MSG         "Sending file [%s] [%llu] bytes from [%u] sessions"
+#define FILE_SENT_MSG         "File [%s] sent: [%llu] bytes published in [%.2f] secs ([%.2f] MB/s)"
+#define FILE_RESEND_MSG       "Resending [%u] missing ranges"
+#define FILE_LINGER_MSG       "No resume request in [%u] secs, stop serving file"
+#define FILE_RESUME_MSG       "Resuming file [%s]: [%u] of [%u] blocks missing"
+#define FILE_DONE_MSG         "File [%s] received: [%llu] bytes"
+#define DELTA_MSG             "Delta: [%u] of [%u] chunks sent, [%u] of [%llu] bytes"
+#define DELTA_APPLY_MSG       "Delta: [%u] of [%u] chunks received, [%u] bytes for a [%llu] bytes file"
+#define DELTA_SKIP_MSG        "Delta: file unchanged, not published"
+#define PACE_MSG              "Pace: [%llu] msgs in [%.2f] secs, [%.1f] msgs/s of [%.1f], jitter p50 [%.1f] p99 [%.1f] max [%.1f] usecs"
+#define PACE_END_MSG          "Pace total: [%llu] msgs in [%.2f] secs, [%.1f] msgs/s of [%.1f], jitter p50 [%.1f] p99 [%.1f] max [%.1f] usecs"
+#define STREAM_MSG            "Stream: [%llu] messages, [%llu] bytes published in [%.2f] secs ([%.0f] msgs/s)"
+#define STREAM_FLUSH_MSG      "Stream: [%u] messages sent in [%u] bytes"
+#define SERIES_MSG            "Series: [%llu] samples in [%llu] blocks, [%llu] bytes for [%llu] sample bytes"
+#define SESSION_LOAD_MSG      "Sessions: [%u] sessions from [%u] sections, [%u] workers"
+#define SESSION_END_MSG       "Sessions: [%u] connected at stop, [%llu] reconnects, [%llu] published, [%llu] held (send queue full), [%llu] received"
+#define SESSION_RECV_MSG      "Session [%s]: message on [%s], [%u] bytes"
+#define BRIDGE_LOAD_MSG       "Bridge: [%u] maps, [%llu] bytes buffer, [%llu] bytes kept from last run"
+#define BRIDGE_UP_MSG         "Bridge: %s broker connected"
+#define BRIDGE_END_MSG        "Bridge: [%llu] received, [%llu] forwarded, [%llu] bytes buffered, [%llu] inbound, [%llu] dropped, [%llu] remote reconnects"
+#define BROKER_LISTEN_MSG     "Broker listening on %s"
+#define BROKER_TLS_LISTEN_MSG "Broker listening on %s (TLS)"
+#define BROKER_END_MSG        "Broker: [%u] connected at stop (max [%u]), [%u] sessions, [%u] retained, [%llu] accepted, [%llu] published, [%llu] delivered, [%llu] dropped, [%llu] wills"
 #define SIGINT_MSG            "Closed by SIGNAl %d"
 /* Error Msg */
 #define UNKNOW_OPT_ERROR      "Unknown option character %c"
@@ -111,7 +245,50 @@
 #define SUB_MSGID_ERROR       "Error SUBACK reading Msg ID - Subscribing to Broker : %s"
 #define READ_SIZE_ERROR       "Error - Reading a message bigger than limit"
 #define UNKNOW_ERROR          "Unknown error: %s"
+#define NO_MEM_ERROR          "Error - Out of memory"
+#define TLS_INIT_ERROR        "Error - TLS setup failed (build with TLS=OPENSSL)"
+#define CODEC_INIT_ERROR      "Error - Compression setup failed (liblz4 / libzstd, dictionary file)"
+#define CODEC_RULE_ERROR      "Error - compress_topic needs \"topic/filter min_bytes\""
+#define CODEC_ERROR           "Error - Payload decompression failed, delivered as received: %s"
+#define TLS_ERROR             "Error - TLS handshake with broker failed: %s"
+#define FILE_CRC_ERROR        "Error - File chunk at [%llu] rejected (CRC, bounds), will be requested again"
+#define FILE_STATE_ERROR      "Error - File transfer state [%s]: %s"
+#define DELTA_ERROR           "Error - Delta file message malformed, dropped"
+#define CHECKSUM_ERROR        "Error - Payload checksum failed on topic [%s], message dropped"
+#define TOPIC_ERROR           "Error - Topic is not valid UTF-8 or misuses wildcards (+ and # only as whole levels, # last)"
+#define UTF8_ERROR            "Error - Text payload is not valid UTF-8 (utf8_payload=1)"
+#define TOPIC_RECV_ERROR      "Error - Received topic is not valid UTF-8 or has wildcards, message dropped"
+#define UTF8_RECV_ERROR       "Error - Text payload on topic [%s] is not valid UTF-8, message dropped"
+#define DELTA_MISS_ERROR      "Error - Delta file chunk missing, waiting for a full version of the file"
 #define OPEN_FILE_ERROR       "Error - Opening file"
+#define STREAM_MODE_ERROR     "Error - Stream format must be line, line+topic, len or len+topic"
+#define STREAM_RECORD_ERROR   "Error - Stream record malformed (topic, length, UTF-8), skipped"
+#define SINK_MODE_ERROR       "Error - Output sink must be ndjson, len, files or shm"
+#define SINK_WRITE_ERROR      "Error - Output sink write to %s failed: %s"
+#define SHM_OPEN_ERROR        "Error - Shared memory ring %s: %s"
+#define SHM_BIG_ERROR         "Error - Message of %s over a quarter of shared memory ring, not written"
+#define SENDQ_DROP_ERROR      "Error - Send queue drop policy must be none, oldest or newest"
+#define LANE_TOPIC_ERROR      "Error - lane_topic needs \"topic/filter alarm|telemetry|bulk\""
+#define LANE_RATE_ERROR       "Error - lane_rate needs \"control|alarm|telemetry|bulk bytes_per_sec\""
+#define SERIES_BLOCK_ERROR    "Error - Series block malformed on topic [%s], rest of it skipped"
+#define URING_SESSION_ERROR   "Error - io_uring (-U, io_uring=1) not supported by sessions, their workers share no ring"
+#define URING_FILE_ERROR      "Error - io_uring (-U, io_uring=1) not supported with -F, chunks go from parallel sessions"
+#define LATENCY_ARGS_ERROR    "Error - -N over 0, -G from %d to %d bytes"
+#define LATENCY_URING_ERROR   "Error - io_uring (-U, io_uring=1) not supported by the latency probe"
+#define SERIES_STREAM_ERROR   "Error - series= aggregates stream publish (-s) only, set series=0 or publish with -s"
+#define SESSION_NONE_ERROR    "Error - No [session] sections in %s"
+#define SESSION_MODE_ERROR    "Error - Session mode must be pub or sub"
+#define SESSION_KEY_ERROR     "Error - Unknown key [%s] in session section %u"
+#define BRIDGE_MAP_ERROR      "Error - bridge needs \"topic/filter [out|in|both] [qos] [local_prefix] [remote_prefix]\""
+#define BRIDGE_NONE_ERROR     "Error - No bridge maps in %s"
+#define BRIDGE_KEY_ERROR      "Error - Unknown key [%s] in bridge section %s"
+#define BRIDGE_STORE_ERROR    "Error - Bridge store %s: %s"
+#define BRIDGE_BIG_ERROR      "Error - Message of %s over a quarter of bridge buffer, dropped"
+#define BRIDGE_SUB_ERROR      "Error - %s broker refused subscription to [%.*s]"
+#define BROKER_LISTEN_ERROR   "Error - Broker listen on %s: %s"
+#define BROKER_KEY_ERROR      "Error - Unknown broker key [%s]"
+#define BROKER_TLS_ERROR      "Error - Broker TLS listener needs TLS=OPENSSL build, tls_cert and tls_key: %s"
+#define PACE_RATE_ERROR       "Error - Publish rate must be a number of msgs/sec over 0"
 #define READ_TIMEOUT_ERROR    "Reading message Timeout..."
 #define CONN_SESS_PRE         "Warning - Session present CONNACK"    /*Connection shall be established*/
 #define UKNOW_FLAG_CONN       "Error - Unknown case CONNACK"
@@ -126,7 +303,8 @@
  Publisher Usage: \n\n \
        ecli_mqtt_pub -option value -flag\n\n\
             Options:\n\n\
-              -b : Broker IP (default %s)\n\
+              -b : Broker list host[:port],[IPv6]:port,... first reachable and fastest is used,\n\
+                   or unix:/path (unix:@name abstract) for a broker on this host (default %s)\n\
               -p : Broker Port (default %d)\n\
               -u : Broker Username (default %s)\n\
               -k : Broker Password (default %s)\n\
@@ -140,20 +318,38 @@
               -T : Will Topic (default %s)\n\
               -M : Will Message (default %s)\n\
               -P : Time in seconds to wait connect to broker (default %d secs)\n\
+              -L : Log file, written by a background thread (default no log file)\n\
+              -x : Metrics dump file, written periodically and on SIGUSR1 (default no metrics dump)\n\
+              -Z : Chrome trace JSON file, needs TRACE=CHROME build (default no trace)\n\
+              -e : Connect timeout in milliseconds, 0 waits forever (default %d msecs)\n\
+              -A : CA file to verify broker certificate with -S (default system CA)\n\
+              -z : Compress payloads [ lz4 | zstd ], raw when not smaller (default no compression)\n\
+              -D : zstd dictionary file for -z zstd (default no dictionary)\n\
+              -j : Sessions sending chunks in parallel with -F (default %d, max %d)\n\
+              -K : Append payload checksum [ crc32c | xxh3 ] (default no checksum)\n\
+              -n : Publish rate in msgs/sec with -l, achieved rate and jitter reported (default no pacing)\n\
+              -B : Messages sent back to back with -n when behind schedule (default %d)\n\
+              -s : Publish records read from stdin over one connection [ line | line+topic | len | len+topic ]\n\
+                   (line+topic: topic<TAB>payload, len: 4 bytes big endian payload len) (default no stream)\n\
               -h : Show help\n\n\
             Flags:\n\n\
               -l : flag to publish messages in loop (default no loop)\n\
               -f : Select file transfer flag (default no file transfer)\n\
+              -F : Resumable chunked file transfer flag, file from -m (default no chunked transfer)\n\
+              -d : Delta file transfer flag with -f, only changed parts are sent (default full file)\n\
               -r : Retain publish flag (default no retain)\n\
               -R : Retain connection flag (default no retain)\n\
               -W : Will connection flag (default no flag)\n\
               -C : Clean Session connection flag (default no clean session)\n\
+              -S : TLS connection flag, needs TLS=OPENSSL build (default no TLS)\n\
+              -U : io_uring I/O flag, batches sends and falls back to sockets on old kernels (default socket I/O)\n\
               -O : First Online Message flag (default no no online retain message)\n\
  \n\n\
  Subscriber Usage: \n\n \
        ecli_mqtt_sub -option value -flag \n\n\
             Options:\n\n\
-              -b : Broker IP (default %s)\n\
+              -b : Broker list host[:port],[IPv6]:port,... first reachable and fastest is used,\n\
+                   or unix:/path (unix:@name abstract) for a broker on this host (default %s)\n\
               -p : Broker Port (default %d)\n\
               -u : Broker Username (default %s)\n\
               -k : Broker Password (default %s)\n\
@@ -166,13 +362,27 @@
               -T : Will Topic (default %s)\n\
               -M : Will Message (default %s)\n\
               -P : Time in seconds to wait connect to broker (default %d secs)\n\
+              -L : Log file, written by a background thread (default no log file)\n\
+              -x : Metrics dump file, written periodically and on SIGUSR1 (default no metrics dump)\n\
+              -Z : Chrome trace JSON file, needs TRACE=CHROME build (default no trace)\n\
+              -e : Connect timeout in milliseconds, 0 waits forever (default %d msecs)\n\
+              -A : CA file to verify broker certificate with -S (default system CA)\n\
+              -z : Decompress payloads [ lz4 | zstd ], or train to write -D dictionary (default no decompression)\n\
+              -D : zstd dictionary file (default no dictionary)\n\
+              -K : Check and remove payload checksum [ crc32c | xxh3 ], drop messages that fail (default no check)\n\
+              -w : Output sink written by a thread [ ndjson | len | files | shm ], ndjson and len to stdout,\n\
+                   files to -o directory/topic, shm to shared memory ring shm_name= (default print messages)\n\
               -h : Show help\n\n\
             Flags:\n\n\
               -l : flag to read messages in loop (default no loop)\n\
               -f : Select file receive flag (default no file receive)\n\
+              -F : Resumable chunked file receive flag, to -o, exits when complete (default no chunked receive)\n\
+              -d : Delta file receive flag with -f, rebuilds the file from changed parts (default full file)\n\
               -R : Retain connection flag (default no retain)\n\
               -W : Will connection flag (default no flag)\n\
               -C : Clean Session connection flag (default no clean session)\n\
+              -S : TLS connection flag, needs TLS=OPENSSL build (default no TLS)\n\
+              -U : io_uring I/O flag, batches sends and falls back to sockets on old kernels (default socket I/O)\n\
               -O : First Online Message flag (default no no online retain message)\n\
   \n\n\
 Examples:\n\
@@ -224,7 +434,39 @@ Publisher:\n\
  ", BROKER_IP_DEFAULT, BROKER_PORT_DEFAULT, USERNAME_DEFAULT, \
  PASSWORD_DEFAULT, CLIENTID_DEFAULT, TOPIC_DEFAULT, TXT_MSG_DEFAULT,\
  QOS_DEFAULT, ALIVE_CON_DEFAULT, WILL_QOS_DEFAULT, WILL_TOPIC_DEFAULT, WILL_MSG_DEFAULT,\
- PERSIST_CON_DEFAULT, BROKER_IP_DEFAULT, BROKER_PORT_DEFAULT, USERNAME_DEFAULT,\
+ PERSIST_CON_DEFAULT, CONNECT_TIMEOUT_DEFAULT, FILE_JOBS_DEFAULT, FILE_JOBS_MAX, PACE_BURST_DEFAULT,\
+ BROKER_IP_DEFAULT, BROKER_PORT_DEFAULT, USERNAME_DEFAULT,\
  PASSWORD_DEFAULT, CLIENTID_DEFAULT, TOPIC_DEFAULT, OUT_FILE_DEFAULT,\
- ALIVE_CON_DEFAULT, WILL_QOS_DEFAULT, WILL_TOPIC_DEFAULT, WILL_MSG_DEFAULT, PERSIST_CON_DEFAULT
+ ALIVE_CON_DEFAULT, WILL_QOS_DEFAULT, WILL_TOPIC_DEFAULT, WILL_MSG_DEFAULT, PERSIST_CON_DEFAULT,\
+ CONNECT_TIMEOUT_DEFAULT
+
+/*Broker command options*/
+#define BROKER_HELP_TXT       "\n \
+ Broker Usage: \n\n \
+       ecli_mqtt_broker -option value\n\n\
+            Options:\n\n\
+              -b : Listen list host[:port],[IPv6]:port,unix:/path,unix:@name (default %s)\n\
+              -p : Listen Port of hosts without port (default %d)\n\
+              -n : Max connections (default %d)\n\
+              -c : Use Configuration File\n\
+              -L : Log file, written by a background thread (default no log file)\n\
+              -h : Show help\n\n\
+            Configuration file keys:\n\n\
+              listen, listen_port, max_conns, log_file as the options\n\
+              queue_bytes  : QoS 0 bytes queued per connection, over it they are dropped (default %d)\n\
+              max_inflight : QoS 1 messages waiting PUBACK per subscriber (default %d)\n\
+              max_pending  : QoS 1 messages kept per session behind them, also offline (default %d)\n\
+              max_packet   : Bigger packets close the connection (default %d bytes)\n\
+              tls_listen   : TLS listen list as listen, needs TLS=OPENSSL build (default no TLS)\n\
+              tls_listen_port : Port of TLS hosts without port (default %d)\n\
+              tls_cert, tls_key : PEM certificate chain and key of TLS listeners\n\
+ \n\n\
+Examples:\n\
+    - Broker on every interface, port 1883.\n\
+      $ ecli_mqtt_broker\n\
+    - Broker for this host only, TCP and unix socket.\n\
+      $ ecli_mqtt_broker -b 127.0.0.1,unix:/tmp/ecli_mqtt.sock\n\
+\n\n\
+ ", LISTEN_DEFAULT, BROKER_PORT_DEFAULT, BROKER_CONNS_DEFAULT, BROKER_QUEUE_DEFAULT,\
+ BROKER_INFLIGHT_DEFAULT, BROKER_PENDING_DEFAULT, BROKER_PACKET_DEFAULT, BROKER_TLS_PORT_DEFAULT
 #endif
@@ -0,0 +1,72 @@
+/***********************************************************************
+* FILENAME    :   libeclimqttdelta.h
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   Library header for content defined dedup and delta
+*                 transfer of repeated file publishes.
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <stdint.h>
+
+/**********************************************************************/
+
+#include <libeclimqtt.h>
+
+/**********************************************************************/
+
+#ifndef LIBECLIMQTTDELTA_H_
+#define LIBECLIMQTTDELTA_H_
+
+/**********************************************************************/
+/*
+ * The file is cut in chunks where a gear rolling hash of the last 64
+ * bytes matches a mask (FastCDC normalized chunking), so an edit only
+ * changes the chunks around it. A publish carries the chunk list and the
+ * data of chunks the previous version did not have (big endian):
+ *   0  "ED", version, flags (DELTA_FLAG_KEY: every chunk data included)
+ *   4  number of chunks
+ *   8  file size
+ *   16 number of chunks x ( xxHash3(8), len(4), DELTA_LEN_DATA when data follows )
+ *      data of chunks with DELTA_LEN_DATA, in order
+ * The subscriber rebuilds the file from the chunks of its previous
+ * version. An unchanged file is not published; a full version goes
+ * every file_delta_key secs for subscribers that joined late or lost
+ * one version.
+ */
+#define DELTA_HEADER_LEN      16
+#define DELTA_ENTRY_LEN       12
+#define DELTA_VERSION         1
+#define DELTA_FLAG_KEY        0x01
+#define DELTA_LEN_DATA        0x80000000
+#define DELTA_CHUNK_MIN       2048
+#define DELTA_CHUNK_AVG       8192
+#define DELTA_CHUNK_MAX       65536
+#define DELTA_MASK_S          ( ~0ULL << ( 64 - 15 ) )  /* Before avg size, harder cut */
+#define DELTA_MASK_L          ( ~0ULL << ( 64 - 11 ) )  /* After avg size, easier cut */
+#define DELTA_TMP_SUFFIX      ".tmp"
+
+/**********************************************************************/
+/** Publish file conf->msg_txt as delta of previous publish, nothing when
+ * the file did not change.
+ *
+ * @param broker: structure that contains the client connection info with broker
+ * @param conf: structure that contains the user config options for broker conn.
+ *
+ */
+uint8_t eclidelta_publish(ecli_broker_t *broker, ecli_conf_t *conf);
+
+/**********************************************************************/
+/** Rebuild conf->datafile_path from delta message, returns 1 when the
+ * file is written, 0 when msg is not a delta (plain file) or -1 when
+ * chunks are missing (wait for next full version) or on file error.
+ *
+ * @param conf: structure that contains the user config options for broker conn.
+ * @param msg: message payload.
+ * @param msg_len: message size.
+ *
+ */
+int8_t eclidelta_apply(ecli_conf_t *conf, const uint8_t *msg, uint32_t msg_len);
+
+#endif
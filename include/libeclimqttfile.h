@@ -0,0 +1,89 @@
+/***********************************************************************
+* FILENAME    :   libeclimqttfile.h
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   Library header for resumable chunked file transfer.
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <stdint.h>
+
+/**********************************************************************/
+
+#include <libeclimqtt.h>
+
+/**********************************************************************/
+
+#ifndef LIBECLIMQTTFILE_H_
+#define LIBECLIMQTTFILE_H_
+
+/**********************************************************************/
+/*
+ * A file goes to topic T as chunks: FILE_HEADER_LEN bytes header (big
+ * endian) and data.
+ *   0  "EF", version, flags (FILE_FLAG_END: end of pass, no data)
+ *   4  transfer id (CRC32C of name, size and mtime)
+ *   8  file size
+ *   16 chunk offset
+ *   24 chunk length
+ *   28 CRC32C of chunk data
+ * Offsets are FILE_BLOCK_SIZE aligned and lengths a multiple of it (but
+ * the last chunk). The receiver writes chunks in any order to a
+ * preallocated file and keeps received blocks in a bitmap next to it
+ * (output.ecft), so a restarted receiver still knows what it has. On
+ * reconnection and on end of pass it publishes the missing ranges to
+ * T/resume: "ER", version, flags, id, count, count x ( offset(8), len(4) ),
+ * count 0 when the file is complete. The sender sends chunks from
+ * several sessions in parallel, each one sizing its chunks to about
+ * FILE_RTT_FACTOR times the measured publish time at the measured
+ * throughput, and serves resume requests until the file is complete or
+ * file_linger secs without requests.
+ */
+#define FILE_HEADER_LEN       32
+#define FILE_VERSION          1
+#define FILE_FLAG_END         0x01
+#define FILE_BLOCK_SIZE       4096
+#define FILE_CHUNK_MIN        16384
+#define FILE_CHUNK_MAX        ( ( ( MAX_CHUNK_SIZE - FILE_HEADER_LEN ) / FILE_BLOCK_SIZE ) * FILE_BLOCK_SIZE )
+#define FILE_RTT_FACTOR       8         /* Chunk send time / min publish time */
+#define FILE_RESUME_RANGES    256       /* Ranges per resume request */
+#define FILE_RESUME_TOPIC     "/resume"
+#define FILE_STATE_SUFFIX     ".ecft"
+#define FILE_STATE_MAGIC      "ECFT"
+#define FILE_RANGE_MAX        0x40000000 /* Bytes per resume range */
+
+/**********************************************************************/
+/** Send file conf->msg_txt in chunks from conf->file_jobs sessions,
+ * broker session serves resume requests until done.
+ *
+ * @param broker: structure that contains the client connection info with broker
+ * @param conf: structure that contains the user config options for broker conn.
+ *
+ */
+uint8_t eclifile_send(ecli_broker_t *broker, ecli_conf_t *conf);
+
+/**********************************************************************/
+/** Receive chunk into conf->datafile_path, returns 1 when the file is
+ * complete, 0 when more chunks are needed, -1 on file error.
+ *
+ * @param broker: structure that contains the client connection info with broker
+ * @param conf: structure that contains the user config options for broker conn.
+ * @param topic: topic of message.
+ * @param msg: message payload.
+ * @param msg_len: message size.
+ *
+ */
+int8_t eclifile_recv(ecli_broker_t *broker, ecli_conf_t *conf, const char *topic,
+                     const uint8_t *msg, uint32_t msg_len);
+
+/**********************************************************************/
+/** Request missing ranges of an unfinished transfer (after connect).
+ *
+ * @param broker: structure that contains the client connection info with broker
+ * @param conf: structure that contains the user config options for broker conn.
+ *
+ */
+void eclifile_resume(ecli_broker_t *broker, ecli_conf_t *conf);
+
+#endif
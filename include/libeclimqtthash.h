@@ -0,0 +1,126 @@
+/***********************************************************************
+* FILENAME    :   libeclimqtthash.h
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   Library header for payload and chunk checksums
+*                 (CRC32C and xxHash3) with runtime CPU dispatch.
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**********************************************************************/
+
+#ifndef LIBECLIMQTTHASH_H_
+#define LIBECLIMQTTHASH_H_
+
+/**********************************************************************/
+/*
+ * CRC32C uses the SSE4.2 crc32 instruction (ARMv8 crc32c when the build
+ * targets it) and xxHash3 (64 bits, seed 0) AVX2 or SSE2 accumulation,
+ * picked once at first use from the running CPU. Other targets (nios2,
+ * 32 bits ARM) use portable code with the same results.
+ * A checksummed payload ends with a trailer:
+ *   checksum of payload before it (big endian, 4 or 8 bytes)
+ *   byte HASH_TAG | hash type
+ */
+#define HASH_TAG              0xA0
+#define HASH_TAG_MASK         0xF0
+#define HASH_TRAILER_MAX      9
+#define HASH_CRC32C_NAME      "crc32c"
+#define HASH_XXH3_NAME        "xxh3"
+
+/**********************************************************************/
+/*Checksums, id on the wire*/
+typedef enum {
+    HASH_NONE = 0,
+    HASH_CRC32C,
+    HASH_XXH3
+} ecli_hash_t;
+
+/**********************************************************************/
+/** Get checksum from name ("crc32c", "xxh3", "none").
+ *
+ * @param name: checksum name.
+ *
+ */
+ecli_hash_t eclihash_from_name(const char *name);
+
+/**********************************************************************/
+/** CRC32C (Castagnoli) of buffer
+ *
+ * @param crc: previous crc, 0 to start.
+ * @param buffer: data.
+ * @param len: data size.
+ *
+ */
+uint32_t eclihash_crc32c(uint32_t crc, const void *buffer, size_t len);
+
+/**********************************************************************/
+/** xxHash3 64 bits of buffer (seed 0)
+ *
+ * @param buffer: data.
+ * @param len: data size.
+ *
+ */
+uint64_t eclihash_xxh3(const void *buffer, size_t len);
+
+/**********************************************************************/
+/** Write trailer of payload, returns trailer size (0 with HASH_NONE).
+ *
+ * @param hash: checksum type.
+ * @param buffer: payload.
+ * @param len: payload size.
+ * @param trailer: HASH_TRAILER_MAX bytes output.
+ *
+ */
+uint8_t eclihash_put(ecli_hash_t hash, const void *buffer, size_t len, uint8_t *trailer);
+
+/**********************************************************************/
+/** Check trailer of payload (any type), returns payload size without
+ * trailer or -1 when there is no trailer or checksum does not match.
+ *
+ * @param buffer: payload with trailer.
+ * @param len: payload size with trailer.
+ *
+ */
+int32_t eclihash_check(const void *buffer, uint32_t len);
+
+/**********************************************************************/
+/** Write big endian 32 / 64 bits integer (hashes, sizes and offsets in
+ * file and delta messages).
+ *
+ * @param buffer: position in buffer, 4 / 8 bytes.
+ * @param value: value to write.
+ *
+ */
+void eclihash_put32(uint8_t *buffer, uint32_t value);
+void eclihash_put64(uint8_t *buffer, uint64_t value);
+
+/**********************************************************************/
+/** Read big endian 32 / 64 bits integer.
+ *
+ * @param buffer: position in buffer, 4 / 8 bytes.
+ *
+ */
+uint32_t eclihash_get32(const uint8_t *buffer);
+uint64_t eclihash_get64(const uint8_t *buffer);
+
+/**********************************************************************/
+/** Use portable code only (benchmark and comparison), or back to CPU
+ * dispatch.
+ *
+ * @param portable: TRUE_FLAG for portable code.
+ *
+ */
+void eclihash_portable(uint8_t portable);
+
+/**********************************************************************/
+/** Implementations in use, "crc32c:<impl> xxh3:<impl>".
+ *
+ */
+const char *eclihash_impl(void);
+
+#endif
@@ -24,6 +24,15 @@
 #define LOG_ERROR         "ERROR"
 #define LOG_TRACE         "TRACE"
 
+/* File logger */
+#define LOG_FILE_DEFAULT      "output/ecli_mqtt.log"
+#define LOG_FILE_SIZE_DEFAULT 4194304   /* 4MB before rotate */
+#define LOG_FILE_NUM_DEFAULT  4         /* Rotated files kept (file.1 .. file.N) */
+#define LOG_RING_SIZE         4096      /* Records in ring, power of 2 */
+#define LOG_RECORD_MSG_LEN    200       /* Message bytes kept per record */
+#define LOG_WRITE_BUF_SIZE    65536     /* Buffered bytes per write() */
+#define LOG_FLUSH_MSECS       100       /* Max time a record waits in buffer */
+
 /**********************************************************************/
 /** Show message in term.
  *
@@ -59,4 +68,38 @@ int8_t eclilog_log(const char * caller, const char * call, const char *msg, cons
  */
 int8_t eclilog_logshow(const char * caller, const char * call, const char *msg, const char *logfile, const char * log_level);
 
+/**********************************************************************/
+/** Open log file and start background writer thread.
+ *
+ * Records are queued by eclilog_log() in a lock-free ring and written by
+ * the writer thread, so callers never wait on disk.
+ *
+ * @param logfile: log file path string.
+ * @param max_size: file size in bytes that triggers a rotation.
+ * @param max_files: number of rotated files kept.
+ *
+ */
+int8_t eclilog_open(const char *logfile, uint32_t max_size, uint8_t max_files);
+
+/**********************************************************************/
+/** Drain queued records, stop writer thread and close log file.
+ *
+ */
+void eclilog_close(void);
+
+/**********************************************************************/
+/** Get number of records dropped because the ring was full.
+ *
+ */
+uint32_t eclilog_dropped(void);
+
+/**********************************************************************/
+/** Set term stream for shown messages (stdout by default), stderr
+ * when stdout carries data.
+ *
+ * @param out: output stream.
+ *
+ */
+void eclilog_console(FILE *out);
+
 #endif
@@ -0,0 +1,113 @@
+/***********************************************************************
+* FILENAME    :   libeclimqttlvc.h
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   Library header for the last value cache of received
+*                 messages (latest payload per topic, lock-free reads).
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <stdint.h>
+
+/**********************************************************************/
+
+#ifndef LIBECLIMQTTLVC_H_
+#define LIBECLIMQTTLVC_H_
+
+/**********************************************************************/
+/*
+ * The receive path keeps the latest payload, arrival time and retain
+ * flag of every topic in a hash table (xxh3 of the topic, chained
+ * buckets). A value is never changed in place: a new one is linked with
+ * one atomic store, so readers of other threads see a whole old value or
+ * a whole new one and never wait for the receive path (RCU style).
+ * Readers mark a read side section (hold / release, one atomic add each,
+ * counted per epoch); replaced values and evicted topics are freed by the
+ * writer once the readers of the epoch they were unlinked in are out, so
+ * busy readers never hold memory for long. Topics and payloads use at
+ * most max bytes: over it the least recently updated topic is evicted, a
+ * topic read since the last pass gets a second chance (CLOCK
+ * approximation of LRU, readers do not touch the LRU list).
+ */
+#define LVC_BUCKETS_MIN       1024
+#define LVC_BUCKETS_MAX       1048576
+#define LVC_ENTRY_BYTES       256       /* Expected topic + payload, sets buckets */
+
+/*Cached value, read only*/
+typedef struct {
+    uint64_t ts_ms;                               /* Arrival epoch msecs */
+    uint32_t len;
+    uint8_t  retain;                              /* Retained publish */
+    uint8_t  data[];
+} ecli_lvc_value_t;
+
+/**********************************************************************/
+/** Create the cache, nothing when it exists, returns -1 on error.
+ *
+ * @param max_bytes: topics and payloads memory limit.
+ *
+ */
+int8_t eclilvc_init(uint64_t max_bytes);
+
+/**********************************************************************/
+/** Store latest payload of topic (receive path), nothing when the cache
+ * does not exist.
+ *
+ * @param topic: topic name.
+ * @param msg: message payload.
+ * @param len: payload size.
+ * @param retain: retained publish flag.
+ * @param ts_ms: arrival epoch msecs, 0 now.
+ *
+ */
+void eclilvc_put(const char *topic, const uint8_t *msg, uint32_t len, uint8_t retain, uint64_t ts_ms);
+
+/**********************************************************************/
+/** Start read side section: values found stay valid until release.
+ * Returns section token for release.
+ *
+ */
+uint32_t eclilvc_hold(void);
+
+/**********************************************************************/
+/** End read side section.
+ *
+ * @param token: eclilvc_hold return.
+ *
+ */
+void eclilvc_release(uint32_t token);
+
+/**********************************************************************/
+/** Find latest value of topic inside a read side section, NULL when the
+ * topic has no value.
+ *
+ * @param topic: topic name.
+ *
+ */
+const ecli_lvc_value_t *eclilvc_find(const char *topic);
+
+/**********************************************************************/
+/** Copy latest value of topic, returns payload len (copied up to size),
+ * -1 when the topic has no value.
+ *
+ * @param topic: topic name.
+ * @param buffer: payload output.
+ * @param size: buffer size.
+ * @param ts_ms: arrival epoch msecs output (may be NULL).
+ * @param retain: retain flag output (may be NULL).
+ *
+ */
+int32_t eclilvc_get(const char *topic, uint8_t *buffer, uint32_t size, uint64_t *ts_ms, uint8_t *retain);
+
+/**********************************************************************/
+/** Get cache counters (waits for a store in progress).
+ *
+ * @param topics: cached topics output.
+ * @param bytes: used bytes output.
+ * @param evicted: evicted topics output.
+ *
+ */
+void eclilvc_stats(uint32_t *topics, uint64_t *bytes, uint64_t *evicted);
+
+#endif
@@ -0,0 +1,219 @@
+/***********************************************************************
+* FILENAME    :   libeclimqttmetrics.h
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   Library header for client counters and latency histograms.
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+/**********************************************************************/
+
+#ifndef LIBECLIMQTTMETRICS_H_
+#define LIBECLIMQTTMETRICS_H_
+
+/**********************************************************************/
+#define METRICS_PKT_TYPES       16        /* MQTT control packet types */
+#define METRICS_QOS_LEVELS      3
+#define METRICS_LABEL_LEN       64
+/* Log-linear (HDR style) histogram: 16 sub buckets per power of 2 */
+#define METRICS_HIST_SUB_BITS   4
+#define METRICS_HIST_SUB        ( 1 << METRICS_HIST_SUB_BITS )
+#define METRICS_HIST_MAX_BITS   36        /* ns: values over ~68 secs clamp */
+#define METRICS_HIST_BUCKETS    ( ( METRICS_HIST_MAX_BITS - METRICS_HIST_SUB_BITS + 1 ) * METRICS_HIST_SUB )
+/* Dump */
+#define METRICS_INTERVAL_DEFAULT 10       /* secs, 0 dump only on SIGUSR1 */
+#define METRICS_FMT_PROM        "prom"
+#define METRICS_FMT_JSON        "json"
+
+/* Counter update: relaxed atomic where the target has 64 bit atomics */
+#ifdef __GCC_HAVE_SYNC_COMPARE_AND_SWAP_8
+#define METRICS_ADD( counter, value ) __atomic_fetch_add( &( counter ), ( value ), __ATOMIC_RELAXED )
+#define METRICS_GET( counter )        __atomic_load_n( &( counter ), __ATOMIC_RELAXED )
+#else
+#define METRICS_ADD( counter, value ) ( ( counter ) += ( value ) )
+#define METRICS_GET( counter )        ( counter )
+#endif
+
+/**********************************************************************/
+/*Dump formats*/
+typedef enum {
+    METRICS_PROM = 0,
+    METRICS_JSON,
+} ecli_metrics_fmt;
+
+/*Latency histogram (nanoseconds)*/
+typedef struct {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[METRICS_HIST_BUCKETS];
+} ecli_hist_t;
+
+/*Per connection metrics*/
+typedef struct ecli_metrics_s {
+    char     label[METRICS_LABEL_LEN];             /* client_id label */
+    uint64_t tx_packets[METRICS_PKT_TYPES];        /* Sent per control type */
+    uint64_t tx_bytes[METRICS_PKT_TYPES];
+    uint64_t rx_packets[METRICS_PKT_TYPES];        /* Received per control type */
+    uint64_t rx_bytes[METRICS_PKT_TYPES];
+    uint64_t publish_qos[METRICS_QOS_LEVELS];      /* Publishes per QoS */
+    uint64_t retransmits;                          /* PUBLISH re-sent with DUP (bridge) */
+    uint64_t connects;
+    uint64_t reconnects;
+    uint64_t ack_timeouts;
+    uint64_t rx_buffer_hwm;                        /* Biggest packet buffered */
+    uint64_t tx_dropped;                           /* QoS 0 dropped by send queue */
+    uint64_t tx_queue_hwm;                         /* Most send queue bytes */
+    ecli_hist_t pub_ack_lat;                       /* Publish to PUBACK/PUBCOMP */
+    ecli_hist_t send_time;                         /* Time blocked in send() */
+    ecli_hist_t recv_time;                         /* Time blocked in recv() */
+    struct ecli_metrics_s *next;                   /* Registry list */
+} ecli_metrics_t;
+
+/**********************************************************************/
+/** Allocate and register metrics for a connection.
+ *
+ * @param label: label used in dumps (client id).
+ *
+ */
+ecli_metrics_t *eclimetrics_new(const char *label);
+
+/**********************************************************************/
+/** Unregister connection metrics, keeping its values in global totals.
+ *
+ * @param metrics: connection metrics.
+ *
+ */
+void eclimetrics_free(ecli_metrics_t *metrics);
+
+/**********************************************************************/
+/** Monotonic time in nanoseconds.
+ *
+ */
+uint64_t eclimetrics_now(void);
+
+/**********************************************************************/
+/** Record a value in histogram.
+ *
+ * @param hist: histogram.
+ * @param value: value in nanoseconds.
+ *
+ */
+void eclimetrics_hist_record(ecli_hist_t *hist, uint64_t value);
+
+/**********************************************************************/
+/** Get value at percentile from histogram.
+ *
+ * @param hist: histogram.
+ * @param percentile: 0.0 - 100.0
+ *
+ */
+uint64_t eclimetrics_hist_percentile(const ecli_hist_t *hist, double percentile);
+
+/**********************************************************************/
+/** Record a sent packet and time blocked sending it.
+ *
+ * @param metrics: connection metrics (may be NULL).
+ * @param packet: packet buffer (first byte is control type).
+ * @param len: bytes sent.
+ * @param nsecs: time blocked in send.
+ *
+ */
+void eclimetrics_tx(ecli_metrics_t *metrics, const uint8_t *packet, uint32_t len, uint64_t nsecs);
+
+/**********************************************************************/
+/** Record a received packet.
+ *
+ * @param metrics: connection metrics (may be NULL).
+ * @param packet: packet buffer (first byte is control type).
+ * @param len: packet len.
+ *
+ */
+void eclimetrics_rx(ecli_metrics_t *metrics, const uint8_t *packet, uint32_t len);
+
+/**********************************************************************/
+/** Record time blocked in recv.
+ *
+ * @param metrics: connection metrics (may be NULL).
+ * @param nsecs: time blocked in recv.
+ *
+ */
+void eclimetrics_recv_time(ecli_metrics_t *metrics, uint64_t nsecs);
+
+/**********************************************************************/
+/** Record a publish and, for QoS > 0, publish to ack latency.
+ *
+ * @param metrics: connection metrics (may be NULL).
+ * @param qos: publish QoS.
+ * @param ack_nsecs: publish to ack time (0 for QoS 0).
+ *
+ */
+void eclimetrics_publish(ecli_metrics_t *metrics, uint8_t qos, uint64_t ack_nsecs);
+
+/**********************************************************************/
+/** Record a failed ack read, counted as timeout if errno says so.
+ *
+ * @param metrics: connection metrics (may be NULL).
+ *
+ */
+void eclimetrics_ack_error(ecli_metrics_t *metrics);
+
+/**********************************************************************/
+/** Record a QoS 0 publish dropped by the send queue.
+ *
+ * @param metrics: connection metrics (may be NULL).
+ *
+ */
+void eclimetrics_tx_drop(ecli_metrics_t *metrics);
+
+/**********************************************************************/
+/** Record send queue size (high-water mark).
+ *
+ * @param metrics: connection metrics (may be NULL).
+ * @param queued: queued bytes.
+ *
+ */
+void eclimetrics_tx_queued(ecli_metrics_t *metrics, uint64_t queued);
+
+/**********************************************************************/
+/** Record a successful connection (reconnect after the first one).
+ *
+ * @param metrics: connection metrics (may be NULL).
+ *
+ */
+void eclimetrics_connect(ecli_metrics_t *metrics);
+
+/**********************************************************************/
+/** Sum every registered connection in global metrics.
+ *
+ * @param global: output metrics.
+ *
+ */
+void eclimetrics_global(ecli_metrics_t *global);
+
+/**********************************************************************/
+/** Dump global and per connection metrics.
+ *
+ * @param out: output stream.
+ * @param fmt: dump format.
+ *
+ */
+void eclimetrics_dump(FILE *out, ecli_metrics_fmt fmt);
+
+/**********************************************************************/
+/** Start background dump to file every interval secs, on SIGUSR1
+ * and at exit.
+ *
+ * @param path: output file path (stderr if empty).
+ * @param interval: seconds between dumps, 0 dumps only on SIGUSR1.
+ * @param fmt: dump format.
+ *
+ */
+int8_t eclimetrics_start_dump(const char *path, uint32_t interval, ecli_metrics_fmt fmt);
+
+#endif
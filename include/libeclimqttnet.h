@@ -0,0 +1,106 @@
+/***********************************************************************
+* FILENAME    :   libeclimqttnet.h
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   Library header for broker endpoint list, name resolution
+*                 and latency ranked connection.
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+/**********************************************************************/
+
+#ifndef LIBECLIMQTTNET_H_
+#define LIBECLIMQTTNET_H_
+
+/**********************************************************************/
+#define NET_MAX_ENDPOINTS       8         /* Brokers in list */
+#define NET_MAX_ADDRS           4         /* Resolved addresses kept per broker */
+#define NET_MAX_CANDIDATES      ( NET_MAX_ENDPOINTS * NET_MAX_ADDRS )
+#define NET_HOST_LEN            128
+#define NET_PORT_LEN            8
+#define NET_LIST_SEP            ","
+/* Ranking: EWMA of connect to CONNACK time, weight 1/2^NET_EWMA_SHIFT */
+#define NET_EWMA_SHIFT          2
+#define NET_REFRESH_DEFAULT     60        /* secs, resolver refresh period, 0 off */
+#define NET_STAGGER_DEFAULT     250       /* msecs, happy eyeballs attempt delay */
+
+/**********************************************************************/
+/*Broker endpoint*/
+typedef struct {
+    char     host[NET_HOST_LEN];                    /* Name or address literal */
+    uint16_t port;
+    uint32_t naddrs;                                /* Cached resolved addresses */
+    struct sockaddr_storage addrs[NET_MAX_ADDRS];
+    socklen_t addr_lens[NET_MAX_ADDRS];
+    uint64_t ewma_nsecs;                            /* Connect to CONNACK, 0 unknown */
+    uint32_t failures;                              /* Consecutive failures */
+} ecli_endpoint_t;
+
+/*Endpoint list*/
+typedef struct {
+    ecli_endpoint_t endpoints[NET_MAX_ENDPOINTS];
+    uint32_t        count;
+    int32_t         current;                        /* Connected endpoint, -1 none */
+    uint64_t        connect_start;                  /* Winner attempt start (ns) */
+    uint32_t        refresh_secs;
+    uint8_t         resolver_run;
+    pthread_t       resolver;
+    pthread_mutex_t lock;
+    pthread_cond_t  wake;
+} ecli_endpoints_t;
+
+/**********************************************************************/
+/** Parse endpoint list and resolve it, starting background refresh.
+ *
+ * @param list: "host[:port],[v6addr]:port,..." comma separated brokers.
+ * @param default_port: port used when host has no port.
+ * @param refresh_secs: resolver refresh period, 0 resolves only once.
+ *
+ */
+ecli_endpoints_t *eclinet_new(const char *list, uint16_t default_port, uint32_t refresh_secs);
+
+/**********************************************************************/
+/** Stop background refresh and free endpoint list.
+ *
+ * @param endpoints: endpoint list.
+ *
+ */
+void eclinet_free(ecli_endpoints_t *endpoints);
+
+/**********************************************************************/
+/** Connect to the best ranked reachable endpoint. Attempts are started
+ * every stagger msecs without waiting for slower ones (happy eyeballs),
+ * the first connected socket wins. errno is set on failure.
+ *
+ * @param endpoints: endpoint list.
+ * @param timeout_ms: overall timeout in msecs, 0 no timeout.
+ * @param stagger_ms: delay between parallel attempts in msecs.
+ * @param socketid: returned connected socket (blocking mode).
+ *
+ */
+int8_t eclinet_connect(ecli_endpoints_t *endpoints, uint32_t timeout_ms,
+                       uint32_t stagger_ms, int32_t *socketid);
+
+/**********************************************************************/
+/** Report CONNACK result of current endpoint, updates its ranking.
+ *
+ * @param endpoints: endpoint list.
+ * @param accepted: broker accepted connection.
+ *
+ */
+void eclinet_connack(ecli_endpoints_t *endpoints, uint8_t accepted);
+
+/**********************************************************************/
+/** Get current connected endpoint (NULL if none).
+ *
+ * @param endpoints: endpoint list.
+ *
+ */
+const ecli_endpoint_t *eclinet_current(const ecli_endpoints_t *endpoints);
+
+#endif
@@ -0,0 +1,87 @@
+/***********************************************************************
+* FILENAME    :   libeclimqttpace.h
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   Library header for publish rate control (token bucket
+*                 with timerfd sleeps) and achieved rate / jitter report.
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <stdint.h>
+
+/**********************************************************************/
+
+#include <libeclimqttmetrics.h>
+
+/**********************************************************************/
+
+#ifndef LIBECLIMQTTPACE_H_
+#define LIBECLIMQTTPACE_H_
+
+/**********************************************************************/
+/*
+ * Message n is due at start + n / rate; up to burst messages go back to
+ * back when the publisher is behind (token bucket as virtual schedule).
+ * Waits sleep on an absolute timerfd deadline, so wake up errors do not
+ * add up, and the last PACE_SPIN_NS are spun for high rates; the idle
+ * hook runs before a sleep (queued sends go out). A late wake
+ * up (timer, scheduler) is caught up within PACE_LAG_NS, so mean rate
+ * holds even with burst 1; a publisher slower than that loses the time.
+ * Jitter is the lateness of paced sends against their schedule.
+ */
+#define PACE_RATE_DEFAULT     0         /* msgs/sec, 0 no pacing */
+#define PACE_BURST_DEFAULT    1
+#define PACE_REPORT_DEFAULT   10        /* secs between rate reports */
+#define PACE_SPIN_NS          20000     /* Busy wait under this, timer over */
+#define PACE_LAG_NS           1000000   /* Late sends caught up within this */
+
+/**********************************************************************/
+/*Pacing state of a publisher*/
+typedef struct {
+    double   rate;                                /* Target msgs/sec */
+    uint32_t burst;                               /* Bucket size, msgs */
+    int32_t  timer_fd;                            /* -1: clock_nanosleep */
+    uint64_t interval_ns;                         /* 1 / rate */
+    uint64_t next_ns;                             /* Schedule of next message */
+    uint64_t start_ns;
+    uint64_t report_ns;                           /* Last report */
+    uint32_t report_secs;                         /* 0 only final report */
+    uint64_t sent;
+    uint64_t report_sent;                         /* Sent at last report */
+    ecli_hist_t jitter;                           /* Since last report */
+    ecli_hist_t jitter_total;                     /* Since start */
+    void     (*idle)(void);                       /* Before a timer sleep, NULL none */
+} ecli_pace_t;
+
+/**********************************************************************/
+/** Start pacing, returns -1 when rate is not valid.
+ *
+ * @param pace: pacing state.
+ * @param rate: target msgs/sec.
+ * @param burst: messages allowed back to back when behind (>= 1).
+ * @param report_secs: seconds between rate reports, 0 only final report.
+ *
+ */
+int8_t eclipace_init(ecli_pace_t *pace, double rate, uint32_t burst, uint32_t report_secs);
+
+/**********************************************************************/
+/** Wait until next message is due, returns -1 when interrupted by a
+ * signal.
+ *
+ * @param pace: pacing state.
+ *
+ */
+int8_t eclipace_wait(ecli_pace_t *pace);
+
+/**********************************************************************/
+/** Report achieved rate and jitter since last report (or since start
+ * with final flag), and free timer with final flag.
+ *
+ * @param pace: pacing state.
+ * @param final: TRUE_FLAG at end of publish loop.
+ *
+ */
+void eclipace_report(ecli_pace_t *pace, uint8_t final);
+
+#endif
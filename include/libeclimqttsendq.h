@@ -0,0 +1,198 @@
+/***********************************************************************
+* FILENAME    :   libeclimqttsendq.h
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   Library header for the outbound packet queue of a
+*                 connection (partial writes, watermarks, QoS 0 drops,
+*                 priority lanes).
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <stdint.h>
+#include <signal.h>
+#include <sys/uio.h>
+
+/**********************************************************************/
+
+#include <libeclimqtttransport.h>
+#include <libeclimqttmetrics.h>
+
+/**********************************************************************/
+
+#ifndef LIBECLIMQTTSENDQ_H_
+#define LIBECLIMQTTSENDQ_H_
+
+/**********************************************************************/
+/*
+ * Packets are written straight to the socket; only the part the socket
+ * does not take (short write, EAGAIN) is copied in the queue and written
+ * first by the next send or before the next read. EINTR is retried.
+ * Queued bytes over the high watermark make the connection congested
+ * until they are under the low one: a waiting producer blocks there
+ * (socket writable, no progress for stall_ms is a lost connection), a
+ * non waiting one (sessions runner) reads the congested state. QoS 0
+ * publishes may be dropped over the high watermark (drop policy), other
+ * packets never are. A packet bigger than the high watermark is written
+ * in place, without a copy. Sends from a signal handler in the middle of
+ * another send (keep alive PINGREQ) are deferred to the next packet end.
+ *
+ * Queued packets wait in priority lanes: control packets, then publishes
+ * by topic rule (alarm, telemetry the default, bulk). A started packet is
+ * always finished (MQTT packets can not be interleaved), then the highest
+ * lane with packets goes; a new packet is written through only when no
+ * lane of its priority or higher holds packets. A lane may have a rate
+ * cap (token bucket, 100 ms burst): its packets are written in slices of
+ * the bytes allowed and wait while the lane is over its rate, so a big
+ * bulk packet is paced instead of filling the socket.
+ */
+#define SENDQ_HIGH_DEFAULT    1048576   /* Bytes, congested over this */
+#define SENDQ_LOW_DEFAULT     262144    /* Bytes, not congested under this */
+#define SENDQ_CTRL_LEN        16        /* Deferred control packet bytes */
+#define SENDQ_MAX_RULES       16        /* Topic lane rules */
+#define SENDQ_TOPIC_LEN       256
+#define SENDQ_BURST_DIV       10        /* Bucket depth: rate / 10 (100 ms) */
+
+/*Drop policy of QoS 0 publishes over the high watermark*/
+typedef enum {
+    SENDQ_DROP_NONE = 0,                          /* Queued, producer waits */
+    SENDQ_DROP_OLDEST,                            /* Oldest queued QoS 0 go */
+    SENDQ_DROP_NEWEST,                            /* New QoS 0 packet goes */
+} ecli_sendq_drop;
+
+/*Priority lanes, highest first*/
+typedef enum {
+    SENDQ_LANE_CONTROL = 0,                       /* Not PUBLISH packets */
+    SENDQ_LANE_ALARM,
+    SENDQ_LANE_TELEMETRY,                         /* Publishes without rule */
+    SENDQ_LANE_BULK,
+    SENDQ_LANES,
+} ecli_sendq_lane;
+
+/*Queued packet*/
+typedef struct ecli_sendq_pkt_s {
+    struct ecli_sendq_pkt_s *next;
+    uint32_t len;
+    uint32_t sent;                                /* Written bytes (head only) */
+    uint8_t  droppable;                           /* QoS 0 publish */
+    uint8_t  data[];
+} ecli_sendq_pkt_t;
+
+/*Lane packets and rate cap*/
+typedef struct {
+    ecli_sendq_pkt_t *head;                       /* Started packet is a head */
+    ecli_sendq_pkt_t *tail;
+    uint64_t rate;                                /* Bytes/sec, 0 no cap */
+    int64_t  tokens;                              /* Bytes allowed, debt when negative */
+    uint64_t stamp_ns;                            /* Last refill */
+} ecli_sendq_lane_t;
+
+/*Outbound queue of a connection*/
+typedef struct {
+    ecli_sendq_lane_t lanes[SENDQ_LANES];
+    int8_t   started;                             /* Lane of a started packet, -1 none */
+    uint64_t queued;                              /* Bytes not written */
+    uint32_t high;                                /* Watermarks, bytes */
+    uint32_t low;
+    ecli_sendq_drop drop;
+    uint32_t stall_ms;                            /* Max wait without progress, 0 forever */
+    uint8_t  nonblock;                            /* Producer never waits (kept by init) */
+    uint8_t  congested;
+    uint8_t  blocked;                             /* Last write found socket full */
+    volatile sig_atomic_t busy;                   /* In a send */
+    volatile sig_atomic_t ctrl_len;               /* Deferred bytes */
+    uint8_t  ctrl[SENDQ_CTRL_LEN];                /* Deferred control packets */
+    ecli_metrics_t *metrics;                      /* Drops & queue high-water mark */
+} ecli_sendq_t;
+
+/**********************************************************************/
+/** Set queue options for a new connection, queue must be empty
+ * (eclisendq_clear).
+ *
+ * @param sendq: outbound queue.
+ * @param high: congested over this queued bytes.
+ * @param low: not congested under this queued bytes.
+ * @param drop: QoS 0 drop policy.
+ * @param stall_ms: max wait for socket space without progress, 0 forever.
+ * @param metrics: connection metrics (may be NULL).
+ *
+ */
+void eclisendq_init(ecli_sendq_t *sendq, uint32_t high, uint32_t low, ecli_sendq_drop drop,
+                    uint32_t stall_ms, ecli_metrics_t *metrics);
+
+/**********************************************************************/
+/** Add lane rule for publishes on topics matching filter. First matching
+ * rule is used, other publishes go to telemetry lane.
+ *
+ * @param rule: "topic/filter/+/# alarm|telemetry|bulk".
+ *
+ */
+int8_t eclisendq_rule(const char *rule);
+
+/**********************************************************************/
+/** Set rate cap of a lane for new connections.
+ *
+ * @param rule: "control|alarm|telemetry|bulk bytes_per_sec".
+ *
+ */
+int8_t eclisendq_rate(const char *rule);
+
+/**********************************************************************/
+/** Get lane of a publish topic (rules).
+ *
+ * @param topic: topic name.
+ * @param topic_len: topic length.
+ *
+ */
+ecli_sendq_lane eclisendq_lane(const uint8_t *topic, uint32_t topic_len);
+
+/**********************************************************************/
+/** Send packet after queued ones, returns packet size when written,
+ * queued or dropped by policy, -1 with errno on error.
+ *
+ * @param sendq: outbound queue.
+ * @param transport: connected transport.
+ * @param iov: packet parts, first one starts with fixed header.
+ * @param iovcnt: number of parts (max TRANSPORT_MAX_IOV).
+ *
+ */
+int32_t eclisendq_sendv(ecli_sendq_t *sendq, ecli_transport_t *transport,
+                        const struct iovec *iov, int32_t iovcnt);
+
+/**********************************************************************/
+/** Write queued packets, returns bytes left in queue, -1 on error.
+ *
+ * @param sendq: outbound queue.
+ * @param transport: connected transport.
+ * @param wait: wait for socket space until queue is empty.
+ *
+ */
+int64_t eclisendq_flush(ecli_sendq_t *sendq, ecli_transport_t *transport, uint8_t wait);
+
+/**********************************************************************/
+/** Get congested state: set over high watermark, cleared under low.
+ *
+ * @param sendq: outbound queue.
+ *
+ */
+uint8_t eclisendq_congested(const ecli_sendq_t *sendq);
+
+/**********************************************************************/
+/** Get nanoseconds until a capped lane may write again, 0 when queued
+ * packets only wait for socket space (or queue is empty).
+ *
+ * @param sendq: outbound queue.
+ *
+ */
+uint64_t eclisendq_wait_ns(ecli_sendq_t *sendq);
+
+/**********************************************************************/
+/** Free queued packets (connection closed), nothing when called by a
+ * signal handler in the middle of a send.
+ *
+ * @param sendq: outbound queue.
+ *
+ */
+void eclisendq_clear(ecli_sendq_t *sendq);
+
+#endif
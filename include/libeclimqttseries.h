@@ -0,0 +1,141 @@
+/***********************************************************************
+* FILENAME    :   libeclimqttseries.h
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   Library header for time-series aggregation of small
+*                 numeric text samples (one block publish per window).
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <stdint.h>
+
+/**********************************************************************/
+
+#include <libeclimqttclient.h>
+
+/**********************************************************************/
+
+#ifndef LIBECLIMQTTSERIES_H_
+#define LIBECLIMQTTSERIES_H_
+
+/**********************************************************************/
+/*
+ * A sample is a short text payload with one decimal number, the last one
+ * of the text ("Temperature: 30.5 C"). Text around the number and its
+ * fraction digits are the sample template: samples of a topic with the
+ * same template go in one block, a new template or a payload that is not
+ * a sample (no number, leading zeros, too long) closes it.
+ * A block is closed when it has the window samples or its first sample
+ * is window ms old, and is published as one message:
+ *   byte 0     : SERIES_MAGIC
+ *   byte 1     : SERIES_TAG | version
+ *   varint     : samples
+ *   byte       : fraction digits
+ *   varint/txt : prefix len, prefix, suffix len, suffix
+ *   first      : epoch msecs varint, value zigzag varint
+ *   next ones  : msecs delta-of-delta zigzag varint, value delta zigzag varint
+ * Values are the number without the decimal point (fixed point), so a
+ * regular sensor costs 2 bytes per sample and texts come back exactly.
+ */
+#define SERIES_MAGIC          0xEC      /* Same first byte as codec header */
+#define SERIES_TAG            0x50
+#define SERIES_TAG_MASK       0xF0
+#define SERIES_VERSION        1
+#define SERIES_MAX_TOPICS     64        /* Topics with an open block */
+#define SERIES_SAMPLE_MAX     128       /* Bigger payloads are not samples */
+#define SERIES_DIGITS_MAX     18        /* Number digits, int64 fixed point */
+#define SERIES_BODY_SIZE      4096      /* Encoded samples per block */
+#define SERIES_SAMPLE_BYTES   20        /* Max encoded sample (2 varints) */
+#define SERIES_HEAD_MAX       ( 3 + 5 + 1 + 2 * 2 + SERIES_SAMPLE_MAX )
+#define SERIES_BLOCK_MAX      ( SERIES_HEAD_MAX + SERIES_BODY_SIZE )
+#define SERIES_TEXT_MAX       ( SERIES_SAMPLE_MAX + SERIES_DIGITS_MAX + 3 )
+
+/*Closed block to publish*/
+typedef struct {
+    char     topic[CLI_TOPIC_LEN + 1];
+    uint32_t topic_len;
+    uint32_t samples;
+    uint32_t len;                                 /* 0 no block */
+    uint8_t  data[SERIES_BLOCK_MAX];
+} ecli_series_block_t;
+
+/*Block reader*/
+typedef struct {
+    const uint8_t *pos;
+    const uint8_t *end;
+    const uint8_t *prefix;
+    const uint8_t *suffix;
+    uint32_t prefix_len;
+    uint32_t suffix_len;
+    uint32_t left;                                /* Samples not read */
+    uint32_t count;
+    uint8_t  digits;
+    uint64_t ts_ms;
+    int64_t  delta;
+    int64_t  value;
+} ecli_series_iter_t;
+
+/**********************************************************************/
+/** Set window of new blocks.
+ *
+ * @param samples: samples per block (min 2).
+ * @param window_ms: max msecs between first sample and block publish.
+ *
+ */
+void ecliseries_init(uint32_t samples, uint32_t window_ms);
+
+/**********************************************************************/
+/** Add payload of topic to its block, returns 1 when it is a sample, 0
+ * when it must be published as is (after block, when one was closed).
+ *
+ * @param topic: topic name.
+ * @param topic_len: topic length.
+ * @param payload: message payload.
+ * @param len: payload size.
+ * @param ts_ms: sample epoch msecs.
+ * @param block: closed block output (len 0 none).
+ *
+ */
+int8_t ecliseries_add(const uint8_t *topic, uint32_t topic_len, const uint8_t *payload, uint32_t len,
+                      uint64_t ts_ms, ecli_series_block_t *block);
+
+/**********************************************************************/
+/** Get msecs until next block window ends, -1 when no block is open.
+ *
+ */
+int64_t ecliseries_due(void);
+
+/**********************************************************************/
+/** Close a block whose window ended (any open one with all), returns 1
+ * when block was closed, 0 when none.
+ *
+ * @param all: close blocks before their window end (end of input).
+ * @param block: closed block output.
+ *
+ */
+int8_t ecliseries_expire(uint8_t all, ecli_series_block_t *block);
+
+/**********************************************************************/
+/** Start reading a block, returns 1 when msg is a block, 0 when it is a
+ * plain message, -1 when block is malformed.
+ *
+ * @param iter: block reader.
+ * @param msg: message payload.
+ * @param len: payload size.
+ *
+ */
+int8_t ecliseries_open(ecli_series_iter_t *iter, const uint8_t *msg, uint32_t len);
+
+/**********************************************************************/
+/** Next sample text of block, returns text len, 0 at block end, -1 when
+ * block is malformed.
+ *
+ * @param iter: block reader.
+ * @param text: sample text output (SERIES_TEXT_MAX bytes, not terminated).
+ * @param ts_ms: sample epoch msecs output.
+ *
+ */
+int32_t ecliseries_next(ecli_series_iter_t *iter, uint8_t *text, uint64_t *ts_ms);
+
+#endif
@@ -0,0 +1,71 @@
+/***********************************************************************
+* FILENAME    :   libeclimqttsession.h
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   Library header for many client sessions served by one
+*                 process ([session] config sections, shared event loop).
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <stdint.h>
+
+/**********************************************************************/
+
+#include <libeclimqtt.h>
+
+/**********************************************************************/
+
+#ifndef LIBECLIMQTTSESSION_H_
+#define LIBECLIMQTTSESSION_H_
+
+/**********************************************************************/
+/*
+ * Config file: keys before the first [session] line (and command line
+ * options) are defaults of every session, each [session] section adds
+ * count sessions with its own keys:
+ *   mode=pub|sub  count=N  first=N  message=text  + any client key
+ * %n in client_id, topic, will_topic, will_msg and message is the session
+ * number (first .. first + count - 1), %% a literal %.
+ * One epoll loop watches every socket and session timer (connect retry,
+ * publish_rate period, keep alive); ready sessions are run by a pool of
+ * workers, one worker per session at a time. Sessions of a section share
+ * the broker endpoint list; string buffers of a session are only touched
+ * up to their length, so idle sessions cost a few pages.
+ */
+#define SESSION_SECTION       "[session]"
+#define SESSION_WORKERS_DEFAULT 4
+#define SESSION_WORKERS_MAX   64
+#define SESSION_EVENTS        256       /* epoll events per wait */
+#define SESSION_READ_TIMEOUT  1         /* secs, rest of a started packet */
+
+/*Session role*/
+typedef enum {
+    SESSION_PUB = 0,
+    SESSION_SUB,
+} ecli_session_mode;
+
+/**********************************************************************/
+/** Create sessions from [session] sections of cfg_file, broker and conf
+ * hold the defaults. Returns number of sessions, -1 on error.
+ *
+ * @param cfg_file: sessions config file.
+ * @param broker: default client connection info (global keys).
+ * @param conf: default user config options (global keys).
+ *
+ */
+int32_t eclisession_load(const char *cfg_file, ecli_broker_t *broker, ecli_conf_t *conf);
+
+/**********************************************************************/
+/** Run all sessions until eclisession_stop, then disconnect them.
+ *
+ */
+uint8_t eclisession_run(void);
+
+/**********************************************************************/
+/** Stop event loop (async signal safe).
+ *
+ */
+void eclisession_stop(void);
+
+#endif
@@ -0,0 +1,187 @@
+/***********************************************************************
+* FILENAME    :   libeclimqttshm.h
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   Library header for the shared memory fan-out ring: one
+*                 subscriber writes, local processes read in place.
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <stdint.h>
+
+/**********************************************************************/
+
+#ifndef LIBECLIMQTTSHM_H_
+#define LIBECLIMQTTSHM_H_
+
+/**********************************************************************/
+/*
+ * A POSIX shared memory object (shm_open name) holds a head page and a
+ * power of two data ring. Records are written one after the other at
+ * 64 bit positions that never go back (offset = position & ring mask):
+ *   record : len (aligned record bytes), topic len, payload len, seq,
+ *            epoch msecs, topic, payload (8 bytes aligned)
+ *   pad    : len SHM_PAD_FLAG | bytes to ring end, record goes at start
+ * The writer never waits for readers: before a record overwrites old
+ * ones it moves tail (oldest whole record) past them, then writes the
+ * record and moves head. A reader behind tail was lapped: it is skipped
+ * forward to tail and the messages it missed are counted (seq gap).
+ * Readers get topic and payload in place (no copy); eclishm_valid tells
+ * whether the writer overwrote them while they were used. Every reader
+ * has a slot (pid, cursor, counters) in the head page, so monitors see
+ * lag, and slots of dead readers are taken again. Idle readers sleep on
+ * a futex in the head page, woken by the writer only when one waits.
+ */
+#define SHM_MAGIC             0x45434C52      /* "ECLR" */
+#define SHM_VERSION           1
+#define SHM_READERS_MAX       32
+#define SHM_HEAD_SIZE         4096            /* Head page, data ring after it */
+#define SHM_SIZE_MIN          65536
+#define SHM_MODE              0660
+#define SHM_PAD_FLAG          0x80000000      /* Record len: pad to ring end */
+#define SHM_ALIGN( len )      ( ( ( len ) + 7 ) & ~7ULL )
+#define SHM_SPIN              256             /* Polls before sleeping on the futex */
+
+/*Record header, topic and payload after it*/
+typedef struct {
+    uint32_t len;                                 /* Aligned record bytes, pad flag */
+    uint16_t topic_len;
+    uint16_t reserved;
+    uint32_t msg_len;
+    uint32_t reserved2;
+    uint64_t seq;                                 /* Message number, from 1 */
+    uint64_t ts_ms;                               /* Receive epoch msecs */
+} ecli_shm_rec_t;
+
+/*Reader slot, written by its reader*/
+typedef struct {
+    int32_t  pid;                                 /* 0 free slot */
+    uint32_t reserved;
+    uint64_t cursor;                              /* Next record position */
+    uint64_t msgs;                                /* Messages read */
+    uint64_t lost;                                /* Messages overwritten before read */
+    uint64_t skips;                               /* Times lapped by the writer */
+    uint8_t  pad[24];                             /* One cache line per slot */
+} ecli_shm_slot_t;
+
+/*Head page*/
+typedef struct {
+    uint32_t magic;                               /* Set last, ring ready */
+    uint32_t version;
+    uint64_t size;                                /* Data ring bytes */
+    int32_t  writer_pid;
+    uint32_t reserved;
+    uint64_t too_big;                             /* Messages over size / 4 not written */
+    uint8_t  pad1[32];
+    uint64_t head;                                /* Written records end */
+    uint64_t seq;                                 /* Last written message */
+    uint8_t  pad2[48];
+    uint64_t tail;                                /* Oldest whole record */
+    uint8_t  pad3[56];
+    uint32_t notify;                              /* Futex word, changed on wake up */
+    uint32_t waiters;                             /* Readers sleeping on it */
+    uint8_t  pad4[56];
+    ecli_shm_slot_t slots[SHM_READERS_MAX];
+} ecli_shm_head_t;
+
+/*Reader of a ring*/
+typedef struct {
+    ecli_shm_head_t *head;
+    uint8_t  *data;
+    uint64_t mask;
+    uint64_t map_size;
+    uint64_t cursor;
+    uint64_t last;                                /* Position of the message read */
+    uint64_t seq;                                 /* Next expected message */
+    ecli_shm_slot_t *slot;
+} ecli_shm_reader_t;
+
+/*Message read in place*/
+typedef struct {
+    const char    *topic;                         /* Not terminated */
+    uint16_t      topic_len;
+    const uint8_t *payload;
+    uint32_t      len;
+    uint64_t      seq;
+    uint64_t      ts_ms;
+} ecli_shm_msg_t;
+
+/**********************************************************************/
+/** Create ring (or take an existing one of the same size, readers go
+ * on), returns -1 on error.
+ *
+ * @param name: shm_open name ("/name").
+ * @param size: data ring bytes, rounded up to a power of two.
+ *
+ */
+int8_t eclishm_create(const char *name, uint64_t size);
+
+/**********************************************************************/
+/** Write message to the ring (single writer), returns -1 when it is
+ * over a quarter of the ring or there is no ring.
+ *
+ * @param topic: message topic.
+ * @param topic_len: topic size.
+ * @param msg: message payload.
+ * @param msg_len: message size.
+ * @param ts_ms: message epoch msecs.
+ *
+ */
+int8_t eclishm_write(const char *topic, uint16_t topic_len, const uint8_t *msg, uint32_t msg_len,
+                     uint64_t ts_ms);
+
+/**********************************************************************/
+/** Unmap ring, readers keep reading what was written.
+ *
+ */
+void eclishm_close(void);
+
+/**********************************************************************/
+/** Map ring and take a reader slot, returns -1 on error (no ring, no
+ * free slot).
+ *
+ * @param reader: reader state.
+ * @param name: shm_open name ("/name").
+ * @param oldest: start at oldest record in the ring, else at new ones.
+ *
+ */
+int8_t eclishm_attach(ecli_shm_reader_t *reader, const char *name, uint8_t oldest);
+
+/**********************************************************************/
+/** Read next message in place, returns 1 with msg, 0 when there is no
+ * new message. Skips forward (counting lost messages) when lapped.
+ *
+ * @param reader: reader state.
+ * @param msg: message output, valid until the writer laps the reader.
+ *
+ */
+int8_t eclishm_next(ecli_shm_reader_t *reader, ecli_shm_msg_t *msg);
+
+/**********************************************************************/
+/** Check that the last message read was not overwritten while it was
+ * used, returns 1 when it is whole.
+ *
+ * @param reader: reader state.
+ *
+ */
+int8_t eclishm_valid(const ecli_shm_reader_t *reader);
+
+/**********************************************************************/
+/** Wait for a new message, returns 1 when there is one, 0 on timeout.
+ *
+ * @param reader: reader state.
+ * @param timeout_ms: max msecs to wait, -1 forever.
+ *
+ */
+int8_t eclishm_wait(ecli_shm_reader_t *reader, int32_t timeout_ms);
+
+/**********************************************************************/
+/** Free reader slot and unmap ring.
+ *
+ * @param reader: reader state.
+ *
+ */
+void eclishm_detach(ecli_shm_reader_t *reader);
+
+#endif
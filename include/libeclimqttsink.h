@@ -0,0 +1,67 @@
+/***********************************************************************
+* FILENAME    :   libeclimqttsink.h
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   Library header for subscriber output sinks (NDJSON,
+*                 length prefixed, per topic files) written by a thread.
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <stdint.h>
+
+/**********************************************************************/
+
+#include <libeclimqttclient.h>
+
+/**********************************************************************/
+
+#ifndef LIBECLIMQTTSINK_H_
+#define LIBECLIMQTTSINK_H_
+
+/**********************************************************************/
+/*
+ * Received messages are copied in a bounded queue and written by a
+ * writer thread with big buffered writes, so disk or pipe stalls do not
+ * stop the socket reader until the queue is full. Outputs:
+ *   ndjson  stdout, {"topic":"..","ts":epoch msecs,"len":N,"payload":".."}
+ *           per line, payload base64 ("payload_b64") with -f
+ *   len     stdout, topic len (2, big endian), topic, payload len (4),
+ *           payload: same as ecli_mqtt_pub -s len+topic input
+ *   files   -o directory/topic, text lines appended, with -f each message
+ *           replaces the file (written to .tmp and renamed)
+ *   shm     shared memory ring shm_name= for local readers, written by
+ *           the socket reader itself (no queue, the ring never waits)
+ */
+#define SINK_WRITE_BUF        262144    /* Bytes per write to stdout */
+#define SINK_FILE_BUF         16384     /* Buffered bytes per open topic file */
+#define SINK_FILES_MAX        64        /* Topic files kept open */
+#define SINK_TMP_SUFFIX       ".tmp"
+
+/**********************************************************************/
+/** Start writer thread for conf->output_sink, returns -1 on error.
+ *
+ * @param conf: structure that contains the user config options for broker conn.
+ *
+ */
+int8_t eclisink_open(ecli_conf_t *conf);
+
+/**********************************************************************/
+/** Queue message for the writer, waiting while queue is full, returns
+ * -1 when the writer failed.
+ *
+ * @param topic: message topic.
+ * @param msg: message payload.
+ * @param msg_len: message size.
+ * @param ts_ms: message epoch msecs, 0 now.
+ *
+ */
+int8_t eclisink_push(const char *topic, const uint8_t *msg, uint32_t msg_len, uint64_t ts_ms);
+
+/**********************************************************************/
+/** Write queued messages, stop writer thread and close outputs.
+ *
+ */
+void eclisink_close(void);
+
+#endif
@@ -0,0 +1,51 @@
+/***********************************************************************
+* FILENAME    :   libeclimqttstream.h
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   Library header for streaming publish of records read
+*                 from stdin / pipe over one connection.
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <stdint.h>
+
+/**********************************************************************/
+
+#include <libeclimqtt.h>
+
+/**********************************************************************/
+
+#ifndef LIBECLIMQTTSTREAM_H_
+#define LIBECLIMQTTSTREAM_H_
+
+/**********************************************************************/
+/*
+ * Records (one message each):
+ *   line        payload \n
+ *   line+topic  topic \t payload \n   (no \t: default topic)
+ *   len         payload len (4, big endian), payload
+ *   len+topic   topic len (2, big endian), topic, payload len (4), payload
+ * QoS 0 messages are encoded back to back in a batch buffer that goes in
+ * one send when full or before a read that would wait for input; QoS 1/2,
+ * compressed and bigger messages go one by one (publish_chunk). With
+ * series= short numeric text records are aggregated per topic (series
+ * module) and their blocks are published as records.
+ */
+#define STREAM_READ_SIZE      65536     /* Input buffer, grows up to a max message */
+#define STREAM_BATCH_SIZE     65536     /* Packets per send */
+#define STREAM_TOPIC_SEP      '\t'
+#define STREAM_LEN_BYTES      4
+#define STREAM_TOPIC_BYTES    2
+
+/**********************************************************************/
+/** Publish every record read from fd until end of input.
+ *
+ * @param broker: structure that contains the client connection info with broker
+ * @param conf: structure that contains the user config options for broker conn.
+ * @param fd: input (stdin).
+ *
+ */
+uint8_t eclistream_publish(ecli_broker_t *broker, ecli_conf_t *conf, int32_t fd);
+
+#endif
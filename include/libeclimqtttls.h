@@ -0,0 +1,82 @@
+/***********************************************************************
+* FILENAME    :   libeclimqtttls.h
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   Library header for TLS transport (OpenSSL) with session
+*                 resumption and kernel TLS offload.
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/**********************************************************************/
+
+#include <libeclimqtttransport.h>
+
+/**********************************************************************/
+
+#ifndef LIBECLIMQTTTLS_H_
+#define LIBECLIMQTTTLS_H_
+
+/**********************************************************************/
+/*
+ * TLS is built with TLS=OPENSSL (links libssl / libcrypto), otherwise
+ * every function fails and -S reports it. The TLS session is the
+ * transport ctx, the socket underneath is a TCP transport one.
+ */
+#define TLS_SESSION_CACHE     8         /* Resumable sessions (one per broker) */
+#define TLS_KEY_LEN           160       /* Session cache key "host:port" */
+#define TLS_PATH_LEN          510
+#define TLS_FILE_CHUNK        16384     /* Read / write size without kTLS */
+
+/**********************************************************************/
+/*TLS configuration*/
+typedef struct {
+    char    ca_file[TLS_PATH_LEN];          /* CA bundle, empty system default */
+    char    cert_file[TLS_PATH_LEN];        /* Client certificate (optional) */
+    char    key_file[TLS_PATH_LEN];         /* Client private key (optional) */
+    char    session_file[TLS_PATH_LEN];     /* Persisted sessions (optional) */
+    uint8_t verify;                         /* Verify broker certificate */
+} ecli_tls_conf_t;
+
+/**********************************************************************/
+/** Create TLS context and load persisted sessions.
+ *
+ * @param tls_conf: TLS configuration.
+ *
+ */
+int8_t eclitls_init(const ecli_tls_conf_t *tls_conf);
+
+/**********************************************************************/
+/*TLS over TCP transport, resumes the cached session of each broker.
+  connect returns TRANSPORT_SESSION_ERROR when the handshake fails*/
+extern const ecli_transport_ops_t eclitls_transport;
+
+/**********************************************************************/
+/** Session of transport was resumed (abbreviated handshake).
+ *
+ * @param transport: connected TLS transport.
+ *
+ */
+uint8_t eclitls_resumed(const ecli_transport_t *transport);
+
+/**********************************************************************/
+/** Kernel TLS send offload is active for transport.
+ *
+ * @param transport: connected TLS transport.
+ *
+ */
+uint8_t eclitls_ktls(const ecli_transport_t *transport);
+
+/**********************************************************************/
+/** Decrypted bytes are waiting in the TLS session (socket may not be
+ * readable for them), 0 for other transports.
+ *
+ * @param transport: connected transport.
+ *
+ */
+uint8_t eclitls_pending(const ecli_transport_t *transport);
+
+#endif
@@ -0,0 +1,89 @@
+/***********************************************************************
+* FILENAME    :   libeclimqtttrace.h
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   Library header for packet lifecycle tracepoints.
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <stdint.h>
+
+/**********************************************************************/
+
+#ifndef LIBECLIMQTTTRACE_H_
+#define LIBECLIMQTTTRACE_H_
+
+/**********************************************************************/
+/*
+ * Tracepoints are compiled out unless the build sets TRACE:
+ *   TRACE=USDT   : static probes (provider ecli_mqtt) for perf/bpftrace,
+ *                  a nop instruction per point when nobody is attached.
+ *   TRACE=CHROME : in-process recorder, enabled at runtime with -Z file,
+ *                  written as Chrome trace-event JSON (chrome://tracing).
+ *   TRACE=ALL    : both.
+ * Points: encode, send, recv, decode as spans (begin/end) and ack as
+ * instant event when the ack msg id is matched.
+ */
+#define TRACE_MAX_EVENTS      65536     /* Recorded events per process */
+#define TRACE_PROVIDER        ecli_mqtt
+
+#ifdef ECLI_TRACE_USDT
+#include <sys/sdt.h>
+#define TRACE_USDT( name, msg_id, len ) DTRACE_PROBE2( TRACE_PROVIDER, name, msg_id, len )
+#else
+#define TRACE_USDT( name, msg_id, len )
+#endif
+
+#ifdef ECLI_TRACE_CHROME
+extern uint8_t eclitrace_enabled;
+#define TRACE_RECORD( name, phase, msg_id, len ) \
+    if ( __builtin_expect( eclitrace_enabled, 0 ) ) { \
+        eclitrace_record( name, phase, msg_id, len ); \
+    }
+#else
+/* Arguments are not evaluated, only referenced for unused warnings */
+#define TRACE_RECORD( name, phase, msg_id, len ) \
+    ( void ) sizeof( msg_id ); ( void ) sizeof( len );
+#endif
+
+/* Span begin / end and instant event */
+#define TRACE_BEGIN( name, msg_id, len ) do { \
+        TRACE_USDT( name##__begin, msg_id, len ); \
+        TRACE_RECORD( #name, 'B', msg_id, len ); \
+    } while ( 0 )
+#define TRACE_END( name, msg_id, len ) do { \
+        TRACE_USDT( name##__end, msg_id, len ); \
+        TRACE_RECORD( #name, 'E', msg_id, len ); \
+    } while ( 0 )
+#define TRACE_MARK( name, msg_id, len ) do { \
+        TRACE_USDT( name, msg_id, len ); \
+        TRACE_RECORD( #name, 'i', msg_id, len ); \
+    } while ( 0 )
+
+/**********************************************************************/
+/** Start in-process recorder, events are written in file at exit.
+ *
+ * @param path: Chrome trace-event JSON file path.
+ *
+ */
+int8_t eclitrace_start(const char *path);
+
+/**********************************************************************/
+/** Stop recorder and write recorded events in file.
+ *
+ */
+void eclitrace_stop(void);
+
+/**********************************************************************/
+/** Record an event (use TRACE_* macros instead).
+ *
+ * @param name: event name (static string).
+ * @param phase: 'B' begin, 'E' end, 'i' instant.
+ * @param msg_id: packet message id.
+ * @param len: packet or payload len.
+ *
+ */
+void eclitrace_record(const char *name, char phase, uint32_t msg_id, uint32_t len);
+
+#endif
@@ -0,0 +1,96 @@
+/***********************************************************************
+* FILENAME    :   libeclimqtttransport.h
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   Library header for broker transports (TCP, Unix domain
+*                 socket) behind a common operations table.
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <stdint.h>
+#include <sys/uio.h>
+
+/**********************************************************************/
+
+#include <libeclimqttnet.h>
+
+/**********************************************************************/
+
+#ifndef LIBECLIMQTTTRANSPORT_H_
+#define LIBECLIMQTTTRANSPORT_H_
+
+/**********************************************************************/
+/*
+ * Client code only talks to a transport through its ops table, a new
+ * transport (TLS, a mock for tests...) only fills one. Return values
+ * follow the socket calls: bytes or -1 with errno set.
+ */
+#define TRANSPORT_UNIX_PREFIX   "unix:"   /* -b unix:/path, unix:@abstract */
+#define TRANSPORT_PATH_LEN      108       /* sun_path */
+#define TRANSPORT_MAX_IOV       8         /* sendv vectors */
+#define TRANSPORT_FILE_CHUNK    16384     /* Read / send size without sendfile */
+
+/* connect errors */
+#define TRANSPORT_CONN_ERROR    -1        /* Broker not reachable */
+#define TRANSPORT_SESSION_ERROR -2        /* Connected, session setup (TLS) failed */
+
+typedef struct ecli_transport_s ecli_transport_t;
+
+/*Transport operations*/
+typedef struct {
+    const char *name;
+    /* Connect, bounded by timeout_ms (0 no timeout), socket in blocking mode */
+    int8_t  (*connect)(ecli_transport_t *transport, uint32_t timeout_ms);
+    int32_t (*send)(ecli_transport_t *transport, const void *buffer, int32_t count);
+    /* Gather send, all vectors or error */
+    int32_t (*sendv)(ecli_transport_t *transport, const struct iovec *iov, int32_t iovcnt);
+    /* Gather send without waiting, may be short (EAGAIN when full), NULL: sendv used */
+    int32_t (*writev)(ecli_transport_t *transport, const struct iovec *iov, int32_t iovcnt);
+    int32_t (*recv)(ecli_transport_t *transport, void *buffer, int32_t count, int32_t flags);
+    /* Header then count bytes from fd current offset */
+    int32_t (*send_file)(ecli_transport_t *transport, const void *header, int32_t header_len,
+                         int32_t fd, uint32_t count);
+    void    (*close)(ecli_transport_t *transport);
+    /* Pollable descriptor, -1 when not connected */
+    int32_t (*fd)(const ecli_transport_t *transport);
+} ecli_transport_ops_t;
+
+/*Transport instance*/
+struct ecli_transport_s {
+    const ecli_transport_ops_t *ops;
+    int32_t  socketid;                          /* Connected socket, -1 none */
+    ecli_endpoints_t *endpoints;                /* Broker list (tcp, tls) */
+    uint32_t stagger_ms;                        /* Parallel attempts delay (tcp, tls) */
+    char     path[TRANSPORT_PATH_LEN];          /* Socket path (unix) */
+    uint32_t recv_timeout_ms;                   /* recv wait, 0 forever (also SO_RCVTIMEO) */
+    void     *ctx;                              /* Transport state (TLS session) */
+};
+
+/**********************************************************************/
+/*TCP over broker endpoint list, happy eyeballs connect*/
+extern const ecli_transport_ops_t eclitransport_tcp;
+
+/*Unix domain stream socket, for brokers on the same host*/
+extern const ecli_transport_ops_t eclitransport_unix;
+
+/**********************************************************************/
+/** Set transport ops, transport is not connected.
+ *
+ * @param transport: transport instance.
+ * @param ops: transport operations.
+ *
+ */
+void eclitransport_init(ecli_transport_t *transport, const ecli_transport_ops_t *ops);
+
+/**********************************************************************/
+/** Get peer description of connected transport ("host:port" or path).
+ *
+ * @param transport: transport instance.
+ * @param peer: output buffer.
+ * @param len: output buffer size.
+ *
+ */
+void eclitransport_peer(const ecli_transport_t *transport, char *peer, uint32_t len);
+
+#endif
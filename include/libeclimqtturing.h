@@ -0,0 +1,76 @@
+/***********************************************************************
+* FILENAME    :   libeclimqtturing.h
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   Library header for io_uring transport with batched
+*                 submission and multishot receive.
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <stdint.h>
+
+/**********************************************************************/
+
+#include <libeclimqtttransport.h>
+
+/**********************************************************************/
+
+#ifndef LIBECLIMQTTURING_H_
+#define LIBECLIMQTTURING_H_
+
+/**********************************************************************/
+/*
+ * One ring per process, shared by all sessions. Sends are copied to a
+ * per session batch buffer and submitted together (one io_uring_enter
+ * for every session) when URING batch packets are queued, when the first
+ * queued one waited flush usecs, before any receive wait, when the
+ * publish loops go idle (eclituring_flush) and on close. Receives use multishot recv with a
+ * registered ring of provided buffers, so packets that arrive together
+ * are read without syscalls. Needs kernel 5.19 (provided buffer rings)
+ * and raw syscalls only; multishot recv (6.0) is used when accepted.
+ * eclituring_init fails on older kernels and the socket transports are
+ * used instead.
+ */
+#define URING_ENTRIES           256       /* SQ entries */
+#define URING_BATCH_DEFAULT     32        /* Queued packets per submission */
+#define URING_FLUSH_US_DEFAULT  1000      /* Max delay of a queued packet */
+#define URING_TX_SIZE           65536     /* Send batch buffer per session */
+#define URING_RX_BUFS           64        /* Provided receive buffers, power of 2 */
+#define URING_RX_BUF_SIZE       4096
+#define URING_BGID              1         /* Provided buffer group */
+#define URING_MAX_CONNS         64        /* Sessions on the ring */
+
+/**********************************************************************/
+/*TCP over broker endpoint list, I/O on the ring*/
+extern const ecli_transport_ops_t eclituring_tcp;
+
+/*Unix domain stream socket, I/O on the ring*/
+extern const ecli_transport_ops_t eclituring_unix;
+
+/**********************************************************************/
+/** Create ring and register receive buffers, fails when the kernel
+ * does not support what is needed (caller uses socket transports).
+ *
+ * @param batch: queued packets that trigger a submission.
+ * @param flush_us: max usecs a queued packet waits for the batch, 0 no limit.
+ *
+ */
+int8_t eclituring_init(uint32_t batch, uint32_t flush_us);
+
+/**********************************************************************/
+/** Submit queued sends of every session and wait for them.
+ *
+ */
+void eclituring_flush(void);
+
+/**********************************************************************/
+/** Get io_uring_enter calls and submitted sends so far.
+ *
+ * @param enters: io_uring_enter calls.
+ * @param sends: send operations (each one a batch of packets).
+ *
+ */
+void eclituring_stats(uint64_t *enters, uint64_t *sends);
+
+#endif
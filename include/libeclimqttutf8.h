@@ -0,0 +1,91 @@
+/***********************************************************************
+* FILENAME    :   libeclimqttutf8.h
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   Library header for UTF-8 validation of topics, filters
+*                 and text payloads with runtime CPU dispatch.
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**********************************************************************/
+
+#ifndef LIBECLIMQTTUTF8_H_
+#define LIBECLIMQTTUTF8_H_
+
+/**********************************************************************/
+/*
+ * Topic names and filters are 1 to UTF8_STRING_MAX bytes of well-formed
+ * UTF-8 (no overlong forms, surrogates or code points over U+10FFFF)
+ * without U+0000. Names hold no wildcards, in filters + and # take a
+ * whole level and # is the last one. Text payloads only need to be
+ * well-formed.
+ * Input is checked 32 (AVX2) or 16 (SSSE3) bytes at a time: ASCII blocks
+ * only look for NUL and wildcards, other blocks classify each byte pair
+ * with three nibble lookup tables (one shuffle each) and the 3rd and 4th
+ * bytes of sequences with two saturated subtracts. Picked once at first
+ * use from the running CPU; other targets (nios2, 32 bits ARM) use
+ * portable code, 8 ASCII bytes per step, with the same results.
+ */
+#define UTF8_STRING_MAX       65535     /* MQTT string length field */
+#define UTF8_SINGLE_LEVEL     '+'
+#define UTF8_MULTI_LEVEL      '#'
+#define UTF8_LEVEL_SEPARATOR  '/'
+
+/**********************************************************************/
+/** Check text payload, returns 0 when it is well-formed UTF-8, -1 if not.
+ *
+ * @param buffer: payload.
+ * @param len: payload size.
+ *
+ */
+int8_t ecliutf8_text(const void *buffer, size_t len);
+
+/**********************************************************************/
+/** Check topic name (publish), returns 0 valid, -1 not.
+ *
+ * @param topic: topic, not NUL terminated.
+ * @param len: topic size.
+ *
+ */
+int8_t ecliutf8_topic(const char *topic, size_t len);
+
+/**********************************************************************/
+/** Check topic filter (subscribe), returns 0 valid, -1 not.
+ *
+ * @param filter: filter, not NUL terminated.
+ * @param len: filter size.
+ *
+ */
+int8_t ecliutf8_filter(const char *filter, size_t len);
+
+/**********************************************************************/
+/** Topic name matches filter (+ and # wildcards, "a/#" also matches
+ * "a"), returns 1 when it does, 0 when not.
+ *
+ * @param filter: filter, NUL terminated.
+ * @param topic: topic, not NUL terminated.
+ * @param len: topic size.
+ *
+ */
+uint8_t ecliutf8_match(const char *filter, const char *topic, size_t len);
+
+/**********************************************************************/
+/** Use portable code only (benchmark and comparison), or back to CPU
+ * dispatch.
+ *
+ * @param portable: TRUE_FLAG for portable code.
+ *
+ */
+void ecliutf8_portable(uint8_t portable);
+
+/**********************************************************************/
+/** Implementation in use, "utf8:<impl>".
+ *
+ */
+const char *ecliutf8_impl(void);
+
+#endif
@@ -0,0 +1,124 @@
+/***********************************************************************
+* FILENAME    :   ecli_mqtt_broker.c
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   Embedded MQTT broker for local devices of a gateway.
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <signal.h>
+
+/**********************************************************************/
+
+#include <libeclimqttbroker.h>
+
+/**********************************************************************/
+
+void interrupt(int signal)
+{
+    eclibroker_stop();
+}
+
+/**********************************************************************/
+/** Read broker options of config file.
+ *
+ * @param conf: broker options.
+ * @param cfg_file: config file path.
+ *
+ */
+static void broker_cfg_file(ecli_broker_conf_t *conf, const char *cfg_file) {
+
+    char key[CLI_CFGLINE_LEN]   = {0};
+    char value[CLI_CFGLINE_LEN] = {0};
+    char line[CLI_CFGLINE_LEN];
+    FILE *fileptr = fopen( cfg_file, "r" );
+
+    if ( fileptr == NULL ) {
+        perror( cfg_file );
+        exit( CLI_ERROR );
+    }
+    while ( fgets( line, sizeof line, fileptr ) != NULL ) {
+        ecli_conf_value( line, key, value );
+        if ( key[0] && eclibroker_set( conf, key, value ) < 0 ) {
+            fprintf( stderr, BROKER_KEY_ERROR "\n", key );
+        }
+    }
+    fclose( fileptr );
+
+}
+
+/**********************************************************************/
+
+int main(int argc, char* argv[]){
+
+    ecli_broker_conf_t conf;
+    ecli_broker_stats_t stats;
+    const char *listen = NULL;
+    const char *port = NULL;
+    const char *max_conns = NULL;
+    const char *log_file = NULL;
+    uint8_t return_code;
+    int32_t option;
+
+    signal(SIGINT, interrupt);
+    signal(SIGTERM, interrupt);
+    signal(SIGPIPE, SIG_IGN);
+
+    /* Command line options override config file */
+    eclibroker_defaults( &conf );
+    while ( ( option = getopt( argc, argv, "b:p:n:c:L:h" ) ) != -1 ) {
+        switch ( option ) {
+            case 'b': /* Listen list */
+                listen = optarg;
+                break;
+            case 'p': /* Listen port */
+                port = optarg;
+                break;
+            case 'n': /* Max connections */
+                max_conns = optarg;
+                break;
+            case 'c': /* Config file */
+                broker_cfg_file( &conf, optarg );
+                break;
+            case 'L': /* Log file */
+                log_file = optarg;
+                break;
+            case 'h': /* Help */
+                printf(BROKER_HELP_TXT);
+                return CLI_NO_ERROR;
+            default:
+                fprintf( stderr, UNKNOW_OPT_ERROR "\n", optopt );
+                return CLI_ERROR;
+        }
+    }
+    if ( listen ) {
+        eclibroker_set( &conf, LISTEN_ID, listen );
+    }
+    if ( port ) {
+        eclibroker_set( &conf, LISTEN_PORT_ID, port );
+    }
+    if ( max_conns ) {
+        eclibroker_set( &conf, MAX_CONNS_ID, max_conns );
+    }
+    if ( log_file ) {
+        eclibroker_set( &conf, LOG_FILE_ID, log_file );
+    }
+    if ( conf.log_file[0] ) {
+        eclilog_open( conf.log_file, LOG_FILE_SIZE_DEFAULT, LOG_FILE_NUM_DEFAULT );
+    }
+
+    if ( eclibroker_init( &conf ) < 0 ) {
+        return CLI_ERROR;
+    }
+    return_code = eclibroker_run();
+
+    eclibroker_stats( &stats );
+    printf( BROKER_END_MSG "\n", stats.conns, stats.conns_max, stats.sessions, stats.retained,
+            ( unsigned long long ) stats.accepted, ( unsigned long long ) stats.msgs_in,
+            ( unsigned long long ) stats.msgs_out, ( unsigned long long ) stats.dropped,
+            ( unsigned long long ) stats.wills );
+    eclilog_close();
+
+    return return_code;
+}
@@ -0,0 +1,376 @@
+/***********************************************************************
+* FILENAME    :   ecli_mqtt_brokerbench.c
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   Broker fan-out benchmark: one publisher, N subscribers
+*                 of its topic, deliveries/s of a running broker.
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+/**********************************************************************/
+
+#include <libeclimqtt.h>
+
+/**********************************************************************/
+#define BENCH_SUBS            100
+#define BENCH_MSGS            100000
+#define BENCH_SIZE            64
+#define BENCH_WINDOW          500       /* Messages published ahead of slowest subscriber */
+#define BENCH_BATCH           64        /* Messages per publisher write */
+#define BENCH_TOPIC           "bench/fanout"
+#define BENCH_IDLE_SECS       3         /* No delivery: stop, messages were dropped */
+#define BENCH_READ_BUF        65536
+
+/*Subscriber stream parser*/
+typedef struct {
+    int32_t  fd;
+    uint64_t msgs;
+    uint32_t remain;                              /* Packet body bytes left, 0 in header */
+    uint32_t pos;                                 /* Body bytes read */
+    uint32_t mult;
+    uint8_t  in_header;
+    uint8_t  type;
+    uint8_t  pid[2];
+    uint8_t  acks[BENCH_READ_BUF / 4];            /* PUBACKs to write */
+    uint32_t acks_len;
+} bench_sub_t;
+
+/**********************************************************************/
+
+static double bench_now(void) {
+
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**********************************************************************/
+
+static int32_t bench_write(int32_t fd, const uint8_t *buffer, uint32_t len) {
+
+    ssize_t n = 0;
+
+    while ( len > 0 ) {
+        if ( ( n = write( fd, buffer, len ) ) < 0 ) {
+            if ( errno == EINTR ) {
+                continue;
+            }
+            return -1;
+        }
+        buffer += n;
+        len    -= n;
+    }
+
+    return 0;
+}
+
+/**********************************************************************/
+
+static int32_t bench_read(int32_t fd, uint8_t *buffer, uint32_t len) {
+
+    ssize_t n = 0;
+
+    while ( len > 0 ) {
+        if ( ( n = read( fd, buffer, len ) ) <= 0 ) {
+            return -1;
+        }
+        buffer += n;
+        len    -= n;
+    }
+
+    return 0;
+}
+
+/**********************************************************************/
+/* Connect with clean session, subscribe topic when qos >= 0 */
+static int32_t bench_client(const char *host, const char *port, const char *id, int32_t qos) {
+
+    static const uint8_t name[] = { MQTT_311_PROTOCOL_NAME };
+    struct addrinfo hints;
+    struct addrinfo *result = NULL;
+    uint8_t  packet[256];
+    uint32_t len = 0;
+    uint32_t id_len = strlen( id );
+    uint32_t topic_len = strlen( BENCH_TOPIC );
+    int32_t  fd = -1;
+    int32_t  one = 1;
+
+    memset( &hints, 0, sizeof( hints ) );
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if ( getaddrinfo( host, port, &hints, &result ) != 0 ) {
+        return -1;
+    }
+    if ( ( fd = socket( result->ai_family, SOCK_STREAM, 0 ) ) < 0 ||
+         connect( fd, result->ai_addr, result->ai_addrlen ) < 0 ) {
+        freeaddrinfo( result );
+        if ( fd >= 0 ) {
+            close( fd );
+        }
+        return -1;
+    }
+    freeaddrinfo( result );
+    setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof( one ) );
+
+    packet[len++] = MQTT_CTRLPKT_CONNECT | MQTT_CONNECT_FLAG;
+    packet[len++] = sizeof( name ) + 4 + 2 + id_len;
+    memcpy( packet + len, name, sizeof( name ) );
+    len += sizeof( name );
+    packet[len++] = MQTT_311_PROTOCOL_VER;
+    packet[len++] = MQTT_CLEAN_SESSION;
+    packet[len++] = 0;
+    packet[len++] = 0;
+    packet[len++] = 0;
+    packet[len++] = id_len;
+    memcpy( packet + len, id, id_len );
+    len += id_len;
+    if ( bench_write( fd, packet, len ) < 0 || bench_read( fd, packet, 4 ) < 0 || packet[3] != 0 ) {
+        close( fd );
+        return -1;
+    }
+    if ( qos < 0 ) {
+        return fd;
+    }
+    len = 0;
+    packet[len++] = MQTT_CTRLPKT_SUBSCRIBE | MQTT_SUBSCRIBE_FLAG;
+    packet[len++] = 2 + 2 + topic_len + 1;
+    packet[len++] = 0;
+    packet[len++] = 1;
+    packet[len++] = 0;
+    packet[len++] = topic_len;
+    memcpy( packet + len, BENCH_TOPIC, topic_len );
+    len += topic_len;
+    packet[len++] = qos;
+    if ( bench_write( fd, packet, len ) < 0 || bench_read( fd, packet, 5 ) < 0 || packet[4] == 0x80 ) {
+        close( fd );
+        return -1;
+    }
+
+    return fd;
+}
+
+/**********************************************************************/
+/* Count PUBLISH packets of subscriber stream, queue PUBACK of QoS 1 */
+static void bench_parse(bench_sub_t *sub, const uint8_t *data, uint32_t len, uint32_t topic_len) {
+
+    uint32_t n = 0;
+    uint32_t i = 0;
+
+    while ( len > 0 ) {
+        if ( sub->in_header ) {
+            if ( sub->type == 0 ) {
+                sub->type   = *data;
+                sub->remain = 0;
+                sub->mult   = 1;
+            }
+            else {
+                sub->remain += ( *data & ( MQTT_REMAIN_LEN - 1 ) ) * sub->mult;
+                sub->mult   *= MQTT_REMAIN_LEN;
+                if ( !( *data & MQTT_REMAIN_LEN ) ) {
+                    sub->in_header = FALSE_FLAG;
+                    sub->pos = 0;
+                }
+            }
+            data++;
+            len--;
+        }
+        else {
+            n = sub->remain - sub->pos < len ? sub->remain - sub->pos : len;
+            /* Packet id after topic */
+            for ( i = 0; i < n; i++ ) {
+                if ( sub->pos + i == 2 + topic_len || sub->pos + i == 3 + topic_len ) {
+                    sub->pid[sub->pos + i - 2 - topic_len] = data[i];
+                }
+            }
+            sub->pos += n;
+            data     += n;
+            len      -= n;
+        }
+        if ( !sub->in_header && sub->pos == sub->remain ) {
+            if ( MQTT_MSG_TYPE( &sub->type ) == MQTT_CTRLPKT_PUBLISH ) {
+                sub->msgs++;
+                if ( MQTT_QOS_TYPE( &sub->type ) && sub->acks_len + 4 <= sizeof( sub->acks ) ) {
+                    sub->acks[sub->acks_len++] = MQTT_CTRLPKT_PUBACK | MQTT_PUBACK_FLAG;
+                    sub->acks[sub->acks_len++] = 2;
+                    sub->acks[sub->acks_len++] = sub->pid[0];
+                    sub->acks[sub->acks_len++] = sub->pid[1];
+                }
+            }
+            sub->in_header = TRUE_FLAG;
+            sub->type      = 0;
+        }
+    }
+
+}
+
+/**********************************************************************/
+
+int main(int argc, char* argv[]){
+
+    struct epoll_event events[256];
+    struct epoll_event event;
+    bench_sub_t *subs = NULL;
+    uint8_t  *batch = NULL;
+    uint8_t  *buffer = NULL;
+    const char *host = BROKER_IP_DEFAULT;
+    char     port[NET_PORT_LEN];
+    char     id[32];
+    uint32_t nsubs = BENCH_SUBS;
+    uint64_t msgs = BENCH_MSGS;
+    uint32_t size = BENCH_SIZE;
+    uint32_t window = BENCH_WINDOW;
+    int32_t  qos = 0;
+    uint32_t topic_len = strlen( BENCH_TOPIC );
+    uint32_t packet_len = 0;
+    uint32_t hdr_len = 0;
+    uint64_t sent = 0;
+    uint64_t received = 0;
+    uint64_t slowest = 0;
+    uint64_t count = 0;
+    uint32_t i = 0;
+    int32_t  option = 0;
+    int32_t  epfd = -1;
+    int32_t  pub = -1;
+    int32_t  n = 0;
+    int32_t  j = 0;
+    ssize_t  rd = 0;
+    double   start = 0;
+    double   last = 0;
+    double   secs = 0;
+
+    snprintf( port, sizeof( port ), "%d", BROKER_PORT_DEFAULT );
+    while ( ( option = getopt( argc, argv, "b:p:s:m:z:q:w:h" ) ) != -1 ) {
+        switch ( option ) {
+            case 'b': host   = optarg; break;
+            case 'p': snprintf( port, sizeof( port ), "%s", optarg ); break;
+            case 's': nsubs  = strtoul( optarg, NULL, 10 ); break;
+            case 'm': msgs   = strtoull( optarg, NULL, 10 ); break;
+            case 'z': size   = strtoul( optarg, NULL, 10 ); break;
+            case 'q': qos    = atoi( optarg ) ? 1 : 0; break;
+            case 'w': window = strtoul( optarg, NULL, 10 ); break;
+            default:
+                printf( "ecli_mqtt_brokerbench [-b host] [-p port] [-s subscribers %d] [-m messages %d]\n"
+                        "                      [-z payload bytes %d] [-q qos 0|1] [-w window %d]\n",
+                        BENCH_SUBS, BENCH_MSGS, BENCH_SIZE, BENCH_WINDOW );
+                return option == 'h' ? 0 : 1;
+        }
+    }
+    if ( nsubs == 0 || window == 0 ) {
+        return 1;
+    }
+
+    /* Subscribers, then publisher */
+    subs   = calloc( nsubs, sizeof( bench_sub_t ) );
+    buffer = malloc( BENCH_READ_BUF );
+    epfd   = epoll_create1( 0 );
+    if ( subs == NULL || buffer == NULL || epfd < 0 ) {
+        return 1;
+    }
+    for ( i = 0; i < nsubs; i++ ) {
+        snprintf( id, sizeof( id ), "bench-sub-%u", i );
+        if ( ( subs[i].fd = bench_client( host, port, id, qos ) ) < 0 ) {
+            fprintf( stderr, "Subscriber %u: %s\n", i, strerror( errno ) );
+            return 1;
+        }
+        subs[i].in_header = TRUE_FLAG;
+        fcntl( subs[i].fd, F_SETFL, O_NONBLOCK );
+        event.events   = EPOLLIN;
+        event.data.u32 = i;
+        epoll_ctl( epfd, EPOLL_CTL_ADD, subs[i].fd, &event );
+    }
+    if ( ( pub = bench_client( host, port, "bench-pub", -1 ) ) < 0 ) {
+        fprintf( stderr, "Publisher: %s\n", strerror( errno ) );
+        return 1;
+    }
+
+    /* QoS 0 PUBLISH packets, payload filled once */
+    packet_len = 2 + topic_len + size;
+    if ( ( batch = malloc( BENCH_BATCH * ( packet_len + 5 ) ) ) == NULL ) {
+        return 1;
+    }
+    hdr_len = 1;
+    batch[0] = MQTT_CTRLPKT_PUBLISH | MQTT_PUBLISH_QOS0_FLAG;
+    for ( i = packet_len; ; i /= MQTT_REMAIN_LEN ) {
+        batch[hdr_len++] = ( i % MQTT_REMAIN_LEN ) | ( i >= MQTT_REMAIN_LEN ? MQTT_REMAIN_LEN : 0 );
+        if ( i < MQTT_REMAIN_LEN ) {
+            break;
+        }
+    }
+    batch[hdr_len]     = topic_len >> 8;
+    batch[hdr_len + 1] = topic_len & 0xFF;
+    memcpy( batch + hdr_len + 2, BENCH_TOPIC, topic_len );
+    memset( batch + hdr_len + 2 + topic_len, 'x', size );
+    packet_len += hdr_len;
+    for ( i = 1; i < BENCH_BATCH; i++ ) {
+        memcpy( batch + i * packet_len, batch, packet_len );
+    }
+
+    start = last = bench_now();
+    while ( received < msgs * nsubs ) {
+        /* Publish while the slowest subscriber is within window */
+        if ( sent < msgs && sent - slowest < window ) {
+            count = window - ( sent - slowest );
+            count = count < BENCH_BATCH ? count : BENCH_BATCH;
+            count = count < msgs - sent ? count : msgs - sent;
+            if ( bench_write( pub, batch, count * packet_len ) < 0 ) {
+                fprintf( stderr, "Publisher: %s\n", strerror( errno ) );
+                return 1;
+            }
+            sent += count;
+        }
+        n = epoll_wait( epfd, events, 256, ( sent < msgs && sent - slowest < window ) ? 0 : 100 );
+        for ( j = 0; j < n; j++ ) {
+            bench_sub_t *sub = &subs[events[j].data.u32];
+            while ( ( rd = read( sub->fd, buffer, BENCH_READ_BUF ) ) > 0 ) {
+                count = sub->msgs;
+                bench_parse( sub, buffer, rd, topic_len );
+                received += sub->msgs - count;
+                if ( sub->acks_len ) {
+                    bench_write( sub->fd, sub->acks, sub->acks_len );
+                    sub->acks_len = 0;
+                }
+            }
+            if ( rd == 0 ) {
+                fprintf( stderr, "Subscriber closed by broker\n" );
+                return 1;
+            }
+        }
+        if ( n > 0 ) {
+            last = bench_now();
+        }
+        else if ( bench_now() - last > BENCH_IDLE_SECS ) {
+            break;
+        }
+        slowest = subs[0].msgs;
+        for ( i = 1; i < nsubs; i++ ) {
+            slowest = subs[i].msgs < slowest ? subs[i].msgs : slowest;
+        }
+    }
+    secs = last - start;
+
+    printf( "subscribers %u, messages %llu, payload %u bytes, qos %d, window %u\n", nsubs,
+            ( unsigned long long ) msgs, size, qos, window );
+    printf( "  delivered %llu of %llu in %.3f secs\n", ( unsigned long long ) received,
+            ( unsigned long long ) ( msgs * nsubs ), secs );
+    printf( "  %.0f msgs/s in, %.0f deliveries/s out, %.1f MB/s out\n", sent / secs, received / secs,
+            received * ( double ) packet_len / secs / 1e6 );
+
+    close( pub );
+    for ( i = 0; i < nsubs; i++ ) {
+        close( subs[i].fd );
+    }
+
+    return received == msgs * nsubs ? 0 : 1;
+}
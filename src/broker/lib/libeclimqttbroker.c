@@ -0,0 +1,2816 @@
+/***********************************************************************
+* FILENAME    :   libeclimqttbroker.c
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   Embedded MQTT broker: one epoll loop, topic trie of
+*                 subscriptions and retained messages, QoS 0/1, wills.
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <netdb.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+/**********************************************************************/
+
+#include <libeclimqttbroker.h>
+
+/**********************************************************************/
+#ifdef ECLI_TLS_OPENSSL
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+#endif
+/**********************************************************************/
+/*Connection states*/
+#define BRK_LISTEN            0
+#define BRK_NEW               1         /* Waiting CONNECT */
+#define BRK_ONLINE            2
+#define BRK_CLOSED            3         /* Freed at end of loop pass */
+
+#define BRK_BUCKETS_MIN       1024      /* Level and client id hash tables */
+#define BRK_REL_MAX           1024      /* QoS 2 ids waiting PUBREL per session */
+#define BRK_ACCEPT_MAX        64        /* Connections accepted per event */
+#define BRK_BACKLOG           1024
+#define BRK_IN_MIN            256       /* Partial packet buffer */
+#define BRK_GOLDEN            0x9E3779B97F4A7C15ULL
+
+/*Message, shared by every queue it is in*/
+typedef struct {
+    uint32_t refs;
+    uint32_t len;                                 /* data bytes */
+    uint16_t topic_len;
+    uint8_t  qos;                                 /* Publish QoS, for retained */
+    uint8_t  data[];                              /* topic len (2), topic, payload */
+} brk_msg_t;
+
+/*Queued packet*/
+typedef struct brk_out {
+    struct brk_out *next;
+    brk_msg_t *msg;                               /* NULL: control packet in hdr */
+    uint32_t off;                                 /* Bytes written */
+    uint32_t len;                                 /* Packet bytes */
+    uint16_t pid;                                 /* QoS 1 publish, 0 QoS 0 */
+    uint8_t  pid_be[2];
+    uint8_t  hdr[6];                              /* Fixed header, control packet */
+    uint8_t  hdr_len;
+    uint8_t  raw;                                 /* msg data is the whole packet */
+} brk_out_t;
+
+struct brk_conn;
+struct brk_node;
+
+/*Client session, by client id*/
+typedef struct brk_session {
+    struct brk_session *hnext;
+    struct brk_conn *conn;                        /* NULL offline */
+    struct brk_node **subs;                       /* Trie nodes subscribed */
+    brk_out_t *flight_head;                       /* Written, waiting PUBACK */
+    brk_out_t *flight_tail;
+    brk_out_t *pend_head;                         /* Waiting an inflight slot */
+    brk_out_t *pend_tail;
+    uint16_t *rel;                                /* QoS 2 ids waiting PUBREL */
+    uint64_t key;
+    uint32_t inflight;                            /* QoS 1 with id, queued or written */
+    uint32_t pending;
+    uint16_t nsubs;
+    uint16_t subs_cap;
+    uint16_t nrel;
+    uint16_t rel_cap;
+    uint16_t next_pid;
+    uint8_t  clean;
+    char     id[];
+} brk_session_t;
+
+/*Connection*/
+typedef struct brk_conn {
+    int32_t  fd;
+    uint8_t  state;
+    uint8_t  tls;                                 /* TLS listener */
+    uint8_t  dirty;                               /* In dirty list */
+    uint8_t  pollout;                             /* EPOLLOUT set */
+    uint8_t  will_qos;
+    uint8_t  will_retain;
+    uint16_t keepalive;
+    uint32_t last;                                /* Secs of last read */
+    brk_session_t *session;
+    uint8_t  *in;                                 /* Partial packet */
+    uint32_t in_len;
+    uint32_t in_cap;
+    brk_out_t *out_head;
+    brk_out_t *out_tail;
+    uint32_t out_bytes;
+    brk_msg_t *will;
+    struct brk_conn *dirty_next;
+    struct brk_conn *closed_next;
+#ifdef ECLI_TLS_OPENSSL
+    SSL      *ssl;                                /* Handshake done when SSL_is_init_finished */
+#endif
+} brk_conn_t;
+
+/*Subscriber of a filter*/
+typedef struct {
+    brk_session_t *session;
+    uint8_t qos;
+} brk_sub_t;
+
+/*Topic trie level*/
+typedef struct brk_node {
+    struct brk_node *parent;
+    struct brk_node *child;                       /* Literal children */
+    struct brk_node *prev;
+    struct brk_node *next;
+    struct brk_node *hnext;                       /* Level hash chain */
+    struct brk_node *plus;                        /* + child */
+    struct brk_node *hash;                        /* # child */
+    brk_sub_t *subs;
+    brk_msg_t *retained;
+    uint64_t key;
+    uint32_t nsubs;
+    uint32_t subs_cap;
+    uint16_t len;
+    char     level[];
+} brk_node_t;
+
+/**********************************************************************/
+/**********************************************************************/
+/** Get message with topic and payload, refs 1.
+ *
+ * @param topic: topic name.
+ * @param topic_len: topic size.
+ * @param payload: message payload.
+ * @param len: payload size.
+ *
+ */
+static brk_msg_t *brk_msg_new(const uint8_t *topic, uint16_t topic_len, const uint8_t *payload, uint32_t len);
+
+/**********************************************************************/
+/** Release message reference.
+ *
+ * @param msg: message.
+ *
+ */
+static void brk_msg_put(brk_msg_t *msg);
+
+/**********************************************************************/
+/** Get queue entry from free list.
+ *
+ */
+static brk_out_t *brk_out_get(void);
+
+/**********************************************************************/
+/** Release queue entry and its message.
+ *
+ * @param entry: queue entry.
+ *
+ */
+static void brk_out_free(brk_out_t *entry);
+
+/**********************************************************************/
+/** Free queue entries list.
+ *
+ * @param entry: first entry.
+ *
+ */
+static void brk_out_free_list(brk_out_t *entry);
+
+/**********************************************************************/
+/** Get PUBLISH entry of message (no packet id yet).
+ *
+ * @param msg: message.
+ * @param qos: delivery QoS.
+ * @param retain: retain flag.
+ *
+ */
+static brk_out_t *brk_out_publish(brk_msg_t *msg, uint8_t qos, uint8_t retain);
+
+/**********************************************************************/
+/** Set packet id of QoS 1 entry.
+ *
+ * @param entry: queue entry.
+ * @param pid: packet id.
+ *
+ */
+static void brk_out_pid(brk_out_t *entry, uint16_t pid);
+
+/**********************************************************************/
+/** Fill iovec of entry from its written offset, returns iovec count.
+ *
+ * @param entry: queue entry.
+ * @param iov: iovec output, 4 entries.
+ *
+ */
+static uint32_t brk_out_iov(const brk_out_t *entry, struct iovec *iov);
+
+/**********************************************************************/
+/** Encode MQTT remaining length, returns bytes used.
+ *
+ * @param buffer: output.
+ * @param len: remaining length.
+ *
+ */
+static uint8_t brk_encode_len(uint8_t *buffer, uint32_t len);
+
+/**********************************************************************/
+/** Append entry to connection queue, written at end of loop pass.
+ *
+ * @param conn: connection.
+ * @param entry: queue entry.
+ *
+ */
+static void brk_queue(brk_conn_t *conn, brk_out_t *entry);
+
+/**********************************************************************/
+/** Queue control packet of 2 (no id) or 4 bytes.
+ *
+ * @param conn: connection.
+ * @param type: packet type and flags.
+ * @param pid: packet id, -1 none.
+ *
+ */
+static int8_t brk_queue_ctrl(brk_conn_t *conn, uint8_t type, int32_t pid);
+
+/**********************************************************************/
+/** Deliver message to session with QoS (queue, inflight or pending).
+ *
+ * @param session: subscriber session.
+ * @param msg: message.
+ * @param qos: delivery QoS.
+ * @param retain: retain flag.
+ *
+ */
+static void brk_deliver(brk_session_t *session, brk_msg_t *msg, uint8_t qos, uint8_t retain);
+
+/**********************************************************************/
+/** Move pending QoS 1 messages to free inflight slots.
+ *
+ * @param session: session.
+ *
+ */
+static void brk_pump(brk_session_t *session);
+
+/**********************************************************************/
+/** Publish message: update retained, deliver to subscribers.
+ *
+ * @param msg: message.
+ * @param qos: publish QoS.
+ * @param retain: retain flag.
+ *
+ */
+static void brk_route(brk_msg_t *msg, uint8_t qos, uint8_t retain);
+
+/**********************************************************************/
+/** Split topic or filter in levels, returns levels or -1.
+ *
+ * @param topic: topic.
+ * @param len: topic size.
+ * @param levels: level starts output.
+ * @param lens: level sizes output.
+ *
+ */
+static int32_t brk_split(const char *topic, uint32_t len, const char **levels, uint16_t *lens);
+
+/**********************************************************************/
+/** Deliver message to subscribers of nodes matching topic levels.
+ *
+ * @param node: trie node.
+ * @param levels: topic levels.
+ * @param lens: level sizes.
+ * @param i: level to match.
+ * @param n: levels.
+ * @param msg: message.
+ * @param qos: publish QoS.
+ *
+ */
+static void brk_match(brk_node_t *node, const char **levels, const uint16_t *lens, int32_t i, int32_t n,
+                      brk_msg_t *msg, uint8_t qos);
+
+/**********************************************************************/
+/** Deliver subscribers of node.
+ *
+ * @param node: trie node.
+ * @param msg: message.
+ * @param qos: publish QoS.
+ *
+ */
+static void brk_match_subs(const brk_node_t *node, brk_msg_t *msg, uint8_t qos);
+
+/**********************************************************************/
+/** Get literal child of node, created when create is set.
+ *
+ * @param node: parent node.
+ * @param level: level name.
+ * @param len: level size.
+ * @param create: create missing child.
+ *
+ */
+static brk_node_t *brk_node_child(brk_node_t *node, const char *level, uint16_t len, uint8_t create);
+
+/**********************************************************************/
+/** Get node of filter or topic levels, created when create is set.
+ *
+ * @param levels: levels.
+ * @param lens: level sizes.
+ * @param n: levels.
+ * @param create: create missing nodes.
+ *
+ */
+static brk_node_t *brk_node_walk(const char **levels, const uint16_t *lens, int32_t n, uint8_t create);
+
+/**********************************************************************/
+/** Free node and empty parents.
+ *
+ * @param node: trie node.
+ *
+ */
+static void brk_node_prune(brk_node_t *node);
+
+/**********************************************************************/
+/** Double level hash table.
+ *
+ */
+static void brk_levels_grow(void);
+
+/**********************************************************************/
+/** Add subscription, returns -1 on error.
+ *
+ * @param session: subscriber session.
+ * @param levels: filter levels.
+ * @param lens: level sizes.
+ * @param n: levels.
+ * @param qos: granted QoS.
+ *
+ */
+static int8_t brk_sub_add(brk_session_t *session, const char **levels, const uint16_t *lens, int32_t n,
+                          uint8_t qos);
+
+/**********************************************************************/
+/** Remove subscription of session from node.
+ *
+ * @param session: subscriber session.
+ * @param node: filter node.
+ *
+ */
+static void brk_sub_del(brk_session_t *session, brk_node_t *node);
+
+/**********************************************************************/
+/** Queue retained messages matching filter levels.
+ *
+ * @param node: trie node.
+ * @param levels: filter levels.
+ * @param lens: level sizes.
+ * @param i: level to match.
+ * @param n: levels.
+ * @param session: subscriber session.
+ * @param qos: granted QoS.
+ *
+ */
+static void brk_retained_match(brk_node_t *node, const char **levels, const uint16_t *lens, int32_t i,
+                               int32_t n, brk_session_t *session, uint8_t qos);
+
+/**********************************************************************/
+/** Queue retained messages of node and its literal children.
+ *
+ * @param node: trie node.
+ * @param session: subscriber session.
+ * @param qos: granted QoS.
+ *
+ */
+static void brk_retained_tree(brk_node_t *node, brk_session_t *session, uint8_t qos);
+
+/**********************************************************************/
+/** Find session of client id.
+ *
+ * @param id: client id.
+ * @param len: id size.
+ * @param key: id hash.
+ *
+ */
+static brk_session_t *brk_session_find(const char *id, uint16_t len, uint64_t key);
+
+/**********************************************************************/
+/** Create session of client id.
+ *
+ * @param id: client id.
+ * @param len: id size.
+ * @param key: id hash.
+ *
+ */
+static brk_session_t *brk_session_new(const char *id, uint16_t len, uint64_t key);
+
+/**********************************************************************/
+/** Remove subscriptions and queues of session and free it.
+ *
+ * @param session: session.
+ *
+ */
+static void brk_session_free(brk_session_t *session);
+
+/**********************************************************************/
+/** Close connection, keeping QoS 1 messages of a persistent session.
+ *
+ * @param conn: connection.
+ * @param abnormal: no DISCONNECT, publish will.
+ *
+ */
+static void brk_conn_close(brk_conn_t *conn, uint8_t abnormal);
+
+/**********************************************************************/
+/** Read socket and handle whole packets.
+ *
+ * @param conn: connection.
+ *
+ */
+static void brk_conn_read(brk_conn_t *conn);
+
+/**********************************************************************/
+/** Read socket or TLS records, returns bytes, 0 on close or -1 with
+ * errno (EAGAIN while the TLS handshake waits).
+ *
+ * @param conn: connection.
+ * @param buffer: output buffer.
+ * @param len: buffer size.
+ *
+ */
+static ssize_t brk_conn_recv(brk_conn_t *conn, uint8_t *buffer, uint32_t len);
+
+/**********************************************************************/
+/** Write vectors to socket or TLS records, returns bytes or -1 with
+ * errno (EAGAIN when full).
+ *
+ * @param conn: connection.
+ * @param iov: vectors.
+ * @param count: number of vectors.
+ *
+ */
+static ssize_t brk_conn_send(brk_conn_t *conn, const struct iovec *iov, uint32_t count);
+
+/**********************************************************************/
+/** Handle packets in buffer, returns bytes used or -1 when closed.
+ *
+ * @param conn: connection.
+ * @param data: read bytes.
+ * @param len: bytes.
+ *
+ */
+static int64_t brk_conn_parse(brk_conn_t *conn, const uint8_t *data, uint32_t len);
+
+/**********************************************************************/
+/** Handle one packet, returns -1 to close connection.
+ *
+ * @param conn: connection.
+ * @param type: packet type and flags.
+ * @param body: variable header and payload.
+ * @param len: remaining length.
+ *
+ */
+static int8_t brk_conn_packet(brk_conn_t *conn, uint8_t type, const uint8_t *body, uint32_t len);
+
+/**********************************************************************/
+/** Handle CONNECT.
+ *
+ * @param conn: connection.
+ * @param body: variable header and payload.
+ * @param len: remaining length.
+ *
+ */
+static int8_t brk_connect(brk_conn_t *conn, const uint8_t *body, uint32_t len);
+
+/**********************************************************************/
+/** Handle PUBLISH.
+ *
+ * @param conn: connection.
+ * @param type: packet type and flags.
+ * @param body: variable header and payload.
+ * @param len: remaining length.
+ *
+ */
+static int8_t brk_publish(brk_conn_t *conn, uint8_t type, const uint8_t *body, uint32_t len);
+
+/**********************************************************************/
+/** Handle SUBSCRIBE.
+ *
+ * @param conn: connection.
+ * @param body: variable header and payload.
+ * @param len: remaining length.
+ *
+ */
+static int8_t brk_subscribe(brk_conn_t *conn, const uint8_t *body, uint32_t len);
+
+/**********************************************************************/
+/** Handle UNSUBSCRIBE.
+ *
+ * @param conn: connection.
+ * @param body: variable header and payload.
+ * @param len: remaining length.
+ *
+ */
+static int8_t brk_unsubscribe(brk_conn_t *conn, const uint8_t *body, uint32_t len);
+
+/**********************************************************************/
+/** Handle PUBACK of a QoS 1 delivery.
+ *
+ * @param session: session.
+ * @param pid: packet id.
+ *
+ */
+static void brk_puback(brk_session_t *session, uint16_t pid);
+
+/**********************************************************************/
+/** Write queued packets, wait EPOLLOUT when the socket is full.
+ *
+ * @param conn: connection.
+ *
+ */
+static void brk_conn_flush(brk_conn_t *conn);
+
+/**********************************************************************/
+/** Accept connections of listening socket.
+ *
+ * @param listener: listening socket.
+ *
+ */
+static void brk_accept(brk_conn_t *listener);
+
+/**********************************************************************/
+/** Open listening socket, returns -1 on error.
+ *
+ * @param item: host, host:port, [IPv6]:port, unix:/path or unix:@name.
+ * @param port: default port.
+ *
+ */
+static int32_t brk_listen(const char *item, uint16_t port);
+
+/**********************************************************************/
+/** Open listening sockets of list, returns -1 on error.
+ *
+ * @param list: listen list.
+ * @param port: default port.
+ * @param tls: TLS listeners.
+ *
+ */
+static int8_t brk_listen_list(const char *list, uint16_t port, uint8_t tls);
+
+/**********************************************************************/
+/** Load certificate and key of TLS listeners, returns -1 on error.
+ *
+ * @param conf: broker options.
+ *
+ */
+static int8_t brk_tls_init(const ecli_broker_conf_t *conf);
+
+/**********************************************************************/
+/** Close connections without CONNECT or keep alive.
+ *
+ */
+static void brk_sweep(void);
+
+/**********************************************************************/
+/** Get monotonic secs.
+ *
+ */
+static uint32_t brk_secs(void);
+
+/**********************************************************************/
+/**********************************************************************/
+
+static ecli_broker_conf_t  brk_conf;
+static ecli_broker_stats_t brk_stats;
+static volatile uint8_t    brk_running = 0;
+static int32_t     brk_epfd = -1;
+static brk_conn_t  brk_listeners[BROKER_LISTEN_MAX];
+static uint32_t    brk_nlisten = 0;
+static brk_conn_t  **brk_conns = NULL;           /* By fd */
+static uint32_t    brk_conns_size = 0;
+static uint32_t    brk_open = 0;                 /* Sockets, connected or not */
+static brk_conn_t  *brk_dirty = NULL;
+static brk_conn_t  *brk_closed = NULL;
+static brk_node_t  brk_root;
+static brk_node_t  **brk_levels = NULL;
+static uint64_t    brk_levels_mask = 0;
+static uint64_t    brk_levels_count = 0;
+static brk_session_t **brk_ids = NULL;
+static uint64_t    brk_ids_mask = 0;
+static brk_out_t   *brk_free_outs = NULL;
+static uint8_t     brk_buffer[BROKER_READ_BUF];  /* Shared socket read buffer */
+static uint32_t    brk_now = 0;
+static uint32_t    brk_id_seq = 0;
+#ifdef ECLI_TLS_OPENSSL
+static SSL_CTX     *brk_tls_ctx = NULL;
+static uint8_t     brk_tls_out[BROKER_READ_BUF]; /* Queued packets gathered in TLS records */
+#endif
+
+/**********************************************************************/
+/** Set default options.
+ *
+ * @param conf: broker options.
+ *
+ */
+void eclibroker_defaults(ecli_broker_conf_t *conf) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    memset( conf, 0, sizeof( *conf ) );
+    strncpy( conf->listen, LISTEN_DEFAULT, sizeof( conf->listen ) - 1 );
+    conf->port         = BROKER_PORT_DEFAULT;
+    conf->max_conns    = BROKER_CONNS_DEFAULT;
+    conf->queue_bytes  = BROKER_QUEUE_DEFAULT;
+    conf->max_inflight = BROKER_INFLIGHT_DEFAULT;
+    conf->max_pending  = BROKER_PENDING_DEFAULT;
+    conf->max_packet   = BROKER_PACKET_DEFAULT;
+    conf->tls_port     = BROKER_TLS_PORT_DEFAULT;
+
+}
+
+/**********************************************************************/
+/** Set option from key and value, returns -1 when key is not known.
+ *
+ * @param conf: broker options.
+ * @param key: option key.
+ * @param value: option value.
+ *
+ */
+int8_t eclibroker_set(ecli_broker_conf_t *conf, const char *key, const char *value) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    if ( strcmp( key, LISTEN_ID ) == EQUAL_STR_CMP ) {
+        strncpy( conf->listen, value, sizeof( conf->listen ) - 1 );
+    }
+    else if ( strcmp( key, LISTEN_PORT_ID ) == EQUAL_STR_CMP ) {
+        conf->port = atoi( value );
+    }
+    else if ( strcmp( key, MAX_CONNS_ID ) == EQUAL_STR_CMP ) {
+        conf->max_conns = strtoul( value, NULL, 10 );
+    }
+    else if ( strcmp( key, QUEUE_BYTES_ID ) == EQUAL_STR_CMP ) {
+        conf->queue_bytes = strtoul( value, NULL, 10 );
+    }
+    else if ( strcmp( key, MAX_INFLIGHT_ID ) == EQUAL_STR_CMP ) {
+        conf->max_inflight = strtoul( value, NULL, 10 );
+    }
+    else if ( strcmp( key, MAX_PENDING_ID ) == EQUAL_STR_CMP ) {
+        conf->max_pending = strtoul( value, NULL, 10 );
+    }
+    else if ( strcmp( key, MAX_PACKET_ID ) == EQUAL_STR_CMP ) {
+        conf->max_packet = strtoul( value, NULL, 10 );
+    }
+    else if ( strcmp( key, LOG_FILE_ID ) == EQUAL_STR_CMP ) {
+        strncpy( conf->log_file, value, sizeof( conf->log_file ) - 1 );
+    }
+    else if ( strcmp( key, TLS_LISTEN_ID ) == EQUAL_STR_CMP ) {
+        strncpy( conf->tls_listen, value, sizeof( conf->tls_listen ) - 1 );
+    }
+    else if ( strcmp( key, TLS_LISTEN_PORT_ID ) == EQUAL_STR_CMP ) {
+        conf->tls_port = atoi( value );
+    }
+    else if ( strcmp( key, TLS_CERT_ID ) == EQUAL_STR_CMP ) {
+        strncpy( conf->tls_cert, value, sizeof( conf->tls_cert ) - 1 );
+    }
+    else if ( strcmp( key, TLS_KEY_ID ) == EQUAL_STR_CMP ) {
+        strncpy( conf->tls_key, value, sizeof( conf->tls_key ) - 1 );
+    }
+    else {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Open listening sockets, returns -1 on error.
+ *
+ * @param conf: broker options.
+ *
+ */
+int8_t eclibroker_init(const ecli_broker_conf_t *conf) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    brk_conf = *conf;
+    if ( brk_conf.max_inflight == 0 ) {
+        brk_conf.max_inflight = 1;
+    }
+    memset( &brk_stats, 0, sizeof( brk_stats ) );
+    brk_now = brk_secs();
+    if ( ( brk_epfd = epoll_create1( EPOLL_CLOEXEC ) ) < 0 ) {
+        return -1;
+    }
+    brk_levels = calloc( BRK_BUCKETS_MIN, sizeof( *brk_levels ) );
+    brk_ids    = calloc( BRK_BUCKETS_MIN, sizeof( *brk_ids ) );
+    if ( brk_levels == NULL || brk_ids == NULL ) {
+        return -1;
+    }
+    brk_levels_mask = BRK_BUCKETS_MIN - 1;
+    brk_ids_mask    = BRK_BUCKETS_MIN - 1;
+
+    if ( brk_listen_list( conf->listen, conf->port, FALSE_FLAG ) < 0 ) {
+        return -1;
+    }
+    if ( conf->tls_listen[0] &&
+         ( brk_tls_init( conf ) < 0 || brk_listen_list( conf->tls_listen, conf->tls_port, TRUE_FLAG ) < 0 ) ) {
+        return -1;
+    }
+
+    return brk_nlisten > 0 ? 0 : -1;
+}
+
+/**********************************************************************/
+/** Serve connections until eclibroker_stop.
+ *
+ */
+uint8_t eclibroker_run(void) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    struct epoll_event events[BROKER_EVENTS];
+    brk_conn_t *conn = NULL;
+    uint32_t last_sweep = 0;
+    uint32_t conns = 0;
+    uint32_t fd = 0;
+    int32_t  n = 0;
+    int32_t  i = 0;
+
+    brk_running = TRUE_FLAG;
+    last_sweep = brk_secs();
+    while ( brk_running ) {
+        n = epoll_wait( brk_epfd, events, BROKER_EVENTS, 1000 );
+        if ( n < 0 && errno != EINTR ) {
+            return CLI_ERROR;
+        }
+        brk_now = brk_secs();
+        for ( i = 0; i < n; i++ ) {
+            conn = events[i].data.ptr;
+            if ( conn->state == BRK_LISTEN ) {
+                brk_accept( conn );
+                continue;
+            }
+            if ( conn->state == BRK_CLOSED ) {
+                continue;
+            }
+            if ( events[i].events & ( EPOLLIN | EPOLLHUP | EPOLLERR ) ) {
+                brk_conn_read( conn );
+            }
+            if ( ( events[i].events & EPOLLOUT ) && conn->state != BRK_CLOSED ) {
+                brk_conn_flush( conn );
+            }
+        }
+        /* Packets queued in this pass go out with one writev per connection */
+        while ( ( conn = brk_dirty ) != NULL ) {
+            brk_dirty  = conn->dirty_next;
+            conn->dirty = FALSE_FLAG;
+            if ( conn->state != BRK_CLOSED ) {
+                brk_conn_flush( conn );
+            }
+        }
+        if ( brk_now != last_sweep ) {
+            last_sweep = brk_now;
+            brk_sweep();
+        }
+        while ( ( conn = brk_closed ) != NULL ) {
+            brk_closed = conn->closed_next;
+            free( conn );
+        }
+    }
+
+    /* Stop: connections closed without publishing wills, counters kept */
+    conns = brk_stats.conns;
+    for ( fd = 0; fd < brk_conns_size; fd++ ) {
+        if ( brk_conns[fd] != NULL ) {
+            brk_conn_close( brk_conns[fd], FALSE_FLAG );
+        }
+    }
+    brk_stats.conns = conns;
+    while ( ( conn = brk_closed ) != NULL ) {
+        brk_closed = conn->closed_next;
+        free( conn );
+    }
+    for ( i = 0; i < ( int32_t ) brk_nlisten; i++ ) {
+        close( brk_listeners[i].fd );
+    }
+    brk_nlisten = 0;
+#ifdef ECLI_TLS_OPENSSL
+    SSL_CTX_free( brk_tls_ctx );
+    brk_tls_ctx = NULL;
+#endif
+
+    return CLI_NO_ERROR;
+}
+
+/**********************************************************************/
+/** Stop event loop (async signal safe).
+ *
+ */
+void eclibroker_stop(void) {
+
+    brk_running = FALSE_FLAG;
+
+}
+
+/**********************************************************************/
+/** Get broker counters.
+ *
+ * @param stats: counters output.
+ *
+ */
+void eclibroker_stats(ecli_broker_stats_t *stats) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    *stats = brk_stats;
+
+}
+
+/**********************************************************************/
+/**********************************************************************/
+/** Get message with topic and payload, refs 1.
+ *
+ * @param topic: topic name.
+ * @param topic_len: topic size.
+ * @param payload: message payload.
+ * @param len: payload size.
+ *
+ */
+static brk_msg_t *brk_msg_new(const uint8_t *topic, uint16_t topic_len, const uint8_t *payload, uint32_t len) {
+
+    brk_msg_t *msg = malloc( sizeof( brk_msg_t ) + 2 + topic_len + len );
+
+    if ( msg == NULL ) {
+        return NULL;
+    }
+    msg->refs      = 1;
+    msg->len       = 2 + topic_len + len;
+    msg->topic_len = topic_len;
+    msg->qos       = 0;
+    msg->data[0]   = topic_len >> 8;
+    msg->data[1]   = topic_len & 0xFF;
+    memcpy( msg->data + 2, topic, topic_len );
+    if ( len ) {
+        memcpy( msg->data + 2 + topic_len, payload, len );
+    }
+
+    return msg;
+}
+
+/**********************************************************************/
+/** Release message reference.
+ *
+ * @param msg: message.
+ *
+ */
+static void brk_msg_put(brk_msg_t *msg) {
+
+    if ( msg != NULL && --msg->refs == 0 ) {
+        free( msg );
+    }
+
+}
+
+/**********************************************************************/
+/** Get queue entry from free list.
+ *
+ */
+static brk_out_t *brk_out_get(void) {
+
+    brk_out_t *entry = brk_free_outs;
+
+    if ( entry != NULL ) {
+        brk_free_outs = entry->next;
+    }
+    else if ( ( entry = malloc( sizeof( brk_out_t ) ) ) == NULL ) {
+        return NULL;
+    }
+    memset( entry, 0, sizeof( *entry ) );
+
+    return entry;
+}
+
+/**********************************************************************/
+/** Release queue entry and its message.
+ *
+ * @param entry: queue entry.
+ *
+ */
+static void brk_out_free(brk_out_t *entry) {
+
+    brk_msg_put( entry->msg );
+    entry->msg    = NULL;
+    entry->next   = brk_free_outs;
+    brk_free_outs = entry;
+
+}
+
+/**********************************************************************/
+/** Free queue entries list.
+ *
+ * @param entry: first entry.
+ *
+ */
+static void brk_out_free_list(brk_out_t *entry) {
+
+    brk_out_t *next = NULL;
+
+    for ( ; entry != NULL; entry = next ) {
+        next = entry->next;
+        brk_out_free( entry );
+    }
+
+}
+
+/**********************************************************************/
+/** Get PUBLISH entry of message (no packet id yet).
+ *
+ * @param msg: message.
+ * @param qos: delivery QoS.
+ * @param retain: retain flag.
+ *
+ */
+static brk_out_t *brk_out_publish(brk_msg_t *msg, uint8_t qos, uint8_t retain) {
+
+    brk_out_t *entry = brk_out_get();
+    uint32_t remain = msg->len + ( qos ? 2 : 0 );
+
+    if ( entry == NULL ) {
+        return NULL;
+    }
+    msg->refs++;
+    entry->msg     = msg;
+    entry->hdr[0]  = MQTT_CTRLPKT_PUBLISH | ( qos << 1 ) | ( retain ? MQTT_PUBLISH_RETAIN_FLAG : 0 );
+    entry->hdr_len = 1 + brk_encode_len( entry->hdr + 1, remain );
+    entry->len     = entry->hdr_len + remain;
+
+    return entry;
+}
+
+/**********************************************************************/
+/** Set packet id of QoS 1 entry.
+ *
+ * @param entry: queue entry.
+ * @param pid: packet id.
+ *
+ */
+static void brk_out_pid(brk_out_t *entry, uint16_t pid) {
+
+    entry->pid       = pid;
+    entry->pid_be[0] = pid >> 8;
+    entry->pid_be[1] = pid & 0xFF;
+
+}
+
+/**********************************************************************/
+/** Fill iovec of entry from its written offset, returns iovec count.
+ *
+ * @param entry: queue entry.
+ * @param iov: iovec output, 4 entries.
+ *
+ */
+static uint32_t brk_out_iov(const brk_out_t *entry, struct iovec *iov) {
+
+    const uint8_t *base[4];
+    uint32_t len[4];
+    uint32_t parts = 0;
+    uint32_t off = entry->off;
+    uint32_t count = 0;
+    uint32_t i = 0;
+
+    if ( entry->raw ) {
+        base[parts] = entry->msg->data;
+        len[parts++] = entry->msg->len;
+    }
+    else {
+        base[parts] = entry->hdr;
+        len[parts++] = entry->hdr_len;
+        if ( entry->msg != NULL ) {
+            /* topic len and topic, packet id, payload */
+            base[parts] = entry->msg->data;
+            len[parts++] = 2 + entry->msg->topic_len;
+            if ( entry->pid ) {
+                base[parts] = entry->pid_be;
+                len[parts++] = 2;
+            }
+            base[parts] = entry->msg->data + 2 + entry->msg->topic_len;
+            len[parts++] = entry->msg->len - 2 - entry->msg->topic_len;
+        }
+    }
+    for ( i = 0; i < parts; i++ ) {
+        if ( off >= len[i] ) {
+            off -= len[i];
+            continue;
+        }
+        iov[count].iov_base = ( void * ) ( base[i] + off );
+        iov[count].iov_len  = len[i] - off;
+        off = 0;
+        count++;
+    }
+
+    return count;
+}
+
+/**********************************************************************/
+/** Encode MQTT remaining length, returns bytes used.
+ *
+ * @param buffer: output.
+ * @param len: remaining length.
+ *
+ */
+static uint8_t brk_encode_len(uint8_t *buffer, uint32_t len) {
+
+    uint8_t count = 0;
+
+    do {
+        buffer[count] = len % MQTT_REMAIN_LEN;
+        len /= MQTT_REMAIN_LEN;
+        if ( len > 0 ) {
+            buffer[count] |= MQTT_REMAIN_LEN;
+        }
+        count++;
+    } while ( len > 0 && count < 4 );
+
+    return count;
+}
+
+/**********************************************************************/
+/** Append entry to connection queue, written at end of loop pass.
+ *
+ * @param conn: connection.
+ * @param entry: queue entry.
+ *
+ */
+static void brk_queue(brk_conn_t *conn, brk_out_t *entry) {
+
+    entry->next = NULL;
+    if ( conn->out_tail != NULL ) {
+        conn->out_tail->next = entry;
+    }
+    else {
+        conn->out_head = entry;
+    }
+    conn->out_tail = entry;
+    conn->out_bytes += entry->len;
+    if ( !conn->dirty ) {
+        conn->dirty      = TRUE_FLAG;
+        conn->dirty_next = brk_dirty;
+        brk_dirty        = conn;
+    }
+
+}
+
+/**********************************************************************/
+/** Queue control packet of 2 (no id) or 4 bytes.
+ *
+ * @param conn: connection.
+ * @param type: packet type and flags.
+ * @param pid: packet id, -1 none.
+ *
+ */
+static int8_t brk_queue_ctrl(brk_conn_t *conn, uint8_t type, int32_t pid) {
+
+    brk_out_t *entry = brk_out_get();
+
+    if ( entry == NULL ) {
+        return -1;
+    }
+    entry->hdr[0] = type;
+    if ( pid < 0 ) {
+        entry->hdr[1]  = 0;
+        entry->hdr_len = 2;
+    }
+    else {
+        entry->hdr[1]  = 2;
+        entry->hdr[2]  = pid >> 8;
+        entry->hdr[3]  = pid & 0xFF;
+        entry->hdr_len = 4;
+    }
+    entry->len = entry->hdr_len;
+    brk_queue( conn, entry );
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Deliver message to session with QoS (queue, inflight or pending).
+ *
+ * @param session: subscriber session.
+ * @param msg: message.
+ * @param qos: delivery QoS.
+ * @param retain: retain flag.
+ *
+ */
+static void brk_deliver(brk_session_t *session, brk_msg_t *msg, uint8_t qos, uint8_t retain) {
+
+    brk_conn_t *conn = session->conn;
+    brk_out_t *entry = NULL;
+
+    if ( conn != NULL && conn->state != BRK_ONLINE ) {
+        conn = NULL;
+    }
+    if ( qos == 0 ) {
+        /* Offline or slow subscriber: QoS 0 is dropped */
+        if ( conn == NULL ||
+             conn->out_bytes + msg->len + 5 > brk_conf.queue_bytes ||
+             ( entry = brk_out_publish( msg, 0, retain ) ) == NULL ) {
+            brk_stats.dropped++;
+            return;
+        }
+        brk_queue( conn, entry );
+        brk_stats.msgs_out++;
+        return;
+    }
+    if ( session->pending >= brk_conf.max_pending ||
+         ( entry = brk_out_publish( msg, 1, retain ) ) == NULL ) {
+        brk_stats.dropped++;
+        return;
+    }
+    brk_stats.msgs_out++;
+    if ( conn != NULL && session->inflight < brk_conf.max_inflight && session->pend_head == NULL ) {
+        if ( ++session->next_pid == 0 ) {
+            session->next_pid = 1;
+        }
+        brk_out_pid( entry, session->next_pid );
+        session->inflight++;
+        brk_queue( conn, entry );
+        return;
+    }
+    /* Keeps order behind older pending messages */
+    entry->next = NULL;
+    if ( session->pend_tail != NULL ) {
+        session->pend_tail->next = entry;
+    }
+    else {
+        session->pend_head = entry;
+    }
+    session->pend_tail = entry;
+    session->pending++;
+
+}
+
+/**********************************************************************/
+/** Move pending QoS 1 messages to free inflight slots.
+ *
+ * @param session: session.
+ *
+ */
+static void brk_pump(brk_session_t *session) {
+
+    brk_out_t *entry = NULL;
+
+    if ( session->conn == NULL || session->conn->state != BRK_ONLINE ) {
+        return;
+    }
+    while ( session->pend_head != NULL && session->inflight < brk_conf.max_inflight ) {
+        entry = session->pend_head;
+        session->pend_head = entry->next;
+        if ( session->pend_head == NULL ) {
+            session->pend_tail = NULL;
+        }
+        session->pending--;
+        if ( ++session->next_pid == 0 ) {
+            session->next_pid = 1;
+        }
+        brk_out_pid( entry, session->next_pid );
+        session->inflight++;
+        brk_queue( session->conn, entry );
+    }
+
+}
+
+/**********************************************************************/
+/** Publish message: update retained, deliver to subscribers.
+ *
+ * @param msg: message.
+ * @param qos: publish QoS.
+ * @param retain: retain flag.
+ *
+ */
+static void brk_route(brk_msg_t *msg, uint8_t qos, uint8_t retain) {
+
+    const char *levels[BROKER_LEVELS_MAX];
+    uint16_t lens[BROKER_LEVELS_MAX];
+    brk_node_t *node = NULL;
+    int32_t n = 0;
+
+    if ( ( n = brk_split( ( const char * ) msg->data + 2, msg->topic_len, levels, lens ) ) < 0 ) {
+        return;
+    }
+    brk_stats.msgs_in++;
+    if ( retain ) {
+        /* Empty payload clears retained message of topic */
+        if ( msg->len == 2U + msg->topic_len ) {
+            if ( ( node = brk_node_walk( levels, lens, n, FALSE_FLAG ) ) != NULL && node->retained != NULL ) {
+                brk_msg_put( node->retained );
+                node->retained = NULL;
+                brk_stats.retained--;
+                brk_node_prune( node );
+            }
+        }
+        else if ( ( node = brk_node_walk( levels, lens, n, TRUE_FLAG ) ) != NULL ) {
+            if ( node->retained != NULL ) {
+                brk_msg_put( node->retained );
+            }
+            else {
+                brk_stats.retained++;
+            }
+            msg->refs++;
+            msg->qos = qos;
+            node->retained = msg;
+        }
+    }
+    brk_match( &brk_root, levels, lens, 0, n, msg, qos );
+
+}
+
+/**********************************************************************/
+/** Split topic or filter in levels, returns levels or -1.
+ *
+ * @param topic: topic.
+ * @param len: topic size.
+ * @param levels: level starts output.
+ * @param lens: level sizes output.
+ *
+ */
+static int32_t brk_split(const char *topic, uint32_t len, const char **levels, uint16_t *lens) {
+
+    const char *end = topic + len;
+    const char *slash = NULL;
+    int32_t n = 0;
+
+    if ( len == 0 ) {
+        return -1;
+    }
+    while ( n < BROKER_LEVELS_MAX ) {
+        slash = memchr( topic, '/', end - topic );
+        levels[n] = topic;
+        lens[n]   = ( slash ? slash : end ) - topic;
+        n++;
+        if ( slash == NULL ) {
+            return n;
+        }
+        topic = slash + 1;
+    }
+
+    return -1;
+}
+
+/**********************************************************************/
+/** Deliver message to subscribers of nodes matching topic levels.
+ *
+ * @param node: trie node.
+ * @param levels: topic levels.
+ * @param lens: level sizes.
+ * @param i: level to match.
+ * @param n: levels.
+ * @param msg: message.
+ * @param qos: publish QoS.
+ *
+ */
+static void brk_match(brk_node_t *node, const char **levels, const uint16_t *lens, int32_t i, int32_t n,
+                      brk_msg_t *msg, uint8_t qos) {
+
+    brk_node_t *child = NULL;
+    /* Wildcards at first level do not match $ topics */
+    uint8_t wild = !( i == 0 && lens[0] > 0 && levels[0][0] == '$' );
+
+    /* # matches parent level too: a/# gets a */
+    if ( node->hash != NULL && wild ) {
+        brk_match_subs( node->hash, msg, qos );
+    }
+    if ( i == n ) {
+        brk_match_subs( node, msg, qos );
+        return;
+    }
+    if ( node->plus != NULL && wild ) {
+        brk_match( node->plus, levels, lens, i + 1, n, msg, qos );
+    }
+    if ( ( child = brk_node_child( node, levels[i], lens[i], FALSE_FLAG ) ) != NULL ) {
+        brk_match( child, levels, lens, i + 1, n, msg, qos );
+    }
+
+}
+
+/**********************************************************************/
+/** Deliver subscribers of node.
+ *
+ * @param node: trie node.
+ * @param msg: message.
+ * @param qos: publish QoS.
+ *
+ */
+static void brk_match_subs(const brk_node_t *node, brk_msg_t *msg, uint8_t qos) {
+
+    uint32_t i = 0;
+
+    for ( i = 0; i < node->nsubs; i++ ) {
+        brk_deliver( node->subs[i].session, msg, qos < node->subs[i].qos ? qos : node->subs[i].qos, FALSE_FLAG );
+    }
+
+}
+
+/**********************************************************************/
+/** Get literal child of node, created when create is set.
+ *
+ * @param node: parent node.
+ * @param level: level name.
+ * @param len: level size.
+ * @param create: create missing child.
+ *
+ */
+static brk_node_t *brk_node_child(brk_node_t *node, const char *level, uint16_t len, uint8_t create) {
+
+    uint64_t key = eclihash_xxh3( level, len ) ^ ( ( uint64_t ) ( uintptr_t ) node * BRK_GOLDEN );
+    brk_node_t *child = NULL;
+
+    for ( child = brk_levels[key & brk_levels_mask]; child != NULL; child = child->hnext ) {
+        if ( child->key == key && child->parent == node && child->len == len &&
+             memcmp( child->level, level, len ) == 0 ) {
+            return child;
+        }
+    }
+    if ( !create || ( child = calloc( 1, sizeof( brk_node_t ) + len + 1 ) ) == NULL ) {
+        return NULL;
+    }
+    child->parent = node;
+    child->key    = key;
+    child->len    = len;
+    memcpy( child->level, level, len );
+    child->next = node->child;
+    if ( node->child != NULL ) {
+        node->child->prev = child;
+    }
+    node->child  = child;
+    child->hnext = brk_levels[key & brk_levels_mask];
+    brk_levels[key & brk_levels_mask] = child;
+    if ( ++brk_levels_count > brk_levels_mask ) {
+        brk_levels_grow();
+    }
+
+    return child;
+}
+
+/**********************************************************************/
+/** Get node of filter or topic levels, created when create is set.
+ *
+ * @param levels: levels.
+ * @param lens: level sizes.
+ * @param n: levels.
+ * @param create: create missing nodes.
+ *
+ */
+static brk_node_t *brk_node_walk(const char **levels, const uint16_t *lens, int32_t n, uint8_t create) {
+
+    brk_node_t *node = &brk_root;
+    brk_node_t **wild = NULL;
+    int32_t i = 0;
+
+    for ( i = 0; i < n && node != NULL; i++ ) {
+        wild = NULL;
+        if ( lens[i] == 1 && levels[i][0] == '+' ) {
+            wild = &node->plus;
+        }
+        else if ( lens[i] == 1 && levels[i][0] == '#' ) {
+            wild = &node->hash;
+        }
+        if ( wild == NULL ) {
+            node = brk_node_child( node, levels[i], lens[i], create );
+            continue;
+        }
+        /* + and # children are not in the level hash */
+        if ( *wild == NULL && create && ( *wild = calloc( 1, sizeof( brk_node_t ) + 2 ) ) != NULL ) {
+            ( *wild )->parent   = node;
+            ( *wild )->len      = 1;
+            ( *wild )->level[0] = levels[i][0];
+        }
+        node = *wild;
+    }
+
+    return node;
+}
+
+/**********************************************************************/
+/** Free node and empty parents.
+ *
+ * @param node: trie node.
+ *
+ */
+static void brk_node_prune(brk_node_t *node) {
+
+    brk_node_t *parent = NULL;
+    brk_node_t **chain = NULL;
+
+    while ( node != &brk_root && node->nsubs == 0 && node->retained == NULL &&
+            node->child == NULL && node->plus == NULL && node->hash == NULL ) {
+        parent = node->parent;
+        if ( parent->plus == node ) {
+            parent->plus = NULL;
+        }
+        else if ( parent->hash == node ) {
+            parent->hash = NULL;
+        }
+        else {
+            if ( node->prev != NULL ) {
+                node->prev->next = node->next;
+            }
+            else {
+                parent->child = node->next;
+            }
+            if ( node->next != NULL ) {
+                node->next->prev = node->prev;
+            }
+            for ( chain = &brk_levels[node->key & brk_levels_mask]; *chain != NULL; chain = &( *chain )->hnext ) {
+                if ( *chain == node ) {
+                    *chain = node->hnext;
+                    break;
+                }
+            }
+            brk_levels_count--;
+        }
+        free( node->subs );
+        free( node );
+        node = parent;
+    }
+
+}
+
+/**********************************************************************/
+/** Double level hash table.
+ *
+ */
+static void brk_levels_grow(void) {
+
+    uint64_t size = ( brk_levels_mask + 1 ) * 2;
+    brk_node_t **table = calloc( size, sizeof( *table ) );
+    brk_node_t *node = NULL;
+    brk_node_t *next = NULL;
+    uint64_t i = 0;
+
+    if ( table == NULL ) {
+        return;
+    }
+    for ( i = 0; i <= brk_levels_mask; i++ ) {
+        for ( node = brk_levels[i]; node != NULL; node = next ) {
+            next = node->hnext;
+            node->hnext = table[node->key & ( size - 1 )];
+            table[node->key & ( size - 1 )] = node;
+        }
+    }
+    free( brk_levels );
+    brk_levels      = table;
+    brk_levels_mask = size - 1;
+
+}
+
+/**********************************************************************/
+/** Add subscription, returns -1 on error.
+ *
+ * @param session: subscriber session.
+ * @param levels: filter levels.
+ * @param lens: level sizes.
+ * @param n: levels.
+ * @param qos: granted QoS.
+ *
+ */
+static int8_t brk_sub_add(brk_session_t *session, const char **levels, const uint16_t *lens, int32_t n,
+                          uint8_t qos) {
+
+    brk_node_t *node = brk_node_walk( levels, lens, n, TRUE_FLAG );
+    brk_node_t **subs = NULL;
+    brk_sub_t *node_subs = NULL;
+    uint32_t i = 0;
+    uint32_t cap = 0;
+
+    if ( node == NULL ) {
+        return -1;
+    }
+    /* Same filter again replaces QoS */
+    for ( i = 0; i < node->nsubs; i++ ) {
+        if ( node->subs[i].session == session ) {
+            node->subs[i].qos = qos;
+            return 0;
+        }
+    }
+    if ( session->nsubs == UINT16_MAX ) {
+        brk_node_prune( node );
+        return -1;
+    }
+    if ( node->nsubs == node->subs_cap ) {
+        cap = node->subs_cap ? node->subs_cap * 2 : 2;
+        if ( ( node_subs = realloc( node->subs, cap * sizeof( brk_sub_t ) ) ) == NULL ) {
+            brk_node_prune( node );
+            return -1;
+        }
+        node->subs     = node_subs;
+        node->subs_cap = cap;
+    }
+    if ( session->nsubs == session->subs_cap ) {
+        cap = session->subs_cap ? session->subs_cap * 2 : 2;
+        if ( cap > UINT16_MAX ) {
+            cap = UINT16_MAX;
+        }
+        if ( ( subs = realloc( session->subs, cap * sizeof( brk_node_t * ) ) ) == NULL ) {
+            brk_node_prune( node );
+            return -1;
+        }
+        session->subs     = subs;
+        session->subs_cap = cap;
+    }
+    node->subs[node->nsubs].session = session;
+    node->subs[node->nsubs].qos     = qos;
+    node->nsubs++;
+    session->subs[session->nsubs++] = node;
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Remove subscription of session from node.
+ *
+ * @param session: subscriber session.
+ * @param node: filter node.
+ *
+ */
+static void brk_sub_del(brk_session_t *session, brk_node_t *node) {
+
+    uint32_t i = 0;
+
+    for ( i = 0; i < node->nsubs; i++ ) {
+        if ( node->subs[i].session == session ) {
+            node->subs[i] = node->subs[--node->nsubs];
+            break;
+        }
+    }
+    for ( i = 0; i < session->nsubs; i++ ) {
+        if ( session->subs[i] == node ) {
+            session->subs[i] = session->subs[--session->nsubs];
+            break;
+        }
+    }
+    if ( node->nsubs == 0 ) {
+        free( node->subs );
+        node->subs     = NULL;
+        node->subs_cap = 0;
+        brk_node_prune( node );
+    }
+
+}
+
+/**********************************************************************/
+/** Queue retained messages matching filter levels.
+ *
+ * @param node: trie node.
+ * @param levels: filter levels.
+ * @param lens: level sizes.
+ * @param i: level to match.
+ * @param n: levels.
+ * @param session: subscriber session.
+ * @param qos: granted QoS.
+ *
+ */
+static void brk_retained_match(brk_node_t *node, const char **levels, const uint16_t *lens, int32_t i,
+                               int32_t n, brk_session_t *session, uint8_t qos) {
+
+    brk_node_t *child = NULL;
+
+    if ( i == n ) {
+        if ( node->retained != NULL ) {
+            brk_deliver( session, node->retained, qos < node->retained->qos ? qos : node->retained->qos,
+                         TRUE_FLAG );
+        }
+        return;
+    }
+    if ( lens[i] == 1 && levels[i][0] == '#' ) {
+        if ( node->retained != NULL ) {
+            brk_deliver( session, node->retained, qos < node->retained->qos ? qos : node->retained->qos,
+                         TRUE_FLAG );
+        }
+        for ( child = node->child; child != NULL; child = child->next ) {
+            if ( node != &brk_root || child->level[0] != '$' ) {
+                brk_retained_tree( child, session, qos );
+            }
+        }
+        return;
+    }
+    if ( lens[i] == 1 && levels[i][0] == '+' ) {
+        for ( child = node->child; child != NULL; child = child->next ) {
+            if ( node != &brk_root || child->level[0] != '$' ) {
+                brk_retained_match( child, levels, lens, i + 1, n, session, qos );
+            }
+        }
+        return;
+    }
+    if ( ( child = brk_node_child( node, levels[i], lens[i], FALSE_FLAG ) ) != NULL ) {
+        brk_retained_match( child, levels, lens, i + 1, n, session, qos );
+    }
+
+}
+
+/**********************************************************************/
+/** Queue retained messages of node and its literal children.
+ *
+ * @param node: trie node.
+ * @param session: subscriber session.
+ * @param qos: granted QoS.
+ *
+ */
+static void brk_retained_tree(brk_node_t *node, brk_session_t *session, uint8_t qos) {
+
+    brk_node_t *child = NULL;
+
+    if ( node->retained != NULL ) {
+        brk_deliver( session, node->retained, qos < node->retained->qos ? qos : node->retained->qos,
+                     TRUE_FLAG );
+    }
+    for ( child = node->child; child != NULL; child = child->next ) {
+        brk_retained_tree( child, session, qos );
+    }
+
+}
+
+/**********************************************************************/
+/** Find session of client id.
+ *
+ * @param id: client id.
+ * @param len: id size.
+ * @param key: id hash.
+ *
+ */
+static brk_session_t *brk_session_find(const char *id, uint16_t len, uint64_t key) {
+
+    brk_session_t *session = NULL;
+
+    for ( session = brk_ids[key & brk_ids_mask]; session != NULL; session = session->hnext ) {
+        if ( session->key == key && strlen( session->id ) == len && memcmp( session->id, id, len ) == 0 ) {
+            return session;
+        }
+    }
+
+    return NULL;
+}
+
+/**********************************************************************/
+/** Create session of client id.
+ *
+ * @param id: client id.
+ * @param len: id size.
+ * @param key: id hash.
+ *
+ */
+static brk_session_t *brk_session_new(const char *id, uint16_t len, uint64_t key) {
+
+    brk_session_t *session = NULL;
+    brk_session_t **table = NULL;
+    brk_session_t *next = NULL;
+    uint64_t size = 0;
+    uint64_t i = 0;
+
+    if ( ( session = calloc( 1, sizeof( brk_session_t ) + len + 1 ) ) == NULL ) {
+        return NULL;
+    }
+    memcpy( session->id, id, len );
+    session->key = key;
+    session->hnext = brk_ids[key & brk_ids_mask];
+    brk_ids[key & brk_ids_mask] = session;
+    /* One session per bucket on average */
+    if ( ++brk_stats.sessions > brk_ids_mask &&
+         ( table = calloc( ( brk_ids_mask + 1 ) * 2, sizeof( *table ) ) ) != NULL ) {
+        size = ( brk_ids_mask + 1 ) * 2;
+        for ( i = 0; i <= brk_ids_mask; i++ ) {
+            for ( session = brk_ids[i]; session != NULL; session = next ) {
+                next = session->hnext;
+                session->hnext = table[session->key & ( size - 1 )];
+                table[session->key & ( size - 1 )] = session;
+            }
+        }
+        free( brk_ids );
+        brk_ids      = table;
+        brk_ids_mask = size - 1;
+        session = brk_session_find( id, len, key );
+    }
+
+    return session;
+}
+
+/**********************************************************************/
+/** Remove subscriptions and queues of session and free it.
+ *
+ * @param session: session.
+ *
+ */
+static void brk_session_free(brk_session_t *session) {
+
+    brk_session_t **chain = NULL;
+
+    while ( session->nsubs > 0 ) {
+        brk_sub_del( session, session->subs[session->nsubs - 1] );
+    }
+    for ( chain = &brk_ids[session->key & brk_ids_mask]; *chain != NULL; chain = &( *chain )->hnext ) {
+        if ( *chain == session ) {
+            *chain = session->hnext;
+            break;
+        }
+    }
+    brk_out_free_list( session->flight_head );
+    brk_out_free_list( session->pend_head );
+    brk_stats.sessions--;
+    free( session->subs );
+    free( session->rel );
+    free( session );
+
+}
+
+/**********************************************************************/
+/** Close connection, keeping QoS 1 messages of a persistent session.
+ *
+ * @param conn: connection.
+ * @param abnormal: no DISCONNECT, publish will.
+ *
+ */
+static void brk_conn_close(brk_conn_t *conn, uint8_t abnormal) {
+
+    brk_session_t *session = conn->session;
+    brk_out_t *entry = NULL;
+    brk_out_t *next = NULL;
+    brk_out_t *unsent = NULL;
+    brk_out_t *unsent_last = NULL;
+    uint32_t count = 0;
+
+    if ( conn->state == BRK_CLOSED ) {
+        return;
+    }
+    if ( conn->state == BRK_ONLINE ) {
+        brk_stats.conns--;
+    }
+    epoll_ctl( brk_epfd, EPOLL_CTL_DEL, conn->fd, NULL );
+#ifdef ECLI_TLS_OPENSSL
+    if ( conn->ssl != NULL ) {
+        /* close_notify only on a clean close, it may not fit a full socket */
+        if ( !abnormal && SSL_is_init_finished( conn->ssl ) ) {
+            SSL_shutdown( conn->ssl );
+        }
+        SSL_free( conn->ssl );
+        conn->ssl = NULL;
+    }
+#endif
+    close( conn->fd );
+    brk_open--;
+    brk_conns[conn->fd] = NULL;
+    conn->state = BRK_CLOSED;
+
+    /* QoS 1 written in part waits PUBACK, not written goes back to pending */
+    for ( entry = conn->out_head; entry != NULL; entry = next ) {
+        next = entry->next;
+        if ( session == NULL || session->clean || entry->pid == 0 ) {
+            brk_out_free( entry );
+        }
+        else if ( entry->off > 0 ) {
+            entry->next = NULL;
+            entry->hdr[0] |= MQTT_PUBLISH_DUP_FLAG;
+            if ( session->flight_tail != NULL ) {
+                session->flight_tail->next = entry;
+            }
+            else {
+                session->flight_head = entry;
+            }
+            session->flight_tail = entry;
+        }
+        else {
+            entry->pid  = 0;
+            entry->next = NULL;
+            if ( unsent_last != NULL ) {
+                unsent_last->next = entry;
+            }
+            else {
+                unsent = entry;
+            }
+            unsent_last = entry;
+            count++;
+        }
+    }
+    conn->out_head = conn->out_tail = NULL;
+    if ( unsent != NULL ) {
+        unsent_last->next = session->pend_head;
+        if ( session->pend_head == NULL ) {
+            session->pend_tail = unsent_last;
+        }
+        session->pend_head = unsent;
+        session->pending  += count;
+        session->inflight -= count;
+    }
+    free( conn->in );
+    conn->in = NULL;
+    if ( session != NULL ) {
+        session->conn = NULL;
+        if ( session->clean ) {
+            brk_session_free( session );
+        }
+    }
+    if ( conn->will != NULL ) {
+        if ( abnormal ) {
+            brk_stats.wills++;
+            brk_route( conn->will, conn->will_qos, conn->will_retain );
+        }
+        brk_msg_put( conn->will );
+        conn->will = NULL;
+    }
+    conn->closed_next = brk_closed;
+    brk_closed = conn;
+
+}
+
+/**********************************************************************/
+/** Read socket and handle whole packets.
+ *
+ * @param conn: connection.
+ *
+ */
+static void brk_conn_read(brk_conn_t *conn) {
+
+    const uint8_t *data = brk_buffer;
+    uint8_t *in = NULL;
+    ssize_t  n = brk_conn_recv( conn, brk_buffer, sizeof( brk_buffer ) );
+    uint32_t len = 0;
+    uint32_t cap = 0;
+    int64_t  used = 0;
+
+    if ( n <= 0 ) {
+        if ( n < 0 && ( errno == EAGAIN || errno == EINTR ) ) {
+            return;
+        }
+        brk_conn_close( conn, TRUE_FLAG );
+        return;
+    }
+    brk_stats.bytes_in += n;
+    conn->last = brk_now;
+    len = n;
+    /* Only a partial packet is kept in the connection buffer */
+    if ( conn->in_len > 0 ) {
+        if ( conn->in_len + len > conn->in_cap ) {
+            cap = ( conn->in_len + len ) * 2;
+            if ( ( in = realloc( conn->in, cap ) ) == NULL ) {
+                brk_conn_close( conn, TRUE_FLAG );
+                return;
+            }
+            conn->in     = in;
+            conn->in_cap = cap;
+        }
+        memcpy( conn->in + conn->in_len, brk_buffer, len );
+        len += conn->in_len;
+        data = conn->in;
+    }
+    if ( ( used = brk_conn_parse( conn, data, len ) ) < 0 ) {
+        return;
+    }
+    len -= used;
+    if ( len == 0 ) {
+        free( conn->in );
+        conn->in     = NULL;
+        conn->in_len = conn->in_cap = 0;
+    }
+    else if ( data == conn->in ) {
+        memmove( conn->in, conn->in + used, len );
+        conn->in_len = len;
+    }
+    else {
+        if ( len > conn->in_cap ) {
+            cap = len > BRK_IN_MIN ? len : BRK_IN_MIN;
+            free( conn->in );
+            if ( ( conn->in = malloc( cap ) ) == NULL ) {
+                conn->in_len = conn->in_cap = 0;
+                brk_conn_close( conn, TRUE_FLAG );
+                return;
+            }
+            conn->in_cap = cap;
+        }
+        memcpy( conn->in, data + used, len );
+        conn->in_len = len;
+    }
+#ifdef ECLI_TLS_OPENSSL
+    /* Decrypted bytes left in the TLS buffer raise no epoll event */
+    if ( conn->ssl != NULL && conn->state != BRK_CLOSED && SSL_pending( conn->ssl ) > 0 ) {
+        brk_conn_read( conn );
+    }
+#endif
+
+}
+
+/**********************************************************************/
+/** Read socket or TLS records, returns bytes, 0 on close or -1 with
+ * errno (EAGAIN while the TLS handshake waits).
+ *
+ * @param conn: connection.
+ * @param buffer: output buffer.
+ * @param len: buffer size.
+ *
+ */
+static ssize_t brk_conn_recv(brk_conn_t *conn, uint8_t *buffer, uint32_t len) {
+
+#ifdef ECLI_TLS_OPENSSL
+    struct epoll_event event;
+    int32_t  result = 0;
+    int32_t  error = 0;
+
+    if ( conn->ssl != NULL ) {
+        if ( !SSL_is_init_finished( conn->ssl ) ) {
+            result = SSL_accept( conn->ssl );
+        }
+        if ( result >= 0 && SSL_is_init_finished( conn->ssl ) ) {
+            result = SSL_read( conn->ssl, buffer, len );
+        }
+        if ( result > 0 ) {
+            return result;
+        }
+        error = SSL_get_error( conn->ssl, result );
+        ERR_clear_error();
+        /* Handshake records not sent wait EPOLLOUT, flush resumes the handshake */
+        if ( !SSL_is_init_finished( conn->ssl ) && ( error == SSL_ERROR_WANT_WRITE ) != conn->pollout ) {
+            conn->pollout  = error == SSL_ERROR_WANT_WRITE;
+            event.events   = EPOLLIN | ( conn->pollout ? EPOLLOUT : 0 );
+            event.data.ptr = conn;
+            epoll_ctl( brk_epfd, EPOLL_CTL_MOD, conn->fd, &event );
+        }
+        if ( error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE ) {
+            errno = EAGAIN;
+            return -1;
+        }
+        if ( error == SSL_ERROR_ZERO_RETURN ) {
+            return 0;
+        }
+        if ( error != SSL_ERROR_SYSCALL || errno == 0 ) {
+            errno = EPROTO;
+        }
+        return -1;
+    }
+#endif
+
+    return read( conn->fd, buffer, len );
+}
+
+/**********************************************************************/
+/** Write vectors to socket or TLS records, returns bytes or -1 with
+ * errno (EAGAIN when full).
+ *
+ * @param conn: connection.
+ * @param iov: vectors.
+ * @param count: number of vectors.
+ *
+ */
+static ssize_t brk_conn_send(brk_conn_t *conn, const struct iovec *iov, uint32_t count) {
+
+#ifdef ECLI_TLS_OPENSSL
+    uint32_t len = 0;
+    uint32_t part = 0;
+    uint32_t i = 0;
+    int32_t  result = 0;
+    int32_t  error = 0;
+
+    if ( conn->ssl != NULL ) {
+        /* Gathered so small packets share a record; a retry after WANT_WRITE
+           gathers the same head of queue, never fewer bytes */
+        for ( i = 0; i < count && len < sizeof( brk_tls_out ); i++ ) {
+            part = iov[i].iov_len < sizeof( brk_tls_out ) - len ? iov[i].iov_len : sizeof( brk_tls_out ) - len;
+            memcpy( brk_tls_out + len, iov[i].iov_base, part );
+            len += part;
+        }
+        if ( ( result = SSL_write( conn->ssl, brk_tls_out, len ) ) > 0 ) {
+            return result;
+        }
+        error = SSL_get_error( conn->ssl, result );
+        ERR_clear_error();
+        if ( error == SSL_ERROR_WANT_WRITE || error == SSL_ERROR_WANT_READ ) {
+            errno = EAGAIN;
+        }
+        else if ( error != SSL_ERROR_SYSCALL || errno == 0 ) {
+            errno = EPROTO;
+        }
+        return -1;
+    }
+#endif
+
+    return writev( conn->fd, iov, count );
+}
+
+/**********************************************************************/
+/** Handle packets in buffer, returns bytes used or -1 when closed.
+ *
+ * @param conn: connection.
+ * @param data: read bytes.
+ * @param len: bytes.
+ *
+ */
+static int64_t brk_conn_parse(brk_conn_t *conn, const uint8_t *data, uint32_t len) {
+
+    uint32_t pos = 0;
+    uint32_t remain = 0;
+    uint32_t mult = 0;
+    uint32_t i = 0;
+    uint8_t  byte = 0;
+
+    while ( len - pos >= MQTT_FIXED_HEADER_LEN ) {
+        remain = 0;
+        mult   = 1;
+        i      = 1;
+        do {
+            if ( pos + i >= len ) {
+                return pos;
+            }
+            byte = data[pos + i];
+            remain += ( byte & ( MQTT_REMAIN_LEN - 1 ) ) * mult;
+            mult *= MQTT_REMAIN_LEN;
+            i++;
+        } while ( ( byte & MQTT_REMAIN_LEN ) && i <= 4 );
+        if ( ( byte & MQTT_REMAIN_LEN ) || remain > brk_conf.max_packet ) {
+            brk_conn_close( conn, TRUE_FLAG );
+            return -1;
+        }
+        if ( len - pos < i + remain ) {
+            return pos;
+        }
+        if ( brk_conn_packet( conn, data[pos], data + pos + i, remain ) < 0 ) {
+            brk_conn_close( conn, TRUE_FLAG );
+            return -1;
+        }
+        if ( conn->state == BRK_CLOSED ) {
+            return -1;
+        }
+        pos += i + remain;
+    }
+
+    return pos;
+}
+
+/**********************************************************************/
+/** Handle one packet, returns -1 to close connection.
+ *
+ * @param conn: connection.
+ * @param type: packet type and flags.
+ * @param body: variable header and payload.
+ * @param len: remaining length.
+ *
+ */
+static int8_t brk_conn_packet(brk_conn_t *conn, uint8_t type, const uint8_t *body, uint32_t len) {
+
+    uint16_t pid = len >= 2 ? ( body[0] << 8 ) | body[1] : 0;
+    uint16_t i = 0;
+
+    if ( conn->state == BRK_NEW ) {
+        return MQTT_MSG_TYPE( &type ) == MQTT_CTRLPKT_CONNECT ? brk_connect( conn, body, len ) : -1;
+    }
+    switch ( MQTT_MSG_TYPE( &type ) ) {
+        case MQTT_CTRLPKT_PUBLISH:
+            return brk_publish( conn, type, body, len );
+        case MQTT_CTRLPKT_PUBACK:
+            brk_puback( conn->session, pid );
+            return 0;
+        case MQTT_CTRLPKT_PUBREL:
+            /* QoS 2 message was delivered on PUBLISH, forget its id */
+            for ( i = 0; i < conn->session->nrel; i++ ) {
+                if ( conn->session->rel[i] == pid ) {
+                    conn->session->rel[i] = conn->session->rel[--conn->session->nrel];
+                    break;
+                }
+            }
+            return brk_queue_ctrl( conn, MQTT_CTRLPKT_PUBCOMP | MQTT_PUBCOMP_FLAG, pid );
+        case MQTT_CTRLPKT_PUBREC:
+        case MQTT_CTRLPKT_PUBCOMP:
+            /* Deliveries are QoS 1 at most */
+            return 0;
+        case MQTT_CTRLPKT_SUBSCRIBE:
+            return brk_subscribe( conn, body, len );
+        case MQTT_CTRLPKT_UNSUBSCRIBE:
+            return brk_unsubscribe( conn, body, len );
+        case MQTT_CTRLPKT_PINGREQ:
+            return brk_queue_ctrl( conn, MQTT_CTRLPKT_PINGRESP | MQTT_PINGRESP_FLAG, -1 );
+        case MQTT_CTRLPKT_DISCONNECT:
+            /* Clean close: will is discarded */
+            brk_msg_put( conn->will );
+            conn->will = NULL;
+            brk_conn_flush( conn );
+            brk_conn_close( conn, FALSE_FLAG );
+            return 0;
+        default:
+            return -1;
+    }
+
+}
+
+/**********************************************************************/
+/** Handle CONNECT.
+ *
+ * @param conn: connection.
+ * @param body: variable header and payload.
+ * @param len: remaining length.
+ *
+ */
+static int8_t brk_connect(brk_conn_t *conn, const uint8_t *body, uint32_t len) {
+
+    static const uint8_t name_311[] = { MQTT_311_PROTOCOL_NAME };
+    static const uint8_t name_31[]  = { MQTT_31_PROTOCOL_NAME };
+    const uint8_t *will_topic = NULL;
+    const uint8_t *will_msg = NULL;
+    const char *id = NULL;
+    brk_session_t *session = NULL;
+    brk_out_t *entry = NULL;
+    struct iovec iov;
+    char     gen_id[32];
+    uint8_t  connack[4] = { MQTT_CTRLPKT_CONNACK | MQTT_CONNACK_FLAG, 2, 0, 0 };
+    uint8_t  flags = 0;
+    uint8_t  present = 0;
+    uint16_t id_len = 0;
+    uint16_t will_topic_len = 0;
+    uint16_t will_len = 0;
+    uint64_t key = 0;
+    uint32_t pos = 0;
+
+    /* Protocol name and level, connect flags, keep alive */
+    if ( len >= sizeof( name_311 ) + 4 && memcmp( body, name_311, sizeof( name_311 ) ) == 0 ) {
+        pos = sizeof( name_311 );
+        if ( body[pos] != MQTT_311_PROTOCOL_VER ) {
+            connack[3] = 1;
+        }
+    }
+    else if ( len >= sizeof( name_31 ) + 4 && memcmp( body, name_31, sizeof( name_31 ) ) == 0 ) {
+        pos = sizeof( name_31 );
+        if ( body[pos] != MQTT_31_PROTOCOL_VER ) {
+            connack[3] = 1;
+        }
+    }
+    else {
+        return -1;
+    }
+    flags           = body[pos + 1];
+    conn->keepalive = ( body[pos + 2] << 8 ) | body[pos + 3];
+    pos += 4;
+    if ( flags & 1 ) {
+        return -1;
+    }
+    if ( pos + 2 > len || pos + 2 + ( id_len = ( body[pos] << 8 ) | body[pos + 1] ) > len ) {
+        return -1;
+    }
+    id   = ( const char * ) body + pos + 2;
+    pos += 2 + id_len;
+    if ( flags & MQTT_WILL_FLAG ) {
+        if ( pos + 2 > len || pos + 2 + ( will_topic_len = ( body[pos] << 8 ) | body[pos + 1] ) > len ) {
+            return -1;
+        }
+        will_topic = body + pos + 2;
+        pos += 2 + will_topic_len;
+        if ( pos + 2 > len || pos + 2 + ( will_len = ( body[pos] << 8 ) | body[pos + 1] ) > len ) {
+            return -1;
+        }
+        will_msg = body + pos + 2;
+        /* Will topic is a topic name like a PUBLISH one */
+        if ( ecliutf8_topic( ( const char * ) will_topic, will_topic_len ) < 0 ) {
+            return -1;
+        }
+    }
+    /* User name and password are not checked */
+    if ( id_len == 0 ) {
+        if ( !( flags & MQTT_CLEAN_SESSION ) ) {
+            connack[3] = 2;
+        }
+        else {
+            id_len = snprintf( gen_id, sizeof( gen_id ), "ecli-broker-%u", ++brk_id_seq );
+            id = gen_id;
+        }
+    }
+    if ( connack[3] != 0 ) {
+        /* Refused: CONNACK fits a new socket buffer */
+        iov.iov_base = connack;
+        iov.iov_len  = sizeof( connack );
+        if ( brk_conn_send( conn, &iov, 1 ) < 0 ) {
+            return -1;
+        }
+        brk_conn_close( conn, FALSE_FLAG );
+        return 0;
+    }
+    if ( flags & MQTT_WILL_FLAG ) {
+        if ( ( conn->will = brk_msg_new( will_topic, will_topic_len, will_msg, will_len ) ) == NULL ) {
+            return -1;
+        }
+        conn->will_qos    = ( flags & ( MQTT_WILL_QOS1 | MQTT_WILL_QOS2 ) ) >> 3;
+        conn->will_retain = ( flags & MQTT_WILL_RETAIN ) ? TRUE_FLAG : FALSE_FLAG;
+    }
+
+    /* Same client id takes over: old connection closed, its will published */
+    key = eclihash_xxh3( id, id_len );
+    if ( ( session = brk_session_find( id, id_len, key ) ) != NULL && session->conn != NULL ) {
+        brk_conn_close( session->conn, TRUE_FLAG );
+        session = brk_session_find( id, id_len, key );
+    }
+    if ( session != NULL && ( flags & MQTT_CLEAN_SESSION ) ) {
+        brk_session_free( session );
+        session = NULL;
+    }
+    present = session != NULL;
+    if ( session == NULL && ( session = brk_session_new( id, id_len, key ) ) == NULL ) {
+        return -1;
+    }
+    session->clean = ( flags & MQTT_CLEAN_SESSION ) ? TRUE_FLAG : FALSE_FLAG;
+    session->conn  = conn;
+    conn->session  = session;
+    conn->state    = BRK_ONLINE;
+    if ( ++brk_stats.conns > brk_stats.conns_max ) {
+        brk_stats.conns_max = brk_stats.conns;
+    }
+    /* Session present flag, return code 0 */
+    if ( brk_queue_ctrl( conn, MQTT_CTRLPKT_CONNACK | MQTT_CONNACK_FLAG, present ? MQTT_CONNACK_SESS_PRESENT << 8 : 0 ) < 0 ) {
+        return -1;
+    }
+
+    /* Unacked messages again with DUP, then pending ones */
+    while ( ( entry = session->flight_head ) != NULL ) {
+        session->flight_head = entry->next;
+        entry->off = 0;
+        entry->hdr[0] |= MQTT_PUBLISH_DUP_FLAG;
+        brk_queue( conn, entry );
+    }
+    session->flight_tail = NULL;
+    brk_pump( session );
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Handle PUBLISH.
+ *
+ * @param conn: connection.
+ * @param type: packet type and flags.
+ * @param body: variable header and payload.
+ * @param len: remaining length.
+ *
+ */
+static int8_t brk_publish(brk_conn_t *conn, uint8_t type, const uint8_t *body, uint32_t len) {
+
+    brk_session_t *session = conn->session;
+    brk_msg_t *msg = NULL;
+    uint16_t *rel = NULL;
+    uint8_t  qos = MQTT_QOS_TYPE( &type );
+    uint8_t  retain = type & MQTT_PUBLISH_RETAIN_FLAG;
+    uint16_t topic_len = 0;
+    uint16_t pid = 0;
+    uint32_t pos = 0;
+    uint16_t i = 0;
+
+    if ( qos > 2 || len < 2 || 2U + ( topic_len = ( body[0] << 8 ) | body[1] ) > len ) {
+        return -1;
+    }
+    pos = 2 + topic_len;
+    /* UTF-8 without NUL or wildcards, else connection is closed */
+    if ( ecliutf8_topic( ( const char * ) body + 2, topic_len ) < 0 ) {
+        return -1;
+    }
+    if ( qos > 0 ) {
+        if ( pos + 2 > len || ( pid = ( body[pos] << 8 ) | body[pos + 1] ) == 0 ) {
+            return -1;
+        }
+        pos += 2;
+    }
+    if ( qos == 2 ) {
+        /* Duplicate of a QoS 2 message waiting PUBREL is not delivered again */
+        for ( i = 0; i < session->nrel; i++ ) {
+            if ( session->rel[i] == pid ) {
+                return brk_queue_ctrl( conn, MQTT_CTRLPKT_PUBREC | MQTT_PUBREC_FLAG, pid );
+            }
+        }
+        if ( session->nrel == session->rel_cap && session->rel_cap < BRK_REL_MAX ) {
+            if ( ( rel = realloc( session->rel, ( session->rel_cap + 8 ) * sizeof( uint16_t ) ) ) != NULL ) {
+                session->rel      = rel;
+                session->rel_cap += 8;
+            }
+        }
+        if ( session->nrel < session->rel_cap ) {
+            session->rel[session->nrel++] = pid;
+        }
+    }
+    if ( ( msg = brk_msg_new( body + 2, topic_len, body + pos, len - pos ) ) == NULL ) {
+        return -1;
+    }
+    brk_route( msg, qos, retain );
+    brk_msg_put( msg );
+    if ( qos == 1 ) {
+        return brk_queue_ctrl( conn, MQTT_CTRLPKT_PUBACK | MQTT_PUBACK_FLAG, pid );
+    }
+    if ( qos == 2 ) {
+        return brk_queue_ctrl( conn, MQTT_CTRLPKT_PUBREC | MQTT_PUBREC_FLAG, pid );
+    }
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Handle SUBSCRIBE.
+ *
+ * @param conn: connection.
+ * @param body: variable header and payload.
+ * @param len: remaining length.
+ *
+ */
+static int8_t brk_subscribe(brk_conn_t *conn, const uint8_t *body, uint32_t len) {
+
+    const char *levels[BROKER_LEVELS_MAX];
+    uint16_t lens[BROKER_LEVELS_MAX];
+    brk_msg_t *suback = NULL;
+    brk_out_t *entry = NULL;
+    uint8_t  *codes = NULL;
+    uint8_t  hdr[5];
+    uint8_t  hdr_len = 0;
+    uint8_t  qos = 0;
+    uint16_t filter_len = 0;
+    uint32_t count = 0;
+    uint32_t pos = 0;
+    uint32_t i = 0;
+    int32_t  n = 0;
+
+    /* Check packet and count filters */
+    for ( pos = 2; pos < len; pos += 3 + filter_len, count++ ) {
+        if ( pos + 2 > len || pos + 3 + ( filter_len = ( body[pos] << 8 ) | body[pos + 1] ) > len ||
+             body[pos + 2 + filter_len] > 2 ) {
+            return -1;
+        }
+    }
+    if ( len < 2 || count == 0 ) {
+        return -1;
+    }
+    hdr[0]  = MQTT_CTRLPKT_SUBACK | MQTT_SUBACK_FLAG;
+    hdr_len = 1 + brk_encode_len( hdr + 1, 2 + count );
+    if ( ( suback = malloc( sizeof( brk_msg_t ) + hdr_len + 2 + count ) ) == NULL ||
+         ( entry = brk_out_get() ) == NULL ) {
+        free( suback );
+        return -1;
+    }
+    suback->refs = 1;
+    suback->len  = hdr_len + 2 + count;
+    suback->topic_len = 0;
+    memcpy( suback->data, hdr, hdr_len );
+    memcpy( suback->data + hdr_len, body, 2 );
+    codes = suback->data + hdr_len + 2;
+
+    /* Granted QoS 0 or 1, 0x80 invalid filter */
+    for ( pos = 2, i = 0; i < count; pos += 3 + filter_len, i++ ) {
+        filter_len = ( body[pos] << 8 ) | body[pos + 1];
+        qos = body[pos + 2 + filter_len] ? 1 : 0;
+        codes[i] = 0x80;
+        if ( ecliutf8_filter( ( const char * ) body + pos + 2, filter_len ) == 0 &&
+             ( n = brk_split( ( const char * ) body + pos + 2, filter_len, levels, lens ) ) > 0 &&
+             brk_sub_add( conn->session, levels, lens, n, qos ) == 0 ) {
+            codes[i] = qos;
+        }
+    }
+    entry->msg = suback;
+    entry->raw = TRUE_FLAG;
+    entry->len = suback->len;
+    brk_queue( conn, entry );
+
+    /* Retained messages after SUBACK */
+    for ( pos = 2, i = 0; i < count; pos += 3 + filter_len, i++ ) {
+        filter_len = ( body[pos] << 8 ) | body[pos + 1];
+        if ( codes[i] != 0x80 ) {
+            n = brk_split( ( const char * ) body + pos + 2, filter_len, levels, lens );
+            brk_retained_match( &brk_root, levels, lens, 0, n, conn->session, codes[i] );
+        }
+    }
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Handle UNSUBSCRIBE.
+ *
+ * @param conn: connection.
+ * @param body: variable header and payload.
+ * @param len: remaining length.
+ *
+ */
+static int8_t brk_unsubscribe(brk_conn_t *conn, const uint8_t *body, uint32_t len) {
+
+    const char *levels[BROKER_LEVELS_MAX];
+    uint16_t lens[BROKER_LEVELS_MAX];
+    brk_node_t *node = NULL;
+    uint16_t filter_len = 0;
+    uint32_t pos = 0;
+    int32_t  n = 0;
+
+    if ( len < 4 ) {
+        return -1;
+    }
+    for ( pos = 2; pos < len; pos += 2 + filter_len ) {
+        if ( pos + 2 > len || pos + 2 + ( filter_len = ( body[pos] << 8 ) | body[pos + 1] ) > len ) {
+            return -1;
+        }
+        if ( ecliutf8_filter( ( const char * ) body + pos + 2, filter_len ) == 0 &&
+             ( n = brk_split( ( const char * ) body + pos + 2, filter_len, levels, lens ) ) > 0 &&
+             ( node = brk_node_walk( levels, lens, n, FALSE_FLAG ) ) != NULL ) {
+            brk_sub_del( conn->session, node );
+        }
+    }
+
+    return brk_queue_ctrl( conn, MQTT_CTRLPKT_UNSUBACK | MQTT_UNSUBACK_FLAG, ( body[0] << 8 ) | body[1] );
+}
+
+/**********************************************************************/
+/** Handle PUBACK of a QoS 1 delivery.
+ *
+ * @param session: session.
+ * @param pid: packet id.
+ *
+ */
+static void brk_puback(brk_session_t *session, uint16_t pid) {
+
+    brk_out_t *entry = NULL;
+    brk_out_t *prev = NULL;
+
+    for ( entry = session->flight_head; entry != NULL; prev = entry, entry = entry->next ) {
+        if ( entry->pid == pid ) {
+            if ( prev != NULL ) {
+                prev->next = entry->next;
+            }
+            else {
+                session->flight_head = entry->next;
+            }
+            if ( session->flight_tail == entry ) {
+                session->flight_tail = prev;
+            }
+            session->inflight--;
+            brk_out_free( entry );
+            brk_pump( session );
+            return;
+        }
+    }
+
+}
+
+/**********************************************************************/
+/** Write queued packets, wait EPOLLOUT when the socket is full.
+ *
+ * @param conn: connection.
+ *
+ */
+static void brk_conn_flush(brk_conn_t *conn) {
+
+    struct iovec iov[BROKER_IOV_MAX];
+    struct epoll_event event;
+    brk_session_t *session = conn->session;
+    brk_out_t *entry = NULL;
+    ssize_t  written = 0;
+    ssize_t  total = 0;
+    uint64_t wanted = 0;
+    uint32_t count = 0;
+    uint32_t left = 0;
+
+#ifdef ECLI_TLS_OPENSSL
+    /* EPOLLOUT of a handshake waiting to write */
+    if ( conn->ssl != NULL && !SSL_is_init_finished( conn->ssl ) ) {
+        brk_conn_read( conn );
+        if ( conn->state == BRK_CLOSED || !SSL_is_init_finished( conn->ssl ) ) {
+            return;
+        }
+    }
+#endif
+    while ( conn->out_head != NULL ) {
+        count  = 0;
+        wanted = 0;
+        for ( entry = conn->out_head; entry != NULL && count + 4 <= BROKER_IOV_MAX; entry = entry->next ) {
+            count  += brk_out_iov( entry, iov + count );
+            wanted += entry->len - entry->off;
+        }
+        if ( ( written = brk_conn_send( conn, iov, count ) ) < 0 ) {
+            if ( errno == EINTR ) {
+                continue;
+            }
+            if ( errno == EAGAIN ) {
+                break;
+            }
+            brk_conn_close( conn, TRUE_FLAG );
+            return;
+        }
+        brk_stats.bytes_out += written;
+        total = written;
+        /* Written QoS 1 messages wait PUBACK in the session */
+        while ( ( entry = conn->out_head ) != NULL && written > 0 ) {
+            left = entry->len - entry->off;
+            if ( ( uint64_t ) written < left ) {
+                entry->off += written;
+                break;
+            }
+            written -= left;
+            conn->out_head = entry->next;
+            if ( conn->out_head == NULL ) {
+                conn->out_tail = NULL;
+            }
+            conn->out_bytes -= entry->len;
+            if ( entry->pid != 0 && session != NULL ) {
+                entry->next = NULL;
+                if ( session->flight_tail != NULL ) {
+                    session->flight_tail->next = entry;
+                }
+                else {
+                    session->flight_head = entry;
+                }
+                session->flight_tail = entry;
+            }
+            else {
+                brk_out_free( entry );
+            }
+        }
+        /* Socket buffer full */
+        if ( ( uint64_t ) total < wanted ) {
+            break;
+        }
+    }
+    if ( ( conn->out_head != NULL ) != conn->pollout ) {
+        conn->pollout  = conn->out_head != NULL;
+        event.events   = EPOLLIN | ( conn->pollout ? EPOLLOUT : 0 );
+        event.data.ptr = conn;
+        epoll_ctl( brk_epfd, EPOLL_CTL_MOD, conn->fd, &event );
+    }
+
+}
+
+/**********************************************************************/
+/** Accept connections of listening socket.
+ *
+ * @param listener: listening socket.
+ *
+ */
+static void brk_accept(brk_conn_t *listener) {
+
+    struct epoll_event event;
+    brk_conn_t **conns = NULL;
+    brk_conn_t *conn = NULL;
+    uint32_t size = 0;
+    int32_t  fd = -1;
+    int32_t  one = 1;
+    uint32_t i = 0;
+
+    for ( i = 0; i < BRK_ACCEPT_MAX; i++ ) {
+        if ( ( fd = accept( listener->fd, NULL, NULL ) ) < 0 ) {
+            return;
+        }
+        fcntl( fd, F_SETFL, O_NONBLOCK );
+        fcntl( fd, F_SETFD, FD_CLOEXEC );
+        if ( brk_open >= brk_conf.max_conns ) {
+            close( fd );
+            continue;
+        }
+        if ( ( uint32_t ) fd >= brk_conns_size ) {
+            size = ( fd + 1 ) * 2;
+            if ( ( conns = realloc( brk_conns, size * sizeof( *conns ) ) ) == NULL ) {
+                close( fd );
+                continue;
+            }
+            memset( conns + brk_conns_size, 0, ( size - brk_conns_size ) * sizeof( *conns ) );
+            brk_conns      = conns;
+            brk_conns_size = size;
+        }
+        if ( ( conn = calloc( 1, sizeof( brk_conn_t ) ) ) == NULL ) {
+            close( fd );
+            continue;
+        }
+        /* Packets are batched by writev, Nagle only adds delay */
+        setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof( one ) );
+        conn->fd    = fd;
+        conn->state = BRK_NEW;
+        conn->last  = brk_now;
+#ifdef ECLI_TLS_OPENSSL
+        /* Handshake starts on the first read event */
+        if ( listener->tls && ( ( conn->ssl = SSL_new( brk_tls_ctx ) ) == NULL ||
+                                SSL_set_fd( conn->ssl, fd ) != 1 ) ) {
+            SSL_free( conn->ssl );
+            close( fd );
+            free( conn );
+            continue;
+        }
+#endif
+        event.events   = EPOLLIN;
+        event.data.ptr = conn;
+        if ( epoll_ctl( brk_epfd, EPOLL_CTL_ADD, fd, &event ) < 0 ) {
+#ifdef ECLI_TLS_OPENSSL
+            SSL_free( conn->ssl );
+#endif
+            close( fd );
+            free( conn );
+            continue;
+        }
+        brk_conns[fd] = conn;
+        brk_open++;
+        brk_stats.accepted++;
+    }
+
+}
+
+/**********************************************************************/
+/** Open listening socket, returns -1 on error.
+ *
+ * @param item: host, host:port, [IPv6]:port, unix:/path or unix:@name.
+ * @param port: default port.
+ *
+ */
+static int32_t brk_listen(const char *item, uint16_t port) {
+
+    struct sockaddr_un addr_un;
+    struct addrinfo hints;
+    struct addrinfo *result = NULL;
+    char     host[NET_HOST_LEN];
+    char     port_str[NET_PORT_LEN];
+    const char *colon = NULL;
+    socklen_t addr_len = 0;
+    int32_t  fd = -1;
+    int32_t  one = 1;
+    int32_t  rc = 0;
+    size_t   len = 0;
+
+    if ( strncmp( item, TRANSPORT_UNIX_PREFIX, strlen( TRANSPORT_UNIX_PREFIX ) ) == 0 ) {
+        item += strlen( TRANSPORT_UNIX_PREFIX );
+        memset( &addr_un, 0, sizeof( addr_un ) );
+        addr_un.sun_family = AF_UNIX;
+        if ( ( len = strlen( item ) ) == 0 || len >= sizeof( addr_un.sun_path ) ) {
+            errno = EINVAL;
+            return -1;
+        }
+        memcpy( addr_un.sun_path, item, len );
+        addr_len = offsetof( struct sockaddr_un, sun_path ) + len;
+        if ( item[0] == '@' ) {
+            addr_un.sun_path[0] = '\0';
+        }
+        else {
+            unlink( item );
+            addr_len++;
+        }
+        if ( ( fd = socket( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 ) ) < 0 ) {
+            return -1;
+        }
+        if ( bind( fd, ( struct sockaddr * ) &addr_un, addr_len ) < 0 || listen( fd, BRK_BACKLOG ) < 0 ) {
+            close( fd );
+            return -1;
+        }
+        return fd;
+    }
+
+    /* host, host:port, [v6]:port, v6 */
+    snprintf( port_str, sizeof( port_str ), "%u", port );
+    if ( item[0] == '[' && ( colon = strchr( item, ']' ) ) != NULL ) {
+        snprintf( host, sizeof( host ), "%.*s", ( int ) ( colon - item - 1 ), item + 1 );
+        if ( colon[1] == ':' ) {
+            snprintf( port_str, sizeof( port_str ), "%s", colon + 2 );
+        }
+    }
+    else if ( ( colon = strchr( item, ':' ) ) != NULL && strchr( colon + 1, ':' ) == NULL ) {
+        snprintf( host, sizeof( host ), "%.*s", ( int ) ( colon - item ), item );
+        snprintf( port_str, sizeof( port_str ), "%s", colon + 1 );
+    }
+    else {
+        snprintf( host, sizeof( host ), "%s", item );
+    }
+    memset( &hints, 0, sizeof( hints ) );
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags    = AI_PASSIVE;
+    if ( ( rc = getaddrinfo( host[0] ? host : NULL, port_str, &hints, &result ) ) != 0 ) {
+        errno = rc == EAI_SYSTEM ? errno : EINVAL;
+        return -1;
+    }
+    if ( ( fd = socket( result->ai_family, result->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 ) ) < 0 ) {
+        freeaddrinfo( result );
+        return -1;
+    }
+    setsockopt( fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof( one ) );
+    if ( bind( fd, result->ai_addr, result->ai_addrlen ) < 0 || listen( fd, BRK_BACKLOG ) < 0 ) {
+        close( fd );
+        fd = -1;
+    }
+    freeaddrinfo( result );
+
+    return fd;
+}
+
+/**********************************************************************/
+/** Open listening sockets of list, returns -1 on error.
+ *
+ * @param list: listen list.
+ * @param port: default port.
+ * @param tls: TLS listeners.
+ *
+ */
+static int8_t brk_listen_list(const char *list, uint16_t port, uint8_t tls) {
+
+    char hosts[CLI_HOSTNAME_LEN];
+    char buffer_str[CLI_HOSTNAME_LEN + 128];
+    char *item = NULL;
+    char *save = NULL;
+    struct epoll_event event;
+    int32_t fd = -1;
+
+    strncpy( hosts, list, sizeof( hosts ) - 1 );
+    hosts[sizeof( hosts ) - 1] = '\0';
+    for ( item = strtok_r( hosts, NET_LIST_SEP, &save ); item != NULL;
+          item = strtok_r( NULL, NET_LIST_SEP, &save ) ) {
+        if ( brk_nlisten == BROKER_LISTEN_MAX ) {
+            break;
+        }
+        if ( ( fd = brk_listen( item, port ) ) < 0 ) {
+            snprintf( buffer_str, sizeof( buffer_str ), BROKER_LISTEN_ERROR, item, strerror( errno ) );
+            eclilog_show(__FILE__, __func__, buffer_str, LOG_ERROR);
+            fprintf( stderr, "%s\n", buffer_str );
+            return -1;
+        }
+        brk_listeners[brk_nlisten].fd    = fd;
+        brk_listeners[brk_nlisten].state = BRK_LISTEN;
+        brk_listeners[brk_nlisten].tls   = tls;
+        event.events   = EPOLLIN;
+        event.data.ptr = &brk_listeners[brk_nlisten];
+        epoll_ctl( brk_epfd, EPOLL_CTL_ADD, fd, &event );
+        brk_nlisten++;
+        snprintf( buffer_str, sizeof( buffer_str ), tls ? BROKER_TLS_LISTEN_MSG : BROKER_LISTEN_MSG, item );
+        eclilog_show(__FILE__, __func__, buffer_str, LOG_INFO);
+    }
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Load certificate and key of TLS listeners, returns -1 on error.
+ *
+ * @param conf: broker options.
+ *
+ */
+static int8_t brk_tls_init(const ecli_broker_conf_t *conf) {
+
+    char buffer_str[CLI_PATH_LEN + 128];
+    const char *reason = "no TLS=OPENSSL build";
+
+#ifdef ECLI_TLS_OPENSSL
+    static const uint8_t sid_ctx[] = "ecli_mqtt_broker";
+
+    if ( conf->tls_cert[0] == '\0' ) {
+        reason = "no tls_cert";
+    }
+    else if ( ( brk_tls_ctx = SSL_CTX_new( TLS_server_method() ) ) == NULL ) {
+        reason = ERR_reason_error_string( ERR_get_error() );
+    }
+    else {
+        SSL_CTX_set_min_proto_version( brk_tls_ctx, TLS1_2_VERSION );
+        /* A retry after WANT_WRITE gathers the queue head in the same buffer, maybe more */
+        SSL_CTX_set_mode( brk_tls_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER );
+#ifdef SSL_OP_ENABLE_KTLS
+        SSL_CTX_set_options( brk_tls_ctx, SSL_OP_ENABLE_KTLS );
+#endif
+        /* Session cache and tickets: reconnecting clients resume */
+        SSL_CTX_set_session_id_context( brk_tls_ctx, sid_ctx, sizeof( sid_ctx ) - 1 );
+        SSL_CTX_set_session_cache_mode( brk_tls_ctx, SSL_SESS_CACHE_SERVER );
+        if ( SSL_CTX_use_certificate_chain_file( brk_tls_ctx, conf->tls_cert ) == 1 &&
+             SSL_CTX_use_PrivateKey_file( brk_tls_ctx, conf->tls_key[0] ? conf->tls_key : conf->tls_cert,
+                                          SSL_FILETYPE_PEM ) == 1 &&
+             SSL_CTX_check_private_key( brk_tls_ctx ) == 1 ) {
+            return 0;
+        }
+        reason = ERR_reason_error_string( ERR_get_error() );
+        SSL_CTX_free( brk_tls_ctx );
+        brk_tls_ctx = NULL;
+    }
+#endif
+    snprintf( buffer_str, sizeof( buffer_str ), BROKER_TLS_ERROR, reason != NULL ? reason : conf->tls_cert );
+    eclilog_show(__FILE__, __func__, buffer_str, LOG_ERROR);
+    fprintf( stderr, "%s\n", buffer_str );
+
+    return -1;
+}
+
+/**********************************************************************/
+/** Close connections without CONNECT or keep alive.
+ *
+ */
+static void brk_sweep(void) {
+
+    brk_conn_t *conn = NULL;
+    uint32_t fd = 0;
+
+    for ( fd = 0; fd < brk_conns_size; fd++ ) {
+        if ( ( conn = brk_conns[fd] ) == NULL ) {
+            continue;
+        }
+        if ( conn->state == BRK_NEW && brk_now - conn->last > BROKER_CONNECT_TIMEOUT ) {
+            brk_conn_close( conn, FALSE_FLAG );
+        }
+        else if ( conn->state == BRK_ONLINE && conn->keepalive &&
+                  brk_now - conn->last > conn->keepalive + conn->keepalive / 2U ) {
+            brk_conn_close( conn, TRUE_FLAG );
+        }
+    }
+
+}
+
+/**********************************************************************/
+/** Get monotonic secs.
+ *
+ */
+static uint32_t brk_secs(void) {
+
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+
+    return ts.tv_sec;
+}
@@ -0,0 +1,58 @@
+/***********************************************************************
+* FILENAME    :   ecli_mqtt_bridge.c
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   MQTT bridge: store-and-forward of topic maps between
+*                 the [local] and [remote] brokers of config file (-c).
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <signal.h>
+
+/**********************************************************************/
+
+#include <libeclimqtt.h>
+#include <libeclimqttbridge.h>
+
+/**********************************************************************/
+
+void interrupt(int signal)
+{
+    eclibridge_stop();
+}
+
+/**********************************************************************/
+
+int main(int argc, char* argv[]){
+
+    ecli_conf_t conf;
+    ecli_broker_t broker;
+    const char *config_file = NULL;
+    uint8_t return_code;
+    int32_t i;
+
+    signal(SIGINT, interrupt);
+    signal(SIGTERM, interrupt);
+    signal(SIGPIPE, SIG_IGN);
+
+    /* Global keys of config file and command line are defaults of both sides */
+    for ( i = 1; i + 1 < argc; i++ ) {
+        if ( strcmp( argv[i], "-c" ) == EQUAL_STR_CMP ) {
+            config_file = argv[i + 1];
+        }
+    }
+    if ( config_file == NULL ) {
+        fprintf( stderr, BRIDGE_NONE_ERROR "\n", "(use -c file)" );
+        return CLI_ERROR;
+    }
+    ecli_get_conf(&broker, &conf, argc, argv);
+    if ( eclibridge_load( config_file, &broker, &conf ) < 0 ) {
+        return CLI_ERROR;
+    }
+
+    return_code = eclibridge_run();
+    ecli_release(&broker);
+
+    return return_code;
+}
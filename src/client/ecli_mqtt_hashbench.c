@@ -0,0 +1,86 @@
+/***********************************************************************
+* FILENAME    :   ecli_mqtt_hashbench.c
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   Checksum throughput microbenchmark (CRC32C, xxHash3),
+*                 CPU dispatched against portable code.
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**********************************************************************/
+
+#include <libeclimqtthash.h>
+
+/**********************************************************************/
+#define BENCH_BYTES           ( 1ULL << 30 )  /* Hashed per size and impl */
+#define BENCH_BUFFER          ( 1 << 20 )
+
+/**********************************************************************/
+
+static double bench_now(void) {
+
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**********************************************************************/
+
+int main(int argc, char* argv[]){
+
+    static const uint32_t sizes[] = { 64, 256, 1024, 4096, 65536, BENCH_BUFFER };
+    uint64_t total_bytes = BENCH_BYTES;
+    uint64_t sink = 0;
+    uint64_t rounds = 0;
+    uint64_t r = 0;
+    uint8_t  *buffer = NULL;
+    uint8_t  portable = 0;
+    uint32_t i = 0;
+    double   start = 0;
+    double   crc_rate = 0;
+    double   xxh3_rate = 0;
+
+    /* Optional MB hashed per measure; offsets vary to include unaligned input */
+    if ( argc > 1 ) {
+        total_bytes = strtoull( argv[1], NULL, 10 ) << 20;
+    }
+    if ( ( buffer = malloc( BENCH_BUFFER + 64 ) ) == NULL ) {
+        return 1;
+    }
+    for ( i = 0; i < BENCH_BUFFER + 64; i++ ) {
+        buffer[i] = i * 2654435761U >> 13;
+    }
+
+    for ( portable = 0; portable < 2; portable++ ) {
+        eclihash_portable( portable );
+        printf( "%s\n", eclihash_impl() );
+        printf( "  %8s %12s %12s\n", "bytes", "crc32c GB/s", "xxh3 GB/s" );
+        for ( i = 0; i < sizeof( sizes ) / sizeof( sizes[0] ); i++ ) {
+            rounds = total_bytes / sizes[i] + 1;
+            start = bench_now();
+            for ( r = 0; r < rounds; r++ ) {
+                sink += eclihash_crc32c( 0, buffer + ( r & 63 ), sizes[i] );
+            }
+            crc_rate = rounds * ( double ) sizes[i] / ( bench_now() - start ) / 1e9;
+            start = bench_now();
+            for ( r = 0; r < rounds; r++ ) {
+                sink += eclihash_xxh3( buffer + ( r & 63 ), sizes[i] );
+            }
+            xxh3_rate = rounds * ( double ) sizes[i] / ( bench_now() - start ) / 1e9;
+            printf( "  %8u %12.2f %12.2f\n", sizes[i], crc_rate, xxh3_rate );
+        }
+    }
+    /* Keep results alive */
+    printf( "(%llx)\n", ( unsigned long long ) sink & 0xFF );
+    free( buffer );
+
+    return 0;
+}
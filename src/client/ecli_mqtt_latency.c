@@ -0,0 +1,348 @@
+/***********************************************************************
+* FILENAME    :   ecli_mqtt_latency.c
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   Latency probe: timestamped pings echoed back over the
+*                 broker, one-way and round trip latency histograms.
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/prctl.h>
+
+/**********************************************************************/
+
+#include <libeclimqtt.h>
+
+/**********************************************************************/
+#define LATENCY_MSGS          10000
+#define LATENCY_SIZE          64
+#define LATENCY_RATE          1000      /* msgs/sec when -n is not set */
+#define LATENCY_STAMP_LEN     24        /* seq, intended and sent times */
+#define LATENCY_SPIN_NS       20000     /* Busy wait under this, sleep over */
+#define LATENCY_DRAIN_SECS    2         /* Wait for pongs after last ping */
+#define LATENCY_PING_TOPIC    "/ping"
+#define LATENCY_PONG_TOPIC    "/pong"
+
+/*Connection of the probe: one job per connection, so QoS 1 publishes
+  read their PUBACK without meeting a ping or pong*/
+typedef struct {
+    ecli_broker_t broker;
+    ecli_conf_t   conf;
+    uint64_t      tx_ns;                          /* Last packet sent, keep alive */
+} latency_conn_t;
+
+/*Histograms of one receiving side, written by its thread only*/
+typedef struct {
+    latency_conn_t *in;                           /* Subscribed connection */
+    latency_conn_t *out;                          /* Echo publisher, NULL none */
+    uint64_t    msgs;                             /* Atomic, pinger waits on it */
+    ecli_hist_t actual;                           /* From time sent */
+    ecli_hist_t intended;                         /* From time due (no coordinated omission) */
+} latency_side_t;
+
+/**********************************************************************/
+
+static volatile sig_atomic_t loop_stop = 0;
+static uint8_t              read_stop = 0;
+
+/**********************************************************************/
+
+void interrupt(int signal)
+{
+    loop_stop = 1;
+}
+
+/**********************************************************************/
+/* Connect copy of options with client id and topic suffix, subscribe */
+static latency_conn_t *latency_conn(const ecli_broker_t *broker, const ecli_conf_t *conf,
+                                    const char *id_suffix, const char *topic_suffix, uint8_t subscribe) {
+
+    latency_conn_t *conn = malloc( sizeof( latency_conn_t ) );
+    uint8_t return_code = CLI_NO_ERROR;
+
+    if ( conn == NULL ) {
+        fprintf( stderr, NO_MEM_ERROR "\n" );
+        return NULL;
+    }
+    conn->broker = *broker;
+    conn->conf = *conf;
+    snprintf( conn->broker.client_id, sizeof( conn->broker.client_id ), "%.*s%s",
+              ( int ) ( sizeof( conn->broker.client_id ) - strlen( id_suffix ) - 1 ), broker->client_id,
+              id_suffix );
+    snprintf( conn->broker.topic, sizeof( conn->broker.topic ), "%.*s%s",
+              ( int ) ( sizeof( conn->broker.topic ) - strlen( topic_suffix ) - 1 ), broker->topic,
+              topic_suffix );
+    conn->broker.connect_packet = NULL;
+    conn->broker.connect_len = 0;
+    conn->broker.rx_pending = 0;
+    conn->broker.transport.socketid = -1;
+    conn->broker.transport.ctx = NULL;
+    conn->broker.metrics = eclimetrics_new( conn->broker.client_id );
+
+    if ( ( return_code = ecli_init( &conn->broker, &conn->conf ) ) == CLI_NO_ERROR &&
+         ( return_code = eclimqtt_connect( &conn->broker, &conn->conf ) ) == CLI_NO_ERROR && subscribe ) {
+        return_code = eclimqtt_subscribe( &conn->broker, &conn->conf );
+    }
+    if ( return_code != CLI_NO_ERROR ) {
+        ecli_show_error( return_code );
+        free( conn );
+        return NULL;
+    }
+    conn->tx_ns = eclimetrics_now();
+
+    return conn;
+}
+
+/**********************************************************************/
+/* Stamped payload: sequence, time due and time sent (CLOCK_MONOTONIC,
+   so one-way times hold for pinger and echo in this process) */
+static void latency_stamp(uint8_t *payload, uint64_t seq, uint64_t intended_ns, uint64_t sent_ns) {
+
+    memcpy( payload, &seq, sizeof( seq ) );
+    memcpy( payload + 8, &intended_ns, sizeof( intended_ns ) );
+    memcpy( payload + 16, &sent_ns, sizeof( sent_ns ) );
+}
+
+/**********************************************************************/
+/* Receiving side: record latencies of pings (echo them) or pongs */
+static void *latency_reader(void *arg) {
+
+    static const uint8_t pingreq[] = { MQTT_CTRLPKT_PINGREQ, 0x00 };
+    latency_side_t *side = arg;
+    latency_conn_t *in   = side->in;
+    char     topic[CLI_TOPIC_LEN + 1];
+    /* Sized as ecli_read_get_msg writes (decompressed) payloads of the type */
+    uint8_t  *msg_buffer = malloc( in->conf.msg_type == CLI_DATAFILE_MSG ? CLI_MAX_MSG_SIZE : MAX_TXT_MSG_SIZE );
+    uint8_t  return_code = CLI_NO_ERROR;
+    uint32_t msg_len     = 0;
+    uint64_t intended_ns = 0;
+    uint64_t sent_ns     = 0;
+    uint64_t now_ns      = 0;
+    uint64_t alive_ns    = in->broker.alive * 500000000ULL;
+    sigset_t signals;
+
+    /* SIGINT goes to the pinger */
+    sigfillset( &signals );
+    pthread_sigmask( SIG_BLOCK, &signals, NULL );
+    if ( msg_buffer == NULL ) {
+        return NULL;
+    }
+
+    while ( !__atomic_load_n( &read_stop, __ATOMIC_ACQUIRE ) ) {
+        return_code = ecli_read_get_msg( &in->broker, &in->conf, topic, msg_buffer, &msg_len, 1 );
+        now_ns = eclimetrics_now();
+        if ( return_code == CLI_READ_TIMEOUT_ERROR ) {
+            msg_len = 0;
+        }
+        else if ( return_code != CLI_NO_ERROR ) {
+            ecli_show_error( return_code );
+            break;
+        }
+        /* Subscriber connections send nothing else */
+        if ( alive_ns && now_ns - in->tx_ns >= alive_ns ) {
+            ecli_send_packet( &in->broker, pingreq, sizeof( pingreq ) );
+            in->tx_ns = now_ns;
+        }
+        if ( msg_len < LATENCY_STAMP_LEN ) {
+            continue;
+        }
+        memcpy( &intended_ns, msg_buffer + 8, sizeof( intended_ns ) );
+        memcpy( &sent_ns, msg_buffer + 16, sizeof( sent_ns ) );
+        eclimetrics_hist_record( &side->actual, now_ns - sent_ns );
+        eclimetrics_hist_record( &side->intended, now_ns - intended_ns );
+        __atomic_add_fetch( &side->msgs, 1, __ATOMIC_RELEASE );
+        if ( side->out != NULL &&
+             ( return_code = eclimqtt_publish_chunk( &side->out->broker, &side->out->conf,
+                                                     msg_buffer, msg_len ) ) != CLI_NO_ERROR ) {
+            ecli_show_error( return_code );
+            break;
+        }
+    }
+    free( msg_buffer );
+
+    return NULL;
+}
+
+/**********************************************************************/
+/* Sleep until absolute time, spin the last LATENCY_SPIN_NS */
+static void latency_wait(uint64_t due_ns) {
+
+    struct timespec ts;
+    uint64_t now_ns = eclimetrics_now();
+
+    if ( due_ns > now_ns + LATENCY_SPIN_NS ) {
+        ts.tv_sec = ( due_ns - LATENCY_SPIN_NS ) / 1000000000ULL;
+        ts.tv_nsec = ( due_ns - LATENCY_SPIN_NS ) % 1000000000ULL;
+        clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL );
+    }
+    while ( !loop_stop && eclimetrics_now() < due_ns );
+}
+
+/**********************************************************************/
+
+static void latency_show(const char *name, const ecli_hist_t *hist) {
+
+    printf( "  %-14s %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n", name,
+            eclimetrics_hist_percentile( hist, 50 ) / 1000.0,
+            eclimetrics_hist_percentile( hist, 90 ) / 1000.0,
+            eclimetrics_hist_percentile( hist, 99 ) / 1000.0,
+            eclimetrics_hist_percentile( hist, 99.9 ) / 1000.0,
+            eclimetrics_hist_percentile( hist, 99.99 ) / 1000.0,
+            hist->max / 1000.0, hist->count ? hist->sum / ( double ) hist->count / 1000.0 : 0 );
+}
+
+/**********************************************************************/
+
+int main(int argc, char* argv[]){
+
+    ecli_conf_t conf;
+    ecli_broker_t broker;
+    latency_conn_t *ping = NULL;
+    latency_side_t echo;
+    latency_side_t pong;
+    pthread_t echo_thread;
+    pthread_t pong_thread;
+    char     *args[argc + 1];
+    uint8_t  *payload = NULL;
+    uint8_t  return_code = CLI_NO_ERROR;
+    uint64_t msgs = LATENCY_MSGS;
+    uint32_t size = LATENCY_SIZE;
+    uint64_t interval_ns = 0;
+    uint64_t start_ns = 0;
+    uint64_t due_ns = 0;
+    uint64_t sent_ns = 0;
+    uint64_t lag_max = 0;
+    uint64_t sent = 0;
+    uint64_t returned = 0;
+    uint64_t last = 0;
+    double   rate = 0;
+    double   secs = 0;
+    int32_t  nargs = 0;
+    int32_t  i = 0;
+
+    signal(SIGINT, interrupt);
+    signal(SIGTERM, interrupt);
+    signal(SIGPIPE, SIG_IGN);
+
+    /* Own options out, the rest are client options */
+    args[nargs++] = argv[0];
+    for ( i = 1; i < argc; i++ ) {
+        if ( strcmp( argv[i], "-N" ) == EQUAL_STR_CMP && i + 1 < argc ) {
+            msgs = strtoull( argv[++i], NULL, 10 );
+        }
+        else if ( strcmp( argv[i], "-G" ) == EQUAL_STR_CMP && i + 1 < argc ) {
+            size = strtoul( argv[++i], NULL, 10 );
+        }
+        else if ( strcmp( argv[i], "-h" ) == EQUAL_STR_CMP ) {
+            printf( "ecli_mqtt_latency [-N pings %d] [-G payload bytes %d, min %d] [-n pings/s %d]\n"
+                    "                  [-q qos 0|1|2] [ecli_mqtt_pub connection options: -b -p -t -i -S -c ...]\n",
+                    LATENCY_MSGS, LATENCY_SIZE, LATENCY_STAMP_LEN, LATENCY_RATE );
+            return CLI_NO_ERROR;
+        }
+        else {
+            args[nargs++] = argv[i];
+        }
+    }
+    args[nargs] = NULL;
+    if ( msgs == 0 || size < LATENCY_STAMP_LEN || size > MAX_CHUNK_SIZE ) {
+        fprintf( stderr, LATENCY_ARGS_ERROR "\n", LATENCY_STAMP_LEN, MAX_CHUNK_SIZE );
+        return CLI_ERROR;
+    }
+    ecli_get_conf( &broker, &conf, nargs, args );
+    /* One io_uring per process, used by one thread: pinger and readers
+       would share it */
+    if ( conf.io_uring ) {
+        fprintf( stderr, LATENCY_URING_ERROR "\n" );
+        ecli_release( &broker );
+        return CLI_ERROR;
+    }
+    rate = conf.publish_rate > 0 ? conf.publish_rate : LATENCY_RATE;
+    interval_ns = 1000000000.0 / rate;
+#ifdef PR_SET_TIMERSLACK
+    /* Default 50 usecs timer slack would show in every latency from due time */
+    prctl( PR_SET_TIMERSLACK, 1, 0, 0, 0 );
+#endif
+    /* Receive buffer of ecli_read_get_msg is cleared up to its type size */
+    conf.msg_type = size < MAX_TXT_MSG_SIZE ? CLI_TXT_MSG : CLI_DATAFILE_MSG;
+
+    /* Pinger publishes pings, echo publishes each ping it gets as pong */
+    memset( &echo, 0, sizeof( echo ) );
+    memset( &pong, 0, sizeof( pong ) );
+    if ( ( pong.in = latency_conn( &broker, &conf, "-pong", LATENCY_PONG_TOPIC, TRUE_FLAG ) ) == NULL ||
+         ( echo.in = latency_conn( &broker, &conf, "-echo-in", LATENCY_PING_TOPIC, TRUE_FLAG ) ) == NULL ||
+         ( echo.out = latency_conn( &broker, &conf, "-echo", LATENCY_PONG_TOPIC, FALSE_FLAG ) ) == NULL ||
+         ( ping = latency_conn( &broker, &conf, "-ping", LATENCY_PING_TOPIC, FALSE_FLAG ) ) == NULL ||
+         ( payload = malloc( size ) ) == NULL ) {
+        return CLI_ERROR;
+    }
+    for ( i = LATENCY_STAMP_LEN; i < size; i++ ) {
+        payload[i] = 'x';
+    }
+    if ( pthread_create( &echo_thread, NULL, latency_reader, &echo ) != 0 ||
+         pthread_create( &pong_thread, NULL, latency_reader, &pong ) != 0 ) {
+        return CLI_ERROR;
+    }
+
+    /* Open loop: ping n is due at start + n / rate whatever the previous
+       ones took, so a stalled publish or broker shows in the latency
+       from the due time instead of delaying (and hiding) later pings */
+    start_ns = eclimetrics_now();
+    for ( sent = 0; sent < msgs && !loop_stop; sent++ ) {
+        due_ns = start_ns + sent * interval_ns;
+        latency_wait( due_ns );
+        if ( loop_stop ) {
+            break;
+        }
+        sent_ns = eclimetrics_now();
+        if ( sent_ns - due_ns > lag_max ) {
+            lag_max = sent_ns - due_ns;
+        }
+        latency_stamp( payload, sent, due_ns, sent_ns );
+        if ( ( return_code = eclimqtt_publish_chunk( &ping->broker, &ping->conf, payload, size ) ) != CLI_NO_ERROR ) {
+            ecli_show_error( return_code );
+            break;
+        }
+    }
+    secs = ( eclimetrics_now() - start_ns ) / 1e9;
+
+    /* Pongs still on the way, until none for LATENCY_DRAIN_SECS */
+    for ( last = 0, i = 0; ( returned = __atomic_load_n( &pong.msgs, __ATOMIC_ACQUIRE ) ) < sent &&
+                           i < LATENCY_DRAIN_SECS * 10; i++ ) {
+        i = last == returned ? i : 0;
+        last = returned;
+        usleep( 100000 );
+    }
+    __atomic_store_n( &read_stop, TRUE_FLAG, __ATOMIC_RELEASE );
+    pthread_join( echo_thread, NULL );
+    pthread_join( pong_thread, NULL );
+    returned = __atomic_load_n( &pong.msgs, __ATOMIC_ACQUIRE );
+
+    printf( "pings %llu of %u bytes, qos %u, %.1f pings/s target, %.1f sent, %s transport\n",
+            ( unsigned long long ) sent, size, broker.qos, rate, secs > 0 ? sent / secs : 0,
+            ping->broker.transport.ops->name );
+    printf( "  echoed %llu, returned %llu, lost %llu, max send lag %.1f usecs\n",
+            ( unsigned long long ) __atomic_load_n( &echo.msgs, __ATOMIC_ACQUIRE ),
+            ( unsigned long long ) returned, ( unsigned long long ) ( sent - returned ), lag_max / 1000.0 );
+    printf( "  %-14s %9s %9s %9s %9s %9s %9s %9s\n", "usecs", "p50", "p90", "p99", "p99.9", "p99.99",
+            "max", "mean" );
+    latency_show( "one-way", &echo.actual );
+    latency_show( "one-way (due)", &echo.intended );
+    latency_show( "rtt", &pong.actual );
+    latency_show( "rtt (due)", &pong.intended );
+
+    eclimqtt_disconnect( &ping->broker );
+    eclimqtt_disconnect( &echo.out->broker );
+    eclimqtt_disconnect( &echo.in->broker );
+    eclimqtt_disconnect( &pong.in->broker );
+    ecli_close( &ping->broker );
+    ecli_close( &echo.out->broker );
+    ecli_close( &echo.in->broker );
+    ecli_close( &pong.in->broker );
+    ecli_release( &broker );
+
+    return return_code;
+}
@@ -7,7 +7,26 @@
 *
 ***********************************************************************/
 
+#include <signal.h>
+
+/**********************************************************************/
+
 #include <libeclimqtt.h>
+#include <libeclimqttfile.h>
+#include <libeclimqttdelta.h>
+#include <libeclimqttpace.h>
+#include <libeclimqttstream.h>
+
+/**********************************************************************/
+
+volatile sig_atomic_t loop_stop = 0;
+
+/**********************************************************************/
+
+void interrupt(int signal)
+{
+    loop_stop = 1;
+}
 
 /**********************************************************************/
 
@@ -15,10 +34,25 @@ int main(int argc, char* argv[]){
 
     ecli_conf_t conf;
     ecli_broker_t broker;
+    ecli_pace_t pace;
+    struct sigaction action;
     uint8_t return_code;
 
     /*Get configuration*/
     ecli_get_conf(&broker, &conf, argc, argv);
+    /* Samples are aggregated from stream records, other publishes would
+       go out one by one */
+    if ( conf.series && conf.stream_mode == CLI_STREAM_NONE ) {
+        fprintf( stderr, SERIES_STREAM_ERROR "\n" );
+        ecli_release( &broker );
+        return CLI_ERROR;
+    }
+    /* Chunks go from job threads, the ring belongs to this one */
+    if ( conf.io_uring && conf.file_chunked ) {
+        fprintf( stderr, URING_FILE_ERROR "\n" );
+        ecli_release( &broker );
+        return CLI_ERROR;
+    }
     /*Associate client connection with Broker*/
     if ( ( return_code = ecli_init(&broker, &conf) ) != CLI_NO_ERROR ) {
         ecli_show_error(return_code);
@@ -39,14 +73,54 @@ int main(int argc, char* argv[]){
         sleep(1);
     }
 
-    do {
+    /* Paced loop: SIGINT ends it (no restart of the timer wait) to
+       report the achieved rate and disconnect */
+    memset( &pace, 0, sizeof( pace ) );
+    if ( conf.client_loop_flg && !conf.file_chunked && !conf.stream_mode && conf.publish_rate > 0 ) {
+        if ( eclipace_init( &pace, conf.publish_rate, conf.publish_burst, conf.publish_report ) < 0 ) {
+            fprintf( stderr, PACE_RATE_ERROR );
+            return CLI_ERROR;
+        }
+        /* Sends queued on io_uring do not wait for the next message */
+        pace.idle = eclituring_flush;
+        memset( &action, 0, sizeof( action ) );
+        action.sa_handler = interrupt;
+        sigaction( SIGINT, &action, NULL );
+    }
+
+    /* Resumable chunked file transfer, until receiver has it all */
+    if ( conf.file_chunked ) {
+        if ( ( return_code = eclifile_send( &broker, &conf ) ) != CLI_NO_ERROR ){
+            ecli_show_error(return_code);
+            return return_code;
+        }
+    }
+    /* Records from stdin over this connection */
+    else if ( conf.stream_mode != CLI_STREAM_NONE ) {
+        if ( ( return_code = eclistream_publish( &broker, &conf, STDIN_FILENO ) ) != CLI_NO_ERROR ){
+            ecli_show_error(return_code);
+            return return_code;
+        }
+    }
+    else do {
+        if ( pace.rate > 0 && ( loop_stop || eclipace_wait( &pace ) < 0 ) ) {
+            break;
+        }
+        /* Repeated file publish: changed chunks only */
+        if ( conf.file_delta && conf.msg_type == CLI_DATAFILE_MSG ) {
+            return_code = eclidelta_publish( &broker, &conf );
+        }
         /* Publish normal message*/
-        if ( ( return_code = eclimqtt_publish( &broker, &conf, 0 ) ) != CLI_NO_ERROR ){
+        else {
+            return_code = eclimqtt_publish( &broker, &conf, 0 );
+        }
+        if ( return_code != CLI_NO_ERROR ){
             ecli_show_error(return_code);
             return return_code;
         }
     }
-    while( conf.client_loop_flg );
+    while( conf.client_loop_flg && !loop_stop );
+    eclipace_report( &pace, TRUE_FLAG );
 
     /* Close connections */
     /* Send Disconnect Msg to Broker */
@@ -56,6 +130,7 @@ int main(int argc, char* argv[]){
     }
     /* Close socket */
     ecli_close(&broker);
+    ecli_release(&broker);
 
     return CLI_NO_ERROR;
 }
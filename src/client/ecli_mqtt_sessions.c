@@ -0,0 +1,70 @@
+/***********************************************************************
+* FILENAME    :   ecli_mqtt_sessions.c
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   MQTT client sessions runner: every [session] of the
+*                 config file (-c) served by this process.
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <signal.h>
+
+/**********************************************************************/
+
+#include <libeclimqtt.h>
+#include <libeclimqttsink.h>
+#include <libeclimqttsession.h>
+
+/**********************************************************************/
+
+void interrupt(int signal)
+{
+    eclisession_stop();
+}
+
+/**********************************************************************/
+
+int main(int argc, char* argv[]){
+
+    ecli_conf_t conf;
+    ecli_broker_t broker;
+    const char *config_file = NULL;
+    uint8_t return_code;
+    int32_t i;
+
+    signal(SIGINT, interrupt);
+    signal(SIGTERM, interrupt);
+    signal(SIGPIPE, SIG_IGN);
+
+    /* Global keys of config file and command line are session defaults */
+    for ( i = 1; i + 1 < argc; i++ ) {
+        if ( strcmp( argv[i], "-c" ) == EQUAL_STR_CMP ) {
+            config_file = argv[i + 1];
+        }
+    }
+    if ( config_file == NULL ) {
+        fprintf( stderr, SESSION_NONE_ERROR "\n", "(use -c file)" );
+        return CLI_ERROR;
+    }
+    ecli_get_conf(&broker, &conf, argc, argv);
+    if ( eclisession_load( config_file, &broker, &conf ) < 0 ) {
+        return CLI_ERROR;
+    }
+
+    /* Messages of sub sessions to the output sink */
+    if ( conf.output_sink == CLI_SINK_NDJSON || conf.output_sink == CLI_SINK_LEN ) {
+        eclilog_console( stderr );
+    }
+    if ( conf.output_sink != CLI_SINK_NONE ) {
+        if ( eclisink_open( &conf ) < 0 ) {
+            return CLI_FILE_ERROR;
+        }
+        atexit( eclisink_close );
+    }
+
+    return_code = eclisession_run();
+    ecli_release(&broker);
+
+    return return_code;
+}
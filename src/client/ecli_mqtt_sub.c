@@ -12,16 +12,23 @@
 /**********************************************************************/
 
 #include <libeclimqtt.h>
+#include <libeclimqttfile.h>
+#include <libeclimqttdelta.h>
+#include <libeclimqttsink.h>
+#include <libeclimqttseries.h>
 
 /**********************************************************************/
 
 ecli_broker_t broker;
+FILE *console = NULL;                        /* stderr when stdout is the sink */
+volatile sig_atomic_t sink_busy = 0;         /* Queueing message for the sink */
+volatile sig_atomic_t sink_signal = 0;       /* Signal to handle after queueing */
 
 /**********************************************************************/
 
 void keep_alive(int signal)
 {
-    printf(PING_MSG);
+    fprintf(console, PING_MSG);
     eclimqtt_pingreq(&broker);
     alarm(ALIVE_PING_DEFAULT);
 }
@@ -30,7 +37,12 @@ void keep_alive(int signal)
 
 void interrupt(int signal)
 {
-    printf(SIGINT_MSG, signal);
+    /* Sink lock may be held: exit (and drain the sink) after the push */
+    if ( sink_busy ) {
+        sink_signal = signal;
+        return;
+    }
+    fprintf(console, SIGINT_MSG, signal);
     eclimqtt_disconnect(&broker);
     ecli_close(&broker);
     exit(signal);
@@ -43,11 +55,17 @@ int main(int argc, char* argv[]){
     ecli_conf_t conf;
     uint8_t      return_code = 0;
 
+    console = stdout;
     signal(SIGINT, interrupt);
     signal(SIGALRM, keep_alive);
 
     /*Get configuration*/
     ecli_get_conf(&broker, &conf, argc, argv);
+    /* Sink on stdout: console messages go to stderr */
+    if ( conf.output_sink == CLI_SINK_NDJSON || conf.output_sink == CLI_SINK_LEN ) {
+        console = stderr;
+        eclilog_console( stderr );
+    }
     /*Associate client connection with Broker*/
     if ( ( return_code = ecli_init(&broker, &conf) ) != CLI_NO_ERROR ) {
         ecli_show_error(return_code);
@@ -61,11 +79,25 @@ int main(int argc, char* argv[]){
 
     alarm(ALIVE_PING_DEFAULT);
 
-    /* Subscribe */
-    if ( ( return_code = eclimqtt_subscribe( &broker, &conf ) ) != CLI_NO_ERROR ){
+    /* Subscribe, unless broker kept the session */
+    if ( broker.session_present ) {
+        eclilog_show(__FILE__, __func__, SESS_PRESENT_MSG, LOG_DEBUG);
+    }
+    else if ( ( return_code = eclimqtt_subscribe( &broker, &conf ) ) != CLI_NO_ERROR ){
         ecli_show_error(return_code);
         return return_code;
     }
+    /* Ask for what an unfinished chunked transfer is missing */
+    if ( conf.file_chunked ) {
+        eclifile_resume( &broker, &conf );
+    }
+    /* Writer thread, queue drained at exit (also on SIGINT) */
+    if ( conf.output_sink != CLI_SINK_NONE && !conf.file_chunked ) {
+        if ( eclisink_open( &conf ) < 0 ) {
+            return CLI_FILE_ERROR;
+        }
+        atexit( eclisink_close );
+    }
 
 
     /* Read and get Payload */
@@ -73,11 +105,18 @@ int main(int argc, char* argv[]){
     //uint8_t  msg_buffer[CLI_MAX_MSG_SIZE];
     uint32_t buffer_len = MAX_TXT_MSG_SIZE;
     /* buffer size according to Type of Message [ text msg | datafile msg ]*/
-    if ( conf.msg_type == CLI_DATAFILE_MSG ) {
+    if ( conf.msg_type == CLI_DATAFILE_MSG || conf.output_sink != CLI_SINK_NONE ) {
         buffer_len = CLI_MAX_MSG_SIZE;
     }
     uint8_t  msg_buffer[buffer_len];
     uint32_t msg_len     = 0;
+    int8_t   file_done   = 0;
+    char     buffer_str[CLI_BUF_SIZE];
+    uint8_t  sample[SERIES_TEXT_MAX + 1];
+    int32_t  sample_len  = 0;
+    uint64_t sample_ms   = 0;
+    int8_t   series_found = 0;
+    ecli_series_iter_t series;
     do {
         if ( ( return_code = ecli_read_get_msg( &broker, &conf, topic, msg_buffer, &msg_len, 0 ) ) != CLI_NO_ERROR ){
             ecli_show_error(return_code);
@@ -94,23 +133,78 @@ int main(int argc, char* argv[]){
                         ecli_show_error(return_code);
                         return return_code;
                     }
-                    /* Subscribe */
-                    if ( ( return_code = eclimqtt_subscribe( &broker, &conf ) ) != CLI_NO_ERROR ){
+                    /* Subscribe, unless broker kept the session */
+                    if ( broker.session_present ) {
+                        eclilog_show(__FILE__, __func__, SESS_PRESENT_MSG, LOG_DEBUG);
+                    }
+                    else if ( ( return_code = eclimqtt_subscribe( &broker, &conf ) ) != CLI_NO_ERROR ){
                         ecli_show_error(return_code);
                         return return_code;
                     }
+                    if ( conf.file_chunked ) {
+                        eclifile_resume( &broker, &conf );
+                    }
                 }
             }
             else{
                 return return_code;
             }
         }
-        if ( msg_len > 0 ) {
+        if ( msg_len > 0 && conf.file_chunked ) {
+            /* Chunks go to the output file as they come */
+            if ( ( file_done = eclifile_recv( &broker, &conf, topic, msg_buffer, msg_len ) ) < 0 ) {
+                return CLI_FILE_ERROR;
+            }
+        }
+        else if ( msg_len > 0 && conf.series &&
+                  ( series_found = ecliseries_open( &series, msg_buffer, msg_len ) ) != 0 ) {
+            /* Aggregated block: one message per sample, at its time */
+            sample_len = 0;
+            while ( series_found > 0 && ( sample_len = ecliseries_next( &series, sample, &sample_ms ) ) > 0 ) {
+                if ( conf.output_sink != CLI_SINK_NONE ) {
+                    sink_busy = 1;
+                    return_code = eclisink_push( topic, sample, sample_len, sample_ms );
+                    sink_busy = 0;
+                    if ( sink_signal ) {
+                        interrupt( sink_signal );
+                    }
+                    if ( return_code != 0 ) {
+                        return CLI_FILE_ERROR;
+                    }
+                }
+                else {
+                    sample[sample_len] = '\0';
+                    printf(TOPIC_MSG, topic);
+                    printf(MSG_LEN_MSG, sample_len);
+                    printf(MESSAGE_MSG, sample);
+                }
+            }
+            if ( series_found < 0 || sample_len < 0 ) {
+                sprintf(buffer_str, SERIES_BLOCK_ERROR, topic);
+                eclilog_show(__FILE__, __func__, buffer_str, LOG_ERROR);
+            }
+        }
+        else if ( msg_len > 0 && conf.output_sink != CLI_SINK_NONE ) {
+            sink_busy = 1;
+            return_code = eclisink_push( topic, msg_buffer, msg_len, 0 );
+            sink_busy = 0;
+            if ( sink_signal ) {
+                interrupt( sink_signal );
+            }
+            if ( return_code != 0 ) {
+                return CLI_FILE_ERROR;
+            }
+        }
+        else if ( msg_len > 0 ) {
             printf(TOPIC_MSG, topic);
             printf(MSG_LEN_MSG, msg_len);
             /*Type of Message [ text msg | datafile msg ]*/
             if ( conf.msg_type == CLI_DATAFILE_MSG ) {
                 printf(DATA_MSG);
+                /* Delta message rebuilds the file, plain one is written as is */
+                if ( conf.file_delta && eclidelta_apply( &conf, msg_buffer, msg_len ) != 0 ) {
+                    continue;
+                }
                 FILE* recv_file = fopen( conf.datafile_path, "wb" );
                 fwrite(msg_buffer, 1 , msg_len, recv_file);
                 fclose(recv_file);
@@ -121,7 +215,7 @@ int main(int argc, char* argv[]){
             }
         }
     }
-    while(conf.client_loop_flg);
+    while( conf.client_loop_flg || ( conf.file_chunked && !file_done ) );
 
     /* Close connections */
     /* Send Disconnect Msg to Broker */
@@ -131,6 +225,7 @@ int main(int argc, char* argv[]){
     }
     /* Close socket */
     ecli_close(&broker);
+    ecli_release(&broker);
 
     return CLI_NO_ERROR;
 }
@@ -0,0 +1,133 @@
+/***********************************************************************
+* FILENAME    :   ecli_mqtt_utf8bench.c
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   UTF-8 topic and text payload validation microbenchmark,
+*                 CPU dispatched against portable code.
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**********************************************************************/
+
+#include <libeclimqttutf8.h>
+
+/**********************************************************************/
+#define BENCH_BYTES           ( 1ULL << 30 )  /* Checked per size and impl */
+#define BENCH_BUFFER          ( 1 << 17 )
+#define BENCH_STARTS          64
+
+/**********************************************************************/
+
+static double bench_now(void) {
+
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**********************************************************************/
+/* Fill buffer repeating text */
+static void bench_fill(char *buffer, const char *text) {
+
+    size_t len = strlen( text );
+    size_t i = 0;
+
+    for ( i = 0; i + len < BENCH_BUFFER; i += len ) {
+        memcpy( buffer + i, text, len );
+    }
+    memset( buffer + i, '/', BENCH_BUFFER - i );
+}
+
+/**********************************************************************/
+/* Character boundary at or before pos */
+static size_t bench_boundary(const char *buffer, size_t pos) {
+
+    while ( pos > 0 && ( buffer[pos] & 0xC0 ) == 0x80 ) {
+        pos--;
+    }
+
+    return pos;
+}
+
+/**********************************************************************/
+
+int main(int argc, char* argv[]){
+
+    static const uint32_t sizes[] = { 16, 64, 256, 1024, 4096, UTF8_STRING_MAX };
+    uint64_t total_bytes = BENCH_BYTES;
+    uint64_t valid = 0;
+    uint64_t checks = 0;
+    uint64_t rounds = 0;
+    uint64_t bytes = 0;
+    uint64_t r = 0;
+    char     *ascii = NULL;
+    char     *mixed = NULL;
+    size_t   starts[BENCH_STARTS];
+    size_t   lens[BENCH_STARTS];
+    uint8_t  portable = 0;
+    uint32_t i = 0;
+    uint32_t j = 0;
+    double   start = 0;
+    double   topic_rate = 0;
+    double   ascii_rate = 0;
+    double   mixed_rate = 0;
+
+    /* Optional MB checked per measure; starts vary to include unaligned input */
+    if ( argc > 1 ) {
+        total_bytes = strtoull( argv[1], NULL, 10 ) << 20;
+    }
+    if ( ( ascii = malloc( BENCH_BUFFER ) ) == NULL || ( mixed = malloc( BENCH_BUFFER ) ) == NULL ) {
+        return 1;
+    }
+    bench_fill( ascii, "site-04/line-3/plc-17/sensor/temperature/" );
+    bench_fill( mixed, "fábrica/línea-3/温度センサー/€/Ωmega/\xF0\x9D\x84\x9E/" );
+    for ( j = 0; j < BENCH_STARTS; j++ ) {
+        starts[j] = bench_boundary( mixed, j );
+    }
+
+    for ( portable = 0; portable < 2; portable++ ) {
+        ecliutf8_portable( portable );
+        printf( "%s\n", ecliutf8_impl() );
+        printf( "  %8s %12s %12s %12s\n", "bytes", "topic GB/s", "ascii GB/s", "utf8 GB/s" );
+        for ( i = 0; i < sizeof( sizes ) / sizeof( sizes[0] ); i++ ) {
+            rounds = total_bytes / sizes[i] + 1;
+            start = bench_now();
+            for ( r = 0; r < rounds; r++ ) {
+                valid += ecliutf8_topic( ascii + ( r & 63 ), sizes[i] ) == 0;
+            }
+            topic_rate = rounds * ( double ) sizes[i] / ( bench_now() - start ) / 1e9;
+            start = bench_now();
+            for ( r = 0; r < rounds; r++ ) {
+                valid += ecliutf8_text( ascii + ( r & 63 ), sizes[i] ) == 0;
+            }
+            ascii_rate = rounds * ( double ) sizes[i] / ( bench_now() - start ) / 1e9;
+            /* Multibyte text cut at character boundaries */
+            bytes = 0;
+            for ( j = 0; j < BENCH_STARTS; j++ ) {
+                lens[j] = bench_boundary( mixed, starts[j] + sizes[i] ) - starts[j];
+            }
+            start = bench_now();
+            for ( r = 0; r < rounds; r++ ) {
+                valid += ecliutf8_text( mixed + starts[r & 63], lens[r & 63] ) == 0;
+                bytes += lens[r & 63];
+            }
+            mixed_rate = bytes / ( bench_now() - start ) / 1e9;
+            checks += 3 * rounds;
+            printf( "  %8u %12.2f %12.2f %12.2f\n", sizes[i], topic_rate, ascii_rate, mixed_rate );
+        }
+    }
+    /* Every input is valid, any other count is a bug */
+    printf( "(%llu of %llu valid)\n", ( unsigned long long ) valid, ( unsigned long long ) checks );
+    free( ascii );
+    free( mixed );
+
+    return 0;
+}
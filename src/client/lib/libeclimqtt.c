@@ -7,6 +7,10 @@
 *
 ***********************************************************************/
 
+#include <sys/mman.h>
+
+/**********************************************************************/
+
 #include <libeclimqtt.h>
 
 /**********************************************************************/
@@ -59,6 +63,27 @@ static uint8_t eclimqtt_pubrel(ecli_broker_t *broker);
  */
 static uint8_t eclimqtt_pubcomp(ecli_broker_t *broker, ecli_conf_t *conf);
 
+/**********************************************************************/
+/** Encode CONNECT packet and keep it in broker for next connections.
+ *
+ * @param broker: structure that contains the client connection info with broker
+ */
+static uint8_t eclimqtt_connect_encode(ecli_broker_t *broker);
+
+/**********************************************************************/
+/** Compress payload (from memory or file) when it pays off, returns
+ * compressed size (buffer in out, caller frees) or 0 to send raw.
+ *
+ * @param broker: structure that contains the client connection info with broker
+ * @param payload: payload in memory, NULL to read fd.
+ * @param fd: file with payload, read from start.
+ * @param msg_len: payload size.
+ * @param out: compressed payload.
+ *
+ */
+static uint32_t eclimqtt_compress(ecli_broker_t *broker, const uint8_t *payload, int32_t fd,
+                                  uint32_t msg_len, uint8_t **out);
+
 /**********************************************************************/
 /**********************************************************************/
 /** Connect with broker.
@@ -70,140 +95,25 @@ static uint8_t eclimqtt_pubcomp(ecli_broker_t *broker, ecli_conf_t *conf);
 uint8_t eclimqtt_connect(ecli_broker_t *broker, ecli_conf_t *conf){
     eclilog_show(__FILE__, __func__, "", LOG_TRACE);
 
-    uint8_t  conn_flags       = CLI_EMPTY_BYTE;
-    uint8_t  clientid_len     = strlen(broker->client_id);
-    uint8_t  will_topic_len   = strlen(broker->will_topic);
-    uint8_t  will_msg_len     = strlen(broker->will_msg);
-    uint8_t  username_len     = strlen(broker->username);
-    uint8_t  passwd_len       = strlen(broker->password);
-    uint8_t  payload_len      = clientid_len + 2;
-    uint8_t  fixed_header_len = MQTT_FIXED_HEADER_LEN;
-    uint8_t  remain_value     = 0;
     uint8_t  return_code      = CLI_NO_ERROR;
-    uint16_t packet_offset    = 0;
 
-    /*****  Var header *****/
-    /***********************/
-    /* Set connection flags*/
-    if(username_len) {
-        payload_len += username_len + 2;
-        conn_flags |= MQTT_USERNAME_FLAG;
-    }
-    if(passwd_len) {
-        payload_len += passwd_len + 2;
-        conn_flags |= MQTT_PASSWORD_FLAG;
-    }
-    if(broker->clean_session) {
-        conn_flags |= MQTT_CLEAN_SESSION;
-    }
-    if(broker->will_flag) {
-        conn_flags |= MQTT_WILL_FLAG;
-        if(will_topic_len) {
-            payload_len += will_topic_len + 2;
-        }
-        if(will_msg_len) {
-            payload_len += will_msg_len + 2;
-        }
-        if(broker->will_retain) {
-            conn_flags |= MQTT_WILL_RETAIN;
-        }
-        if(broker->will_qos == 1) {
-            conn_flags |= MQTT_WILL_QOS1 ;
-        }
-        if(broker->will_qos == 2) {
-            conn_flags |= MQTT_WILL_QOS2 ;
+    /* CONNECT does not change between reconnections, encode it once */
+    if ( broker->connect_packet == NULL ) {
+        if ( ( return_code = eclimqtt_connect_encode( broker ) ) != CLI_NO_ERROR ) {
+            return return_code;
         }
     }
-    uint8_t var_header[] = {
-        MQTT_311_PROTOCOL_NAME,                /* Protocol name */
-        MQTT_311_PROTOCOL_VER,                 /* Protocol version */
-        conn_flags,                              /* Connect flags */
-        CLI_RSHIFT_BYTE(broker->alive),        /* MSB Keep alive */
-        broker->alive & CLI_BYTE,              /* LSB Keep alive */
-    };
-
-    /***** Fixed header ****/
-    /***********************/
-    uint32_t remain_len = sizeof( var_header ) + payload_len;
-    /* Add extra byte for remain len */
-    if ( remain_len > ( MQTT_REMAIN_LEN_2ND_BYTE - 1 ) ) {
-        fixed_header_len++;
-        if ( remain_len > ( MQTT_REMAIN_LEN_3RD_BYTE - 1) ) {
-            fixed_header_len++;
-            if ( remain_len > ( MQTT_REMAIN_LEN_4TH_BYTE - 1) ) {
-                fixed_header_len++;
-            }
-        }
-    }
-    uint8_t fixed_header[fixed_header_len];
-    /* First Byte : Msg Type */
-    fixed_header[ packet_offset++ ] = MQTT_CTRLPKT_CONNECT;
-    /*  From 2nd to 5th Byte :  Remaining Len */
-    do{
-        remain_value = remain_len % MQTT_REMAIN_LEN;
-        remain_len = remain_len / MQTT_REMAIN_LEN;
-        if (remain_len > 0){
-            remain_value |= MQTT_REMAIN_LEN;
-        }
-        fixed_header[ packet_offset++ ] = remain_value;
-    }
-    while( remain_len > 0 );
-
-    /***********************/
-    /*******  Packet *******/
-    /***********************/
-    packet_offset = 0;
-    uint8_t qmtt_packet[ sizeof( fixed_header ) + sizeof( var_header ) + payload_len ];
-    memset( qmtt_packet, 0, sizeof( qmtt_packet ) );
-    /* Bulk Fixed Header */
-    memcpy( qmtt_packet, fixed_header, sizeof( fixed_header ) );
-    packet_offset += sizeof(fixed_header);
-    /* Bulk Var Header */
-    memcpy( qmtt_packet + packet_offset, var_header, sizeof( var_header ) );
-    packet_offset += sizeof( var_header );
-    /* Bulk Payload : Client ID */
-    qmtt_packet[ packet_offset++ ] = CLI_RSHIFT_BYTE(clientid_len);
-    qmtt_packet[ packet_offset++ ] = clientid_len & CLI_BYTE ;
-    memcpy( qmtt_packet + packet_offset, broker->client_id, clientid_len );
-    packet_offset += clientid_len;
-    if(broker->will_flag) {
-        /* Bulk Payload : Will Topic */
-        if(will_topic_len) {
-            qmtt_packet[ packet_offset++ ] = CLI_RSHIFT_BYTE(will_topic_len);
-            qmtt_packet[ packet_offset++ ] = will_topic_len & CLI_BYTE ;
-            memcpy( qmtt_packet + packet_offset, broker->will_topic, will_topic_len );
-            packet_offset += will_topic_len;
-        }
-        /* Bulk Payload : Will Message*/
-        if(will_msg_len) {
-            qmtt_packet[packet_offset++] = CLI_RSHIFT_BYTE(will_msg_len);
-            qmtt_packet[packet_offset++] = will_msg_len & CLI_BYTE;
-            memcpy(qmtt_packet + packet_offset, broker->will_msg, will_msg_len);
-            packet_offset += will_msg_len;
-        }
-    }
-    /* Bulk Payload : Username */
-    if(username_len) {
-        qmtt_packet[ packet_offset++ ] = CLI_RSHIFT_BYTE(username_len);
-        qmtt_packet[ packet_offset++ ] = username_len & CLI_BYTE ;
-        memcpy( qmtt_packet + packet_offset, broker->username, username_len );
-        packet_offset += username_len;
-    }
-    /* Bulk Payload : User password */
-    if(passwd_len) {
-        qmtt_packet[packet_offset++] = CLI_RSHIFT_BYTE(passwd_len);
-        qmtt_packet[packet_offset++] = passwd_len & CLI_BYTE;
-        memcpy(qmtt_packet + packet_offset, broker->password, passwd_len);
-        packet_offset += passwd_len;
-    }
+    broker->session_present = FALSE_FLAG;
 
     /* Send Conn packet */
-    if( broker->send_data( broker->socketid, ( void * ) qmtt_packet,
-        ( int ) sizeof( qmtt_packet ) ) < sizeof( qmtt_packet ) ) {
+    if( ecli_send_packet( broker, ( void * ) broker->connect_packet,
+        ( int ) broker->connect_len ) != ( int32_t ) broker->connect_len ) {
         return CLI_BRK_CON_ERROR;
     }
 
     return_code = eclimqtt_connack(broker, conf);
+    /* Rank endpoint by connect to CONNACK time */
+    eclinet_connack( broker->transport.endpoints, return_code == CLI_NO_ERROR );
 
     return return_code;
 }
@@ -226,9 +136,21 @@ uint8_t eclimqtt_publish(ecli_broker_t *broker, ecli_conf_t *conf, uint8_t first
     uint16_t packet_offset    = 0;
     uint16_t topiclen         = strlen(broker->topic);
     uint32_t fixed_header_len = MQTT_FIXED_HEADER_LEN;
+    uint64_t pub_start        = 0;
+    uint16_t trace_id         = 0;
     uint32_t msg_len          = 0;
+    int32_t  sent             = 0;
     FILE     *fileptr         = NULL;
+    const char *payload       = NULL;
+    uint8_t  *compressed      = NULL;
+    uint32_t compressed_len   = 0;
+    void     *mapped          = NULL;
+    uint8_t  trailer[HASH_TRAILER_MAX];
+    uint8_t  trailer_len      = 0;
 
+    if ( ecliutf8_topic( broker->topic, topiclen ) < 0 ) {
+        return CLI_TOPIC_ERROR;
+    }
     if ( first_msg_flag ) {
         msg_len = strlen( broker->retain_msg );
     }
@@ -255,26 +177,54 @@ uint8_t eclimqtt_publish(ecli_broker_t *broker, ecli_conf_t *conf, uint8_t first
     }
     /* Check max size */
     if ( msg_len > CLI_MAX_MSG_SIZE ){
+        if ( fileptr != NULL ) {
+            fclose(fileptr);
+        }
         return CLI_PUBLISH_SIZE_ERROR;
     }
-    uint8_t msg_buffer[msg_len];
+    /* Payload is not copied, transport sends it from the file or in place */
     if ( first_msg_flag ) {
-        memset( msg_buffer, 0, msg_len );
-        memcpy( msg_buffer, broker->retain_msg, msg_len );
+        payload = broker->retain_msg;
     }
-    else {
-        /*Type of Message [ text msg | datafile msg ]*/
-        if ( conf->msg_type == CLI_DATAFILE_MSG ) {
-            /*  Read in the entire file */
-            fread(msg_buffer, msg_len, 1, fileptr);
+    else if ( conf->msg_type == CLI_TXT_MSG ) {
+        payload = conf->msg_txt;
+    }
+    if ( conf->utf8_payload && payload != NULL && ecliutf8_text( payload, msg_len ) < 0 ) {
+        return CLI_UTF8_ERROR;
+    }
+
+    /* Compressed file goes from memory, not with sendfile */
+    if ( conf->codec_conf.codec != CODEC_NONE &&
+         ( compressed_len = eclimqtt_compress( broker, ( const uint8_t * ) payload,
+                                               fileptr ? fileno( fileptr ) : -1,
+                                               msg_len, &compressed ) ) > 0 ) {
+        if ( fileptr != NULL ) {
             fclose(fileptr);
+            fileptr = NULL;
         }
-        else if ( conf->msg_type == CLI_TXT_MSG ) {
-            memset( msg_buffer, 0, msg_len );
-            memcpy( msg_buffer, conf->msg_txt, msg_len );
+        payload = ( const char * ) compressed;
+        msg_len = compressed_len;
+    }
+    /* Checksum of payload as sent, or lane rate paced by the send queue:
+       file is mapped instead of sendfile */
+    if ( fileptr != NULL &&
+         ( conf->checksum != HASH_NONE ||
+           broker->sendq.lanes[ eclisendq_lane( ( const uint8_t * ) broker->topic,
+                                                strlen( broker->topic ) ) ].rate ) ) {
+        if ( msg_len > 0 &&
+             ( mapped = mmap( NULL, msg_len, PROT_READ, MAP_PRIVATE, fileno( fileptr ), 0 ) ) == MAP_FAILED ) {
+            fclose(fileptr);
+            return CLI_FILE_ERROR;
         }
+        fclose(fileptr);
+        fileptr = NULL;
+        payload = mapped ? ( const char * ) mapped : "";
     }
+    trailer_len = eclihash_put( conf->checksum, payload, payload ? msg_len : 0, trailer );
 
+    trace_id = broker->qos ? broker->sequence : 0;
+    TRACE_BEGIN( publish, trace_id, msg_len );
+    TRACE_BEGIN( encode, trace_id, msg_len );
     if(broker->qos == 1) {
         qos_size = 2; // 2 bytes for QoS
         qos_flag = MQTT_PUBLISH_QOS1_FLAG;
@@ -302,7 +252,7 @@ uint8_t eclimqtt_publish(ecli_broker_t *broker, ecli_conf_t *conf, uint8_t first
 
     /***** Fixed header ****/
     /***********************/
-    uint32_t remain_len = sizeof( var_header ) + msg_len;
+    uint32_t remain_len = sizeof( var_header ) + msg_len + trailer_len;
     /* Add extra byte for remain len */
     if ( remain_len > ( MQTT_REMAIN_LEN_2ND_BYTE - 1 ) ) {
         fixed_header_len++;
@@ -334,12 +284,16 @@ uint8_t eclimqtt_publish(ecli_broker_t *broker, ecli_conf_t *conf, uint8_t first
     /***********************/
     /*******  Packet *******/
     /***********************/
-    uint32_t packet_size = sizeof( fixed_header ) + sizeof( var_header ) + msg_len ;
-    uint8_t mqtt_packet[packet_size];
-    memset( mqtt_packet, 0, packet_size );
-    memcpy( mqtt_packet, fixed_header, sizeof( fixed_header ) );
-    memcpy( mqtt_packet + sizeof(fixed_header ), var_header, sizeof( var_header ) );
-    memcpy( mqtt_packet + sizeof( fixed_header ) + sizeof( var_header ), msg_buffer, msg_len );
+    uint32_t packet_size = sizeof( fixed_header ) + sizeof( var_header ) + msg_len + trailer_len;
+    uint32_t header_size = sizeof( fixed_header ) + sizeof( var_header );
+    struct iovec packet_iov[] = {
+        { .iov_base = fixed_header, .iov_len = sizeof( fixed_header ) },
+        { .iov_base = var_header, .iov_len = sizeof( var_header ) },
+        { .iov_base = ( void * ) payload, .iov_len = payload ? msg_len : 0 },
+        { .iov_base = trailer, .iov_len = trailer_len },
+    };
+
+    TRACE_END( encode, trace_id, packet_size );
 
     /* Send Publish packet */
     eclilog_show(__FILE__, __func__, PUBLISH_MSG, LOG_DEBUG);
@@ -347,9 +301,25 @@ uint8_t eclimqtt_publish(ecli_broker_t *broker, ecli_conf_t *conf, uint8_t first
     eclilog_show(__FILE__, __func__, buffer_str, LOG_DEBUG);
     sprintf(buffer_str, PUB_PKTLEN_MSG, packet_size);
     eclilog_show(__FILE__, __func__, buffer_str, LOG_DEBUG);
-    if( ( broker->send_data( broker->socketid,
-                           ( const void * ) mqtt_packet,
-                           packet_size ) ) < packet_size ) {
+    pub_start = eclimetrics_now();
+    if ( fileptr != NULL ) {
+        /* sendfile needs header in one piece */
+        uint8_t mqtt_header[header_size];
+        memcpy( mqtt_header, fixed_header, sizeof( fixed_header ) );
+        memcpy( mqtt_header + sizeof( fixed_header ), var_header, sizeof( var_header ) );
+        sent = ecli_send_file_packet( broker, ( const void * ) mqtt_header, header_size,
+                                      fileno( fileptr ), msg_len );
+        fclose(fileptr);
+    }
+    else {
+        sent = ecli_sendv_packet( broker, packet_iov, sizeof( packet_iov ) / sizeof( packet_iov[0] ) );
+    }
+    free( compressed );
+    if ( mapped != NULL ) {
+        munmap( mapped, msg_len );
+    }
+    if( sent != ( int32_t ) packet_size ) {
+        TRACE_END( publish, trace_id, 0 );
         return CLI_PUBLISH_ERROR;
     }
     sprintf(buffer_str, PUBLISHED_MSG, packet_size);
@@ -365,6 +335,11 @@ uint8_t eclimqtt_publish(ecli_broker_t *broker, ecli_conf_t *conf, uint8_t first
             }
         }
     }
+    if( return_code == CLI_NO_ERROR ) {
+        eclimetrics_publish( broker->metrics, broker->qos,
+                             broker->qos ? eclimetrics_now() - pub_start : 0 );
+    }
+    TRACE_END( publish, trace_id, packet_size );
 
     return return_code;
 }
@@ -389,12 +364,35 @@ uint8_t eclimqtt_publish_chunk(ecli_broker_t *broker, ecli_conf_t *conf, const u
     uint16_t packet_offset    = 0;
     uint16_t topiclen         = strlen(broker->topic);
     uint32_t fixed_header_len = MQTT_FIXED_HEADER_LEN;
+    uint64_t pub_start        = 0;
+    uint16_t trace_id         = 0;
+    int32_t  sent             = 0;
+    uint8_t  *compressed      = NULL;
+    uint32_t compressed_len   = 0;
+    uint8_t  trailer[HASH_TRAILER_MAX];
+    uint8_t  trailer_len      = 0;
 
     /* Check max size */
-    if ( msg_len > MAX_CHUNK_SIZE ){
+    if ( msg_len > CLI_MAX_MSG_SIZE ){
         return CLI_PUBLISH_SIZE_ERROR;
     }
+    if ( ecliutf8_topic( broker->topic, topiclen ) < 0 ) {
+        return CLI_TOPIC_ERROR;
+    }
+    if ( conf->utf8_payload && conf->msg_type == CLI_TXT_MSG && ecliutf8_text( msg_buffer, msg_len ) < 0 ) {
+        return CLI_UTF8_ERROR;
+    }
 
+    if ( conf->codec_conf.codec != CODEC_NONE &&
+         ( compressed_len = eclimqtt_compress( broker, msg_buffer, -1, msg_len, &compressed ) ) > 0 ) {
+        msg_buffer = compressed;
+        msg_len = compressed_len;
+    }
+    trailer_len = eclihash_put( conf->checksum, msg_buffer, msg_len, trailer );
+
+    trace_id = broker->qos ? broker->sequence : 0;
+    TRACE_BEGIN( publish, trace_id, msg_len );
+    TRACE_BEGIN( encode, trace_id, msg_len );
     if(broker->qos == 1) {
         qos_size = 2; // 2 bytes for QoS
         qos_flag = MQTT_PUBLISH_QOS1_FLAG;
@@ -422,7 +420,7 @@ uint8_t eclimqtt_publish_chunk(ecli_broker_t *broker, ecli_conf_t *conf, const u
 
     /***** Fixed header ****/
     /***********************/
-    uint32_t remain_len = sizeof( var_header ) + msg_len;
+    uint32_t remain_len = sizeof( var_header ) + msg_len + trailer_len;
     /* Add extra byte for remain len */
     if ( remain_len > ( MQTT_REMAIN_LEN_2ND_BYTE - 1 ) ) {
         fixed_header_len++;
@@ -454,12 +452,15 @@ uint8_t eclimqtt_publish_chunk(ecli_broker_t *broker, ecli_conf_t *conf, const u
     /***********************/
     /*******  Packet *******/
     /***********************/
-    uint32_t packet_size = sizeof( fixed_header ) + sizeof( var_header ) + msg_len ;
-    uint8_t mqtt_packet[packet_size];
-    memset( mqtt_packet, 0, packet_size );
-    memcpy( mqtt_packet, fixed_header, sizeof( fixed_header ) );
-    memcpy( mqtt_packet + sizeof(fixed_header ), var_header, sizeof( var_header ) );
-    memcpy( mqtt_packet + sizeof( fixed_header ) + sizeof( var_header ), msg_buffer, msg_len );
+    uint32_t packet_size = sizeof( fixed_header ) + sizeof( var_header ) + msg_len + trailer_len;
+    struct iovec packet_iov[] = {
+        { .iov_base = fixed_header, .iov_len = sizeof( fixed_header ) },
+        { .iov_base = var_header, .iov_len = sizeof( var_header ) },
+        { .iov_base = ( void * ) msg_buffer, .iov_len = msg_len },
+        { .iov_base = trailer, .iov_len = trailer_len },
+    };
+
+    TRACE_END( encode, trace_id, packet_size );
 
     /* Send Publish packet */
     eclilog_show(__FILE__, __func__, PUBLISH_MSG, LOG_DEBUG);
@@ -467,9 +468,11 @@ uint8_t eclimqtt_publish_chunk(ecli_broker_t *broker, ecli_conf_t *conf, const u
     eclilog_show(__FILE__, __func__, buffer_str, LOG_DEBUG);
     sprintf(buffer_str, PUB_PKTLEN_MSG, packet_size);
     eclilog_show(__FILE__, __func__, buffer_str, LOG_DEBUG);
-    if( ( broker->send_data( broker->socketid,
-                           ( const void * ) mqtt_packet,
-                           packet_size ) ) < packet_size ) {
+    pub_start = eclimetrics_now();
+    sent = ecli_sendv_packet( broker, packet_iov, sizeof( packet_iov ) / sizeof( packet_iov[0] ) );
+    free( compressed );
+    if( sent != ( int32_t ) packet_size ) {
+        TRACE_END( publish, trace_id, 0 );
         return CLI_PUBLISH_ERROR;
     }
     sprintf(buffer_str, PUBLISHED_MSG, packet_size);
@@ -485,6 +488,11 @@ uint8_t eclimqtt_publish_chunk(ecli_broker_t *broker, ecli_conf_t *conf, const u
             }
         }
     }
+    if( return_code == CLI_NO_ERROR ) {
+        eclimetrics_publish( broker->metrics, broker->qos,
+                             broker->qos ? eclimetrics_now() - pub_start : 0 );
+    }
+    TRACE_END( publish, trace_id, packet_size );
 
     return return_code;
 }
@@ -502,6 +510,10 @@ uint8_t eclimqtt_subscribe(ecli_broker_t *broker, ecli_conf_t *conf){
     uint8_t  return_code = CLI_NO_ERROR;
     uint16_t topiclen    = strlen(broker->topic);
 
+    if ( ecliutf8_filter( broker->topic, topiclen ) < 0 ) {
+        return CLI_TOPIC_ERROR;
+    }
+
     /***** Var. header *****/
     /***********************/
     /*Message ID*/
@@ -539,7 +551,7 @@ uint8_t eclimqtt_subscribe(ecli_broker_t *broker, ecli_conf_t *conf){
     memcpy( mqtt_packet + sizeof( fixed_header ) + sizeof( var_header ), topic, sizeof( topic ) );
 
     /* Send Subs packet */
-    if(broker->send_data(broker->socketid, mqtt_packet, sizeof( mqtt_packet ) ) < sizeof( mqtt_packet ) ) {
+    if(ecli_send_packet( broker, mqtt_packet, sizeof( mqtt_packet ) ) != sizeof( mqtt_packet ) ) {
         return CLI_SUB_SEND_ERROR;
     }
 
@@ -560,7 +572,7 @@ uint8_t eclimqtt_pingreq(ecli_broker_t *broker) {
     uint8_t mqtt_packet[] = { MQTT_CTRLPKT_PINGREQ, 0x00 };
 
     // Send the packet
-    if(broker->send_data(broker->socketid, mqtt_packet, sizeof(mqtt_packet)) < sizeof(mqtt_packet)) {
+    if(ecli_send_packet( broker, mqtt_packet, sizeof( mqtt_packet ) ) != sizeof( mqtt_packet ) ) {
         return CLI_ERROR;
     }
 
@@ -578,7 +590,11 @@ uint8_t eclimqtt_disconnect(ecli_broker_t *broker){
 
     uint8_t mqtt_packet[] = { MQTT_CTRLPKT_DISCONNECT, 0x00 };
 
-    if(broker->send_data(broker->socketid, mqtt_packet, sizeof(mqtt_packet)) < sizeof(mqtt_packet)) {
+    /* Queued packets go before the connection is closed, DISCONNECT
+       (control lane) must not pass queued publishes */
+    if(eclisendq_flush( &broker->sendq, &broker->transport, TRUE_FLAG ) != 0 ||
+       ecli_send_packet( broker, mqtt_packet, sizeof( mqtt_packet ) ) != sizeof( mqtt_packet ) ||
+       eclisendq_flush( &broker->sendq, &broker->transport, TRUE_FLAG ) != 0 ) {
         return CLI_BRK_DISCONNECT_ERROR;
     }
 
@@ -586,6 +602,153 @@ uint8_t eclimqtt_disconnect(ecli_broker_t *broker){
 }
 
 /**********************************************************************/
+/**********************************************************************/
+/** Encode CONNECT packet and keep it in broker for next connections.
+ *
+ * @param broker: structure that contains the client connection info with broker
+ */
+static uint8_t eclimqtt_connect_encode(ecli_broker_t *broker) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    uint8_t  conn_flags       = CLI_EMPTY_BYTE;
+    uint8_t  clientid_len     = strlen(broker->client_id);
+    uint8_t  will_topic_len   = strlen(broker->will_topic);
+    uint8_t  will_msg_len     = strlen(broker->will_msg);
+    uint8_t  username_len     = strlen(broker->username);
+    uint8_t  passwd_len       = strlen(broker->password);
+    uint8_t  payload_len      = clientid_len + 2;
+    uint8_t  fixed_header_len = MQTT_FIXED_HEADER_LEN;
+    uint8_t  remain_value     = 0;
+    uint16_t packet_offset    = 0;
+
+    TRACE_BEGIN( encode, 0, 0 );
+    /*****  Var header *****/
+    /***********************/
+    /* Set connection flags*/
+    if(username_len) {
+        payload_len += username_len + 2;
+        conn_flags |= MQTT_USERNAME_FLAG;
+    }
+    if(passwd_len) {
+        payload_len += passwd_len + 2;
+        conn_flags |= MQTT_PASSWORD_FLAG;
+    }
+    if(broker->clean_session) {
+        conn_flags |= MQTT_CLEAN_SESSION;
+    }
+    if(broker->will_flag) {
+        conn_flags |= MQTT_WILL_FLAG;
+        if(will_topic_len) {
+            payload_len += will_topic_len + 2;
+        }
+        if(will_msg_len) {
+            payload_len += will_msg_len + 2;
+        }
+        if(broker->will_retain) {
+            conn_flags |= MQTT_WILL_RETAIN;
+        }
+        if(broker->will_qos == 1) {
+            conn_flags |= MQTT_WILL_QOS1 ;
+        }
+        if(broker->will_qos == 2) {
+            conn_flags |= MQTT_WILL_QOS2 ;
+        }
+    }
+    uint8_t var_header[] = {
+        MQTT_311_PROTOCOL_NAME,                /* Protocol name */
+        MQTT_311_PROTOCOL_VER,                 /* Protocol version */
+        conn_flags,                              /* Connect flags */
+        CLI_RSHIFT_BYTE(broker->alive),        /* MSB Keep alive */
+        broker->alive & CLI_BYTE,              /* LSB Keep alive */
+    };
+
+    /***** Fixed header ****/
+    /***********************/
+    uint32_t remain_len = sizeof( var_header ) + payload_len;
+    /* Add extra byte for remain len */
+    if ( remain_len > ( MQTT_REMAIN_LEN_2ND_BYTE - 1 ) ) {
+        fixed_header_len++;
+        if ( remain_len > ( MQTT_REMAIN_LEN_3RD_BYTE - 1) ) {
+            fixed_header_len++;
+            if ( remain_len > ( MQTT_REMAIN_LEN_4TH_BYTE - 1) ) {
+                fixed_header_len++;
+            }
+        }
+    }
+    uint8_t fixed_header[fixed_header_len];
+    /* First Byte : Msg Type */
+    fixed_header[ packet_offset++ ] = MQTT_CTRLPKT_CONNECT;
+    /*  From 2nd to 5th Byte :  Remaining Len */
+    do{
+        remain_value = remain_len % MQTT_REMAIN_LEN;
+        remain_len = remain_len / MQTT_REMAIN_LEN;
+        if (remain_len > 0){
+            remain_value |= MQTT_REMAIN_LEN;
+        }
+        fixed_header[ packet_offset++ ] = remain_value;
+    }
+    while( remain_len > 0 );
+
+    /***********************/
+    /*******  Packet *******/
+    /***********************/
+    packet_offset = 0;
+    uint8_t qmtt_packet[ sizeof( fixed_header ) + sizeof( var_header ) + payload_len ];
+    memset( qmtt_packet, 0, sizeof( qmtt_packet ) );
+    /* Bulk Fixed Header */
+    memcpy( qmtt_packet, fixed_header, sizeof( fixed_header ) );
+    packet_offset += sizeof(fixed_header);
+    /* Bulk Var Header */
+    memcpy( qmtt_packet + packet_offset, var_header, sizeof( var_header ) );
+    packet_offset += sizeof( var_header );
+    /* Bulk Payload : Client ID */
+    qmtt_packet[ packet_offset++ ] = CLI_RSHIFT_BYTE(clientid_len);
+    qmtt_packet[ packet_offset++ ] = clientid_len & CLI_BYTE ;
+    memcpy( qmtt_packet + packet_offset, broker->client_id, clientid_len );
+    packet_offset += clientid_len;
+    if(broker->will_flag) {
+        /* Bulk Payload : Will Topic */
+        if(will_topic_len) {
+            qmtt_packet[ packet_offset++ ] = CLI_RSHIFT_BYTE(will_topic_len);
+            qmtt_packet[ packet_offset++ ] = will_topic_len & CLI_BYTE ;
+            memcpy( qmtt_packet + packet_offset, broker->will_topic, will_topic_len );
+            packet_offset += will_topic_len;
+        }
+        /* Bulk Payload : Will Message*/
+        if(will_msg_len) {
+            qmtt_packet[packet_offset++] = CLI_RSHIFT_BYTE(will_msg_len);
+            qmtt_packet[packet_offset++] = will_msg_len & CLI_BYTE;
+            memcpy(qmtt_packet + packet_offset, broker->will_msg, will_msg_len);
+            packet_offset += will_msg_len;
+        }
+    }
+    /* Bulk Payload : Username */
+    if(username_len) {
+        qmtt_packet[ packet_offset++ ] = CLI_RSHIFT_BYTE(username_len);
+        qmtt_packet[ packet_offset++ ] = username_len & CLI_BYTE ;
+        memcpy( qmtt_packet + packet_offset, broker->username, username_len );
+        packet_offset += username_len;
+    }
+    /* Bulk Payload : User password */
+    if(passwd_len) {
+        qmtt_packet[packet_offset++] = CLI_RSHIFT_BYTE(passwd_len);
+        qmtt_packet[packet_offset++] = passwd_len & CLI_BYTE;
+        memcpy(qmtt_packet + packet_offset, broker->password, passwd_len);
+        packet_offset += passwd_len;
+    }
+
+    TRACE_END( encode, 0, sizeof( qmtt_packet ) );
+
+    /* Keep encoded packet */
+    if ( ( broker->connect_packet = malloc( sizeof( qmtt_packet ) ) ) == NULL ) {
+        return CLI_BRK_CON_ERROR;
+    }
+    memcpy( broker->connect_packet, qmtt_packet, sizeof( qmtt_packet ) );
+    broker->connect_len = sizeof( qmtt_packet );
+
+    return CLI_NO_ERROR;
+}
+
 /**********************************************************************/
 /** Recv Connect CONNACK
  *
@@ -596,19 +759,11 @@ static uint8_t eclimqtt_connack(ecli_broker_t *broker, ecli_conf_t *conf) {
     eclilog_show(__FILE__, __func__, "", LOG_TRACE);
 
     if( ecli_read_header( broker, conf ) == CLI_ERROR ){
+        eclimetrics_ack_error( broker->metrics );
         return CLI_BRK_CON_READ_ERROR;
     }
     if( MQTT_MSG_TYPE( conf->packet_buffer ) != MQTT_CTRLPKT_CONNACK ) {
-      /* Session Present Flag. */
-      switch (conf->packet_buffer[2]) {
-      /*Session Present*/
-        case 0x01:
-          return CLI_CONN_SESS_PRE;
-        break;
-        default:
-          return CLI_BRK_CON_EXP_ERROR;
-        break;
-        }
+        return CLI_BRK_CON_EXP_ERROR;
     }
     if( conf->packet_buffer[3] != MQTT_CONNACK_FLAG ) {
       /*Connection Refused, verify which cases*/
@@ -638,6 +793,9 @@ static uint8_t eclimqtt_connack(ecli_broker_t *broker, ecli_conf_t *conf) {
           break;
       }
     }
+    /* Session Present Flag, broker kept our subscriptions */
+    broker->session_present = conf->packet_buffer[2] & MQTT_CONNACK_SESS_PRESENT;
+    TRACE_MARK( connack, 0, conf->packet_buffer[2] );
 
     return CLI_NO_ERROR;
 }
@@ -652,6 +810,7 @@ static uint8_t eclimqtt_suback(ecli_broker_t *broker, ecli_conf_t *conf) {
     eclilog_show(__FILE__, __func__, "", LOG_TRACE);
 
     if( ecli_read_header( broker, conf ) == CLI_ERROR ){
+        eclimetrics_ack_error( broker->metrics );
         return CLI_SUB_READ_ERROR;
     }
     if( MQTT_MSG_TYPE( conf->packet_buffer ) != MQTT_CTRLPKT_SUBACK ) {
@@ -662,6 +821,7 @@ static uint8_t eclimqtt_suback(ecli_broker_t *broker, ecli_conf_t *conf) {
     {
         return CLI_SUB_MSGID_ERROR;
     }
+    TRACE_MARK( suback, msg_id_rcv, 0 );
 
     return CLI_NO_ERROR;
 }
@@ -676,6 +836,7 @@ static uint8_t eclimqtt_puback(ecli_broker_t *broker, ecli_conf_t *conf) {
     eclilog_show(__FILE__, __func__, "", LOG_TRACE);
 
     if( ecli_read_header( broker, conf ) == CLI_ERROR ){
+        eclimetrics_ack_error( broker->metrics );
         return CLI_PUB1_READ_ERROR;
     }
     if( MQTT_MSG_TYPE( conf->packet_buffer ) != MQTT_CTRLPKT_PUBACK ) {
@@ -686,6 +847,7 @@ static uint8_t eclimqtt_puback(ecli_broker_t *broker, ecli_conf_t *conf) {
     {
         return CLI_PUB1_MSGID_ERROR;
     }
+    TRACE_MARK( puback, msg_id_rcv, 0 );
 
     return CLI_NO_ERROR;
 }
@@ -700,6 +862,7 @@ static uint8_t eclimqtt_pubrec(ecli_broker_t *broker, ecli_conf_t *conf) {
     eclilog_show(__FILE__, __func__, "", LOG_TRACE);
 
     if( ecli_read_header( broker, conf ) == CLI_ERROR ){
+        eclimetrics_ack_error( broker->metrics );
         return CLI_PUB2_REC_READ_ERROR;
     }
     if( MQTT_MSG_TYPE( conf->packet_buffer ) != MQTT_CTRLPKT_PUBREC ) {
@@ -710,6 +873,7 @@ static uint8_t eclimqtt_pubrec(ecli_broker_t *broker, ecli_conf_t *conf) {
     {
         return CLI_PUB2_REC_MSGID_ERROR;
     }
+    TRACE_MARK( pubrec, msg_id_rcv, 0 );
 
     return CLI_NO_ERROR;
 }
@@ -728,7 +892,7 @@ static uint8_t eclimqtt_pubrel(ecli_broker_t *broker) {
         CLI_RSHIFT_BYTE( broker->msg_id ), broker->msg_id & CLI_BYTE
     };
 
-    if(broker->send_data( broker->socketid, mqtt_packet, sizeof( mqtt_packet ) ) < sizeof( mqtt_packet ) ) {
+    if(ecli_send_packet( broker, mqtt_packet, sizeof( mqtt_packet ) ) != sizeof( mqtt_packet ) ) {
         return CLI_ERROR;
     }
 
@@ -746,6 +910,7 @@ static uint8_t eclimqtt_pubcomp(ecli_broker_t *broker, ecli_conf_t *conf) {
     eclilog_show(__FILE__, __func__, "", LOG_TRACE);
 
     if( ecli_read_header( broker, conf ) == CLI_ERROR ){
+        eclimetrics_ack_error( broker->metrics );
         return CLI_PUB2_COMP_READ_ERROR;
     }
     if( MQTT_MSG_TYPE( conf->packet_buffer ) != MQTT_CTRLPKT_PUBCOMP ) {
@@ -756,6 +921,60 @@ static uint8_t eclimqtt_pubcomp(ecli_broker_t *broker, ecli_conf_t *conf) {
     {
         return CLI_PUB2_COMP_MSGID_ERROR;
     }
+    TRACE_MARK( pubcomp, msg_id_rcv, 0 );
 
     return CLI_NO_ERROR;
 }
+
+/**********************************************************************/
+/** Compress payload (from memory or file) when it pays off, returns
+ * compressed size (buffer in out, caller frees) or 0 to send raw.
+ *
+ * @param broker: structure that contains the client connection info with broker
+ * @param payload: payload in memory, NULL to read fd.
+ * @param fd: file with payload, read from start.
+ * @param msg_len: payload size.
+ * @param out: compressed payload.
+ *
+ */
+static uint32_t eclimqtt_compress(ecli_broker_t *broker, const uint8_t *payload, int32_t fd,
+                                  uint32_t msg_len, uint8_t **out) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    char     buffer_str[CLI_BUF_SIZE] = {0};
+    uint8_t  *file_data = NULL;
+    uint32_t compressed_len = 0;
+    ssize_t  bytes = 0;
+    uint32_t total = 0;
+
+    *out = NULL;
+    if ( msg_len == 0 || ( *out = malloc( msg_len ) ) == NULL ) {
+        return 0;
+    }
+    /* pread keeps the file offset for sendfile if it is sent raw */
+    if ( payload == NULL && fd >= 0 ) {
+        if ( ( file_data = malloc( msg_len ) ) == NULL ) {
+            free( *out );
+            *out = NULL;
+            return 0;
+        }
+        while ( total < msg_len &&
+                ( bytes = pread( fd, file_data + total, msg_len - total, total ) ) > 0 ) {
+            total += bytes;
+        }
+        payload = total == msg_len ? file_data : NULL;
+    }
+    if ( payload != NULL ) {
+        compressed_len = eclicodec_compress( broker->topic, payload, msg_len, *out );
+    }
+    free( file_data );
+    if ( compressed_len == 0 ) {
+        free( *out );
+        *out = NULL;
+        return 0;
+    }
+    sprintf(buffer_str, COMPRESSED_MSG, msg_len, compressed_len);
+    eclilog_show(__FILE__, __func__, buffer_str, LOG_DEBUG);
+
+    return compressed_len;
+}
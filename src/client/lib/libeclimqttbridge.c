@@ -0,0 +1,1717 @@
+/***********************************************************************
+* FILENAME    :   libeclimqttbridge.c
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   Library code for the store-and-forward bridge between
+*                 a local and an upstream broker.
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**********************************************************************/
+
+#include <libeclimqttbridge.h>
+#include <libeclimqttutf8.h>
+
+/**********************************************************************/
+#define BRIDGE_HEADER_MAX     5         /* Fixed header of a packet */
+#define BRIDGE_WRAP           0x00      /* Ring byte: next packet at ring start */
+
+/**********************************************************************/
+/*Topic map*/
+typedef struct {
+    char     filter[CLI_TOPIC_LEN];
+    char     local_prefix[CLI_TOPIC_LEN];
+    char     remote_prefix[CLI_TOPIC_LEN];
+    uint16_t local_len;
+    uint16_t remote_len;
+    uint8_t  dir;                           /* ecli_bridge_dir flags */
+    uint8_t  qos;
+} eclibridge_map_t;
+
+/*Ring header, first bytes of the mapping (store file)*/
+typedef struct {
+    uint32_t magic;
+    uint32_t reserved;
+    uint64_t size;                          /* Ring bytes after header */
+    uint64_t head;                          /* Bytes written since store creation */
+    uint64_t tail;                          /* Bytes freed */
+    uint8_t  pad[32];
+} eclibridge_store_t;
+
+/*Unacked upstream QoS 1 packet*/
+typedef struct {
+    uint64_t start;                         /* Ring offset */
+    uint64_t sent_ns;
+    uint16_t pid;
+    uint8_t  acked;
+} eclibridge_flight_t;
+
+/*Bridge side: one connection*/
+typedef struct {
+    const char    *name;
+    ecli_broker_t *broker;
+    ecli_conf_t   *conf;
+    uint8_t       dir;                      /* Maps subscribed on this side */
+    uint8_t       connected;
+    uint32_t      attempt;                  /* Failed connects in a row */
+    uint64_t      connects;
+    uint64_t      retry_ns;
+    uint64_t      tx_ns;                    /* Last packet sent, keep alive */
+    uint64_t      rx_ns;                    /* Last bytes read */
+    uint64_t      ping_ns;
+    uint16_t      pid;                      /* SUBSCRIBE packet id */
+    uint8_t       *in;                      /* Bytes read, not parsed */
+    uint32_t      in_size;
+    uint32_t      in_len;
+    uint8_t       acks[BRIDGE_ACKS_SIZE];   /* Acks of parsed packets */
+    uint32_t      acks_len;
+    int32_t       wake_fd;
+} eclibridge_side_t;
+
+/**********************************************************************/
+static eclibridge_map_t   maps[BRIDGE_MAPS_MAX];
+static uint32_t           maps_num        = 0;
+static eclibridge_side_t  local_side      = { .name = "local", .dir = BRIDGE_OUT, .wake_fd = -1 };
+static eclibridge_side_t  remote_side     = { .name = "remote", .dir = BRIDGE_IN, .wake_fd = -1 };
+static eclibridge_store_t *store          = NULL;
+static uint8_t            *ring           = NULL;
+static size_t             store_len       = 0;
+static uint64_t           buffer_size     = BRIDGE_BUFFER_DEFAULT;
+static char               store_path[CLI_PATH_LEN] = {0};
+static uint64_t           head_off        = 0;      /* Local thread: written, not published */
+static uint64_t           send_off        = 0;      /* Remote thread: next packet to send */
+static uint64_t           sent_max        = 0;      /* Remote thread: packets sent once */
+static eclibridge_flight_t flight[BRIDGE_INFLIGHT_MAX];
+static uint32_t           flight_first    = 0;
+static uint32_t           flight_num      = 0;
+static uint32_t           inflight_max    = BRIDGE_INFLIGHT_DEFAULT;
+static uint16_t           publish_pid     = 1;
+static uint8_t            local_waiting   = 0;      /* Local thread waits for ring space */
+static uint8_t            remote_waiting  = 0;      /* Remote thread waits for packets */
+static volatile sig_atomic_t loop_stop    = 0;
+static pthread_mutex_t    local_lock      = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t           stat_received   = 0;
+static uint64_t           stat_forwarded  = 0;
+static uint64_t           stat_inbound    = 0;
+static uint64_t           stat_dropped    = 0;
+static uint64_t           stat_reconnects = 0;
+
+/**********************************************************************/
+/**********************************************************************/
+/** Read bridge keys and sections, returns -1 on error.
+ *
+ * @param fileptr: config file, at start.
+ * @param broker: default client connection info.
+ * @param conf: default user config options.
+ *
+ */
+static int8_t eclibridge_sections(FILE *fileptr, ecli_broker_t *broker, ecli_conf_t *conf);
+
+/**********************************************************************/
+/** Add topic map from "filter [out|in|both] [qos] [local_prefix]
+ * [remote_prefix]", returns -1 when not valid.
+ *
+ * @param value: map text.
+ *
+ */
+static int8_t eclibridge_map(const char *value);
+
+/**********************************************************************/
+/** Own transport and metrics of side options, returns -1 on error.
+ *
+ * @param side: bridge side, options set.
+ * @param base_conf: default user config options.
+ *
+ */
+static int8_t eclibridge_side(eclibridge_side_t *side, const ecli_conf_t *base_conf);
+
+/**********************************************************************/
+/** Map ring (store file or memory), check kept packets. Returns -1 on
+ * error.
+ *
+ */
+static int8_t eclibridge_store_open(void);
+
+/**********************************************************************/
+/** Local side thread: read local broker into the ring.
+ *
+ */
+static void eclibridge_local_loop(void);
+
+/**********************************************************************/
+/** Remote side thread: write the ring to the remote broker, publish
+ * incoming messages to the local broker.
+ *
+ * @param arg: not used.
+ *
+ */
+static void *eclibridge_remote_loop(void *arg);
+
+/**********************************************************************/
+/** Connect side and subscribe its maps, schedule retry when it fails.
+ * Returns -1 when not connected.
+ *
+ * @param side: bridge side.
+ *
+ */
+static int8_t eclibridge_connect(eclibridge_side_t *side);
+
+/**********************************************************************/
+/** Close lost connection and schedule reconnection.
+ *
+ * @param side: bridge side.
+ * @param error: error code.
+ *
+ */
+static void eclibridge_lost(eclibridge_side_t *side, uint8_t error);
+
+/**********************************************************************/
+/** Send packet on side (local one locked), returns -1 on error.
+ *
+ * @param side: bridge side.
+ * @param iov: packet parts.
+ * @param iovcnt: number of parts.
+ *
+ */
+static int8_t eclibridge_send(eclibridge_side_t *side, const struct iovec *iov, int32_t iovcnt);
+
+/**********************************************************************/
+/** Send PINGREQ when side is idle, returns -1 when connection is lost
+ * (nothing read for keep alive x 1.5).
+ *
+ * @param side: bridge side.
+ * @param now_ns: current time.
+ *
+ */
+static int8_t eclibridge_alive(eclibridge_side_t *side, uint64_t now_ns);
+
+/**********************************************************************/
+/** Get msecs until next keep alive check of side, -1 none.
+ *
+ * @param side: bridge side.
+ * @param now_ns: current time.
+ *
+ */
+static int32_t eclibridge_alive_ms(const eclibridge_side_t *side, uint64_t now_ns);
+
+/**********************************************************************/
+/** Read available bytes of side and handle its complete packets.
+ * Returns -1 when connection is lost.
+ *
+ * @param side: bridge side.
+ *
+ */
+static int8_t eclibridge_read(eclibridge_side_t *side);
+
+/**********************************************************************/
+/** Handle packet read from local broker, returns -1 to stop reading.
+ *
+ * @param packet: packet.
+ * @param header_len: fixed header bytes.
+ * @param len: packet bytes.
+ *
+ */
+static int8_t eclibridge_local_packet(const uint8_t *packet, uint32_t header_len, uint32_t len);
+
+/**********************************************************************/
+/** Handle packet read from remote broker, returns -1 on error.
+ *
+ * @param packet: packet.
+ * @param header_len: fixed header bytes.
+ * @param len: packet bytes.
+ *
+ */
+static int8_t eclibridge_remote_packet(const uint8_t *packet, uint32_t header_len, uint32_t len);
+
+/**********************************************************************/
+/** Check SUBACK return codes of side maps.
+ *
+ * @param side: bridge side.
+ * @param codes: return codes.
+ * @param count: number of codes.
+ *
+ */
+static void eclibridge_suback(const eclibridge_side_t *side, const uint8_t *codes, uint32_t count);
+
+/**********************************************************************/
+/** Append outgoing PUBLISH to the ring, waiting for space. Returns -1
+ * when stopped or local connection lost while waiting.
+ *
+ * @param map: map of topic.
+ * @param topic: local topic.
+ * @param topic_len: local topic length.
+ * @param payload: payload.
+ * @param payload_len: payload length.
+ * @param flags: PUBLISH QoS & retain flags.
+ *
+ */
+static int8_t eclibridge_put(const eclibridge_map_t *map, const uint8_t *topic, uint32_t topic_len,
+                             const uint8_t *payload, uint32_t payload_len, uint8_t flags);
+
+/**********************************************************************/
+/** Publish written ring packets to the remote thread.
+ *
+ */
+static void eclibridge_publish(void);
+
+/**********************************************************************/
+/** Write ring packets to remote broker while window and socket allow.
+ * Returns -1 on error.
+ *
+ * @param now_ns: current time.
+ *
+ */
+static int8_t eclibridge_forward(uint64_t now_ns);
+
+/**********************************************************************/
+/** Free ring up to offset, wake local thread waiting for space.
+ *
+ * @param offset: ring offset.
+ *
+ */
+static void eclibridge_release(uint64_t offset);
+
+/**********************************************************************/
+/** PUBACK of upstream packet.
+ *
+ * @param pid: packet id.
+ *
+ */
+static void eclibridge_ack(uint16_t pid);
+
+/**********************************************************************/
+/** Publish incoming message to local broker with QoS 0.
+ *
+ * @param map: map of topic.
+ * @param topic: remote topic.
+ * @param topic_len: remote topic length.
+ * @param payload: payload.
+ * @param payload_len: payload length.
+ * @param retain: retain flag.
+ *
+ */
+static void eclibridge_inbound(const eclibridge_map_t *map, const uint8_t *topic, uint32_t topic_len,
+                               const uint8_t *payload, uint32_t payload_len, uint8_t retain);
+
+/**********************************************************************/
+/** Find map of topic on side: prefix of side and filter match.
+ *
+ * @param dir: map direction (side of topic).
+ * @param topic: topic.
+ * @param topic_len: topic length.
+ *
+ */
+static const eclibridge_map_t *eclibridge_find(uint8_t dir, const uint8_t *topic, uint32_t topic_len);
+
+/**********************************************************************/
+/** Get length of packet at data, 0 when incomplete, -1 when malformed.
+ *
+ * @param data: packet start.
+ * @param avail: bytes available.
+ * @param header_len: fixed header bytes output.
+ *
+ */
+static int64_t eclibridge_packet_len(const uint8_t *data, uint32_t avail, uint32_t *header_len);
+
+/**********************************************************************/
+/** Wake thread waiting on eventfd.
+ *
+ * @param fd: eventfd.
+ *
+ */
+static void eclibridge_wake(int32_t fd);
+
+/**********************************************************************/
+/**********************************************************************/
+/** Read bridge keys, maps and sides of cfg_file, broker and conf hold
+ * the defaults of both sides. Returns number of maps, -1 on error.
+ *
+ * @param cfg_file: bridge config file.
+ * @param broker: default client connection info (global keys).
+ * @param conf: default user config options (global keys).
+ *
+ */
+int32_t eclibridge_load(const char *cfg_file, ecli_broker_t *broker, ecli_conf_t *conf) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    char     buffer_str[CLI_BUF_SIZE] = {0};
+    FILE     *fileptr;
+
+    if ( ( fileptr = fopen( cfg_file, "r" ) ) == NULL ) {
+        perror( cfg_file );
+        return -1;
+    }
+    local_side.broker = malloc( sizeof( ecli_broker_t ) );
+    local_side.conf = malloc( sizeof( ecli_conf_t ) );
+    remote_side.broker = malloc( sizeof( ecli_broker_t ) );
+    remote_side.conf = malloc( sizeof( ecli_conf_t ) );
+    if ( local_side.broker == NULL || local_side.conf == NULL ||
+         remote_side.broker == NULL || remote_side.conf == NULL ) {
+        fclose( fileptr );
+        fprintf( stderr, NO_MEM_ERROR "\n" );
+        return -1;
+    }
+    *local_side.broker = *broker;
+    *local_side.conf = *conf;
+    *remote_side.broker = *broker;
+    *remote_side.conf = *conf;
+    if ( eclibridge_sections( fileptr, broker, conf ) < 0 ) {
+        fclose( fileptr );
+        return -1;
+    }
+    fclose( fileptr );
+    if ( maps_num == 0 ) {
+        fprintf( stderr, BRIDGE_NONE_ERROR "\n", cfg_file );
+        return -1;
+    }
+    if ( eclibridge_side( &local_side, conf ) < 0 || eclibridge_side( &remote_side, conf ) < 0 ||
+         eclibridge_store_open() < 0 ) {
+        return -1;
+    }
+    sprintf( buffer_str, BRIDGE_LOAD_MSG, maps_num, ( unsigned long long ) store->size,
+             ( unsigned long long ) ( store->head - store->tail ) );
+    eclilog_show(__FILE__, __func__, buffer_str, LOG_INFO);
+
+    return maps_num;
+}
+
+/**********************************************************************/
+/** Bridge both sides until eclibridge_stop, then disconnect them.
+ *
+ */
+uint8_t eclibridge_run(void) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    char      buffer_str[CLI_BUF_SIZE] = {0};
+    pthread_t remote_thread;
+
+    if ( ( local_side.wake_fd = eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK ) ) < 0 ||
+         ( remote_side.wake_fd = eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK ) ) < 0 ||
+         ( local_side.in = malloc( BRIDGE_READ_SIZE ) ) == NULL ||
+         ( remote_side.in = malloc( BRIDGE_READ_SIZE ) ) == NULL ) {
+        return CLI_ERROR;
+    }
+    local_side.in_size = BRIDGE_READ_SIZE;
+    remote_side.in_size = BRIDGE_READ_SIZE;
+    if ( pthread_create( &remote_thread, NULL, eclibridge_remote_loop, NULL ) != 0 ) {
+        return CLI_ERROR;
+    }
+
+    eclibridge_local_loop();
+
+    eclibridge_wake( remote_side.wake_fd );
+    pthread_join( remote_thread, NULL );
+    if ( local_side.connected ) {
+        eclimqtt_disconnect( local_side.broker );
+        ecli_close( local_side.broker );
+    }
+    ecli_release( local_side.broker );
+    ecli_release( remote_side.broker );
+    if ( store_path[0] ) {
+        msync( store, store_len, MS_SYNC );
+    }
+    sprintf( buffer_str, BRIDGE_END_MSG, ( unsigned long long ) stat_received,
+             ( unsigned long long ) stat_forwarded, ( unsigned long long ) ( store->head - store->tail ),
+             ( unsigned long long ) stat_inbound, ( unsigned long long ) stat_dropped,
+             ( unsigned long long ) stat_reconnects );
+    eclilog_show(__FILE__, __func__, buffer_str, LOG_INFO);
+    close( local_side.wake_fd );
+    close( remote_side.wake_fd );
+    free( local_side.in );
+    free( remote_side.in );
+    munmap( store, store_len );
+
+    return CLI_NO_ERROR;
+}
+
+/**********************************************************************/
+/** Stop bridge (async signal safe).
+ *
+ */
+void eclibridge_stop(void) {
+
+    loop_stop = TRUE_FLAG;
+    eclibridge_wake( local_side.wake_fd );
+    eclibridge_wake( remote_side.wake_fd );
+}
+
+/**********************************************************************/
+/**********************************************************************/
+/** Read bridge keys and sections, returns -1 on error.
+ *
+ * @param fileptr: config file, at start.
+ * @param broker: default client connection info.
+ * @param conf: default user config options.
+ *
+ */
+static int8_t eclibridge_sections(FILE *fileptr, ecli_broker_t *broker, ecli_conf_t *conf) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    char     line[CLI_CFGLINE_LEN];
+    char     key[CLI_CFGLINE_LEN]   = {0};
+    char     value[CLI_CFGLINE_LEN] = {0};
+    eclibridge_side_t *side         = NULL;
+
+    while ( fgets( line, sizeof( line ), fileptr ) != NULL ) {
+        if ( strncmp( line, BRIDGE_LOCAL_SECTION, strlen( BRIDGE_LOCAL_SECTION ) ) == 0 ) {
+            side = &local_side;
+            continue;
+        }
+        if ( strncmp( line, BRIDGE_REMOTE_SECTION, strlen( BRIDGE_REMOTE_SECTION ) ) == 0 ) {
+            side = &remote_side;
+            continue;
+        }
+        ecli_conf_value( line, key, value );
+        if ( key[0] == '\0' ) {
+            continue;
+        }
+        /* Client keys before sections were set by ecli_get_conf */
+        if ( strcmp( key, BRIDGE_ID ) == EQUAL_STR_CMP ) {
+            if ( eclibridge_map( value ) < 0 ) {
+                fprintf( stderr, BRIDGE_MAP_ERROR "\n" );
+                return -1;
+            }
+        }
+        else if ( strcmp( key, BRIDGE_BUFFER_ID ) == EQUAL_STR_CMP ) {
+            buffer_size = strtoull( value, NULL, 10 );
+        }
+        else if ( strcmp( key, BRIDGE_STORE_ID ) == EQUAL_STR_CMP ) {
+            strncpy( store_path, value, sizeof( store_path ) - 1 );
+        }
+        else if ( strcmp( key, BRIDGE_INFLIGHT_ID ) == EQUAL_STR_CMP ) {
+            inflight_max = atoi( value );
+            if ( inflight_max < 1 || inflight_max > BRIDGE_INFLIGHT_MAX ) {
+                inflight_max = inflight_max < 1 ? 1 : BRIDGE_INFLIGHT_MAX;
+            }
+        }
+        else if ( side != NULL && ecli_set_conf( side->broker, side->conf, key, value ) < 0 ) {
+            fprintf( stderr, BRIDGE_KEY_ERROR "\n", key, side->name );
+            return -1;
+        }
+    }
+    /* Biggest packet must fit a quarter of the ring */
+    if ( buffer_size < 4 * ( uint64_t ) BRIDGE_READ_SIZE ) {
+        buffer_size = 4 * ( uint64_t ) BRIDGE_READ_SIZE;
+    }
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Add topic map from "filter [out|in|both] [qos] [local_prefix]
+ * [remote_prefix]", returns -1 when not valid.
+ *
+ * @param value: map text.
+ *
+ */
+static int8_t eclibridge_map(const char *value) {
+
+    char     text[CLI_CFGLINE_LEN];
+    char     *words[5] = { NULL };
+    char     *save     = NULL;
+    uint32_t count     = 0;
+    eclibridge_map_t *map = &maps[maps_num];
+
+    if ( maps_num == BRIDGE_MAPS_MAX ) {
+        return -1;
+    }
+    strncpy( text, value, sizeof( text ) - 1 );
+    text[sizeof( text ) - 1] = '\0';
+    for ( words[0] = strtok_r( text, " \t\r\n", &save ); words[count] != NULL && count < 4; ) {
+        words[++count] = strtok_r( NULL, " \t\r\n", &save );
+    }
+    if ( words[4] != NULL ) {
+        count = 5;
+    }
+    if ( count == 0 || strlen( words[0] ) >= CLI_TOPIC_LEN ) {
+        return -1;
+    }
+    memset( map, 0, sizeof( *map ) );
+    strcpy( map->filter, words[0] );
+    map->dir = BRIDGE_OUT;
+    if ( count > 1 ) {
+        if ( strcmp( words[1], BRIDGE_OUT_NAME ) == EQUAL_STR_CMP ) {
+            map->dir = BRIDGE_OUT;
+        }
+        else if ( strcmp( words[1], BRIDGE_IN_NAME ) == EQUAL_STR_CMP ) {
+            map->dir = BRIDGE_IN;
+        }
+        else if ( strcmp( words[1], BRIDGE_BOTH_NAME ) == EQUAL_STR_CMP ) {
+            map->dir = BRIDGE_BOTH;
+        }
+        else {
+            return -1;
+        }
+    }
+    /* QoS 2 is bridged as QoS 1 */
+    if ( count > 2 ) {
+        map->qos = atoi( words[2] ) > 0 ? 1 : 0;
+    }
+    if ( count > 3 && strcmp( words[3], BRIDGE_EMPTY_NAME ) != EQUAL_STR_CMP ) {
+        strncpy( map->local_prefix, words[3], sizeof( map->local_prefix ) - 1 );
+    }
+    if ( count > 4 && strcmp( words[4], BRIDGE_EMPTY_NAME ) != EQUAL_STR_CMP ) {
+        strncpy( map->remote_prefix, words[4], sizeof( map->remote_prefix ) - 1 );
+    }
+    map->local_len = strlen( map->local_prefix );
+    map->remote_len = strlen( map->remote_prefix );
+    if ( map->local_len + strlen( map->filter ) >= CLI_TOPIC_LEN ||
+         map->remote_len + strlen( map->filter ) >= CLI_TOPIC_LEN ) {
+        return -1;
+    }
+    maps_num++;
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Own transport and metrics of side options, returns -1 on error.
+ *
+ * @param side: bridge side, options set.
+ * @param base_conf: default user config options.
+ *
+ */
+static int8_t eclibridge_side(eclibridge_side_t *side, const ecli_conf_t *base_conf) {
+
+    ecli_broker_t *broker = side->broker;
+    ecli_conf_t   *conf   = side->conf;
+
+    /* Threads retry with backoff, connects do not wait */
+    conf->persist_conn_time = 0;
+    /* Ring packets are never dropped, incoming QoS 0 ones may be */
+    conf->sendq_drop = ( side == &remote_side ) ? SENDQ_DROP_NONE : SENDQ_DROP_NEWEST;
+    broker->sendq.nonblock = TRUE_FLAG;
+    broker->connect_packet = NULL;
+    broker->connect_len = 0;
+    broker->rx_pending = 0;
+    broker->transport.socketid = -1;
+    broker->transport.ctx = NULL;
+    if ( conf->tls && !base_conf->tls && eclitls_init( &conf->tls_conf ) < CLI_NO_ERROR ) {
+        fprintf( stderr, TLS_INIT_ERROR "\n" );
+        return -1;
+    }
+    if ( strncmp( conf->broker_hostname, TRANSPORT_UNIX_PREFIX, strlen( TRANSPORT_UNIX_PREFIX ) ) == 0 ) {
+        eclitransport_init( &broker->transport, &eclitransport_unix );
+        strncpy( broker->transport.path, conf->broker_hostname + strlen( TRANSPORT_UNIX_PREFIX ),
+                 sizeof( broker->transport.path ) - 1 );
+    }
+    else {
+        eclitransport_init( &broker->transport, conf->tls ? &eclitls_transport : &eclitransport_tcp );
+        broker->transport.stagger_ms = conf->connect_stagger;
+        if ( ( broker->transport.endpoints = eclinet_new( conf->broker_hostname, conf->broker_port,
+                                                          conf->dns_refresh ) ) == NULL ) {
+            fprintf( stderr, NO_MEM_ERROR "\n" );
+            return -1;
+        }
+    }
+    if ( ( broker->metrics = eclimetrics_new( broker->client_id ) ) == NULL ) {
+        fprintf( stderr, NO_MEM_ERROR "\n" );
+        return -1;
+    }
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Map ring (store file or memory), check kept packets. Returns -1 on
+ * error.
+ *
+ */
+static int8_t eclibridge_store_open(void) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    int32_t  fd         = -1;
+    uint8_t  keep       = FALSE_FLAG;
+    uint32_t header_len = 0;
+    uint64_t offset     = 0;
+    uint64_t pos        = 0;
+    int64_t  len        = 0;
+    struct stat st;
+
+    store_len = sizeof( eclibridge_store_t ) + buffer_size;
+    if ( store_path[0] == '\0' ) {
+        /* Pages taken as the ring is first filled */
+        store = mmap( NULL, store_len, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0 );
+    }
+    else {
+        if ( ( fd = open( store_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600 ) ) < 0 ||
+             fstat( fd, &st ) < 0 ) {
+            fprintf( stderr, BRIDGE_STORE_ERROR "\n", store_path, strerror( errno ) );
+            return -1;
+        }
+        keep = ( uint64_t ) st.st_size == store_len;
+        if ( !keep && ftruncate( fd, store_len ) < 0 ) {
+            fprintf( stderr, BRIDGE_STORE_ERROR "\n", store_path, strerror( errno ) );
+            close( fd );
+            return -1;
+        }
+        store = mmap( NULL, store_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+        close( fd );
+    }
+    if ( store == MAP_FAILED ) {
+        fprintf( stderr, BRIDGE_STORE_ERROR "\n", store_path[0] ? store_path : "-", strerror( errno ) );
+        return -1;
+    }
+    ring = ( uint8_t * ) store + sizeof( eclibridge_store_t );
+    if ( !keep || store->magic != BRIDGE_STORE_MAGIC || store->size != buffer_size ||
+         store->tail > store->head || store->head - store->tail > buffer_size ) {
+        memset( store, 0, sizeof( eclibridge_store_t ) );
+        store->magic = BRIDGE_STORE_MAGIC;
+        store->size = buffer_size;
+    }
+
+    /* Kept packets are checked up to the first torn one (crash while
+       writing), and sent again as duplicates */
+    for ( offset = store->tail; offset < store->head; offset += len ) {
+        pos = offset % store->size;
+        if ( ring[pos] == BRIDGE_WRAP ) {
+            len = store->size - pos;
+            continue;
+        }
+        len = eclibridge_packet_len( ring + pos, store->size - pos, &header_len );
+        if ( len <= 0 || MQTT_MSG_TYPE( ( ring + pos ) ) != MQTT_CTRLPKT_PUBLISH ||
+             offset + len > store->head ) {
+            break;
+        }
+    }
+    store->head = offset;
+    head_off = store->head;
+    send_off = store->tail;
+    sent_max = store->head;
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Local side thread: read local broker into the ring.
+ *
+ */
+static void eclibridge_local_loop(void) {
+
+    eclibridge_side_t *side = &local_side;
+    ecli_broker_t *broker   = side->broker;
+    uint64_t now_ns         = 0;
+    uint64_t value          = 0;
+    int32_t  timeout        = 0;
+    struct pollfd pfd[2];
+
+    while ( !loop_stop ) {
+        now_ns = eclimetrics_now();
+        if ( !side->connected && ( now_ns < side->retry_ns || eclibridge_connect( side ) < 0 ) ) {
+            pfd[0].fd = side->wake_fd;
+            pfd[0].events = POLLIN;
+            timeout = ( int32_t ) ( ( side->retry_ns - now_ns + 999999 ) / 1000000 );
+            if ( poll( pfd, 1, timeout ) > 0 ) {
+                while ( read( side->wake_fd, &value, sizeof( value ) ) < 0 && errno == EINTR );
+            }
+            continue;
+        }
+
+        /* Incoming messages may be queued by the remote thread */
+        pthread_mutex_lock( &local_lock );
+        if ( eclisendq_flush( &broker->sendq, &broker->transport, FALSE_FLAG ) < 0 ) {
+            pthread_mutex_unlock( &local_lock );
+            eclibridge_lost( side, CLI_ERROR );
+            continue;
+        }
+        pfd[0].events = POLLIN | ( broker->sendq.queued ? POLLOUT : 0 );
+        pthread_mutex_unlock( &local_lock );
+        pfd[0].fd = broker->transport.ops->fd( &broker->transport );
+        pfd[1].fd = side->wake_fd;
+        pfd[1].events = POLLIN;
+        timeout = eclibridge_alive_ms( side, now_ns );
+        if ( side->in_len == 0 && !eclitls_pending( &broker->transport ) &&
+             poll( pfd, 2, timeout ) <= 0 ) {
+            pfd[0].revents = 0;
+            pfd[1].revents = 0;
+        }
+        if ( pfd[1].revents ) {
+            while ( read( side->wake_fd, &value, sizeof( value ) ) < 0 && errno == EINTR );
+        }
+        if ( ( pfd[0].revents & ~POLLOUT ) || side->in_len || eclitls_pending( &broker->transport ) ) {
+            if ( eclibridge_read( side ) < 0 ) {
+                if ( !loop_stop ) {
+                    eclibridge_lost( side, CLI_BRK_CON_READ_ERROR );
+                }
+                continue;
+            }
+        }
+        if ( eclibridge_alive( side, eclimetrics_now() ) < 0 ) {
+            eclibridge_lost( side, CLI_BRK_CON_EXP_ERROR );
+        }
+    }
+}
+
+/**********************************************************************/
+/** Remote side thread: write the ring to the remote broker, publish
+ * incoming messages to the local broker.
+ *
+ * @param arg: not used.
+ *
+ */
+static void *eclibridge_remote_loop(void *arg) {
+
+    eclibridge_side_t *side = &remote_side;
+    ecli_broker_t *broker   = side->broker;
+    uint64_t now_ns         = 0;
+    uint64_t value          = 0;
+    int32_t  timeout        = 0;
+    uint8_t  more           = FALSE_FLAG;
+    sigset_t signals;
+    struct pollfd pfd[2];
+
+    /* Signals are handled by the local thread */
+    sigfillset( &signals );
+    pthread_sigmask( SIG_BLOCK, &signals, NULL );
+
+    while ( !loop_stop ) {
+        now_ns = eclimetrics_now();
+        if ( !side->connected ) {
+            if ( now_ns >= side->retry_ns && eclibridge_connect( side ) == 0 ) {
+                /* Packets from the oldest unacked one go again */
+                send_off = store->tail;
+                flight_num = 0;
+                if ( side->connects > 1 ) {
+                    stat_reconnects++;
+                }
+                continue;
+            }
+            pfd[0].fd = side->wake_fd;
+            pfd[0].events = POLLIN;
+            timeout = ( int32_t ) ( ( side->retry_ns - eclimetrics_now() + 999999 ) / 1000000 );
+            if ( poll( pfd, 1, timeout > 0 ? timeout : 0 ) > 0 ) {
+                while ( read( side->wake_fd, &value, sizeof( value ) ) < 0 && errno == EINTR );
+            }
+            continue;
+        }
+
+        if ( eclisendq_flush( &broker->sendq, &broker->transport, FALSE_FLAG ) < 0 ||
+             eclibridge_forward( now_ns ) < 0 ) {
+            eclibridge_lost( side, CLI_PUBLISH_ERROR );
+            continue;
+        }
+        /* Nothing to write: told by the local thread when there is */
+        more = broker->sendq.queued == 0 && flight_num < inflight_max &&
+               send_off < __atomic_load_n( &store->head, __ATOMIC_ACQUIRE );
+        if ( !more && broker->sendq.queued == 0 ) {
+            __atomic_store_n( &remote_waiting, TRUE_FLAG, __ATOMIC_SEQ_CST );
+            more = flight_num < inflight_max && send_off < __atomic_load_n( &store->head, __ATOMIC_SEQ_CST );
+        }
+        pfd[0].fd = broker->transport.ops->fd( &broker->transport );
+        pfd[0].events = POLLIN | ( broker->sendq.queued ? POLLOUT : 0 );
+        pfd[1].fd = side->wake_fd;
+        pfd[1].events = POLLIN;
+        timeout = ( more || side->in_len || eclitls_pending( &broker->transport ) ) ? 0 :
+                  eclibridge_alive_ms( side, now_ns );
+        if ( poll( pfd, 2, timeout ) <= 0 ) {
+            pfd[0].revents = 0;
+            pfd[1].revents = 0;
+        }
+        __atomic_store_n( &remote_waiting, FALSE_FLAG, __ATOMIC_RELAXED );
+        if ( pfd[1].revents ) {
+            while ( read( side->wake_fd, &value, sizeof( value ) ) < 0 && errno == EINTR );
+        }
+        if ( ( pfd[0].revents & ~POLLOUT ) || side->in_len || eclitls_pending( &broker->transport ) ) {
+            if ( eclibridge_read( side ) < 0 ) {
+                eclibridge_lost( side, CLI_BRK_CON_READ_ERROR );
+                continue;
+            }
+        }
+        if ( eclibridge_alive( side, eclimetrics_now() ) < 0 ) {
+            eclibridge_lost( side, CLI_BRK_CON_EXP_ERROR );
+        }
+    }
+
+    if ( side->connected ) {
+        eclimqtt_disconnect( broker );
+        ecli_close( broker );
+        side->connected = FALSE_FLAG;
+    }
+
+    return NULL;
+}
+
+/**********************************************************************/
+/** Connect side and subscribe its maps, schedule retry when it fails.
+ * Returns -1 when not connected.
+ *
+ * @param side: bridge side.
+ *
+ */
+static int8_t eclibridge_connect(eclibridge_side_t *side) {
+
+    ecli_broker_t *broker = side->broker;
+    ecli_conf_t   *conf   = side->conf;
+    char     buffer_str[CLI_BUF_SIZE] = {0};
+    uint8_t  packet[BRIDGE_HEADER_MAX + 2 + BRIDGE_MAPS_MAX * ( 2 * CLI_TOPIC_LEN + 3 )];
+    uint8_t  *ptr          = packet + BRIDGE_HEADER_MAX;
+    uint8_t  return_code   = CLI_NO_ERROR;
+    uint32_t remain_len    = 0;
+    uint32_t header_len    = 2;
+    uint32_t filter_len    = 0;
+    uint32_t i             = 0;
+    struct iovec iov;
+
+    if ( ( return_code = ecli_init( broker, conf ) ) == CLI_NO_ERROR ) {
+        return_code = eclimqtt_connect( broker, conf );
+    }
+    if ( return_code != CLI_NO_ERROR ) {
+        ecli_show_error( return_code );
+        ecli_close( broker );
+        side->retry_ns = eclimetrics_now() + ecli_backoff_msecs( conf, side->attempt++ ) * 1000000ULL;
+        return -1;
+    }
+    /* Packets read after CONNACK (kept session) are parsed first */
+    memcpy( side->in, broker->rx_buffer, broker->rx_pending );
+    side->in_len = broker->rx_pending;
+    broker->rx_pending = 0;
+    side->acks_len = 0;
+
+    /* One SUBSCRIBE with every filter of the side */
+    if ( ++side->pid == 0 ) {
+        side->pid = 1;
+    }
+    *ptr++ = CLI_RSHIFT_BYTE( side->pid );
+    *ptr++ = side->pid & CLI_BYTE;
+    for ( i = 0; i < maps_num; i++ ) {
+        if ( !( maps[i].dir & side->dir ) ) {
+            continue;
+        }
+        filter_len = strlen( maps[i].filter );
+        if ( side == &local_side ) {
+            filter_len += maps[i].local_len;
+            *ptr++ = CLI_RSHIFT_BYTE( filter_len );
+            *ptr++ = filter_len & CLI_BYTE;
+            memcpy( ptr, maps[i].local_prefix, maps[i].local_len );
+            ptr += maps[i].local_len;
+        }
+        else {
+            filter_len += maps[i].remote_len;
+            *ptr++ = CLI_RSHIFT_BYTE( filter_len );
+            *ptr++ = filter_len & CLI_BYTE;
+            memcpy( ptr, maps[i].remote_prefix, maps[i].remote_len );
+            ptr += maps[i].remote_len;
+        }
+        strcpy( ( char * ) ptr, maps[i].filter );
+        ptr += strlen( maps[i].filter );
+        *ptr++ = maps[i].qos;
+    }
+    if ( ptr > packet + BRIDGE_HEADER_MAX + 2 ) {
+        /* Remaining length written backwards before the var header */
+        remain_len = ptr - ( packet + BRIDGE_HEADER_MAX );
+        header_len += ( remain_len >= MQTT_REMAIN_LEN_2ND_BYTE ) + ( remain_len >= MQTT_REMAIN_LEN_3RD_BYTE );
+        iov.iov_base = packet + BRIDGE_HEADER_MAX - header_len;
+        iov.iov_len = header_len + remain_len;
+        ptr = iov.iov_base;
+        *ptr++ = MQTT_CTRLPKT_SUBSCRIBE | MQTT_SUBSCRIBE_FLAG;
+        do {
+            *ptr = remain_len % MQTT_REMAIN_LEN;
+            remain_len /= MQTT_REMAIN_LEN;
+            if ( remain_len > 0 ) {
+                *ptr |= MQTT_REMAIN_LEN;
+            }
+            ptr++;
+        }
+        while ( remain_len > 0 );
+        if ( ecli_sendv_packet( broker, &iov, 1 ) != ( int32_t ) iov.iov_len ) {
+            ecli_show_error( CLI_SUB_SEND_ERROR );
+            ecli_close( broker );
+            side->retry_ns = eclimetrics_now() + ecli_backoff_msecs( conf, side->attempt++ ) * 1000000ULL;
+            return -1;
+        }
+    }
+
+    pthread_mutex_lock( &local_lock );
+    side->connected = TRUE_FLAG;
+    pthread_mutex_unlock( &local_lock );
+    side->attempt = 0;
+    side->connects++;
+    side->tx_ns = eclimetrics_now();
+    side->rx_ns = side->tx_ns;
+    side->ping_ns = 0;
+    sprintf( buffer_str, BRIDGE_UP_MSG, side->name );
+    eclilog_show(__FILE__, __func__, buffer_str, LOG_INFO);
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Close lost connection and schedule reconnection.
+ *
+ * @param side: bridge side.
+ * @param error: error code.
+ *
+ */
+static void eclibridge_lost(eclibridge_side_t *side, uint8_t error) {
+
+    ecli_show_error( error );
+    pthread_mutex_lock( &local_lock );
+    side->connected = FALSE_FLAG;
+    ecli_close( side->broker );
+    pthread_mutex_unlock( &local_lock );
+    side->in_len = 0;
+    side->acks_len = 0;
+    side->retry_ns = eclimetrics_now() + ecli_backoff_msecs( side->conf, side->attempt++ ) * 1000000ULL;
+}
+
+/**********************************************************************/
+/** Send packet on side (local one locked), returns -1 on error.
+ *
+ * @param side: bridge side.
+ * @param iov: packet parts.
+ * @param iovcnt: number of parts.
+ *
+ */
+static int8_t eclibridge_send(eclibridge_side_t *side, const struct iovec *iov, int32_t iovcnt) {
+
+    int32_t count  = 0;
+    int32_t sent   = 0;
+    int32_t i      = 0;
+
+    for ( i = 0; i < iovcnt; i++ ) {
+        count += iov[i].iov_len;
+    }
+    if ( side == &local_side ) {
+        pthread_mutex_lock( &local_lock );
+    }
+    sent = ecli_sendv_packet( side->broker, iov, iovcnt );
+    if ( side == &local_side ) {
+        pthread_mutex_unlock( &local_lock );
+    }
+    if ( sent != count ) {
+        return -1;
+    }
+    side->tx_ns = eclimetrics_now();
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Send PINGREQ when side is idle, returns -1 when connection is lost
+ * (nothing read for keep alive x 1.5).
+ *
+ * @param side: bridge side.
+ * @param now_ns: current time.
+ *
+ */
+static int8_t eclibridge_alive(eclibridge_side_t *side, uint64_t now_ns) {
+
+    uint64_t alive_ns = side->broker->alive * 500000000ULL;
+    uint8_t  packet[] = { MQTT_CTRLPKT_PINGREQ, 0x00 };
+    struct iovec iov  = { .iov_base = packet, .iov_len = sizeof( packet ) };
+
+    if ( alive_ns == 0 ) {
+        return 0;
+    }
+    if ( now_ns - side->rx_ns > 3 * alive_ns ) {
+        return -1;
+    }
+    /* Nothing sent, or nothing read (a link gone silent) for half keep alive */
+    if ( ( now_ns - side->tx_ns >= alive_ns || now_ns - side->rx_ns >= alive_ns ) &&
+         now_ns - side->ping_ns >= alive_ns ) {
+        side->ping_ns = now_ns;
+        return eclibridge_send( side, &iov, 1 );
+    }
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Get msecs until next keep alive check of side, -1 none.
+ *
+ * @param side: bridge side.
+ * @param now_ns: current time.
+ *
+ */
+static int32_t eclibridge_alive_ms(const eclibridge_side_t *side, uint64_t now_ns) {
+
+    uint64_t alive_ns = side->broker->alive * 500000000ULL;
+    uint64_t due_ns   = 0;
+
+    if ( alive_ns == 0 ) {
+        return -1;
+    }
+    due_ns = ( side->tx_ns < side->rx_ns ? side->tx_ns : side->rx_ns ) + alive_ns;
+    if ( side->ping_ns + alive_ns > due_ns ) {
+        due_ns = side->ping_ns + alive_ns;
+    }
+    if ( side->rx_ns + 3 * alive_ns < due_ns ) {
+        due_ns = side->rx_ns + 3 * alive_ns;
+    }
+
+    return due_ns <= now_ns ? 0 : ( int32_t ) ( ( due_ns - now_ns + 999999 ) / 1000000 );
+}
+
+/**********************************************************************/
+/** Read available bytes of side and handle its complete packets.
+ * Returns -1 when connection is lost.
+ *
+ * @param side: bridge side.
+ *
+ */
+static int8_t eclibridge_read(eclibridge_side_t *side) {
+
+    ecli_broker_t *broker = side->broker;
+    uint8_t  *data       = NULL;
+    uint32_t header_len  = 0;
+    uint32_t start       = 0;
+    uint32_t size        = 0;
+    int32_t  bytes       = 0;
+    int64_t  len         = 0;
+    int8_t   return_code = 0;
+    struct iovec iov;
+
+    /* Bigger packet than buffer: buffer grows up to a max packet */
+    if ( side->in_len == side->in_size ) {
+        size = side->in_size * 2;
+        if ( size > CLI_MAX_MSG_SIZE + CLI_BUF_SIZE ) {
+            size = CLI_MAX_MSG_SIZE + CLI_BUF_SIZE;
+        }
+        if ( size <= side->in_size || ( data = realloc( side->in, size ) ) == NULL ) {
+            return -1;
+        }
+        side->in = data;
+        side->in_size = size;
+    }
+    bytes = broker->transport.ops->recv( &broker->transport, side->in + side->in_len,
+                                         side->in_size - side->in_len, MSG_DONTWAIT );
+    if ( bytes == 0 || ( bytes < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR ) ) {
+        return -1;
+    }
+    if ( bytes > 0 ) {
+        side->in_len += bytes;
+        side->rx_ns = eclimetrics_now();
+    }
+
+    while ( return_code == 0 &&
+            ( len = eclibridge_packet_len( side->in + start, side->in_len - start, &header_len ) ) > 0 ) {
+        eclimetrics_rx( broker->metrics, side->in + start, len );
+        if ( side == &local_side ) {
+            return_code = eclibridge_local_packet( side->in + start, header_len, len );
+        }
+        else {
+            return_code = eclibridge_remote_packet( side->in + start, header_len, len );
+        }
+        start += len;
+    }
+    if ( len < 0 ) {
+        return_code = -1;
+    }
+    /* Acks go after the packets they ack are stored / published */
+    if ( side == &local_side ) {
+        eclibridge_publish();
+    }
+    if ( side->acks_len && return_code == 0 ) {
+        iov.iov_base = side->acks;
+        iov.iov_len = side->acks_len;
+        return_code = eclibridge_send( side, &iov, 1 );
+    }
+    side->acks_len = 0;
+    if ( start > 0 && start < side->in_len ) {
+        memmove( side->in, side->in + start, side->in_len - start );
+    }
+    side->in_len -= start;
+
+    return return_code;
+}
+
+/**********************************************************************/
+/** Handle packet read from local broker, returns -1 to stop reading.
+ *
+ * @param packet: packet.
+ * @param header_len: fixed header bytes.
+ * @param len: packet bytes.
+ *
+ */
+static int8_t eclibridge_local_packet(const uint8_t *packet, uint32_t header_len, uint32_t len) {
+
+    const eclibridge_map_t *map = NULL;
+    const uint8_t *ptr   = packet + header_len;
+    uint32_t topic_len   = 0;
+    uint8_t  qos         = MQTT_QOS_TYPE( packet );
+    uint8_t  ack_type    = 0;
+    struct iovec iov;
+
+    switch ( MQTT_MSG_TYPE( packet ) ) {
+        case MQTT_CTRLPKT_PUBLISH:
+            if ( len < header_len + 2 ) {
+                return -1;
+            }
+            topic_len = CLI_LSHIFT_BYTE( ptr[0] ) | ptr[1];
+            if ( header_len + 2 + topic_len + ( qos ? 2 : 0 ) > len ) {
+                return -1;
+            }
+            ptr += 2 + topic_len + ( qos ? 2 : 0 );
+            stat_received++;
+            if ( ( map = eclibridge_find( BRIDGE_OUT, packet + header_len + 2, topic_len ) ) == NULL ) {
+                stat_dropped++;
+            }
+            else if ( eclibridge_put( map, packet + header_len + 2, topic_len, ptr, packet + len - ptr,
+                                      packet[0] & ( MQTT_PUBLISH_QOS1_FLAG | MQTT_PUBLISH_QOS2_FLAG |
+                                                    MQTT_PUBLISH_RETAIN_FLAG ) ) < 0 ) {
+                return -1;
+            }
+            if ( qos == 1 ) {
+                ack_type = MQTT_CTRLPKT_PUBACK;
+            }
+            else if ( qos == 2 ) {
+                ack_type = MQTT_CTRLPKT_PUBREC;
+            }
+            ptr = packet + header_len + 2 + topic_len;
+            break;
+        case MQTT_CTRLPKT_PUBREL:
+            ack_type = MQTT_CTRLPKT_PUBCOMP;
+            break;
+        case MQTT_CTRLPKT_SUBACK:
+            if ( len >= header_len + 2 ) {
+                eclibridge_suback( &local_side, ptr + 2, len - header_len - 2 );
+            }
+            break;
+        default:
+            break;
+    }
+    if ( ack_type && ptr + 2 <= packet + len ) {
+        if ( local_side.acks_len + 4 > sizeof( local_side.acks ) ) {
+            iov.iov_base = local_side.acks;
+            iov.iov_len = local_side.acks_len;
+            eclibridge_publish();
+            local_side.acks_len = 0;
+            if ( eclibridge_send( &local_side, &iov, 1 ) < 0 ) {
+                return -1;
+            }
+        }
+        local_side.acks[local_side.acks_len++] = ack_type;
+        local_side.acks[local_side.acks_len++] = 0x02;
+        local_side.acks[local_side.acks_len++] = ptr[0];
+        local_side.acks[local_side.acks_len++] = ptr[1];
+    }
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Handle packet read from remote broker, returns -1 on error.
+ *
+ * @param packet: packet.
+ * @param header_len: fixed header bytes.
+ * @param len: packet bytes.
+ *
+ */
+static int8_t eclibridge_remote_packet(const uint8_t *packet, uint32_t header_len, uint32_t len) {
+
+    const eclibridge_map_t *map = NULL;
+    const uint8_t *ptr   = packet + header_len;
+    uint32_t topic_len   = 0;
+    uint8_t  qos         = MQTT_QOS_TYPE( packet );
+    uint8_t  ack_type    = 0;
+    struct iovec iov;
+
+    switch ( MQTT_MSG_TYPE( packet ) ) {
+        case MQTT_CTRLPKT_PUBACK:
+            if ( len >= header_len + 2 ) {
+                eclibridge_ack( CLI_LSHIFT_BYTE( ptr[0] ) | ptr[1] );
+            }
+            break;
+        case MQTT_CTRLPKT_PUBLISH:
+            if ( len < header_len + 2 ) {
+                return -1;
+            }
+            topic_len = CLI_LSHIFT_BYTE( ptr[0] ) | ptr[1];
+            if ( header_len + 2 + topic_len + ( qos ? 2 : 0 ) > len ) {
+                return -1;
+            }
+            ptr += 2 + topic_len;
+            if ( ( map = eclibridge_find( BRIDGE_IN, packet + header_len + 2, topic_len ) ) != NULL ) {
+                eclibridge_inbound( map, packet + header_len + 2, topic_len, ptr + ( qos ? 2 : 0 ),
+                                    packet + len - ptr - ( qos ? 2 : 0 ), packet[0] & MQTT_PUBLISH_RETAIN_FLAG );
+            }
+            if ( qos == 1 ) {
+                ack_type = MQTT_CTRLPKT_PUBACK;
+            }
+            else if ( qos == 2 ) {
+                ack_type = MQTT_CTRLPKT_PUBREC;
+            }
+            break;
+        case MQTT_CTRLPKT_PUBREL:
+            ack_type = MQTT_CTRLPKT_PUBCOMP;
+            break;
+        case MQTT_CTRLPKT_SUBACK:
+            if ( len >= header_len + 2 ) {
+                eclibridge_suback( &remote_side, ptr + 2, len - header_len - 2 );
+            }
+            break;
+        default:
+            break;
+    }
+    if ( ack_type && ptr + 2 <= packet + len ) {
+        if ( remote_side.acks_len + 4 > sizeof( remote_side.acks ) ) {
+            iov.iov_base = remote_side.acks;
+            iov.iov_len = remote_side.acks_len;
+            remote_side.acks_len = 0;
+            if ( eclibridge_send( &remote_side, &iov, 1 ) < 0 ) {
+                return -1;
+            }
+        }
+        remote_side.acks[remote_side.acks_len++] = ack_type;
+        remote_side.acks[remote_side.acks_len++] = 0x02;
+        remote_side.acks[remote_side.acks_len++] = ptr[0];
+        remote_side.acks[remote_side.acks_len++] = ptr[1];
+    }
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Check SUBACK return codes of side maps.
+ *
+ * @param side: bridge side.
+ * @param codes: return codes.
+ * @param count: number of codes.
+ *
+ */
+static void eclibridge_suback(const eclibridge_side_t *side, const uint8_t *codes, uint32_t count) {
+
+    char     buffer_str[CLI_BUF_SIZE] = {0};
+    uint32_t i = 0;
+    uint32_t j = 0;
+
+    for ( i = 0; i < maps_num && j < count; i++ ) {
+        if ( !( maps[i].dir & side->dir ) ) {
+            continue;
+        }
+        if ( codes[j++] & 0x80 ) {
+            snprintf( buffer_str, sizeof( buffer_str ), BRIDGE_SUB_ERROR, side->name,
+                      ( int ) sizeof( maps[i].filter ), maps[i].filter );
+            eclilog_show(__FILE__, __func__, buffer_str, LOG_ERROR);
+            fprintf( stderr, "%s\n", buffer_str );
+        }
+    }
+}
+
+/**********************************************************************/
+/** Append outgoing PUBLISH to the ring, waiting for space. Returns -1
+ * when stopped or local connection lost while waiting.
+ *
+ * @param map: map of topic.
+ * @param topic: local topic.
+ * @param topic_len: local topic length.
+ * @param payload: payload.
+ * @param payload_len: payload length.
+ * @param flags: PUBLISH QoS & retain flags.
+ *
+ */
+static int8_t eclibridge_put(const eclibridge_map_t *map, const uint8_t *topic, uint32_t topic_len,
+                             const uint8_t *payload, uint32_t payload_len, uint8_t flags) {
+
+    char     buffer_str[CLI_BUF_SIZE] = {0};
+    uint8_t  *ptr        = NULL;
+    uint8_t  qos_size    = ( flags & ( MQTT_PUBLISH_QOS1_FLAG | MQTT_PUBLISH_QOS2_FLAG ) ) ? 2 : 0;
+    uint32_t out_len     = map->remote_len + topic_len - map->local_len;
+    uint32_t remain_len  = 2 + out_len + qos_size + payload_len;
+    uint32_t len         = 1 + 1 + ( remain_len >= MQTT_REMAIN_LEN_2ND_BYTE ) +
+                           ( remain_len >= MQTT_REMAIN_LEN_3RD_BYTE ) +
+                           ( remain_len >= MQTT_REMAIN_LEN_4TH_BYTE ) + remain_len;
+    uint64_t pos         = head_off % store->size;
+    uint64_t skip        = ( pos + len > store->size ) ? store->size - pos : 0;
+    uint64_t value       = 0;
+    uint64_t now_ns      = 0;
+    struct pollfd pfd;
+
+    if ( len > store->size / 4 ) {
+        snprintf( buffer_str, sizeof( buffer_str ), BRIDGE_BIG_ERROR, map->filter );
+        eclilog_show(__FILE__, __func__, buffer_str, LOG_ERROR);
+        stat_dropped++;
+        return 0;
+    }
+
+    /* Full ring: local socket is not read, local broker holds messages */
+    while ( head_off + skip + len - __atomic_load_n( &store->tail, __ATOMIC_ACQUIRE ) > store->size ) {
+        eclibridge_publish();
+        if ( local_side.acks_len ) {
+            struct iovec iov = { .iov_base = local_side.acks, .iov_len = local_side.acks_len };
+            local_side.acks_len = 0;
+            if ( eclibridge_send( &local_side, &iov, 1 ) < 0 ) {
+                return -1;
+            }
+        }
+        __atomic_store_n( &local_waiting, TRUE_FLAG, __ATOMIC_SEQ_CST );
+        if ( head_off + skip + len - __atomic_load_n( &store->tail, __ATOMIC_SEQ_CST ) <= store->size ) {
+            __atomic_store_n( &local_waiting, FALSE_FLAG, __ATOMIC_RELAXED );
+            break;
+        }
+        now_ns = eclimetrics_now();
+        pfd.fd = local_side.wake_fd;
+        pfd.events = POLLIN;
+        if ( poll( &pfd, 1, eclibridge_alive_ms( &local_side, now_ns ) ) > 0 ) {
+            while ( read( local_side.wake_fd, &value, sizeof( value ) ) < 0 && errno == EINTR );
+        }
+        __atomic_store_n( &local_waiting, FALSE_FLAG, __ATOMIC_RELAXED );
+        /* Messages waiting in the socket keep the local link alive */
+        local_side.rx_ns = eclimetrics_now();
+        if ( loop_stop || eclibridge_alive( &local_side, local_side.rx_ns ) < 0 ) {
+            return -1;
+        }
+    }
+
+    if ( skip ) {
+        ring[pos] = BRIDGE_WRAP;
+        head_off += skip;
+        pos = 0;
+    }
+    /* Packet sent as is by the remote thread, packet id set there */
+    ptr = ring + pos;
+    *ptr++ = MQTT_CTRLPKT_PUBLISH | ( flags & MQTT_PUBLISH_RETAIN_FLAG ) | ( qos_size ? MQTT_PUBLISH_QOS1_FLAG : 0 );
+    do {
+        *ptr = remain_len % MQTT_REMAIN_LEN;
+        remain_len /= MQTT_REMAIN_LEN;
+        if ( remain_len > 0 ) {
+            *ptr |= MQTT_REMAIN_LEN;
+        }
+        ptr++;
+    }
+    while ( remain_len > 0 );
+    *ptr++ = CLI_RSHIFT_BYTE( out_len );
+    *ptr++ = out_len & CLI_BYTE;
+    memcpy( ptr, map->remote_prefix, map->remote_len );
+    ptr += map->remote_len;
+    memcpy( ptr, topic + map->local_len, topic_len - map->local_len );
+    ptr += topic_len - map->local_len;
+    if ( qos_size ) {
+        *ptr++ = 0;
+        *ptr++ = 0;
+    }
+    memcpy( ptr, payload, payload_len );
+    head_off += len;
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Publish written ring packets to the remote thread.
+ *
+ */
+static void eclibridge_publish(void) {
+
+    if ( head_off == store->head ) {
+        return;
+    }
+    __atomic_store_n( &store->head, head_off, __ATOMIC_SEQ_CST );
+    if ( __atomic_load_n( &remote_waiting, __ATOMIC_SEQ_CST ) ) {
+        __atomic_store_n( &remote_waiting, FALSE_FLAG, __ATOMIC_RELAXED );
+        eclibridge_wake( remote_side.wake_fd );
+    }
+}
+
+/**********************************************************************/
+/** Write ring packets to remote broker while window and socket allow.
+ * Returns -1 on error.
+ *
+ * @param now_ns: current time.
+ *
+ */
+static int8_t eclibridge_forward(uint64_t now_ns) {
+
+    ecli_broker_t *broker = remote_side.broker;
+    uint64_t head        = __atomic_load_n( &store->head, __ATOMIC_ACQUIRE );
+    uint64_t pos         = 0;
+    uint64_t run         = 0;
+    uint32_t header_len  = 0;
+    uint32_t count       = 0;
+    uint32_t qos0        = 0;
+    uint32_t dups        = 0;
+    uint8_t  *packet     = NULL;
+    uint8_t  *pid        = NULL;
+    int64_t  len         = 0;
+    eclibridge_flight_t *entry = NULL;
+    struct iovec iov;
+
+    /* Socket took everything sent before: no copy in the send queue */
+    while ( send_off < head && broker->sendq.queued == 0 && flight_num < inflight_max ) {
+        pos = send_off % store->size;
+        if ( ring[pos] == BRIDGE_WRAP ) {
+            send_off += store->size - pos;
+            if ( flight_num == 0 ) {
+                eclibridge_release( send_off );
+            }
+            continue;
+        }
+        /* Contiguous packets up to batch size, ring end or window */
+        run = 0;
+        count = 0;
+        qos0 = 0;
+        dups = 0;
+        while ( send_off + run < head && run < BRIDGE_BATCH_SIZE && pos + run < store->size ) {
+            packet = ring + pos + run;
+            if ( *packet == BRIDGE_WRAP ) {
+                break;
+            }
+            len = eclibridge_packet_len( packet, store->size - pos - run, &header_len );
+            if ( MQTT_QOS_TYPE( packet ) ) {
+                if ( flight_num == inflight_max ) {
+                    break;
+                }
+                if ( ++publish_pid == 0 ) {
+                    publish_pid = 1;
+                }
+                pid = packet + header_len + 2 + ( CLI_LSHIFT_BYTE( packet[header_len] ) | packet[header_len + 1] );
+                pid[0] = CLI_RSHIFT_BYTE( publish_pid );
+                pid[1] = publish_pid & CLI_BYTE;
+                packet[0] &= ~( MQTT_PUBLISH_DUP_FLAG );
+                if ( send_off + run < sent_max ) {
+                    packet[0] |= MQTT_PUBLISH_DUP_FLAG;
+                    dups++;
+                }
+                entry = &flight[( flight_first + flight_num++ ) % BRIDGE_INFLIGHT_MAX];
+                entry->start = send_off + run;
+                entry->sent_ns = now_ns;
+                entry->pid = publish_pid;
+                entry->acked = FALSE_FLAG;
+            }
+            else {
+                qos0++;
+            }
+            run += len;
+            count++;
+        }
+        if ( run == 0 ) {
+            break;
+        }
+        iov.iov_base = ring + pos;
+        iov.iov_len = run;
+        if ( eclibridge_send( &remote_side, &iov, 1 ) < 0 ) {
+            return -1;
+        }
+        /* Send counted as one packet with every byte, rest of packets here */
+        if ( broker->metrics ) {
+            METRICS_ADD( broker->metrics->tx_packets[MQTT_CTRLPKT_PUBLISH >> 4], count - 1 );
+            METRICS_ADD( broker->metrics->retransmits, dups );
+        }
+        for ( ; qos0 > 0; qos0-- ) {
+            eclimetrics_publish( broker->metrics, 0, 0 );
+        }
+        stat_forwarded += count;
+        send_off += run;
+        if ( send_off > sent_max ) {
+            sent_max = send_off;
+        }
+        if ( flight_num == 0 ) {
+            eclibridge_release( send_off );
+        }
+    }
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Free ring up to offset, wake local thread waiting for space.
+ *
+ * @param offset: ring offset.
+ *
+ */
+static void eclibridge_release(uint64_t offset) {
+
+    __atomic_store_n( &store->tail, offset, __ATOMIC_SEQ_CST );
+    if ( __atomic_load_n( &local_waiting, __ATOMIC_SEQ_CST ) ) {
+        __atomic_store_n( &local_waiting, FALSE_FLAG, __ATOMIC_RELAXED );
+        eclibridge_wake( local_side.wake_fd );
+    }
+}
+
+/**********************************************************************/
+/** PUBACK of upstream packet.
+ *
+ * @param pid: packet id.
+ *
+ */
+static void eclibridge_ack(uint16_t pid) {
+
+    ecli_broker_t *broker = remote_side.broker;
+    eclibridge_flight_t *entry = NULL;
+    uint64_t now_ns = eclimetrics_now();
+    uint32_t i      = 0;
+
+    /* Acks come in order, the first one is searched from the oldest */
+    for ( i = 0; i < flight_num; i++ ) {
+        entry = &flight[( flight_first + i ) % BRIDGE_INFLIGHT_MAX];
+        if ( entry->pid == pid && !entry->acked ) {
+            entry->acked = TRUE_FLAG;
+            eclimetrics_publish( broker->metrics, 1, now_ns - entry->sent_ns );
+            break;
+        }
+    }
+    if ( i == flight_num ) {
+        return;
+    }
+    while ( flight_num > 0 && flight[flight_first].acked ) {
+        flight_first = ( flight_first + 1 ) % BRIDGE_INFLIGHT_MAX;
+        flight_num--;
+    }
+    eclibridge_release( flight_num ? flight[flight_first].start : send_off );
+}
+
+/**********************************************************************/
+/** Publish incoming message to local broker with QoS 0.
+ *
+ * @param map: map of topic.
+ * @param topic: remote topic.
+ * @param topic_len: remote topic length.
+ * @param payload: payload.
+ * @param payload_len: payload length.
+ * @param retain: retain flag.
+ *
+ */
+static void eclibridge_inbound(const eclibridge_map_t *map, const uint8_t *topic, uint32_t topic_len,
+                               const uint8_t *payload, uint32_t payload_len, uint8_t retain) {
+
+    ecli_broker_t *broker = local_side.broker;
+    uint8_t  header[BRIDGE_HEADER_MAX + 2 + CLI_TOPIC_LEN];
+    uint8_t  *ptr        = header;
+    uint32_t out_len     = map->local_len + topic_len - map->remote_len;
+    uint32_t remain_len  = 2 + out_len + payload_len;
+    uint64_t dropped     = 0;
+    int32_t  sent        = 0;
+    struct iovec iov[2];
+
+    if ( out_len >= CLI_TOPIC_LEN ) {
+        stat_dropped++;
+        return;
+    }
+    *ptr++ = MQTT_CTRLPKT_PUBLISH | retain;
+    do {
+        *ptr = remain_len % MQTT_REMAIN_LEN;
+        remain_len /= MQTT_REMAIN_LEN;
+        if ( remain_len > 0 ) {
+            *ptr |= MQTT_REMAIN_LEN;
+        }
+        ptr++;
+    }
+    while ( remain_len > 0 );
+    *ptr++ = CLI_RSHIFT_BYTE( out_len );
+    *ptr++ = out_len & CLI_BYTE;
+    memcpy( ptr, map->local_prefix, map->local_len );
+    ptr += map->local_len;
+    memcpy( ptr, topic + map->remote_len, topic_len - map->remote_len );
+    ptr += topic_len - map->remote_len;
+    iov[0].iov_base = header;
+    iov[0].iov_len = ptr - header;
+    iov[1].iov_base = ( void * ) payload;
+    iov[1].iov_len = payload_len;
+
+    /* Local link down or its send queue over high watermark: dropped */
+    pthread_mutex_lock( &local_lock );
+    if ( local_side.connected ) {
+        dropped = broker->metrics ? broker->metrics->tx_dropped : 0;
+        sent = ecli_sendv_packet( broker, iov, 2 );
+        if ( sent < 0 || ( broker->metrics && broker->metrics->tx_dropped != dropped ) ) {
+            stat_dropped++;
+        }
+        else {
+            stat_inbound++;
+        }
+        /* Queued bytes are written by the local thread */
+        if ( broker->sendq.queued ) {
+            eclibridge_wake( local_side.wake_fd );
+        }
+    }
+    else {
+        stat_dropped++;
+    }
+    pthread_mutex_unlock( &local_lock );
+}
+
+/**********************************************************************/
+/** Find map of topic on side: prefix of side and filter match.
+ *
+ * @param dir: map direction (side of topic).
+ * @param topic: topic.
+ * @param topic_len: topic length.
+ *
+ */
+static const eclibridge_map_t *eclibridge_find(uint8_t dir, const uint8_t *topic, uint32_t topic_len) {
+
+    const eclibridge_map_t *map = NULL;
+    const char *prefix  = NULL;
+    uint32_t prefix_len = 0;
+    uint32_t i          = 0;
+
+    for ( i = 0; i < maps_num; i++ ) {
+        map = &maps[i];
+        if ( !( map->dir & dir ) ) {
+            continue;
+        }
+        prefix = ( dir == BRIDGE_OUT ) ? map->local_prefix : map->remote_prefix;
+        prefix_len = ( dir == BRIDGE_OUT ) ? map->local_len : map->remote_len;
+        if ( topic_len >= prefix_len && memcmp( topic, prefix, prefix_len ) == 0 &&
+             ecliutf8_match( map->filter, ( const char * ) topic + prefix_len, topic_len - prefix_len ) ) {
+            return map;
+        }
+    }
+
+    return NULL;
+}
+
+/**********************************************************************/
+/** Get length of packet at data, 0 when incomplete, -1 when malformed.
+ *
+ * @param data: packet start.
+ * @param avail: bytes available.
+ * @param header_len: fixed header bytes output.
+ *
+ */
+static int64_t eclibridge_packet_len(const uint8_t *data, uint32_t avail, uint32_t *header_len) {
+
+    uint32_t remain_len = 0;
+    uint32_t multiplier = 1;
+    uint32_t i          = 1;
+
+    do {
+        if ( i >= avail ) {
+            return 0;
+        }
+        if ( i == BRIDGE_HEADER_MAX ) {
+            return -1;
+        }
+        remain_len += ( data[i] & ( MQTT_REMAIN_LEN - 1 ) ) * multiplier;
+        multiplier *= MQTT_REMAIN_LEN;
+    }
+    while ( data[i++] & MQTT_REMAIN_LEN );
+    if ( remain_len > CLI_MAX_MSG_SIZE + CLI_TOPIC_LEN + 4 ) {
+        return -1;
+    }
+    *header_len = i;
+    if ( avail < i + remain_len ) {
+        return 0;
+    }
+
+    return i + remain_len;
+}
+
+/**********************************************************************/
+/** Wake thread waiting on eventfd.
+ *
+ * @param fd: eventfd.
+ *
+ */
+static void eclibridge_wake(int32_t fd) {
+
+    uint64_t value = 1;
+
+    if ( fd >= 0 && write( fd, &value, sizeof( value ) ) < 0 ) {
+        return;
+    }
+}
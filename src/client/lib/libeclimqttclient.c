@@ -10,10 +10,13 @@
 #include <arpa/inet.h>
 #include <linux/tcp.h>
 #include <errno.h>
+#include <time.h>
+#include <sys/syscall.h>
 
 /**********************************************************************/
 
 #include <libeclimqttclient.h>
+#include <libeclimqttseries.h>
 
 /**********************************************************************/
 /**********************************************************************/
@@ -25,16 +28,6 @@
  */
 static void get_set_cfg_file(ecli_broker_t *broker, ecli_conf_t *conf, const char *cfg_file);
 
-/**********************************************************************/
-/** Get Key Value of line from Config file
- *
- * @param conf: structure that contains the user config options for broker conn.
- * @param key: key return name
- * @param value: return value
- *
- */
-static void get_conf_value( char *line, char *key, char *value );
-
 /**********************************************************************/
 /** Get Topic from mqtt packet
  *
@@ -53,6 +46,66 @@ static uint16_t ecli_get_topic(const uint8_t* packet_buffer, const uint8_t **top
  */
 static uint32_t ecli_get_message(const uint8_t* packet_buffer, const uint8_t **msg_ptr);
 
+/**********************************************************************/
+/** Get stream record format from name, exits when not known
+ *
+ * @param name: format name.
+ *
+ */
+static ecli_stream_mode ecli_stream_from_name(const char *name);
+
+/**********************************************************************/
+/** Get subscriber output sink from name, exits when not known
+ *
+ * @param name: sink name.
+ *
+ */
+static ecli_sink_mode ecli_sink_from_name(const char *name);
+
+/**********************************************************************/
+/** Get send queue drop policy from name, exits when not known
+ *
+ * @param name: policy name.
+ *
+ */
+static ecli_sendq_drop ecli_drop_from_name(const char *name);
+
+/**********************************************************************/
+/** Read first bytes of next packet to conf->packet_buffer, bytes left
+ * from the previous read first, until the fixed header is complete.
+ *
+ * @param broker: structure that contains the client connection info with broker
+ * @param conf: structure that contains the user config options for broker conn.
+ *
+ */
+static int32_t ecli_read_first(ecli_broker_t *broker, ecli_conf_t *conf);
+
+/**********************************************************************/
+/** Keep bytes read past packet end for the next read
+ *
+ * @param broker: structure that contains the client connection info with broker
+ * @param buffer: bytes read.
+ * @param totalbytes: number of bytes read.
+ * @param packet_length: size of packet at buffer start.
+ *
+ */
+static void ecli_read_keep(ecli_broker_t *broker, const uint8_t *buffer,
+                           int32_t totalbytes, uint32_t packet_length);
+
+/**********************************************************************/
+/** Store received message in the last value cache, last sample of an
+ * aggregated block.
+ *
+ * @param conf: structure that contains the user config options for broker conn.
+ * @param topic: message topic.
+ * @param msg: message payload.
+ * @param msg_len: message size.
+ * @param retain: retained publish flag.
+ *
+ */
+static void ecli_lvc_put(ecli_conf_t *conf, const char *topic, const uint8_t *msg,
+                         uint32_t msg_len, uint8_t retain);
+
 /**********************************************************************/
 /**********************************************************************/
 /** Get and Set user configuration opts
@@ -67,7 +120,7 @@ void ecli_get_conf(ecli_broker_t *broker, ecli_conf_t *conf, int argc, char* arg
 
     extern   char *optarg;
     char     *config_file      = CONFIGFILE_DEFAULT;
-    char     *broker_ip        = BROKER_IP_DEFAULT;
+    char     *broker_ip        = NULL;
     char     *username         = USERNAME_DEFAULT;
     char     *password         = PASSWORD_DEFAULT;
     char     *topic            = TOPIC_DEFAULT;
@@ -76,6 +129,23 @@ void ecli_get_conf(ecli_broker_t *broker, ecli_conf_t *conf, int argc, char* arg
     char     *output_file      = OUT_FILE_DEFAULT;
     char     *will_msg         = WILL_MSG_DEFAULT;
     char     *will_topic       = WILL_TOPIC_DEFAULT;
+    char     *log_file         = NULL;
+    char     *metrics_file     = NULL;
+    char     *trace_file       = NULL;
+    int32_t  connect_timeout   = -1;
+    char     *tls_ca           = NULL;
+    uint8_t  tls_flag          = TLS_DEFAULT;
+    uint8_t  io_uring_flag     = IO_URING_DEFAULT;
+    char     *codec_name       = NULL;
+    char     *codec_dict       = NULL;
+    char     *checksum_name    = NULL;
+    char     *publish_rate     = NULL;
+    int32_t  publish_burst     = -1;
+    char     *stream_name      = NULL;
+    char     *sink_name        = NULL;
+    uint8_t  file_chunked      = FILE_CHUNKED_DEFAULT;
+    int32_t  file_jobs         = -1;
+    uint8_t  file_delta        = FILE_DELTA_DEFAULT;
     uint8_t  clean_session     = CLEAN_SESSION_DEFAULT;
     uint8_t  will_qos          = WILL_QOS_DEFAULT;
     uint8_t  will_retain       = WILL_RETAIN_DEFAULT;
@@ -89,11 +159,11 @@ void ecli_get_conf(ecli_broker_t *broker, ecli_conf_t *conf, int argc, char* arg
     uint8_t  pub_online_flag   = PUBONLINE_FLG_DEFAULT;
     uint16_t alive             = ALIVE_CON_DEFAULT;
     int16_t  persist_conn_time = PERSIST_CON_DEFAULT;
-    uint16_t broker_port       = BROKER_PORT_DEFAULT;
+    uint16_t broker_port       = 0;
     uint32_t c;
 
     /* Get Values from Opt Args */
-    while ((c = getopt (argc, argv, "a:c:b:p:u:k:i:t:m:o:q:Q:T:M:P:lfrhRWCO")) != -1) {
+    while ((c = getopt (argc, argv, "a:c:b:p:u:k:i:t:m:o:q:Q:T:M:P:L:x:Z:e:A:z:D:j:K:n:B:s:w:lfrhRWCOSUFd")) != -1) {
         switch (c) {
             case 'c': /* Config File */
                 cfg_file_flag = 1;
@@ -141,6 +211,45 @@ void ecli_get_conf(ecli_broker_t *broker, ecli_conf_t *conf, int argc, char* arg
             case 'P': /* Persist on Connection */
                 persist_conn_time = atoi( optarg );
                 break;
+            case 'L': /* Log file */
+                log_file = optarg;
+                break;
+            case 'x': /* Metrics dump file */
+                metrics_file = optarg;
+                break;
+            case 'Z': /* Chrome trace file */
+                trace_file = optarg;
+                break;
+            case 'e': /* Connect timeout */
+                connect_timeout = atoi( optarg );
+                break;
+            case 'A': /* TLS CA file */
+                tls_ca = optarg;
+                break;
+            case 'z': /* Payload codec */
+                codec_name = optarg;
+                break;
+            case 'D': /* zstd dictionary */
+                codec_dict = optarg;
+                break;
+            case 'K': /* Payload checksum */
+                checksum_name = optarg;
+                break;
+            case 'n': /* Publish rate */
+                publish_rate = optarg;
+                break;
+            case 'B': /* Publish burst */
+                publish_burst = atoi( optarg );
+                break;
+            case 's': /* Stream from stdin */
+                stream_name = optarg;
+                break;
+            case 'w': /* Sub output sink */
+                sink_name = optarg;
+                break;
+            case 'j': /* Chunked file sessions */
+                file_jobs = atoi( optarg );
+                break;
             case 'l': /* Sub Read Loop */
                 client_loop_flg = TRUE_FLAG;
                 break;
@@ -162,6 +271,18 @@ void ecli_get_conf(ecli_broker_t *broker, ecli_conf_t *conf, int argc, char* arg
             case 'O': /* Online Message at first connect */
                 pub_online_flag = TRUE_FLAG;
                 break;
+            case 'S': /* TLS */
+                tls_flag = TRUE_FLAG;
+                break;
+            case 'U': /* io_uring I/O */
+                io_uring_flag = TRUE_FLAG;
+                break;
+            case 'F': /* Chunked file transfer */
+                file_chunked = TRUE_FLAG;
+                break;
+            case 'd': /* Delta file transfer */
+                file_delta = TRUE_FLAG;
+                break;
             case 'h': /* Help */
                 printf(HELP_TXT);
                 exit( CLI_NO_ERROR );
@@ -184,6 +305,56 @@ void ecli_get_conf(ecli_broker_t *broker, ecli_conf_t *conf, int argc, char* arg
     memset( conf->broker_hostname, 0, sizeof( conf->broker_hostname ) );
     memset( conf->msg_txt, 0, sizeof( conf->msg_txt ) );
     memset( conf->datafile_path, 0, sizeof( conf->datafile_path ) );
+    memset( conf->log_file, 0, sizeof( conf->log_file ) );
+    memset( conf->metrics_file, 0, sizeof( conf->metrics_file ) );
+    conf->metrics_interval = METRICS_INTERVAL_DEFAULT;
+    conf->metrics_fmt = METRICS_PROM;
+    memset( conf->trace_file, 0, sizeof( conf->trace_file ) );
+    memset( conf->shm_name, 0, sizeof( conf->shm_name ) );
+    strncpy(conf->broker_hostname, BROKER_IP_DEFAULT, sizeof( conf->broker_hostname ) - 1 );
+    conf->broker_port = BROKER_PORT_DEFAULT;
+    conf->connect_timeout = CONNECT_TIMEOUT_DEFAULT;
+    conf->connect_stagger = NET_STAGGER_DEFAULT;
+    conf->dns_refresh = NET_REFRESH_DEFAULT;
+    conf->backoff_base = BACKOFF_BASE_DEFAULT;
+    conf->backoff_max = BACKOFF_MAX_DEFAULT;
+    broker->connect_packet = NULL;
+    broker->connect_len = 0;
+    broker->session_present = FALSE_FLAG;
+    broker->rx_pending = 0;
+    conf->tls = TLS_DEFAULT;
+    memset( &conf->tls_conf, 0, sizeof( conf->tls_conf ) );
+    conf->tls_conf.verify = TLS_VERIFY_DEFAULT;
+    conf->io_uring = IO_URING_DEFAULT;
+    conf->uring_batch = URING_BATCH_DEFAULT;
+    conf->uring_flush_us = URING_FLUSH_US_DEFAULT;
+    memset( &conf->codec_conf, 0, sizeof( conf->codec_conf ) );
+    conf->codec_conf.codec = CODEC_NONE;
+    conf->codec_conf.level = CODEC_LEVEL_DEFAULT;
+    conf->codec_conf.min_size = CODEC_MIN_DEFAULT;
+    conf->file_chunked = FILE_CHUNKED_DEFAULT;
+    conf->file_jobs = FILE_JOBS_DEFAULT;
+    conf->file_linger = FILE_LINGER_DEFAULT;
+    conf->file_delta = FILE_DELTA_DEFAULT;
+    conf->file_delta_key = FILE_DELTA_KEY_DEFAULT;
+    conf->checksum = HASH_NONE;
+    conf->publish_rate = PACE_RATE_DEFAULT;
+    conf->publish_burst = PACE_BURST_DEFAULT;
+    conf->publish_report = PACE_REPORT_DEFAULT;
+    conf->stream_mode = CLI_STREAM_NONE;
+    conf->output_sink = CLI_SINK_NONE;
+    conf->sink_queue = SINK_QUEUE_DEFAULT;
+    conf->sendq_high = SENDQ_HIGH_DEFAULT;
+    conf->sendq_low = SENDQ_LOW_DEFAULT;
+    conf->sendq_drop = SENDQ_DROP_NONE;
+    conf->sendq_lowat = 0;
+    conf->series = 0;
+    conf->series_ms = SERIES_MS_DEFAULT;
+    conf->lvc_size = 0;
+    conf->utf8_payload = FALSE_FLAG;
+    strncpy( conf->shm_name, SHM_NAME_DEFAULT, sizeof( conf->shm_name ) - 1 );
+    conf->shm_size = SHM_SIZE_DEFAULT;
+    memset( &broker->sendq, 0, sizeof( broker->sendq ) );
 
     /* Get & Set Values from Config file */
     if ( cfg_file_flag ) {
@@ -215,11 +386,20 @@ void ecli_get_conf(ecli_broker_t *broker, ecli_conf_t *conf, int argc, char* arg
     strncpy( broker->client_id, client_id, sizeof( broker->client_id ) );
 
     /* Set Values to configuration */
-    strncpy(conf->broker_hostname, broker_ip, sizeof( conf->broker_hostname ) );
-    conf->broker_port = broker_port;
+    /* Broker list and port from options override config file */
+    if ( broker_ip ) {
+        memset( conf->broker_hostname, 0, sizeof( conf->broker_hostname ) );
+        strncpy(conf->broker_hostname, broker_ip, sizeof( conf->broker_hostname ) - 1 );
+    }
+    if ( broker_port ) {
+        conf->broker_port = broker_port;
+    }
     conf->client_loop_flg = client_loop_flg;
     conf->publish_online_flg = pub_online_flag;
     conf->persist_conn_time = persist_conn_time;
+    if ( connect_timeout >= 0 ) {
+        conf->connect_timeout = connect_timeout;
+    }
     if ( datafile_trans ) {
         conf->msg_type = CLI_DATAFILE_MSG;
         strncpy(conf->msg_txt, text_message, sizeof( conf->msg_txt ) );
@@ -229,71 +409,606 @@ void ecli_get_conf(ecli_broker_t *broker, ecli_conf_t *conf, int argc, char* arg
         conf->msg_type = CLI_TXT_MSG;
         strncpy(conf->msg_txt, text_message, sizeof( conf->msg_txt ) );
     }
+    /* Chunked transfer: file path in msg_txt (pub), datafile_path (sub) */
+    if ( file_chunked ) {
+        conf->file_chunked = TRUE_FLAG;
+    }
+    if ( conf->file_chunked ) {
+        conf->msg_type = CLI_DATAFILE_MSG;
+        strncpy(conf->datafile_path, output_file, sizeof( conf->datafile_path ) );
+    }
+    if ( file_jobs > 0 ) {
+        conf->file_jobs = file_jobs;
+    }
+    if ( conf->file_jobs < 1 || conf->file_jobs > FILE_JOBS_MAX ) {
+        conf->file_jobs = conf->file_jobs < 1 ? 1 : FILE_JOBS_MAX;
+    }
+    if ( file_delta ) {
+        conf->file_delta = TRUE_FLAG;
+    }
+    if ( publish_rate ) {
+        conf->publish_rate = strtod( publish_rate, NULL );
+    }
+    if ( publish_burst > 0 ) {
+        conf->publish_burst = publish_burst;
+    }
+    if ( stream_name ) {
+        conf->stream_mode = ecli_stream_from_name( stream_name );
+    }
+    if ( sink_name ) {
+        conf->output_sink = ecli_sink_from_name( sink_name );
+    }
+    /* Files sink: output directory in datafile_path (sub) */
+    if ( conf->output_sink == CLI_SINK_FILES ) {
+        strncpy(conf->datafile_path, output_file, sizeof( conf->datafile_path ) - 1 );
+    }
+    if ( conf->publish_rate < 0 ) {
+        fprintf( stderr, PACE_RATE_ERROR );
+        exit( CLI_ERROR );
+    }
+
+    /* Start file logger */
+    if ( log_file ) {
+        strncpy(conf->log_file, log_file, sizeof( conf->log_file ) - 1 );
+    }
+    if ( conf->log_file[0] ) {
+        eclilog_open( conf->log_file, LOG_FILE_SIZE_DEFAULT, LOG_FILE_NUM_DEFAULT );
+    }
+
+    /* Last value cache, kept by the receive path */
+    if ( conf->lvc_size && eclilvc_init( conf->lvc_size ) < 0 ) {
+        fprintf( stderr, NO_MEM_ERROR );
+        exit( CLI_ERROR );
+    }
+
+    /* TLS context and persisted sessions */
+    if ( tls_flag ) {
+        conf->tls = TRUE_FLAG;
+    }
+    if ( tls_ca ) {
+        strncpy(conf->tls_conf.ca_file, tls_ca, sizeof( conf->tls_conf.ca_file ) - 1 );
+    }
+    if ( conf->tls && eclitls_init( &conf->tls_conf ) < CLI_NO_ERROR ) {
+        fprintf( stderr, TLS_INIT_ERROR );
+        exit( CLI_ERROR );
+    }
+
+    /* Transport: unix:path socket, or broker endpoints resolved now and
+       refreshed in background for tcp / tls */
+    if ( strncmp( conf->broker_hostname, TRANSPORT_UNIX_PREFIX,
+                  strlen( TRANSPORT_UNIX_PREFIX ) ) == 0 ) {
+        eclitransport_init( &broker->transport, &eclitransport_unix );
+        strncpy( broker->transport.path, conf->broker_hostname + strlen( TRANSPORT_UNIX_PREFIX ),
+                 sizeof( broker->transport.path ) - 1 );
+    }
+    else {
+        eclitransport_init( &broker->transport, conf->tls ? &eclitls_transport : &eclitransport_tcp );
+        broker->transport.stagger_ms = conf->connect_stagger;
+        if ( ( broker->transport.endpoints = eclinet_new( conf->broker_hostname, conf->broker_port,
+                                                          conf->dns_refresh ) ) == NULL ) {
+            fprintf( stderr, NO_MEM_ERROR );
+            exit( CLI_ERROR );
+        }
+    }
+
+    /* io_uring I/O for the same socket, TLS records stay on the socket path */
+    if ( io_uring_flag ) {
+        conf->io_uring = TRUE_FLAG;
+    }
+    if ( conf->io_uring ) {
+        if ( conf->tls ) {
+            eclilog_show(__FILE__, __func__, URING_TLS_MSG, LOG_DEBUG);
+        }
+        else if ( eclituring_init( conf->uring_batch, conf->uring_flush_us ) < CLI_NO_ERROR ) {
+            eclilog_show(__FILE__, __func__, URING_FALLBACK_MSG, LOG_DEBUG);
+        }
+        else {
+            broker->transport.ops = ( broker->transport.ops == &eclitransport_unix ) ?
+                                    &eclituring_unix : &eclituring_tcp;
+        }
+    }
+
+    /* Payload compression */
+    if ( codec_name ) {
+        conf->codec_conf.codec = eclicodec_from_name( codec_name );
+    }
+    if ( codec_dict ) {
+        strncpy(conf->codec_conf.dict_file, codec_dict, sizeof( conf->codec_conf.dict_file ) - 1 );
+    }
+    if ( eclicodec_init( &conf->codec_conf ) < CLI_NO_ERROR ) {
+        fprintf( stderr, CODEC_INIT_ERROR );
+        exit( CLI_ERROR );
+    }
+
+    /* Payload checksum */
+    if ( checksum_name ) {
+        conf->checksum = eclihash_from_name( checksum_name );
+    }
+
+    /* Connection metrics */
+    broker->metrics = eclimetrics_new( broker->client_id );
+    if ( metrics_file ) {
+        strncpy(conf->metrics_file, metrics_file, sizeof( conf->metrics_file ) - 1 );
+    }
+    if ( conf->metrics_file[0] ) {
+        eclimetrics_start_dump( conf->metrics_file, conf->metrics_interval, conf->metrics_fmt );
+    }
+
+    /* Packet lifecycle trace recorder */
+    if ( trace_file ) {
+        strncpy(conf->trace_file, trace_file, sizeof( conf->trace_file ) - 1 );
+    }
+    if ( conf->trace_file[0] ) {
+        eclitrace_start( conf->trace_file );
+    }
 
 }
 
 /**********************************************************************/
-/** Set connection data & options
+/** Set one config option from its key and value, returns -1 when key
+ * is not known.
  *
  * @param broker: structure that contains the client connection info with broker
  * @param conf: structure that contains the user config options for broker conn.
+ * @param key: option name.
+ * @param value: option value.
  *
  */
-uint8_t ecli_init(ecli_broker_t *broker, ecli_conf_t *conf) {
+int8_t ecli_set_conf(ecli_broker_t *broker, ecli_conf_t *conf, const char *key, const char *value) {
     eclilog_show(__FILE__, __func__, "", LOG_TRACE);
 
-    char    buffer_str[CLI_BUF_SIZE] = {0};
-    int32_t opt_flag    = 1;
-    uint8_t return_code = CLI_NO_ERROR;
-    uint32_t conn_secs   = 0;
-    struct sockaddr_in socket_addr;
+    if ( strcmp( key, BROKER_IP_ID ) == EQUAL_STR_CMP ){
+        strncpy( conf->broker_hostname, value, sizeof( conf->broker_hostname ) - 1 );
+    }
+    else if ( strcmp( key, BROKER_PORT_ID ) == EQUAL_STR_CMP ) {
+        conf->broker_port = atoi( value );
+    }
+    else if ( strcmp( key, BROKER_USER_ID ) == EQUAL_STR_CMP ) {
+        strncpy( broker->username, value, sizeof( broker->username ) );
+    }
+    else if ( strcmp( key, BROKER_PASSWD_ID ) == EQUAL_STR_CMP ) {
+        strncpy( broker->password, value, sizeof( broker->username ) );
+    }
+    else if ( strcmp( key, CLIENT_ID ) == EQUAL_STR_CMP ) {
+        strncpy( broker->client_id, value, sizeof( broker->client_id ) );
+    }
+    else if ( strcmp( key, TOPIC_ID ) == EQUAL_STR_CMP ) {
+        strncpy( broker->topic, value, sizeof( broker->topic ) );
+    }
+    else if ( strcmp( key, QOS_ID ) == EQUAL_STR_CMP ) {
+        broker->qos = atoi( value );
+    }
+    else if ( strcmp( key, RETAIN_ID ) == EQUAL_STR_CMP ) {
+        broker->retain = atoi( value );
+    }
+    else if ( strcmp( key, KEEP_ALIVE_ID ) == EQUAL_STR_CMP ) {
+        broker->alive = atoi( value );
+    }
+    else if ( strcmp( key, WILL_FLAG_ID ) == EQUAL_STR_CMP ) {
+        broker->will_flag = atoi( value );
+    }
+    else if ( strcmp( key, WILL_RETAIN_ID ) == EQUAL_STR_CMP ) {
+        broker->will_retain = atoi( value );
+    }
+    else if ( strcmp( key, WILL_QOS_ID ) == EQUAL_STR_CMP ) {
+        broker->will_qos = atoi( value );
+    }
+    else if ( strcmp( key, CLEAN_SESSION_ID ) == EQUAL_STR_CMP ) {
+        broker->clean_session = atoi( value );
+    }
+    else if ( strcmp( key, WILL_TOPIC_ID ) == EQUAL_STR_CMP ) {
+        strncpy(broker->will_topic, value, sizeof( broker->will_topic ) );
+    }
+    else if ( strcmp( key, WILL_MSG_ID ) == EQUAL_STR_CMP ) {
+        strncpy(broker->will_msg, value, sizeof( broker->will_msg ) );
+    }
+    else if ( strcmp( key, SEQUENCE_ID ) == EQUAL_STR_CMP ) {
+        broker->sequence = atoi( value );
+    }
+    else if ( strcmp( key, OUTPUT_FILE_ID ) == EQUAL_STR_CMP ) {
+        strncpy(conf->datafile_path, value, sizeof( conf->datafile_path ) );
+    }
+    else if ( strcmp( key, INPUT_FILE_ID ) == EQUAL_STR_CMP ) {
+        strncpy(conf->msg_txt, value, sizeof( conf->msg_txt ) );
+    }
+    else if ( strcmp( key, CLIENT_LOOP_ID ) == EQUAL_STR_CMP ) {
+        conf->client_loop_flg = atoi( value );
+    }
+    else if ( strcmp( key, PERSIST_CON_ID ) == EQUAL_STR_CMP ) {
+        conf->persist_conn_time = atoi( value );
+    }
+    else if ( strcmp( key, ONLINE_MSG_ID ) == EQUAL_STR_CMP ) {
+        conf->publish_online_flg = atoi( value );
+    }
+    else if ( strcmp( key, LOG_FILE_ID ) == EQUAL_STR_CMP ) {
+        strncpy(conf->log_file, value, sizeof( conf->log_file ) - 1 );
+    }
+    else if ( strcmp( key, METRICS_FILE_ID ) == EQUAL_STR_CMP ) {
+        strncpy(conf->metrics_file, value, sizeof( conf->metrics_file ) - 1 );
+    }
+    else if ( strcmp( key, METRICS_INTERVAL_ID ) == EQUAL_STR_CMP ) {
+        conf->metrics_interval = atoi( value );
+    }
+    else if ( strcmp( key, METRICS_FORMAT_ID ) == EQUAL_STR_CMP ) {
+        if ( strcmp( value, METRICS_FMT_JSON ) == EQUAL_STR_CMP ) {
+            conf->metrics_fmt = METRICS_JSON;
+        }
+        else {
+            conf->metrics_fmt = METRICS_PROM;
+        }
+    }
+    else if ( strcmp( key, TRACE_FILE_ID ) == EQUAL_STR_CMP ) {
+        strncpy(conf->trace_file, value, sizeof( conf->trace_file ) - 1 );
+    }
+    else if ( strcmp( key, CONNECT_TIMEOUT_ID ) == EQUAL_STR_CMP ) {
+        conf->connect_timeout = atoi( value );
+    }
+    else if ( strcmp( key, BACKOFF_BASE_ID ) == EQUAL_STR_CMP ) {
+        conf->backoff_base = atoi( value );
+    }
+    else if ( strcmp( key, BACKOFF_MAX_ID ) == EQUAL_STR_CMP ) {
+        conf->backoff_max = atoi( value );
+    }
+    else if ( strcmp( key, CONNECT_STAGGER_ID ) == EQUAL_STR_CMP ) {
+        conf->connect_stagger = atoi( value );
+    }
+    else if ( strcmp( key, DNS_REFRESH_ID ) == EQUAL_STR_CMP ) {
+        conf->dns_refresh = atoi( value );
+    }
+    else if ( strcmp( key, IO_URING_ID ) == EQUAL_STR_CMP ) {
+        conf->io_uring = atoi( value );
+    }
+    else if ( strcmp( key, URING_BATCH_ID ) == EQUAL_STR_CMP ) {
+        conf->uring_batch = atoi( value );
+    }
+    else if ( strcmp( key, URING_FLUSH_US_ID ) == EQUAL_STR_CMP ) {
+        conf->uring_flush_us = atoi( value );
+    }
+    else if ( strcmp( key, COMPRESS_ID ) == EQUAL_STR_CMP ) {
+        conf->codec_conf.codec = eclicodec_from_name( value );
+    }
+    else if ( strcmp( key, COMPRESS_LEVEL_ID ) == EQUAL_STR_CMP ) {
+        conf->codec_conf.level = atoi( value );
+    }
+    else if ( strcmp( key, COMPRESS_MIN_ID ) == EQUAL_STR_CMP ) {
+        conf->codec_conf.min_size = atoi( value );
+    }
+    else if ( strcmp( key, COMPRESS_DICT_ID ) == EQUAL_STR_CMP ) {
+        strncpy(conf->codec_conf.dict_file, value, sizeof( conf->codec_conf.dict_file ) - 1 );
+    }
+    else if ( strcmp( key, COMPRESS_TOPIC_ID ) == EQUAL_STR_CMP ) {
+        if ( eclicodec_rule( value ) < CLI_NO_ERROR ) {
+            fprintf( stderr, CODEC_RULE_ERROR );
+            exit( CLI_ERROR );
+        }
+    }
+    else if ( strcmp( key, FILE_CHUNKED_ID ) == EQUAL_STR_CMP ) {
+        conf->file_chunked = atoi( value );
+    }
+    else if ( strcmp( key, FILE_JOBS_ID ) == EQUAL_STR_CMP ) {
+        conf->file_jobs = atoi( value );
+    }
+    else if ( strcmp( key, FILE_LINGER_ID ) == EQUAL_STR_CMP ) {
+        conf->file_linger = atoi( value );
+    }
+    else if ( strcmp( key, FILE_DELTA_ID ) == EQUAL_STR_CMP ) {
+        conf->file_delta = atoi( value );
+    }
+    else if ( strcmp( key, FILE_DELTA_KEY_ID ) == EQUAL_STR_CMP ) {
+        conf->file_delta_key = atoi( value );
+    }
+    else if ( strcmp( key, CHECKSUM_ID ) == EQUAL_STR_CMP ) {
+        conf->checksum = eclihash_from_name( value );
+    }
+    else if ( strcmp( key, STREAM_ID ) == EQUAL_STR_CMP ) {
+        conf->stream_mode = ecli_stream_from_name( value );
+    }
+    else if ( strcmp( key, OUTPUT_SINK_ID ) == EQUAL_STR_CMP ) {
+        conf->output_sink = ecli_sink_from_name( value );
+    }
+    else if ( strcmp( key, SINK_QUEUE_ID ) == EQUAL_STR_CMP ) {
+        conf->sink_queue = atoi( value );
+    }
+    else if ( strcmp( key, SENDQ_HIGH_ID ) == EQUAL_STR_CMP ) {
+        conf->sendq_high = atoi( value );
+    }
+    else if ( strcmp( key, SENDQ_LOW_ID ) == EQUAL_STR_CMP ) {
+        conf->sendq_low = atoi( value );
+    }
+    else if ( strcmp( key, SENDQ_DROP_ID ) == EQUAL_STR_CMP ) {
+        conf->sendq_drop = ecli_drop_from_name( value );
+    }
+    else if ( strcmp( key, SENDQ_LOWAT_ID ) == EQUAL_STR_CMP ) {
+        conf->sendq_lowat = atoi( value );
+    }
+    else if ( strcmp( key, SERIES_ID ) == EQUAL_STR_CMP ) {
+        conf->series = atoi( value );
+    }
+    else if ( strcmp( key, SERIES_MS_ID ) == EQUAL_STR_CMP ) {
+        conf->series_ms = atoi( value );
+    }
+    else if ( strcmp( key, LVC_SIZE_ID ) == EQUAL_STR_CMP ) {
+        conf->lvc_size = strtoull( value, NULL, 10 );
+    }
+    else if ( strcmp( key, UTF8_PAYLOAD_ID ) == EQUAL_STR_CMP ) {
+        conf->utf8_payload = atoi( value );
+    }
+    else if ( strcmp( key, SHM_NAME_ID ) == EQUAL_STR_CMP ) {
+        strncpy( conf->shm_name, value, sizeof( conf->shm_name ) - 1 );
+    }
+    else if ( strcmp( key, SHM_SIZE_ID ) == EQUAL_STR_CMP ) {
+        conf->shm_size = strtoull( value, NULL, 10 );
+    }
+    else if ( strcmp( key, LANE_TOPIC_ID ) == EQUAL_STR_CMP ) {
+        if ( eclisendq_rule( value ) < CLI_NO_ERROR ) {
+            fprintf( stderr, LANE_TOPIC_ERROR "\n" );
+            exit( CLI_ERROR );
+        }
+    }
+    else if ( strcmp( key, LANE_RATE_ID ) == EQUAL_STR_CMP ) {
+        if ( eclisendq_rate( value ) < CLI_NO_ERROR ) {
+            fprintf( stderr, LANE_RATE_ERROR "\n" );
+            exit( CLI_ERROR );
+        }
+    }
+    else if ( strcmp( key, PUBLISH_RATE_ID ) == EQUAL_STR_CMP ) {
+        conf->publish_rate = strtod( value, NULL );
+    }
+    else if ( strcmp( key, PUBLISH_BURST_ID ) == EQUAL_STR_CMP ) {
+        conf->publish_burst = atoi( value );
+    }
+    else if ( strcmp( key, PUBLISH_REPORT_ID ) == EQUAL_STR_CMP ) {
+        conf->publish_report = atoi( value );
+    }
+    else if ( strcmp( key, TLS_ID ) == EQUAL_STR_CMP ) {
+        conf->tls = atoi( value );
+    }
+    else if ( strcmp( key, TLS_CA_ID ) == EQUAL_STR_CMP ) {
+        strncpy(conf->tls_conf.ca_file, value, sizeof( conf->tls_conf.ca_file ) - 1 );
+    }
+    else if ( strcmp( key, TLS_CERT_ID ) == EQUAL_STR_CMP ) {
+        strncpy(conf->tls_conf.cert_file, value, sizeof( conf->tls_conf.cert_file ) - 1 );
+    }
+    else if ( strcmp( key, TLS_KEY_ID ) == EQUAL_STR_CMP ) {
+        strncpy(conf->tls_conf.key_file, value, sizeof( conf->tls_conf.key_file ) - 1 );
+    }
+    else if ( strcmp( key, TLS_VERIFY_ID ) == EQUAL_STR_CMP ) {
+        conf->tls_conf.verify = atoi( value );
+    }
+    else if ( strcmp( key, TLS_SESSION_ID ) == EQUAL_STR_CMP ) {
+        strncpy(conf->tls_conf.session_file, value, sizeof( conf->tls_conf.session_file ) - 1 );
+    }
+    else if ( strcmp( key, FILE_TRANS_ID ) == EQUAL_STR_CMP ) {
+        if ( atoi( value ) ) {
+            conf->msg_type = CLI_DATAFILE_MSG;
+        }
+        else {
+            conf->msg_type = CLI_TXT_MSG;
+        }
+    }
+    else {
+        return -1;
+    }
 
-    socket_addr.sin_addr.s_addr = inet_addr(conf->broker_hostname);
-    socket_addr.sin_port = htons(conf->broker_port);
-    socket_addr.sin_family = AF_INET;
+    return 0;
+}
+
+/**********************************************************************/
+/** Get Key Value of line from Config file, empty key for blank and
+ * comment lines
+ *
+ * @param line: config line, changed.
+ * @param key: key return name
+ * @param value: return value
+ *
+ */
+void ecli_conf_value(char *line, char *key, char *value) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
 
-    if ( ( broker->socketid = socket( PF_INET, SOCK_STREAM, 0 ) ) < CLI_NO_ERROR ) {
-        return CLI_SOCK_ERROR;
+    char delim[] = "=";
+    key[0] = '\0';
+    value[0] = '\0';
+    /*Blank and comment lines have no key*/
+    if ( strchr( line, '=' ) == NULL || line[0] == '#' ) {
+        return;
     }
-    if ( setsockopt( broker->socketid, IPPROTO_TCP, TCP_NODELAY,
-        ( const void * ) &opt_flag, sizeof( opt_flag ) ) < CLI_NO_ERROR ) {
-        return CLI_SET_SOCK_OPTS_ERROR;
+    /*Get Key*/
+    char *ptr = strtok(line, delim);
+    strcpy( key, ptr);
+    /*Get Value*/
+    if ( ( ptr = strtok(NULL, delim) ) == NULL ) {
+        return;
     }
-    do {
-        if ( ( connect ( broker->socketid,
-             (struct sockaddr *) &socket_addr,
-              sizeof(socket_addr) ) ) < CLI_NO_ERROR ) {
-                  return_code = CLI_CON_ERROR;
+    /*Quit new line*/
+    char *newline = strchr( ptr, '\n' );
+    if ( newline )
+        *newline = 0;
+    strcpy( value, ptr);
+
+}
+
+/**********************************************************************/
+/** Set connection data & options
+ *
+ * @param broker: structure that contains the client connection info with broker
+ * @param conf: structure that contains the user config options for broker conn.
+ *
+ */
+uint8_t ecli_init(ecli_broker_t *broker, ecli_conf_t *conf) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    char     buffer_str[CLI_BUF_SIZE] = {0};
+    uint8_t  return_code = CLI_NO_ERROR;
+    uint32_t attempt     = 0;
+    uint32_t delay_ms    = 0;
+    uint64_t now_ns      = 0;
+    uint64_t deadline_ns = 0;
+    char     peer[CLI_HOSTNAME_LEN] = {0};
+    struct timespec    delay;
+    ecli_transport_t   *transport = &broker->transport;
+
+    /* Keep trying until persist time (secs) elapsed, -1 forever, 0 once */
+    if ( conf->persist_conn_time > 0 ) {
+        deadline_ns = eclimetrics_now() + conf->persist_conn_time * 1000000000ULL;
+    }
+    for ( ;; ) {
+        return_code = CLI_NO_ERROR;
+        switch ( transport->ops->connect( transport, conf->connect_timeout ) ) {
+            case TRANSPORT_CONN_ERROR:
+                return_code = CLI_CON_ERROR;
+                break;
+            case TRANSPORT_SESSION_ERROR:
+                /* Broker reachable but handshake failed, rank it down */
+                eclinet_connack( transport->endpoints, FALSE_FLAG );
+                return_code = CLI_TLS_ERROR;
+                break;
         }
-        else {
-            return_code = CLI_NO_ERROR;
-            sprintf(buffer_str, CONNECTED_MSG, conf->broker_hostname, conf->broker_port);
+        if ( return_code == CLI_NO_ERROR ) {
+            eclitransport_peer( transport, peer, sizeof( peer ) );
+            sprintf(buffer_str, CONNECTED_MSG, peer, transport->ops->name);
             eclilog_show(__FILE__, __func__, buffer_str, LOG_DEBUG);
+            eclimetrics_connect( broker->metrics );
+            broker->rx_pending = 0;
+            /* Broker drops a client silent for 1.5 keep alive, so does the queue */
+            eclisendq_init( &broker->sendq, conf->sendq_high, conf->sendq_low, conf->sendq_drop,
+                            broker->alive * 1500, broker->metrics );
+            /* Unsent bytes left to the kernel are small: the queue lanes
+               decide what goes next */
+            if ( conf->sendq_lowat && transport->ops == &eclitransport_tcp ) {
+                setsockopt( transport->ops->fd( transport ), IPPROTO_TCP, TCP_NOTSENT_LOWAT,
+                            &conf->sendq_lowat, sizeof( conf->sendq_lowat ) );
+            }
+            break;
+        }
+        if ( conf->persist_conn_time == 0 ) {
             break;
         }
-        sleep(1);
-        conn_secs++;
-        sprintf(buffer_str, CONN_TRY_MSG, conf->broker_hostname, conf->broker_port);
+        /* Spread reconnections of many clients over the backoff window */
+        delay_ms = ecli_backoff_msecs( conf, attempt++ );
+        if ( deadline_ns ) {
+            now_ns = eclimetrics_now();
+            if ( now_ns >= deadline_ns ) {
+                break;
+            }
+            if ( now_ns + delay_ms * 1000000ULL > deadline_ns ) {
+                delay_ms = ( deadline_ns - now_ns ) / 1000000ULL;
+            }
+        }
+        sprintf(buffer_str, CONN_BACKOFF_MSG, delay_ms);
+        eclilog_show(__FILE__, __func__, buffer_str, LOG_DEBUG);
+        delay.tv_sec = delay_ms / 1000;
+        delay.tv_nsec = ( delay_ms % 1000 ) * 1000000L;
+        while ( nanosleep( &delay, &delay ) < CLI_NO_ERROR && errno == EINTR );
+        sprintf(buffer_str, CONN_TRY_MSG, conf->broker_hostname);
         eclilog_show(__FILE__, __func__, buffer_str, LOG_INFO);
     }
-    while(conn_secs != conf->persist_conn_time && conf->persist_conn_time );
-    broker->send_data = ecli_send;
 
     return return_code;
 }
 
 /**********************************************************************/
-/** Send packet function
+/** Get next reconnection delay, exponential backoff with full jitter
+ *
+ * @param conf: structure that contains the user config options for broker conn.
+ * @param attempt: failed attempts so far
+ *
+ */
+uint32_t ecli_backoff_msecs(const ecli_conf_t *conf, uint32_t attempt) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    /* One seed per thread: sessions on worker threads draw apart */
+    static __thread uint32_t seed = 0;
+    uint64_t window = conf->backoff_base;
+
+    if ( seed == 0 ) {
+        seed = ( uint32_t ) eclimetrics_now() ^ ( uint32_t ) getpid() ^
+               ( ( uint32_t ) syscall( SYS_gettid ) << 16 );
+    }
+    /* min( max, base * 2^attempt ), shift capped to avoid overflow */
+    window <<= ( attempt < 31 ) ? attempt : 31;
+    if ( window > conf->backoff_max ) {
+        window = conf->backoff_max;
+    }
+
+    /* Uniform in [0, window] */
+    return rand_r( &seed ) % ( window + 1 );
+}
+
+/**********************************************************************/
+/** Send packet to broker after queued ones, recording packet metrics.
+ * Returns count when written or queued, -1 on error.
  *
- * @param socketid: socket id / file descriptor
+ * @param broker: structure that contains the client connection info with broker
  * @param buffer: packet buffer.
  * @param count: size of packet.
  *
  */
-uint32_t ecli_send(uint32_t socketid, const void* buffer, int32_t count) {
-    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+int32_t ecli_send_packet(ecli_broker_t *broker, const void* buffer, int32_t count) {
 
-    return send(socketid, buffer, count, 0);
+    struct iovec iov = { .iov_base = ( void * ) buffer, .iov_len = count };
+
+    return ecli_sendv_packet( broker, &iov, 1 );
+}
+
+/**********************************************************************/
+/** Send packet in parts (gather, no copy), recording packet metrics.
+ *
+ * @param broker: structure that contains the client connection info with broker
+ * @param iov: packet parts, first one starts with fixed header.
+ * @param iovcnt: number of parts.
+ *
+ */
+int32_t ecli_sendv_packet(ecli_broker_t *broker, const struct iovec *iov, int32_t iovcnt) {
+
+    int32_t  count = 0;
+    int32_t  i;
+
+    for ( i = 0; i < iovcnt; i++ ) {
+        count += iov[i].iov_len;
+    }
+    TRACE_BEGIN( send, broker->msg_id, count );
+    uint64_t start = eclimetrics_now();
+    int32_t  sent  = eclisendq_sendv( &broker->sendq, &broker->transport, iov, iovcnt );
+    TRACE_END( send, broker->msg_id, sent );
+
+    if ( sent == count ) {
+        eclimetrics_tx( broker->metrics, iov[0].iov_base, sent, eclimetrics_now() - start );
+    }
+
+    return sent;
+}
+
+/**********************************************************************/
+/** Send packet with payload read from file, recording packet metrics.
+ *
+ * @param broker: structure that contains the client connection info with broker
+ * @param header: packet header (fixed & var header).
+ * @param header_len: size of header.
+ * @param fd: file descriptor, read from current offset.
+ * @param count: file bytes to send.
+ *
+ */
+int32_t ecli_send_file_packet(ecli_broker_t *broker, const void* header, int32_t header_len,
+                              int32_t fd, uint32_t count) {
+
+    int32_t  sent  = -1;
+
+    TRACE_BEGIN( send, broker->msg_id, header_len + count );
+    uint64_t start = eclimetrics_now();
+    /* File goes straight to the socket, after queued packets */
+    if ( eclisendq_flush( &broker->sendq, &broker->transport, TRUE_FLAG ) == 0 ) {
+        broker->sendq.busy = TRUE_FLAG;
+        sent = broker->transport.ops->send_file( &broker->transport, header, header_len, fd, count );
+        broker->sendq.busy = FALSE_FLAG;
+        eclisendq_flush( &broker->sendq, &broker->transport, FALSE_FLAG );
+    }
+    TRACE_END( send, broker->msg_id, sent );
+
+    if ( sent == header_len + count ) {
+        eclimetrics_tx( broker->metrics, header, sent, eclimetrics_now() - start );
+    }
+
+    return sent;
 }
 
 /**********************************************************************/
@@ -306,16 +1021,30 @@ uint32_t ecli_send(uint32_t socketid, const void* buffer, int32_t count) {
 uint32_t ecli_read_header(ecli_broker_t *broker, ecli_conf_t *conf) {
     eclilog_show(__FILE__, __func__, "", LOG_TRACE);
 
-    int32_t totalbytes = 0;
-    int32_t rcv_bytes  = 0;
+    int32_t  totalbytes    = 0;
+    int32_t  rcv_bytes     = 0;
+    uint32_t packet_length = 0;
 
     memset(conf->packet_buffer, 0, sizeof( conf->packet_buffer ) );
 
-    rcv_bytes = recv( broker->socketid, conf->packet_buffer, CLI_BUF_SIZE, 0 );
+    TRACE_BEGIN( recv, 0, 0 );
+    uint64_t start = eclimetrics_now();
+    rcv_bytes = ecli_read_first( broker, conf );
+    eclimetrics_recv_time( broker->metrics, eclimetrics_now() - start );
+    TRACE_END( recv, 0, rcv_bytes );
     if( rcv_bytes <= 0 ) {
         return CLI_ERROR;
     }
     totalbytes += rcv_bytes;
+    /* Next packet may come in the same read (ack after a publish) */
+    packet_length = 1 + ecli_get_remain_len_b( conf->packet_buffer ) +
+                    ecli_get_remain_len( conf->packet_buffer );
+    ecli_read_keep( broker, conf->packet_buffer, totalbytes, packet_length );
+    if ( totalbytes > packet_length ) {
+        totalbytes = packet_length;
+        memset( conf->packet_buffer + packet_length, 0, sizeof( conf->packet_buffer ) - packet_length );
+    }
+    eclimetrics_rx( broker->metrics, conf->packet_buffer, totalbytes );
 
     return totalbytes;
 }
@@ -325,6 +1054,7 @@ uint32_t ecli_read_header(ecli_broker_t *broker, ecli_conf_t *conf) {
  *
  * @param broker: structure that contains the client connection info with broker
  * @param conf: structure that contains the user config options for broker conn.
+ * @param msg_buffer: payload output, CLI_MAX_MSG_SIZE bytes for CLI_DATAFILE_MSG, MAX_TXT_MSG_SIZE else
  *
  */
 uint32_t ecli_read_get_msg(ecli_broker_t *broker, ecli_conf_t *conf,
@@ -344,11 +1074,17 @@ uint32_t ecli_read_get_msg(ecli_broker_t *broker, ecli_conf_t *conf,
     uint32_t rem_len        = 0;
     int32_t  totalbytes     = 0;
     int32_t  rcv_bytes      = 0;
+    int32_t  decoded        = 0;
+    int32_t  checked        = 0;
+    uint64_t start          = 0;
+    char     buffer_str[CLI_BUF_SIZE] = {0};
 
     struct timeval tv;
     tv.tv_sec = timeout;
     tv.tv_usec = 0;
-    setsockopt( broker->socketid, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof(tv));
+    setsockopt( broker->transport.ops->fd( &broker->transport ), SOL_SOCKET, SO_RCVTIMEO,
+                (const char*)&tv, sizeof(tv));
+    broker->transport.recv_timeout_ms = timeout * 1000;
 
     memset(conf->packet_buffer, 0, sizeof( conf->packet_buffer ) );
     /* buffer size according to Type of Message [ text msg | datafile msg ]*/
@@ -360,8 +1096,12 @@ uint32_t ecli_read_get_msg(ecli_broker_t *broker, ecli_conf_t *conf,
     }
 
     /*Getting first chunk to get remaining len*/
-    rcv_bytes = recv( broker->socketid, conf->packet_buffer, CLI_BUF_SIZE, 0 );
+    TRACE_BEGIN( recv, 0, 0 );
+    start = eclimetrics_now();
+    rcv_bytes = ecli_read_first( broker, conf );
+    eclimetrics_recv_time( broker->metrics, eclimetrics_now() - start );
     if( rcv_bytes <= 0 ) {
+        TRACE_END( recv, 0, 0 );
         if ( rcv_bytes < 0 ) {
             return CLI_READ_TIMEOUT_ERROR;
         }
@@ -392,6 +1132,11 @@ uint32_t ecli_read_get_msg(ecli_broker_t *broker, ecli_conf_t *conf,
     uint32_t packet_length = rem_len + rem_len_bytes + 1;
     uint8_t packet_buffer[packet_length];
     memset( packet_buffer, 0, packet_length );
+    /* Small packets may come in the same read, keep them for next call */
+    ecli_read_keep( broker, conf->packet_buffer, totalbytes, packet_length );
+    if ( totalbytes > packet_length ) {
+        totalbytes = packet_length;
+    }
     /* Guard buffer integrity copying memory*/
     if( packet_length >= sizeof( conf->packet_buffer ) ) {
         memcpy( packet_buffer, conf->packet_buffer, sizeof( conf->packet_buffer ) );
@@ -401,25 +1146,80 @@ uint32_t ecli_read_get_msg(ecli_broker_t *broker, ecli_conf_t *conf,
     }
     while(totalbytes < packet_length) // Reading the packet
     {
-        rcv_bytes = recv( broker->socketid, ( packet_buffer + totalbytes ),
-                          CLI_BUF_SIZE, 0 );
+        start = eclimetrics_now();
+        rcv_bytes = broker->transport.ops->recv( &broker->transport, ( packet_buffer + totalbytes ),
+                                                 packet_length - totalbytes, 0 );
+        eclimetrics_recv_time( broker->metrics, eclimetrics_now() - start );
         if( rcv_bytes <= 0 ) {
+            TRACE_END( recv, 0, totalbytes );
             return CLI_ERROR;
         }
         totalbytes += rcv_bytes;
     }
+    eclimetrics_rx( broker->metrics, packet_buffer, packet_length );
+    TRACE_END( recv, 0, packet_length );
 
+    TRACE_BEGIN( decode, 0, packet_length );
     /*Get Topic buffer*/
     topic_len = ecli_get_topic(packet_buffer, &topic_ptr);
     if(topic_len != 0 && topic_ptr != NULL) {
         memcpy(topic, topic_ptr, topic_len);
     }
     topic[topic_len] = '\0';
+    /* Topic names must be UTF-8 without wildcards, otherwise dropped */
+    if( topic_ptr != NULL && ecliutf8_topic( ( const char * ) topic_ptr, topic_len ) < 0 ) {
+        eclilog_show(__FILE__, __func__, TOPIC_RECV_ERROR, LOG_ERROR);
+        *msg_len = 0;
+        TRACE_END( decode, ecli_get_msg_id( packet_buffer ), 0 );
+        return CLI_NO_ERROR;
+    }
     /*Get Message buffer*/
     *msg_len = ecli_get_message(packet_buffer, &msg_ptr);
-    if( msg_len != 0 && msg_ptr != NULL) {
+    /* Checksum trailer: dropped on mismatch, removed when it matches */
+    if( conf->checksum != HASH_NONE && ( packet_buffer[0] & 0xF0 ) == CLI_CTRLPKT_PUBLISH &&
+        msg_ptr != NULL ) {
+        if ( ( checked = eclihash_check( msg_ptr, *msg_len ) ) < 0 ) {
+            sprintf(buffer_str, CHECKSUM_ERROR, topic);
+            eclilog_show(__FILE__, __func__, buffer_str, LOG_ERROR);
+            *msg_len = 0;
+            TRACE_END( decode, ecli_get_msg_id( packet_buffer ), 0 );
+            return CLI_NO_ERROR;
+        }
+        *msg_len = checked;
+    }
+    /* Compressed payloads are decoded straight to msg_buffer */
+    decoded = 0;
+    if( conf->codec_conf.codec != CODEC_NONE && *msg_len != 0 && msg_ptr != NULL ) {
+        decoded = eclicodec_decompress( msg_ptr, *msg_len, msg_buffer,
+                                        conf->msg_type == CLI_DATAFILE_MSG ? CLI_MAX_MSG_SIZE :
+                                                                             MAX_TXT_MSG_SIZE - 1 );
+        if ( decoded < 0 ) {
+            sprintf(buffer_str, CODEC_ERROR, strerror( errno ) );
+            eclilog_show(__FILE__, __func__, buffer_str, LOG_ERROR);
+        }
+        else if ( decoded == 0 && eclicodec_train( msg_ptr, *msg_len ) < 0 ) {
+            conf->codec_conf.codec = CODEC_NONE;
+        }
+    }
+    if ( decoded > 0 ) {
+        *msg_len = decoded;
+    }
+    else if( msg_len != 0 && msg_ptr != NULL) {
         memcpy( msg_buffer, msg_ptr, *msg_len);
     }
+    /* Text payloads checked as delivered (after checksum and codec) */
+    if( conf->utf8_payload && conf->msg_type == CLI_TXT_MSG && msg_ptr != NULL &&
+        ecliutf8_text( msg_buffer, *msg_len ) < 0 ) {
+        sprintf(buffer_str, UTF8_RECV_ERROR, topic);
+        eclilog_show(__FILE__, __func__, buffer_str, LOG_ERROR);
+        *msg_len = 0;
+        TRACE_END( decode, ecli_get_msg_id( packet_buffer ), 0 );
+        return CLI_NO_ERROR;
+    }
+    if ( conf->lvc_size && ( packet_buffer[0] & 0xF0 ) == CLI_CTRLPKT_PUBLISH ) {
+        ecli_lvc_put( conf, topic, msg_buffer, *msg_len, CLI_MSG_RETAIN( packet_buffer ) );
+    }
+    TRACE_END( decode, ecli_get_msg_id( packet_buffer ), *msg_len );
 
     return CLI_NO_ERROR;
 }
@@ -433,7 +1233,27 @@ uint32_t ecli_read_get_msg(ecli_broker_t *broker, ecli_conf_t *conf,
 uint8_t ecli_close(ecli_broker_t *broker){
     eclilog_show(__FILE__, __func__, "", LOG_TRACE);
 
-    return close(broker->socketid);
+    broker->transport.ops->close( &broker->transport );
+    eclisendq_clear( &broker->sendq );
+
+    return CLI_NO_ERROR;
+}
+
+/**********************************************************************/
+/** Release what a connection keeps between reconnections: broker list
+ * (and its resolver thread) and cached CONNECT.
+ *
+ * @param broker: structure that contains the client connection info with broker
+ *
+ */
+void ecli_release(ecli_broker_t *broker){
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    eclinet_free( broker->transport.endpoints );
+    broker->transport.endpoints = NULL;
+    free( broker->connect_packet );
+    broker->connect_packet = NULL;
+    broker->connect_len = 0;
 }
 
 /**********************************************************************/
@@ -646,6 +1466,15 @@ void ecli_show_error(ecli_conn_msg return_code){
             sprintf(buffer_str, NOT_AUTH);
             eclilog_show(__FILE__, __func__, buffer_str, LOG_DEBUG);
             break;
+        case CLI_TLS_ERROR:
+            sprintf(buffer_str, TLS_ERROR, strerror( errno ) );
+            break;
+        case CLI_TOPIC_ERROR:
+            sprintf(buffer_str, TOPIC_ERROR);
+            break;
+        case CLI_UTF8_ERROR:
+            sprintf(buffer_str, UTF8_ERROR);
+            break;
         break;
         default:
             sprintf(buffer_str, UNKNOW_ERROR, strerror( errno ));
@@ -674,81 +1503,12 @@ static void get_set_cfg_file(ecli_broker_t *broker, ecli_conf_t *conf, const cha
     if ( fileptr != NULL ) {
         char line [CLI_CFGLINE_LEN];
         while ( fgets ( line, sizeof line, fileptr ) != NULL ) {
-            memset( key, 0, sizeof( key ) );
-            memset( value, 0, sizeof( value ) );
-            get_conf_value( line, key, value );
-            //printf(" [%s] = [%s]\n", key, value);
-            if ( strcmp( key, BROKER_IP_ID ) == EQUAL_STR_CMP ){
-                strncpy( conf->broker_hostname, value, sizeof( conf->broker_hostname ) );
-            }
-            else if ( strcmp( key, BROKER_PORT_ID ) == EQUAL_STR_CMP ) {
-                conf->broker_port = atoi( value );
-            }
-            else if ( strcmp( key, BROKER_USER_ID ) == EQUAL_STR_CMP ) {
-                strncpy( broker->username, value, sizeof( broker->username ) );
-            }
-            else if ( strcmp( key, BROKER_PASSWD_ID ) == EQUAL_STR_CMP ) {
-                strncpy( broker->password, value, sizeof( broker->username ) );
-            }
-            else if ( strcmp( key, CLIENT_ID ) == EQUAL_STR_CMP ) {
-                strncpy( broker->client_id, value, sizeof( broker->client_id ) );
-            }
-            else if ( strcmp( key, TOPIC_ID ) == EQUAL_STR_CMP ) {
-                strncpy( broker->topic, value, sizeof( broker->topic ) );
-            }
-            else if ( strcmp( key, QOS_ID ) == EQUAL_STR_CMP ) {
-                broker->qos = atoi( value );
-            }
-            else if ( strcmp( key, RETAIN_ID ) == EQUAL_STR_CMP ) {
-                broker->retain = atoi( value );
-            }
-            else if ( strcmp( key, KEEP_ALIVE_ID ) == EQUAL_STR_CMP ) {
-                broker->alive = atoi( value );
-            }
-            else if ( strcmp( key, WILL_FLAG_ID ) == EQUAL_STR_CMP ) {
-                broker->will_flag = atoi( value );
-            }
-            else if ( strcmp( key, WILL_RETAIN_ID ) == EQUAL_STR_CMP ) {
-                broker->will_retain = atoi( value );
-            }
-            else if ( strcmp( key, WILL_QOS_ID ) == EQUAL_STR_CMP ) {
-                broker->will_qos = atoi( value );
-            }
-            else if ( strcmp( key, CLEAN_SESSION_ID ) == EQUAL_STR_CMP ) {
-                broker->clean_session = atoi( value );
-            }
-            else if ( strcmp( key, WILL_TOPIC_ID ) == EQUAL_STR_CMP ) {
-                strncpy(broker->will_topic, value, sizeof( broker->will_topic ) );
-            }
-            else if ( strcmp( key, WILL_MSG_ID ) == EQUAL_STR_CMP ) {
-                strncpy(broker->will_msg, value, sizeof( broker->will_msg ) );
-            }
-            else if ( strcmp( key, SEQUENCE_ID ) == EQUAL_STR_CMP ) {
-                broker->sequence = atoi( value );
-            }
-            else if ( strcmp( key, OUTPUT_FILE_ID ) == EQUAL_STR_CMP ) {
-                strncpy(conf->datafile_path, value, sizeof( conf->datafile_path ) );
-            }
-            else if ( strcmp( key, INPUT_FILE_ID ) == EQUAL_STR_CMP ) {
-                strncpy(conf->msg_txt, value, sizeof( conf->msg_txt ) );
-            }
-            else if ( strcmp( key, CLIENT_LOOP_ID ) == EQUAL_STR_CMP ) {
-                conf->client_loop_flg = atoi( value );
-            }
-            else if ( strcmp( key, PERSIST_CON_ID ) == EQUAL_STR_CMP ) {
-                conf->persist_conn_time = atoi( value );
-            }
-            else if ( strcmp( key, ONLINE_MSG_ID ) == EQUAL_STR_CMP ) {
-                conf->publish_online_flg = atoi( value );
-            }
-            else if ( strcmp( key, FILE_TRANS_ID ) == EQUAL_STR_CMP ) {
-                if ( atoi( value ) ) {
-                    conf->msg_type = CLI_DATAFILE_MSG;
-                }
-                else {
-                    conf->msg_type = CLI_TXT_MSG;
-                }
+            /* Sections ([session]) are read by the sessions runner */
+            if ( line[0] == '[' ) {
+                break;
             }
+            ecli_conf_value( line, key, value );
+            ecli_set_conf( broker, conf, key, value );
         }
         fclose ( fileptr );
     }
@@ -760,30 +1520,6 @@ static void get_set_cfg_file(ecli_broker_t *broker, ecli_conf_t *conf, const cha
 }
 
 /**********************************************************************/
-/**********************************************************************/
-/** Get Key Value of line from Config file
- *
- * @param conf: structure that contains the user config options for broker conn.
- * @param key: key return name
- * @param value: return value
- *
- */
-static void get_conf_value( char *line, char *key, char *value ) {
-    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
-
-    char delim[] = "=";
-    /*Get Key*/
-    char *ptr = strtok(line, delim);
-    strcpy( key, ptr);
-    /*Get Value*/
-    ptr = strtok(NULL, delim);
-    /*Quit new line*/
-    char *newline = strchr( ptr, '\n' );
-    if ( newline )
-        *newline = 0;
-    strcpy( value, ptr);
-
-}
 
 /**********************************************************************/
 /** Get Topic from mqtt packet
@@ -845,3 +1581,175 @@ static uint32_t ecli_get_message(const uint8_t* packet_buffer, const uint8_t **m
 
     return msg_len;
 }
+
+
+/**********************************************************************/
+/** Get stream record format from name, exits when not known
+ *
+ * @param name: format name.
+ *
+ */
+static ecli_stream_mode ecli_stream_from_name(const char *name) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    if ( strcmp( name, STREAM_LINE_NAME ) == EQUAL_STR_CMP ) {
+        return CLI_STREAM_LINE;
+    }
+    if ( strcmp( name, STREAM_LINE_TOPIC_NAME ) == EQUAL_STR_CMP ) {
+        return CLI_STREAM_LINE_TOPIC;
+    }
+    if ( strcmp( name, STREAM_LEN_NAME ) == EQUAL_STR_CMP ) {
+        return CLI_STREAM_LEN;
+    }
+    if ( strcmp( name, STREAM_LEN_TOPIC_NAME ) == EQUAL_STR_CMP ) {
+        return CLI_STREAM_LEN_TOPIC;
+    }
+    if ( strcmp( name, "none" ) == EQUAL_STR_CMP ) {
+        return CLI_STREAM_NONE;
+    }
+    fprintf( stderr, STREAM_MODE_ERROR );
+    exit( CLI_ERROR );
+}
+
+/**********************************************************************/
+/** Get subscriber output sink from name, exits when not known
+ *
+ * @param name: sink name.
+ *
+ */
+static ecli_sink_mode ecli_sink_from_name(const char *name) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    if ( strcmp( name, SINK_NDJSON_NAME ) == EQUAL_STR_CMP ) {
+        return CLI_SINK_NDJSON;
+    }
+    if ( strcmp( name, SINK_LEN_NAME ) == EQUAL_STR_CMP ) {
+        return CLI_SINK_LEN;
+    }
+    if ( strcmp( name, SINK_FILES_NAME ) == EQUAL_STR_CMP ) {
+        return CLI_SINK_FILES;
+    }
+    if ( strcmp( name, SINK_SHM_NAME ) == EQUAL_STR_CMP ) {
+        return CLI_SINK_SHM;
+    }
+    if ( strcmp( name, "none" ) == EQUAL_STR_CMP ) {
+        return CLI_SINK_NONE;
+    }
+    fprintf( stderr, SINK_MODE_ERROR );
+    exit( CLI_ERROR );
+}
+
+/**********************************************************************/
+/** Get send queue drop policy from name, exits when not known
+ *
+ * @param name: policy name.
+ *
+ */
+static ecli_sendq_drop ecli_drop_from_name(const char *name) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    if ( strcmp( name, SENDQ_NONE_NAME ) == EQUAL_STR_CMP ) {
+        return SENDQ_DROP_NONE;
+    }
+    if ( strcmp( name, SENDQ_OLDEST_NAME ) == EQUAL_STR_CMP ) {
+        return SENDQ_DROP_OLDEST;
+    }
+    if ( strcmp( name, SENDQ_NEWEST_NAME ) == EQUAL_STR_CMP ) {
+        return SENDQ_DROP_NEWEST;
+    }
+    fprintf( stderr, SENDQ_DROP_ERROR "\n" );
+    exit( CLI_ERROR );
+}
+
+/**********************************************************************/
+
+/**********************************************************************/
+/** Read first bytes of next packet to conf->packet_buffer, bytes left
+ * from the previous read first, until the fixed header is complete.
+ *
+ * @param broker: structure that contains the client connection info with broker
+ * @param conf: structure that contains the user config options for broker conn.
+ *
+ */
+static int32_t ecli_read_first(ecli_broker_t *broker, ecli_conf_t *conf) {
+
+    int32_t totalbytes = broker->rx_pending;
+    int32_t rcv_bytes  = 0;
+    int32_t i          = 0;
+
+    memcpy( conf->packet_buffer, broker->rx_buffer, totalbytes );
+    broker->rx_pending = 0;
+    for ( ;; ) {
+        /* Fixed header: type byte and 1 to 4 remaining len bytes */
+        for ( i = 1; i < totalbytes && i < 5; i++ ) {
+            if ( ( conf->packet_buffer[i] & CLI_REMAIN_LEN ) == 0 ) {
+                return totalbytes;
+            }
+        }
+        /* Packet waited for (ack) may still be queued */
+        if ( eclisendq_flush( &broker->sendq, &broker->transport, TRUE_FLAG ) < 0 ) {
+            rcv_bytes = -1;
+        }
+        else {
+            rcv_bytes = broker->transport.ops->recv( &broker->transport, conf->packet_buffer + totalbytes,
+                                                     CLI_BUF_SIZE - totalbytes, 0 );
+        }
+        if ( rcv_bytes <= 0 ) {
+            /* Timeout in the middle of a header, keep what we have */
+            memcpy( broker->rx_buffer, conf->packet_buffer, totalbytes );
+            broker->rx_pending = totalbytes;
+            return rcv_bytes;
+        }
+        totalbytes += rcv_bytes;
+    }
+}
+
+/**********************************************************************/
+/** Keep bytes read past packet end for the next read
+ *
+ * @param broker: structure that contains the client connection info with broker
+ * @param buffer: bytes read.
+ * @param totalbytes: number of bytes read.
+ * @param packet_length: size of packet at buffer start.
+ *
+ */
+static void ecli_read_keep(ecli_broker_t *broker, const uint8_t *buffer,
+                           int32_t totalbytes, uint32_t packet_length) {
+
+    if ( totalbytes > packet_length ) {
+        broker->rx_pending = totalbytes - packet_length;
+        memcpy( broker->rx_buffer, buffer + packet_length, broker->rx_pending );
+    }
+}
+
+/**********************************************************************/
+/** Store received message in the last value cache, last sample of an
+ * aggregated block.
+ *
+ * @param conf: structure that contains the user config options for broker conn.
+ * @param topic: message topic.
+ * @param msg: message payload.
+ * @param msg_len: message size.
+ * @param retain: retained publish flag.
+ *
+ */
+static void ecli_lvc_put(ecli_conf_t *conf, const char *topic, const uint8_t *msg,
+                         uint32_t msg_len, uint8_t retain) {
+
+    uint8_t  sample[SERIES_TEXT_MAX];
+    int32_t  sample_len = 0;
+    int32_t  last_len   = -1;
+    uint64_t sample_ms  = 0;
+    ecli_series_iter_t series;
+
+    if ( conf->series && ecliseries_open( &series, msg, msg_len ) > 0 ) {
+        while ( ( sample_len = ecliseries_next( &series, sample, &sample_ms ) ) > 0 ) {
+            last_len = sample_len;
+        }
+        if ( last_len > 0 ) {
+            eclilvc_put( topic, sample, last_len, retain, sample_ms );
+        }
+        return;
+    }
+    eclilvc_put( topic, msg, msg_len, retain, 0 );
+}
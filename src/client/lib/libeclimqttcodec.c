@@ -0,0 +1,496 @@
+/***********************************************************************
+* FILENAME    :   libeclimqttcodec.c
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   Library code for payload compression (LZ4, zstd and
+*                 zstd with trained dictionary).
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dlfcn.h>
+#include <pthread.h>
+
+/**********************************************************************/
+
+#include <libeclimqttcodec.h>
+#include <libeclimqttutf8.h>
+#include <libeclimqttlog.h>
+
+/**********************************************************************/
+#define CODEC_MSG_LEN       600
+
+/**********************************************************************/
+/* Topic threshold */
+typedef struct {
+    char     filter[CODEC_TOPIC_LEN];
+    uint32_t min_size;
+} eclicodec_rule_t;
+
+/* liblz4 */
+typedef struct {
+    void *handle;
+    int  (*compress)(const char *src, char *dst, int src_size, int dst_capacity);
+    int  (*decompress)(const char *src, char *dst, int compressed_size, int dst_capacity);
+} eclicodec_lz4_t;
+
+/* libzstd */
+typedef struct {
+    void     *handle;
+    size_t   (*compress)(void *dst, size_t dst_capacity, const void *src, size_t src_size, int level);
+    size_t   (*decompress)(void *dst, size_t dst_capacity, const void *src, size_t src_size);
+    unsigned (*is_error)(size_t code);
+    void     *(*create_cctx)(void);
+    void     *(*create_dctx)(void);
+    void     *(*create_cdict)(const void *dict, size_t dict_size, int level);
+    void     *(*create_ddict)(const void *dict, size_t dict_size);
+    size_t   (*compress_cdict)(void *cctx, void *dst, size_t dst_capacity,
+                               const void *src, size_t src_size, const void *cdict);
+    size_t   (*decompress_ddict)(void *dctx, void *dst, size_t dst_capacity,
+                                 const void *src, size_t src_size, const void *ddict);
+    size_t   (*train)(void *dict, size_t dict_capacity, const void *samples,
+                      const size_t *sample_sizes, unsigned samples_num);
+    unsigned (*dict_is_error)(size_t code);
+    void     *cctx;
+    void     *dctx;
+    void     *cdict;
+    void     *ddict;
+} eclicodec_zstd_t;
+
+/* Dictionary training */
+typedef struct {
+    uint8_t  *samples;
+    size_t   sizes[CODEC_TRAIN_SAMPLES];
+    size_t   len;
+    uint32_t count;
+    uint8_t  done;
+} eclicodec_train_t;
+
+/**********************************************************************/
+
+static ecli_codec_conf_t codec_conf = { .codec = CODEC_NONE, .level = CODEC_LEVEL_DEFAULT,
+                                        .min_size = CODEC_MIN_DEFAULT };
+static eclicodec_rule_t  codec_rules[CODEC_MAX_RULES];
+static uint32_t          codec_rules_num = 0;
+static eclicodec_lz4_t   codec_lz4;
+static eclicodec_zstd_t  codec_zstd;
+static eclicodec_train_t codec_train;
+static pthread_mutex_t   codec_cctx_lock = PTHREAD_MUTEX_INITIALIZER;  /* Dict cctx, parallel senders */
+
+/**********************************************************************/
+/**********************************************************************/
+/** Load codec library, once.
+ *
+ * @param codec: codec.
+ *
+ */
+static int8_t eclicodec_load(ecli_codec_t codec);
+
+/**********************************************************************/
+/** Load zstd dictionary from dict_file.
+ *
+ */
+static int8_t eclicodec_load_dict(void);
+
+/**********************************************************************/
+/**********************************************************************/
+/** Get codec from name ("lz4", "zstd", "train", "none").
+ *
+ * @param name: codec name.
+ *
+ */
+ecli_codec_t eclicodec_from_name(const char *name) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    if ( strcmp( name, "lz4" ) == 0 ) {
+        return CODEC_LZ4;
+    }
+    if ( strcmp( name, "zstd" ) == 0 ) {
+        return CODEC_ZSTD;
+    }
+    if ( strcmp( name, "train" ) == 0 ) {
+        return CODEC_TRAIN;
+    }
+
+    return CODEC_NONE;
+}
+
+/**********************************************************************/
+/** Add size threshold for topics matching filter, payloads smaller are
+ * sent raw. First matching rule is used.
+ *
+ * @param rule: "topic/filter/+/# min_bytes".
+ *
+ */
+int8_t eclicodec_rule(const char *rule) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    eclicodec_rule_t *new_rule;
+
+    if ( codec_rules_num == CODEC_MAX_RULES ) {
+        return -1;
+    }
+    new_rule = &codec_rules[codec_rules_num];
+    if ( sscanf( rule, "%255s %u", new_rule->filter, &new_rule->min_size ) != 2 ) {
+        return -1;
+    }
+    codec_rules_num++;
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Load codec libraries and dictionary.
+ *
+ * @param conf: compression configuration.
+ *
+ */
+int8_t eclicodec_init(const ecli_codec_conf_t *conf) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    char buffer_str[CODEC_MSG_LEN] = {0};
+
+    codec_conf = *conf;
+    switch ( codec_conf.codec ) {
+        case CODEC_LZ4:
+            return eclicodec_load( CODEC_LZ4 );
+        case CODEC_ZSTD:
+        case CODEC_ZSTD_DICT:
+            if ( eclicodec_load( CODEC_ZSTD ) < 0 ) {
+                return -1;
+            }
+            if ( codec_conf.dict_file[0] ) {
+                if ( eclicodec_load_dict() < 0 ) {
+                    return -1;
+                }
+                codec_conf.codec = CODEC_ZSTD_DICT;
+            }
+            return 0;
+        case CODEC_TRAIN:
+            if ( !codec_conf.dict_file[0] || eclicodec_load( CODEC_ZSTD ) < 0 ) {
+                return -1;
+            }
+            snprintf( buffer_str, sizeof( buffer_str ), "Collecting %u payloads for dictionary %s",
+                      CODEC_TRAIN_SAMPLES, codec_conf.dict_file );
+            eclilog_show(__FILE__, __func__, buffer_str, LOG_DEBUG);
+            return 0;
+        default:
+            return 0;
+    }
+}
+
+/**********************************************************************/
+/** Compress payload of topic, returns compressed size with header or 0
+ * when it has to be sent raw (threshold, no gain, codec error).
+ *
+ * @param topic: publish topic.
+ * @param in: payload.
+ * @param len: payload size.
+ * @param out: output buffer, len bytes.
+ *
+ */
+uint32_t eclicodec_compress(const char *topic, const uint8_t *in, uint32_t len, uint8_t *out) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    uint32_t min_size   = codec_conf.min_size;
+    uint32_t header_len = 0;
+    uint32_t remain     = len;
+    uint32_t capacity   = 0;
+    size_t   result     = 0;
+    uint32_t i;
+
+    if ( codec_conf.codec == CODEC_NONE || codec_conf.codec == CODEC_TRAIN ) {
+        return 0;
+    }
+    for ( i = 0; i < codec_rules_num; i++ ) {
+        if ( ecliutf8_match( codec_rules[i].filter, topic, strlen( topic ) ) ) {
+            min_size = codec_rules[i].min_size;
+            break;
+        }
+    }
+    if ( len < min_size || len < CODEC_HEADER_MAX + 1 ) {
+        return 0;
+    }
+    out[header_len++] = CODEC_MAGIC;
+    out[header_len++] = CODEC_TAG | codec_conf.codec;
+    do {
+        out[header_len] = remain % 128;
+        remain /= 128;
+        if ( remain > 0 ) {
+            out[header_len] |= 128;
+        }
+        header_len++;
+    }
+    while ( remain > 0 );
+    /* Only a smaller payload is worth it, output has room for no more */
+    capacity = len - header_len;
+    switch ( codec_conf.codec ) {
+        case CODEC_LZ4: {
+            int compressed = codec_lz4.compress( ( const char * ) in, ( char * ) out + header_len,
+                                                 len, capacity );
+            result = compressed > 0 ? compressed : 0;
+            break;
+        }
+        case CODEC_ZSTD:
+            result = codec_zstd.compress( out + header_len, capacity, in, len, codec_conf.level );
+            if ( codec_zstd.is_error( result ) ) {
+                result = 0;
+            }
+            break;
+        case CODEC_ZSTD_DICT:
+            pthread_mutex_lock( &codec_cctx_lock );
+            result = codec_zstd.compress_cdict( codec_zstd.cctx, out + header_len, capacity,
+                                                in, len, codec_zstd.cdict );
+            pthread_mutex_unlock( &codec_cctx_lock );
+            if ( codec_zstd.is_error( result ) ) {
+                result = 0;
+            }
+            break;
+        default:
+            break;
+    }
+    if ( result == 0 || header_len + result >= len ) {
+        return 0;
+    }
+
+    return header_len + result;
+}
+
+/**********************************************************************/
+/** Decompress payload, returns original size, 0 when payload is not
+ * compressed (deliver as is) or -1 on error.
+ *
+ * @param in: payload.
+ * @param len: payload size.
+ * @param out: output buffer.
+ * @param out_size: output buffer size.
+ *
+ */
+int32_t eclicodec_decompress(const uint8_t *in, uint32_t len, uint8_t *out, uint32_t out_size) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    ecli_codec_t codec;
+    uint32_t header_len = 2;
+    uint32_t multiplier = 1;
+    uint32_t orig_len   = 0;
+    size_t   result     = 0;
+
+    if ( len < 3 || in[0] != CODEC_MAGIC || ( in[1] & CODEC_TAG_MASK ) != CODEC_TAG ) {
+        return 0;
+    }
+    codec = in[1] & ~CODEC_TAG_MASK;
+    if ( codec < CODEC_LZ4 || codec > CODEC_ZSTD_DICT ) {
+        return 0;
+    }
+    do {
+        if ( header_len == len || header_len == CODEC_HEADER_MAX ) {
+            return 0;
+        }
+        orig_len += ( in[header_len] & 127 ) * multiplier;
+        multiplier *= 128;
+    }
+    while ( in[header_len++] & 128 );
+    if ( orig_len > out_size ) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    if ( eclicodec_load( codec == CODEC_LZ4 ? CODEC_LZ4 : CODEC_ZSTD ) < 0 ) {
+        return -1;
+    }
+    switch ( codec ) {
+        case CODEC_LZ4:
+            if ( codec_lz4.decompress( ( const char * ) in + header_len, ( char * ) out,
+                                       len - header_len, orig_len ) != ( int32_t ) orig_len ) {
+                errno = EBADMSG;
+                return -1;
+            }
+            break;
+        case CODEC_ZSTD:
+            result = codec_zstd.decompress( out, orig_len, in + header_len, len - header_len );
+            if ( codec_zstd.is_error( result ) || result != orig_len ) {
+                errno = EBADMSG;
+                return -1;
+            }
+            break;
+        default:
+            if ( codec_zstd.ddict == NULL ) {
+                errno = ENOENT;
+                return -1;
+            }
+            result = codec_zstd.decompress_ddict( codec_zstd.dctx, out, orig_len, in + header_len,
+                                                  len - header_len, codec_zstd.ddict );
+            if ( codec_zstd.is_error( result ) || result != orig_len ) {
+                errno = EBADMSG;
+                return -1;
+            }
+            break;
+    }
+
+    return orig_len;
+}
+
+/**********************************************************************/
+/** Collect payload to train dictionary, when CODEC_TRAIN_SAMPLES are
+ * collected the dictionary is written to dict_file. Returns 1 when
+ * written, 0 collecting, -1 on error.
+ *
+ * @param in: payload.
+ * @param len: payload size.
+ *
+ */
+int8_t eclicodec_train(const uint8_t *in, uint32_t len) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    char    buffer_str[CODEC_MSG_LEN] = {0};
+    uint8_t *samples;
+    uint8_t *dict;
+    size_t  dict_len;
+    FILE    *fileptr;
+
+    if ( codec_conf.codec != CODEC_TRAIN || codec_train.done || len == 0 ) {
+        return 0;
+    }
+    if ( ( samples = realloc( codec_train.samples, codec_train.len + len ) ) == NULL ) {
+        return -1;
+    }
+    codec_train.samples = samples;
+    memcpy( codec_train.samples + codec_train.len, in, len );
+    codec_train.len += len;
+    codec_train.sizes[codec_train.count++] = len;
+    if ( codec_train.count < CODEC_TRAIN_SAMPLES ) {
+        return 0;
+    }
+    codec_train.done = 1;
+    /* Dictionary about a tenth of the samples */
+    dict_len = codec_train.len / 10 < CODEC_DICT_SIZE ? codec_train.len / 10 : CODEC_DICT_SIZE;
+    if ( ( dict = malloc( dict_len ) ) == NULL ) {
+        return -1;
+    }
+    dict_len = codec_zstd.train( dict, dict_len, codec_train.samples, codec_train.sizes,
+                                 codec_train.count );
+    free( codec_train.samples );
+    codec_train.samples = NULL;
+    if ( codec_zstd.dict_is_error( dict_len ) ) {
+        eclilog_show(__FILE__, __func__, "Dictionary training failed, payloads too small or too few",
+                     LOG_ERROR);
+        free( dict );
+        return -1;
+    }
+    if ( ( fileptr = fopen( codec_conf.dict_file, "wb" ) ) == NULL ||
+         fwrite( dict, 1, dict_len, fileptr ) != dict_len ) {
+        perror( codec_conf.dict_file );
+        if ( fileptr != NULL ) {
+            fclose( fileptr );
+        }
+        free( dict );
+        return -1;
+    }
+    fclose( fileptr );
+    free( dict );
+    snprintf( buffer_str, sizeof( buffer_str ), "Dictionary %s written: %zu bytes from %u payloads",
+              codec_conf.dict_file, dict_len, codec_train.count );
+    eclilog_show(__FILE__, __func__, buffer_str, LOG_DEBUG);
+
+    return 1;
+}
+
+/**********************************************************************/
+/**********************************************************************/
+/** Load codec library, once.
+ *
+ * @param codec: codec.
+ *
+ */
+static int8_t eclicodec_load(ecli_codec_t codec) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    char buffer_str[CODEC_MSG_LEN] = {0};
+
+    if ( codec == CODEC_LZ4 ) {
+        if ( codec_lz4.handle != NULL ) {
+            return 0;
+        }
+        if ( ( codec_lz4.handle = dlopen( CODEC_LZ4_LIB, RTLD_NOW ) ) != NULL ) {
+            *( void ** ) &codec_lz4.compress = dlsym( codec_lz4.handle, "LZ4_compress_default" );
+            *( void ** ) &codec_lz4.decompress = dlsym( codec_lz4.handle, "LZ4_decompress_safe" );
+            if ( codec_lz4.compress != NULL && codec_lz4.decompress != NULL ) {
+                return 0;
+            }
+            dlclose( codec_lz4.handle );
+            codec_lz4.handle = NULL;
+        }
+    }
+    else {
+        if ( codec_zstd.handle != NULL ) {
+            return 0;
+        }
+        if ( ( codec_zstd.handle = dlopen( CODEC_ZSTD_LIB, RTLD_NOW ) ) != NULL ) {
+            *( void ** ) &codec_zstd.compress = dlsym( codec_zstd.handle, "ZSTD_compress" );
+            *( void ** ) &codec_zstd.decompress = dlsym( codec_zstd.handle, "ZSTD_decompress" );
+            *( void ** ) &codec_zstd.is_error = dlsym( codec_zstd.handle, "ZSTD_isError" );
+            *( void ** ) &codec_zstd.create_cctx = dlsym( codec_zstd.handle, "ZSTD_createCCtx" );
+            *( void ** ) &codec_zstd.create_dctx = dlsym( codec_zstd.handle, "ZSTD_createDCtx" );
+            *( void ** ) &codec_zstd.create_cdict = dlsym( codec_zstd.handle, "ZSTD_createCDict" );
+            *( void ** ) &codec_zstd.create_ddict = dlsym( codec_zstd.handle, "ZSTD_createDDict" );
+            *( void ** ) &codec_zstd.compress_cdict = dlsym( codec_zstd.handle, "ZSTD_compress_usingCDict" );
+            *( void ** ) &codec_zstd.decompress_ddict = dlsym( codec_zstd.handle, "ZSTD_decompress_usingDDict" );
+            *( void ** ) &codec_zstd.train = dlsym( codec_zstd.handle, "ZDICT_trainFromBuffer" );
+            *( void ** ) &codec_zstd.dict_is_error = dlsym( codec_zstd.handle, "ZDICT_isError" );
+            if ( codec_zstd.compress != NULL && codec_zstd.decompress != NULL &&
+                 codec_zstd.is_error != NULL && codec_zstd.create_cctx != NULL &&
+                 codec_zstd.create_dctx != NULL && codec_zstd.create_cdict != NULL &&
+                 codec_zstd.create_ddict != NULL && codec_zstd.compress_cdict != NULL &&
+                 codec_zstd.decompress_ddict != NULL && codec_zstd.train != NULL &&
+                 codec_zstd.dict_is_error != NULL ) {
+                return 0;
+            }
+            dlclose( codec_zstd.handle );
+            codec_zstd.handle = NULL;
+        }
+    }
+    snprintf( buffer_str, sizeof( buffer_str ), "Codec library: %s", dlerror() );
+    eclilog_show(__FILE__, __func__, buffer_str, LOG_ERROR);
+
+    return -1;
+}
+
+/**********************************************************************/
+/** Load zstd dictionary from dict_file.
+ *
+ */
+static int8_t eclicodec_load_dict(void) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    char    buffer_str[CODEC_MSG_LEN] = {0};
+    uint8_t dict[CODEC_DICT_SIZE];
+    size_t  dict_len;
+    FILE    *fileptr;
+
+    if ( ( fileptr = fopen( codec_conf.dict_file, "rb" ) ) == NULL ) {
+        perror( codec_conf.dict_file );
+        return -1;
+    }
+    dict_len = fread( dict, 1, sizeof( dict ), fileptr );
+    fclose( fileptr );
+    /* Dictionaries are digested, the buffer is not kept */
+    codec_zstd.cctx = codec_zstd.create_cctx();
+    codec_zstd.dctx = codec_zstd.create_dctx();
+    codec_zstd.cdict = codec_zstd.create_cdict( dict, dict_len, codec_conf.level );
+    codec_zstd.ddict = codec_zstd.create_ddict( dict, dict_len );
+    if ( dict_len == 0 || codec_zstd.cctx == NULL || codec_zstd.dctx == NULL ||
+         codec_zstd.cdict == NULL || codec_zstd.ddict == NULL ) {
+        eclilog_show(__FILE__, __func__, "Dictionary load failed", LOG_ERROR);
+        return -1;
+    }
+    snprintf( buffer_str, sizeof( buffer_str ), "Dictionary %s: %zu bytes",
+              codec_conf.dict_file, dict_len );
+    eclilog_show(__FILE__, __func__, buffer_str, LOG_DEBUG);
+
+    return 0;
+}
+
+/**********************************************************************/
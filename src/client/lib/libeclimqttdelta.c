@@ -0,0 +1,525 @@
+/***********************************************************************
+* FILENAME    :   libeclimqttdelta.c
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   Library code for content defined dedup and delta
+*                 transfer of repeated file publishes.
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/**********************************************************************/
+
+#include <libeclimqttdelta.h>
+
+/**********************************************************************/
+#define DELTA_EMPTY           0         /* Free table slot */
+
+/**********************************************************************/
+/* Chunk of a version */
+typedef struct {
+    uint64_t hash;
+    uint32_t offset;
+    uint32_t len;
+} eclidelta_chunk_t;
+
+/* Chunk hash -> chunk index, open addressing */
+typedef struct {
+    uint64_t *keys;
+    uint32_t *values;
+    uint32_t mask;
+} eclidelta_table_t;
+
+/* Version known by both sides */
+typedef struct {
+    eclidelta_table_t table;
+    eclidelta_chunk_t *chunks;
+    uint32_t num;
+    uint64_t size;
+    uint8_t  *data;                         /* File data (subscriber) */
+} eclidelta_version_t;
+
+/**********************************************************************/
+static uint64_t            delta_gear[256];
+static uint8_t             delta_gear_ready = 0;
+static eclidelta_version_t delta_prev;
+static uint64_t            delta_key_ns = 0;  /* Last full version published */
+static struct stat         delta_stat;        /* File of last version */
+
+/**********************************************************************/
+/**********************************************************************/
+/** Fill gear table with fixed pseudo random values (splitmix64), both
+ * sides must cut at the same places
+ *
+ */
+static void eclidelta_gear_init(void);
+
+/**********************************************************************/
+/** Length of next chunk
+ *
+ * @param buffer: data from chunk start.
+ * @param len: data size.
+ *
+ */
+static uint32_t eclidelta_cut(const uint8_t *buffer, uint32_t len);
+
+/**********************************************************************/
+/** Chunk table for up to entries chunks
+ *
+ * @param table: chunk table.
+ * @param entries: max number of chunks.
+ *
+ */
+static int8_t eclidelta_table_init(eclidelta_table_t *table, uint32_t entries);
+
+/**********************************************************************/
+/** Add chunk, first one of a hash is kept
+ *
+ * @param table: chunk table.
+ * @param hash: chunk hash.
+ * @param value: chunk index.
+ *
+ */
+static void eclidelta_table_put(eclidelta_table_t *table, uint64_t hash, uint32_t value);
+
+/**********************************************************************/
+/** Find chunk, returns 1 when found
+ *
+ * @param table: chunk table.
+ * @param hash: chunk hash.
+ * @param value: chunk index output.
+ *
+ */
+static uint8_t eclidelta_table_get(const eclidelta_table_t *table, uint64_t hash, uint32_t *value);
+
+/**********************************************************************/
+/** Free version
+ *
+ * @param version: version chunks, table and data.
+ *
+ */
+static void eclidelta_free(eclidelta_version_t *version);
+
+/**********************************************************************/
+/**********************************************************************/
+/** Publish file conf->msg_txt as delta of previous publish, nothing when
+ * the file did not change.
+ *
+ * @param broker: structure that contains the client connection info with broker
+ * @param conf: structure that contains the user config options for broker conn.
+ *
+ */
+uint8_t eclidelta_publish(ecli_broker_t *broker, ecli_conf_t *conf) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    char     buffer_str[CLI_BUF_SIZE] = {0};
+    int32_t  fd          = -1;
+    int32_t  bytes       = 0;
+    uint8_t  key         = FALSE_FLAG;
+    uint8_t  return_code = CLI_NO_ERROR;
+    uint8_t  *msg        = NULL;
+    uint8_t  *new_chunk  = NULL;
+    uint32_t i           = 0;
+    uint32_t index       = 0;
+    uint32_t offset      = 0;
+    uint32_t msg_len     = 0;
+    uint32_t data_pos    = 0;
+    uint32_t new_num     = 0;
+    uint64_t now_ns      = eclimetrics_now();
+    struct stat file_stat;
+    eclidelta_version_t version;
+
+    memset( &version, 0, sizeof( version ) );
+    if ( ( fd = open( conf->msg_txt, O_RDONLY ) ) < 0 || fstat( fd, &file_stat ) < 0 ) {
+        perror( conf->msg_txt );
+        if ( fd >= 0 ) {
+            close( fd );
+        }
+        return CLI_FILE_ERROR;
+    }
+    if ( file_stat.st_size > CLI_MAX_MSG_SIZE ) {
+        close( fd );
+        return CLI_PUBLISH_SIZE_ERROR;
+    }
+    /* Full version when due, after a failed publish or the first one */
+    key = ( delta_key_ns == 0 || now_ns - delta_key_ns >= conf->file_delta_key * 1000000000ULL );
+    /* Same inode, size and mtime: not read again */
+    if ( !key && file_stat.st_ino == delta_stat.st_ino && file_stat.st_size == delta_stat.st_size &&
+         file_stat.st_mtim.tv_sec == delta_stat.st_mtim.tv_sec &&
+         file_stat.st_mtim.tv_nsec == delta_stat.st_mtim.tv_nsec ) {
+        close( fd );
+        return CLI_NO_ERROR;
+    }
+    version.size = file_stat.st_size;
+    version.data = malloc( version.size + 1 );
+    version.chunks = malloc( ( version.size / DELTA_CHUNK_MIN + 1 ) * sizeof( eclidelta_chunk_t ) );
+    new_chunk = calloc( 1, version.size / DELTA_CHUNK_MIN + 1 );
+    if ( version.data == NULL || version.chunks == NULL || new_chunk == NULL ||
+         eclidelta_table_init( &version.table, version.size / DELTA_CHUNK_MIN + 1 ) < CLI_NO_ERROR ) {
+        return_code = CLI_FILE_ERROR;
+        goto publish_end;
+    }
+    while ( offset < version.size ) {
+        if ( ( bytes = read( fd, version.data + offset, version.size - offset ) ) <= 0 ) {
+            if ( bytes < 0 && errno == EINTR ) {
+                continue;
+            }
+            return_code = CLI_FILE_ERROR;
+            goto publish_end;
+        }
+        offset += bytes;
+    }
+
+    msg_len = DELTA_HEADER_LEN;
+    for ( offset = 0; offset < version.size; offset += version.chunks[i++].len ) {
+        version.chunks[i].offset = offset;
+        version.chunks[i].len = eclidelta_cut( version.data + offset, version.size - offset );
+        version.chunks[i].hash = eclihash_xxh3( version.data + offset, version.chunks[i].len );
+        /* Data only once: not in previous version, not earlier in this one */
+        if ( key || ( !eclidelta_table_get( &delta_prev.table, version.chunks[i].hash, &index ) &&
+                      !eclidelta_table_get( &version.table, version.chunks[i].hash, &index ) ) ) {
+            new_chunk[i] = TRUE_FLAG;
+            new_num++;
+            msg_len += version.chunks[i].len;
+        }
+        eclidelta_table_put( &version.table, version.chunks[i].hash, i );
+        msg_len += DELTA_ENTRY_LEN;
+    }
+    version.num = i;
+
+    /* Same chunks in the same order: nothing to publish */
+    if ( !key && version.size == delta_prev.size && version.num == delta_prev.num ) {
+        for ( i = 0; i < version.num && version.chunks[i].hash == delta_prev.chunks[i].hash; i++ );
+        if ( i == version.num ) {
+            eclilog_show(__FILE__, __func__, DELTA_SKIP_MSG, LOG_DEBUG);
+            delta_stat = file_stat;
+            goto publish_end;
+        }
+    }
+    if ( msg_len > CLI_MAX_MSG_SIZE ) {
+        return_code = CLI_PUBLISH_SIZE_ERROR;
+        goto publish_end;
+    }
+    if ( ( msg = malloc( msg_len ) ) == NULL ) {
+        return_code = CLI_PUBLISH_ERROR;
+        goto publish_end;
+    }
+    msg[0] = 'E';
+    msg[1] = 'D';
+    msg[2] = DELTA_VERSION;
+    msg[3] = key ? DELTA_FLAG_KEY : 0;
+    eclihash_put32( msg + 4, version.num );
+    eclihash_put64( msg + 8, version.size );
+    data_pos = DELTA_HEADER_LEN + version.num * DELTA_ENTRY_LEN;
+    for ( i = 0; i < version.num; i++ ) {
+        eclihash_put64( msg + DELTA_HEADER_LEN + i * DELTA_ENTRY_LEN, version.chunks[i].hash );
+        eclihash_put32( msg + DELTA_HEADER_LEN + i * DELTA_ENTRY_LEN + 8,
+                         version.chunks[i].len | ( new_chunk[i] ? DELTA_LEN_DATA : 0 ) );
+        if ( new_chunk[i] ) {
+            memcpy( msg + data_pos, version.data + version.chunks[i].offset, version.chunks[i].len );
+            data_pos += version.chunks[i].len;
+        }
+    }
+
+    if ( ( return_code = eclimqtt_publish_chunk( broker, conf, msg, msg_len ) ) != CLI_NO_ERROR ) {
+        /* Subscriber may not have this version, next one goes full */
+        delta_key_ns = 0;
+        goto publish_end;
+    }
+    if ( key ) {
+        delta_key_ns = now_ns;
+    }
+    delta_stat = file_stat;
+    sprintf(buffer_str, DELTA_MSG, new_num, version.num, msg_len, ( unsigned long long ) version.size);
+    eclilog_show(__FILE__, __func__, buffer_str, LOG_DEBUG);
+    /* Published version is the base of the next one, data not needed */
+    free( version.data );
+    version.data = NULL;
+    eclidelta_free( &delta_prev );
+    delta_prev = version;
+    memset( &version, 0, sizeof( version ) );
+
+publish_end:
+    close( fd );
+    free( msg );
+    free( new_chunk );
+    eclidelta_free( &version );
+
+    return return_code;
+}
+
+/**********************************************************************/
+/** Rebuild conf->datafile_path from delta message, returns 1 when the
+ * file is written, 0 when msg is not a delta (plain file) or -1 when
+ * chunks are missing (wait for next full version) or on file error.
+ *
+ * @param conf: structure that contains the user config options for broker conn.
+ * @param msg: message payload.
+ * @param msg_len: message size.
+ *
+ */
+int8_t eclidelta_apply(ecli_conf_t *conf, const uint8_t *msg, uint32_t msg_len) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    char     buffer_str[CLI_BUF_SIZE] = {0};
+    char     tmp_path[CLI_PATH_LEN + sizeof( DELTA_TMP_SUFFIX )] = {0};
+    int32_t  fd        = -1;
+    int32_t  bytes     = 0;
+    uint32_t i         = 0;
+    uint32_t index     = 0;
+    uint32_t len       = 0;
+    uint32_t offset    = 0;
+    uint32_t data_pos  = 0;
+    uint32_t received  = 0;
+    uint64_t hash      = 0;
+    const uint8_t *src = NULL;
+    eclidelta_version_t version;
+
+    if ( msg_len < DELTA_HEADER_LEN || msg[0] != 'E' || msg[1] != 'D' || msg[2] != DELTA_VERSION ) {
+        return 0;
+    }
+    memset( &version, 0, sizeof( version ) );
+    version.num = eclihash_get32( msg + 4 );
+    version.size = eclihash_get64( msg + 8 );
+    if ( version.num > ( msg_len - DELTA_HEADER_LEN ) / DELTA_ENTRY_LEN || version.size > CLI_MAX_MSG_SIZE ) {
+        eclilog_show(__FILE__, __func__, DELTA_ERROR, LOG_ERROR);
+        return -1;
+    }
+    version.data = malloc( version.size + 1 );
+    version.chunks = malloc( ( version.num + 1 ) * sizeof( eclidelta_chunk_t ) );
+    if ( version.data == NULL || version.chunks == NULL ||
+         eclidelta_table_init( &version.table, version.num + 1 ) < CLI_NO_ERROR ) {
+        eclidelta_free( &version );
+        return -1;
+    }
+
+    data_pos = DELTA_HEADER_LEN + version.num * DELTA_ENTRY_LEN;
+    for ( i = 0; i < version.num; i++ ) {
+        hash = eclihash_get64( msg + DELTA_HEADER_LEN + i * DELTA_ENTRY_LEN );
+        len = eclihash_get32( msg + DELTA_HEADER_LEN + i * DELTA_ENTRY_LEN + 8 );
+        src = NULL;
+        if ( len & DELTA_LEN_DATA ) {
+            len &= ~DELTA_LEN_DATA;
+            if ( len <= msg_len - data_pos && eclihash_xxh3( msg + data_pos, len ) == hash ) {
+                src = msg + data_pos;
+                data_pos += len;
+                received++;
+            }
+        }
+        else if ( eclidelta_table_get( &version.table, hash, &index ) ) {
+            src = version.data + version.chunks[index].offset;
+        }
+        else if ( eclidelta_table_get( &delta_prev.table, hash, &index ) &&
+                  delta_prev.chunks[index].len == len ) {
+            src = delta_prev.data + delta_prev.chunks[index].offset;
+        }
+        if ( src == NULL || len == 0 || len > DELTA_CHUNK_MAX || len > version.size - offset ) {
+            eclilog_show(__FILE__, __func__, src ? DELTA_ERROR : DELTA_MISS_ERROR, LOG_ERROR);
+            eclidelta_free( &version );
+            return -1;
+        }
+        memcpy( version.data + offset, src, len );
+        version.chunks[i].hash = hash;
+        version.chunks[i].offset = offset;
+        version.chunks[i].len = len;
+        eclidelta_table_put( &version.table, hash, i );
+        offset += len;
+    }
+    if ( offset != version.size ) {
+        eclilog_show(__FILE__, __func__, DELTA_ERROR, LOG_ERROR);
+        eclidelta_free( &version );
+        return -1;
+    }
+
+    /* Readers of the output never see a half written file */
+    snprintf( tmp_path, sizeof( tmp_path ), "%s%s", conf->datafile_path, DELTA_TMP_SUFFIX );
+    if ( ( fd = open( tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644 ) ) < 0 ) {
+        perror( tmp_path );
+        eclidelta_free( &version );
+        return -1;
+    }
+    for ( offset = 0; offset < version.size; offset += bytes ) {
+        if ( ( bytes = write( fd, version.data + offset, version.size - offset ) ) < 0 ) {
+            if ( errno == EINTR ) {
+                bytes = 0;
+                continue;
+            }
+            break;
+        }
+    }
+    close( fd );
+    if ( offset < version.size || rename( tmp_path, conf->datafile_path ) < 0 ) {
+        perror( conf->datafile_path );
+        unlink( tmp_path );
+        eclidelta_free( &version );
+        return -1;
+    }
+    sprintf(buffer_str, DELTA_APPLY_MSG, received, version.num, msg_len, ( unsigned long long ) version.size);
+    eclilog_show(__FILE__, __func__, buffer_str, LOG_DEBUG);
+
+    /* Chunk cache: this version, base of the next delta */
+    eclidelta_free( &delta_prev );
+    delta_prev = version;
+
+    return 1;
+}
+
+/**********************************************************************/
+/**********************************************************************/
+/** Fill gear table with fixed pseudo random values (splitmix64), both
+ * sides must cut at the same places
+ *
+ */
+static void eclidelta_gear_init(void) {
+
+    uint64_t seed  = 0;
+    uint64_t value = 0;
+    uint32_t i     = 0;
+
+    for ( i = 0; i < 256; i++ ) {
+        seed += 0x9E3779B97F4A7C15ULL;
+        value = seed;
+        value = ( value ^ ( value >> 30 ) ) * 0xBF58476D1CE4E5B9ULL;
+        value = ( value ^ ( value >> 27 ) ) * 0x94D049BB133111EBULL;
+        delta_gear[i] = value ^ ( value >> 31 );
+    }
+    delta_gear_ready = TRUE_FLAG;
+}
+
+/**********************************************************************/
+/** Length of next chunk
+ *
+ * @param buffer: data from chunk start.
+ * @param len: data size.
+ *
+ */
+static uint32_t eclidelta_cut(const uint8_t *buffer, uint32_t len) {
+
+    uint64_t hash   = 0;
+    uint32_t i      = DELTA_CHUNK_MIN;
+    uint32_t normal = DELTA_CHUNK_AVG;
+
+    if ( !delta_gear_ready ) {
+        eclidelta_gear_init();
+    }
+    if ( len <= DELTA_CHUNK_MIN ) {
+        return len;
+    }
+    if ( len > DELTA_CHUNK_MAX ) {
+        len = DELTA_CHUNK_MAX;
+    }
+    if ( normal > len ) {
+        normal = len;
+    }
+    /* Hash covers the last 64 bytes, cut points move with the content */
+    for ( ; i < normal; i++ ) {
+        hash = ( hash << 1 ) + delta_gear[ buffer[i] ];
+        if ( !( hash & DELTA_MASK_S ) ) {
+            return i + 1;
+        }
+    }
+    for ( ; i < len; i++ ) {
+        hash = ( hash << 1 ) + delta_gear[ buffer[i] ];
+        if ( !( hash & DELTA_MASK_L ) ) {
+            return i + 1;
+        }
+    }
+
+    return len;
+}
+
+/**********************************************************************/
+/** Chunk table for up to entries chunks
+ *
+ * @param table: chunk table.
+ * @param entries: max number of chunks.
+ *
+ */
+static int8_t eclidelta_table_init(eclidelta_table_t *table, uint32_t entries) {
+
+    uint32_t size = 16;
+
+    /* Half full at most */
+    while ( size < entries * 2 ) {
+        size <<= 1;
+    }
+    table->keys = calloc( size, sizeof( uint64_t ) );
+    table->values = malloc( size * sizeof( uint32_t ) );
+    table->mask = size - 1;
+    if ( table->keys == NULL || table->values == NULL ) {
+        return -1;
+    }
+
+    return CLI_NO_ERROR;
+}
+
+/**********************************************************************/
+/** Add chunk, first one of a hash is kept
+ *
+ * @param table: chunk table.
+ * @param hash: chunk hash.
+ * @param value: chunk index.
+ *
+ */
+static void eclidelta_table_put(eclidelta_table_t *table, uint64_t hash, uint32_t value) {
+
+    uint32_t slot = 0;
+
+    hash = ( hash == DELTA_EMPTY ) ? 1 : hash;
+    for ( slot = hash & table->mask; table->keys[slot] != DELTA_EMPTY; slot = ( slot + 1 ) & table->mask ) {
+        if ( table->keys[slot] == hash ) {
+            return;
+        }
+    }
+    table->keys[slot] = hash;
+    table->values[slot] = value;
+}
+
+/**********************************************************************/
+/** Find chunk, returns 1 when found
+ *
+ * @param table: chunk table.
+ * @param hash: chunk hash.
+ * @param value: chunk index output.
+ *
+ */
+static uint8_t eclidelta_table_get(const eclidelta_table_t *table, uint64_t hash, uint32_t *value) {
+
+    uint32_t slot = 0;
+
+    if ( table->keys == NULL ) {
+        return FALSE_FLAG;
+    }
+    hash = ( hash == DELTA_EMPTY ) ? 1 : hash;
+    for ( slot = hash & table->mask; table->keys[slot] != DELTA_EMPTY; slot = ( slot + 1 ) & table->mask ) {
+        if ( table->keys[slot] == hash ) {
+            *value = table->values[slot];
+            return TRUE_FLAG;
+        }
+    }
+
+    return FALSE_FLAG;
+}
+
+/**********************************************************************/
+/** Free version
+ *
+ * @param version: version chunks, table and data.
+ *
+ */
+static void eclidelta_free(eclidelta_version_t *version) {
+
+    free( version->table.keys );
+    free( version->table.values );
+    free( version->chunks );
+    free( version->data );
+    memset( version, 0, sizeof( *version ) );
+}
@@ -0,0 +1,1017 @@
+/***********************************************************************
+* FILENAME    :   libeclimqttfile.c
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   Library code for resumable chunked file transfer.
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+
+/**********************************************************************/
+
+#include <libeclimqttfile.h>
+
+/**********************************************************************/
+#define FILE_RESUME_LEN       16        /* Resume message header */
+#define FILE_RANGE_LEN        12        /* offset(8), len(4) */
+#define FILE_END_PERIOD       1000000000ULL  /* nsecs between end markers */
+#define FILE_RATE_EWMA        8
+
+#define FILE_BIT_SET( map, bit )   ( ( map )[ ( bit ) >> 3 ] |= ( 1 << ( ( bit ) & 7 ) ) )
+#define FILE_BIT_CLR( map, bit )   ( ( map )[ ( bit ) >> 3 ] &= ~( 1 << ( ( bit ) & 7 ) ) )
+#define FILE_BIT_GET( map, bit )   ( ( map )[ ( bit ) >> 3 ] & ( 1 << ( ( bit ) & 7 ) ) )
+#define FILE_BLOCKS( size )        ( ( uint32_t ) ( ( ( size ) + FILE_BLOCK_SIZE - 1 ) / FILE_BLOCK_SIZE ) )
+
+/**********************************************************************/
+/* Chunk / end marker header */
+typedef struct {
+    uint8_t  flags;
+    uint32_t id;
+    uint64_t size;
+    uint64_t offset;
+    uint32_t len;
+    uint32_t crc;
+} eclifile_header_t;
+
+/* Sender: blocks still to send, shared by the sessions */
+typedef struct {
+    ecli_broker_t *broker;                  /* Control session */
+    ecli_conf_t   *conf;
+    int32_t  fd;
+    uint32_t id;
+    uint64_t size;
+    uint32_t blocks;
+    uint8_t  *pending;                      /* Bit per block to send */
+    uint32_t cursor;                        /* No pending block before */
+    uint32_t busy;                          /* Chunks being published */
+    uint32_t alive;                         /* Connected sessions */
+    uint8_t  stop;
+    uint8_t  error;
+    uint64_t bytes;                         /* Published file bytes */
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+} eclifile_tx_t;
+
+/* Sender session */
+typedef struct {
+    eclifile_tx_t *tx;
+    uint32_t  num;
+    pthread_t thread;
+} eclifile_job_t;
+
+/* Receiver state file header, bitmap follows */
+typedef struct {
+    char     magic[4];
+    uint32_t id;
+    uint64_t size;
+    char     topic[CLI_TOPIC_LEN + 1];
+} eclifile_state_t;
+
+/* Receiver */
+typedef struct {
+    eclifile_state_t head;
+    int32_t  fd;                            /* Output file */
+    int32_t  state_fd;
+    uint8_t  *bitmap;                       /* Bit per received block */
+    uint32_t blocks;
+    uint32_t missing;
+    uint32_t done_id;                       /* Last completed transfer */
+} eclifile_rx_t;
+
+/**********************************************************************/
+static eclifile_rx_t   file_rx = { .fd = -1, .state_fd = -1 };
+
+/**********************************************************************/
+/**********************************************************************/
+/** Encode chunk header, big endian
+ *
+ * @param buffer: FILE_HEADER_LEN bytes output.
+ * @param header: header values.
+ *
+ */
+static void eclifile_encode(uint8_t *buffer, const eclifile_header_t *header);
+
+/**********************************************************************/
+/** Decode chunk header, returns -1 when payload is not a chunk
+ *
+ * @param buffer: payload.
+ * @param len: payload size.
+ * @param header: header values output.
+ *
+ */
+static int8_t eclifile_decode(const uint8_t *buffer, uint32_t len, eclifile_header_t *header);
+
+/**********************************************************************/
+/** Publish QOS0 control message to topic from session
+ *
+ * @param broker: structure that contains the client connection info with broker
+ * @param conf: structure that contains the user config options for broker conn.
+ * @param topic: topic to publish.
+ * @param buffer: message.
+ * @param len: message size.
+ *
+ */
+static uint8_t eclifile_publish(ecli_broker_t *broker, ecli_conf_t *conf, const char *topic,
+                                const uint8_t *buffer, uint32_t len);
+
+/**********************************************************************/
+/** (Re)connect session, subscribing to resume requests for control session
+ *
+ * @param broker: structure that contains the client connection info with broker
+ * @param conf: structure that contains the user config options for broker conn.
+ * @param resume_topic: topic to subscribe, NULL for sending sessions.
+ *
+ */
+static uint8_t eclifile_connect(ecli_broker_t *broker, ecli_conf_t *conf, const char *resume_topic);
+
+/**********************************************************************/
+/** Sending session thread
+ *
+ * @param arg: eclifile_job_t.
+ *
+ */
+static void *eclifile_job(void *arg);
+
+/**********************************************************************/
+/** Take next pending blocks, at most max_blocks, under tx lock. Returns
+ * number of blocks, 0 when nothing is pending.
+ *
+ * @param tx: sender.
+ * @param max_blocks: chunk size in blocks.
+ * @param first: first block output.
+ *
+ */
+static uint32_t eclifile_take(eclifile_tx_t *tx, uint32_t max_blocks, uint32_t *first);
+
+/**********************************************************************/
+/** Mark blocks pending again, under tx lock
+ *
+ * @param tx: sender.
+ * @param first: first block.
+ * @param count: number of blocks.
+ *
+ */
+static void eclifile_requeue(eclifile_tx_t *tx, uint32_t first, uint32_t count);
+
+/**********************************************************************/
+/** Apply resume request, returns ranges, 0 when transfer is complete or
+ * -1 when request is not for this transfer.
+ *
+ * @param tx: sender.
+ * @param msg: resume message.
+ * @param len: message size.
+ *
+ */
+static int32_t eclifile_resend(eclifile_tx_t *tx, const uint8_t *msg, uint32_t len);
+
+/**********************************************************************/
+/** Open receiver state for transfer head, reusing state file when it
+ * matches. head NULL only loads an existing state file.
+ *
+ * @param conf: structure that contains the user config options for broker conn.
+ * @param head: transfer id, size and topic.
+ *
+ */
+static int8_t eclifile_rx_open(ecli_conf_t *conf, const eclifile_state_t *head);
+
+/**********************************************************************/
+/** Close receiver files
+ *
+ */
+static void eclifile_rx_close(void);
+
+/**********************************************************************/
+/** Publish missing ranges of receiver, none when complete
+ *
+ * @param broker: structure that contains the client connection info with broker
+ * @param conf: structure that contains the user config options for broker conn.
+ * @param id: transfer id.
+ * @param topic: file topic.
+ *
+ */
+static uint8_t eclifile_rx_request(ecli_broker_t *broker, ecli_conf_t *conf,
+                                   uint32_t id, const char *topic);
+
+/**********************************************************************/
+/** Finish transfer when all blocks are received, returns 1 when done
+ *
+ * @param broker: structure that contains the client connection info with broker
+ * @param conf: structure that contains the user config options for broker conn.
+ *
+ */
+static int8_t eclifile_rx_complete(ecli_broker_t *broker, ecli_conf_t *conf);
+
+/**********************************************************************/
+/**********************************************************************/
+/** Send file conf->msg_txt in chunks from conf->file_jobs sessions,
+ * broker session serves resume requests until done.
+ *
+ * @param broker: structure that contains the client connection info with broker
+ * @param conf: structure that contains the user config options for broker conn.
+ *
+ */
+uint8_t eclifile_send(ecli_broker_t *broker, ecli_conf_t *conf) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    char     buffer_str[CLI_BUF_SIZE] = {0};
+    char     resume_topic[CLI_TOPIC_LEN + sizeof( FILE_RESUME_TOPIC )] = {0};
+    char     topic[CLI_TOPIC_LEN] = {0};
+    char     path[CLI_PATH_LEN] = {0};
+    char     name[CLI_PATH_LEN] = {0};
+    uint8_t  id_buffer[CLI_PATH_LEN + 16] = {0};
+    uint8_t  end[FILE_HEADER_LEN];
+    uint8_t  *msg_buffer  = NULL;
+    uint8_t  return_code  = CLI_NO_ERROR;
+    uint8_t  idle         = 0;
+    uint32_t msg_len      = 0;
+    uint32_t name_len     = 0;
+    uint32_t alive        = 0;
+    uint32_t i            = 0;
+    int32_t  ranges       = 0;
+    uint64_t start_ns     = eclimetrics_now();
+    uint64_t now_ns       = 0;
+    uint64_t end_ns       = 0;
+    uint64_t linger_ns    = 0;
+    uint64_t ping_ns      = start_ns;
+    double   secs         = 0;
+    struct stat   file_stat;
+    eclifile_tx_t tx;
+    eclifile_header_t header;
+    eclifile_job_t jobs[FILE_JOBS_MAX];
+
+    memset( &tx, 0, sizeof( tx ) );
+    tx.broker = broker;
+    tx.conf = conf;
+    if ( ( tx.fd = open( conf->msg_txt, O_RDONLY ) ) < 0 || fstat( tx.fd, &file_stat ) < 0 ) {
+        if ( tx.fd >= 0 ) {
+            close( tx.fd );
+        }
+        return CLI_FILE_ERROR;
+    }
+    tx.size = file_stat.st_size;
+    tx.blocks = FILE_BLOCKS( tx.size );
+    /* Same file, same id: a restarted sender resumes the receivers */
+    strncpy( path, conf->msg_txt, sizeof( path ) - 1 );
+    strncpy( name, path, sizeof( name ) - 1 );
+    name_len = strlen( basename( name ) );
+    memcpy( id_buffer, basename( name ), name_len );
+    eclihash_put64( id_buffer + name_len, tx.size );
+    eclihash_put64( id_buffer + name_len + 8, file_stat.st_mtime );
+    tx.id = eclihash_crc32c( 0, id_buffer, name_len + 16 );
+    if ( ( tx.pending = malloc( tx.blocks / 8 + 1 ) ) == NULL ||
+         ( msg_buffer = malloc( CLI_MAX_MSG_SIZE ) ) == NULL ) {
+        free( tx.pending );
+        close( tx.fd );
+        return CLI_FILE_ERROR;
+    }
+    memset( tx.pending, CLI_BYTE, tx.blocks / 8 + 1 );
+    pthread_mutex_init( &tx.lock, NULL );
+    pthread_cond_init( &tx.cond, NULL );
+
+    snprintf( resume_topic, sizeof( resume_topic ), "%s%s", broker->topic, FILE_RESUME_TOPIC );
+    if ( ( return_code = eclifile_connect( broker, conf, resume_topic ) ) != CLI_NO_ERROR ) {
+        goto send_end;
+    }
+    sprintf(buffer_str, FILE_SEND_MSG, path, ( unsigned long long ) tx.size, conf->file_jobs);
+    eclilog_show(__FILE__, __func__, buffer_str, LOG_INFO);
+
+    /* Sending sessions */
+    for ( i = 0; i < conf->file_jobs; i++ ) {
+        jobs[i].tx = &tx;
+        jobs[i].num = i + 1;
+        tx.alive++;
+        if ( pthread_create( &jobs[i].thread, NULL, eclifile_job, &jobs[i] ) != 0 ) {
+            tx.alive--;
+            break;
+        }
+    }
+    memset( &header, 0, sizeof( header ) );
+    header.flags = FILE_FLAG_END;
+    header.id = tx.id;
+    header.size = tx.size;
+    eclifile_encode( end, &header );
+
+    /* Control session: end markers, resume requests, keep alive */
+    for ( ;; ) {
+        pthread_mutex_lock( &tx.lock );
+        idle = ( tx.cursor >= tx.blocks && tx.busy == 0 );
+        alive = tx.alive;
+        pthread_mutex_unlock( &tx.lock );
+        if ( alive == 0 ) {
+            return_code = tx.error ? tx.error : CLI_PUBLISH_ERROR;
+            break;
+        }
+        now_ns = eclimetrics_now();
+        if ( idle ) {
+            if ( end_ns == 0 || now_ns - end_ns >= FILE_END_PERIOD ) {
+                eclifile_publish( broker, conf, broker->topic, end, sizeof( end ) );
+                end_ns = now_ns;
+                if ( linger_ns == 0 ) {
+                    linger_ns = now_ns;
+                }
+            }
+            if ( now_ns - linger_ns > conf->file_linger * 1000000000ULL ) {
+                sprintf(buffer_str, FILE_LINGER_MSG, conf->file_linger);
+                eclilog_show(__FILE__, __func__, buffer_str, LOG_INFO);
+                break;
+            }
+        }
+        if ( broker->alive && now_ns - ping_ns > broker->alive * 500000000ULL ) {
+            eclimqtt_pingreq( broker );
+            ping_ns = now_ns;
+        }
+        return_code = ecli_read_get_msg( broker, conf, topic, msg_buffer, &msg_len, 1 );
+        if ( return_code == CLI_READ_TIMEOUT_ERROR ) {
+            continue;
+        }
+        if ( return_code != CLI_NO_ERROR ) {
+            ecli_show_error( return_code );
+            ecli_close( broker );
+            if ( ( return_code = eclifile_connect( broker, conf, resume_topic ) ) != CLI_NO_ERROR ) {
+                break;
+            }
+            continue;
+        }
+        if ( msg_len == 0 || strcmp( topic, resume_topic ) != EQUAL_STR_CMP ||
+             ( ranges = eclifile_resend( &tx, msg_buffer, msg_len ) ) < 0 ) {
+            continue;
+        }
+        if ( ranges == 0 ) {
+            break;
+        }
+        sprintf(buffer_str, FILE_RESEND_MSG, ranges);
+        eclilog_show(__FILE__, __func__, buffer_str, LOG_DEBUG);
+        /* Serve file_linger more secs from last request */
+        end_ns = 0;
+        linger_ns = 0;
+    }
+
+    pthread_mutex_lock( &tx.lock );
+    tx.stop = TRUE_FLAG;
+    pthread_cond_broadcast( &tx.cond );
+    pthread_mutex_unlock( &tx.lock );
+    for ( ; i > 0; i-- ) {
+        pthread_join( jobs[i - 1].thread, NULL );
+    }
+    secs = ( eclimetrics_now() - start_ns ) / 1e9;
+    sprintf(buffer_str, FILE_SENT_MSG, path, ( unsigned long long ) tx.bytes, secs,
+            secs > 0 ? tx.bytes / secs / 1048576 : 0);
+    eclilog_show(__FILE__, __func__, buffer_str, LOG_INFO);
+
+send_end:
+    pthread_cond_destroy( &tx.cond );
+    pthread_mutex_destroy( &tx.lock );
+    free( msg_buffer );
+    free( tx.pending );
+    close( tx.fd );
+
+    return return_code;
+}
+
+/**********************************************************************/
+/** Receive chunk into conf->datafile_path, returns 1 when the file is
+ * complete, 0 when more chunks are needed, -1 on file error.
+ *
+ * @param broker: structure that contains the client connection info with broker
+ * @param conf: structure that contains the user config options for broker conn.
+ * @param topic: topic of message.
+ * @param msg: message payload.
+ * @param msg_len: message size.
+ *
+ */
+int8_t eclifile_recv(ecli_broker_t *broker, ecli_conf_t *conf, const char *topic,
+                     const uint8_t *msg, uint32_t msg_len) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    char     buffer_str[CLI_BUF_SIZE] = {0};
+    uint32_t first      = 0;
+    uint32_t last       = 0;
+    uint32_t block      = 0;
+    uint32_t written    = 0;
+    int32_t  bytes      = 0;
+    eclifile_header_t header;
+    eclifile_state_t  head;
+
+    if ( eclifile_decode( msg, msg_len, &header ) < CLI_NO_ERROR ) {
+        return 0;
+    }
+    /* Already complete, tell a sender still serving it */
+    if ( header.id == file_rx.done_id && file_rx.fd < 0 ) {
+        if ( header.flags & FILE_FLAG_END ) {
+            eclifile_rx_request( broker, conf, header.id, topic );
+        }
+        return 0;
+    }
+    if ( file_rx.fd < 0 || file_rx.head.id != header.id ) {
+        memset( &head, 0, sizeof( head ) );
+        memcpy( head.magic, FILE_STATE_MAGIC, sizeof( head.magic ) );
+        head.id = header.id;
+        head.size = header.size;
+        strncpy( head.topic, topic, sizeof( head.topic ) - 1 );
+        if ( eclifile_rx_open( conf, &head ) < CLI_NO_ERROR ) {
+            return -1;
+        }
+    }
+    if ( header.flags & FILE_FLAG_END ) {
+        /* End of pass, ask for what is missing */
+        if ( file_rx.missing ) {
+            eclifile_rx_request( broker, conf, header.id, file_rx.head.topic );
+        }
+        return eclifile_rx_complete( broker, conf );
+    }
+
+    /* Block aligned, inside file, whole blocks but the last one */
+    if ( header.offset % FILE_BLOCK_SIZE || header.len == 0 || header.offset >= file_rx.head.size ||
+         header.len > file_rx.head.size - header.offset ||
+         ( header.len % FILE_BLOCK_SIZE && header.offset + header.len != file_rx.head.size ) ||
+         eclihash_crc32c( 0, msg + FILE_HEADER_LEN, header.len ) != header.crc ) {
+        sprintf(buffer_str, FILE_CRC_ERROR, ( unsigned long long ) header.offset);
+        eclilog_show(__FILE__, __func__, buffer_str, LOG_ERROR);
+        return 0;
+    }
+    while ( written < header.len ) {
+        if ( ( bytes = pwrite( file_rx.fd, msg + FILE_HEADER_LEN + written, header.len - written,
+                               header.offset + written ) ) < 0 ) {
+            if ( errno == EINTR ) {
+                continue;
+            }
+            sprintf(buffer_str, FILE_STATE_ERROR, conf->datafile_path, strerror( errno ));
+            eclilog_show(__FILE__, __func__, buffer_str, LOG_ERROR);
+            return -1;
+        }
+        written += bytes;
+    }
+    /* Data first, then its blocks in the bitmap */
+    first = header.offset / FILE_BLOCK_SIZE;
+    last = FILE_BLOCKS( header.offset + header.len ) - 1;
+    for ( block = first; block <= last; block++ ) {
+        if ( !FILE_BIT_GET( file_rx.bitmap, block ) ) {
+            FILE_BIT_SET( file_rx.bitmap, block );
+            file_rx.missing--;
+        }
+    }
+    if ( pwrite( file_rx.state_fd, file_rx.bitmap + first / 8, last / 8 - first / 8 + 1,
+                 sizeof( eclifile_state_t ) + first / 8 ) < 0 ) {
+        sprintf(buffer_str, FILE_STATE_ERROR, conf->datafile_path, strerror( errno ));
+        eclilog_show(__FILE__, __func__, buffer_str, LOG_ERROR);
+    }
+
+    return eclifile_rx_complete( broker, conf );
+}
+
+/**********************************************************************/
+/** Request missing ranges of an unfinished transfer (after connect).
+ *
+ * @param broker: structure that contains the client connection info with broker
+ * @param conf: structure that contains the user config options for broker conn.
+ *
+ */
+void eclifile_resume(ecli_broker_t *broker, ecli_conf_t *conf) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    char buffer_str[CLI_BUF_SIZE] = {0};
+
+    if ( file_rx.fd < 0 && eclifile_rx_open( conf, NULL ) < CLI_NO_ERROR ) {
+        return;
+    }
+    sprintf(buffer_str, FILE_RESUME_MSG, conf->datafile_path, file_rx.missing, file_rx.blocks);
+    eclilog_show(__FILE__, __func__, buffer_str, LOG_INFO);
+    eclifile_rx_request( broker, conf, file_rx.head.id, file_rx.head.topic );
+}
+
+/**********************************************************************/
+/**********************************************************************/
+/** Encode chunk header, big endian
+ *
+ * @param buffer: FILE_HEADER_LEN bytes output.
+ * @param header: header values.
+ *
+ */
+static void eclifile_encode(uint8_t *buffer, const eclifile_header_t *header) {
+
+    buffer[0] = 'E';
+    buffer[1] = 'F';
+    buffer[2] = FILE_VERSION;
+    buffer[3] = header->flags;
+    eclihash_put32( buffer + 4, header->id );
+    eclihash_put64( buffer + 8, header->size );
+    eclihash_put64( buffer + 16, header->offset );
+    eclihash_put32( buffer + 24, header->len );
+    eclihash_put32( buffer + 28, header->crc );
+}
+
+/**********************************************************************/
+/** Decode chunk header, returns -1 when payload is not a chunk
+ *
+ * @param buffer: payload.
+ * @param len: payload size.
+ * @param header: header values output.
+ *
+ */
+static int8_t eclifile_decode(const uint8_t *buffer, uint32_t len, eclifile_header_t *header) {
+
+    if ( len < FILE_HEADER_LEN || buffer[0] != 'E' || buffer[1] != 'F' || buffer[2] != FILE_VERSION ) {
+        return -1;
+    }
+    header->flags = buffer[3];
+    header->id = eclihash_get32( buffer + 4 );
+    header->size = eclihash_get64( buffer + 8 );
+    header->offset = eclihash_get64( buffer + 16 );
+    header->len = eclihash_get32( buffer + 24 );
+    header->crc = eclihash_get32( buffer + 28 );
+    if ( !( header->flags & FILE_FLAG_END ) && header->len != len - FILE_HEADER_LEN ) {
+        return -1;
+    }
+
+    return CLI_NO_ERROR;
+}
+
+/**********************************************************************/
+/** Publish QOS0 control message to topic from session
+ *
+ * @param broker: structure that contains the client connection info with broker
+ * @param conf: structure that contains the user config options for broker conn.
+ * @param topic: topic to publish.
+ * @param buffer: message.
+ * @param len: message size.
+ *
+ */
+static uint8_t eclifile_publish(ecli_broker_t *broker, ecli_conf_t *conf, const char *topic,
+                                const uint8_t *buffer, uint32_t len) {
+
+    char     broker_topic[CLI_TOPIC_LEN];
+    uint8_t  qos         = broker->qos;
+    uint8_t  retain      = broker->retain;
+    uint8_t  return_code = CLI_NO_ERROR;
+
+    /* No ack to wait for, the session also reads data or requests */
+    memcpy( broker_topic, broker->topic, sizeof( broker_topic ) );
+    strncpy( broker->topic, topic, sizeof( broker->topic ) - 1 );
+    broker->qos = 0;
+    broker->retain = 0;
+    return_code = eclimqtt_publish_chunk( broker, conf, buffer, len );
+    memcpy( broker->topic, broker_topic, sizeof( broker_topic ) );
+    broker->qos = qos;
+    broker->retain = retain;
+
+    return return_code;
+}
+
+/**********************************************************************/
+/** (Re)connect session, subscribing to resume requests for control session
+ *
+ * @param broker: structure that contains the client connection info with broker
+ * @param conf: structure that contains the user config options for broker conn.
+ * @param resume_topic: topic to subscribe, NULL for sending sessions.
+ *
+ */
+static uint8_t eclifile_connect(ecli_broker_t *broker, ecli_conf_t *conf, const char *resume_topic) {
+
+    char    broker_topic[CLI_TOPIC_LEN];
+    uint8_t return_code = CLI_NO_ERROR;
+
+    if ( broker->transport.ops->fd( &broker->transport ) < 0 ) {
+        if ( ( return_code = ecli_init( broker, conf ) ) != CLI_NO_ERROR ||
+             ( return_code = eclimqtt_connect( broker, conf ) ) != CLI_NO_ERROR ) {
+            ecli_show_error( return_code );
+            return return_code;
+        }
+    }
+    if ( resume_topic ) {
+        memcpy( broker_topic, broker->topic, sizeof( broker_topic ) );
+        strncpy( broker->topic, resume_topic, sizeof( broker->topic ) - 1 );
+        return_code = eclimqtt_subscribe( broker, conf );
+        memcpy( broker->topic, broker_topic, sizeof( broker_topic ) );
+        if ( return_code != CLI_NO_ERROR ) {
+            ecli_show_error( return_code );
+        }
+    }
+
+    return return_code;
+}
+
+/**********************************************************************/
+/** Sending session thread
+ *
+ * @param arg: eclifile_job_t.
+ *
+ */
+static void *eclifile_job(void *arg) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    eclifile_job_t *job   = arg;
+    eclifile_tx_t  *tx    = job->tx;
+    ecli_broker_t  *broker = malloc( sizeof( ecli_broker_t ) );
+    ecli_conf_t    *conf  = malloc( sizeof( ecli_conf_t ) );
+    uint8_t  *buffer      = malloc( FILE_HEADER_LEN + FILE_CHUNK_MAX );
+    uint8_t  connected    = FALSE_FLAG;
+    uint8_t  return_code  = CLI_NO_ERROR;
+    uint32_t chunk        = FILE_CHUNK_MIN;
+    uint32_t first        = 0;
+    uint32_t count        = 0;
+    uint32_t len          = 0;
+    uint32_t target       = 0;
+    int32_t  bytes        = 0;
+    uint64_t start_ns     = 0;
+    uint64_t elapsed_ns   = 0;
+    uint64_t min_ns       = 0;
+    uint64_t last_ns      = eclimetrics_now();
+    double   rate         = 0;
+    struct timespec   wait;
+    eclifile_header_t header;
+
+    if ( broker && conf && buffer ) {
+        /* Own session: client id, socket, metrics and packet buffers */
+        *broker = *tx->broker;
+        *conf = *tx->conf;
+        snprintf( broker->client_id, sizeof( broker->client_id ), "%.*s-%u",
+                  ( int ) sizeof( broker->client_id ) - 12, tx->broker->client_id, job->num );
+        broker->connect_packet = NULL;
+        broker->will_flag = FALSE_FLAG;
+        broker->retain = FALSE_FLAG;
+        broker->rx_pending = 0;
+        broker->transport.socketid = -1;
+        broker->transport.ctx = NULL;
+        broker->metrics = eclimetrics_new( broker->client_id );
+        connected = ( eclifile_connect( broker, conf, NULL ) == CLI_NO_ERROR );
+    }
+
+    pthread_mutex_lock( &tx->lock );
+    while ( connected && !tx->stop ) {
+        if ( ( count = eclifile_take( tx, chunk / FILE_BLOCK_SIZE, &first ) ) == 0 ) {
+            clock_gettime( CLOCK_REALTIME, &wait );
+            wait.tv_sec++;
+            pthread_cond_timedwait( &tx->cond, &tx->lock, &wait );
+            /* Idle session keep alive, read PINGRESP before next ack */
+            if ( broker->alive && eclimetrics_now() - last_ns > broker->alive * 500000000ULL ) {
+                pthread_mutex_unlock( &tx->lock );
+                if ( eclimqtt_pingreq( broker ) == CLI_NO_ERROR ) {
+                    ecli_read_header( broker, conf );
+                }
+                last_ns = eclimetrics_now();
+                pthread_mutex_lock( &tx->lock );
+            }
+            continue;
+        }
+        tx->busy++;
+        pthread_mutex_unlock( &tx->lock );
+
+        memset( &header, 0, sizeof( header ) );
+        header.id = tx->id;
+        header.size = tx->size;
+        header.offset = ( uint64_t ) first * FILE_BLOCK_SIZE;
+        len = count * FILE_BLOCK_SIZE;
+        if ( header.offset + len > tx->size ) {
+            len = tx->size - header.offset;
+        }
+        header.len = 0;
+        while ( header.len < len ) {
+            if ( ( bytes = pread( tx->fd, buffer + FILE_HEADER_LEN + header.len, len - header.len,
+                                  header.offset + header.len ) ) <= 0 ) {
+                if ( bytes < 0 && errno == EINTR ) {
+                    continue;
+                }
+                break;
+            }
+            header.len += bytes;
+        }
+        if ( header.len < len ) {
+            pthread_mutex_lock( &tx->lock );
+            tx->busy--;
+            tx->error = CLI_FILE_ERROR;
+            tx->stop = TRUE_FLAG;
+            break;
+        }
+        header.crc = eclihash_crc32c( 0, buffer + FILE_HEADER_LEN, len );
+        eclifile_encode( buffer, &header );
+
+        start_ns = eclimetrics_now();
+        return_code = eclimqtt_publish_chunk( broker, conf, buffer, FILE_HEADER_LEN + len );
+        last_ns = eclimetrics_now();
+        elapsed_ns = last_ns - start_ns;
+
+        if ( return_code != CLI_NO_ERROR ) {
+            ecli_show_error( return_code );
+            pthread_mutex_lock( &tx->lock );
+            tx->busy--;
+            eclifile_requeue( tx, first, count );
+            pthread_cond_broadcast( &tx->cond );
+            pthread_mutex_unlock( &tx->lock );
+            /* Start small again on the new connection */
+            chunk = FILE_CHUNK_MIN;
+            min_ns = 0;
+            rate = 0;
+            ecli_close( broker );
+            connected = ( eclifile_connect( broker, conf, NULL ) == CLI_NO_ERROR );
+            pthread_mutex_lock( &tx->lock );
+            continue;
+        }
+
+        /* Chunk takes FILE_RTT_FACTOR times the fastest publish at the
+           measured throughput: per chunk cost (ack RTT) stays small */
+        if ( elapsed_ns ) {
+            if ( min_ns == 0 || elapsed_ns < min_ns ) {
+                min_ns = elapsed_ns;
+            }
+            rate = rate ? ( rate * ( FILE_RATE_EWMA - 1 ) + len * 1e9 / elapsed_ns ) / FILE_RATE_EWMA :
+                          len * 1e9 / elapsed_ns;
+            target = rate * min_ns / 1e9 * FILE_RTT_FACTOR;
+            target = target < FILE_CHUNK_MIN ? FILE_CHUNK_MIN : target > FILE_CHUNK_MAX ? FILE_CHUNK_MAX : target;
+            chunk = target - target % FILE_BLOCK_SIZE;
+        }
+
+        pthread_mutex_lock( &tx->lock );
+        tx->busy--;
+        tx->bytes += len;
+    }
+    tx->alive--;
+    pthread_cond_broadcast( &tx->cond );
+    pthread_mutex_unlock( &tx->lock );
+
+    if ( connected ) {
+        eclimqtt_disconnect( broker );
+        ecli_close( broker );
+    }
+    if ( broker && conf && buffer ) {
+        eclimetrics_free( broker->metrics );
+    }
+    free( buffer );
+    free( conf );
+    free( broker );
+
+    return NULL;
+}
+
+/**********************************************************************/
+/** Take next pending blocks, at most max_blocks, under tx lock. Returns
+ * number of blocks, 0 when nothing is pending.
+ *
+ * @param tx: sender.
+ * @param max_blocks: chunk size in blocks.
+ * @param first: first block output.
+ *
+ */
+static uint32_t eclifile_take(eclifile_tx_t *tx, uint32_t max_blocks, uint32_t *first) {
+
+    uint32_t count = 0;
+
+    while ( tx->cursor < tx->blocks && !FILE_BIT_GET( tx->pending, tx->cursor ) ) {
+        /* Skip whole bytes already sent */
+        if ( ( tx->cursor & 7 ) == 0 && tx->pending[ tx->cursor >> 3 ] == 0 ) {
+            tx->cursor += 8;
+            continue;
+        }
+        tx->cursor++;
+    }
+    if ( tx->cursor >= tx->blocks ) {
+        tx->cursor = tx->blocks;
+        return 0;
+    }
+    *first = tx->cursor;
+    while ( tx->cursor < tx->blocks && count < max_blocks && FILE_BIT_GET( tx->pending, tx->cursor ) ) {
+        FILE_BIT_CLR( tx->pending, tx->cursor );
+        tx->cursor++;
+        count++;
+    }
+
+    return count;
+}
+
+/**********************************************************************/
+/** Mark blocks pending again, under tx lock
+ *
+ * @param tx: sender.
+ * @param first: first block.
+ * @param count: number of blocks.
+ *
+ */
+static void eclifile_requeue(eclifile_tx_t *tx, uint32_t first, uint32_t count) {
+
+    uint32_t block = 0;
+
+    for ( block = first; block < first + count && block < tx->blocks; block++ ) {
+        FILE_BIT_SET( tx->pending, block );
+    }
+    if ( first < tx->cursor ) {
+        tx->cursor = first;
+    }
+}
+
+/**********************************************************************/
+/** Apply resume request, returns ranges, 0 when transfer is complete or
+ * -1 when request is not for this transfer.
+ *
+ * @param tx: sender.
+ * @param msg: resume message.
+ * @param len: message size.
+ *
+ */
+static int32_t eclifile_resend(eclifile_tx_t *tx, const uint8_t *msg, uint32_t len) {
+
+    uint32_t count  = 0;
+    uint32_t i      = 0;
+    uint64_t offset = 0;
+    uint64_t range  = 0;
+
+    if ( len < FILE_RESUME_LEN || msg[0] != 'E' || msg[1] != 'R' || msg[2] != FILE_VERSION ||
+         eclihash_get32( msg + 4 ) != tx->id ) {
+        return -1;
+    }
+    count = eclihash_get32( msg + 8 );
+    if ( count > ( len - FILE_RESUME_LEN ) / FILE_RANGE_LEN ) {
+        return -1;
+    }
+    pthread_mutex_lock( &tx->lock );
+    for ( i = 0; i < count; i++ ) {
+        offset = eclihash_get64( msg + FILE_RESUME_LEN + i * FILE_RANGE_LEN );
+        range = eclihash_get32( msg + FILE_RESUME_LEN + i * FILE_RANGE_LEN + 8 );
+        if ( offset >= tx->size || range == 0 ) {
+            continue;
+        }
+        eclifile_requeue( tx, offset / FILE_BLOCK_SIZE,
+                          FILE_BLOCKS( offset + range ) - offset / FILE_BLOCK_SIZE );
+    }
+    pthread_cond_broadcast( &tx->cond );
+    pthread_mutex_unlock( &tx->lock );
+
+    return count;
+}
+
+/**********************************************************************/
+/** Open receiver state for transfer head, reusing state file when it
+ * matches. head NULL only loads an existing state file.
+ *
+ * @param conf: structure that contains the user config options for broker conn.
+ * @param head: transfer id, size and topic.
+ *
+ */
+static int8_t eclifile_rx_open(ecli_conf_t *conf, const eclifile_state_t *head) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    char     buffer_str[CLI_BUF_SIZE] = {0};
+    char     state_path[CLI_PATH_LEN + sizeof( FILE_STATE_SUFFIX )] = {0};
+    uint8_t  resumed = FALSE_FLAG;
+    uint32_t block   = 0;
+    uint32_t map_len = 0;
+    eclifile_state_t saved;
+
+    eclifile_rx_close();
+    snprintf( state_path, sizeof( state_path ), "%s%s", conf->datafile_path, FILE_STATE_SUFFIX );
+
+    /* State of an unfinished transfer of the same file */
+    if ( ( file_rx.state_fd = open( state_path, O_RDWR ) ) >= 0 &&
+         pread( file_rx.state_fd, &saved, sizeof( saved ), 0 ) == sizeof( saved ) &&
+         memcmp( saved.magic, FILE_STATE_MAGIC, sizeof( saved.magic ) ) == EQUAL_STR_CMP &&
+         ( head == NULL || ( saved.id == head->id && saved.size == head->size ) ) ) {
+        file_rx.head = saved;
+        file_rx.head.topic[ sizeof( file_rx.head.topic ) - 1 ] = '\0';
+        file_rx.blocks = FILE_BLOCKS( file_rx.head.size );
+        map_len = file_rx.blocks / 8 + 1;
+        if ( ( file_rx.bitmap = calloc( 1, map_len ) ) != NULL &&
+             ( file_rx.fd = open( conf->datafile_path, O_RDWR ) ) >= 0 &&
+             pread( file_rx.state_fd, file_rx.bitmap, map_len, sizeof( saved ) ) == map_len ) {
+            resumed = TRUE_FLAG;
+        }
+    }
+
+    /* New transfer: preallocated output and empty bitmap */
+    if ( !resumed ) {
+        eclifile_rx_close();
+        if ( head == NULL ) {
+            return -1;
+        }
+        file_rx.head = *head;
+        file_rx.blocks = FILE_BLOCKS( file_rx.head.size );
+        map_len = file_rx.blocks / 8 + 1;
+        if ( ( file_rx.bitmap = calloc( 1, map_len ) ) == NULL ||
+             ( file_rx.fd = open( conf->datafile_path, O_RDWR | O_CREAT | O_TRUNC, 0644 ) ) < 0 ||
+             ( posix_fallocate( file_rx.fd, 0, file_rx.head.size ) != 0 &&
+               ftruncate( file_rx.fd, file_rx.head.size ) < 0 ) ||
+             ( file_rx.state_fd = open( state_path, O_RDWR | O_CREAT | O_TRUNC, 0644 ) ) < 0 ||
+             pwrite( file_rx.state_fd, &file_rx.head, sizeof( file_rx.head ), 0 ) != sizeof( file_rx.head ) ||
+             pwrite( file_rx.state_fd, file_rx.bitmap, map_len, sizeof( file_rx.head ) ) != map_len ) {
+            sprintf(buffer_str, FILE_STATE_ERROR, conf->datafile_path, strerror( errno ));
+            eclilog_show(__FILE__, __func__, buffer_str, LOG_ERROR);
+            eclifile_rx_close();
+            return -1;
+        }
+    }
+    file_rx.missing = 0;
+    for ( block = 0; block < file_rx.blocks; block++ ) {
+        if ( !FILE_BIT_GET( file_rx.bitmap, block ) ) {
+            file_rx.missing++;
+        }
+    }
+
+    return CLI_NO_ERROR;
+}
+
+/**********************************************************************/
+/** Close receiver files
+ *
+ */
+static void eclifile_rx_close(void) {
+
+    if ( file_rx.fd >= 0 ) {
+        close( file_rx.fd );
+    }
+    if ( file_rx.state_fd >= 0 ) {
+        close( file_rx.state_fd );
+    }
+    free( file_rx.bitmap );
+    file_rx.fd = -1;
+    file_rx.state_fd = -1;
+    file_rx.bitmap = NULL;
+}
+
+/**********************************************************************/
+/** Publish missing ranges of receiver, none when complete
+ *
+ * @param broker: structure that contains the client connection info with broker
+ * @param conf: structure that contains the user config options for broker conn.
+ * @param id: transfer id.
+ * @param topic: file topic.
+ *
+ */
+static uint8_t eclifile_rx_request(ecli_broker_t *broker, ecli_conf_t *conf,
+                                   uint32_t id, const char *topic) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    char     resume_topic[CLI_TOPIC_LEN + sizeof( FILE_RESUME_TOPIC )] = {0};
+    uint8_t  msg[FILE_RESUME_LEN + FILE_RESUME_RANGES * FILE_RANGE_LEN] = {0};
+    uint32_t count  = 0;
+    uint32_t block  = 0;
+    uint32_t first  = 0;
+    uint64_t offset = 0;
+    uint64_t len    = 0;
+
+    /* Missing blocks coalesced in ranges, the rest on next request */
+    if ( file_rx.fd >= 0 && file_rx.head.id == id ) {
+        while ( block < file_rx.blocks && count < FILE_RESUME_RANGES ) {
+            if ( FILE_BIT_GET( file_rx.bitmap, block ) ) {
+                block++;
+                continue;
+            }
+            first = block;
+            while ( block < file_rx.blocks && !FILE_BIT_GET( file_rx.bitmap, block ) &&
+                    ( uint64_t ) ( block - first ) * FILE_BLOCK_SIZE < FILE_RANGE_MAX ) {
+                block++;
+            }
+            offset = ( uint64_t ) first * FILE_BLOCK_SIZE;
+            len = ( uint64_t ) ( block - first ) * FILE_BLOCK_SIZE;
+            if ( offset + len > file_rx.head.size ) {
+                len = file_rx.head.size - offset;
+            }
+            eclihash_put64( msg + FILE_RESUME_LEN + count * FILE_RANGE_LEN, offset );
+            eclihash_put32( msg + FILE_RESUME_LEN + count * FILE_RANGE_LEN + 8, len );
+            count++;
+        }
+    }
+    msg[0] = 'E';
+    msg[1] = 'R';
+    msg[2] = FILE_VERSION;
+    eclihash_put32( msg + 4, id );
+    eclihash_put32( msg + 8, count );
+    snprintf( resume_topic, sizeof( resume_topic ), "%s%s", topic, FILE_RESUME_TOPIC );
+
+    return eclifile_publish( broker, conf, resume_topic, msg, FILE_RESUME_LEN + count * FILE_RANGE_LEN );
+}
+
+/**********************************************************************/
+/** Finish transfer when all blocks are received, returns 1 when done
+ *
+ * @param broker: structure that contains the client connection info with broker
+ * @param conf: structure that contains the user config options for broker conn.
+ *
+ */
+static int8_t eclifile_rx_complete(ecli_broker_t *broker, ecli_conf_t *conf) {
+
+    char buffer_str[CLI_BUF_SIZE] = {0};
+    char state_path[CLI_PATH_LEN + sizeof( FILE_STATE_SUFFIX )] = {0};
+
+    if ( file_rx.fd < 0 || file_rx.missing ) {
+        return 0;
+    }
+    /* Data on disk before the state that would resume it goes away */
+    fdatasync( file_rx.fd );
+    eclifile_rx_close();
+    snprintf( state_path, sizeof( state_path ), "%s%s", conf->datafile_path, FILE_STATE_SUFFIX );
+    unlink( state_path );
+    file_rx.done_id = file_rx.head.id;
+    sprintf(buffer_str, FILE_DONE_MSG, conf->datafile_path, ( unsigned long long ) file_rx.head.size);
+    eclilog_show(__FILE__, __func__, buffer_str, LOG_INFO);
+    eclifile_rx_request( broker, conf, file_rx.head.id, file_rx.head.topic );
+
+    return 1;
+}
@@ -0,0 +1,844 @@
+/***********************************************************************
+* FILENAME    :   libeclimqtthash.c
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   Library code for payload and chunk checksums
+*                 (CRC32C and xxHash3) with runtime CPU dispatch.
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+/**********************************************************************/
+
+#include <libeclimqtthash.h>
+
+/**********************************************************************/
+#define HASH_IMPL_LEN         64
+#define HASH_CRC32C_POLY      0x82F63B78
+#define HASH_STRIPE_LEN       64        /* xxHash3 accumulation input */
+#define HASH_SECRET_LEN       192       /* Default secret */
+#define HASH_SECRET_RATE      8         /* Secret bytes per stripe */
+#define HASH_BLOCK_STRIPES    ( ( HASH_SECRET_LEN - HASH_STRIPE_LEN ) / HASH_SECRET_RATE )
+#define HASH_BLOCK_LEN        ( HASH_STRIPE_LEN * HASH_BLOCK_STRIPES )
+#define HASH_LASTACC_START    7
+#define HASH_MERGEACCS_START  11
+#define HASH_MIDSIZE_MAX      240
+#define HASH_MIDSIZE_START    3
+#define HASH_MIDSIZE_LAST     17
+#define HASH_SECRET_SIZE_MIN  136
+#define HASH_PRIME32_1        0x9E3779B1U
+#define HASH_PRIME32_2        0x85EBCA77U
+#define HASH_PRIME32_3        0xC2B2AE3DU
+#define HASH_PRIME64_1        0x9E3779B185EBCA87ULL
+#define HASH_PRIME64_2        0xC2B2AE3D27D4EB4FULL
+#define HASH_PRIME64_3        0x165667B19E3779F9ULL
+#define HASH_PRIME64_4        0x85EBCA77C2B2AE63ULL
+#define HASH_PRIME64_5        0x27D4EB2F165667C5ULL
+#define HASH_PRIME_MX1        0x165667919E3779F9ULL
+#define HASH_PRIME_MX2        0x9FB21C651E98DF25ULL
+
+/**********************************************************************/
+/* CRC32C of buffer, crc already inverted */
+typedef uint32_t (*eclihash_crc_f)(uint32_t crc, const uint8_t *buffer, size_t len);
+/* xxHash3 accumulation of stripes, secret moves HASH_SECRET_RATE each stripe */
+typedef void (*eclihash_acc_f)(uint64_t *acc, const uint8_t *input, const uint8_t *secret, size_t stripes);
+/* xxHash3 accumulators scramble after each block */
+typedef void (*eclihash_scramble_f)(uint64_t *acc, const uint8_t *secret);
+
+/**********************************************************************/
+/* xxHash3 default secret */
+static const uint8_t hash_secret[HASH_SECRET_LEN] = {
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+    0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+    0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+    0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+    0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+    0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+    0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+    0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+    0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+/**********************************************************************/
+static pthread_once_t      hash_once = PTHREAD_ONCE_INIT;
+static uint32_t            hash_crc_table[8][256];
+static eclihash_crc_f      hash_crc;
+static eclihash_acc_f      hash_acc;
+static eclihash_scramble_f hash_scramble;
+static const char          *hash_crc_name;
+static const char          *hash_acc_name;
+static char                hash_impl_str[HASH_IMPL_LEN];
+
+/**********************************************************************/
+/**********************************************************************/
+/** Build CRC32C tables and pick implementations, once
+ *
+ */
+static void eclihash_init(void);
+
+/**********************************************************************/
+/** Pick implementations for the running CPU
+ *
+ * @param portable: TRUE_FLAG for portable code only.
+ *
+ */
+static void eclihash_select(uint8_t portable);
+
+/**********************************************************************/
+/** CRC32C, 8 bytes per step with tables (portable)
+ *
+ * @param crc: inverted crc.
+ * @param buffer: data.
+ * @param len: data size.
+ *
+ */
+static uint32_t eclihash_crc_table(uint32_t crc, const uint8_t *buffer, size_t len);
+
+/**********************************************************************/
+/** xxHash3 stripes and scramble (portable)
+ *
+ * @param acc: 8 accumulators.
+ * @param input: stripes.
+ * @param secret: secret of first stripe.
+ * @param stripes: number of stripes.
+ *
+ */
+static void eclihash_acc_scalar(uint64_t *acc, const uint8_t *input, const uint8_t *secret, size_t stripes);
+static void eclihash_scramble_scalar(uint64_t *acc, const uint8_t *secret);
+
+#if defined(__x86_64__)
+/**********************************************************************/
+/** CRC32C with SSE4.2 crc32 instruction
+ *
+ * @param crc: inverted crc.
+ * @param buffer: data.
+ * @param len: data size.
+ *
+ */
+static uint32_t eclihash_crc_sse42(uint32_t crc, const uint8_t *buffer, size_t len);
+
+/**********************************************************************/
+/** xxHash3 stripes and scramble, 2 (SSE2) or 4 (AVX2) lanes at once
+ *
+ * @param acc: 8 accumulators.
+ * @param input: stripes.
+ * @param secret: secret of first stripe.
+ * @param stripes: number of stripes.
+ *
+ */
+static void eclihash_acc_sse2(uint64_t *acc, const uint8_t *input, const uint8_t *secret, size_t stripes);
+static void eclihash_scramble_sse2(uint64_t *acc, const uint8_t *secret);
+static void eclihash_acc_avx2(uint64_t *acc, const uint8_t *input, const uint8_t *secret, size_t stripes);
+static void eclihash_scramble_avx2(uint64_t *acc, const uint8_t *secret);
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+/**********************************************************************/
+/** CRC32C with ARMv8 crc32c instructions
+ *
+ * @param crc: inverted crc.
+ * @param buffer: data.
+ * @param len: data size.
+ *
+ */
+static uint32_t eclihash_crc_armv8(uint32_t crc, const uint8_t *buffer, size_t len);
+#endif
+
+/**********************************************************************/
+/** xxHash3 of inputs bigger than HASH_MIDSIZE_MAX
+ *
+ * @param input: data.
+ * @param len: data size.
+ *
+ */
+static uint64_t eclihash_xxh3_long(const uint8_t *input, size_t len);
+
+/**********************************************************************/
+/** xxHash3 of inputs up to HASH_MIDSIZE_MAX
+ *
+ * @param input: data.
+ * @param len: data size.
+ *
+ */
+static uint64_t eclihash_xxh3_short(const uint8_t *input, size_t len);
+
+/**********************************************************************/
+/** xxHash3 helpers: 16 bytes mix, 64x64->128 fold, avalanches
+ *
+ */
+static uint64_t eclihash_mix16(const uint8_t *input, const uint8_t *secret);
+static uint64_t eclihash_fold64(uint64_t lhs, uint64_t rhs);
+static uint64_t eclihash_avalanche(uint64_t hash);
+static uint64_t eclihash_avalanche64(uint64_t hash);
+static uint64_t eclihash_rrmxmx(uint64_t hash, uint64_t len);
+
+/**********************************************************************/
+/** Little endian reads
+ *
+ * @param buffer: data.
+ *
+ */
+static uint32_t eclihash_read32(const uint8_t *buffer);
+static uint64_t eclihash_read64(const uint8_t *buffer);
+
+/**********************************************************************/
+/**********************************************************************/
+/** Get checksum from name ("crc32c", "xxh3", "none").
+ *
+ * @param name: checksum name.
+ *
+ */
+ecli_hash_t eclihash_from_name(const char *name) {
+
+    if ( strcmp( name, HASH_CRC32C_NAME ) == 0 ) {
+        return HASH_CRC32C;
+    }
+    if ( strcmp( name, HASH_XXH3_NAME ) == 0 ) {
+        return HASH_XXH3;
+    }
+
+    return HASH_NONE;
+}
+
+/**********************************************************************/
+/** CRC32C (Castagnoli) of buffer
+ *
+ * @param crc: previous crc, 0 to start.
+ * @param buffer: data.
+ * @param len: data size.
+ *
+ */
+uint32_t eclihash_crc32c(uint32_t crc, const void *buffer, size_t len) {
+
+    pthread_once( &hash_once, eclihash_init );
+
+    return ~hash_crc( ~crc, ( const uint8_t * ) buffer, len );
+}
+
+/**********************************************************************/
+/** xxHash3 64 bits of buffer (seed 0)
+ *
+ * @param buffer: data.
+ * @param len: data size.
+ *
+ */
+uint64_t eclihash_xxh3(const void *buffer, size_t len) {
+
+    if ( len <= HASH_MIDSIZE_MAX ) {
+        return eclihash_xxh3_short( ( const uint8_t * ) buffer, len );
+    }
+    pthread_once( &hash_once, eclihash_init );
+
+    return eclihash_xxh3_long( ( const uint8_t * ) buffer, len );
+}
+
+/**********************************************************************/
+/** Write trailer of payload, returns trailer size (0 with HASH_NONE).
+ *
+ * @param hash: checksum type.
+ * @param buffer: payload.
+ * @param len: payload size.
+ * @param trailer: HASH_TRAILER_MAX bytes output.
+ *
+ */
+uint8_t eclihash_put(ecli_hash_t hash, const void *buffer, size_t len, uint8_t *trailer) {
+
+    uint8_t  size  = 0;
+
+    if ( hash == HASH_CRC32C ) {
+        eclihash_put32( trailer, eclihash_crc32c( 0, buffer, len ) );
+        size = 4;
+    }
+    else if ( hash == HASH_XXH3 ) {
+        eclihash_put64( trailer, eclihash_xxh3( buffer, len ) );
+        size = 8;
+    }
+    else {
+        return 0;
+    }
+    trailer[size] = HASH_TAG | hash;
+
+    return size + 1;
+}
+
+/**********************************************************************/
+/** Check trailer of payload (any type), returns payload size without
+ * trailer or -1 when there is no trailer or checksum does not match.
+ *
+ * @param buffer: payload with trailer.
+ * @param len: payload size with trailer.
+ *
+ */
+int32_t eclihash_check(const void *buffer, uint32_t len) {
+
+    const uint8_t *data = ( const uint8_t * ) buffer;
+    uint8_t  trailer[HASH_TRAILER_MAX];
+    uint8_t  size = 0;
+    ecli_hash_t hash;
+
+    if ( len == 0 || ( data[len - 1] & HASH_TAG_MASK ) != HASH_TAG ) {
+        return -1;
+    }
+    hash = data[len - 1] & ~HASH_TAG_MASK;
+    size = ( hash == HASH_CRC32C ) ? 5 : ( hash == HASH_XXH3 ) ? 9 : 0;
+    if ( size == 0 || len < size ||
+         eclihash_put( hash, data, len - size, trailer ) != size ||
+         memcmp( trailer, data + len - size, size ) != 0 ) {
+        return -1;
+    }
+
+    return len - size;
+}
+
+/**********************************************************************/
+/** Write big endian 32 / 64 bits integer (hashes, sizes and offsets in
+ * file and delta messages).
+ *
+ * @param buffer: position in buffer, 4 / 8 bytes.
+ * @param value: value to write.
+ *
+ */
+void eclihash_put32(uint8_t *buffer, uint32_t value) {
+
+    buffer[0] = value >> 24;
+    buffer[1] = value >> 16;
+    buffer[2] = value >> 8;
+    buffer[3] = value;
+}
+
+void eclihash_put64(uint8_t *buffer, uint64_t value) {
+
+    eclihash_put32( buffer, value >> 32 );
+    eclihash_put32( buffer + 4, value );
+}
+
+/**********************************************************************/
+/** Read big endian 32 / 64 bits integer.
+ *
+ * @param buffer: position in buffer, 4 / 8 bytes.
+ *
+ */
+uint32_t eclihash_get32(const uint8_t *buffer) {
+
+    return ( ( uint32_t ) buffer[0] << 24 ) | ( ( uint32_t ) buffer[1] << 16 ) |
+           ( ( uint32_t ) buffer[2] << 8 ) | buffer[3];
+}
+
+uint64_t eclihash_get64(const uint8_t *buffer) {
+
+    return ( ( uint64_t ) eclihash_get32( buffer ) << 32 ) | eclihash_get32( buffer + 4 );
+}
+
+/**********************************************************************/
+/** Use portable code only (benchmark and comparison), or back to CPU
+ * dispatch.
+ *
+ * @param portable: TRUE_FLAG for portable code.
+ *
+ */
+void eclihash_portable(uint8_t portable) {
+
+    pthread_once( &hash_once, eclihash_init );
+    eclihash_select( portable );
+}
+
+/**********************************************************************/
+/** Implementations in use, "crc32c:<impl> xxh3:<impl>".
+ *
+ */
+const char *eclihash_impl(void) {
+
+    pthread_once( &hash_once, eclihash_init );
+    snprintf( hash_impl_str, sizeof( hash_impl_str ), "crc32c:%s xxh3:%s",
+              hash_crc_name, hash_acc_name );
+
+    return hash_impl_str;
+}
+
+/**********************************************************************/
+/**********************************************************************/
+/** Build CRC32C tables and pick implementations, once
+ *
+ */
+static void eclihash_init(void) {
+
+    uint32_t i   = 0;
+    uint32_t j   = 0;
+    uint32_t crc = 0;
+
+    for ( i = 0; i < 256; i++ ) {
+        crc = i;
+        for ( j = 0; j < 8; j++ ) {
+            crc = ( crc & 1 ) ? ( crc >> 1 ) ^ HASH_CRC32C_POLY : crc >> 1;
+        }
+        hash_crc_table[0][i] = crc;
+    }
+    /* Table k: crc of byte followed by k zero bytes */
+    for ( i = 0; i < 256; i++ ) {
+        for ( j = 1; j < 8; j++ ) {
+            crc = hash_crc_table[j - 1][i];
+            hash_crc_table[j][i] = ( crc >> 8 ) ^ hash_crc_table[0][crc & 0xFF];
+        }
+    }
+    eclihash_select( 0 );
+}
+
+/**********************************************************************/
+/** Pick implementations for the running CPU
+ *
+ * @param portable: TRUE_FLAG for portable code only.
+ *
+ */
+static void eclihash_select(uint8_t portable) {
+
+    hash_crc = eclihash_crc_table;
+    hash_crc_name = "table";
+    hash_acc = eclihash_acc_scalar;
+    hash_scramble = eclihash_scramble_scalar;
+    hash_acc_name = "scalar";
+    if ( portable ) {
+        return;
+    }
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if ( __builtin_cpu_supports( "sse4.2" ) ) {
+        hash_crc = eclihash_crc_sse42;
+        hash_crc_name = "sse4.2";
+    }
+    if ( __builtin_cpu_supports( "avx2" ) ) {
+        hash_acc = eclihash_acc_avx2;
+        hash_scramble = eclihash_scramble_avx2;
+        hash_acc_name = "avx2";
+    }
+    else {
+        hash_acc = eclihash_acc_sse2;
+        hash_scramble = eclihash_scramble_sse2;
+        hash_acc_name = "sse2";
+    }
+#endif
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+    hash_crc = eclihash_crc_armv8;
+    hash_crc_name = "armv8";
+#endif
+}
+
+/**********************************************************************/
+/** CRC32C, 8 bytes per step with tables (portable)
+ *
+ * @param crc: inverted crc.
+ * @param buffer: data.
+ * @param len: data size.
+ *
+ */
+static uint32_t eclihash_crc_table(uint32_t crc, const uint8_t *buffer, size_t len) {
+
+    uint32_t low  = 0;
+    uint32_t high = 0;
+
+    while ( len >= 8 ) {
+        low = eclihash_read32( buffer ) ^ crc;
+        high = eclihash_read32( buffer + 4 );
+        crc = hash_crc_table[7][ low & 0xFF ] ^ hash_crc_table[6][ ( low >> 8 ) & 0xFF ] ^
+              hash_crc_table[5][ ( low >> 16 ) & 0xFF ] ^ hash_crc_table[4][ low >> 24 ] ^
+              hash_crc_table[3][ high & 0xFF ] ^ hash_crc_table[2][ ( high >> 8 ) & 0xFF ] ^
+              hash_crc_table[1][ ( high >> 16 ) & 0xFF ] ^ hash_crc_table[0][ high >> 24 ];
+        buffer += 8;
+        len -= 8;
+    }
+    while ( len-- ) {
+        crc = hash_crc_table[0][ ( crc ^ *buffer++ ) & 0xFF ] ^ ( crc >> 8 );
+    }
+
+    return crc;
+}
+
+/**********************************************************************/
+/** xxHash3 stripes and scramble (portable)
+ *
+ * @param acc: 8 accumulators.
+ * @param input: stripes.
+ * @param secret: secret of first stripe.
+ * @param stripes: number of stripes.
+ *
+ */
+static void eclihash_acc_scalar(uint64_t *acc, const uint8_t *input, const uint8_t *secret, size_t stripes) {
+
+    uint64_t data = 0;
+    uint64_t key  = 0;
+    size_t   n    = 0;
+    uint8_t  i    = 0;
+
+    for ( n = 0; n < stripes; n++ ) {
+        for ( i = 0; i < 8; i++ ) {
+            data = eclihash_read64( input + n * HASH_STRIPE_LEN + i * 8 );
+            key = data ^ eclihash_read64( secret + n * HASH_SECRET_RATE + i * 8 );
+            acc[i ^ 1] += data;
+            acc[i] += ( uint32_t ) key * ( key >> 32 );
+        }
+    }
+}
+
+static void eclihash_scramble_scalar(uint64_t *acc, const uint8_t *secret) {
+
+    uint8_t i = 0;
+
+    for ( i = 0; i < 8; i++ ) {
+        acc[i] ^= acc[i] >> 47;
+        acc[i] ^= eclihash_read64( secret + i * 8 );
+        acc[i] *= HASH_PRIME32_1;
+    }
+}
+
+#if defined(__x86_64__)
+/**********************************************************************/
+/** CRC32C with SSE4.2 crc32 instruction
+ *
+ * @param crc: inverted crc.
+ * @param buffer: data.
+ * @param len: data size.
+ *
+ */
+__attribute__((target("sse4.2")))
+static uint32_t eclihash_crc_sse42(uint32_t crc, const uint8_t *buffer, size_t len) {
+
+    uint64_t crc64 = crc;
+    uint64_t value = 0;
+
+    while ( len >= 8 ) {
+        memcpy( &value, buffer, 8 );
+        crc64 = _mm_crc32_u64( crc64, value );
+        buffer += 8;
+        len -= 8;
+    }
+    crc = crc64;
+    while ( len-- ) {
+        crc = _mm_crc32_u8( crc, *buffer++ );
+    }
+
+    return crc;
+}
+
+/**********************************************************************/
+/** xxHash3 stripes and scramble, 2 (SSE2) or 4 (AVX2) lanes at once
+ *
+ * @param acc: 8 accumulators.
+ * @param input: stripes.
+ * @param secret: secret of first stripe.
+ * @param stripes: number of stripes.
+ *
+ */
+static void eclihash_acc_sse2(uint64_t *acc, const uint8_t *input, const uint8_t *secret, size_t stripes) {
+
+    __m128i xacc[4];
+    __m128i data;
+    __m128i key;
+    __m128i swap;
+    size_t  n = 0;
+    uint8_t i = 0;
+
+    for ( i = 0; i < 4; i++ ) {
+        xacc[i] = _mm_loadu_si128( ( const __m128i * ) acc + i );
+    }
+    for ( n = 0; n < stripes; n++ ) {
+        for ( i = 0; i < 4; i++ ) {
+            data = _mm_loadu_si128( ( const __m128i * ) ( input + n * HASH_STRIPE_LEN ) + i );
+            key = _mm_xor_si128( data, _mm_loadu_si128( ( const __m128i * ) ( secret + n * HASH_SECRET_RATE ) + i ) );
+            /* low 32 x high 32 of each lane, plus data of the other lane */
+            swap = _mm_shuffle_epi32( data, _MM_SHUFFLE( 1, 0, 3, 2 ) );
+            xacc[i] = _mm_add_epi64( xacc[i], swap );
+            xacc[i] = _mm_add_epi64( xacc[i], _mm_mul_epu32( key, _mm_shuffle_epi32( key, _MM_SHUFFLE( 0, 3, 0, 1 ) ) ) );
+        }
+    }
+    for ( i = 0; i < 4; i++ ) {
+        _mm_storeu_si128( ( __m128i * ) acc + i, xacc[i] );
+    }
+}
+
+static void eclihash_scramble_sse2(uint64_t *acc, const uint8_t *secret) {
+
+    const __m128i prime = _mm_set1_epi32( HASH_PRIME32_1 );
+    __m128i value;
+    __m128i low;
+    __m128i high;
+    uint8_t i = 0;
+
+    for ( i = 0; i < 4; i++ ) {
+        value = _mm_loadu_si128( ( const __m128i * ) acc + i );
+        value = _mm_xor_si128( value, _mm_srli_epi64( value, 47 ) );
+        value = _mm_xor_si128( value, _mm_loadu_si128( ( const __m128i * ) secret + i ) );
+        /* 64 x 32 bits multiply from two 32 x 32 */
+        low = _mm_mul_epu32( value, prime );
+        high = _mm_mul_epu32( _mm_shuffle_epi32( value, _MM_SHUFFLE( 0, 3, 0, 1 ) ), prime );
+        _mm_storeu_si128( ( __m128i * ) acc + i, _mm_add_epi64( low, _mm_slli_epi64( high, 32 ) ) );
+    }
+}
+
+__attribute__((target("avx2")))
+static void eclihash_acc_avx2(uint64_t *acc, const uint8_t *input, const uint8_t *secret, size_t stripes) {
+
+    __m256i xacc[2];
+    __m256i data;
+    __m256i key;
+    __m256i swap;
+    size_t  n = 0;
+    uint8_t i = 0;
+
+    for ( i = 0; i < 2; i++ ) {
+        xacc[i] = _mm256_loadu_si256( ( const __m256i * ) acc + i );
+    }
+    for ( n = 0; n < stripes; n++ ) {
+        for ( i = 0; i < 2; i++ ) {
+            data = _mm256_loadu_si256( ( const __m256i * ) ( input + n * HASH_STRIPE_LEN ) + i );
+            key = _mm256_xor_si256( data, _mm256_loadu_si256( ( const __m256i * ) ( secret + n * HASH_SECRET_RATE ) + i ) );
+            swap = _mm256_shuffle_epi32( data, _MM_SHUFFLE( 1, 0, 3, 2 ) );
+            xacc[i] = _mm256_add_epi64( xacc[i], swap );
+            xacc[i] = _mm256_add_epi64( xacc[i], _mm256_mul_epu32( key, _mm256_shuffle_epi32( key, _MM_SHUFFLE( 0, 3, 0, 1 ) ) ) );
+        }
+    }
+    for ( i = 0; i < 2; i++ ) {
+        _mm256_storeu_si256( ( __m256i * ) acc + i, xacc[i] );
+    }
+}
+
+__attribute__((target("avx2")))
+static void eclihash_scramble_avx2(uint64_t *acc, const uint8_t *secret) {
+
+    const __m256i prime = _mm256_set1_epi32( HASH_PRIME32_1 );
+    __m256i value;
+    __m256i low;
+    __m256i high;
+    uint8_t i = 0;
+
+    for ( i = 0; i < 2; i++ ) {
+        value = _mm256_loadu_si256( ( const __m256i * ) acc + i );
+        value = _mm256_xor_si256( value, _mm256_srli_epi64( value, 47 ) );
+        value = _mm256_xor_si256( value, _mm256_loadu_si256( ( const __m256i * ) secret + i ) );
+        low = _mm256_mul_epu32( value, prime );
+        high = _mm256_mul_epu32( _mm256_shuffle_epi32( value, _MM_SHUFFLE( 0, 3, 0, 1 ) ), prime );
+        _mm256_storeu_si256( ( __m256i * ) acc + i, _mm256_add_epi64( low, _mm256_slli_epi64( high, 32 ) ) );
+    }
+}
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+/**********************************************************************/
+/** CRC32C with ARMv8 crc32c instructions
+ *
+ * @param crc: inverted crc.
+ * @param buffer: data.
+ * @param len: data size.
+ *
+ */
+static uint32_t eclihash_crc_armv8(uint32_t crc, const uint8_t *buffer, size_t len) {
+
+    uint64_t value = 0;
+
+    while ( len >= 8 ) {
+        memcpy( &value, buffer, 8 );
+        crc = __crc32cd( crc, value );
+        buffer += 8;
+        len -= 8;
+    }
+    while ( len-- ) {
+        crc = __crc32cb( crc, *buffer++ );
+    }
+
+    return crc;
+}
+#endif
+
+/**********************************************************************/
+/** xxHash3 of inputs bigger than HASH_MIDSIZE_MAX
+ *
+ * @param input: data.
+ * @param len: data size.
+ *
+ */
+static uint64_t eclihash_xxh3_long(const uint8_t *input, size_t len) {
+
+    uint64_t acc[8] = { HASH_PRIME32_3, HASH_PRIME64_1, HASH_PRIME64_2, HASH_PRIME64_3,
+                        HASH_PRIME64_4, HASH_PRIME32_2, HASH_PRIME64_5, HASH_PRIME32_1 };
+    uint64_t result = len * HASH_PRIME64_1;
+    size_t   blocks = ( len - 1 ) / HASH_BLOCK_LEN;
+    size_t   n      = 0;
+    uint8_t  i      = 0;
+
+    for ( n = 0; n < blocks; n++ ) {
+        hash_acc( acc, input + n * HASH_BLOCK_LEN, hash_secret, HASH_BLOCK_STRIPES );
+        hash_scramble( acc, hash_secret + HASH_SECRET_LEN - HASH_STRIPE_LEN );
+    }
+    /* Stripes of last block, then last 64 bytes (may overlap) */
+    hash_acc( acc, input + blocks * HASH_BLOCK_LEN, hash_secret,
+              ( ( len - 1 ) - blocks * HASH_BLOCK_LEN ) / HASH_STRIPE_LEN );
+    hash_acc( acc, input + len - HASH_STRIPE_LEN,
+              hash_secret + HASH_SECRET_LEN - HASH_STRIPE_LEN - HASH_LASTACC_START, 1 );
+
+    for ( i = 0; i < 4; i++ ) {
+        result += eclihash_fold64( acc[2 * i] ^ eclihash_read64( hash_secret + HASH_MERGEACCS_START + 16 * i ),
+                                   acc[2 * i + 1] ^ eclihash_read64( hash_secret + HASH_MERGEACCS_START + 16 * i + 8 ) );
+    }
+
+    return eclihash_avalanche( result );
+}
+
+/**********************************************************************/
+/** xxHash3 of inputs up to HASH_MIDSIZE_MAX
+ *
+ * @param input: data.
+ * @param len: data size.
+ *
+ */
+static uint64_t eclihash_xxh3_short(const uint8_t *input, size_t len) {
+
+    uint64_t acc     = 0;
+    uint64_t acc_end = 0;
+    uint64_t low     = 0;
+    uint64_t high    = 0;
+    uint32_t i       = 0;
+
+    if ( len == 0 ) {
+        return eclihash_avalanche64( eclihash_read64( hash_secret + 56 ) ^ eclihash_read64( hash_secret + 64 ) );
+    }
+    if ( len <= 3 ) {
+        acc = ( ( uint32_t ) input[0] << 16 ) | ( ( uint32_t ) input[len >> 1] << 24 ) |
+              input[len - 1] | ( ( uint32_t ) len << 8 );
+        acc ^= eclihash_read32( hash_secret ) ^ eclihash_read32( hash_secret + 4 );
+        return eclihash_avalanche64( acc );
+    }
+    if ( len <= 8 ) {
+        acc = eclihash_read32( input + len - 4 ) + ( ( uint64_t ) eclihash_read32( input ) << 32 );
+        acc ^= eclihash_read64( hash_secret + 8 ) ^ eclihash_read64( hash_secret + 16 );
+        return eclihash_rrmxmx( acc, len );
+    }
+    if ( len <= 16 ) {
+        low = eclihash_read64( input ) ^ eclihash_read64( hash_secret + 24 ) ^ eclihash_read64( hash_secret + 32 );
+        high = eclihash_read64( input + len - 8 ) ^ eclihash_read64( hash_secret + 40 ) ^ eclihash_read64( hash_secret + 48 );
+        acc = len + __builtin_bswap64( low ) + high + eclihash_fold64( low, high );
+        return eclihash_avalanche( acc );
+    }
+    acc = len * HASH_PRIME64_1;
+    if ( len <= 128 ) {
+        /* Pairs from both ends */
+        for ( i = 0; i < 4; i++ ) {
+            acc += eclihash_mix16( input + 16 * i, hash_secret + 32 * i );
+            acc += eclihash_mix16( input + len - 16 * ( i + 1 ), hash_secret + 32 * i + 16 );
+            if ( len <= 32 * ( i + 1 ) ) {
+                break;
+            }
+        }
+        return eclihash_avalanche( acc );
+    }
+    for ( i = 0; i < 8; i++ ) {
+        acc += eclihash_mix16( input + 16 * i, hash_secret + 16 * i );
+    }
+    acc = eclihash_avalanche( acc );
+    acc_end = eclihash_mix16( input + len - 16, hash_secret + HASH_SECRET_SIZE_MIN - HASH_MIDSIZE_LAST );
+    for ( i = 8; i < len / 16; i++ ) {
+        acc_end += eclihash_mix16( input + 16 * i, hash_secret + 16 * ( i - 8 ) + HASH_MIDSIZE_START );
+    }
+
+    return eclihash_avalanche( acc + acc_end );
+}
+
+/**********************************************************************/
+/** xxHash3 helpers: 16 bytes mix, 64x64->128 fold, avalanches
+ *
+ */
+static uint64_t eclihash_mix16(const uint8_t *input, const uint8_t *secret) {
+
+    return eclihash_fold64( eclihash_read64( input ) ^ eclihash_read64( secret ),
+                            eclihash_read64( input + 8 ) ^ eclihash_read64( secret + 8 ) );
+}
+
+static uint64_t eclihash_fold64(uint64_t lhs, uint64_t rhs) {
+
+#if defined(__SIZEOF_INT128__)
+    unsigned __int128 product = ( unsigned __int128 ) lhs * rhs;
+
+    return ( uint64_t ) product ^ ( uint64_t ) ( product >> 64 );
+#else
+    /* 32 bits targets: four 32 x 32 products */
+    uint64_t lo_lo = ( lhs & 0xFFFFFFFF ) * ( rhs & 0xFFFFFFFF );
+    uint64_t hi_lo = ( lhs >> 32 ) * ( rhs & 0xFFFFFFFF );
+    uint64_t lo_hi = ( lhs & 0xFFFFFFFF ) * ( rhs >> 32 );
+    uint64_t hi_hi = ( lhs >> 32 ) * ( rhs >> 32 );
+    uint64_t cross = ( lo_lo >> 32 ) + ( hi_lo & 0xFFFFFFFF ) + lo_hi;
+    uint64_t upper = ( hi_lo >> 32 ) + ( cross >> 32 ) + hi_hi;
+    uint64_t lower = ( cross << 32 ) | ( lo_lo & 0xFFFFFFFF );
+
+    return lower ^ upper;
+#endif
+}
+
+static uint64_t eclihash_avalanche(uint64_t hash) {
+
+    hash ^= hash >> 37;
+    hash *= HASH_PRIME_MX1;
+    hash ^= hash >> 32;
+
+    return hash;
+}
+
+static uint64_t eclihash_avalanche64(uint64_t hash) {
+
+    hash ^= hash >> 33;
+    hash *= HASH_PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= HASH_PRIME64_3;
+    hash ^= hash >> 32;
+
+    return hash;
+}
+
+static uint64_t eclihash_rrmxmx(uint64_t hash, uint64_t len) {
+
+    hash ^= ( ( hash << 49 ) | ( hash >> 15 ) ) ^ ( ( hash << 24 ) | ( hash >> 40 ) );
+    hash *= HASH_PRIME_MX2;
+    hash ^= ( hash >> 35 ) + len;
+    hash *= HASH_PRIME_MX2;
+
+    return hash ^ ( hash >> 28 );
+}
+
+/**********************************************************************/
+/** Little endian reads
+ *
+ * @param buffer: data.
+ *
+ */
+static uint32_t eclihash_read32(const uint8_t *buffer) {
+
+    uint32_t value = 0;
+
+    memcpy( &value, buffer, sizeof( value ) );
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap32( value );
+#endif
+
+    return value;
+}
+
+static uint64_t eclihash_read64(const uint8_t *buffer) {
+
+    uint64_t value = 0;
+
+    memcpy( &value, buffer, sizeof( value ) );
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap64( value );
+#endif
+
+    return value;
+}
@@ -7,10 +7,72 @@
 *
 ***********************************************************************/
 
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/**********************************************************************/
+
 #include <libeclimqttlog.h>
 
 /**********************************************************************/
-/** Show message in term.
+/* Log levels stored in records */
+#define LOG_LEVEL_INFO    0
+#define LOG_LEVEL_DEBUG   1
+#define LOG_LEVEL_ERROR   2
+#define LOG_LEVEL_TRACE   3
+/* Logger states */
+#define LOG_STATE_CLOSED  0
+#define LOG_STATE_OPENING 1
+#define LOG_STATE_OPEN    2
+#define LOG_STATE_CLOSING 3
+#define LOG_TS_LEN        32
+#define LOG_LINE_LEN      ( LOG_RECORD_MSG_LEN + 512 )
+
+/**********************************************************************/
+/* Binary record written by producers and formatted by writer thread */
+typedef struct {
+    uint32_t    seq;                            /* Ring slot sequence */
+    uint8_t     level;                          /* Log level */
+    uint8_t     msg_len;                        /* Bytes used in msg */
+    uint64_t    ts_nsec;                        /* Realtime timestamp */
+    const char  *caller;                        /* Call site: file */
+    const char  *call;                          /* Call site: function */
+    char        msg[LOG_RECORD_MSG_LEN];        /* Message argument */
+} eclilog_record_t;
+
+/* Per-second cached timestamp string */
+typedef struct {
+    time_t sec;
+    char   str[LOG_TS_LEN];
+} eclilog_ts_cache_t;
+
+/**********************************************************************/
+
+static eclilog_record_t *log_ring    = NULL;
+static uint32_t  log_enq_pos         = 0;
+static uint32_t  log_deq_pos         = 0;
+static uint32_t  log_dropped         = 0;
+static uint8_t   log_state           = LOG_STATE_CLOSED;
+static uint8_t   log_running         = 0;
+static uint32_t  log_producers       = 0;      /* Threads writing a ring slot */
+static uint32_t  log_waiting         = 0;      /* Writer sleeps on log_notify */
+static uint32_t  log_notify          = 0;      /* futex word, bumped to wake writer */
+static int32_t   log_fd              = -1;
+static uint32_t  log_file_size       = 0;
+static uint32_t  log_max_size        = LOG_FILE_SIZE_DEFAULT;
+static uint8_t   log_max_files       = LOG_FILE_NUM_DEFAULT;
+static char      log_path[512];
+static pthread_t log_thread;
+static FILE      *log_console        = NULL;   /* NULL: stdout */
+
+/**********************************************************************/
+/**********************************************************************/
+/** Print message in term.
  *
  * @param caller: caller file string.
  * @param call: function that calls string.
@@ -18,45 +80,82 @@
  * @param log_level: log level flag
  *
  */
-void eclilog_show(const char * caller, const char * call, const char *msg, const char * log_level) {
+static void eclilog_print(const char * caller, const char * call, const char *msg, const char * log_level);
 
-    time_t t = time(NULL);
-    struct tm tm = *localtime(&t);
+/**********************************************************************/
+/** Get timestamp string, formatting it only once per second.
+ *
+ * @param cache: cached timestamp of caller thread.
+ * @param sec: seconds since epoch.
+ *
+ */
+static const char *eclilog_timestamp(eclilog_ts_cache_t *cache, time_t sec);
 
-    if ( strcmp( log_level, "INFO" ) == 0 ) {
-#ifdef LOG_TRACE
-        printf("[ %d-%02d-%02d %02d:%02d:%02d ] [ %s  ] : [%s (%s)] %s\n",
-                tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
-                tm.tm_hour, tm.tm_min, tm.tm_sec,
-                log_level, caller, call, msg);
-#else
-        printf("[ %d-%02d-%02d %02d:%02d:%02d ] [ %s  ] : %s\n",
-                tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
-                tm.tm_hour, tm.tm_min, tm.tm_sec,
-                log_level, msg);
-#endif
-    }
+/**********************************************************************/
+/** Map log level string to record level.
+ *
+ * @param log_level: log level flag
+ *
+ */
+static uint8_t eclilog_level_id(const char *log_level);
 
-#ifdef LOG_DEBUG
-    else if ( strcmp( log_level, "DEBUG" ) == 0 ) {
-#ifdef LOG_TRACE
-        printf("[ %d-%02d-%02d %02d:%02d:%02d ] [ %s  ] : [%s (%s)] %s\n",
-                tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
-                tm.tm_hour, tm.tm_min, tm.tm_sec,
-                log_level, caller, call, msg);
+/**********************************************************************/
+/** Rotate log files: file.N-1 -> file.N ... file -> file.1
+ *
+ */
+static void eclilog_rotate(void);
+
+/**********************************************************************/
+/** Write buffered lines in log file.
+ *
+ * @param buffer: formatted lines.
+ * @param len: bytes in buffer.
+ *
+ */
+static void eclilog_write(const char *buffer, uint32_t len);
+
+/**********************************************************************/
+/** Wake writer thread if it sleeps on an empty ring.
+ *
+ */
+static void eclilog_wake(void);
+
+/**********************************************************************/
+/** Background thread: drain ring, format records and write file.
+ *
+ * @param arg: unused.
+ *
+ */
+static void *eclilog_writer(void *arg);
+
+/**********************************************************************/
+/**********************************************************************/
+/** Show message in term.
+ *
+ * @param caller: caller file string.
+ * @param call: function that calls string.
+ * @param msg: message string.
+ * @param log_level: log level flag
+ *
+ */
+void eclilog_show(const char * caller, const char * call, const char *msg, const char * log_level) {
+
+    eclilog_print(caller, call, msg, log_level);
+    /* Forward to file logger: every level with LOG_BULK, else only when opened */
+#ifdef LOG_BULK
+    eclilog_log(caller, call, msg, LOG_FILE_DEFAULT, log_level);
 #else
-        printf("[ %d-%02d-%02d %02d:%02d:%02d ] [ %s  ] : %s\n",
-                tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
-                tm.tm_hour, tm.tm_min, tm.tm_sec,
-                log_level, msg);
-#endif
-    }
+    eclilog_log(caller, call, msg, NULL, log_level);
 #endif
 
 }
 
 /**********************************************************************/
 /** log message in file.
+ *
+ * Never blocks: the record is copied in the ring or dropped if it is full.
+ * The logger is opened on first use when logfile is set; once opened the
+ * logfile argument is ignored.
  *
  * @param caller: caller file string.
  * @param call: function that calls string.
@@ -67,13 +166,65 @@ void eclilog_show(const char * caller, const char * call, const char *msg, const
  */
 int8_t eclilog_log(const char * caller, const char * call, const char *msg, const char *logfile, const char * log_level) {
 
-    int8_t return_code = 0;
+    eclilog_record_t *record;
+    struct timespec  ts;
+    uint32_t pos;
+    uint32_t seq;
+    uint32_t msg_len;
+    int32_t  diff;
+
+    if ( __atomic_load_n( &log_state, __ATOMIC_ACQUIRE ) != LOG_STATE_OPEN ) {
+        if ( logfile == NULL ||
+             eclilog_open( logfile, LOG_FILE_SIZE_DEFAULT, LOG_FILE_NUM_DEFAULT ) != 0 ) {
+            return -1;
+        }
+    }
+    /* Counted while the ring is used: close waits for it before free */
+    __atomic_add_fetch( &log_producers, 1, __ATOMIC_SEQ_CST );
+    if ( __atomic_load_n( &log_state, __ATOMIC_SEQ_CST ) != LOG_STATE_OPEN ) {
+        __atomic_sub_fetch( &log_producers, 1, __ATOMIC_RELEASE );
+        return -1;
+    }
 
-    #ifdef LOG_BULK
-        /* TODO: write log in file*/
-    #endif
+    /* Claim a slot (bounded MPMC ring, producers only race on enq pos) */
+    pos = __atomic_load_n( &log_enq_pos, __ATOMIC_RELAXED );
+    for ( ;; ) {
+        record = &log_ring[ pos & ( LOG_RING_SIZE - 1 ) ];
+        seq = __atomic_load_n( &record->seq, __ATOMIC_ACQUIRE );
+        diff = ( int32_t ) ( seq - pos );
+        if ( diff == 0 ) {
+            if ( __atomic_compare_exchange_n( &log_enq_pos, &pos, pos + 1, 1,
+                                              __ATOMIC_RELAXED, __ATOMIC_RELAXED ) ) {
+                break;
+            }
+        }
+        else if ( diff < 0 ) {
+            /* Ring full */
+            __atomic_fetch_add( &log_dropped, 1, __ATOMIC_RELAXED );
+            __atomic_sub_fetch( &log_producers, 1, __ATOMIC_RELEASE );
+            return -1;
+        }
+        else {
+            pos = __atomic_load_n( &log_enq_pos, __ATOMIC_RELAXED );
+        }
+    }
 
-    return return_code;
+    clock_gettime( CLOCK_REALTIME, &ts );
+    msg_len = strlen( msg );
+    if ( msg_len > LOG_RECORD_MSG_LEN ) {
+        msg_len = LOG_RECORD_MSG_LEN;
+    }
+    record->ts_nsec = ( uint64_t ) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    record->level   = eclilog_level_id( log_level );
+    record->caller  = caller;
+    record->call    = call;
+    record->msg_len = msg_len;
+    memcpy( record->msg, msg, msg_len );
+    __atomic_store_n( &record->seq, pos + 1, __ATOMIC_RELEASE );
+    eclilog_wake();
+    __atomic_sub_fetch( &log_producers, 1, __ATOMIC_RELEASE );
+
+    return 0;
 
 }
 
@@ -91,10 +242,348 @@ int8_t eclilog_logshow(const char * caller, const char * call, const char *msg,
 
     int8_t return_code;
 
-    eclilog_show(caller, call, msg, log_level);
+    eclilog_print(caller, call, msg, log_level);
     return_code = eclilog_log(caller, call, msg, logfile, log_level);
 
     return return_code;
 }
 
 /**********************************************************************/
+/** Open log file and start background writer thread.
+ *
+ * @param logfile: log file path string.
+ * @param max_size: file size in bytes that triggers a rotation.
+ * @param max_files: number of rotated files kept.
+ *
+ */
+int8_t eclilog_open(const char *logfile, uint32_t max_size, uint8_t max_files) {
+
+    uint8_t  state = LOG_STATE_CLOSED;
+    uint32_t i     = 0;
+
+    if ( !__atomic_compare_exchange_n( &log_state, &state, LOG_STATE_OPENING, 0,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED ) ) {
+        /* Already open (or being opened by other thread) */
+        return ( state == LOG_STATE_OPEN ) ? 0 : -1;
+    }
+
+    strncpy( log_path, logfile, sizeof( log_path ) - 1 );
+    log_max_size  = max_size;
+    log_max_files = max_files;
+    log_fd = open( log_path, O_WRONLY | O_CREAT | O_APPEND, 0644 );
+    if ( log_fd < 0 ) {
+        perror( log_path );
+        __atomic_store_n( &log_state, LOG_STATE_CLOSED, __ATOMIC_RELEASE );
+        return -1;
+    }
+    log_file_size = lseek( log_fd, 0, SEEK_END );
+
+    log_ring = malloc( sizeof( eclilog_record_t ) * LOG_RING_SIZE );
+    if ( log_ring == NULL ) {
+        close( log_fd );
+        __atomic_store_n( &log_state, LOG_STATE_CLOSED, __ATOMIC_RELEASE );
+        return -1;
+    }
+    for ( i = 0; i < LOG_RING_SIZE; i++ ) {
+        log_ring[i].seq = i;
+    }
+    log_enq_pos = 0;
+    log_deq_pos = 0;
+    log_waiting = 0;
+
+    log_running = 1;
+    if ( pthread_create( &log_thread, NULL, eclilog_writer, NULL ) != 0 ) {
+        free( log_ring );
+        close( log_fd );
+        __atomic_store_n( &log_state, LOG_STATE_CLOSED, __ATOMIC_RELEASE );
+        return -1;
+    }
+    atexit( eclilog_close );
+    __atomic_store_n( &log_state, LOG_STATE_OPEN, __ATOMIC_RELEASE );
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Drain queued records, stop writer thread and close log file.
+ *
+ */
+void eclilog_close(void) {
+
+    uint8_t state = LOG_STATE_OPEN;
+
+    /* Closing: new records are refused and open waits until the end */
+    if ( !__atomic_compare_exchange_n( &log_state, &state, LOG_STATE_CLOSING, 0,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_RELAXED ) ) {
+        return;
+    }
+    /* Producers that saw the log open finish their slot first */
+    while ( __atomic_load_n( &log_producers, __ATOMIC_SEQ_CST ) ) {
+        sched_yield();
+    }
+    __atomic_store_n( &log_running, 0, __ATOMIC_SEQ_CST );
+    eclilog_wake();
+    pthread_join( log_thread, NULL );
+    close( log_fd );
+    log_fd = -1;
+    free( log_ring );
+    log_ring = NULL;
+    __atomic_store_n( &log_state, LOG_STATE_CLOSED, __ATOMIC_RELEASE );
+}
+
+/**********************************************************************/
+/** Get number of records dropped because the ring was full.
+ *
+ */
+uint32_t eclilog_dropped(void) {
+
+    return __atomic_load_n( &log_dropped, __ATOMIC_RELAXED );
+}
+
+/**********************************************************************/
+/** Set term stream for shown messages (stdout by default), stderr
+ * when stdout carries data.
+ *
+ * @param out: output stream.
+ *
+ */
+void eclilog_console(FILE *out) {
+
+    log_console = out;
+}
+
+/**********************************************************************/
+/**********************************************************************/
+/** Print message in term.
+ *
+ * @param caller: caller file string.
+ * @param call: function that calls string.
+ * @param msg: message string.
+ * @param log_level: log level flag
+ *
+ */
+static void eclilog_print(const char * caller, const char * call, const char *msg, const char * log_level) {
+
+    static __thread eclilog_ts_cache_t ts_cache;
+    const char *ts_str;
+    FILE       *out = log_console ? log_console : stdout;
+
+    if ( strcmp( log_level, "INFO" ) == 0 ) {
+        ts_str = eclilog_timestamp( &ts_cache, time( NULL ) );
+#ifdef LOG_TRACE
+        fprintf(out, "[ %s ] [ %s  ] : [%s (%s)] %s\n",
+                ts_str, log_level, caller, call, msg);
+#else
+        fprintf(out, "[ %s ] [ %s  ] : %s\n",
+                ts_str, log_level, msg);
+#endif
+    }
+
+#ifdef LOG_DEBUG
+    else if ( strcmp( log_level, "DEBUG" ) == 0 ) {
+        ts_str = eclilog_timestamp( &ts_cache, time( NULL ) );
+#ifdef LOG_TRACE
+        fprintf(out, "[ %s ] [ %s  ] : [%s (%s)] %s\n",
+                ts_str, log_level, caller, call, msg);
+#else
+        fprintf(out, "[ %s ] [ %s  ] : %s\n",
+                ts_str, log_level, msg);
+#endif
+    }
+#endif
+
+}
+
+/**********************************************************************/
+/** Get timestamp string, formatting it only once per second.
+ *
+ * @param cache: cached timestamp of caller thread.
+ * @param sec: seconds since epoch.
+ *
+ */
+static const char *eclilog_timestamp(eclilog_ts_cache_t *cache, time_t sec) {
+
+    struct tm tm;
+
+    if ( cache->sec != sec || cache->str[0] == '\0' ) {
+        localtime_r( &sec, &tm );
+        strftime( cache->str, sizeof( cache->str ), "%Y-%m-%d %H:%M:%S", &tm );
+        cache->sec = sec;
+    }
+
+    return cache->str;
+}
+
+/**********************************************************************/
+/** Map log level string to record level.
+ *
+ * @param log_level: log level flag
+ *
+ */
+static uint8_t eclilog_level_id(const char *log_level) {
+
+    switch ( log_level[0] ) {
+        case 'D':
+            return LOG_LEVEL_DEBUG;
+        case 'E':
+            return LOG_LEVEL_ERROR;
+        case 'T':
+            return LOG_LEVEL_TRACE;
+        default:
+            return LOG_LEVEL_INFO;
+    }
+}
+
+/**********************************************************************/
+/** Rotate log files: file.N-1 -> file.N ... file -> file.1
+ *
+ */
+static void eclilog_rotate(void) {
+
+    char    from[sizeof( log_path ) + 16];
+    char    to[sizeof( log_path ) + 16];
+    int32_t i;
+
+    close( log_fd );
+    for ( i = log_max_files - 1; i > 0; i-- ) {
+        snprintf( from, sizeof( from ), "%s.%d", log_path, i );
+        snprintf( to, sizeof( to ), "%s.%d", log_path, i + 1 );
+        rename( from, to );
+    }
+    if ( log_max_files ) {
+        snprintf( to, sizeof( to ), "%s.1", log_path );
+        rename( log_path, to );
+        log_fd = open( log_path, O_WRONLY | O_CREAT | O_APPEND, 0644 );
+    }
+    else {
+        log_fd = open( log_path, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+    }
+    log_file_size = 0;
+}
+
+/**********************************************************************/
+/** Write buffered lines in log file.
+ *
+ * @param buffer: formatted lines.
+ * @param len: bytes in buffer.
+ *
+ */
+static void eclilog_write(const char *buffer, uint32_t len) {
+
+    ssize_t written;
+
+    if ( log_file_size && log_file_size + len > log_max_size ) {
+        eclilog_rotate();
+    }
+    while ( len > 0 && log_fd >= 0 ) {
+        written = write( log_fd, buffer, len );
+        if ( written <= 0 ) {
+            break;
+        }
+        buffer += written;
+        len -= written;
+        log_file_size += written;
+    }
+}
+
+/**********************************************************************/
+/** Background thread: drain ring, format records and write file.
+ *
+ * @param arg: unused.
+ *
+ */
+static void *eclilog_writer(void *arg) {
+
+    static const char * const level_str[] = { LOG_INFO, LOG_DEBUG, LOG_ERROR, LOG_TRACE };
+    eclilog_ts_cache_t ts_cache = { 0 };
+    eclilog_record_t   *record;
+    struct timespec    now;
+    struct timespec    wait;
+    char     *buffer       = malloc( LOG_WRITE_BUF_SIZE );
+    uint32_t buffer_len    = 0;
+    uint32_t dropped_seen  = 0;
+    uint32_t dropped       = 0;
+    uint64_t last_flush    = 0;
+    uint64_t now_msec      = 0;
+    int32_t  line_len      = 0;
+    uint32_t notify        = 0;
+
+    if ( buffer == NULL ) {
+        return NULL;
+    }
+
+    for ( ;; ) {
+        record = &log_ring[ log_deq_pos & ( LOG_RING_SIZE - 1 ) ];
+        if ( __atomic_load_n( &record->seq, __ATOMIC_ACQUIRE ) == log_deq_pos + 1 ) {
+            /* Keep room for a full line */
+            if ( buffer_len + LOG_LINE_LEN > LOG_WRITE_BUF_SIZE ) {
+                eclilog_write( buffer, buffer_len );
+                buffer_len = 0;
+            }
+            line_len = snprintf( buffer + buffer_len, LOG_LINE_LEN,
+                                 "[ %s.%06u ] [ %s  ] : [%s (%s)] %.*s\n",
+                                 eclilog_timestamp( &ts_cache, record->ts_nsec / 1000000000ULL ),
+                                 ( uint32_t ) ( ( record->ts_nsec % 1000000000ULL ) / 1000 ),
+                                 level_str[ record->level ], record->caller, record->call,
+                                 record->msg_len, record->msg );
+            if ( line_len > 0 ) {
+                buffer_len += ( line_len < LOG_LINE_LEN ) ? line_len : LOG_LINE_LEN - 1;
+            }
+            __atomic_store_n( &record->seq, log_deq_pos + LOG_RING_SIZE, __ATOMIC_RELEASE );
+            log_deq_pos++;
+            continue;
+        }
+
+        /* Ring empty */
+        dropped = __atomic_load_n( &log_dropped, __ATOMIC_RELAXED );
+        if ( dropped != dropped_seen && buffer_len + LOG_LINE_LEN <= LOG_WRITE_BUF_SIZE ) {
+            buffer_len += snprintf( buffer + buffer_len, LOG_LINE_LEN,
+                                    "[ %s ] [ %s  ] : %u log records dropped\n",
+                                    eclilog_timestamp( &ts_cache, time( NULL ) ),
+                                    LOG_ERROR, dropped - dropped_seen );
+            dropped_seen = dropped;
+        }
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        now_msec = ( uint64_t ) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+        if ( buffer_len && ( now_msec - last_flush >= LOG_FLUSH_MSECS ||
+                             !__atomic_load_n( &log_running, __ATOMIC_ACQUIRE ) ) ) {
+            eclilog_write( buffer, buffer_len );
+            buffer_len = 0;
+            last_flush = now_msec;
+        }
+        if ( !__atomic_load_n( &log_running, __ATOMIC_ACQUIRE ) && buffer_len == 0 ) {
+            break;
+        }
+        /* Sleep until a record comes, or the buffered lines are due */
+        notify = __atomic_load_n( &log_notify, __ATOMIC_SEQ_CST );
+        __atomic_store_n( &log_waiting, 1, __ATOMIC_SEQ_CST );
+        if ( __atomic_load_n( &record->seq, __ATOMIC_SEQ_CST ) != log_deq_pos + 1 &&
+             __atomic_load_n( &log_running, __ATOMIC_SEQ_CST ) ) {
+            wait.tv_sec  = 0;
+            wait.tv_nsec = ( LOG_FLUSH_MSECS - ( now_msec - last_flush ) ) * 1000000L;
+            syscall( SYS_futex, &log_notify, FUTEX_WAIT_PRIVATE, notify,
+                     buffer_len ? &wait : NULL, NULL, 0 );
+        }
+        __atomic_store_n( &log_waiting, 0, __ATOMIC_RELAXED );
+    }
+    free( buffer );
+
+    return NULL;
+}
+
+/**********************************************************************/
+/** Wake writer thread if it sleeps on an empty ring.
+ *
+ */
+static void eclilog_wake(void) {
+
+    /* Only the empty to non-empty change costs a syscall; the published
+       slot is visible before log_waiting is read (writer does the reverse) */
+    __atomic_thread_fence( __ATOMIC_SEQ_CST );
+    if ( __atomic_load_n( &log_waiting, __ATOMIC_RELAXED ) ) {
+        __atomic_add_fetch( &log_notify, 1, __ATOMIC_SEQ_CST );
+        syscall( SYS_futex, &log_notify, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0 );
+    }
+}
+
+/**********************************************************************/
@@ -0,0 +1,457 @@
+/***********************************************************************
+* FILENAME    :   libeclimqttlvc.c
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   Library code for the last value cache of received
+*                 messages (latest payload per topic, lock-free reads).
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+/**********************************************************************/
+
+#include <libeclimqttlvc.h>
+#include <libeclimqtthash.h>
+#include <libeclimqttlog.h>
+
+/**********************************************************************/
+/* Topic in the cache */
+typedef struct eclilvc_entry_s {
+    struct eclilvc_entry_s *next;           /* Bucket chain (readers) */
+    struct eclilvc_entry_s *newer;          /* LRU list (writer only) */
+    struct eclilvc_entry_s *older;
+    ecli_lvc_value_t *value;                /* Latest value (readers) */
+    uint64_t hash;
+    uint32_t topic_len;
+    uint8_t  used;                          /* Read since last eviction pass */
+    char     topic[];
+} eclilvc_entry_t;
+
+/* Hidden header of values and topics: retired list link (writer only) */
+typedef struct eclilvc_node_s {
+    struct eclilvc_node_s *next;
+    uint64_t reserved;                      /* Keeps payload 16 bytes aligned */
+} eclilvc_node_t;
+
+/**********************************************************************/
+static eclilvc_entry_t   **lvc_buckets = NULL;
+static uint32_t          lvc_mask      = 0;
+static uint64_t          lvc_max       = 0;
+static uint64_t          lvc_bytes     = 0;
+static uint32_t          lvc_topics    = 0;
+static uint64_t          lvc_evicted   = 0;
+static uint32_t          lvc_epoch     = 0;
+static int32_t           lvc_readers[2] = { 0, 0 };         /* Sections per epoch parity */
+static eclilvc_node_t    *lvc_retired[2] = { NULL, NULL };  /* Unlinked in last, this epoch */
+static eclilvc_entry_t   *lvc_newest   = NULL;
+static eclilvc_entry_t   *lvc_oldest   = NULL;
+static pthread_mutex_t   lvc_lock      = PTHREAD_MUTEX_INITIALIZER;
+
+/**********************************************************************/
+/**********************************************************************/
+/** Remove topic from cache (writer, lock held).
+ *
+ * @param entry: cached topic.
+ *
+ */
+static void eclilvc_evict(eclilvc_entry_t *entry);
+
+/**********************************************************************/
+/** Move topic to newest end of LRU list (writer, lock held).
+ *
+ * @param entry: cached topic, linked or not.
+ *
+ */
+static void eclilvc_touch(eclilvc_entry_t *entry);
+
+/**********************************************************************/
+/** Allocate value or topic with its retired list link, NULL on error.
+ *
+ * @param size: bytes.
+ *
+ */
+static void *eclilvc_alloc(uint64_t size);
+
+/**********************************************************************/
+/** Free unlinked value or topic once readers that may see it are out
+ * (writer, lock held).
+ *
+ * @param ptr: unlinked value or topic.
+ *
+ */
+static void eclilvc_retire(void *ptr);
+
+/**********************************************************************/
+/** Free memory retired in the last epoch when its readers are out and
+ * start a new epoch (writer, lock held).
+ *
+ */
+static void eclilvc_reclaim(void);
+
+/**********************************************************************/
+/**********************************************************************/
+/** Create the cache, nothing when it exists, returns -1 on error.
+ *
+ * @param max_bytes: topics and payloads memory limit.
+ *
+ */
+int8_t eclilvc_init(uint64_t max_bytes) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    eclilvc_entry_t **buckets = NULL;
+    uint32_t count = LVC_BUCKETS_MIN;
+
+    pthread_mutex_lock( &lvc_lock );
+    if ( lvc_buckets != NULL ) {
+        pthread_mutex_unlock( &lvc_lock );
+        return 0;
+    }
+    while ( count < LVC_BUCKETS_MAX && ( uint64_t ) count * LVC_ENTRY_BYTES < max_bytes ) {
+        count <<= 1;
+    }
+    if ( ( buckets = calloc( count, sizeof( *buckets ) ) ) == NULL ) {
+        pthread_mutex_unlock( &lvc_lock );
+        return -1;
+    }
+    lvc_mask = count - 1;
+    lvc_max = max_bytes;
+    __atomic_store_n( &lvc_buckets, buckets, __ATOMIC_RELEASE );
+    pthread_mutex_unlock( &lvc_lock );
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Store latest payload of topic (receive path), nothing when the cache
+ * does not exist.
+ *
+ * @param topic: topic name.
+ * @param msg: message payload.
+ * @param len: payload size.
+ * @param retain: retained publish flag.
+ * @param ts_ms: arrival epoch msecs, 0 now.
+ *
+ */
+void eclilvc_put(const char *topic, const uint8_t *msg, uint32_t len, uint8_t retain, uint64_t ts_ms) {
+
+    eclilvc_entry_t  *entry  = NULL;
+    eclilvc_entry_t  *found  = NULL;
+    eclilvc_entry_t  *victim = NULL;
+    eclilvc_entry_t  **bucket = NULL;
+    ecli_lvc_value_t *value  = NULL;
+    ecli_lvc_value_t *old    = NULL;
+    uint32_t topic_len = strlen( topic );
+    uint32_t chances   = 0;
+    uint64_t hash      = 0;
+    uint64_t size      = sizeof( ecli_lvc_value_t ) + len;
+    struct timespec ts;
+
+    if ( __atomic_load_n( &lvc_buckets, __ATOMIC_ACQUIRE ) == NULL ) {
+        return;
+    }
+    if ( ts_ms == 0 ) {
+        clock_gettime( CLOCK_REALTIME, &ts );
+        ts_ms = ( uint64_t ) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    }
+    hash = eclihash_xxh3( topic, topic_len );
+
+    pthread_mutex_lock( &lvc_lock );
+    bucket = &lvc_buckets[hash & lvc_mask];
+    for ( found = *bucket; found != NULL; found = found->next ) {
+        if ( found->hash == hash && found->topic_len == topic_len &&
+             memcmp( found->topic, topic, topic_len ) == 0 ) {
+            break;
+        }
+    }
+    /* A value over the limit is not kept, nor the older one */
+    if ( size + ( found ? 0 : sizeof( eclilvc_entry_t ) + topic_len + 1 ) > lvc_max ||
+         ( value = eclilvc_alloc( size ) ) == NULL ||
+         ( found == NULL && ( entry = eclilvc_alloc( sizeof( eclilvc_entry_t ) + topic_len + 1 ) ) == NULL ) ) {
+        if ( found != NULL ) {
+            eclilvc_evict( found );
+        }
+        if ( value != NULL ) {
+            free( ( eclilvc_node_t * ) value - 1 );
+        }
+        eclilvc_reclaim();
+        pthread_mutex_unlock( &lvc_lock );
+        return;
+    }
+    value->ts_ms = ts_ms;
+    value->len = len;
+    value->retain = retain;
+    memcpy( value->data, msg, len );
+
+    if ( found == NULL ) {
+        /* New topic: complete before readers can reach it */
+        memset( entry, 0, sizeof( eclilvc_entry_t ) );
+        entry->hash = hash;
+        entry->topic_len = topic_len;
+        memcpy( entry->topic, topic, topic_len + 1 );
+        entry->value = value;
+        entry->next = *bucket;
+        __atomic_store_n( bucket, entry, __ATOMIC_RELEASE );
+        lvc_bytes += sizeof( eclilvc_entry_t ) + topic_len + 1;
+        lvc_topics++;
+    }
+    else {
+        entry = found;
+        old = entry->value;
+        __atomic_store_n( &entry->value, value, __ATOMIC_SEQ_CST );
+        lvc_bytes -= sizeof( ecli_lvc_value_t ) + old->len;
+        eclilvc_retire( old );
+    }
+    lvc_bytes += size;
+    eclilvc_touch( entry );
+
+    /* Oldest updated topics go, read ones get a second chance */
+    chances = lvc_topics;
+    while ( lvc_bytes > lvc_max && ( victim = lvc_oldest ) != NULL && victim != entry ) {
+        if ( __atomic_load_n( &victim->used, __ATOMIC_RELAXED ) && chances > 0 ) {
+            chances--;
+            __atomic_store_n( &victim->used, 0, __ATOMIC_RELAXED );
+            eclilvc_touch( victim );
+            continue;
+        }
+        eclilvc_evict( victim );
+    }
+    eclilvc_reclaim();
+    pthread_mutex_unlock( &lvc_lock );
+}
+
+/**********************************************************************/
+/** Start read side section: values found stay valid until release.
+ * Returns section token for release.
+ *
+ */
+uint32_t eclilvc_hold(void) {
+
+    uint32_t epoch = 0;
+
+    /* Counted in the epoch that is still current after the count */
+    for ( ;; ) {
+        epoch = __atomic_load_n( &lvc_epoch, __ATOMIC_SEQ_CST ) & 1;
+        __atomic_add_fetch( &lvc_readers[epoch], 1, __ATOMIC_SEQ_CST );
+        if ( ( __atomic_load_n( &lvc_epoch, __ATOMIC_SEQ_CST ) & 1 ) == epoch ) {
+            return epoch;
+        }
+        __atomic_sub_fetch( &lvc_readers[epoch], 1, __ATOMIC_SEQ_CST );
+    }
+}
+
+/**********************************************************************/
+/** End read side section.
+ *
+ * @param token: eclilvc_hold return.
+ *
+ */
+void eclilvc_release(uint32_t token) {
+
+    __atomic_sub_fetch( &lvc_readers[token & 1], 1, __ATOMIC_RELEASE );
+}
+
+/**********************************************************************/
+/** Find latest value of topic inside a read side section, NULL when the
+ * topic has no value.
+ *
+ * @param topic: topic name.
+ *
+ */
+const ecli_lvc_value_t *eclilvc_find(const char *topic) {
+
+    eclilvc_entry_t **buckets = __atomic_load_n( &lvc_buckets, __ATOMIC_ACQUIRE );
+    eclilvc_entry_t *entry   = NULL;
+    uint32_t topic_len = strlen( topic );
+    uint64_t hash      = 0;
+
+    if ( buckets == NULL ) {
+        return NULL;
+    }
+    hash = eclihash_xxh3( topic, topic_len );
+    for ( entry = __atomic_load_n( &buckets[hash & lvc_mask], __ATOMIC_SEQ_CST ); entry != NULL;
+          entry = __atomic_load_n( &entry->next, __ATOMIC_ACQUIRE ) ) {
+        if ( entry->hash == hash && entry->topic_len == topic_len &&
+             memcmp( entry->topic, topic, topic_len ) == 0 ) {
+            if ( !__atomic_load_n( &entry->used, __ATOMIC_RELAXED ) ) {
+                __atomic_store_n( &entry->used, 1, __ATOMIC_RELAXED );
+            }
+            return __atomic_load_n( &entry->value, __ATOMIC_SEQ_CST );
+        }
+    }
+
+    return NULL;
+}
+
+/**********************************************************************/
+/** Copy latest value of topic, returns payload len (copied up to size),
+ * -1 when the topic has no value.
+ *
+ * @param topic: topic name.
+ * @param buffer: payload output.
+ * @param size: buffer size.
+ * @param ts_ms: arrival epoch msecs output (may be NULL).
+ * @param retain: retain flag output (may be NULL).
+ *
+ */
+int32_t eclilvc_get(const char *topic, uint8_t *buffer, uint32_t size, uint64_t *ts_ms, uint8_t *retain) {
+
+    const ecli_lvc_value_t *value = NULL;
+    uint32_t token = eclilvc_hold();
+    int32_t  len   = -1;
+
+    if ( ( value = eclilvc_find( topic ) ) != NULL ) {
+        len = value->len;
+        memcpy( buffer, value->data, value->len < size ? value->len : size );
+        if ( ts_ms ) {
+            *ts_ms = value->ts_ms;
+        }
+        if ( retain ) {
+            *retain = value->retain;
+        }
+    }
+    eclilvc_release( token );
+
+    return len;
+}
+
+/**********************************************************************/
+/** Get cache counters (waits for a store in progress).
+ *
+ * @param topics: cached topics output.
+ * @param bytes: used bytes output.
+ * @param evicted: evicted topics output.
+ *
+ */
+void eclilvc_stats(uint32_t *topics, uint64_t *bytes, uint64_t *evicted) {
+
+    pthread_mutex_lock( &lvc_lock );
+    *topics = lvc_topics;
+    *bytes = lvc_bytes;
+    *evicted = lvc_evicted;
+    pthread_mutex_unlock( &lvc_lock );
+}
+
+/**********************************************************************/
+/**********************************************************************/
+/** Remove topic from cache (writer, lock held).
+ *
+ * @param entry: cached topic.
+ *
+ */
+static void eclilvc_evict(eclilvc_entry_t *entry) {
+
+    eclilvc_entry_t **link = &lvc_buckets[entry->hash & lvc_mask];
+
+    while ( *link != entry ) {
+        link = &( *link )->next;
+    }
+    /* Readers on it still follow its next link */
+    __atomic_store_n( link, entry->next, __ATOMIC_SEQ_CST );
+    if ( entry->newer ) {
+        entry->newer->older = entry->older;
+    }
+    else {
+        lvc_newest = entry->older;
+    }
+    if ( entry->older ) {
+        entry->older->newer = entry->newer;
+    }
+    else {
+        lvc_oldest = entry->newer;
+    }
+    lvc_bytes -= sizeof( eclilvc_entry_t ) + entry->topic_len + 1 + sizeof( ecli_lvc_value_t ) + entry->value->len;
+    lvc_topics--;
+    lvc_evicted++;
+    eclilvc_retire( entry->value );
+    eclilvc_retire( entry );
+}
+
+/**********************************************************************/
+/** Move topic to newest end of LRU list (writer, lock held).
+ *
+ * @param entry: cached topic, linked or not.
+ *
+ */
+static void eclilvc_touch(eclilvc_entry_t *entry) {
+
+    if ( lvc_newest == entry ) {
+        return;
+    }
+    if ( entry->newer ) {
+        entry->newer->older = entry->older;
+        if ( entry->older ) {
+            entry->older->newer = entry->newer;
+        }
+        else {
+            lvc_oldest = entry->newer;
+        }
+    }
+    entry->newer = NULL;
+    entry->older = lvc_newest;
+    if ( lvc_newest ) {
+        lvc_newest->newer = entry;
+    }
+    lvc_newest = entry;
+    if ( lvc_oldest == NULL ) {
+        lvc_oldest = entry;
+    }
+}
+
+/**********************************************************************/
+/** Allocate value or topic with its retired list link, NULL on error.
+ *
+ * @param size: bytes.
+ *
+ */
+static void *eclilvc_alloc(uint64_t size) {
+
+    eclilvc_node_t *node = malloc( sizeof( eclilvc_node_t ) + size );
+
+    return node ? node + 1 : NULL;
+}
+
+/**********************************************************************/
+/** Free unlinked value or topic once readers that may see it are out
+ * (writer, lock held).
+ *
+ * @param ptr: unlinked value or topic.
+ *
+ */
+static void eclilvc_retire(void *ptr) {
+
+    eclilvc_node_t *node = ( eclilvc_node_t * ) ptr - 1;
+
+    node->next = lvc_retired[lvc_epoch & 1];
+    lvc_retired[lvc_epoch & 1] = node;
+}
+
+/**********************************************************************/
+/** Free memory retired in the last epoch when its readers are out and
+ * start a new epoch (writer, lock held).
+ *
+ */
+static void eclilvc_reclaim(void) {
+
+    eclilvc_node_t *node = NULL;
+    uint32_t last = ( lvc_epoch + 1 ) & 1;
+
+    /* Readers of the last epoch may still see its retired memory; readers
+       of this one started after it was unlinked */
+    if ( lvc_retired[0] == NULL && lvc_retired[1] == NULL ) {
+        return;
+    }
+    if ( __atomic_load_n( &lvc_readers[last], __ATOMIC_SEQ_CST ) != 0 ) {
+        return;
+    }
+    while ( ( node = lvc_retired[last] ) != NULL ) {
+        lvc_retired[last] = node->next;
+        free( node );
+    }
+    __atomic_store_n( &lvc_epoch, lvc_epoch + 1, __ATOMIC_SEQ_CST );
+}
@@ -0,0 +1,825 @@
+/***********************************************************************
+* FILENAME    :   libeclimqttmetrics.c
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   Library code for client counters and latency histograms.
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/**********************************************************************/
+
+#include <libeclimqttmetrics.h>
+#include <libeclimqttlog.h>
+
+/**********************************************************************/
+#define METRICS_PATH_LEN  512
+
+/**********************************************************************/
+
+static const char * const pkt_type_str[METRICS_PKT_TYPES] = {
+    "RESERVED", "CONNECT", "CONNACK", "PUBLISH", "PUBACK", "PUBREC",
+    "PUBREL", "PUBCOMP", "SUBSCRIBE", "SUBACK", "UNSUBSCRIBE",
+    "UNSUBACK", "PINGREQ", "PINGRESP", "DISCONNECT", "AUTH"
+};
+
+static ecli_metrics_t    *metrics_list    = NULL;    /* Registered connections */
+static ecli_metrics_t    metrics_retired;            /* Freed connections totals */
+static pthread_mutex_t   metrics_lock     = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t         dump_thread;
+static int32_t           dump_pipe[2]     = { -1, -1 };
+static uint32_t          dump_interval    = 0;
+static ecli_metrics_fmt  dump_fmt         = METRICS_PROM;
+static char              dump_path[METRICS_PATH_LEN];
+
+/**********************************************************************/
+/**********************************************************************/
+/** Get histogram bucket for value.
+ *
+ * @param value: value in nanoseconds.
+ *
+ */
+static uint32_t eclimetrics_hist_index(uint64_t value);
+
+/**********************************************************************/
+/** Get highest value counted in bucket.
+ *
+ * @param index: bucket index.
+ *
+ */
+static uint64_t eclimetrics_hist_value(uint32_t index);
+
+/**********************************************************************/
+/** Add src metrics values in dst.
+ *
+ * @param dst: accumulated metrics.
+ * @param src: metrics to add.
+ *
+ */
+static void eclimetrics_merge(ecli_metrics_t *dst, const ecli_metrics_t *src);
+
+/**********************************************************************/
+/** Dump metrics sets as Prometheus text, one family at a time.
+ *
+ * @param out: output stream.
+ * @param sets: metrics to dump (global first).
+ * @param num: number of sets.
+ *
+ */
+static void eclimetrics_dump_prom(FILE *out, const ecli_metrics_t * const *sets, uint32_t num);
+
+/**********************************************************************/
+/** Dump one metrics set as JSON object.
+ *
+ * @param out: output stream.
+ * @param metrics: metrics to dump.
+ *
+ */
+static void eclimetrics_dump_json(FILE *out, const ecli_metrics_t *metrics);
+
+/**********************************************************************/
+/** Write dump in file (tmp file + rename) or stderr.
+ *
+ */
+static void eclimetrics_dump_file(void);
+
+/**********************************************************************/
+/** SIGUSR1 handler: wake dump thread.
+ *
+ * @param signal: signal number.
+ *
+ */
+static void eclimetrics_signal(int signal);
+
+/**********************************************************************/
+/** Background dump thread.
+ *
+ * @param arg: unused.
+ *
+ */
+static void *eclimetrics_dumper(void *arg);
+
+/**********************************************************************/
+/**********************************************************************/
+/** Allocate and register metrics for a connection.
+ *
+ * @param label: label used in dumps (client id).
+ *
+ */
+ecli_metrics_t *eclimetrics_new(const char *label) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    ecli_metrics_t *metrics = calloc( 1, sizeof( ecli_metrics_t ) );
+
+    if ( metrics == NULL ) {
+        return NULL;
+    }
+    strncpy( metrics->label, label, sizeof( metrics->label ) - 1 );
+    pthread_mutex_lock( &metrics_lock );
+    metrics->next = metrics_list;
+    metrics_list = metrics;
+    pthread_mutex_unlock( &metrics_lock );
+
+    return metrics;
+}
+
+/**********************************************************************/
+/** Unregister connection metrics, keeping its values in global totals.
+ *
+ * @param metrics: connection metrics.
+ *
+ */
+void eclimetrics_free(ecli_metrics_t *metrics) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    ecli_metrics_t **item;
+
+    if ( metrics == NULL ) {
+        return;
+    }
+    pthread_mutex_lock( &metrics_lock );
+    for ( item = &metrics_list; *item != NULL; item = &( *item )->next ) {
+        if ( *item == metrics ) {
+            *item = metrics->next;
+            break;
+        }
+    }
+    eclimetrics_merge( &metrics_retired, metrics );
+    pthread_mutex_unlock( &metrics_lock );
+    free( metrics );
+}
+
+/**********************************************************************/
+/** Monotonic time in nanoseconds.
+ *
+ */
+uint64_t eclimetrics_now(void) {
+
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+
+    return ( uint64_t ) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**********************************************************************/
+/** Record a value in histogram.
+ *
+ * @param hist: histogram.
+ * @param value: value in nanoseconds.
+ *
+ */
+void eclimetrics_hist_record(ecli_hist_t *hist, uint64_t value) {
+
+    METRICS_ADD( hist->buckets[ eclimetrics_hist_index( value ) ], 1 );
+    METRICS_ADD( hist->count, 1 );
+    METRICS_ADD( hist->sum, value );
+    /* Racy max is fine: a lost update is corrected by next bigger value */
+    if ( value > METRICS_GET( hist->max ) ) {
+        hist->max = value;
+    }
+}
+
+/**********************************************************************/
+/** Get value at percentile from histogram.
+ *
+ * @param hist: histogram.
+ * @param percentile: 0.0 - 100.0
+ *
+ */
+uint64_t eclimetrics_hist_percentile(const ecli_hist_t *hist, double percentile) {
+
+    uint64_t count = METRICS_GET( hist->count );
+    uint64_t rank  = 0;
+    uint64_t seen  = 0;
+    uint64_t value = 0;
+    uint32_t i     = 0;
+
+    if ( count == 0 ) {
+        return 0;
+    }
+    rank = ( uint64_t ) ( ( percentile / 100.0 ) * count + 0.5 );
+    if ( rank == 0 ) {
+        rank = 1;
+    }
+    for ( i = 0; i < METRICS_HIST_BUCKETS; i++ ) {
+        seen += METRICS_GET( hist->buckets[i] );
+        if ( seen >= rank ) {
+            value = eclimetrics_hist_value( i );
+            break;
+        }
+    }
+    /* Bucket bound may exceed the biggest recorded value */
+    if ( value > hist->max ) {
+        value = hist->max;
+    }
+
+    return value;
+}
+
+/**********************************************************************/
+/** Record a sent packet and time blocked sending it.
+ *
+ * @param metrics: connection metrics (may be NULL).
+ * @param packet: packet buffer (first byte is control type).
+ * @param len: bytes sent.
+ * @param nsecs: time blocked in send.
+ *
+ */
+void eclimetrics_tx(ecli_metrics_t *metrics, const uint8_t *packet, uint32_t len, uint64_t nsecs) {
+
+    uint8_t type = packet[0] >> 4;
+
+    if ( metrics == NULL ) {
+        return;
+    }
+    METRICS_ADD( metrics->tx_packets[type], 1 );
+    METRICS_ADD( metrics->tx_bytes[type], len );
+    eclimetrics_hist_record( &metrics->send_time, nsecs );
+}
+
+/**********************************************************************/
+/** Record a received packet.
+ *
+ * @param metrics: connection metrics (may be NULL).
+ * @param packet: packet buffer (first byte is control type).
+ * @param len: packet len.
+ *
+ */
+void eclimetrics_rx(ecli_metrics_t *metrics, const uint8_t *packet, uint32_t len) {
+
+    uint8_t type = packet[0] >> 4;
+
+    if ( metrics == NULL ) {
+        return;
+    }
+    METRICS_ADD( metrics->rx_packets[type], 1 );
+    METRICS_ADD( metrics->rx_bytes[type], len );
+    if ( len > METRICS_GET( metrics->rx_buffer_hwm ) ) {
+        metrics->rx_buffer_hwm = len;
+    }
+}
+
+/**********************************************************************/
+/** Record time blocked in recv.
+ *
+ * @param metrics: connection metrics (may be NULL).
+ * @param nsecs: time blocked in recv.
+ *
+ */
+void eclimetrics_recv_time(ecli_metrics_t *metrics, uint64_t nsecs) {
+
+    if ( metrics == NULL ) {
+        return;
+    }
+    eclimetrics_hist_record( &metrics->recv_time, nsecs );
+}
+
+/**********************************************************************/
+/** Record a publish and, for QoS > 0, publish to ack latency.
+ *
+ * @param metrics: connection metrics (may be NULL).
+ * @param qos: publish QoS.
+ * @param ack_nsecs: publish to ack time (0 for QoS 0).
+ *
+ */
+void eclimetrics_publish(ecli_metrics_t *metrics, uint8_t qos, uint64_t ack_nsecs) {
+
+    if ( metrics == NULL || qos >= METRICS_QOS_LEVELS ) {
+        return;
+    }
+    METRICS_ADD( metrics->publish_qos[qos], 1 );
+    if ( qos ) {
+        eclimetrics_hist_record( &metrics->pub_ack_lat, ack_nsecs );
+    }
+}
+
+/**********************************************************************/
+/** Record a failed ack read, counted as timeout if errno says so.
+ *
+ * @param metrics: connection metrics (may be NULL).
+ *
+ */
+void eclimetrics_ack_error(ecli_metrics_t *metrics) {
+
+    if ( metrics == NULL ) {
+        return;
+    }
+    if ( errno == EAGAIN || errno == EWOULDBLOCK ) {
+        METRICS_ADD( metrics->ack_timeouts, 1 );
+    }
+}
+
+/**********************************************************************/
+/** Record a QoS 0 publish dropped by the send queue.
+ *
+ * @param metrics: connection metrics (may be NULL).
+ *
+ */
+void eclimetrics_tx_drop(ecli_metrics_t *metrics) {
+
+    if ( metrics == NULL ) {
+        return;
+    }
+    METRICS_ADD( metrics->tx_dropped, 1 );
+}
+
+/**********************************************************************/
+/** Record send queue size (high-water mark).
+ *
+ * @param metrics: connection metrics (may be NULL).
+ * @param queued: queued bytes.
+ *
+ */
+void eclimetrics_tx_queued(ecli_metrics_t *metrics, uint64_t queued) {
+
+    if ( metrics == NULL ) {
+        return;
+    }
+    if ( queued > METRICS_GET( metrics->tx_queue_hwm ) ) {
+        metrics->tx_queue_hwm = queued;
+    }
+}
+
+/**********************************************************************/
+/** Record a successful connection (reconnect after the first one).
+ *
+ * @param metrics: connection metrics (may be NULL).
+ *
+ */
+void eclimetrics_connect(ecli_metrics_t *metrics) {
+
+    if ( metrics == NULL ) {
+        return;
+    }
+    if ( METRICS_ADD( metrics->connects, 1 ) ) {
+        METRICS_ADD( metrics->reconnects, 1 );
+    }
+}
+
+/**********************************************************************/
+/** Sum every registered connection in global metrics.
+ *
+ * @param global: output metrics.
+ *
+ */
+void eclimetrics_global(ecli_metrics_t *global) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    ecli_metrics_t *metrics;
+
+    memset( global, 0, sizeof( ecli_metrics_t ) );
+    strncpy( global->label, "global", sizeof( global->label ) - 1 );
+    pthread_mutex_lock( &metrics_lock );
+    eclimetrics_merge( global, &metrics_retired );
+    for ( metrics = metrics_list; metrics != NULL; metrics = metrics->next ) {
+        eclimetrics_merge( global, metrics );
+    }
+    pthread_mutex_unlock( &metrics_lock );
+}
+
+/**********************************************************************/
+/** Dump global and per connection metrics.
+ *
+ * @param out: output stream.
+ * @param fmt: dump format.
+ *
+ */
+void eclimetrics_dump(FILE *out, ecli_metrics_fmt fmt) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    ecli_metrics_t *global = malloc( sizeof( ecli_metrics_t ) );
+    ecli_metrics_t *metrics;
+    const ecli_metrics_t **sets = NULL;
+    uint32_t num = 1;
+
+    if ( global == NULL ) {
+        return;
+    }
+    eclimetrics_global( global );
+    pthread_mutex_lock( &metrics_lock );
+    if ( fmt == METRICS_JSON ) {
+        fprintf( out, "{\"global\":" );
+        eclimetrics_dump_json( out, global );
+        fprintf( out, ",\"connections\":[" );
+        for ( metrics = metrics_list; metrics != NULL; metrics = metrics->next ) {
+            eclimetrics_dump_json( out, metrics );
+            if ( metrics->next ) {
+                fprintf( out, "," );
+            }
+        }
+        fprintf( out, "]}\n" );
+    }
+    else {
+        /* Series of one family must be together: global then connections */
+        for ( metrics = metrics_list; metrics != NULL; metrics = metrics->next ) {
+            num++;
+        }
+        if ( ( sets = malloc( sizeof( ecli_metrics_t * ) * num ) ) != NULL ) {
+            sets[0] = global;
+            num = 1;
+            for ( metrics = metrics_list; metrics != NULL; metrics = metrics->next ) {
+                sets[num++] = metrics;
+            }
+            eclimetrics_dump_prom( out, sets, num );
+            free( sets );
+        }
+    }
+    pthread_mutex_unlock( &metrics_lock );
+    free( global );
+}
+
+/**********************************************************************/
+/** Start background dump to file every interval secs, on SIGUSR1
+ * and at exit.
+ *
+ * @param path: output file path (stderr if empty).
+ * @param interval: seconds between dumps, 0 dumps only on SIGUSR1.
+ * @param fmt: dump format.
+ *
+ */
+int8_t eclimetrics_start_dump(const char *path, uint32_t interval, ecli_metrics_fmt fmt) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    struct sigaction action;
+
+    if ( dump_pipe[0] >= 0 ) {
+        return 0;
+    }
+    strncpy( dump_path, path, sizeof( dump_path ) - 1 );
+    dump_interval = interval;
+    dump_fmt = fmt;
+    if ( pipe( dump_pipe ) < 0 ) {
+        return -1;
+    }
+    fcntl( dump_pipe[1], F_SETFL, O_NONBLOCK );
+
+    memset( &action, 0, sizeof( action ) );
+    action.sa_handler = eclimetrics_signal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset( &action.sa_mask );
+    sigaction( SIGUSR1, &action, NULL );
+
+    if ( pthread_create( &dump_thread, NULL, eclimetrics_dumper, NULL ) != 0 ) {
+        return -1;
+    }
+    pthread_detach( dump_thread );
+    /* Last dump when process ends */
+    atexit( eclimetrics_dump_file );
+
+    return 0;
+}
+
+/**********************************************************************/
+/**********************************************************************/
+/** Get histogram bucket for value.
+ *
+ * @param value: value in nanoseconds.
+ *
+ */
+static uint32_t eclimetrics_hist_index(uint64_t value) {
+
+    uint32_t msb;
+
+    if ( value < METRICS_HIST_SUB ) {
+        return value;
+    }
+    msb = 63 - __builtin_clzll( value );
+    if ( msb >= METRICS_HIST_MAX_BITS ) {
+        return METRICS_HIST_BUCKETS - 1;
+    }
+
+    return ( msb - METRICS_HIST_SUB_BITS + 1 ) * METRICS_HIST_SUB +
+           ( ( value >> ( msb - METRICS_HIST_SUB_BITS ) ) & ( METRICS_HIST_SUB - 1 ) );
+}
+
+/**********************************************************************/
+/** Get highest value counted in bucket.
+ *
+ * @param index: bucket index.
+ *
+ */
+static uint64_t eclimetrics_hist_value(uint32_t index) {
+
+    uint32_t group = index / METRICS_HIST_SUB;
+    uint64_t sub   = index % METRICS_HIST_SUB;
+
+    if ( group == 0 ) {
+        return sub;
+    }
+
+    return ( ( ( METRICS_HIST_SUB + sub + 1 ) << ( group - 1 ) ) - 1 );
+}
+
+/**********************************************************************/
+/** Add src metrics values in dst.
+ *
+ * @param dst: accumulated metrics.
+ * @param src: metrics to add.
+ *
+ */
+static void eclimetrics_merge(ecli_metrics_t *dst, const ecli_metrics_t *src) {
+
+    const ecli_hist_t *src_hist[] = { &src->pub_ack_lat, &src->send_time, &src->recv_time };
+    ecli_hist_t       *dst_hist[] = { &dst->pub_ack_lat, &dst->send_time, &dst->recv_time };
+    uint32_t i = 0;
+    uint32_t h = 0;
+
+    for ( i = 0; i < METRICS_PKT_TYPES; i++ ) {
+        dst->tx_packets[i] += METRICS_GET( src->tx_packets[i] );
+        dst->tx_bytes[i]   += METRICS_GET( src->tx_bytes[i] );
+        dst->rx_packets[i] += METRICS_GET( src->rx_packets[i] );
+        dst->rx_bytes[i]   += METRICS_GET( src->rx_bytes[i] );
+    }
+    for ( i = 0; i < METRICS_QOS_LEVELS; i++ ) {
+        dst->publish_qos[i] += METRICS_GET( src->publish_qos[i] );
+    }
+    dst->retransmits  += METRICS_GET( src->retransmits );
+    dst->connects     += METRICS_GET( src->connects );
+    dst->reconnects   += METRICS_GET( src->reconnects );
+    dst->ack_timeouts += METRICS_GET( src->ack_timeouts );
+    dst->tx_dropped   += METRICS_GET( src->tx_dropped );
+    if ( src->rx_buffer_hwm > dst->rx_buffer_hwm ) {
+        dst->rx_buffer_hwm = src->rx_buffer_hwm;
+    }
+    if ( src->tx_queue_hwm > dst->tx_queue_hwm ) {
+        dst->tx_queue_hwm = src->tx_queue_hwm;
+    }
+    for ( h = 0; h < sizeof( src_hist ) / sizeof( src_hist[0] ); h++ ) {
+        dst_hist[h]->count += METRICS_GET( src_hist[h]->count );
+        dst_hist[h]->sum   += METRICS_GET( src_hist[h]->sum );
+        if ( src_hist[h]->max > dst_hist[h]->max ) {
+            dst_hist[h]->max = src_hist[h]->max;
+        }
+        for ( i = 0; i < METRICS_HIST_BUCKETS; i++ ) {
+            dst_hist[h]->buckets[i] += METRICS_GET( src_hist[h]->buckets[i] );
+        }
+    }
+}
+
+/**********************************************************************/
+/** Dump metrics sets as Prometheus text, one family at a time.
+ *
+ * @param out: output stream.
+ * @param sets: metrics to dump (global first).
+ * @param num: number of sets.
+ *
+ */
+static void eclimetrics_dump_prom(FILE *out, const ecli_metrics_t * const *sets, uint32_t num) {
+
+    static const struct {
+        const char *name;
+        const char *type;
+        const char *help;
+        size_t     offset;
+    } scalars[] = {
+        { "retransmits_total", "counter", "PUBLISH packets re-sent with DUP after reconnect",
+          offsetof( ecli_metrics_t, retransmits ) },
+        { "reconnects_total", "counter", "Connections after the first one",
+          offsetof( ecli_metrics_t, reconnects ) },
+        { "ack_timeouts_total", "counter", "Acks not received in time",
+          offsetof( ecli_metrics_t, ack_timeouts ) },
+        { "rx_buffer_hwm_bytes", "gauge", "Biggest packet buffered on receive",
+          offsetof( ecli_metrics_t, rx_buffer_hwm ) },
+        { "tx_dropped_total", "counter", "QoS 0 publishes dropped by the send queue",
+          offsetof( ecli_metrics_t, tx_dropped ) },
+        { "tx_queue_hwm_bytes", "gauge", "Most bytes in the send queue",
+          offsetof( ecli_metrics_t, tx_queue_hwm ) },
+    };
+    static const struct {
+        const char *name;
+        const char *help;
+        size_t     offset;
+    } hists[] = {
+        { "publish_ack_latency", "Publish to PUBACK/PUBCOMP time", offsetof( ecli_metrics_t, pub_ack_lat ) },
+        { "send_blocked", "Time blocked in send", offsetof( ecli_metrics_t, send_time ) },
+        { "recv_blocked", "Time blocked in recv", offsetof( ecli_metrics_t, recv_time ) },
+    };
+    /* Bucket bounds in seconds, the last one is +Inf */
+    static const double bounds[] = { 1e-6, 5e-6, 1e-5, 2.5e-5, 5e-5, 1e-4, 2.5e-4, 5e-4,
+                                     1e-3, 2.5e-3, 5e-3, 1e-2, 2.5e-2, 5e-2, 0.1, 0.25,
+                                     0.5, 1.0, 2.5, 5.0, 10.0 };
+    const ecli_hist_t *hist;
+    uint64_t cumulative = 0;
+    uint32_t i = 0;
+    uint32_t n = 0;
+    uint32_t b = 0;
+    uint32_t index = 0;
+
+    fprintf( out, "# HELP ecli_mqtt_tx_packets_total Packets sent per control type\n"
+                  "# TYPE ecli_mqtt_tx_packets_total counter\n" );
+    for ( n = 0; n < num; n++ ) {
+        for ( i = 0; i < METRICS_PKT_TYPES; i++ ) {
+            if ( sets[n]->tx_packets[i] ) {
+                fprintf( out, "ecli_mqtt_tx_packets_total{client=\"%s\",type=\"%s\"} %llu\n",
+                         sets[n]->label, pkt_type_str[i], ( unsigned long long ) sets[n]->tx_packets[i] );
+            }
+        }
+    }
+    fprintf( out, "# HELP ecli_mqtt_tx_bytes_total Bytes sent per control type\n"
+                  "# TYPE ecli_mqtt_tx_bytes_total counter\n" );
+    for ( n = 0; n < num; n++ ) {
+        for ( i = 0; i < METRICS_PKT_TYPES; i++ ) {
+            if ( sets[n]->tx_packets[i] ) {
+                fprintf( out, "ecli_mqtt_tx_bytes_total{client=\"%s\",type=\"%s\"} %llu\n",
+                         sets[n]->label, pkt_type_str[i], ( unsigned long long ) sets[n]->tx_bytes[i] );
+            }
+        }
+    }
+    fprintf( out, "# HELP ecli_mqtt_rx_packets_total Packets received per control type\n"
+                  "# TYPE ecli_mqtt_rx_packets_total counter\n" );
+    for ( n = 0; n < num; n++ ) {
+        for ( i = 0; i < METRICS_PKT_TYPES; i++ ) {
+            if ( sets[n]->rx_packets[i] ) {
+                fprintf( out, "ecli_mqtt_rx_packets_total{client=\"%s\",type=\"%s\"} %llu\n",
+                         sets[n]->label, pkt_type_str[i], ( unsigned long long ) sets[n]->rx_packets[i] );
+            }
+        }
+    }
+    fprintf( out, "# HELP ecli_mqtt_rx_bytes_total Bytes received per control type\n"
+                  "# TYPE ecli_mqtt_rx_bytes_total counter\n" );
+    for ( n = 0; n < num; n++ ) {
+        for ( i = 0; i < METRICS_PKT_TYPES; i++ ) {
+            if ( sets[n]->rx_packets[i] ) {
+                fprintf( out, "ecli_mqtt_rx_bytes_total{client=\"%s\",type=\"%s\"} %llu\n",
+                         sets[n]->label, pkt_type_str[i], ( unsigned long long ) sets[n]->rx_bytes[i] );
+            }
+        }
+    }
+    fprintf( out, "# HELP ecli_mqtt_publish_total Publishes per QoS\n"
+                  "# TYPE ecli_mqtt_publish_total counter\n" );
+    for ( n = 0; n < num; n++ ) {
+        for ( i = 0; i < METRICS_QOS_LEVELS; i++ ) {
+            fprintf( out, "ecli_mqtt_publish_total{client=\"%s\",qos=\"%u\"} %llu\n",
+                     sets[n]->label, i, ( unsigned long long ) sets[n]->publish_qos[i] );
+        }
+    }
+    for ( i = 0; i < sizeof( scalars ) / sizeof( scalars[0] ); i++ ) {
+        fprintf( out, "# HELP ecli_mqtt_%s %s\n# TYPE ecli_mqtt_%s %s\n",
+                 scalars[i].name, scalars[i].help, scalars[i].name, scalars[i].type );
+        for ( n = 0; n < num; n++ ) {
+            fprintf( out, "ecli_mqtt_%s{client=\"%s\"} %llu\n", scalars[i].name, sets[n]->label,
+                     ( unsigned long long ) *( const uint64_t * ) ( ( const uint8_t * ) sets[n] + scalars[i].offset ) );
+        }
+    }
+    /* Log-linear buckets summed up to each bound (buckets ending under it) */
+    for ( i = 0; i < sizeof( hists ) / sizeof( hists[0] ); i++ ) {
+        fprintf( out, "# HELP ecli_mqtt_%s_seconds %s\n# TYPE ecli_mqtt_%s_seconds histogram\n",
+                 hists[i].name, hists[i].help, hists[i].name );
+        for ( n = 0; n < num; n++ ) {
+            hist = ( const ecli_hist_t * ) ( ( const uint8_t * ) sets[n] + hists[i].offset );
+            cumulative = 0;
+            index = 0;
+            for ( b = 0; b < sizeof( bounds ) / sizeof( bounds[0] ); b++ ) {
+                while ( index < METRICS_HIST_BUCKETS && eclimetrics_hist_value( index ) <= bounds[b] * 1e9 ) {
+                    cumulative += hist->buckets[index++];
+                }
+                fprintf( out, "ecli_mqtt_%s_seconds_bucket{client=\"%s\",le=\"%g\"} %llu\n",
+                         hists[i].name, sets[n]->label, bounds[b], ( unsigned long long ) cumulative );
+            }
+            fprintf( out, "ecli_mqtt_%s_seconds_bucket{client=\"%s\",le=\"+Inf\"} %llu\n",
+                     hists[i].name, sets[n]->label, ( unsigned long long ) hist->count );
+            fprintf( out, "ecli_mqtt_%s_seconds_sum{client=\"%s\"} %.9f\n",
+                     hists[i].name, sets[n]->label, hist->sum / 1e9 );
+            fprintf( out, "ecli_mqtt_%s_seconds_count{client=\"%s\"} %llu\n",
+                     hists[i].name, sets[n]->label, ( unsigned long long ) hist->count );
+        }
+    }
+}
+
+/**********************************************************************/
+/** Dump one metrics set as JSON object.
+ *
+ * @param out: output stream.
+ * @param metrics: metrics to dump.
+ *
+ */
+static void eclimetrics_dump_json(FILE *out, const ecli_metrics_t *metrics) {
+
+    const ecli_hist_t *hist[]      = { &metrics->pub_ack_lat, &metrics->send_time, &metrics->recv_time };
+    const char        *hist_name[] = { "publish_ack_latency_ns", "send_blocked_ns", "recv_blocked_ns" };
+    uint32_t i     = 0;
+    uint8_t  first = 1;
+
+    fprintf( out, "{\"client\":\"%s\",\"packets\":{", metrics->label );
+    for ( i = 0; i < METRICS_PKT_TYPES; i++ ) {
+        if ( metrics->tx_packets[i] || metrics->rx_packets[i] ) {
+            fprintf( out, "%s\"%s\":{\"tx\":%llu,\"tx_bytes\":%llu,\"rx\":%llu,\"rx_bytes\":%llu}",
+                     first ? "" : ",", pkt_type_str[i],
+                     ( unsigned long long ) metrics->tx_packets[i],
+                     ( unsigned long long ) metrics->tx_bytes[i],
+                     ( unsigned long long ) metrics->rx_packets[i],
+                     ( unsigned long long ) metrics->rx_bytes[i] );
+            first = 0;
+        }
+    }
+    fprintf( out, "},\"publish_qos\":[%llu,%llu,%llu],\"retransmits\":%llu,"
+                  "\"reconnects\":%llu,\"ack_timeouts\":%llu,\"rx_buffer_hwm\":%llu,"
+                  "\"tx_dropped\":%llu,\"tx_queue_hwm\":%llu",
+             ( unsigned long long ) metrics->publish_qos[0],
+             ( unsigned long long ) metrics->publish_qos[1],
+             ( unsigned long long ) metrics->publish_qos[2],
+             ( unsigned long long ) metrics->retransmits,
+             ( unsigned long long ) metrics->reconnects,
+             ( unsigned long long ) metrics->ack_timeouts,
+             ( unsigned long long ) metrics->rx_buffer_hwm,
+             ( unsigned long long ) metrics->tx_dropped,
+             ( unsigned long long ) metrics->tx_queue_hwm );
+    for ( i = 0; i < sizeof( hist ) / sizeof( hist[0] ); i++ ) {
+        fprintf( out, ",\"%s\":{\"count\":%llu,\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,"
+                      "\"p999\":%llu,\"max\":%llu}",
+                 hist_name[i], ( unsigned long long ) hist[i]->count,
+                 ( unsigned long long ) eclimetrics_hist_percentile( hist[i], 50.0 ),
+                 ( unsigned long long ) eclimetrics_hist_percentile( hist[i], 90.0 ),
+                 ( unsigned long long ) eclimetrics_hist_percentile( hist[i], 99.0 ),
+                 ( unsigned long long ) eclimetrics_hist_percentile( hist[i], 99.9 ),
+                 ( unsigned long long ) hist[i]->max );
+    }
+    fprintf( out, "}" );
+}
+
+/**********************************************************************/
+/** Write dump in file (tmp file + rename) or stderr.
+ *
+ */
+static void eclimetrics_dump_file(void) {
+
+    char tmp_path[METRICS_PATH_LEN + 8];
+    FILE *out;
+
+    if ( dump_path[0] == '\0' ) {
+        eclimetrics_dump( stderr, dump_fmt );
+        return;
+    }
+    snprintf( tmp_path, sizeof( tmp_path ), "%s.tmp", dump_path );
+    out = fopen( tmp_path, "w" );
+    if ( out == NULL ) {
+        perror( tmp_path );
+        return;
+    }
+    eclimetrics_dump( out, dump_fmt );
+    fclose( out );
+    rename( tmp_path, dump_path );
+}
+
+/**********************************************************************/
+/** SIGUSR1 handler: wake dump thread.
+ *
+ * @param signal: signal number.
+ *
+ */
+static void eclimetrics_signal(int signal) {
+
+    int32_t saved_errno = errno;
+    uint8_t byte        = 1;
+
+    if ( write( dump_pipe[1], &byte, 1 ) < 0 ) {
+        /* Dump already pending */
+    }
+    errno = saved_errno;
+}
+
+/**********************************************************************/
+/** Background dump thread.
+ *
+ * @param arg: unused.
+ *
+ */
+static void *eclimetrics_dumper(void *arg) {
+
+    struct pollfd pfd;
+    uint8_t byte;
+    int32_t ready;
+
+    /* Signals are handled by main thread, only the pipe wakes us */
+    sigset_t mask;
+    sigfillset( &mask );
+    pthread_sigmask( SIG_BLOCK, &mask, NULL );
+
+    pfd.fd = dump_pipe[0];
+    pfd.events = POLLIN;
+    for ( ;; ) {
+        ready = poll( &pfd, 1, dump_interval ? ( int32_t ) dump_interval * 1000 : -1 );
+        if ( ready < 0 && errno != EINTR ) {
+            break;
+        }
+        if ( ready > 0 && read( dump_pipe[0], &byte, 1 ) <= 0 ) {
+            break;
+        }
+        eclimetrics_dump_file();
+    }
+
+    return NULL;
+}
+
+/**********************************************************************/
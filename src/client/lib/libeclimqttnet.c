@@ -0,0 +1,660 @@
+/***********************************************************************
+* FILENAME    :   libeclimqttnet.c
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   Library code for broker endpoint list, name resolution
+*                 and latency ranked connection.
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+/**********************************************************************/
+
+#include <libeclimqttnet.h>
+#include <libeclimqttlog.h>
+#include <libeclimqttmetrics.h>
+
+/**********************************************************************/
+#define NET_MSG_LEN       256
+
+/**********************************************************************/
+/* Connection attempt candidate */
+typedef struct {
+    struct sockaddr_storage addr;
+    socklen_t               addr_len;
+    uint32_t                endpoint;
+} eclinet_candidate_t;
+
+/**********************************************************************/
+
+/**********************************************************************/
+/** Split "host", "host:port", "[v6addr]:port" or "v6addr" in host and port.
+ *
+ * @param item: endpoint string.
+ * @param default_port: port used when item has no port.
+ * @param endpoint: endpoint to fill.
+ *
+ */
+static int8_t eclinet_parse(const char *item, uint16_t default_port, ecli_endpoint_t *endpoint);
+
+/**********************************************************************/
+/** Resolve host, interleaving address families (IPv6 / IPv4).
+ *
+ * @param host: name or address literal.
+ * @param port: port.
+ * @param addrs: returned addresses (NET_MAX_ADDRS).
+ * @param addr_lens: returned address lens.
+ *
+ */
+static uint32_t eclinet_resolve(const char *host, uint16_t port,
+                                struct sockaddr_storage *addrs, socklen_t *addr_lens);
+
+/**********************************************************************/
+/** Background resolver, refreshes cached addresses every refresh_secs.
+ *
+ * @param arg: endpoint list.
+ *
+ */
+static void *eclinet_resolver(void *arg);
+
+/**********************************************************************/
+/** Build attempt list ordered by endpoint ranking (healthy and fastest first).
+ *
+ * @param endpoints: endpoint list.
+ * @param candidates: returned candidates (NET_MAX_CANDIDATES).
+ *
+ */
+static uint32_t eclinet_candidates(ecli_endpoints_t *endpoints, eclinet_candidate_t *candidates);
+
+/**********************************************************************/
+/** Start a non-blocking connect.
+ *
+ * @param candidate: address to connect.
+ * @param socketid: returned socket.
+ *
+ * Returns 0 connected, 1 in progress, -1 failed (errno set).
+ */
+static int8_t eclinet_start(const eclinet_candidate_t *candidate, int32_t *socketid);
+
+/**********************************************************************/
+/** Count a failed connect attempt on endpoint.
+ *
+ * @param endpoints: endpoint list.
+ * @param index: endpoint index.
+ *
+ */
+static void eclinet_failed(ecli_endpoints_t *endpoints, uint32_t index);
+
+/**********************************************************************/
+/**********************************************************************/
+/** Parse endpoint list and resolve it, starting background refresh.
+ *
+ * @param list: "host[:port],[v6addr]:port,..." comma separated brokers.
+ * @param default_port: port used when host has no port.
+ * @param refresh_secs: resolver refresh period, 0 resolves only once.
+ *
+ */
+ecli_endpoints_t *eclinet_new(const char *list, uint16_t default_port, uint32_t refresh_secs) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    ecli_endpoints_t *endpoints;
+    ecli_endpoint_t  *endpoint;
+    char     buffer_str[NET_MSG_LEN] = {0};
+    char     *list_copy;
+    char     *item;
+    char     *save_ptr = NULL;
+
+    if ( ( endpoints = calloc( 1, sizeof( ecli_endpoints_t ) ) ) == NULL ) {
+        return NULL;
+    }
+    if ( ( list_copy = strdup( list ) ) == NULL ) {
+        free( endpoints );
+        return NULL;
+    }
+    for ( item = strtok_r( list_copy, NET_LIST_SEP, &save_ptr );
+          item != NULL && endpoints->count < NET_MAX_ENDPOINTS;
+          item = strtok_r( NULL, NET_LIST_SEP, &save_ptr ) ) {
+        while ( *item == ' ' ) {
+            item++;
+        }
+        endpoint = &endpoints->endpoints[endpoints->count];
+        if ( eclinet_parse( item, default_port, endpoint ) < 0 ) {
+            snprintf(buffer_str, sizeof( buffer_str ), "Invalid broker endpoint [%s]", item);
+            eclilog_show(__FILE__, __func__, buffer_str, LOG_ERROR);
+            continue;
+        }
+        endpoint->naddrs = eclinet_resolve( endpoint->host, endpoint->port,
+                                            endpoint->addrs, endpoint->addr_lens );
+        if ( endpoint->naddrs == 0 ) {
+            snprintf(buffer_str, sizeof( buffer_str ), "Cannot resolve broker [%s], retrying later",
+                     endpoint->host);
+            eclilog_show(__FILE__, __func__, buffer_str, LOG_INFO);
+        }
+        endpoints->count++;
+    }
+    free( list_copy );
+    endpoints->current = -1;
+    endpoints->refresh_secs = refresh_secs;
+    pthread_mutex_init( &endpoints->lock, NULL );
+    pthread_cond_init( &endpoints->wake, NULL );
+    if ( refresh_secs ) {
+        endpoints->resolver_run = 1;
+        if ( pthread_create( &endpoints->resolver, NULL, eclinet_resolver, endpoints ) != 0 ) {
+            endpoints->resolver_run = 0;
+        }
+    }
+
+    return endpoints;
+}
+
+/**********************************************************************/
+/** Stop background refresh and free endpoint list.
+ *
+ * @param endpoints: endpoint list.
+ *
+ */
+void eclinet_free(ecli_endpoints_t *endpoints) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    uint8_t running;
+
+    if ( endpoints == NULL ) {
+        return;
+    }
+    pthread_mutex_lock( &endpoints->lock );
+    running = endpoints->resolver_run;
+    endpoints->resolver_run = 0;
+    pthread_cond_signal( &endpoints->wake );
+    pthread_mutex_unlock( &endpoints->lock );
+    if ( running ) {
+        pthread_join( endpoints->resolver, NULL );
+    }
+    pthread_cond_destroy( &endpoints->wake );
+    pthread_mutex_destroy( &endpoints->lock );
+    free( endpoints );
+}
+
+/**********************************************************************/
+/** Connect to the best ranked reachable endpoint. Attempts are started
+ * every stagger msecs without waiting for slower ones (happy eyeballs),
+ * the first connected socket wins. errno is set on failure.
+ *
+ * @param endpoints: endpoint list.
+ * @param timeout_ms: overall timeout in msecs, 0 no timeout.
+ * @param stagger_ms: delay between parallel attempts in msecs.
+ * @param socketid: returned connected socket (blocking mode).
+ *
+ */
+int8_t eclinet_connect(ecli_endpoints_t *endpoints, uint32_t timeout_ms,
+                       uint32_t stagger_ms, int32_t *socketid) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    eclinet_candidate_t candidates[NET_MAX_CANDIDATES];
+    struct pollfd pending[NET_MAX_CANDIDATES];
+    uint32_t pending_ep[NET_MAX_CANDIDATES];
+    uint64_t pending_start[NET_MAX_CANDIDATES];
+    uint32_t ncandidates = 0;
+    uint32_t npending    = 0;
+    uint32_t next        = 0;
+    uint32_t i           = 0;
+    int32_t  winner      = -1;
+    int32_t  sock_fd     = -1;
+    int32_t  sock_error  = 0;
+    int32_t  last_error  = ECONNREFUSED;
+    int32_t  wait_ms     = 0;
+    socklen_t opt_len    = sizeof( sock_error );
+    uint64_t now         = eclimetrics_now();
+    uint64_t deadline    = timeout_ms ? now + timeout_ms * 1000000ULL : 0;
+    uint64_t next_start  = now;
+    uint64_t winner_start = 0;
+
+    if ( endpoints == NULL || ( ncandidates = eclinet_candidates( endpoints, candidates ) ) == 0 ) {
+        errno = EHOSTUNREACH;
+        return -1;
+    }
+    while ( winner < 0 ) {
+        now = eclimetrics_now();
+        if ( deadline && now >= deadline ) {
+            last_error = ETIMEDOUT;
+            break;
+        }
+        /* Start next attempt when stagger elapsed or nothing is pending */
+        if ( next < ncandidates && ( now >= next_start || npending == 0 ) ) {
+            switch ( eclinet_start( &candidates[next], &sock_fd ) ) {
+                case 0:
+                    winner = npending;
+                    pending[npending].fd = sock_fd;
+                    pending_ep[npending] = candidates[next].endpoint;
+                    pending_start[npending++] = now;
+                    break;
+                case 1:
+                    pending[npending].fd = sock_fd;
+                    pending[npending].events = POLLOUT;
+                    pending[npending].revents = 0;
+                    pending_ep[npending] = candidates[next].endpoint;
+                    pending_start[npending++] = now;
+                    next_start = now + stagger_ms * 1000000ULL;
+                    break;
+                default:
+                    last_error = errno;
+                    eclinet_failed( endpoints, candidates[next].endpoint );
+                    next_start = 0;
+                    break;
+            }
+            next++;
+            continue;
+        }
+        if ( npending == 0 ) {
+            break;
+        }
+        /* Wait for a pending attempt until next start or deadline */
+        wait_ms = -1;
+        if ( next < ncandidates ) {
+            wait_ms = ( next_start - now + 999999ULL ) / 1000000ULL;
+        }
+        if ( deadline ) {
+            uint64_t left_ms = ( deadline - now + 999999ULL ) / 1000000ULL;
+            if ( wait_ms < 0 || left_ms < ( uint64_t ) wait_ms ) {
+                wait_ms = left_ms;
+            }
+        }
+        if ( poll( pending, npending, wait_ms ) < 0 ) {
+            if ( errno == EINTR ) {
+                continue;
+            }
+            last_error = errno;
+            break;
+        }
+        for ( i = 0; i < npending && winner < 0; ) {
+            if ( pending[i].revents == 0 ) {
+                i++;
+                continue;
+            }
+            sock_error = 0;
+            if ( getsockopt( pending[i].fd, SOL_SOCKET, SO_ERROR, &sock_error, &opt_len ) < 0 ) {
+                sock_error = errno;
+            }
+            if ( sock_error == 0 ) {
+                winner = i;
+                break;
+            }
+            /* Failed attempt, start the next one right away */
+            last_error = sock_error;
+            eclinet_failed( endpoints, pending_ep[i] );
+            close( pending[i].fd );
+            npending--;
+            pending[i] = pending[npending];
+            pending_ep[i] = pending_ep[npending];
+            pending_start[i] = pending_start[npending];
+            next_start = 0;
+        }
+    }
+    /* Close losing attempts */
+    for ( i = 0; i < npending; i++ ) {
+        if ( ( int32_t ) i != winner ) {
+            close( pending[i].fd );
+        }
+    }
+    if ( winner < 0 ) {
+        errno = last_error;
+        return -1;
+    }
+    sock_fd = pending[winner].fd;
+    winner_start = pending_start[winner];
+    /* Rest of the client expects blocking reads and writes */
+    if ( fcntl( sock_fd, F_SETFL, fcntl( sock_fd, F_GETFL, 0 ) & ~O_NONBLOCK ) < 0 ) {
+        close( sock_fd );
+        return -1;
+    }
+    pthread_mutex_lock( &endpoints->lock );
+    endpoints->current = pending_ep[winner];
+    endpoints->connect_start = winner_start;
+    pthread_mutex_unlock( &endpoints->lock );
+    *socketid = sock_fd;
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Report CONNACK result of current endpoint, updates its ranking.
+ *
+ * @param endpoints: endpoint list.
+ * @param accepted: broker accepted connection.
+ *
+ */
+void eclinet_connack(ecli_endpoints_t *endpoints, uint8_t accepted) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    ecli_endpoint_t *endpoint;
+    uint64_t sample;
+
+    if ( endpoints == NULL || endpoints->current < 0 ) {
+        return;
+    }
+    pthread_mutex_lock( &endpoints->lock );
+    endpoint = &endpoints->endpoints[endpoints->current];
+    if ( accepted ) {
+        sample = eclimetrics_now() - endpoints->connect_start;
+        if ( endpoint->ewma_nsecs == 0 ) {
+            endpoint->ewma_nsecs = sample;
+        }
+        else {
+            endpoint->ewma_nsecs += ( ( int64_t ) sample - ( int64_t ) endpoint->ewma_nsecs )
+                                    >> NET_EWMA_SHIFT;
+        }
+        endpoint->failures = 0;
+    }
+    else {
+        endpoint->failures++;
+    }
+    pthread_mutex_unlock( &endpoints->lock );
+}
+
+/**********************************************************************/
+/** Get current connected endpoint (NULL if none).
+ *
+ * @param endpoints: endpoint list.
+ *
+ */
+const ecli_endpoint_t *eclinet_current(const ecli_endpoints_t *endpoints) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    if ( endpoints == NULL || endpoints->current < 0 ) {
+        return NULL;
+    }
+
+    return &endpoints->endpoints[endpoints->current];
+}
+
+/**********************************************************************/
+/**********************************************************************/
+/** Split "host", "host:port", "[v6addr]:port" or "v6addr" in host and port.
+ *
+ * @param item: endpoint string.
+ * @param default_port: port used when item has no port.
+ * @param endpoint: endpoint to fill.
+ *
+ */
+static int8_t eclinet_parse(const char *item, uint16_t default_port, ecli_endpoint_t *endpoint) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    const char *host_end;
+    const char *port_str = NULL;
+    size_t     host_len;
+
+    if ( *item == '[' ) {
+        /* [v6addr] or [v6addr]:port */
+        if ( ( host_end = strchr( item, ']' ) ) == NULL ) {
+            return -1;
+        }
+        item++;
+        if ( host_end[1] == ':' ) {
+            port_str = host_end + 2;
+        }
+        else if ( host_end[1] != '\0' ) {
+            return -1;
+        }
+    }
+    else {
+        host_end = strchr( item, ':' );
+        /* More than one ':' is a bare IPv6 literal without port */
+        if ( host_end != NULL && strchr( host_end + 1, ':' ) == NULL ) {
+            port_str = host_end + 1;
+        }
+        else {
+            host_end = item + strlen( item );
+        }
+    }
+    host_len = host_end - item;
+    if ( host_len == 0 || host_len >= sizeof( endpoint->host ) ) {
+        return -1;
+    }
+    memcpy( endpoint->host, item, host_len );
+    endpoint->host[host_len] = '\0';
+    endpoint->port = default_port;
+    if ( port_str != NULL ) {
+        if ( ( endpoint->port = atoi( port_str ) ) == 0 ) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Resolve host, interleaving address families (IPv6 / IPv4).
+ *
+ * @param host: name or address literal.
+ * @param port: port.
+ * @param addrs: returned addresses (NET_MAX_ADDRS).
+ * @param addr_lens: returned address lens.
+ *
+ */
+static uint32_t eclinet_resolve(const char *host, uint16_t port,
+                                struct sockaddr_storage *addrs, socklen_t *addr_lens) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    struct addrinfo hints;
+    struct addrinfo *result = NULL;
+    struct addrinfo *family_next[2] = { NULL, NULL };
+    struct addrinfo *info;
+    char     port_str[NET_PORT_LEN];
+    int32_t  ai_family = AF_UNSPEC;
+    uint32_t count  = 0;
+    uint32_t family = 0;
+
+    memset( &hints, 0, sizeof( hints ) );
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICSERV;
+    snprintf( port_str, sizeof( port_str ), "%u", port );
+    if ( getaddrinfo( host, port_str, &hints, &result ) != 0 ) {
+        return 0;
+    }
+    /* Alternate families starting with the resolver preferred one */
+    family_next[0] = result;
+    for ( info = result; info != NULL; info = info->ai_next ) {
+        if ( info->ai_family != result->ai_family ) {
+            family_next[1] = info;
+            break;
+        }
+    }
+    while ( count < NET_MAX_ADDRS && ( family_next[0] != NULL || family_next[1] != NULL ) ) {
+        info = family_next[family];
+        if ( info != NULL ) {
+            if ( info->ai_addrlen <= sizeof( addrs[count] ) ) {
+                memcpy( &addrs[count], info->ai_addr, info->ai_addrlen );
+                addr_lens[count++] = info->ai_addrlen;
+            }
+            /* Next address of the same family */
+            ai_family = info->ai_family;
+            for ( info = info->ai_next; info != NULL; info = info->ai_next ) {
+                if ( info->ai_family == ai_family ) {
+                    break;
+                }
+            }
+            family_next[family] = info;
+        }
+        family ^= 1;
+    }
+    freeaddrinfo( result );
+
+    return count;
+}
+
+/**********************************************************************/
+/** Background resolver, refreshes cached addresses every refresh_secs.
+ *
+ * @param arg: endpoint list.
+ *
+ */
+static void *eclinet_resolver(void *arg) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    ecli_endpoints_t *endpoints = arg;
+    ecli_endpoint_t  *endpoint;
+    struct sockaddr_storage addrs[NET_MAX_ADDRS];
+    socklen_t addr_lens[NET_MAX_ADDRS];
+    struct timespec wake_time;
+    uint32_t naddrs = 0;
+    uint32_t i      = 0;
+
+    pthread_mutex_lock( &endpoints->lock );
+    while ( endpoints->resolver_run ) {
+        clock_gettime( CLOCK_REALTIME, &wake_time );
+        wake_time.tv_sec += endpoints->refresh_secs;
+        pthread_cond_timedwait( &endpoints->wake, &endpoints->lock, &wake_time );
+        if ( !endpoints->resolver_run ) {
+            break;
+        }
+        /* Host and port do not change, resolve without holding the lock */
+        for ( i = 0; i < endpoints->count; i++ ) {
+            endpoint = &endpoints->endpoints[i];
+            pthread_mutex_unlock( &endpoints->lock );
+            naddrs = eclinet_resolve( endpoint->host, endpoint->port, addrs, addr_lens );
+            pthread_mutex_lock( &endpoints->lock );
+            /* Keep last known addresses if resolver fails */
+            if ( naddrs ) {
+                memcpy( endpoint->addrs, addrs, sizeof( addrs[0] ) * naddrs );
+                memcpy( endpoint->addr_lens, addr_lens, sizeof( addr_lens[0] ) * naddrs );
+                endpoint->naddrs = naddrs;
+            }
+        }
+    }
+    pthread_mutex_unlock( &endpoints->lock );
+
+    return NULL;
+}
+
+/**********************************************************************/
+/** Build attempt list ordered by endpoint ranking (healthy and fastest first).
+ *
+ * @param endpoints: endpoint list.
+ * @param candidates: returned candidates (NET_MAX_CANDIDATES).
+ *
+ */
+static uint32_t eclinet_candidates(ecli_endpoints_t *endpoints, eclinet_candidate_t *candidates) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    ecli_endpoint_t *endpoint;
+    ecli_endpoint_t *other;
+    struct sockaddr_storage addrs[NET_MAX_ADDRS];
+    socklen_t addr_lens[NET_MAX_ADDRS];
+    uint32_t order[NET_MAX_ENDPOINTS];
+    uint32_t naddrs = 0;
+    uint32_t count = 0;
+    uint32_t i     = 0;
+    uint32_t j     = 0;
+    uint32_t a     = 0;
+
+    /* Endpoints never resolved are resolved now, without holding the lock
+       (host and port do not change) and published under it */
+    for ( i = 0; i < endpoints->count; i++ ) {
+        endpoint = &endpoints->endpoints[i];
+        pthread_mutex_lock( &endpoints->lock );
+        naddrs = endpoint->naddrs;
+        pthread_mutex_unlock( &endpoints->lock );
+        if ( naddrs == 0 &&
+             ( naddrs = eclinet_resolve( endpoint->host, endpoint->port, addrs, addr_lens ) ) > 0 ) {
+            pthread_mutex_lock( &endpoints->lock );
+            if ( endpoint->naddrs == 0 ) {
+                memcpy( endpoint->addrs, addrs, sizeof( addrs[0] ) * naddrs );
+                memcpy( endpoint->addr_lens, addr_lens, sizeof( addr_lens[0] ) * naddrs );
+                endpoint->naddrs = naddrs;
+            }
+            pthread_mutex_unlock( &endpoints->lock );
+        }
+    }
+    pthread_mutex_lock( &endpoints->lock );
+    /* Stable insertion sort: fewer failures, then lower latency (unknown first) */
+    for ( i = 0; i < endpoints->count; i++ ) {
+        endpoint = &endpoints->endpoints[i];
+        for ( j = i; j > 0; j-- ) {
+            other = &endpoints->endpoints[order[j - 1]];
+            if ( other->failures < endpoint->failures ||
+                 ( other->failures == endpoint->failures &&
+                   other->ewma_nsecs <= endpoint->ewma_nsecs ) ) {
+                break;
+            }
+            order[j] = order[j - 1];
+        }
+        order[j] = i;
+    }
+    for ( i = 0; i < endpoints->count; i++ ) {
+        endpoint = &endpoints->endpoints[order[i]];
+        for ( a = 0; a < endpoint->naddrs && count < NET_MAX_CANDIDATES; a++ ) {
+            memcpy( &candidates[count].addr, &endpoint->addrs[a], endpoint->addr_lens[a] );
+            candidates[count].addr_len = endpoint->addr_lens[a];
+            candidates[count++].endpoint = order[i];
+        }
+    }
+    pthread_mutex_unlock( &endpoints->lock );
+
+    return count;
+}
+
+/**********************************************************************/
+/** Start a non-blocking connect.
+ *
+ * @param candidate: address to connect.
+ * @param socketid: returned socket.
+ *
+ * Returns 0 connected, 1 in progress, -1 failed (errno set).
+ */
+static int8_t eclinet_start(const eclinet_candidate_t *candidate, int32_t *socketid) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    int32_t opt_flag   = 1;
+    int32_t sock_error = 0;
+
+    if ( ( *socketid = socket( candidate->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0 ) ) < 0 ) {
+        return -1;
+    }
+    if ( setsockopt( *socketid, IPPROTO_TCP, TCP_NODELAY,
+                     ( const void * ) &opt_flag, sizeof( opt_flag ) ) < 0 ) {
+        sock_error = errno;
+        close( *socketid );
+        errno = sock_error;
+        return -1;
+    }
+    if ( connect( *socketid, ( const struct sockaddr * ) &candidate->addr, candidate->addr_len ) == 0 ) {
+        return 0;
+    }
+    if ( errno == EINPROGRESS ) {
+        return 1;
+    }
+    sock_error = errno;
+    close( *socketid );
+    errno = sock_error;
+
+    return -1;
+}
+
+/**********************************************************************/
+/** Count a failed connect attempt on endpoint.
+ *
+ * @param endpoints: endpoint list.
+ * @param index: endpoint index.
+ *
+ */
+static void eclinet_failed(ecli_endpoints_t *endpoints, uint32_t index) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    pthread_mutex_lock( &endpoints->lock );
+    endpoints->endpoints[index].failures++;
+    pthread_mutex_unlock( &endpoints->lock );
+}
+
+/**********************************************************************/
@@ -0,0 +1,216 @@
+/***********************************************************************
+* FILENAME    :   libeclimqttpace.c
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   Library code for publish rate control (token bucket
+*                 with timerfd sleeps) and achieved rate / jitter report.
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/timerfd.h>
+
+/**********************************************************************/
+
+#include <libeclimqttpace.h>
+#include <libeclimqttconf.h>
+#include <libeclimqttlog.h>
+
+/**********************************************************************/
+#define PACE_BUF_SIZE         256
+#define PACE_NSECS            1000000000ULL
+
+/**********************************************************************/
+/**********************************************************************/
+/** Sleep until monotonic deadline, returns -1 when interrupted.
+ *
+ * @param pace: pacing state.
+ * @param deadline_ns: monotonic time in nanoseconds.
+ *
+ */
+static int8_t eclipace_sleep(ecli_pace_t *pace, uint64_t deadline_ns);
+
+/**********************************************************************/
+/** Show one report line.
+ *
+ * @param msg_fmt: report message format.
+ * @param sent: messages in period.
+ * @param nsecs: period length.
+ * @param rate: target rate.
+ * @param jitter: lateness histogram of period.
+ *
+ */
+static void eclipace_show(const char *msg_fmt, uint64_t sent, uint64_t nsecs, double rate,
+                          const ecli_hist_t *jitter);
+
+/**********************************************************************/
+/**********************************************************************/
+/** Start pacing, returns -1 when rate is not valid.
+ *
+ * @param pace: pacing state.
+ * @param rate: target msgs/sec.
+ * @param burst: messages allowed back to back when behind (>= 1).
+ * @param report_secs: seconds between rate reports, 0 only final report.
+ *
+ */
+int8_t eclipace_init(ecli_pace_t *pace, double rate, uint32_t burst, uint32_t report_secs) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    memset( pace, 0, sizeof( *pace ) );
+    pace->timer_fd = -1;
+    if ( !( rate > 0 ) || rate > PACE_NSECS ) {
+        return -1;
+    }
+    pace->rate = rate;
+    pace->burst = burst ? burst : 1;
+    pace->interval_ns = ( uint64_t ) ( PACE_NSECS / rate );
+    pace->report_secs = report_secs;
+    /* Old kernels (uClinux) without timerfd sleep with clock_nanosleep */
+    pace->timer_fd = timerfd_create( CLOCK_MONOTONIC, TFD_CLOEXEC );
+#ifdef PR_SET_TIMERSLACK
+    /* Default 50 usecs timer slack would be all the jitter at high rates */
+    prctl( PR_SET_TIMERSLACK, 1, 0, 0, 0 );
+#endif
+    pace->start_ns = eclimetrics_now();
+    pace->report_ns = pace->start_ns;
+    pace->next_ns = pace->start_ns;
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Wait until next message is due, returns -1 when interrupted by a
+ * signal.
+ *
+ * @param pace: pacing state.
+ *
+ */
+int8_t eclipace_wait(ecli_pace_t *pace) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    uint64_t now_ns     = eclimetrics_now();
+    uint64_t backlog_ns = ( pace->burst - 1 ) * pace->interval_ns;
+    uint64_t due_ns     = pace->next_ns > backlog_ns ? pace->next_ns - backlog_ns : 0;
+
+    if ( pace->report_secs && now_ns - pace->report_ns >= pace->report_secs * PACE_NSECS ) {
+        eclipace_report( pace, FALSE_FLAG );
+    }
+    if ( now_ns < due_ns ) {
+        if ( due_ns - now_ns > PACE_SPIN_NS ) {
+            if ( pace->idle != NULL ) {
+                pace->idle();
+            }
+            if ( eclipace_sleep( pace, due_ns - PACE_SPIN_NS ) < 0 ) {
+                return -1;
+            }
+        }
+        while ( ( now_ns = eclimetrics_now() ) < due_ns );
+        eclimetrics_hist_record( &pace->jitter, now_ns - due_ns );
+        eclimetrics_hist_record( &pace->jitter_total, now_ns - due_ns );
+    }
+    /* Schedule of next message, a publisher (or an idle loop) behind it
+       by more than PACE_LAG_NS loses that time: bucket is full again */
+    if ( now_ns > pace->next_ns + PACE_LAG_NS ) {
+        pace->next_ns = now_ns - PACE_LAG_NS;
+    }
+    pace->next_ns += pace->interval_ns;
+    pace->sent++;
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Report achieved rate and jitter since last report (or since start
+ * with final flag), and free timer with final flag.
+ *
+ * @param pace: pacing state.
+ * @param final: TRUE_FLAG at end of publish loop.
+ *
+ */
+void eclipace_report(ecli_pace_t *pace, uint8_t final) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    uint64_t now_ns = eclimetrics_now();
+
+    if ( pace->rate == 0 ) {
+        return;
+    }
+    if ( final ) {
+        eclipace_show( PACE_END_MSG, pace->sent, now_ns - pace->start_ns, pace->rate,
+                       &pace->jitter_total );
+        if ( pace->timer_fd >= 0 ) {
+            close( pace->timer_fd );
+            pace->timer_fd = -1;
+        }
+        pace->rate = 0;
+        return;
+    }
+    eclipace_show( PACE_MSG, pace->sent - pace->report_sent, now_ns - pace->report_ns,
+                   pace->rate, &pace->jitter );
+    memset( &pace->jitter, 0, sizeof( pace->jitter ) );
+    pace->report_sent = pace->sent;
+    pace->report_ns = now_ns;
+}
+
+/**********************************************************************/
+/**********************************************************************/
+/** Sleep until monotonic deadline, returns -1 when interrupted.
+ *
+ * @param pace: pacing state.
+ * @param deadline_ns: monotonic time in nanoseconds.
+ *
+ */
+static int8_t eclipace_sleep(ecli_pace_t *pace, uint64_t deadline_ns) {
+
+    struct itimerspec timer;
+    struct timespec deadline;
+    uint64_t expirations = 0;
+
+    deadline.tv_sec = deadline_ns / PACE_NSECS;
+    deadline.tv_nsec = deadline_ns % PACE_NSECS;
+    if ( pace->timer_fd >= 0 ) {
+        memset( &timer, 0, sizeof( timer ) );
+        timer.it_value = deadline;
+        if ( timerfd_settime( pace->timer_fd, TFD_TIMER_ABSTIME, &timer, NULL ) == 0 ) {
+            if ( read( pace->timer_fd, &expirations, sizeof( expirations ) ) < 0 && errno == EINTR ) {
+                return -1;
+            }
+            return 0;
+        }
+    }
+    if ( clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL ) == EINTR ) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Show one report line.
+ *
+ * @param msg_fmt: report message format.
+ * @param sent: messages in period.
+ * @param nsecs: period length.
+ * @param rate: target rate.
+ * @param jitter: lateness histogram of period.
+ *
+ */
+static void eclipace_show(const char *msg_fmt, uint64_t sent, uint64_t nsecs, double rate,
+                          const ecli_hist_t *jitter) {
+
+    char   buffer_str[PACE_BUF_SIZE] = {0};
+    double secs = nsecs / ( double ) PACE_NSECS;
+
+    snprintf( buffer_str, sizeof( buffer_str ), msg_fmt, ( unsigned long long ) sent, secs,
+              secs > 0 ? sent / secs : 0, rate,
+              eclimetrics_hist_percentile( jitter, 50 ) / 1000.0,
+              eclimetrics_hist_percentile( jitter, 99 ) / 1000.0,
+              jitter->max / 1000.0 );
+    eclilog_show(__FILE__, __func__, buffer_str, LOG_INFO);
+}
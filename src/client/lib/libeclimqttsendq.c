@@ -0,0 +1,1018 @@
+/***********************************************************************
+* FILENAME    :   libeclimqttsendq.c
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   Library code for the outbound packet queue of a
+*                 connection (partial writes, watermarks, QoS 0 drops,
+*                 priority lanes).
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+
+/**********************************************************************/
+
+#include <libeclimqttsendq.h>
+#include <libeclimqttutf8.h>
+#include <libeclimqttlog.h>
+
+/**********************************************************************/
+#define SENDQ_PUBLISH         0x30      /* PUBLISH type, QoS 0 */
+#define SENDQ_QOS0_MASK       0xF6      /* Type and QoS bits of first byte */
+#define SENDQ_TYPE_MASK       0xF0
+#define SENDQ_HEAD_MAX        ( 5 + 2 + SENDQ_TOPIC_LEN )   /* Fixed header, topic len, topic */
+#define SENDQ_NO_CAP          INT64_MAX
+#define SENDQ_NSECS           1000000000ULL
+
+/**********************************************************************/
+/* Topic lane */
+typedef struct {
+    char            filter[SENDQ_TOPIC_LEN];
+    ecli_sendq_lane lane;
+} eclisendq_rule_t;
+
+/**********************************************************************/
+
+static const char       *sendq_lane_names[SENDQ_LANES] = { "control", "alarm", "telemetry", "bulk" };
+static eclisendq_rule_t sendq_rules[SENDQ_MAX_RULES];
+static uint32_t         sendq_rules_num = 0;
+static uint64_t         sendq_rates[SENDQ_LANES];
+
+/**********************************************************************/
+/**********************************************************************/
+/** Write through transport without waiting, bytes taken or -1.
+ *
+ * @param transport: connected transport.
+ * @param iov: vectors.
+ * @param iovcnt: number of vectors.
+ *
+ */
+static int32_t eclisendq_try(ecli_transport_t *transport, const struct iovec *iov, int32_t iovcnt);
+
+/**********************************************************************/
+/** Wait until socket is writable, -1 (ETIMEDOUT) after stall_ms.
+ *
+ * @param sendq: outbound queue.
+ * @param transport: connected transport.
+ *
+ */
+static int8_t eclisendq_wait(ecli_sendq_t *sendq, ecli_transport_t *transport);
+
+/**********************************************************************/
+/** Sleep for a lane over its rate (EINTR ends it early).
+ *
+ * @param wait_ns: nanoseconds.
+ *
+ */
+static void eclisendq_sleep(uint64_t wait_ns);
+
+/**********************************************************************/
+/** Write queued packets until queued bytes are under limit.
+ *
+ * @param sendq: outbound queue.
+ * @param transport: connected transport.
+ * @param wait: wait for socket space and lane rates, otherwise stop.
+ * @param limit: queued bytes left.
+ *
+ */
+static int8_t eclisendq_write(ecli_sendq_t *sendq, ecli_transport_t *transport,
+                              uint8_t wait, uint64_t limit);
+
+/**********************************************************************/
+/** Get lane to write next, -1 when lanes with packets are over rate.
+ *
+ * @param sendq: outbound queue.
+ * @param now_ns: monotonic time.
+ *
+ */
+static int8_t eclisendq_pick(ecli_sendq_t *sendq, uint64_t now_ns);
+
+/**********************************************************************/
+/** Refill lane bucket, returns bytes the lane may write now.
+ *
+ * @param lane: lane.
+ * @param now_ns: monotonic time.
+ *
+ */
+static int64_t eclisendq_budget(ecli_sendq_lane_t *lane, uint64_t now_ns);
+
+/**********************************************************************/
+/** Get nanoseconds until a lane over its rate may write again.
+ *
+ * @param lane: capped lane.
+ *
+ */
+static uint64_t eclisendq_refill_ns(const ecli_sendq_lane_t *lane);
+
+/**********************************************************************/
+/** Copy vectors up to budget bytes, returns vectors copied.
+ *
+ * @param iov: vectors.
+ * @param iovcnt: number of vectors.
+ * @param budget: max bytes.
+ * @param out: copied vectors (iovcnt room).
+ *
+ */
+static int32_t eclisendq_trim(const struct iovec *iov, int32_t iovcnt, int64_t budget,
+                              struct iovec *out);
+
+/**********************************************************************/
+/** Drop written bytes from lane head.
+ *
+ * @param sendq: outbound queue.
+ * @param lane: lane written.
+ * @param bytes: bytes written.
+ *
+ */
+static void eclisendq_advance(ecli_sendq_t *sendq, int8_t lane, uint32_t bytes);
+
+/**********************************************************************/
+/** Copy vectors at lane tail, -1 when out of memory.
+ *
+ * @param sendq: outbound queue.
+ * @param lane: lane of packet.
+ * @param iov: vectors (unwritten part).
+ * @param iovcnt: number of vectors.
+ * @param len: bytes in vectors.
+ * @param sent: packet bytes already written.
+ * @param droppable: QoS 0 publish not written at all.
+ *
+ */
+static int8_t eclisendq_push(ecli_sendq_t *sendq, int8_t lane, const struct iovec *iov,
+                             int32_t iovcnt, uint32_t len, uint32_t sent, uint8_t droppable);
+
+/**********************************************************************/
+/** Drop oldest QoS 0 packets (not started), lowest lane first, until len
+ * bytes fit under high watermark.
+ *
+ * @param sendq: outbound queue.
+ * @param len: bytes to fit.
+ *
+ */
+static void eclisendq_make_room(ecli_sendq_t *sendq, uint32_t len);
+
+/**********************************************************************/
+/** Move deferred control bytes to control lane, after a started packet.
+ *
+ * @param sendq: outbound queue.
+ *
+ */
+static void eclisendq_adopt(ecli_sendq_t *sendq);
+
+/**********************************************************************/
+/** Update congested state (hysteresis) and queue high-water mark.
+ *
+ * @param sendq: outbound queue.
+ *
+ */
+static void eclisendq_state(ecli_sendq_t *sendq);
+
+/**********************************************************************/
+/** Get lane of packet from its first bytes.
+ *
+ * @param iov: packet parts.
+ * @param iovcnt: number of parts.
+ *
+ */
+static ecli_sendq_lane eclisendq_classify(const struct iovec *iov, int32_t iovcnt);
+
+/**********************************************************************/
+/** Get lane from name, SENDQ_LANES when unknown.
+ *
+ * @param name: lane name.
+ *
+ */
+static ecli_sendq_lane eclisendq_from_name(const char *name);
+
+/**********************************************************************/
+/**********************************************************************/
+/** Set queue options for a new connection, queue must be empty
+ * (eclisendq_clear).
+ *
+ * @param sendq: outbound queue.
+ * @param high: congested over this queued bytes.
+ * @param low: not congested under this queued bytes.
+ * @param drop: QoS 0 drop policy.
+ * @param stall_ms: max wait for socket space without progress, 0 forever.
+ * @param metrics: connection metrics (may be NULL).
+ *
+ */
+void eclisendq_init(ecli_sendq_t *sendq, uint32_t high, uint32_t low, ecli_sendq_drop drop,
+                    uint32_t stall_ms, ecli_metrics_t *metrics) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    uint64_t now_ns = eclimetrics_now();
+    int32_t  i      = 0;
+
+    /* Copies of a connected broker (file jobs) do not own its packets */
+    for ( i = 0; i < SENDQ_LANES; i++ ) {
+        sendq->lanes[i].head = NULL;
+        sendq->lanes[i].tail = NULL;
+        sendq->lanes[i].rate = sendq_rates[i];
+        sendq->lanes[i].tokens = sendq_rates[i] / SENDQ_BURST_DIV;
+        sendq->lanes[i].stamp_ns = now_ns;
+    }
+    sendq->started = -1;
+    sendq->queued = 0;
+    sendq->high = high ? high : 1;
+    sendq->low = low < sendq->high ? low : sendq->high;
+    sendq->drop = drop;
+    sendq->stall_ms = stall_ms;
+    sendq->congested = 0;
+    sendq->blocked = 0;
+    sendq->busy = 0;
+    sendq->ctrl_len = 0;
+    sendq->metrics = metrics;
+}
+
+/**********************************************************************/
+/** Add lane rule for publishes on topics matching filter. First matching
+ * rule is used, other publishes go to telemetry lane.
+ *
+ * @param rule: "topic/filter/+/# alarm|telemetry|bulk".
+ *
+ */
+int8_t eclisendq_rule(const char *rule) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    eclisendq_rule_t *new_rule;
+    char lane[SENDQ_TOPIC_LEN];
+
+    if ( sendq_rules_num == SENDQ_MAX_RULES ) {
+        return -1;
+    }
+    new_rule = &sendq_rules[sendq_rules_num];
+    if ( sscanf( rule, "%255s %255s", new_rule->filter, lane ) != 2 ) {
+        return -1;
+    }
+    /* Control lane is for control packets only */
+    new_rule->lane = eclisendq_from_name( lane );
+    if ( new_rule->lane == SENDQ_LANES || new_rule->lane == SENDQ_LANE_CONTROL ) {
+        return -1;
+    }
+    sendq_rules_num++;
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Set rate cap of a lane for new connections.
+ *
+ * @param rule: "control|alarm|telemetry|bulk bytes_per_sec".
+ *
+ */
+int8_t eclisendq_rate(const char *rule) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    char lane_name[SENDQ_TOPIC_LEN];
+    unsigned long long rate = 0;
+    ecli_sendq_lane lane;
+
+    if ( sscanf( rule, "%255s %llu", lane_name, &rate ) != 2 ||
+         ( lane = eclisendq_from_name( lane_name ) ) == SENDQ_LANES ) {
+        return -1;
+    }
+    sendq_rates[lane] = rate;
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Get lane of a publish topic (rules).
+ *
+ * @param topic: topic name.
+ * @param topic_len: topic length.
+ *
+ */
+ecli_sendq_lane eclisendq_lane(const uint8_t *topic, uint32_t topic_len) {
+
+    uint32_t i = 0;
+
+    for ( i = 0; i < sendq_rules_num; i++ ) {
+        if ( ecliutf8_match( sendq_rules[i].filter, ( const char * ) topic, topic_len ) ) {
+            return sendq_rules[i].lane;
+        }
+    }
+
+    return SENDQ_LANE_TELEMETRY;
+}
+
+/**********************************************************************/
+/** Send packet after queued ones, returns packet size when written,
+ * queued or dropped by policy, -1 with errno on error.
+ *
+ * @param sendq: outbound queue.
+ * @param transport: connected transport.
+ * @param iov: packet parts, first one starts with fixed header.
+ * @param iovcnt: number of parts (max TRANSPORT_MAX_IOV).
+ *
+ */
+int32_t eclisendq_sendv(ecli_sendq_t *sendq, ecli_transport_t *transport,
+                        const struct iovec *iov, int32_t iovcnt) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    struct iovec vec[TRANSPORT_MAX_IOV];
+    struct iovec part[TRANSPORT_MAX_IOV];
+    ecli_sendq_lane_t *lane = NULL;
+    uint32_t count     = 0;
+    uint32_t written   = 0;
+    int64_t  budget    = 0;
+    int32_t  bytes     = 0;
+    int32_t  first     = 0;
+    int32_t  i         = 0;
+    int8_t   lane_id   = 0;
+    uint8_t  through   = 0;
+    uint8_t  droppable = 0;
+
+    if ( iovcnt <= 0 || iovcnt > TRANSPORT_MAX_IOV ) {
+        errno = EINVAL;
+        return -1;
+    }
+    for ( i = 0; i < iovcnt; i++ ) {
+        count += iov[i].iov_len;
+    }
+    /* Signal handler in the middle of a send: control packet goes after it */
+    if ( sendq->busy ) {
+        if ( count > SENDQ_CTRL_LEN - sendq->ctrl_len ) {
+            errno = EBUSY;
+            return -1;
+        }
+        for ( i = 0; i < iovcnt; i++ ) {
+            memcpy( sendq->ctrl + sendq->ctrl_len, iov[i].iov_base, iov[i].iov_len );
+            sendq->ctrl_len += iov[i].iov_len;
+        }
+        return count;
+    }
+    sendq->busy = 1;
+    droppable = iov[0].iov_len &&
+                ( ( ( const uint8_t * ) iov[0].iov_base )[0] & SENDQ_QOS0_MASK ) == SENDQ_PUBLISH;
+    lane_id = eclisendq_classify( iov, iovcnt );
+    lane = &sendq->lanes[lane_id];
+
+    /* Queued bytes go first */
+    if ( eclisendq_write( sendq, transport, 0, 0 ) < 0 ) {
+        sendq->busy = 0;
+        return -1;
+    }
+    /* Written through only after a started packet and lanes up to its own */
+    through = sendq->started < 0;
+    for ( i = 0; i <= lane_id && through; i++ ) {
+        through = sendq->lanes[i].head == NULL;
+    }
+    memcpy( vec, iov, iovcnt * sizeof( struct iovec ) );
+    while ( through && first < iovcnt ) {
+        if ( ( budget = eclisendq_budget( lane, eclimetrics_now() ) ) <= 0 ) {
+            /* Over lane rate: small rest queued, a big one paced in place */
+            if ( sendq->nonblock || count - written <= sendq->high ) {
+                break;
+            }
+            eclisendq_sleep( eclisendq_refill_ns( lane ) );
+            continue;
+        }
+        if ( ( bytes = eclisendq_try( transport, part,
+                                      eclisendq_trim( vec + first, iovcnt - first, budget, part ) ) ) < 0 ) {
+            if ( errno == EINTR ) {
+                continue;
+            }
+            if ( errno != EAGAIN && errno != EWOULDBLOCK ) {
+                sendq->busy = 0;
+                return -1;
+            }
+            sendq->blocked = 1;
+            /* Small rest is queued, a big one written in place (no copy) */
+            if ( sendq->nonblock || count - written <= sendq->high ) {
+                break;
+            }
+            if ( eclisendq_wait( sendq, transport ) < 0 ) {
+                sendq->busy = 0;
+                return -1;
+            }
+            continue;
+        }
+        sendq->blocked = 0;
+        if ( lane->rate ) {
+            lane->tokens -= bytes;
+        }
+        written += bytes;
+        /* Drop written vectors, a partly written one goes on from its rest */
+        while ( first < iovcnt && ( size_t ) bytes >= vec[first].iov_len ) {
+            bytes -= vec[first].iov_len;
+            first++;
+        }
+        if ( first < iovcnt ) {
+            vec[first].iov_base = ( uint8_t * ) vec[first].iov_base + bytes;
+            vec[first].iov_len -= bytes;
+        }
+    }
+
+    if ( written < count ) {
+        /* A started packet must be finished, a QoS 0 one not started may go */
+        droppable = droppable && written == 0;
+        if ( droppable && sendq->drop != SENDQ_DROP_NONE &&
+             sendq->queued + count > sendq->high ) {
+            if ( sendq->drop == SENDQ_DROP_OLDEST ) {
+                eclisendq_make_room( sendq, count );
+            }
+            if ( sendq->queued + count > sendq->high ) {
+                eclimetrics_tx_drop( sendq->metrics );
+                sendq->busy = 0;
+                return count;
+            }
+        }
+        if ( eclisendq_push( sendq, lane_id, vec + first, iovcnt - first, count - written,
+                             written, droppable ) < 0 ) {
+            sendq->busy = 0;
+            return -1;
+        }
+    }
+    eclisendq_state( sendq );
+    /* Waiting producer is held until queue is under low watermark */
+    if ( sendq->congested && !sendq->nonblock ) {
+        if ( eclisendq_write( sendq, transport, 1, sendq->low ) < 0 ) {
+            sendq->busy = 0;
+            return -1;
+        }
+        eclisendq_state( sendq );
+    }
+    /* Control packets deferred while busy */
+    if ( sendq->ctrl_len && eclisendq_write( sendq, transport, 0, 0 ) < 0 ) {
+        sendq->busy = 0;
+        return -1;
+    }
+    sendq->busy = 0;
+
+    return count;
+}
+
+/**********************************************************************/
+/** Write queued packets, returns bytes left in queue, -1 on error.
+ *
+ * @param sendq: outbound queue.
+ * @param transport: connected transport.
+ * @param wait: wait for socket space until queue is empty.
+ *
+ */
+int64_t eclisendq_flush(ecli_sendq_t *sendq, ecli_transport_t *transport, uint8_t wait) {
+
+    int8_t return_code = 0;
+
+    if ( sendq->busy || ( sendq->queued == 0 && sendq->ctrl_len == 0 ) ) {
+        return sendq->queued;
+    }
+    sendq->busy = 1;
+    return_code = eclisendq_write( sendq, transport, wait, 0 );
+    eclisendq_state( sendq );
+    sendq->busy = 0;
+
+    return return_code < 0 ? -1 : ( int64_t ) sendq->queued;
+}
+
+/**********************************************************************/
+/** Get congested state: set over high watermark, cleared under low.
+ *
+ * @param sendq: outbound queue.
+ *
+ */
+uint8_t eclisendq_congested(const ecli_sendq_t *sendq) {
+
+    return sendq->congested;
+}
+
+/**********************************************************************/
+/** Get nanoseconds until a capped lane may write again, 0 when queued
+ * packets only wait for socket space (or queue is empty).
+ *
+ * @param sendq: outbound queue.
+ *
+ */
+uint64_t eclisendq_wait_ns(ecli_sendq_t *sendq) {
+
+    uint64_t wait_ns   = UINT64_MAX;
+    uint64_t lane_wait = 0;
+    int32_t  i         = 0;
+
+    if ( sendq->queued == 0 || eclisendq_pick( sendq, eclimetrics_now() ) >= 0 ) {
+        return 0;
+    }
+    /* Every lane that may go is over its rate: first one back */
+    if ( sendq->started >= 0 ) {
+        return eclisendq_refill_ns( &sendq->lanes[sendq->started] );
+    }
+    for ( i = 0; i < SENDQ_LANES; i++ ) {
+        if ( sendq->lanes[i].head != NULL &&
+             ( lane_wait = eclisendq_refill_ns( &sendq->lanes[i] ) ) < wait_ns ) {
+            wait_ns = lane_wait;
+        }
+    }
+
+    return wait_ns;
+}
+
+/**********************************************************************/
+/** Free queued packets (connection closed), nothing when called by a
+ * signal handler in the middle of a send.
+ *
+ * @param sendq: outbound queue.
+ *
+ */
+void eclisendq_clear(ecli_sendq_t *sendq) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    ecli_sendq_pkt_t *pkt = NULL;
+    int32_t           i   = 0;
+
+    if ( sendq->busy ) {
+        return;
+    }
+    for ( i = 0; i < SENDQ_LANES; i++ ) {
+        while ( ( pkt = sendq->lanes[i].head ) != NULL ) {
+            sendq->lanes[i].head = pkt->next;
+            free( pkt );
+        }
+        sendq->lanes[i].tail = NULL;
+    }
+    sendq->started = -1;
+    sendq->queued = 0;
+    sendq->congested = 0;
+    sendq->blocked = 0;
+    sendq->ctrl_len = 0;
+}
+
+/**********************************************************************/
+/**********************************************************************/
+/** Write through transport without waiting, bytes taken or -1.
+ *
+ * @param transport: connected transport.
+ * @param iov: vectors.
+ * @param iovcnt: number of vectors.
+ *
+ */
+static int32_t eclisendq_try(ecli_transport_t *transport, const struct iovec *iov, int32_t iovcnt) {
+
+    int32_t bytes = 0;
+
+    if ( transport->ops->writev != NULL ) {
+        return transport->ops->writev( transport, iov, iovcnt );
+    }
+    /* All or error transports (TLS, io_uring) can not resume a failed send */
+    if ( ( bytes = transport->ops->sendv( transport, iov, iovcnt ) ) < 0 &&
+         ( errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK ) ) {
+        errno = EPIPE;
+    }
+
+    return bytes;
+}
+
+/**********************************************************************/
+/** Wait until socket is writable, -1 (ETIMEDOUT) after stall_ms.
+ *
+ * @param sendq: outbound queue.
+ * @param transport: connected transport.
+ *
+ */
+static int8_t eclisendq_wait(ecli_sendq_t *sendq, ecli_transport_t *transport) {
+
+    struct pollfd pfd;
+    int32_t ready = 0;
+
+    pfd.fd = transport->ops->fd( transport );
+    pfd.events = POLLOUT;
+    pfd.revents = 0;
+    ready = poll( &pfd, 1, sendq->stall_ms ? ( int32_t ) sendq->stall_ms : -1 );
+    if ( ready == 0 ) {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+    /* EINTR: caller tries the write again; errors show up in the write */
+    if ( ready < 0 && errno != EINTR ) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Sleep for a lane over its rate (EINTR ends it early).
+ *
+ * @param wait_ns: nanoseconds.
+ *
+ */
+static void eclisendq_sleep(uint64_t wait_ns) {
+
+    struct timespec delay;
+
+    delay.tv_sec = wait_ns / SENDQ_NSECS;
+    delay.tv_nsec = wait_ns % SENDQ_NSECS;
+    nanosleep( &delay, NULL );
+}
+
+/**********************************************************************/
+/** Write queued packets until queued bytes are under limit.
+ *
+ * @param sendq: outbound queue.
+ * @param transport: connected transport.
+ * @param wait: wait for socket space and lane rates, otherwise stop.
+ * @param limit: queued bytes left.
+ *
+ */
+static int8_t eclisendq_write(ecli_sendq_t *sendq, ecli_transport_t *transport,
+                              uint8_t wait, uint64_t limit) {
+
+    struct iovec       vec[TRANSPORT_MAX_IOV];
+    struct iovec       part[TRANSPORT_MAX_IOV];
+    ecli_sendq_pkt_t  *pkt     = NULL;
+    ecli_sendq_lane_t *lane    = NULL;
+    int64_t            budget  = 0;
+    int32_t            iovcnt  = 0;
+    int32_t            bytes   = 0;
+    int8_t             lane_id = 0;
+
+    eclisendq_adopt( sendq );
+    while ( sendq->queued > limit ) {
+        if ( ( lane_id = eclisendq_pick( sendq, eclimetrics_now() ) ) < 0 ) {
+            if ( !wait ) {
+                return 0;
+            }
+            eclisendq_sleep( eclisendq_wait_ns( sendq ) );
+            continue;
+        }
+        lane = &sendq->lanes[lane_id];
+        budget = eclisendq_budget( lane, eclimetrics_now() );
+        /* Packets of one lane gathered in one write, up to its budget; the
+           rest of a started packet alone, so other lanes go right after it */
+        iovcnt = 0;
+        for ( pkt = lane->head; pkt != NULL && iovcnt < TRANSPORT_MAX_IOV &&
+                                ( iovcnt == 0 || sendq->started < 0 ); pkt = pkt->next ) {
+            vec[iovcnt].iov_base = pkt->data + pkt->sent;
+            vec[iovcnt].iov_len = pkt->len - pkt->sent;
+            iovcnt++;
+        }
+        if ( ( bytes = eclisendq_try( transport, part, eclisendq_trim( vec, iovcnt, budget, part ) ) ) < 0 ) {
+            if ( errno == EINTR ) {
+                continue;
+            }
+            if ( errno != EAGAIN && errno != EWOULDBLOCK ) {
+                return -1;
+            }
+            sendq->blocked = 1;
+            if ( !wait ) {
+                return 0;
+            }
+            if ( eclisendq_wait( sendq, transport ) < 0 ) {
+                return -1;
+            }
+            continue;
+        }
+        sendq->blocked = 0;
+        if ( lane->rate ) {
+            lane->tokens -= bytes;
+        }
+        eclisendq_advance( sendq, lane_id, bytes );
+        eclisendq_adopt( sendq );
+    }
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Get lane to write next, -1 when lanes with packets are over rate.
+ *
+ * @param sendq: outbound queue.
+ * @param now_ns: monotonic time.
+ *
+ */
+static int8_t eclisendq_pick(ecli_sendq_t *sendq, uint64_t now_ns) {
+
+    int8_t i = 0;
+
+    /* A started packet is finished before any other */
+    if ( sendq->started >= 0 ) {
+        return eclisendq_budget( &sendq->lanes[sendq->started], now_ns ) > 0 ? sendq->started : -1;
+    }
+    for ( i = 0; i < SENDQ_LANES; i++ ) {
+        if ( sendq->lanes[i].head != NULL && eclisendq_budget( &sendq->lanes[i], now_ns ) > 0 ) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/**********************************************************************/
+/** Refill lane bucket, returns bytes the lane may write now.
+ *
+ * @param lane: lane.
+ * @param now_ns: monotonic time.
+ *
+ */
+static int64_t eclisendq_budget(ecli_sendq_lane_t *lane, uint64_t now_ns) {
+
+    int64_t depth = 0;
+    int64_t add   = 0;
+
+    if ( lane->rate == 0 ) {
+        return SENDQ_NO_CAP;
+    }
+    depth = lane->rate >= SENDQ_BURST_DIV ? ( int64_t ) ( lane->rate / SENDQ_BURST_DIV ) : 1;
+    if ( now_ns - lane->stamp_ns >= SENDQ_NSECS ) {
+        add = lane->rate;
+    }
+    else {
+        add = ( int64_t ) ( ( double ) lane->rate * ( now_ns - lane->stamp_ns ) / SENDQ_NSECS );
+    }
+    /* Time of a fraction of byte is kept for the next refill */
+    if ( add > 0 ) {
+        lane->tokens = lane->tokens + add < depth ? lane->tokens + add : depth;
+        lane->stamp_ns = now_ns;
+    }
+
+    return lane->tokens;
+}
+
+/**********************************************************************/
+/** Get nanoseconds until a lane over its rate may write again.
+ *
+ * @param lane: capped lane.
+ *
+ */
+static uint64_t eclisendq_refill_ns(const ecli_sendq_lane_t *lane) {
+
+    if ( lane->rate == 0 || lane->tokens > 0 ) {
+        return 0;
+    }
+
+    return ( ( uint64_t ) ( 1 - lane->tokens ) * SENDQ_NSECS + lane->rate - 1 ) / lane->rate;
+}
+
+/**********************************************************************/
+/** Copy vectors up to budget bytes, returns vectors copied.
+ *
+ * @param iov: vectors.
+ * @param iovcnt: number of vectors.
+ * @param budget: max bytes.
+ * @param out: copied vectors (iovcnt room).
+ *
+ */
+static int32_t eclisendq_trim(const struct iovec *iov, int32_t iovcnt, int64_t budget,
+                              struct iovec *out) {
+
+    int32_t i = 0;
+
+    for ( i = 0; i < iovcnt && budget > 0; i++ ) {
+        out[i] = iov[i];
+        if ( ( int64_t ) out[i].iov_len > budget ) {
+            out[i].iov_len = budget;
+        }
+        budget -= out[i].iov_len;
+    }
+
+    return i;
+}
+
+/**********************************************************************/
+/** Drop written bytes from lane head.
+ *
+ * @param sendq: outbound queue.
+ * @param lane: lane written.
+ * @param bytes: bytes written.
+ *
+ */
+static void eclisendq_advance(ecli_sendq_t *sendq, int8_t lane, uint32_t bytes) {
+
+    ecli_sendq_lane_t *queue = &sendq->lanes[lane];
+    ecli_sendq_pkt_t  *pkt   = NULL;
+    uint32_t           part  = 0;
+
+    sendq->queued -= bytes;
+    while ( bytes > 0 && ( pkt = queue->head ) != NULL ) {
+        part = pkt->len - pkt->sent;
+        if ( bytes < part ) {
+            pkt->sent += bytes;
+            break;
+        }
+        bytes -= part;
+        queue->head = pkt->next;
+        free( pkt );
+    }
+    if ( queue->head == NULL ) {
+        queue->tail = NULL;
+    }
+    sendq->started = ( queue->head != NULL && queue->head->sent ) ? lane : -1;
+}
+
+/**********************************************************************/
+/** Copy vectors at lane tail, -1 when out of memory.
+ *
+ * @param sendq: outbound queue.
+ * @param lane: lane of packet.
+ * @param iov: vectors (unwritten part).
+ * @param iovcnt: number of vectors.
+ * @param len: bytes in vectors.
+ * @param sent: packet bytes already written.
+ * @param droppable: QoS 0 publish not written at all.
+ *
+ */
+static int8_t eclisendq_push(ecli_sendq_t *sendq, int8_t lane, const struct iovec *iov,
+                             int32_t iovcnt, uint32_t len, uint32_t sent, uint8_t droppable) {
+
+    ecli_sendq_lane_t *queue = &sendq->lanes[lane];
+    ecli_sendq_pkt_t  *pkt   = malloc( sizeof( ecli_sendq_pkt_t ) + len );
+    uint32_t           off   = 0;
+    int32_t            i     = 0;
+
+    if ( pkt == NULL ) {
+        return -1;
+    }
+    for ( i = 0; i < iovcnt; i++ ) {
+        memcpy( pkt->data + off, iov[i].iov_base, iov[i].iov_len );
+        off += iov[i].iov_len;
+    }
+    pkt->next = NULL;
+    pkt->len = len;
+    pkt->sent = 0;
+    pkt->droppable = droppable;
+    if ( queue->tail != NULL ) {
+        queue->tail->next = pkt;
+    }
+    else {
+        queue->head = pkt;
+    }
+    queue->tail = pkt;
+    sendq->queued += len;
+    /* Rest of a partly written packet (head of an empty lane) goes first */
+    if ( sent ) {
+        sendq->started = lane;
+    }
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Drop oldest QoS 0 packets (not started), lowest lane first, until len
+ * bytes fit under high watermark.
+ *
+ * @param sendq: outbound queue.
+ * @param len: bytes to fit.
+ *
+ */
+static void eclisendq_make_room(ecli_sendq_t *sendq, uint32_t len) {
+
+    ecli_sendq_lane_t *queue = NULL;
+    ecli_sendq_pkt_t  *prev  = NULL;
+    ecli_sendq_pkt_t  *pkt   = NULL;
+    ecli_sendq_pkt_t  *next  = NULL;
+    int32_t            i     = 0;
+
+    for ( i = SENDQ_LANES - 1; i >= 0 && sendq->queued + len > sendq->high; i-- ) {
+        queue = &sendq->lanes[i];
+        prev = NULL;
+        pkt = queue->head;
+        while ( pkt != NULL && sendq->queued + len > sendq->high ) {
+            next = pkt->next;
+            if ( !pkt->droppable || pkt->sent ) {
+                prev = pkt;
+                pkt = next;
+                continue;
+            }
+            if ( prev != NULL ) {
+                prev->next = next;
+            }
+            else {
+                queue->head = next;
+            }
+            if ( queue->tail == pkt ) {
+                queue->tail = prev;
+            }
+            sendq->queued -= pkt->len;
+            free( pkt );
+            eclimetrics_tx_drop( sendq->metrics );
+            pkt = next;
+        }
+    }
+}
+
+/**********************************************************************/
+/** Move deferred control bytes to control lane, after a started packet.
+ *
+ * @param sendq: outbound queue.
+ *
+ */
+static void eclisendq_adopt(ecli_sendq_t *sendq) {
+
+    ecli_sendq_lane_t *queue = &sendq->lanes[SENDQ_LANE_CONTROL];
+    ecli_sendq_pkt_t  *pkt   = NULL;
+    uint32_t           len   = sendq->ctrl_len;
+
+    if ( len == 0 || ( pkt = malloc( sizeof( ecli_sendq_pkt_t ) + len ) ) == NULL ) {
+        return;
+    }
+    memcpy( pkt->data, sendq->ctrl, len );
+    sendq->ctrl_len = 0;
+    pkt->len = len;
+    pkt->sent = 0;
+    pkt->droppable = 0;
+    /* Never inside a started packet */
+    if ( queue->head != NULL && queue->head->sent ) {
+        pkt->next = queue->head->next;
+        queue->head->next = pkt;
+        if ( queue->tail == queue->head ) {
+            queue->tail = pkt;
+        }
+    }
+    else {
+        pkt->next = queue->head;
+        queue->head = pkt;
+        if ( queue->tail == NULL ) {
+            queue->tail = pkt;
+        }
+    }
+    sendq->queued += len;
+}
+
+/**********************************************************************/
+/** Update congested state (hysteresis) and queue high-water mark.
+ *
+ * @param sendq: outbound queue.
+ *
+ */
+static void eclisendq_state(ecli_sendq_t *sendq) {
+
+    if ( sendq->queued > sendq->high ) {
+        sendq->congested = 1;
+    }
+    else if ( sendq->queued <= sendq->low ) {
+        sendq->congested = 0;
+    }
+    eclimetrics_tx_queued( sendq->metrics, sendq->queued );
+}
+
+/**********************************************************************/
+/** Get lane of packet from its first bytes.
+ *
+ * @param iov: packet parts.
+ * @param iovcnt: number of parts.
+ *
+ */
+static ecli_sendq_lane eclisendq_classify(const struct iovec *iov, int32_t iovcnt) {
+
+    uint8_t  head[SENDQ_HEAD_MAX];
+    uint32_t len       = 0;
+    uint32_t part      = 0;
+    uint32_t off       = 1;
+    uint32_t topic_len = 0;
+    int32_t  i         = 0;
+
+    if ( iov[0].iov_len == 0 ||
+         ( ( ( const uint8_t * ) iov[0].iov_base )[0] & SENDQ_TYPE_MASK ) != SENDQ_PUBLISH ) {
+        return SENDQ_LANE_CONTROL;
+    }
+    if ( sendq_rules_num == 0 ) {
+        return SENDQ_LANE_TELEMETRY;
+    }
+    /* Fixed header and topic may be split in parts */
+    for ( i = 0; i < iovcnt && len < sizeof( head ); i++ ) {
+        part = iov[i].iov_len < sizeof( head ) - len ? iov[i].iov_len : sizeof( head ) - len;
+        memcpy( head + len, iov[i].iov_base, part );
+        len += part;
+    }
+    /* Remaining length: up to 4 bytes, high bit set on all but last */
+    while ( off < len && off < 4 && ( head[off] & 0x80 ) ) {
+        off++;
+    }
+    off++;
+    if ( off + 2 > len ) {
+        return SENDQ_LANE_TELEMETRY;
+    }
+    topic_len = ( head[off] << 8 ) | head[off + 1];
+    if ( off + 2 + topic_len > len ) {
+        return SENDQ_LANE_TELEMETRY;
+    }
+
+    return eclisendq_lane( head + off + 2, topic_len );
+}
+
+/**********************************************************************/
+/** Get lane from name, SENDQ_LANES when unknown.
+ *
+ * @param name: lane name.
+ *
+ */
+static ecli_sendq_lane eclisendq_from_name(const char *name) {
+
+    int32_t i = 0;
+
+    for ( i = 0; i < SENDQ_LANES; i++ ) {
+        if ( strcmp( name, sendq_lane_names[i] ) == 0 ) {
+            return i;
+        }
+    }
+
+    return SENDQ_LANES;
+}
+
@@ -0,0 +1,535 @@
+/***********************************************************************
+* FILENAME    :   libeclimqttseries.c
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   Library code for time-series aggregation of small
+*                 numeric text samples (one block publish per window).
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**********************************************************************/
+
+#include <libeclimqttseries.h>
+#include <libeclimqttlog.h>
+
+/**********************************************************************/
+#define SERIES_VARINT_MAX     10
+#define SERIES_IS_DIGIT(c)    ( ( c ) >= '0' && ( c ) <= '9' )
+#define SERIES_IS_ALNUM(c)    ( SERIES_IS_DIGIT( c ) || ( ( ( c ) | 0x20 ) >= 'a' && ( ( c ) | 0x20 ) <= 'z' ) )
+#define SERIES_ZIGZAG(v)      ( ( ( uint64_t ) ( v ) << 1 ) ^ ( uint64_t ) ( ( int64_t ) ( v ) >> 63 ) )
+#define SERIES_UNZIGZAG(v)    ( ( int64_t ) ( ( ( v ) >> 1 ) ^ ( 0 - ( ( v ) & 1 ) ) ) )
+
+/**********************************************************************/
+/* Sample found in a payload */
+typedef struct {
+    uint32_t prefix_len;                    /* Text before number */
+    uint32_t suffix_len;                    /* Text after number */
+    uint8_t  digits;                        /* Fraction digits */
+    int64_t  value;                         /* Number without decimal point */
+} ecliseries_sample_t;
+
+/* Open block of a topic */
+typedef struct {
+    char     topic[CLI_TOPIC_LEN + 1];
+    uint32_t topic_len;
+    uint8_t  text[SERIES_SAMPLE_MAX];       /* Template: prefix, suffix */
+    uint32_t prefix_len;
+    uint32_t suffix_len;
+    uint8_t  digits;
+    uint32_t count;                         /* 0: slot free */
+    uint64_t open_ms;                       /* Monotonic msecs of first sample */
+    uint64_t last_ts;
+    int64_t  last_delta;
+    int64_t  last_value;
+    uint32_t body_len;
+    uint8_t  body[SERIES_BODY_SIZE];
+} ecliseries_slot_t;
+
+/**********************************************************************/
+static ecliseries_slot_t *series_slots[SERIES_MAX_TOPICS];
+static uint32_t series_samples  = 0;
+static uint32_t series_window   = SERIES_MS_DEFAULT;
+
+/**********************************************************************/
+/**********************************************************************/
+/** Find last number of payload, returns 1 when payload is a sample.
+ *
+ * @param payload: message payload.
+ * @param len: payload size.
+ * @param sample: sample output.
+ *
+ */
+static int8_t ecliseries_parse(const uint8_t *payload, uint32_t len, ecliseries_sample_t *sample);
+
+/**********************************************************************/
+/** Get open block of topic, or a free (evicted) one, NULL on error.
+ *
+ * @param topic: topic name.
+ * @param topic_len: topic length.
+ * @param block: block evicted to make room (len 0 none).
+ *
+ */
+static ecliseries_slot_t *ecliseries_slot(const uint8_t *topic, uint32_t topic_len, ecli_series_block_t *block);
+
+/**********************************************************************/
+/** Encode open block in block output and free slot.
+ *
+ * @param slot: open block.
+ * @param block: closed block output.
+ *
+ */
+static void ecliseries_close(ecliseries_slot_t *slot, ecli_series_block_t *block);
+
+/**********************************************************************/
+/** Put varint, returns bytes written.
+ *
+ * @param value: unsigned value.
+ * @param out: output, SERIES_VARINT_MAX bytes.
+ *
+ */
+static uint32_t ecliseries_put(uint64_t value, uint8_t *out);
+
+/**********************************************************************/
+/** Get varint, returns -1 when it does not end before end.
+ *
+ * @param iter: block reader.
+ * @param value: value output.
+ *
+ */
+static int8_t ecliseries_get(ecli_series_iter_t *iter, uint64_t *value);
+
+/**********************************************************************/
+/**********************************************************************/
+/** Set window of new blocks.
+ *
+ * @param samples: samples per block (min 2).
+ * @param window_ms: max msecs between first sample and block publish.
+ *
+ */
+void ecliseries_init(uint32_t samples, uint32_t window_ms) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    series_samples = samples < 2 ? 2 : samples;
+    series_window = window_ms;
+}
+
+/**********************************************************************/
+/** Add payload of topic to its block, returns 1 when it is a sample, 0
+ * when it must be published as is (after block, when one was closed).
+ *
+ * @param topic: topic name.
+ * @param topic_len: topic length.
+ * @param payload: message payload.
+ * @param len: payload size.
+ * @param ts_ms: sample epoch msecs.
+ * @param block: closed block output (len 0 none).
+ *
+ */
+int8_t ecliseries_add(const uint8_t *topic, uint32_t topic_len, const uint8_t *payload, uint32_t len,
+                      uint64_t ts_ms, ecli_series_block_t *block) {
+
+    ecliseries_slot_t   *slot = NULL;
+    ecliseries_sample_t sample;
+    int64_t  delta = 0;
+    uint32_t i     = 0;
+
+    block->len = 0;
+    for ( i = 0; i < SERIES_MAX_TOPICS && series_slots[i] != NULL; i++ ) {
+        if ( series_slots[i]->count && series_slots[i]->topic_len == topic_len &&
+             memcmp( series_slots[i]->topic, topic, topic_len ) == 0 ) {
+            slot = series_slots[i];
+            break;
+        }
+    }
+    /* Not a sample, or a new template: samples before it go first */
+    if ( !ecliseries_parse( payload, len, &sample ) ) {
+        if ( slot != NULL ) {
+            ecliseries_close( slot, block );
+        }
+        return 0;
+    }
+    if ( slot != NULL && ( slot->digits != sample.digits || slot->prefix_len != sample.prefix_len ||
+                           slot->suffix_len != sample.suffix_len ||
+                           memcmp( slot->text, payload, sample.prefix_len ) != 0 ||
+                           memcmp( slot->text + slot->prefix_len, payload + len - sample.suffix_len,
+                                   sample.suffix_len ) != 0 ) ) {
+        ecliseries_close( slot, block );
+    }
+    if ( slot == NULL && ( slot = ecliseries_slot( topic, topic_len, block ) ) == NULL ) {
+        return 0;
+    }
+
+    if ( slot->count == 0 ) {
+        slot->digits = sample.digits;
+        slot->prefix_len = sample.prefix_len;
+        slot->suffix_len = sample.suffix_len;
+        memcpy( slot->text, payload, sample.prefix_len );
+        memcpy( slot->text + sample.prefix_len, payload + len - sample.suffix_len, sample.suffix_len );
+        slot->open_ms = eclimetrics_now() / 1000000;
+        slot->last_delta = 0;
+        slot->body_len = ecliseries_put( ts_ms, slot->body );
+        slot->body_len += ecliseries_put( SERIES_ZIGZAG( sample.value ), slot->body + slot->body_len );
+    }
+    else {
+        delta = ( int64_t ) ( ts_ms - slot->last_ts );
+        slot->body_len += ecliseries_put( SERIES_ZIGZAG( delta - slot->last_delta ), slot->body + slot->body_len );
+        slot->body_len += ecliseries_put( SERIES_ZIGZAG( ( uint64_t ) sample.value - ( uint64_t ) slot->last_value ),
+                                          slot->body + slot->body_len );
+        slot->last_delta = delta;
+    }
+    slot->last_ts = ts_ms;
+    slot->last_value = sample.value;
+    slot->count++;
+    /* A new block (template change) never fills with its first sample */
+    if ( slot->count >= series_samples || slot->body_len + SERIES_SAMPLE_BYTES > SERIES_BODY_SIZE ) {
+        ecliseries_close( slot, block );
+    }
+
+    return 1;
+}
+
+/**********************************************************************/
+/** Get msecs until next block window ends, -1 when no block is open.
+ *
+ */
+int64_t ecliseries_due(void) {
+
+    uint64_t now  = eclimetrics_now() / 1000000;
+    int64_t  due  = -1;
+    int64_t  left = 0;
+    uint32_t i    = 0;
+
+    for ( i = 0; i < SERIES_MAX_TOPICS && series_slots[i] != NULL; i++ ) {
+        if ( series_slots[i]->count == 0 ) {
+            continue;
+        }
+        left = ( int64_t ) ( series_slots[i]->open_ms + series_window - now );
+        if ( left < 0 ) {
+            left = 0;
+        }
+        if ( due < 0 || left < due ) {
+            due = left;
+        }
+    }
+
+    return due;
+}
+
+/**********************************************************************/
+/** Close a block whose window ended (any open one with all), returns 1
+ * when block was closed, 0 when none.
+ *
+ * @param all: close blocks before their window end (end of input).
+ * @param block: closed block output.
+ *
+ */
+int8_t ecliseries_expire(uint8_t all, ecli_series_block_t *block) {
+
+    uint64_t now = eclimetrics_now() / 1000000;
+    uint32_t i   = 0;
+
+    block->len = 0;
+    for ( i = 0; i < SERIES_MAX_TOPICS && series_slots[i] != NULL; i++ ) {
+        if ( series_slots[i]->count && ( all || now >= series_slots[i]->open_ms + series_window ) ) {
+            ecliseries_close( series_slots[i], block );
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Start reading a block, returns 1 when msg is a block, 0 when it is a
+ * plain message, -1 when block is malformed.
+ *
+ * @param iter: block reader.
+ * @param msg: message payload.
+ * @param len: payload size.
+ *
+ */
+int8_t ecliseries_open(ecli_series_iter_t *iter, const uint8_t *msg, uint32_t len) {
+
+    uint64_t value = 0;
+
+    if ( len < 3 || msg[0] != SERIES_MAGIC || ( msg[1] & SERIES_TAG_MASK ) != SERIES_TAG ) {
+        return 0;
+    }
+    memset( iter, 0, sizeof( *iter ) );
+    iter->pos = msg + 2;
+    iter->end = msg + len;
+    if ( ( msg[1] & ~SERIES_TAG_MASK ) != SERIES_VERSION ||
+         ecliseries_get( iter, &value ) < 0 || value == 0 || value > SERIES_BODY_SIZE ||
+         iter->pos >= iter->end || *iter->pos > SERIES_DIGITS_MAX ) {
+        return -1;
+    }
+    iter->count = iter->left = value;
+    iter->digits = *iter->pos++;
+    if ( ecliseries_get( iter, &value ) < 0 || value > SERIES_SAMPLE_MAX || value > iter->end - iter->pos ) {
+        return -1;
+    }
+    iter->prefix = iter->pos;
+    iter->prefix_len = value;
+    iter->pos += value;
+    if ( ecliseries_get( iter, &value ) < 0 || value + iter->prefix_len > SERIES_SAMPLE_MAX ||
+         value > iter->end - iter->pos ) {
+        return -1;
+    }
+    iter->suffix = iter->pos;
+    iter->suffix_len = value;
+    iter->pos += value;
+
+    return 1;
+}
+
+/**********************************************************************/
+/** Next sample text of block, returns text len, 0 at block end, -1 when
+ * block is malformed.
+ *
+ * @param iter: block reader.
+ * @param text: sample text output (SERIES_TEXT_MAX bytes, not terminated).
+ * @param ts_ms: sample epoch msecs output.
+ *
+ */
+int32_t ecliseries_next(ecli_series_iter_t *iter, uint8_t *text, uint64_t *ts_ms) {
+
+    char     number[24];
+    uint64_t ts    = 0;
+    uint64_t value = 0;
+    uint64_t abs   = 0;
+    int32_t  len   = 0;
+    int32_t  pos   = 0;
+
+    if ( iter->left == 0 ) {
+        return 0;
+    }
+    if ( ecliseries_get( iter, &ts ) < 0 || ecliseries_get( iter, &value ) < 0 ) {
+        return -1;
+    }
+    /* Wrapping arithmetic: a malformed block gives wrong samples only */
+    if ( iter->left == iter->count ) {
+        iter->ts_ms = ts;
+        iter->value = SERIES_UNZIGZAG( value );
+    }
+    else {
+        iter->delta = ( int64_t ) ( ( uint64_t ) iter->delta + ( uint64_t ) SERIES_UNZIGZAG( ts ) );
+        iter->ts_ms += ( uint64_t ) iter->delta;
+        iter->value = ( int64_t ) ( ( uint64_t ) iter->value + ( uint64_t ) SERIES_UNZIGZAG( value ) );
+    }
+    iter->left--;
+
+    memcpy( text, iter->prefix, iter->prefix_len );
+    pos = iter->prefix_len;
+    abs = iter->value < 0 ? 0 - ( uint64_t ) iter->value : ( uint64_t ) iter->value;
+    if ( iter->value < 0 ) {
+        text[pos++] = '-';
+    }
+    len = sprintf( number, "%llu", ( unsigned long long ) abs );
+    if ( len <= iter->digits ) {
+        text[pos++] = '0';
+        text[pos++] = '.';
+        memset( text + pos, '0', iter->digits - len );
+        pos += iter->digits - len;
+        memcpy( text + pos, number, len );
+        pos += len;
+    }
+    else {
+        memcpy( text + pos, number, len - iter->digits );
+        pos += len - iter->digits;
+        if ( iter->digits ) {
+            text[pos++] = '.';
+            memcpy( text + pos, number + len - iter->digits, iter->digits );
+            pos += iter->digits;
+        }
+    }
+    memcpy( text + pos, iter->suffix, iter->suffix_len );
+    pos += iter->suffix_len;
+    *ts_ms = iter->ts_ms;
+
+    return pos;
+}
+
+/**********************************************************************/
+/**********************************************************************/
+/** Find last number of payload, returns 1 when payload is a sample.
+ *
+ * @param payload: message payload.
+ * @param len: payload size.
+ * @param sample: sample output.
+ *
+ */
+static int8_t ecliseries_parse(const uint8_t *payload, uint32_t len, ecliseries_sample_t *sample) {
+
+    uint32_t end   = len;
+    uint32_t start = 0;
+    uint32_t dot   = 0;
+    uint32_t i     = 0;
+    uint8_t  neg   = 0;
+    int64_t  value = 0;
+
+    if ( len == 0 || len > SERIES_SAMPLE_MAX ) {
+        return 0;
+    }
+    while ( end > 0 && !SERIES_IS_DIGIT( payload[end - 1] ) ) {
+        end--;
+    }
+    if ( end == 0 ) {
+        return 0;
+    }
+    start = end;
+    while ( start > 0 && SERIES_IS_DIGIT( payload[start - 1] ) ) {
+        start--;
+    }
+    /* Fraction: digits '.' digits */
+    if ( start >= 2 && payload[start - 1] == '.' && SERIES_IS_DIGIT( payload[start - 2] ) ) {
+        dot = start - 1;
+        start = dot;
+        while ( start > 0 && SERIES_IS_DIGIT( payload[start - 1] ) ) {
+            start--;
+        }
+    }
+    /* Leading zeros would not come back as they were */
+    if ( ( payload[start] == '0' && start + 1 < ( dot ? dot : end ) ) ||
+         end - start > SERIES_DIGITS_MAX + ( dot ? 1 : 0 ) ) {
+        return 0;
+    }
+    for ( i = start; i < end; i++ ) {
+        if ( i != dot || dot == 0 ) {
+            value = value * 10 + ( payload[i] - '0' );
+        }
+    }
+    /* Minus sign, not a dash of a name ("sensor-2") */
+    if ( start > 0 && payload[start - 1] == '-' && ( start == 1 || !SERIES_IS_ALNUM( payload[start - 2] ) ) ) {
+        if ( value == 0 ) {
+            return 0;
+        }
+        neg = 1;
+        start--;
+    }
+    sample->prefix_len = start;
+    sample->suffix_len = len - end;
+    sample->digits = dot ? end - dot - 1 : 0;
+    sample->value = neg ? -value : value;
+
+    return 1;
+}
+
+/**********************************************************************/
+/** Get open block of topic, or a free (evicted) one, NULL on error.
+ *
+ * @param topic: topic name.
+ * @param topic_len: topic length.
+ * @param block: block evicted to make room (len 0 none).
+ *
+ */
+static ecliseries_slot_t *ecliseries_slot(const uint8_t *topic, uint32_t topic_len, ecli_series_block_t *block) {
+
+    ecliseries_slot_t *slot = NULL;
+    uint32_t i = 0;
+
+    for ( i = 0; i < SERIES_MAX_TOPICS; i++ ) {
+        if ( series_slots[i] == NULL ) {
+            if ( ( series_slots[i] = calloc( 1, sizeof( ecliseries_slot_t ) ) ) == NULL ) {
+                eclilog_show(__FILE__, __func__, NO_MEM_ERROR, LOG_ERROR);
+                return NULL;
+            }
+            slot = series_slots[i];
+            break;
+        }
+        if ( series_slots[i]->count == 0 ) {
+            slot = series_slots[i];
+            break;
+        }
+        /* All taken: oldest block goes */
+        if ( slot == NULL || series_slots[i]->open_ms < slot->open_ms ) {
+            slot = series_slots[i];
+        }
+    }
+    if ( slot->count ) {
+        ecliseries_close( slot, block );
+    }
+    memcpy( slot->topic, topic, topic_len );
+    slot->topic[topic_len] = '\0';
+    slot->topic_len = topic_len;
+
+    return slot;
+}
+
+/**********************************************************************/
+/** Encode open block in block output and free slot.
+ *
+ * @param slot: open block.
+ * @param block: closed block output.
+ *
+ */
+static void ecliseries_close(ecliseries_slot_t *slot, ecli_series_block_t *block) {
+
+    uint8_t *out = block->data;
+
+    memcpy( block->topic, slot->topic, slot->topic_len + 1 );
+    block->topic_len = slot->topic_len;
+    block->samples = slot->count;
+    *out++ = SERIES_MAGIC;
+    *out++ = SERIES_TAG | SERIES_VERSION;
+    out += ecliseries_put( slot->count, out );
+    *out++ = slot->digits;
+    out += ecliseries_put( slot->prefix_len, out );
+    memcpy( out, slot->text, slot->prefix_len );
+    out += slot->prefix_len;
+    out += ecliseries_put( slot->suffix_len, out );
+    memcpy( out, slot->text + slot->prefix_len, slot->suffix_len );
+    out += slot->suffix_len;
+    memcpy( out, slot->body, slot->body_len );
+    out += slot->body_len;
+    block->len = out - block->data;
+    slot->count = 0;
+    slot->body_len = 0;
+}
+
+/**********************************************************************/
+/** Put varint, returns bytes written.
+ *
+ * @param value: unsigned value.
+ * @param out: output, SERIES_VARINT_MAX bytes.
+ *
+ */
+static uint32_t ecliseries_put(uint64_t value, uint8_t *out) {
+
+    uint32_t len = 0;
+
+    while ( value >= 0x80 ) {
+        out[len++] = ( value & 0x7F ) | 0x80;
+        value >>= 7;
+    }
+    out[len++] = value;
+
+    return len;
+}
+
+/**********************************************************************/
+/** Get varint, returns -1 when it does not end before end.
+ *
+ * @param iter: block reader.
+ * @param value: value output.
+ *
+ */
+static int8_t ecliseries_get(ecli_series_iter_t *iter, uint64_t *value) {
+
+    uint32_t shift = 0;
+
+    *value = 0;
+    while ( iter->pos < iter->end && shift < SERIES_VARINT_MAX * 7 ) {
+        *value |= ( uint64_t ) ( *iter->pos & 0x7F ) << shift;
+        if ( ( *iter->pos++ & 0x80 ) == 0 ) {
+            return 0;
+        }
+        shift += 7;
+    }
+
+    return -1;
+}
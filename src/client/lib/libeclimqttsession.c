@@ -0,0 +1,944 @@
+/***********************************************************************
+* FILENAME    :   libeclimqttsession.c
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   Library code for many client sessions served by one
+*                 process ([session] config sections, shared event loop).
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+
+/**********************************************************************/
+
+#include <libeclimqttsession.h>
+#include <libeclimqttsink.h>
+#include <libeclimqttseries.h>
+
+/**********************************************************************/
+#define SESSION_EV_READ       0x01
+#define SESSION_EV_TIMER      0x02
+#define SESSION_EV_WRITE      0x04      /* Socket space for queued packets */
+#define SESSION_NO_TIMER      UINT64_MAX
+
+/**********************************************************************/
+/*Sessions of one [session] section*/
+typedef struct {
+    ecli_broker_t     *broker;              /* Section options, templates not expanded */
+    ecli_conf_t       *conf;
+    ecli_session_mode mode;
+    uint32_t          count;
+    uint32_t          first;
+    uint64_t          interval_ns;          /* Publish period, 0 publish once */
+    uint8_t           own_endpoints;        /* Broker list is not the default one */
+} eclisession_section_t;
+
+/*Client session*/
+typedef struct eclisession_s {
+    const eclisession_section_t *section;
+    ecli_broker_t  *broker;
+    ecli_conf_t    *conf;
+    uint8_t  connected;
+    uint8_t  events;                        /* SESSION_EV_* to run */
+    uint8_t  queued;                        /* In run queue or running */
+    uint8_t  armed_out;                     /* Waiting for socket space */
+    int32_t  heap_idx;                      /* Timer heap position, -1 none */
+    uint32_t attempt;                       /* Failed connects in a row */
+    uint64_t connects;
+    uint64_t due_ns;                        /* Timer */
+    uint64_t pub_ns;                        /* Next publish, 0 none */
+    uint64_t tx_ns;                         /* Last packet sent, keep alive */
+    struct eclisession_s *next;             /* Run queue */
+} eclisession_t;
+
+/**********************************************************************/
+static eclisession_section_t *sections     = NULL;
+static uint32_t        sections_num        = 0;
+static eclisession_t   *sessions           = NULL;
+static uint8_t         *arena              = NULL;   /* broker & conf of every session */
+static uint32_t        sessions_num        = 0;
+static eclisession_t   **timers            = NULL;   /* Min heap on due_ns */
+static uint32_t        timers_num          = 0;
+static eclisession_t   *run_head           = NULL;
+static eclisession_t   *run_tail           = NULL;
+static uint32_t        workers_num         = SESSION_WORKERS_DEFAULT;
+static int32_t         loop_fd             = -1;
+static int32_t         wake_fd             = -1;
+static volatile sig_atomic_t loop_stop     = 0;
+static uint32_t        stat_connected      = 0;
+static uint64_t        stat_reconnects     = 0;
+static uint64_t        stat_published      = 0;
+static uint64_t        stat_held           = 0;
+static uint64_t        stat_received       = 0;
+static pthread_mutex_t session_lock        = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  session_ready       = PTHREAD_COND_INITIALIZER;
+
+/**********************************************************************/
+/**********************************************************************/
+/** Read [session] sections, returns -1 on error.
+ *
+ * @param fileptr: config file, at start.
+ * @param broker: default client connection info.
+ * @param conf: default user config options.
+ *
+ */
+static int8_t eclisession_sections(FILE *fileptr, ecli_broker_t *broker, ecli_conf_t *conf);
+
+/**********************************************************************/
+/** Create session num of section.
+ *
+ * @param session: session to fill.
+ * @param section: section of session.
+ * @param num: session number.
+ *
+ */
+static int8_t eclisession_new(eclisession_t *session, const eclisession_section_t *section,
+                              uint32_t num);
+
+/**********************************************************************/
+/** Copy template replacing %n by num and %% by %.
+ *
+ * @param out: output string.
+ * @param size: output size.
+ * @param template: template string.
+ * @param num: session number.
+ *
+ */
+static void eclisession_expand(char *out, size_t size, const char *template, uint32_t num);
+
+/**********************************************************************/
+/** Worker thread: run ready sessions.
+ *
+ * @param arg: unused.
+ *
+ */
+static void *eclisession_worker(void *arg);
+
+/**********************************************************************/
+/** Run session events: connect, read, publish, keep alive.
+ *
+ * @param session: client session.
+ * @param events: SESSION_EV_* flags.
+ * @param buffer: message buffer of worker.
+ * @param topic: topic buffer of worker.
+ *
+ */
+static void eclisession_step(eclisession_t *session, uint8_t events, uint8_t *buffer, char *topic);
+
+/**********************************************************************/
+/** Connect and subscribe, or schedule retry with backoff.
+ *
+ * @param session: client session.
+ *
+ */
+static void eclisession_connect(eclisession_t *session);
+
+/**********************************************************************/
+/** Close lost connection and schedule reconnection.
+ *
+ * @param session: client session.
+ * @param error: error code.
+ *
+ */
+static void eclisession_lost(eclisession_t *session, uint8_t error);
+
+/**********************************************************************/
+/** Queue session events for a worker (session_lock held).
+ *
+ * @param session: client session.
+ * @param events: SESSION_EV_* flags.
+ *
+ */
+static void eclisession_dispatch(eclisession_t *session, uint8_t events);
+
+/**********************************************************************/
+/** Timer heap: add session (session_lock held).
+ *
+ * @param session: client session.
+ *
+ */
+static void eclisession_timer_add(eclisession_t *session);
+
+/**********************************************************************/
+/** Timer heap: remove session (session_lock held).
+ *
+ * @param session: client session.
+ *
+ */
+static void eclisession_timer_del(eclisession_t *session);
+
+/**********************************************************************/
+/** Timer heap: move entry at idx to its place.
+ *
+ * @param idx: heap position.
+ *
+ */
+static void eclisession_timer_fix(uint32_t idx);
+
+/**********************************************************************/
+/**********************************************************************/
+/** Create sessions from [session] sections of cfg_file, broker and conf
+ * hold the defaults. Returns number of sessions, -1 on error.
+ *
+ * @param cfg_file: sessions config file.
+ * @param broker: default client connection info (global keys).
+ * @param conf: default user config options (global keys).
+ *
+ */
+int32_t eclisession_load(const char *cfg_file, ecli_broker_t *broker, ecli_conf_t *conf) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    char     buffer_str[CLI_BUF_SIZE] = {0};
+    uint32_t i      = 0;
+    uint32_t j      = 0;
+    uint32_t total  = 0;
+    FILE     *fileptr;
+
+    if ( ( fileptr = fopen( cfg_file, "r" ) ) == NULL ) {
+        perror( cfg_file );
+        return -1;
+    }
+    if ( eclisession_sections( fileptr, broker, conf ) < 0 ) {
+        fclose( fileptr );
+        return -1;
+    }
+    fclose( fileptr );
+    if ( sections_num == 0 ) {
+        fprintf( stderr, SESSION_NONE_ERROR "\n", cfg_file );
+        return -1;
+    }
+
+    for ( i = 0; i < sections_num; i++ ) {
+        total += sections[i].count;
+    }
+    /* Anonymous mapping: zero pages, only the written part of a session
+       (short strings of big buffers) takes memory */
+    arena = mmap( NULL, ( size_t ) total * ( sizeof( ecli_broker_t ) + sizeof( ecli_conf_t ) ),
+                  PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if ( arena == MAP_FAILED ||
+         ( sessions = calloc( total, sizeof( eclisession_t ) ) ) == NULL ||
+         ( timers = calloc( total, sizeof( eclisession_t * ) ) ) == NULL ) {
+        fprintf( stderr, NO_MEM_ERROR "\n" );
+        return -1;
+    }
+    for ( i = 0; i < sections_num; i++ ) {
+        for ( j = 0; j < sections[i].count; j++ ) {
+            if ( eclisession_new( &sessions[sessions_num], &sections[i], sections[i].first + j ) < 0 ) {
+                fprintf( stderr, NO_MEM_ERROR "\n" );
+                return -1;
+            }
+            sessions_num++;
+        }
+    }
+    sprintf( buffer_str, SESSION_LOAD_MSG, sessions_num, sections_num, workers_num );
+    eclilog_show(__FILE__, __func__, buffer_str, LOG_INFO);
+
+    return sessions_num;
+}
+
+/**********************************************************************/
+/** Run all sessions until eclisession_stop, then disconnect them.
+ *
+ */
+uint8_t eclisession_run(void) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    struct epoll_event events[SESSION_EVENTS];
+    struct epoll_event wake_event;
+    pthread_t workers[SESSION_WORKERS_MAX];
+    char      buffer_str[CLI_BUF_SIZE] = {0};
+    uint64_t  now_ns   = eclimetrics_now();
+    uint64_t  value    = 0;
+    int32_t   timeout  = 0;
+    int32_t   ready    = 0;
+    uint32_t  started  = 0;
+    uint32_t  i        = 0;
+
+    if ( ( loop_fd = epoll_create1( EPOLL_CLOEXEC ) ) < 0 ||
+         ( wake_fd = eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK ) ) < 0 ) {
+        return CLI_ERROR;
+    }
+    memset( &wake_event, 0, sizeof( wake_event ) );
+    wake_event.events = EPOLLIN;
+    wake_event.data.ptr = NULL;
+    epoll_ctl( loop_fd, EPOLL_CTL_ADD, wake_fd, &wake_event );
+
+    /* Every session starts with a connect */
+    pthread_mutex_lock( &session_lock );
+    for ( i = 0; i < sessions_num; i++ ) {
+        sessions[i].due_ns = now_ns;
+        eclisession_timer_add( &sessions[i] );
+    }
+    pthread_mutex_unlock( &session_lock );
+    for ( started = 0; started < workers_num; started++ ) {
+        if ( pthread_create( &workers[started], NULL, eclisession_worker, NULL ) != 0 ) {
+            break;
+        }
+    }
+
+    while ( !loop_stop && started > 0 ) {
+        pthread_mutex_lock( &session_lock );
+        timeout = -1;
+        if ( timers_num > 0 ) {
+            now_ns = eclimetrics_now();
+            timeout = ( timers[0]->due_ns <= now_ns ) ? 0 :
+                      ( int32_t ) ( ( timers[0]->due_ns - now_ns + 999999 ) / 1000000 );
+        }
+        pthread_mutex_unlock( &session_lock );
+
+        ready = epoll_wait( loop_fd, events, SESSION_EVENTS, timeout );
+        if ( ready < 0 && errno != EINTR ) {
+            break;
+        }
+
+        pthread_mutex_lock( &session_lock );
+        for ( i = 0; ready > 0 && i < ( uint32_t ) ready; i++ ) {
+            if ( events[i].data.ptr == NULL ) {
+                while ( read( wake_fd, &value, sizeof( value ) ) < 0 && errno == EINTR );
+                continue;
+            }
+            eclisession_dispatch( events[i].data.ptr,
+                                  ( ( events[i].events & ~EPOLLOUT ) ? SESSION_EV_READ : 0 ) |
+                                  ( ( events[i].events & EPOLLOUT ) ? SESSION_EV_WRITE : 0 ) );
+        }
+        now_ns = eclimetrics_now();
+        while ( timers_num > 0 && timers[0]->due_ns <= now_ns ) {
+            eclisession_dispatch( timers[0], SESSION_EV_TIMER );
+        }
+        pthread_mutex_unlock( &session_lock );
+    }
+
+    /* Workers finish the sessions they run */
+    pthread_mutex_lock( &session_lock );
+    loop_stop = TRUE_FLAG;
+    pthread_cond_broadcast( &session_ready );
+    pthread_mutex_unlock( &session_lock );
+    for ( i = 0; i < started; i++ ) {
+        pthread_join( workers[i], NULL );
+    }
+
+    for ( i = 0; i < sessions_num; i++ ) {
+        if ( sessions[i].connected ) {
+            eclimqtt_disconnect( sessions[i].broker );
+            ecli_close( sessions[i].broker );
+        }
+        free( sessions[i].broker->connect_packet );
+        sessions[i].broker->connect_packet = NULL;
+    }
+    /* Broker lists (and resolver threads) created for sections */
+    for ( i = 0; i < sections_num; i++ ) {
+        if ( sections[i].own_endpoints ) {
+            eclinet_free( sections[i].broker->transport.endpoints );
+            sections[i].broker->transport.endpoints = NULL;
+        }
+    }
+    sprintf( buffer_str, SESSION_END_MSG, stat_connected, ( unsigned long long ) stat_reconnects,
+             ( unsigned long long ) stat_published, ( unsigned long long ) stat_held,
+             ( unsigned long long ) stat_received );
+    eclilog_show(__FILE__, __func__, buffer_str, LOG_INFO);
+    close( wake_fd );
+    close( loop_fd );
+
+    return started > 0 ? CLI_NO_ERROR : CLI_ERROR;
+}
+
+/**********************************************************************/
+/** Stop event loop (async signal safe).
+ *
+ */
+void eclisession_stop(void) {
+
+    uint64_t value = 1;
+
+    loop_stop = TRUE_FLAG;
+    if ( wake_fd >= 0 && write( wake_fd, &value, sizeof( value ) ) < 0 ) {
+        return;
+    }
+}
+
+/**********************************************************************/
+/**********************************************************************/
+/** Read [session] sections, returns -1 on error.
+ *
+ * @param fileptr: config file, at start.
+ * @param broker: default client connection info.
+ * @param conf: default user config options.
+ *
+ */
+static int8_t eclisession_sections(FILE *fileptr, ecli_broker_t *broker, ecli_conf_t *conf) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    char     line[CLI_CFGLINE_LEN];
+    char     key[CLI_CFGLINE_LEN]   = {0};
+    char     value[CLI_CFGLINE_LEN] = {0};
+    eclisession_section_t *section  = NULL;
+    eclisession_section_t *resized  = NULL;
+
+    while ( fgets( line, sizeof( line ), fileptr ) != NULL ) {
+        if ( strncmp( line, SESSION_SECTION, strlen( SESSION_SECTION ) ) == 0 ) {
+            if ( ( resized = realloc( sections, ( sections_num + 1 ) * sizeof( *sections ) ) ) == NULL ) {
+                fprintf( stderr, NO_MEM_ERROR "\n" );
+                return -1;
+            }
+            sections = resized;
+            section = &sections[sections_num++];
+            memset( section, 0, sizeof( *section ) );
+            section->broker = malloc( sizeof( ecli_broker_t ) );
+            section->conf = malloc( sizeof( ecli_conf_t ) );
+            if ( section->broker == NULL || section->conf == NULL ) {
+                fprintf( stderr, NO_MEM_ERROR "\n" );
+                return -1;
+            }
+            *section->broker = *broker;
+            *section->conf = *conf;
+            section->mode = SESSION_PUB;
+            section->count = 1;
+            section->first = 1;
+            continue;
+        }
+        ecli_conf_value( line, key, value );
+        if ( key[0] == '\0' ) {
+            continue;
+        }
+        /* Global keys were set by ecli_get_conf, only the runner ones are left */
+        if ( section == NULL ) {
+            if ( strcmp( key, SESSION_WORKERS_ID ) == EQUAL_STR_CMP ) {
+                workers_num = atoi( value );
+                if ( workers_num < 1 || workers_num > SESSION_WORKERS_MAX ) {
+                    workers_num = workers_num < 1 ? 1 : SESSION_WORKERS_MAX;
+                }
+            }
+            continue;
+        }
+        if ( strcmp( key, SESSION_MODE_ID ) == EQUAL_STR_CMP ) {
+            if ( strcmp( value, SESSION_PUB_NAME ) == EQUAL_STR_CMP ) {
+                section->mode = SESSION_PUB;
+            }
+            else if ( strcmp( value, SESSION_SUB_NAME ) == EQUAL_STR_CMP ) {
+                section->mode = SESSION_SUB;
+            }
+            else {
+                fprintf( stderr, SESSION_MODE_ERROR "\n" );
+                return -1;
+            }
+        }
+        else if ( strcmp( key, SESSION_COUNT_ID ) == EQUAL_STR_CMP ) {
+            section->count = atoi( value );
+        }
+        else if ( strcmp( key, SESSION_FIRST_ID ) == EQUAL_STR_CMP ) {
+            section->first = atoi( value );
+        }
+        else if ( strcmp( key, SESSION_MSG_ID ) == EQUAL_STR_CMP ) {
+            strncpy( section->conf->msg_txt, value, sizeof( section->conf->msg_txt ) - 1 );
+        }
+        else if ( ecli_set_conf( section->broker, section->conf, key, value ) < 0 ) {
+            fprintf( stderr, SESSION_KEY_ERROR "\n", key, sections_num );
+            return -1;
+        }
+    }
+
+    for ( section = sections; section < sections + sections_num; section++ ) {
+        if ( section->conf->publish_rate > 0 ) {
+            section->interval_ns = 1000000000.0 / section->conf->publish_rate;
+        }
+        /* Workers retry with backoff, connects do not wait */
+        section->conf->persist_conn_time = 0;
+        /* The io_uring ring belongs to one thread, sessions run on workers */
+        if ( section->conf->io_uring ) {
+            fprintf( stderr, URING_SESSION_ERROR "\n" );
+            return -1;
+        }
+        /* Own broker list when the section changes it */
+        if ( strcmp( section->conf->broker_hostname, conf->broker_hostname ) == EQUAL_STR_CMP &&
+             section->conf->broker_port == conf->broker_port ) {
+            continue;
+        }
+        section->own_endpoints = TRUE_FLAG;
+        if ( strncmp( section->conf->broker_hostname, TRANSPORT_UNIX_PREFIX,
+                      strlen( TRANSPORT_UNIX_PREFIX ) ) == 0 ) {
+            eclitransport_init( &section->broker->transport, &eclitransport_unix );
+            strncpy( section->broker->transport.path,
+                     section->conf->broker_hostname + strlen( TRANSPORT_UNIX_PREFIX ),
+                     sizeof( section->broker->transport.path ) - 1 );
+            continue;
+        }
+        eclitransport_init( &section->broker->transport,
+                            section->conf->tls ? &eclitls_transport : &eclitransport_tcp );
+        section->broker->transport.stagger_ms = section->conf->connect_stagger;
+        if ( ( section->broker->transport.endpoints = eclinet_new( section->conf->broker_hostname,
+                                                                   section->conf->broker_port,
+                                                                   section->conf->dns_refresh ) ) == NULL ) {
+            fprintf( stderr, NO_MEM_ERROR "\n" );
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Create session num of section.
+ *
+ * @param session: session to fill.
+ * @param section: section of session.
+ * @param num: session number.
+ *
+ */
+static int8_t eclisession_new(eclisession_t *session, const eclisession_section_t *section,
+                              uint32_t num) {
+
+    const ecli_broker_t *base_broker = section->broker;
+    const ecli_conf_t   *base_conf   = section->conf;
+    uint8_t       *slot   = arena + ( size_t ) ( session - sessions ) *
+                                    ( sizeof( ecli_broker_t ) + sizeof( ecli_conf_t ) );
+    ecli_broker_t *broker = ( ecli_broker_t * ) slot;
+    ecli_conf_t   *conf   = ( ecli_conf_t * ) ( slot + sizeof( ecli_broker_t ) );
+
+    /* Big string buffers are copied up to their length */
+    memcpy( broker, base_broker, offsetof( ecli_broker_t, will_msg ) );
+    memcpy( &broker->will_flag, &base_broker->will_flag,
+            sizeof( ecli_broker_t ) - offsetof( ecli_broker_t, will_flag ) );
+    eclisession_expand( broker->client_id, sizeof( broker->client_id ), base_broker->client_id, num );
+    eclisession_expand( broker->topic, sizeof( broker->topic ), base_broker->topic, num );
+    eclisession_expand( broker->will_topic, sizeof( broker->will_topic ), base_broker->will_topic, num );
+    eclisession_expand( broker->will_msg, sizeof( broker->will_msg ), base_broker->will_msg, num );
+    strcpy( broker->retain_msg, base_broker->retain_msg );
+    broker->connect_packet = NULL;
+    broker->connect_len = 0;
+    broker->rx_pending = 0;
+    broker->msg_id = 0;
+    broker->transport.socketid = -1;
+    broker->transport.ctx = NULL;
+    /* A congested link holds publishes instead of a worker */
+    broker->sendq.nonblock = TRUE_FLAG;
+    if ( ( broker->metrics = eclimetrics_new( broker->client_id ) ) == NULL ) {
+        return -1;
+    }
+
+    memcpy( conf->broker_hostname, base_conf->broker_hostname, sizeof( conf->broker_hostname ) );
+    eclisession_expand( conf->msg_txt, sizeof( conf->msg_txt ), base_conf->msg_txt, num );
+    memcpy( conf->datafile_path, base_conf->datafile_path,
+            sizeof( ecli_conf_t ) - offsetof( ecli_conf_t, datafile_path ) );
+
+    session->section = section;
+    session->broker = broker;
+    session->conf = conf;
+    session->heap_idx = -1;
+    session->pub_ns = 0;
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Copy template replacing %n by num and %% by %.
+ *
+ * @param out: output string.
+ * @param size: output size.
+ * @param template: template string.
+ * @param num: session number.
+ *
+ */
+static void eclisession_expand(char *out, size_t size, const char *template, uint32_t num) {
+
+    size_t pos = 0;
+
+    while ( *template && pos + 1 < size ) {
+        if ( template[0] == '%' && template[1] == 'n' ) {
+            pos += snprintf( out + pos, size - pos, "%u", num );
+            template += 2;
+        }
+        else if ( template[0] == '%' && template[1] == '%' ) {
+            out[pos++] = '%';
+            template += 2;
+        }
+        else {
+            out[pos++] = *template++;
+        }
+    }
+    if ( pos >= size ) {
+        pos = size - 1;
+    }
+    out[pos] = '\0';
+}
+
+/**********************************************************************/
+/** Worker thread: run ready sessions.
+ *
+ * @param arg: unused.
+ *
+ */
+static void *eclisession_worker(void *arg) {
+
+    uint8_t       *buffer = malloc( CLI_MAX_MSG_SIZE );
+    char          topic[CLI_TOPIC_LEN + 1];
+    eclisession_t *session;
+    uint8_t       events;
+    uint64_t      value = 1;
+
+    if ( buffer == NULL ) {
+        return NULL;
+    }
+    pthread_mutex_lock( &session_lock );
+    for ( ;; ) {
+        while ( run_head == NULL && !loop_stop ) {
+            pthread_cond_wait( &session_ready, &session_lock );
+        }
+        if ( loop_stop ) {
+            break;
+        }
+        session = run_head;
+        if ( ( run_head = session->next ) == NULL ) {
+            run_tail = NULL;
+        }
+        events = session->events;
+        session->events = 0;
+        pthread_mutex_unlock( &session_lock );
+
+        eclisession_step( session, events, buffer, topic );
+
+        pthread_mutex_lock( &session_lock );
+        /* Events that came while running: run again, else wait timer */
+        if ( session->events ) {
+            session->next = NULL;
+            if ( run_tail ) {
+                run_tail->next = session;
+            }
+            else {
+                run_head = session;
+            }
+            run_tail = session;
+        }
+        else {
+            session->queued = FALSE_FLAG;
+            eclisession_timer_add( session );
+            /* Earliest timer now: loop may be waiting longer */
+            if ( session->heap_idx == 0 && write( wake_fd, &value, sizeof( value ) ) < 0 ) {
+                continue;
+            }
+        }
+    }
+    pthread_mutex_unlock( &session_lock );
+    free( buffer );
+
+    return NULL;
+}
+
+/**********************************************************************/
+/** Run session events: connect, read, publish, keep alive.
+ *
+ * @param session: client session.
+ * @param events: SESSION_EV_* flags.
+ * @param buffer: message buffer of worker.
+ * @param topic: topic buffer of worker.
+ *
+ */
+static void eclisession_step(eclisession_t *session, uint8_t events, uint8_t *buffer, char *topic) {
+
+    ecli_broker_t *broker = session->broker;
+    ecli_conf_t   *conf   = session->conf;
+    char     buffer_str[CLI_BUF_SIZE] = {0};
+    uint8_t  return_code  = CLI_NO_ERROR;
+    uint32_t msg_len      = 0;
+    uint64_t alive_ns     = broker->alive * 500000000ULL;
+    uint64_t now_ns       = 0;
+    uint64_t wait_ns      = 0;
+    uint8_t  want_out     = FALSE_FLAG;
+    uint8_t  sample[SERIES_TEXT_MAX];
+    int32_t  sample_len   = 0;
+    uint64_t sample_ms    = 0;
+    int8_t   series_found = 0;
+    ecli_series_iter_t series;
+    struct pollfd      pfd;
+    struct epoll_event event;
+
+    if ( !session->connected ) {
+        if ( events & SESSION_EV_TIMER ) {
+            eclisession_connect( session );
+        }
+        return;
+    }
+
+    pfd.fd = broker->transport.ops->fd( &broker->transport );
+    if ( eclisendq_flush( &broker->sendq, &broker->transport, FALSE_FLAG ) < 0 ) {
+        eclisession_lost( session, CLI_ERROR );
+        return;
+    }
+    if ( events & SESSION_EV_READ ) {
+        pfd.events = POLLIN;
+        /* Acks read by publish leave nothing: check before a blocking read */
+        while ( broker->rx_pending || eclitls_pending( &broker->transport ) ||
+                poll( &pfd, 1, 0 ) > 0 ) {
+            return_code = ecli_read_get_msg( broker, conf, topic, buffer, &msg_len, SESSION_READ_TIMEOUT );
+            if ( return_code == CLI_READ_TIMEOUT_ERROR ) {
+                break;
+            }
+            if ( return_code != CLI_NO_ERROR ) {
+                eclisession_lost( session, return_code );
+                return;
+            }
+            if ( msg_len == 0 ) {
+                continue;
+            }
+            __atomic_add_fetch( &stat_received, 1, __ATOMIC_RELAXED );
+            if ( conf->output_sink != CLI_SINK_NONE && conf->series &&
+                 ( series_found = ecliseries_open( &series, buffer, msg_len ) ) != 0 ) {
+                /* Aggregated block: one sink message per sample */
+                sample_len = 0;
+                while ( series_found > 0 && ( sample_len = ecliseries_next( &series, sample, &sample_ms ) ) > 0 ) {
+                    if ( eclisink_push( topic, sample, sample_len, sample_ms ) < 0 ) {
+                        eclisession_stop();
+                        break;
+                    }
+                }
+                if ( series_found < 0 || sample_len < 0 ) {
+                    snprintf( buffer_str, sizeof( buffer_str ), SERIES_BLOCK_ERROR, topic );
+                    eclilog_show(__FILE__, __func__, buffer_str, LOG_ERROR);
+                }
+            }
+            else if ( conf->output_sink != CLI_SINK_NONE ) {
+                if ( eclisink_push( topic, buffer, msg_len, 0 ) < 0 ) {
+                    eclisession_stop();
+                }
+            }
+            else {
+                snprintf( buffer_str, sizeof( buffer_str ), SESSION_RECV_MSG, broker->client_id, topic, msg_len );
+                eclilog_show(__FILE__, __func__, buffer_str, LOG_DEBUG);
+            }
+        }
+    }
+
+    now_ns = eclimetrics_now();
+    if ( session->pub_ns && now_ns >= session->pub_ns ) {
+        /* Congested without drop policy: this period is skipped */
+        if ( eclisendq_congested( &broker->sendq ) && conf->sendq_drop == SENDQ_DROP_NONE ) {
+            __atomic_add_fetch( &stat_held, 1, __ATOMIC_RELAXED );
+        }
+        else if ( ( return_code = eclimqtt_publish( broker, conf, FALSE_FLAG ) ) != CLI_NO_ERROR ) {
+            eclisession_lost( session, return_code );
+            return;
+        }
+        else {
+            __atomic_add_fetch( &stat_published, 1, __ATOMIC_RELAXED );
+            session->tx_ns = now_ns;
+        }
+        /* Periodic publish keeps schedule, a late one is not caught up */
+        if ( session->section->interval_ns ) {
+            session->pub_ns += session->section->interval_ns;
+            if ( session->pub_ns < now_ns ) {
+                session->pub_ns = now_ns + session->section->interval_ns;
+            }
+        }
+        else {
+            session->pub_ns = 0;
+        }
+    }
+    if ( alive_ns && now_ns - session->tx_ns >= alive_ns ) {
+        if ( ( return_code = eclimqtt_pingreq( broker ) ) != CLI_NO_ERROR ) {
+            eclisession_lost( session, return_code );
+            return;
+        }
+        session->tx_ns = now_ns;
+    }
+
+    /* One shot registration: armed again after socket events, or for
+       socket space while packets are queued (a lane over its rate waits
+       for the timer instead) */
+    wait_ns = eclisendq_wait_ns( &broker->sendq );
+    want_out = broker->sendq.queued > 0 && wait_ns == 0;
+    if ( ( events & ( SESSION_EV_READ | SESSION_EV_WRITE ) ) || want_out != session->armed_out ) {
+        memset( &event, 0, sizeof( event ) );
+        event.events = EPOLLIN | EPOLLONESHOT | ( want_out ? EPOLLOUT : 0 );
+        event.data.ptr = session;
+        epoll_ctl( loop_fd, EPOLL_CTL_MOD, pfd.fd, &event );
+        session->armed_out = want_out;
+    }
+
+    session->due_ns = SESSION_NO_TIMER;
+    if ( session->pub_ns ) {
+        session->due_ns = session->pub_ns;
+    }
+    if ( alive_ns && session->tx_ns + alive_ns < session->due_ns ) {
+        session->due_ns = session->tx_ns + alive_ns;
+    }
+    if ( wait_ns && now_ns + wait_ns < session->due_ns ) {
+        session->due_ns = now_ns + wait_ns;
+    }
+}
+
+/**********************************************************************/
+/** Connect and subscribe, or schedule retry with backoff.
+ *
+ * @param session: client session.
+ *
+ */
+static void eclisession_connect(eclisession_t *session) {
+
+    ecli_broker_t *broker = session->broker;
+    ecli_conf_t   *conf   = session->conf;
+    uint8_t  return_code  = CLI_NO_ERROR;
+    struct epoll_event event;
+
+    if ( ( return_code = ecli_init( broker, conf ) ) == CLI_NO_ERROR ) {
+        if ( ( return_code = eclimqtt_connect( broker, conf ) ) == CLI_NO_ERROR ) {
+            if ( session->section->mode == SESSION_SUB && !broker->session_present ) {
+                return_code = eclimqtt_subscribe( broker, conf );
+            }
+            else if ( session->section->mode == SESSION_PUB && conf->publish_online_flg ) {
+                return_code = eclimqtt_publish( broker, conf, TRUE_FLAG );
+            }
+        }
+    }
+    if ( return_code == CLI_NO_ERROR ) {
+        memset( &event, 0, sizeof( event ) );
+        event.events = EPOLLIN | EPOLLONESHOT;
+        event.data.ptr = session;
+        if ( epoll_ctl( loop_fd, EPOLL_CTL_ADD, broker->transport.ops->fd( &broker->transport ),
+                        &event ) < 0 ) {
+            return_code = CLI_CON_ERROR;
+        }
+    }
+    if ( return_code != CLI_NO_ERROR ) {
+        ecli_show_error( return_code );
+        ecli_close( broker );
+        session->due_ns = eclimetrics_now() + ecli_backoff_msecs( conf, session->attempt++ ) * 1000000ULL;
+        return;
+    }
+
+    session->connected = TRUE_FLAG;
+    session->armed_out = FALSE_FLAG;
+    session->attempt = 0;
+    session->tx_ns = eclimetrics_now();
+    session->pub_ns = ( session->section->mode == SESSION_PUB ) ? session->tx_ns : 0;
+    session->due_ns = session->pub_ns ? session->pub_ns : session->tx_ns + broker->alive * 500000000ULL;
+    if ( session->connects++ ) {
+        __atomic_add_fetch( &stat_reconnects, 1, __ATOMIC_RELAXED );
+    }
+    __atomic_add_fetch( &stat_connected, 1, __ATOMIC_RELAXED );
+}
+
+/**********************************************************************/
+/** Close lost connection and schedule reconnection.
+ *
+ * @param session: client session.
+ * @param error: error code.
+ *
+ */
+static void eclisession_lost(eclisession_t *session, uint8_t error) {
+
+    ecli_show_error( error );
+    epoll_ctl( loop_fd, EPOLL_CTL_DEL, session->broker->transport.ops->fd( &session->broker->transport ), NULL );
+    ecli_close( session->broker );
+    session->connected = FALSE_FLAG;
+    __atomic_sub_fetch( &stat_connected, 1, __ATOMIC_RELAXED );
+    session->due_ns = eclimetrics_now() + ecli_backoff_msecs( session->conf, session->attempt++ ) * 1000000ULL;
+}
+
+/**********************************************************************/
+/** Queue session events for a worker (session_lock held).
+ *
+ * @param session: client session.
+ * @param events: SESSION_EV_* flags.
+ *
+ */
+static void eclisession_dispatch(eclisession_t *session, uint8_t events) {
+
+    session->events |= events;
+    if ( session->queued ) {
+        return;
+    }
+    eclisession_timer_del( session );
+    session->queued = TRUE_FLAG;
+    session->next = NULL;
+    if ( run_tail ) {
+        run_tail->next = session;
+    }
+    else {
+        run_head = session;
+    }
+    run_tail = session;
+    pthread_cond_signal( &session_ready );
+}
+
+/**********************************************************************/
+/** Timer heap: add session (session_lock held).
+ *
+ * @param session: client session.
+ *
+ */
+static void eclisession_timer_add(eclisession_t *session) {
+
+    if ( session->heap_idx >= 0 || session->due_ns == SESSION_NO_TIMER ) {
+        return;
+    }
+    session->heap_idx = timers_num;
+    timers[timers_num++] = session;
+    eclisession_timer_fix( session->heap_idx );
+}
+
+/**********************************************************************/
+/** Timer heap: remove session (session_lock held).
+ *
+ * @param session: client session.
+ *
+ */
+static void eclisession_timer_del(eclisession_t *session) {
+
+    uint32_t idx = session->heap_idx;
+
+    if ( session->heap_idx < 0 ) {
+        return;
+    }
+    session->heap_idx = -1;
+    if ( idx == --timers_num ) {
+        return;
+    }
+    timers[idx] = timers[timers_num];
+    timers[idx]->heap_idx = idx;
+    eclisession_timer_fix( idx );
+}
+
+/**********************************************************************/
+/** Timer heap: move entry at idx to its place.
+ *
+ * @param idx: heap position.
+ *
+ */
+static void eclisession_timer_fix(uint32_t idx) {
+
+    eclisession_t *entry = timers[idx];
+    uint32_t parent = 0;
+    uint32_t child  = 0;
+
+    /* Up while earlier than parent */
+    while ( idx > 0 && timers[ parent = ( idx - 1 ) / 2 ]->due_ns > entry->due_ns ) {
+        timers[idx] = timers[parent];
+        timers[idx]->heap_idx = idx;
+        idx = parent;
+    }
+    /* Down while later than a child */
+    while ( ( child = 2 * idx + 1 ) < timers_num ) {
+        if ( child + 1 < timers_num && timers[child + 1]->due_ns < timers[child]->due_ns ) {
+            child++;
+        }
+        if ( timers[child]->due_ns >= entry->due_ns ) {
+            break;
+        }
+        timers[idx] = timers[child];
+        timers[idx]->heap_idx = idx;
+        idx = child;
+    }
+    timers[idx] = entry;
+    entry->heap_idx = idx;
+}
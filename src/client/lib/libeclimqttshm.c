@@ -0,0 +1,479 @@
+/***********************************************************************
+* FILENAME    :   libeclimqttshm.c
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   Library code for the shared memory fan-out ring: one
+*                 subscriber writes, local processes read in place.
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/**********************************************************************/
+
+#include <libeclimqttshm.h>
+#include <libeclimqttlog.h>
+
+/**********************************************************************/
+static ecli_shm_head_t *shm_head     = NULL;
+static uint8_t         *shm_data     = NULL;
+static uint64_t        shm_mask      = 0;
+static uint64_t        shm_map_size  = 0;
+
+/**********************************************************************/
+/**********************************************************************/
+/** Map shm object, returns NULL on error.
+ *
+ * @param fd: shm object.
+ * @param size: object bytes.
+ *
+ */
+static ecli_shm_head_t *eclishm_map(int32_t fd, uint64_t size);
+
+/**********************************************************************/
+/** Take a free reader slot (or the slot of a dead reader), returns NULL
+ * when all are used.
+ *
+ * @param head: ring head page.
+ *
+ */
+static ecli_shm_slot_t *eclishm_slot(ecli_shm_head_t *head);
+
+/**********************************************************************/
+/** futex call on the head page word (shared between processes).
+ *
+ * @param word: futex word.
+ * @param op: FUTEX_WAIT or FUTEX_WAKE.
+ * @param value: expected word (wait) or readers to wake (wake).
+ * @param timeout_ms: max msecs to wait, -1 forever.
+ *
+ */
+static int32_t eclishm_futex(uint32_t *word, int32_t op, uint32_t value, int32_t timeout_ms);
+
+/**********************************************************************/
+/**********************************************************************/
+/** Create ring (or take an existing one of the same size, readers go
+ * on), returns -1 on error.
+ *
+ * @param name: shm_open name ("/name").
+ * @param size: data ring bytes, rounded up to a power of two.
+ *
+ */
+int8_t eclishm_create(const char *name, uint64_t size) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    struct stat st;
+    ecli_shm_head_t *head = NULL;
+    uint64_t ring = SHM_SIZE_MIN;
+    int32_t  fd   = -1;
+
+    if ( shm_head != NULL ) {
+        return 0;
+    }
+    while ( ring < size ) {
+        ring <<= 1;
+    }
+    if ( ( fd = shm_open( name, O_RDWR | O_CREAT | O_CLOEXEC, SHM_MODE ) ) < 0 ||
+         fstat( fd, &st ) < 0 ) {
+        if ( fd >= 0 ) {
+            close( fd );
+        }
+        return -1;
+    }
+    /* Same ring: positions and sequence go on for attached readers */
+    if ( ( uint64_t ) st.st_size == SHM_HEAD_SIZE + ring &&
+         ( head = eclishm_map( fd, SHM_HEAD_SIZE + ring ) ) != NULL ) {
+        if ( __atomic_load_n( &head->magic, __ATOMIC_ACQUIRE ) == SHM_MAGIC &&
+             head->version == SHM_VERSION && head->size == ring ) {
+            close( fd );
+            head->writer_pid = getpid();
+            shm_head = head;
+            shm_data = ( uint8_t * ) head + SHM_HEAD_SIZE;
+            shm_mask = ring - 1;
+            shm_map_size = SHM_HEAD_SIZE + ring;
+            return 0;
+        }
+        munmap( head, SHM_HEAD_SIZE + ring );
+    }
+    /* Other size or format: readers of the old one keep their mapping */
+    if ( st.st_size != 0 ) {
+        close( fd );
+        shm_unlink( name );
+        if ( ( fd = shm_open( name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, SHM_MODE ) ) < 0 ) {
+            return -1;
+        }
+    }
+    if ( ftruncate( fd, SHM_HEAD_SIZE + ring ) < 0 ||
+         ( head = eclishm_map( fd, SHM_HEAD_SIZE + ring ) ) == NULL ) {
+        close( fd );
+        return -1;
+    }
+    close( fd );
+    head->version = SHM_VERSION;
+    head->size = ring;
+    head->writer_pid = getpid();
+    __atomic_store_n( &head->magic, SHM_MAGIC, __ATOMIC_RELEASE );
+    shm_head = head;
+    shm_data = ( uint8_t * ) head + SHM_HEAD_SIZE;
+    shm_mask = ring - 1;
+    shm_map_size = SHM_HEAD_SIZE + ring;
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Write message to the ring (single writer), returns -1 when it is
+ * over a quarter of the ring or there is no ring.
+ *
+ * @param topic: message topic.
+ * @param topic_len: topic size.
+ * @param msg: message payload.
+ * @param msg_len: message size.
+ * @param ts_ms: message epoch msecs.
+ *
+ */
+int8_t eclishm_write(const char *topic, uint16_t topic_len, const uint8_t *msg, uint32_t msg_len,
+                     uint64_t ts_ms) {
+
+    ecli_shm_rec_t *rec = NULL;
+    uint64_t rec_len = SHM_ALIGN( sizeof( ecli_shm_rec_t ) + topic_len + msg_len );
+    uint64_t pos     = 0;
+    uint64_t tail    = 0;
+    uint64_t off     = 0;
+    uint64_t pad     = 0;
+    uint64_t end     = 0;
+    uint32_t len     = 0;
+
+    if ( shm_head == NULL ) {
+        return -1;
+    }
+    /* Big ones would leave readers too little to work on */
+    if ( rec_len > ( shm_mask + 1 ) / 4 ) {
+        __atomic_add_fetch( &shm_head->too_big, 1, __ATOMIC_RELAXED );
+        return -1;
+    }
+    pos = shm_head->head;
+    off = pos & shm_mask;
+    if ( shm_mask + 1 - off < rec_len ) {
+        pad = shm_mask + 1 - off;
+    }
+    end = pos + pad + rec_len;
+
+    /* Records to overwrite leave the ring before their bytes change */
+    tail = shm_head->tail;
+    if ( end - tail > shm_mask + 1 ) {
+        while ( end - tail > shm_mask + 1 ) {
+            len = ( ( ecli_shm_rec_t * ) ( shm_data + ( tail & shm_mask ) ) )->len;
+            tail += len & ~SHM_PAD_FLAG;
+        }
+        __atomic_store_n( &shm_head->tail, tail, __ATOMIC_RELAXED );
+        __atomic_thread_fence( __ATOMIC_RELEASE );
+    }
+
+    if ( pad ) {
+        ( ( ecli_shm_rec_t * ) ( shm_data + off ) )->len = SHM_PAD_FLAG | pad;
+        off = 0;
+    }
+    rec = ( ecli_shm_rec_t * ) ( shm_data + off );
+    rec->len = rec_len;
+    rec->topic_len = topic_len;
+    rec->reserved = 0;
+    rec->msg_len = msg_len;
+    rec->reserved2 = 0;
+    rec->seq = shm_head->seq + 1;
+    rec->ts_ms = ts_ms;
+    memcpy( rec + 1, topic, topic_len );
+    memcpy( ( uint8_t * ) ( rec + 1 ) + topic_len, msg, msg_len );
+    __atomic_store_n( &shm_head->seq, rec->seq, __ATOMIC_RELAXED );
+    __atomic_store_n( &shm_head->head, end, __ATOMIC_RELEASE );
+
+    /* Wake readers only when one sleeps: no syscall per message */
+    __atomic_thread_fence( __ATOMIC_SEQ_CST );
+    if ( __atomic_load_n( &shm_head->waiters, __ATOMIC_RELAXED ) ) {
+        __atomic_add_fetch( &shm_head->notify, 1, __ATOMIC_SEQ_CST );
+        eclishm_futex( &shm_head->notify, FUTEX_WAKE, INT_MAX, -1 );
+    }
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Unmap ring, readers keep reading what was written.
+ *
+ */
+void eclishm_close(void) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    if ( shm_head == NULL ) {
+        return;
+    }
+    shm_head->writer_pid = 0;
+    munmap( shm_head, shm_map_size );
+    shm_head = NULL;
+    shm_data = NULL;
+}
+
+/**********************************************************************/
+/** Map ring and take a reader slot, returns -1 on error (no ring, no
+ * free slot).
+ *
+ * @param reader: reader state.
+ * @param name: shm_open name ("/name").
+ * @param oldest: start at oldest record in the ring, else at new ones.
+ *
+ */
+int8_t eclishm_attach(ecli_shm_reader_t *reader, const char *name, uint8_t oldest) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    struct stat st;
+    ecli_shm_head_t *head = NULL;
+    int32_t fd = -1;
+
+    memset( reader, 0, sizeof( ecli_shm_reader_t ) );
+    if ( ( fd = shm_open( name, O_RDWR | O_CLOEXEC, 0 ) ) < 0 ) {
+        return -1;
+    }
+    if ( fstat( fd, &st ) < 0 || st.st_size <= SHM_HEAD_SIZE ||
+         ( head = eclishm_map( fd, st.st_size ) ) == NULL ) {
+        close( fd );
+        return -1;
+    }
+    close( fd );
+    /* Writer still making it, or another format */
+    if ( __atomic_load_n( &head->magic, __ATOMIC_ACQUIRE ) != SHM_MAGIC ||
+         head->version != SHM_VERSION || head->size + SHM_HEAD_SIZE != ( uint64_t ) st.st_size ) {
+        munmap( head, st.st_size );
+        errno = EAGAIN;
+        return -1;
+    }
+    if ( ( reader->slot = eclishm_slot( head ) ) == NULL ) {
+        munmap( head, st.st_size );
+        errno = EUSERS;
+        return -1;
+    }
+    reader->head = head;
+    reader->data = ( uint8_t * ) head + SHM_HEAD_SIZE;
+    reader->mask = head->size - 1;
+    reader->map_size = st.st_size;
+    if ( oldest ) {
+        reader->cursor = __atomic_load_n( &head->tail, __ATOMIC_ACQUIRE );
+    }
+    else {
+        reader->seq = __atomic_load_n( &head->seq, __ATOMIC_ACQUIRE ) + 1;
+        reader->cursor = __atomic_load_n( &head->head, __ATOMIC_ACQUIRE );
+    }
+    __atomic_store_n( &reader->slot->cursor, reader->cursor, __ATOMIC_RELAXED );
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Read next message in place, returns 1 with msg, 0 when there is no
+ * new message. Skips forward (counting lost messages) when lapped.
+ *
+ * @param reader: reader state.
+ * @param msg: message output, valid until the writer laps the reader.
+ *
+ */
+int8_t eclishm_next(ecli_shm_reader_t *reader, ecli_shm_msg_t *msg) {
+
+    ecli_shm_head_t *head = reader->head;
+    ecli_shm_rec_t  rec;
+    uint64_t tail = 0;
+    const uint8_t *data = NULL;
+
+    for ( ;; ) {
+        if ( reader->cursor == __atomic_load_n( &head->head, __ATOMIC_ACQUIRE ) ) {
+            return 0;
+        }
+        /* Lapped: oldest whole record, the gap is counted by seq */
+        tail = __atomic_load_n( &head->tail, __ATOMIC_ACQUIRE );
+        if ( reader->cursor < tail ) {
+            reader->cursor = tail;
+            __atomic_add_fetch( &reader->slot->skips, 1, __ATOMIC_RELAXED );
+            continue;
+        }
+        /* Pad may have only its len before the ring end */
+        data = reader->data + ( reader->cursor & reader->mask );
+        memcpy( &rec.len, data, sizeof( rec.len ) );
+        if ( !( rec.len & SHM_PAD_FLAG ) ) {
+            memcpy( &rec, data, sizeof( rec ) );
+        }
+        /* Header is only good when the writer did not take it meanwhile */
+        __atomic_thread_fence( __ATOMIC_ACQUIRE );
+        if ( __atomic_load_n( &head->tail, __ATOMIC_RELAXED ) > reader->cursor ) {
+            continue;
+        }
+        if ( rec.len & SHM_PAD_FLAG ) {
+            reader->cursor += rec.len & ~SHM_PAD_FLAG;
+            continue;
+        }
+        break;
+    }
+    if ( reader->seq && rec.seq > reader->seq ) {
+        __atomic_add_fetch( &reader->slot->lost, rec.seq - reader->seq, __ATOMIC_RELAXED );
+    }
+    msg->topic = ( const char * ) data + sizeof( rec );
+    msg->topic_len = rec.topic_len;
+    msg->payload = data + sizeof( rec ) + rec.topic_len;
+    msg->len = rec.msg_len;
+    msg->seq = rec.seq;
+    msg->ts_ms = rec.ts_ms;
+    reader->last = reader->cursor;
+    reader->cursor += rec.len;
+    reader->seq = rec.seq + 1;
+    __atomic_store_n( &reader->slot->cursor, reader->cursor, __ATOMIC_RELAXED );
+    __atomic_add_fetch( &reader->slot->msgs, 1, __ATOMIC_RELAXED );
+
+    return 1;
+}
+
+/**********************************************************************/
+/** Check that the last message read was not overwritten while it was
+ * used, returns 1 when it is whole.
+ *
+ * @param reader: reader state.
+ *
+ */
+int8_t eclishm_valid(const ecli_shm_reader_t *reader) {
+
+    __atomic_thread_fence( __ATOMIC_ACQUIRE );
+
+    return __atomic_load_n( &reader->head->tail, __ATOMIC_RELAXED ) <= reader->last;
+}
+
+/**********************************************************************/
+/** Wait for a new message, returns 1 when there is one, 0 on timeout.
+ *
+ * @param reader: reader state.
+ * @param timeout_ms: max msecs to wait, -1 forever.
+ *
+ */
+int8_t eclishm_wait(ecli_shm_reader_t *reader, int32_t timeout_ms) {
+
+    ecli_shm_head_t *head = reader->head;
+    struct timespec ts;
+    uint64_t now_ms = 0;
+    uint64_t end_ms = 0;
+    uint32_t notify = 0;
+    uint32_t i      = 0;
+    int8_t   ready  = 0;
+
+    /* Busy ring: next message is a few polls away */
+    for ( i = 0; i < SHM_SPIN; i++ ) {
+        if ( reader->cursor != __atomic_load_n( &head->head, __ATOMIC_ACQUIRE ) ) {
+            return 1;
+        }
+    }
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    now_ms = ( uint64_t ) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    end_ms = now_ms + timeout_ms;
+    __atomic_add_fetch( &head->waiters, 1, __ATOMIC_SEQ_CST );
+    /* Wake ups of other readers and changed words are not a timeout */
+    for ( ;; ) {
+        notify = __atomic_load_n( &head->notify, __ATOMIC_SEQ_CST );
+        if ( ( ready = ( reader->cursor != __atomic_load_n( &head->head, __ATOMIC_SEQ_CST ) ) ) ||
+             ( timeout_ms >= 0 && now_ms >= end_ms ) ) {
+            break;
+        }
+        eclishm_futex( &head->notify, FUTEX_WAIT, notify, timeout_ms < 0 ? -1 : ( int32_t ) ( end_ms - now_ms ) );
+        clock_gettime( CLOCK_MONOTONIC, &ts );
+        now_ms = ( uint64_t ) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    }
+    __atomic_sub_fetch( &head->waiters, 1, __ATOMIC_SEQ_CST );
+
+    return ready;
+}
+
+/**********************************************************************/
+/** Free reader slot and unmap ring.
+ *
+ * @param reader: reader state.
+ *
+ */
+void eclishm_detach(ecli_shm_reader_t *reader) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    if ( reader->head == NULL ) {
+        return;
+    }
+    __atomic_store_n( &reader->slot->pid, 0, __ATOMIC_RELEASE );
+    munmap( reader->head, reader->map_size );
+    memset( reader, 0, sizeof( ecli_shm_reader_t ) );
+}
+
+/**********************************************************************/
+/**********************************************************************/
+/** Map shm object, returns NULL on error.
+ *
+ * @param fd: shm object.
+ * @param size: object bytes.
+ *
+ */
+static ecli_shm_head_t *eclishm_map(int32_t fd, uint64_t size) {
+
+    void *map = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+
+    return ( map == MAP_FAILED ) ? NULL : ( ecli_shm_head_t * ) map;
+}
+
+/**********************************************************************/
+/** Take a free reader slot (or the slot of a dead reader), returns NULL
+ * when all are used.
+ *
+ * @param head: ring head page.
+ *
+ */
+static ecli_shm_slot_t *eclishm_slot(ecli_shm_head_t *head) {
+
+    ecli_shm_slot_t *slot = NULL;
+    int32_t  pid = 0;
+    uint32_t i   = 0;
+
+    for ( i = 0; i < SHM_READERS_MAX; i++ ) {
+        slot = &head->slots[i];
+        pid = __atomic_load_n( &slot->pid, __ATOMIC_ACQUIRE );
+        if ( pid != 0 && ( kill( pid, 0 ) == 0 || errno != ESRCH ) ) {
+            continue;
+        }
+        if ( __atomic_compare_exchange_n( &slot->pid, &pid, getpid(), 0,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_RELAXED ) ) {
+            slot->msgs = slot->lost = slot->skips = 0;
+            return slot;
+        }
+    }
+
+    return NULL;
+}
+
+/**********************************************************************/
+/** futex call on the head page word (shared between processes).
+ *
+ * @param word: futex word.
+ * @param op: FUTEX_WAIT or FUTEX_WAKE.
+ * @param value: expected word (wait) or readers to wake (wake).
+ * @param timeout_ms: max msecs to wait, -1 forever.
+ *
+ */
+static int32_t eclishm_futex(uint32_t *word, int32_t op, uint32_t value, int32_t timeout_ms) {
+
+    struct timespec ts;
+
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = ( timeout_ms % 1000 ) * 1000000L;
+
+    return syscall( SYS_futex, word, op, value, timeout_ms < 0 ? NULL : &ts, NULL, 0 );
+}
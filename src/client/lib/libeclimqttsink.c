@@ -0,0 +1,815 @@
+/***********************************************************************
+* FILENAME    :   libeclimqttsink.c
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   Library code for subscriber output sinks (NDJSON,
+*                 length prefixed, per topic files) written by a thread.
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/stat.h>
+
+/**********************************************************************/
+
+#include <libeclimqttsink.h>
+#include <libeclimqttshm.h>
+#include <libeclimqtthash.h>
+
+/**********************************************************************/
+#define SINK_WRAP             0xFFFFFFFF      /* Record header: go to queue start */
+#define SINK_ALIGN( len )     ( ( ( len ) + 7 ) & ~7U )
+#define SINK_JSON_EXTRA       96              /* Field names, ts, len */
+#define SINK_DIR_MODE         0755
+#define SINK_FILE_MODE        0644
+
+/**********************************************************************/
+/* Queued message, followed by topic and payload */
+typedef struct {
+    uint32_t len;
+    uint16_t topic_len;
+    uint16_t reserved;
+    uint64_t ts_ms;
+} eclisink_rec_t;
+
+/* Open topic file */
+typedef struct {
+    uint64_t hash;                          /* Topic hash, 0 free slot */
+    char     topic[CLI_TOPIC_LEN + 1];
+    int32_t  fd;
+    uint8_t  *buffer;
+    uint32_t len;
+    uint64_t tick;                          /* Last use, LRU eviction */
+} eclisink_file_t;
+
+/**********************************************************************/
+static ecli_sink_mode  sink_mode     = CLI_SINK_NONE;
+static uint8_t         sink_datafile = FALSE_FLAG;
+static char            sink_dir[CLI_PATH_LEN];
+static uint8_t         *sink_queue   = NULL;
+static uint32_t        sink_size     = 0;
+static uint32_t        sink_head     = 0;
+static uint32_t        sink_tail     = 0;
+static uint32_t        sink_used     = 0;
+static uint8_t         sink_stop     = FALSE_FLAG;
+static uint8_t         sink_error    = FALSE_FLAG;
+static uint8_t         sink_running  = FALSE_FLAG;
+static uint8_t         *sink_out     = NULL;  /* stdout buffer */
+static uint32_t        sink_out_size = 0;
+static uint32_t        sink_out_len  = 0;
+static eclisink_file_t sink_files[SINK_FILES_MAX];
+static uint64_t        sink_tick     = 0;
+static pthread_t       sink_thread;
+static pthread_mutex_t sink_lock     = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  sink_data     = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  sink_space    = PTHREAD_COND_INITIALIZER;
+
+/**********************************************************************/
+/**********************************************************************/
+/** Writer thread: take queued messages and write them.
+ *
+ * @param arg: unused.
+ *
+ */
+static void *eclisink_writer(void *arg);
+
+/**********************************************************************/
+/** Format message for stdout sinks, returns -1 on write error.
+ *
+ * @param rec: queued message.
+ *
+ */
+static int8_t eclisink_stdout(const eclisink_rec_t *rec);
+
+/**********************************************************************/
+/** Write message to its topic file, returns -1 on write error.
+ *
+ * @param rec: queued message.
+ *
+ */
+static int8_t eclisink_file(const eclisink_rec_t *rec);
+
+/**********************************************************************/
+/** Buffered topic file for topic, opened (and directories made) when
+ * not open, evicting the least recently used.
+ *
+ * @param topic: message topic.
+ * @param topic_len: topic size.
+ *
+ */
+static eclisink_file_t *eclisink_file_get(const char *topic, uint16_t topic_len);
+
+/**********************************************************************/
+/** Write file buffer, returns -1 on write error.
+ *
+ * @param file: topic file.
+ *
+ */
+static int8_t eclisink_file_flush(eclisink_file_t *file);
+
+/**********************************************************************/
+/** Output path of topic: directory/topic, levels that are empty, "." or
+ * ".." are written as "_".
+ *
+ * @param path: output path.
+ * @param topic: message topic.
+ * @param topic_len: topic size.
+ *
+ */
+static void eclisink_path(char *path, const char *topic, uint16_t topic_len);
+
+/**********************************************************************/
+/** Make parent directories of path.
+ *
+ * @param path: file path.
+ *
+ */
+static void eclisink_mkdirs(const char *path);
+
+/**********************************************************************/
+/** Write all, resuming short writes, returns -1 on error.
+ *
+ * @param fd: output.
+ * @param buffer: data.
+ * @param len: data size.
+ *
+ */
+static int8_t eclisink_write(int32_t fd, const uint8_t *buffer, uint32_t len);
+
+/**********************************************************************/
+/** Write JSON string contents, returns bytes written.
+ *
+ * @param out: output.
+ * @param data: bytes.
+ * @param len: data size.
+ *
+ */
+static uint32_t eclisink_json(uint8_t *out, const uint8_t *data, uint32_t len);
+
+/**********************************************************************/
+/** Write base64 of data, returns bytes written.
+ *
+ * @param out: output.
+ * @param data: bytes.
+ * @param len: data size.
+ *
+ */
+static uint32_t eclisink_base64(uint8_t *out, const uint8_t *data, uint32_t len);
+
+/**********************************************************************/
+/** Write error, shown once.
+ *
+ * @param what: output path.
+ *
+ */
+static void eclisink_fail(const char *what);
+
+/**********************************************************************/
+/** Message too big for the shared memory ring, logged (lock held).
+ *
+ * @param topic: message topic.
+ *
+ */
+static void eclisink_big(const char *topic);
+
+/**********************************************************************/
+/**********************************************************************/
+/** Start writer thread for conf->output_sink, returns -1 on error.
+ *
+ * @param conf: structure that contains the user config options for broker conn.
+ *
+ */
+int8_t eclisink_open(ecli_conf_t *conf) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    sigset_t mask;
+    sigset_t old_mask;
+    int32_t  result = 0;
+    char     buffer_str[CLI_BUF_SIZE] = {0};
+
+    if ( sink_running || conf->output_sink == CLI_SINK_NONE ) {
+        return 0;
+    }
+    sink_mode = conf->output_sink;
+    /* Ring copy is as fast as a queue copy: no writer thread */
+    if ( sink_mode == CLI_SINK_SHM ) {
+        if ( eclishm_create( conf->shm_name, conf->shm_size ) < 0 ) {
+            snprintf( buffer_str, sizeof( buffer_str ), SHM_OPEN_ERROR, conf->shm_name, strerror( errno ) );
+            eclilog_show(__FILE__, __func__, buffer_str, LOG_ERROR);
+            fprintf( stderr, "%s\n", buffer_str );
+            return -1;
+        }
+        sink_running = TRUE_FLAG;
+        return 0;
+    }
+    sink_datafile = ( conf->msg_type == CLI_DATAFILE_MSG );
+    strncpy( sink_dir, conf->datafile_path, sizeof( sink_dir ) - 1 );
+    /* A max size message always fits */
+    sink_size = SINK_ALIGN( conf->sink_queue );
+    if ( sink_size < 2 * SINK_ALIGN( sizeof( eclisink_rec_t ) + CLI_TOPIC_LEN + CLI_MAX_MSG_SIZE ) ) {
+        sink_size = 2 * SINK_ALIGN( sizeof( eclisink_rec_t ) + CLI_TOPIC_LEN + CLI_MAX_MSG_SIZE );
+    }
+    sink_out_size = SINK_WRITE_BUF;
+    memset( sink_files, 0, sizeof( sink_files ) );
+    if ( ( sink_queue = malloc( sink_size ) ) == NULL ||
+         ( sink_out = malloc( sink_out_size ) ) == NULL ) {
+        free( sink_queue );
+        sink_queue = NULL;
+        eclilog_show(__FILE__, __func__, NO_MEM_ERROR, LOG_ERROR);
+        return -1;
+    }
+    sink_head = sink_tail = sink_used = 0;
+    sink_stop = sink_error = FALSE_FLAG;
+    /* Signals are handled by the socket reader, not the writer */
+    sigfillset( &mask );
+    pthread_sigmask( SIG_SETMASK, &mask, &old_mask );
+    result = pthread_create( &sink_thread, NULL, eclisink_writer, NULL );
+    pthread_sigmask( SIG_SETMASK, &old_mask, NULL );
+    if ( result != 0 ) {
+        free( sink_queue );
+        free( sink_out );
+        sink_queue = sink_out = NULL;
+        return -1;
+    }
+    sink_running = TRUE_FLAG;
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Queue message for the writer, waiting while queue is full, returns
+ * -1 when the writer failed.
+ *
+ * @param topic: message topic.
+ * @param msg: message payload.
+ * @param msg_len: message size.
+ * @param ts_ms: message epoch msecs, 0 now.
+ *
+ */
+int8_t eclisink_push(const char *topic, const uint8_t *msg, uint32_t msg_len, uint64_t ts_ms) {
+
+    eclisink_rec_t rec;
+    struct timespec ts;
+    uint32_t rec_len = 0;
+    uint32_t pos     = 0;
+
+    if ( ts_ms == 0 ) {
+        clock_gettime( CLOCK_REALTIME, &ts );
+        ts_ms = ( uint64_t ) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    }
+    rec.len = msg_len;
+    rec.topic_len = strlen( topic );
+    rec.reserved = 0;
+    rec.ts_ms = ts_ms;
+    rec_len = SINK_ALIGN( sizeof( rec ) + rec.topic_len + msg_len );
+
+    pthread_mutex_lock( &sink_lock );
+    /* One ring writer: sessions workers take turns */
+    if ( sink_mode == CLI_SINK_SHM ) {
+        if ( eclishm_write( topic, rec.topic_len, msg, msg_len, ts_ms ) < 0 ) {
+            eclisink_big( topic );
+        }
+        pthread_mutex_unlock( &sink_lock );
+        return 0;
+    }
+    for ( ;; ) {
+        if ( sink_error ) {
+            pthread_mutex_unlock( &sink_lock );
+            return -1;
+        }
+        if ( sink_used == 0 ) {
+            sink_head = sink_tail = 0;
+        }
+        /* Free bytes after head, else at queue start (end is skipped) */
+        if ( sink_head >= sink_tail || sink_used == 0 ) {
+            if ( sink_size - sink_head >= rec_len ) {
+                pos = sink_head;
+                break;
+            }
+            if ( sink_tail >= rec_len ) {
+                if ( sink_size - sink_head >= sizeof( rec ) ) {
+                    ( ( eclisink_rec_t * ) ( sink_queue + sink_head ) )->len = SINK_WRAP;
+                }
+                sink_used += sink_size - sink_head;
+                pos = 0;
+                break;
+            }
+        }
+        else if ( sink_tail - sink_head >= rec_len ) {
+            pos = sink_head;
+            break;
+        }
+        /* Full: socket reader waits for the writer */
+        pthread_cond_wait( &sink_space, &sink_lock );
+    }
+    memcpy( sink_queue + pos, &rec, sizeof( rec ) );
+    memcpy( sink_queue + pos + sizeof( rec ), topic, rec.topic_len );
+    memcpy( sink_queue + pos + sizeof( rec ) + rec.topic_len, msg, msg_len );
+    sink_head = pos + rec_len;
+    sink_used += rec_len;
+    pthread_cond_signal( &sink_data );
+    pthread_mutex_unlock( &sink_lock );
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Write queued messages, stop writer thread and close outputs.
+ *
+ */
+void eclisink_close(void) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    uint32_t i = 0;
+
+    if ( !sink_running ) {
+        return;
+    }
+    if ( sink_mode == CLI_SINK_SHM ) {
+        eclishm_close();
+        sink_running = FALSE_FLAG;
+        return;
+    }
+    pthread_mutex_lock( &sink_lock );
+    sink_stop = TRUE_FLAG;
+    pthread_cond_signal( &sink_data );
+    pthread_mutex_unlock( &sink_lock );
+    pthread_join( sink_thread, NULL );
+    sink_running = FALSE_FLAG;
+
+    for ( i = 0; i < SINK_FILES_MAX; i++ ) {
+        if ( sink_files[i].hash ) {
+            eclisink_file_flush( &sink_files[i] );
+            close( sink_files[i].fd );
+            free( sink_files[i].buffer );
+        }
+    }
+    memset( sink_files, 0, sizeof( sink_files ) );
+    free( sink_queue );
+    free( sink_out );
+    sink_queue = sink_out = NULL;
+}
+
+/**********************************************************************/
+/**********************************************************************/
+/** Writer thread: take queued messages and write them.
+ *
+ * @param arg: unused.
+ *
+ */
+static void *eclisink_writer(void *arg) {
+
+    eclisink_rec_t *rec = NULL;
+    uint32_t rec_len    = 0;
+    uint32_t i          = 0;
+    int8_t   result     = 0;
+
+    pthread_mutex_lock( &sink_lock );
+    for ( ;; ) {
+        if ( sink_used == 0 ) {
+            if ( sink_stop ) {
+                break;
+            }
+            /* Idle: buffered data goes out before waiting */
+            pthread_mutex_unlock( &sink_lock );
+            result = 0;
+            if ( sink_out_len ) {
+                result = eclisink_write( STDOUT_FILENO, sink_out, sink_out_len );
+                sink_out_len = 0;
+            }
+            for ( i = 0; i < SINK_FILES_MAX && result == 0; i++ ) {
+                if ( sink_files[i].hash ) {
+                    result = eclisink_file_flush( &sink_files[i] );
+                }
+            }
+            if ( result < 0 ) {
+                eclisink_fail( sink_mode == CLI_SINK_FILES ? sink_dir : "stdout" );
+            }
+            pthread_mutex_lock( &sink_lock );
+            if ( sink_used == 0 && !sink_stop ) {
+                pthread_cond_wait( &sink_data, &sink_lock );
+            }
+            continue;
+        }
+        /* Wrap marker or end too small for a header */
+        rec = ( eclisink_rec_t * ) ( sink_queue + sink_tail );
+        if ( sink_size - sink_tail < sizeof( eclisink_rec_t ) || rec->len == SINK_WRAP ) {
+            sink_used -= sink_size - sink_tail;
+            sink_tail = 0;
+            continue;
+        }
+        rec_len = SINK_ALIGN( sizeof( eclisink_rec_t ) + rec->topic_len + rec->len );
+        pthread_mutex_unlock( &sink_lock );
+
+        if ( !sink_error ) {
+            result = ( sink_mode == CLI_SINK_FILES ) ? eclisink_file( rec ) : eclisink_stdout( rec );
+            if ( result < 0 ) {
+                eclisink_fail( sink_mode == CLI_SINK_FILES ? sink_dir : "stdout" );
+            }
+        }
+
+        pthread_mutex_lock( &sink_lock );
+        sink_tail += rec_len;
+        sink_used -= rec_len;
+        pthread_cond_signal( &sink_space );
+    }
+    pthread_mutex_unlock( &sink_lock );
+
+    return NULL;
+}
+
+/**********************************************************************/
+/** Format message for stdout sinks, returns -1 on write error.
+ *
+ * @param rec: queued message.
+ *
+ */
+static int8_t eclisink_stdout(const eclisink_rec_t *rec) {
+
+    const uint8_t *topic = ( const uint8_t * ) ( rec + 1 );
+    const uint8_t *msg   = topic + rec->topic_len;
+    uint8_t  *out  = NULL;
+    uint32_t need  = 0;
+
+    if ( sink_mode == CLI_SINK_NDJSON ) {
+        need = SINK_JSON_EXTRA + rec->topic_len * 6 + ( sink_datafile ? rec->len / 3 * 4 + 4 : rec->len * 6 );
+    }
+    else {
+        need = 2 + rec->topic_len + 4 + rec->len;
+    }
+    if ( sink_out_len + need > sink_out_size ) {
+        if ( sink_out_len && eclisink_write( STDOUT_FILENO, sink_out, sink_out_len ) < 0 ) {
+            sink_out_len = 0;
+            return -1;
+        }
+        sink_out_len = 0;
+        /* Bigger than buffer: buffer grows for it */
+        if ( need > sink_out_size ) {
+            if ( ( out = realloc( sink_out, need ) ) == NULL ) {
+                return -1;
+            }
+            sink_out = out;
+            sink_out_size = need;
+        }
+    }
+    out = sink_out + sink_out_len;
+
+    if ( sink_mode == CLI_SINK_NDJSON ) {
+        out += sprintf( ( char * ) out, "{\"topic\":\"" );
+        out += eclisink_json( out, topic, rec->topic_len );
+        out += sprintf( ( char * ) out, "\",\"ts\":%llu,\"len\":%u,\"%s\":\"",
+                        ( unsigned long long ) rec->ts_ms, rec->len,
+                        sink_datafile ? "payload_b64" : "payload" );
+        out += sink_datafile ? eclisink_base64( out, msg, rec->len ) : eclisink_json( out, msg, rec->len );
+        *out++ = '"';
+        *out++ = '}';
+        *out++ = '\n';
+    }
+    else {
+        /* Same records as ecli_mqtt_pub -s len+topic reads */
+        *out++ = CLI_RSHIFT_BYTE( rec->topic_len );
+        *out++ = rec->topic_len & CLI_BYTE;
+        memcpy( out, topic, rec->topic_len );
+        out += rec->topic_len;
+        *out++ = ( rec->len >> 24 ) & CLI_BYTE;
+        *out++ = ( rec->len >> 16 ) & CLI_BYTE;
+        *out++ = ( rec->len >> 8 ) & CLI_BYTE;
+        *out++ = rec->len & CLI_BYTE;
+        memcpy( out, msg, rec->len );
+        out += rec->len;
+    }
+    sink_out_len = out - sink_out;
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Write message to its topic file, returns -1 on write error.
+ *
+ * @param rec: queued message.
+ *
+ */
+static int8_t eclisink_file(const eclisink_rec_t *rec) {
+
+    const char    *topic = ( const char * ) ( rec + 1 );
+    const uint8_t *msg   = ( const uint8_t * ) topic + rec->topic_len;
+    char     path[CLI_PATH_LEN + CLI_TOPIC_LEN + sizeof( SINK_TMP_SUFFIX )];
+    char     tmp_path[sizeof( path ) + sizeof( SINK_TMP_SUFFIX )];
+    int32_t  fd   = -1;
+    int8_t   result = 0;
+    eclisink_file_t *file = NULL;
+
+    /* File messages: whole file replaced, readers never see a partial one */
+    if ( sink_datafile ) {
+        eclisink_path( path, topic, rec->topic_len );
+        snprintf( tmp_path, sizeof( tmp_path ), "%s%s", path, SINK_TMP_SUFFIX );
+        if ( ( fd = open( tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, SINK_FILE_MODE ) ) < 0 &&
+             errno == ENOENT ) {
+            eclisink_mkdirs( tmp_path );
+            fd = open( tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, SINK_FILE_MODE );
+        }
+        if ( fd < 0 ) {
+            return -1;
+        }
+        result = eclisink_write( fd, msg, rec->len );
+        close( fd );
+        if ( result < 0 || rename( tmp_path, path ) < 0 ) {
+            unlink( tmp_path );
+            return -1;
+        }
+        return 0;
+    }
+
+    /* Text messages: one line each, appended */
+    if ( ( file = eclisink_file_get( topic, rec->topic_len ) ) == NULL ) {
+        return -1;
+    }
+    if ( file->len + rec->len + 1 > SINK_FILE_BUF ) {
+        if ( eclisink_file_flush( file ) < 0 ) {
+            return -1;
+        }
+        if ( rec->len + 1 > SINK_FILE_BUF ) {
+            if ( eclisink_write( file->fd, msg, rec->len ) < 0 ||
+                 eclisink_write( file->fd, ( const uint8_t * ) "\n", 1 ) < 0 ) {
+                return -1;
+            }
+            return 0;
+        }
+    }
+    memcpy( file->buffer + file->len, msg, rec->len );
+    file->len += rec->len;
+    file->buffer[ file->len++ ] = '\n';
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Buffered topic file for topic, opened (and directories made) when
+ * not open, evicting the least recently used.
+ *
+ * @param topic: message topic.
+ * @param topic_len: topic size.
+ *
+ */
+static eclisink_file_t *eclisink_file_get(const char *topic, uint16_t topic_len) {
+
+    char     path[CLI_PATH_LEN + CLI_TOPIC_LEN];
+    uint64_t hash = eclihash_xxh3( topic, topic_len ) | 1;  /* 0 is a free slot */
+    uint32_t i    = 0;
+    eclisink_file_t *file = &sink_files[0];
+
+    sink_tick++;
+    for ( i = 0; i < SINK_FILES_MAX; i++ ) {
+        if ( sink_files[i].hash == hash && strlen( sink_files[i].topic ) == topic_len &&
+             memcmp( sink_files[i].topic, topic, topic_len ) == 0 ) {
+            sink_files[i].tick = sink_tick;
+            return &sink_files[i];
+        }
+        if ( sink_files[i].hash == 0 || ( file->hash && sink_files[i].tick < file->tick ) ) {
+            file = &sink_files[i];
+        }
+    }
+    if ( file->hash ) {
+        eclisink_file_flush( file );
+        close( file->fd );
+        file->hash = 0;
+    }
+    if ( file->buffer == NULL && ( file->buffer = malloc( SINK_FILE_BUF ) ) == NULL ) {
+        return NULL;
+    }
+    eclisink_path( path, topic, topic_len );
+    if ( ( file->fd = open( path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, SINK_FILE_MODE ) ) < 0 &&
+         errno == ENOENT ) {
+        eclisink_mkdirs( path );
+        file->fd = open( path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, SINK_FILE_MODE );
+    }
+    if ( file->fd < 0 ) {
+        return NULL;
+    }
+    memcpy( file->topic, topic, topic_len );
+    file->topic[topic_len] = '\0';
+    file->hash = hash;
+    file->len = 0;
+    file->tick = sink_tick;
+
+    return file;
+}
+
+/**********************************************************************/
+/** Write file buffer, returns -1 on write error.
+ *
+ * @param file: topic file.
+ *
+ */
+static int8_t eclisink_file_flush(eclisink_file_t *file) {
+
+    int8_t result = 0;
+
+    if ( file->len ) {
+        result = eclisink_write( file->fd, file->buffer, file->len );
+        file->len = 0;
+    }
+
+    return result;
+}
+
+/**********************************************************************/
+/** Output path of topic: directory/topic, levels that are empty, "." or
+ * ".." are written as "_".
+ *
+ * @param path: output path.
+ * @param topic: message topic.
+ * @param topic_len: topic size.
+ *
+ */
+static void eclisink_path(char *path, const char *topic, uint16_t topic_len) {
+
+    uint32_t pos   = 0;
+    uint16_t start = 0;
+    uint16_t end   = 0;
+    uint16_t len   = 0;
+
+    pos = sprintf( path, "%s", sink_dir );
+    while ( start <= topic_len ) {
+        for ( end = start; end < topic_len && topic[end] != '/'; end++ );
+        len = end - start;
+        path[pos++] = '/';
+        if ( len == 0 || ( len == 1 && topic[start] == '.' ) ||
+             ( len == 2 && topic[start] == '.' && topic[start + 1] == '.' ) ) {
+            path[pos++] = '_';
+        }
+        else {
+            memcpy( path + pos, topic + start, len );
+            pos += len;
+        }
+        start = end + 1;
+    }
+    path[pos] = '\0';
+}
+
+/**********************************************************************/
+/** Make parent directories of path.
+ *
+ * @param path: file path.
+ *
+ */
+static void eclisink_mkdirs(const char *path) {
+
+    char     dir[CLI_PATH_LEN + CLI_TOPIC_LEN + sizeof( SINK_TMP_SUFFIX )];
+    uint32_t i = 0;
+
+    strncpy( dir, path, sizeof( dir ) - 1 );
+    dir[ sizeof( dir ) - 1 ] = '\0';
+    for ( i = 1; dir[i]; i++ ) {
+        if ( dir[i] == '/' ) {
+            dir[i] = '\0';
+            mkdir( dir, SINK_DIR_MODE );
+            dir[i] = '/';
+        }
+    }
+}
+
+/**********************************************************************/
+/** Write all, resuming short writes, returns -1 on error.
+ *
+ * @param fd: output.
+ * @param buffer: data.
+ * @param len: data size.
+ *
+ */
+static int8_t eclisink_write(int32_t fd, const uint8_t *buffer, uint32_t len) {
+
+    ssize_t bytes = 0;
+
+    while ( len > 0 ) {
+        if ( ( bytes = write( fd, buffer, len ) ) < 0 ) {
+            if ( errno == EINTR ) {
+                continue;
+            }
+            return -1;
+        }
+        buffer += bytes;
+        len -= bytes;
+    }
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Write JSON string contents, returns bytes written.
+ *
+ * @param out: output.
+ * @param data: bytes.
+ * @param len: data size.
+ *
+ */
+static uint32_t eclisink_json(uint8_t *out, const uint8_t *data, uint32_t len) {
+
+    static const char hex[] = "0123456789abcdef";
+    uint8_t  *start = out;
+    uint32_t i      = 0;
+
+    for ( i = 0; i < len; i++ ) {
+        if ( data[i] == '"' || data[i] == '\\' ) {
+            *out++ = '\\';
+            *out++ = data[i];
+        }
+        else if ( data[i] == '\n' ) {
+            *out++ = '\\';
+            *out++ = 'n';
+        }
+        else if ( data[i] < 0x20 ) {
+            *out++ = '\\';
+            *out++ = 'u';
+            *out++ = '0';
+            *out++ = '0';
+            *out++ = hex[ data[i] >> 4 ];
+            *out++ = hex[ data[i] & 0x0F ];
+        }
+        else {
+            *out++ = data[i];
+        }
+    }
+
+    return out - start;
+}
+
+/**********************************************************************/
+/** Write base64 of data, returns bytes written.
+ *
+ * @param out: output.
+ * @param data: bytes.
+ * @param len: data size.
+ *
+ */
+static uint32_t eclisink_base64(uint8_t *out, const uint8_t *data, uint32_t len) {
+
+    static const char b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    uint8_t  *start = out;
+    uint32_t value  = 0;
+    uint32_t i      = 0;
+
+    for ( i = 0; i + 2 < len; i += 3 ) {
+        value = ( data[i] << 16 ) | ( data[i + 1] << 8 ) | data[i + 2];
+        *out++ = b64[ ( value >> 18 ) & 0x3F ];
+        *out++ = b64[ ( value >> 12 ) & 0x3F ];
+        *out++ = b64[ ( value >> 6 ) & 0x3F ];
+        *out++ = b64[ value & 0x3F ];
+    }
+    if ( i < len ) {
+        value = data[i] << 16;
+        if ( i + 1 < len ) {
+            value |= data[i + 1] << 8;
+        }
+        *out++ = b64[ ( value >> 18 ) & 0x3F ];
+        *out++ = b64[ ( value >> 12 ) & 0x3F ];
+        *out++ = ( i + 1 < len ) ? b64[ ( value >> 6 ) & 0x3F ] : '=';
+        *out++ = '=';
+    }
+
+    return out - start;
+}
+
+/**********************************************************************/
+/** Write error, shown once.
+ *
+ * @param what: output path.
+ *
+ */
+static void eclisink_fail(const char *what) {
+
+    char buffer_str[CLI_BUF_SIZE] = {0};
+
+    pthread_mutex_lock( &sink_lock );
+    if ( !sink_error ) {
+        snprintf( buffer_str, sizeof( buffer_str ), SINK_WRITE_ERROR, what, strerror( errno ) );
+        eclilog_show(__FILE__, __func__, buffer_str, LOG_ERROR);
+        fprintf( stderr, "%s\n", buffer_str );
+    }
+    sink_error = TRUE_FLAG;
+    pthread_cond_signal( &sink_space );
+    pthread_mutex_unlock( &sink_lock );
+}
+
+/**********************************************************************/
+/** Message too big for the shared memory ring, logged (lock held).
+ *
+ * @param topic: message topic.
+ *
+ */
+static void eclisink_big(const char *topic) {
+
+    char buffer_str[CLI_BUF_SIZE] = {0};
+
+    snprintf( buffer_str, sizeof( buffer_str ), SHM_BIG_ERROR, topic );
+    eclilog_show(__FILE__, __func__, buffer_str, LOG_ERROR);
+}
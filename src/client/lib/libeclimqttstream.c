@@ -0,0 +1,616 @@
+/***********************************************************************
+* FILENAME    :   libeclimqttstream.c
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   Library code for streaming publish of records read
+*                 from stdin / pipe over one connection.
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <time.h>
+
+/**********************************************************************/
+
+#include <libeclimqttstream.h>
+#include <libeclimqttseries.h>
+
+/**********************************************************************/
+/* Biggest record: topic, lengths and a max size message */
+#define STREAM_RECORD_MAX     ( CLI_MAX_MSG_SIZE + CLI_TOPIC_LEN + STREAM_TOPIC_BYTES + STREAM_LEN_BYTES )
+#define STREAM_HEADER_MAX     ( 5 + STREAM_TOPIC_BYTES )  /* Fixed header, topic len */
+
+/**********************************************************************/
+/* Input not parsed yet */
+typedef struct {
+    uint8_t  *data;
+    uint32_t size;
+    uint32_t start;                         /* First byte of next record */
+    uint32_t end;                           /* Bytes read */
+    uint8_t  eof;
+} eclistream_in_t;
+
+/* Record found in input */
+typedef struct {
+    const uint8_t *topic;                   /* NULL: default topic */
+    uint32_t      topic_len;
+    const uint8_t *payload;
+    uint32_t      payload_len;
+} eclistream_record_t;
+
+/* QoS 0 packets waiting for one send */
+typedef struct {
+    uint8_t  buffer[STREAM_BATCH_SIZE];
+    uint32_t len;
+    uint32_t count;
+    ecli_sendq_lane lane;                   /* Send queue lane of batched packets */
+} eclistream_batch_t;
+
+/* Samples aggregated in blocks */
+typedef struct {
+    ecli_series_block_t block;              /* Block to publish */
+    uint64_t samples;
+    uint64_t sample_bytes;
+    uint64_t blocks;
+    uint64_t block_bytes;
+} eclistream_series_t;
+
+/**********************************************************************/
+/**********************************************************************/
+/** Next complete record in input, returns 1 when found, 0 when more
+ * input is needed or -1 when input is not valid.
+ *
+ * @param in: input buffer.
+ * @param mode: record format.
+ * @param record: record output.
+ *
+ */
+static int8_t eclistream_next(eclistream_in_t *in, ecli_stream_mode mode, eclistream_record_t *record);
+
+/**********************************************************************/
+/** Read more input, waiting with keep alive pings, returns -1 on error.
+ *
+ * @param broker: structure that contains the client connection info with broker
+ * @param conf: structure that contains the user config options for broker conn.
+ * @param in: input buffer.
+ * @param fd: input.
+ *
+ */
+static int8_t eclistream_read(ecli_broker_t *broker, ecli_conf_t *conf, eclistream_in_t *in, int32_t fd);
+
+/**********************************************************************/
+/** Add record to the block of its topic, publish closed block and
+ * records that are not samples.
+ *
+ * @param broker: structure that contains the client connection info with broker
+ * @param conf: structure that contains the user config options for broker conn.
+ * @param batch: QoS 0 batch.
+ * @param series: aggregation state.
+ * @param record: record to publish.
+ *
+ */
+static uint8_t eclistream_sample(ecli_broker_t *broker, ecli_conf_t *conf, eclistream_batch_t *batch,
+                                 eclistream_series_t *series, const eclistream_record_t *record);
+
+/**********************************************************************/
+/** Publish closed blocks: ended windows, every open block with all.
+ *
+ * @param broker: structure that contains the client connection info with broker
+ * @param conf: structure that contains the user config options for broker conn.
+ * @param batch: QoS 0 batch.
+ * @param series: aggregation state.
+ * @param all: close blocks before their window end.
+ *
+ */
+static uint8_t eclistream_expire(ecli_broker_t *broker, ecli_conf_t *conf, eclistream_batch_t *batch,
+                                 eclistream_series_t *series, uint8_t all);
+
+/**********************************************************************/
+/** Publish closed block as a record of its topic.
+ *
+ * @param broker: structure that contains the client connection info with broker
+ * @param conf: structure that contains the user config options for broker conn.
+ * @param batch: QoS 0 batch.
+ * @param series: aggregation state, block closed.
+ *
+ */
+static uint8_t eclistream_block(ecli_broker_t *broker, ecli_conf_t *conf, eclistream_batch_t *batch,
+                                eclistream_series_t *series);
+
+/**********************************************************************/
+/** Publish record, in batch when it can.
+ *
+ * @param broker: structure that contains the client connection info with broker
+ * @param conf: structure that contains the user config options for broker conn.
+ * @param batch: QoS 0 batch.
+ * @param record: record to publish.
+ *
+ */
+static uint8_t eclistream_record(ecli_broker_t *broker, ecli_conf_t *conf,
+                                 eclistream_batch_t *batch, const eclistream_record_t *record);
+
+/**********************************************************************/
+/** Send batch.
+ *
+ * @param broker: structure that contains the client connection info with broker
+ * @param batch: QoS 0 batch.
+ *
+ */
+static uint8_t eclistream_flush(ecli_broker_t *broker, eclistream_batch_t *batch);
+
+/**********************************************************************/
+/**********************************************************************/
+/** Publish every record read from fd until end of input.
+ *
+ * @param broker: structure that contains the client connection info with broker
+ * @param conf: structure that contains the user config options for broker conn.
+ * @param fd: input (stdin).
+ *
+ */
+uint8_t eclistream_publish(ecli_broker_t *broker, ecli_conf_t *conf, int32_t fd) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    char     buffer_str[CLI_BUF_SIZE] = {0};
+    int8_t   found        = 0;
+    uint8_t  return_code  = CLI_NO_ERROR;
+    uint64_t messages     = 0;
+    uint64_t bytes        = 0;
+    uint64_t start_ns     = eclimetrics_now();
+    double   secs         = 0;
+    struct pollfd input;
+    eclistream_in_t in;
+    eclistream_record_t record;
+    eclistream_batch_t *batch = malloc( sizeof( eclistream_batch_t ) );
+    eclistream_series_t *series = NULL;
+
+    memset( &in, 0, sizeof( in ) );
+    in.size = STREAM_READ_SIZE;
+    if ( conf->series ) {
+        series = calloc( 1, sizeof( eclistream_series_t ) );
+        ecliseries_init( conf->series, conf->series_ms );
+    }
+    if ( batch == NULL || ( conf->series && series == NULL ) || ( in.data = malloc( in.size ) ) == NULL ) {
+        free( batch );
+        free( series );
+        eclilog_show(__FILE__, __func__, NO_MEM_ERROR, LOG_ERROR);
+        return CLI_ERROR;
+    }
+    batch->len = 0;
+    batch->count = 0;
+    input.fd = fd;
+    input.events = POLLIN;
+
+    while ( return_code == CLI_NO_ERROR ) {
+        while ( ( found = eclistream_next( &in, conf->stream_mode, &record ) ) > 0 ) {
+            return_code = series ? eclistream_sample( broker, conf, batch, series, &record ) :
+                                   eclistream_record( broker, conf, batch, &record );
+            if ( return_code != CLI_NO_ERROR ) {
+                break;
+            }
+            messages++;
+            bytes += record.payload_len;
+        }
+        if ( return_code != CLI_NO_ERROR ) {
+            break;
+        }
+        if ( found < 0 ) {
+            eclilog_show(__FILE__, __func__, STREAM_RECORD_ERROR, LOG_ERROR);
+            return_code = CLI_PUBLISH_SIZE_ERROR;
+            break;
+        }
+        if ( in.eof ) {
+            break;
+        }
+        if ( series && ( return_code = eclistream_expire( broker, conf, batch, series, FALSE_FLAG ) ) != CLI_NO_ERROR ) {
+            break;
+        }
+        /* Batch (and packets queued on io_uring) go before a read that
+           would wait for input */
+        if ( poll( &input, 1, 0 ) == 0 ) {
+            if ( batch->len ) {
+                return_code = eclistream_flush( broker, batch );
+            }
+            eclituring_flush();
+        }
+        if ( return_code == CLI_NO_ERROR && eclistream_read( broker, conf, &in, fd ) < 0 ) {
+            return_code = CLI_FILE_ERROR;
+        }
+    }
+    if ( return_code == CLI_NO_ERROR && in.start < in.end ) {
+        /* Partial length prefixed record at end of input */
+        eclilog_show(__FILE__, __func__, STREAM_RECORD_ERROR, LOG_ERROR);
+    }
+    /* Open blocks go at end of input */
+    if ( series && return_code == CLI_NO_ERROR ) {
+        return_code = eclistream_expire( broker, conf, batch, series, TRUE_FLAG );
+    }
+    if ( batch->len && eclistream_flush( broker, batch ) != CLI_NO_ERROR &&
+         return_code == CLI_NO_ERROR ) {
+        return_code = CLI_PUBLISH_ERROR;
+    }
+
+    secs = ( eclimetrics_now() - start_ns ) / 1e9;
+    sprintf(buffer_str, STREAM_MSG, ( unsigned long long ) messages, ( unsigned long long ) bytes,
+            secs, secs > 0 ? messages / secs : 0);
+    eclilog_show(__FILE__, __func__, buffer_str, LOG_INFO);
+    if ( series ) {
+        sprintf(buffer_str, SERIES_MSG, ( unsigned long long ) series->samples,
+                ( unsigned long long ) series->blocks, ( unsigned long long ) series->block_bytes,
+                ( unsigned long long ) series->sample_bytes);
+        eclilog_show(__FILE__, __func__, buffer_str, LOG_INFO);
+    }
+    free( in.data );
+    free( batch );
+    free( series );
+
+    return return_code;
+}
+
+/**********************************************************************/
+/**********************************************************************/
+/** Next complete record in input, returns 1 when found, 0 when more
+ * input is needed or -1 when input is not valid.
+ *
+ * @param in: input buffer.
+ * @param mode: record format.
+ * @param record: record output.
+ *
+ */
+static int8_t eclistream_next(eclistream_in_t *in, ecli_stream_mode mode, eclistream_record_t *record) {
+
+    uint8_t  *start = in->data + in->start;
+    uint8_t  *end   = NULL;
+    uint8_t  *sep   = NULL;
+    uint32_t avail  = in->end - in->start;
+    uint32_t pos    = 0;
+    uint32_t len    = 0;
+
+    if ( avail == 0 ) {
+        return 0;
+    }
+    memset( record, 0, sizeof( *record ) );
+    if ( mode == CLI_STREAM_LINE || mode == CLI_STREAM_LINE_TOPIC ) {
+        /* Last line may have no \n */
+        if ( ( end = memchr( start, '\n', avail ) ) == NULL ) {
+            if ( !in->eof ) {
+                return 0;
+            }
+            end = start + avail;
+            in->start = in->end;
+        }
+        else {
+            in->start += end - start + 1;
+        }
+        if ( end > start && *( end - 1 ) == '\r' ) {
+            end--;
+        }
+        if ( mode == CLI_STREAM_LINE_TOPIC && ( sep = memchr( start, STREAM_TOPIC_SEP, end - start ) ) != NULL ) {
+            record->topic = start;
+            record->topic_len = sep - start;
+            start = sep + 1;
+        }
+        record->payload = start;
+        record->payload_len = end - start;
+        return 1;
+    }
+
+    if ( mode == CLI_STREAM_LEN_TOPIC ) {
+        if ( avail < STREAM_TOPIC_BYTES ) {
+            return 0;
+        }
+        record->topic_len = CLI_LSHIFT_BYTE( start[0] ) | start[1];
+        record->topic = start + STREAM_TOPIC_BYTES;
+        pos = STREAM_TOPIC_BYTES + record->topic_len;
+    }
+    if ( avail < pos + STREAM_LEN_BYTES ) {
+        return 0;
+    }
+    len = ( ( uint32_t ) start[pos] << 24 ) | ( ( uint32_t ) start[pos + 1] << 16 ) |
+          ( ( uint32_t ) start[pos + 2] << 8 ) | start[pos + 3];
+    if ( len > CLI_MAX_MSG_SIZE ) {
+        return -1;
+    }
+    pos += STREAM_LEN_BYTES;
+    if ( avail < pos + len ) {
+        return 0;
+    }
+    record->payload = start + pos;
+    record->payload_len = len;
+    in->start += pos + len;
+
+    return 1;
+}
+
+/**********************************************************************/
+/** Read more input, waiting with keep alive pings, returns -1 on error.
+ *
+ * @param broker: structure that contains the client connection info with broker
+ * @param conf: structure that contains the user config options for broker conn.
+ * @param in: input buffer.
+ * @param fd: input.
+ *
+ */
+static int8_t eclistream_read(ecli_broker_t *broker, ecli_conf_t *conf, eclistream_in_t *in, int32_t fd) {
+
+    uint8_t  *data = NULL;
+    int32_t  bytes = 0;
+    int32_t  ready = 0;
+    int32_t  wait  = 0;
+    int64_t  due   = 0;
+    struct pollfd input;
+
+    /* Record being read goes to buffer start, buffer grows for big ones */
+    if ( in->start > 0 ) {
+        memmove( in->data, in->data + in->start, in->end - in->start );
+        in->end -= in->start;
+        in->start = 0;
+    }
+    if ( in->end == in->size ) {
+        if ( in->size >= STREAM_RECORD_MAX ||
+             ( data = realloc( in->data, in->size * 2 > STREAM_RECORD_MAX ? STREAM_RECORD_MAX : in->size * 2 ) ) == NULL ) {
+            return -1;
+        }
+        in->data = data;
+        in->size = in->size * 2 > STREAM_RECORD_MAX ? STREAM_RECORD_MAX : in->size * 2;
+    }
+
+    /* Idle input: PINGREQ every half keep alive, back when a block window ends */
+    input.fd = fd;
+    input.events = POLLIN;
+    for ( ;; ) {
+        wait = broker->alive ? broker->alive * 500 : -1;
+        due = conf->series ? ecliseries_due() : -1;
+        if ( due >= 0 && ( wait < 0 || due < wait ) ) {
+            wait = due;
+        }
+        if ( ( ready = poll( &input, 1, wait ) ) > 0 ) {
+            break;
+        }
+        if ( ready < 0 && errno != EINTR ) {
+            return -1;
+        }
+        if ( ready == 0 && wait == due ) {
+            return 0;
+        }
+        if ( ready == 0 && eclimqtt_pingreq( broker ) == CLI_NO_ERROR ) {
+            ecli_read_header( broker, conf );
+        }
+    }
+    while ( ( bytes = read( fd, in->data + in->end, in->size - in->end ) ) < 0 ) {
+        if ( errno != EINTR ) {
+            return -1;
+        }
+    }
+    if ( bytes == 0 ) {
+        in->eof = TRUE_FLAG;
+    }
+    in->end += bytes;
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Add record to the block of its topic, publish closed block and
+ * records that are not samples.
+ *
+ * @param broker: structure that contains the client connection info with broker
+ * @param conf: structure that contains the user config options for broker conn.
+ * @param batch: QoS 0 batch.
+ * @param series: aggregation state.
+ * @param record: record to publish.
+ *
+ */
+static uint8_t eclistream_sample(ecli_broker_t *broker, ecli_conf_t *conf, eclistream_batch_t *batch,
+                                 eclistream_series_t *series, const eclistream_record_t *record) {
+
+    const uint8_t *topic = ( const uint8_t * ) broker->topic;
+    uint32_t topic_len   = strlen( broker->topic );
+    uint8_t  return_code = CLI_NO_ERROR;
+    int8_t   taken       = 0;
+    struct timespec ts;
+
+    if ( record->topic ) {
+        topic = record->topic;
+        topic_len = record->topic_len;
+    }
+    /* Not aggregated, eclistream_record skips it */
+    if ( topic_len == 0 || topic_len >= CLI_TOPIC_LEN || ecliutf8_topic( ( const char * ) topic, topic_len ) < 0 ) {
+        return eclistream_record( broker, conf, batch, record );
+    }
+    clock_gettime( CLOCK_REALTIME, &ts );
+    taken = ecliseries_add( topic, topic_len, record->payload, record->payload_len,
+                            ( uint64_t ) ts.tv_sec * 1000 + ts.tv_nsec / 1000000, &series->block );
+    /* Closed block goes before the record that closed it */
+    if ( series->block.len && ( return_code = eclistream_block( broker, conf, batch, series ) ) != CLI_NO_ERROR ) {
+        return return_code;
+    }
+    if ( taken ) {
+        series->samples++;
+        series->sample_bytes += record->payload_len;
+        return CLI_NO_ERROR;
+    }
+
+    return eclistream_record( broker, conf, batch, record );
+}
+
+/**********************************************************************/
+/** Publish closed blocks: ended windows, every open block with all.
+ *
+ * @param broker: structure that contains the client connection info with broker
+ * @param conf: structure that contains the user config options for broker conn.
+ * @param batch: QoS 0 batch.
+ * @param series: aggregation state.
+ * @param all: close blocks before their window end.
+ *
+ */
+static uint8_t eclistream_expire(ecli_broker_t *broker, ecli_conf_t *conf, eclistream_batch_t *batch,
+                                 eclistream_series_t *series, uint8_t all) {
+
+    uint8_t return_code = CLI_NO_ERROR;
+
+    while ( ecliseries_expire( all, &series->block ) > 0 ) {
+        if ( ( return_code = eclistream_block( broker, conf, batch, series ) ) != CLI_NO_ERROR ) {
+            break;
+        }
+    }
+
+    return return_code;
+}
+
+/**********************************************************************/
+/** Publish closed block as a record of its topic.
+ *
+ * @param broker: structure that contains the client connection info with broker
+ * @param conf: structure that contains the user config options for broker conn.
+ * @param batch: QoS 0 batch.
+ * @param series: aggregation state, block closed.
+ *
+ */
+static uint8_t eclistream_block(ecli_broker_t *broker, ecli_conf_t *conf, eclistream_batch_t *batch,
+                                eclistream_series_t *series) {
+
+    eclistream_record_t block;
+
+    block.topic = ( const uint8_t * ) series->block.topic;
+    block.topic_len = series->block.topic_len;
+    block.payload = series->block.data;
+    block.payload_len = series->block.len;
+    series->blocks++;
+    series->block_bytes += series->block.len;
+
+    return eclistream_record( broker, conf, batch, &block );
+}
+
+/**********************************************************************/
+/** Publish record, in batch when it can.
+ *
+ * @param broker: structure that contains the client connection info with broker
+ * @param conf: structure that contains the user config options for broker conn.
+ * @param batch: QoS 0 batch.
+ * @param record: record to publish.
+ *
+ */
+static uint8_t eclistream_record(ecli_broker_t *broker, ecli_conf_t *conf,
+                                 eclistream_batch_t *batch, const eclistream_record_t *record) {
+
+    char     broker_topic[CLI_TOPIC_LEN];
+    const uint8_t *topic = ( const uint8_t * ) broker->topic;
+    uint8_t  *packet     = NULL;
+    uint8_t  return_code = CLI_NO_ERROR;
+    uint8_t  remain_value = 0;
+    uint8_t  trailer[HASH_TRAILER_MAX];
+    uint8_t  trailer_len = 0;
+    uint32_t topic_len   = strlen( broker->topic );
+    uint32_t remain_len  = 0;
+    ecli_sendq_lane lane = SENDQ_LANE_TELEMETRY;
+
+    if ( record->topic ) {
+        if ( record->topic_len == 0 || record->topic_len >= CLI_TOPIC_LEN ) {
+            eclilog_show(__FILE__, __func__, STREAM_RECORD_ERROR, LOG_ERROR);
+            return CLI_NO_ERROR;
+        }
+        topic = record->topic;
+        topic_len = record->topic_len;
+    }
+    if ( ecliutf8_topic( ( const char * ) topic, topic_len ) < 0 ||
+         ( conf->utf8_payload && ecliutf8_text( record->payload, record->payload_len ) < 0 ) ) {
+        eclilog_show(__FILE__, __func__, STREAM_RECORD_ERROR, LOG_ERROR);
+        return CLI_NO_ERROR;
+    }
+
+    /* QoS 1/2, compressed or big: one publish with its acks */
+    if ( broker->qos || conf->codec_conf.codec != CODEC_NONE ||
+         STREAM_HEADER_MAX + topic_len + record->payload_len + HASH_TRAILER_MAX > STREAM_BATCH_SIZE ) {
+        if ( batch->len && ( return_code = eclistream_flush( broker, batch ) ) != CLI_NO_ERROR ) {
+            return return_code;
+        }
+        memcpy( broker_topic, broker->topic, sizeof( broker_topic ) );
+        memcpy( broker->topic, topic, topic_len );
+        broker->topic[topic_len] = '\0';
+        return_code = eclimqtt_publish_chunk( broker, conf, record->payload, record->payload_len );
+        memcpy( broker->topic, broker_topic, sizeof( broker_topic ) );
+        return return_code;
+    }
+
+    /* A batch goes to the send queue as one packet of one lane */
+    lane = eclisendq_lane( topic, topic_len );
+    if ( batch->len &&
+         ( batch->len + STREAM_HEADER_MAX + topic_len + record->payload_len + HASH_TRAILER_MAX > STREAM_BATCH_SIZE ||
+           lane != batch->lane ) &&
+         ( return_code = eclistream_flush( broker, batch ) ) != CLI_NO_ERROR ) {
+        return return_code;
+    }
+    batch->lane = lane;
+    trailer_len = eclihash_put( conf->checksum, record->payload, record->payload_len, trailer );
+    /* Same packet as eclimqtt_publish_chunk QoS 0 */
+    packet = batch->buffer + batch->len;
+    *packet = MQTT_CTRLPKT_PUBLISH | MQTT_PUBLISH_QOS0_FLAG;
+    if ( broker->retain ) {
+        *packet |= MQTT_PUBLISH_RETAIN_FLAG;
+    }
+    packet++;
+    remain_len = STREAM_TOPIC_BYTES + topic_len + record->payload_len + trailer_len;
+    do {
+        remain_value = remain_len % MQTT_REMAIN_LEN;
+        remain_len = remain_len / MQTT_REMAIN_LEN;
+        if ( remain_len > 0 ) {
+            remain_value |= MQTT_REMAIN_LEN;
+        }
+        *packet++ = remain_value;
+    }
+    while ( remain_len > 0 );
+    *packet++ = CLI_RSHIFT_BYTE( topic_len );
+    *packet++ = topic_len & CLI_BYTE;
+    memcpy( packet, topic, topic_len );
+    packet += topic_len;
+    memcpy( packet, record->payload, record->payload_len );
+    packet += record->payload_len;
+    memcpy( packet, trailer, trailer_len );
+    packet += trailer_len;
+    batch->len = packet - batch->buffer;
+    batch->count++;
+
+    return CLI_NO_ERROR;
+}
+
+/**********************************************************************/
+/** Send batch.
+ *
+ * @param broker: structure that contains the client connection info with broker
+ * @param batch: QoS 0 batch.
+ *
+ */
+static uint8_t eclistream_flush(ecli_broker_t *broker, eclistream_batch_t *batch) {
+
+    char     buffer_str[CLI_BUF_SIZE] = {0};
+    uint32_t i = 0;
+    struct iovec packet_iov[] = {
+        { .iov_base = batch->buffer, .iov_len = batch->len },
+    };
+
+    /* -1 on error too */
+    if ( ecli_sendv_packet( broker, packet_iov, 1 ) != batch->len ) {
+        batch->len = 0;
+        batch->count = 0;
+        return CLI_PUBLISH_ERROR;
+    }
+    /* Send counted as one packet with every byte, rest of packets here */
+    if ( broker->metrics ) {
+        METRICS_ADD( broker->metrics->tx_packets[MQTT_CTRLPKT_PUBLISH >> 4], batch->count - 1 );
+    }
+    for ( i = 0; i < batch->count; i++ ) {
+        eclimetrics_publish( broker->metrics, 0, 0 );
+    }
+    sprintf(buffer_str, STREAM_FLUSH_MSG, batch->count, batch->len);
+    eclilog_show(__FILE__, __func__, buffer_str, LOG_DEBUG);
+    batch->len = 0;
+    batch->count = 0;
+
+    return CLI_NO_ERROR;
+}
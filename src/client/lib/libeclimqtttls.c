@@ -0,0 +1,789 @@
+/***********************************************************************
+* FILENAME    :   libeclimqtttls.c
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   Library code for TLS transport (OpenSSL) with session
+*                 resumption and kernel TLS offload.
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+/**********************************************************************/
+
+#include <libeclimqtttls.h>
+#include <libeclimqttlog.h>
+
+/**********************************************************************/
+#ifdef ECLI_TLS_OPENSSL
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#include <openssl/x509v3.h>
+
+/**********************************************************************/
+#define TLS_MSG_LEN       256
+
+/**********************************************************************/
+/* TLS connection */
+typedef struct {
+    SSL  *ssl;
+    char key[TLS_KEY_LEN];                  /* Session cache key */
+} eclitls_conn_t;
+
+/* Cached session */
+typedef struct {
+    char        key[TLS_KEY_LEN];
+    SSL_SESSION *session;
+} eclitls_session_t;
+
+/**********************************************************************/
+
+static SSL_CTX           *tls_ctx = NULL;
+static eclitls_session_t tls_sessions[TLS_SESSION_CACHE];
+static char              tls_session_file[TLS_PATH_LEN];
+static pthread_mutex_t   tls_lock = PTHREAD_MUTEX_INITIALIZER;   /* Session cache, parallel connects */
+
+/**********************************************************************/
+/**********************************************************************/
+/** TCP connect and TLS handshake, resuming the cached session for
+ * this broker when there is one.
+ *
+ * @param transport: transport instance.
+ * @param timeout_ms: connect and handshake timeout in msecs, 0 no timeout.
+ *
+ */
+static int8_t eclitls_connect(ecli_transport_t *transport, uint32_t timeout_ms);
+
+/**********************************************************************/
+/** Send buffer in TLS records.
+ *
+ * @param transport: transport instance.
+ * @param buffer: packet buffer.
+ * @param count: size of packet.
+ *
+ */
+static int32_t eclitls_send(ecli_transport_t *transport, const void *buffer, int32_t count);
+
+/**********************************************************************/
+/** Send vectors, small packets are gathered in one TLS record.
+ *
+ * @param transport: transport instance.
+ * @param iov: vectors.
+ * @param iovcnt: number of vectors.
+ *
+ */
+static int32_t eclitls_sendv(ecli_transport_t *transport, const struct iovec *iov, int32_t iovcnt);
+
+/**********************************************************************/
+/** Receive decrypted data.
+ *
+ * @param transport: transport instance.
+ * @param buffer: output buffer.
+ * @param count: buffer size.
+ * @param flags: MSG_WAITALL supported.
+ *
+ */
+static int32_t eclitls_recv(ecli_transport_t *transport, void *buffer, int32_t count, int32_t flags);
+
+/**********************************************************************/
+/** Send header and file contents, with sendfile when kernel TLS is
+ * active.
+ *
+ * @param transport: transport instance.
+ * @param header: packet header.
+ * @param header_len: header size.
+ * @param fd: file descriptor, read from current offset.
+ * @param count: file bytes to send.
+ *
+ */
+static int32_t eclitls_send_file(ecli_transport_t *transport, const void *header,
+                                 int32_t header_len, int32_t fd, uint32_t count);
+
+/**********************************************************************/
+/** Shutdown and free TLS session, then close socket.
+ *
+ * @param transport: transport instance.
+ *
+ */
+static void eclitls_close(ecli_transport_t *transport);
+
+/**********************************************************************/
+/** Get socket under TLS session.
+ *
+ * @param transport: transport instance.
+ *
+ */
+static int32_t eclitls_fd(const ecli_transport_t *transport);
+
+/**********************************************************************/
+/** Log OpenSSL error queue.
+ *
+ * @param what: failed operation.
+ *
+ */
+static void eclitls_log_error(const char *what);
+
+/**********************************************************************/
+/** Store new session ticket in cache (OpenSSL callback).
+ *
+ * @param ssl: TLS connection.
+ * @param session: new session, owned by cache if 1 is returned.
+ *
+ */
+static int eclitls_new_session(SSL *ssl, SSL_SESSION *session);
+
+/**********************************************************************/
+/** Find cached session slot for key, or a free / oldest one.
+ *
+ * @param key: "host:port".
+ * @param create: return a slot to store key if not found.
+ *
+ */
+static eclitls_session_t *eclitls_session_slot(const char *key, uint8_t create);
+
+/**********************************************************************/
+/** Load sessions persisted in file.
+ *
+ * @param path: session file.
+ *
+ */
+static void eclitls_load_sessions(const char *path);
+
+/**********************************************************************/
+/** Persist cached sessions in file.
+ *
+ * @param path: session file.
+ *
+ */
+static void eclitls_save_sessions(const char *path);
+
+/**********************************************************************/
+
+const ecli_transport_ops_t eclitls_transport = {
+    .name      = "tls",
+    .connect   = eclitls_connect,
+    .send      = eclitls_send,
+    .sendv     = eclitls_sendv,
+    .recv      = eclitls_recv,
+    .send_file = eclitls_send_file,
+    .close     = eclitls_close,
+    .fd        = eclitls_fd,
+};
+
+/**********************************************************************/
+/**********************************************************************/
+/** Create TLS context and load persisted sessions.
+ *
+ * @param tls_conf: TLS configuration.
+ *
+ */
+int8_t eclitls_init(const ecli_tls_conf_t *tls_conf) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    if ( tls_ctx != NULL ) {
+        return 0;
+    }
+    if ( ( tls_ctx = SSL_CTX_new( TLS_client_method() ) ) == NULL ) {
+        eclitls_log_error( "SSL_CTX_new" );
+        return -1;
+    }
+    SSL_CTX_set_min_proto_version( tls_ctx, TLS1_2_VERSION );
+#ifdef SSL_OP_ENABLE_KTLS
+    /* Kernel does record encryption when the tls ULP is available */
+    SSL_CTX_set_options( tls_ctx, SSL_OP_ENABLE_KTLS );
+#endif
+    /* Client cache is ours, sessions are kept per broker across sockets */
+    SSL_CTX_set_session_cache_mode( tls_ctx, SSL_SESS_CACHE_CLIENT |
+                                             SSL_SESS_CACHE_NO_INTERNAL_STORE );
+    SSL_CTX_sess_set_new_cb( tls_ctx, eclitls_new_session );
+    if ( tls_conf->ca_file[0] ) {
+        if ( SSL_CTX_load_verify_locations( tls_ctx, tls_conf->ca_file, NULL ) != 1 ) {
+            eclitls_log_error( tls_conf->ca_file );
+            return -1;
+        }
+    }
+    else {
+        SSL_CTX_set_default_verify_paths( tls_ctx );
+    }
+    if ( tls_conf->cert_file[0] ) {
+        if ( SSL_CTX_use_certificate_chain_file( tls_ctx, tls_conf->cert_file ) != 1 ||
+             SSL_CTX_use_PrivateKey_file( tls_ctx, tls_conf->key_file[0] ?
+                                          tls_conf->key_file : tls_conf->cert_file,
+                                          SSL_FILETYPE_PEM ) != 1 ) {
+            eclitls_log_error( tls_conf->cert_file );
+            return -1;
+        }
+    }
+    SSL_CTX_set_verify( tls_ctx, tls_conf->verify ? SSL_VERIFY_PEER : SSL_VERIFY_NONE, NULL );
+    if ( tls_conf->session_file[0] ) {
+        strncpy( tls_session_file, tls_conf->session_file, sizeof( tls_session_file ) - 1 );
+        eclitls_load_sessions( tls_session_file );
+    }
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Session of transport was resumed (abbreviated handshake).
+ *
+ * @param transport: connected TLS transport.
+ *
+ */
+uint8_t eclitls_resumed(const ecli_transport_t *transport) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    eclitls_conn_t *conn = transport->ctx;
+
+    return conn != NULL && SSL_session_reused( conn->ssl );
+}
+
+/**********************************************************************/
+/** Kernel TLS send offload is active for transport.
+ *
+ * @param transport: connected TLS transport.
+ *
+ */
+uint8_t eclitls_ktls(const ecli_transport_t *transport) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    eclitls_conn_t *conn = transport->ctx;
+
+    return conn != NULL && BIO_get_ktls_send( SSL_get_wbio( conn->ssl ) );
+}
+
+/**********************************************************************/
+/** Decrypted bytes are waiting in the TLS session (socket may not be
+ * readable for them), 0 for other transports.
+ *
+ * @param transport: connected transport.
+ *
+ */
+uint8_t eclitls_pending(const ecli_transport_t *transport) {
+
+    eclitls_conn_t *conn = transport->ctx;
+
+    return transport->ops == &eclitls_transport && conn != NULL && SSL_pending( conn->ssl ) > 0;
+}
+
+/**********************************************************************/
+/**********************************************************************/
+/** TCP connect and TLS handshake, resuming the cached session for
+ * this broker when there is one.
+ *
+ * @param transport: transport instance.
+ * @param timeout_ms: connect and handshake timeout in msecs, 0 no timeout.
+ *
+ */
+static int8_t eclitls_connect(ecli_transport_t *transport, uint32_t timeout_ms) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    const ecli_endpoint_t *endpoint;
+    eclitls_conn_t    *conn;
+    eclitls_session_t *cached;
+    unsigned char     addr[sizeof( struct in6_addr )];
+    char              buffer_str[TLS_MSG_LEN] = {0};
+    uint8_t           is_ip = 0;
+    int32_t           result = 0;
+    struct timeval    tv;
+
+    if ( tls_ctx == NULL ) {
+        errno = EINVAL;
+        return TRANSPORT_CONN_ERROR;
+    }
+    if ( eclitransport_tcp.connect( transport, timeout_ms ) < 0 ) {
+        return TRANSPORT_CONN_ERROR;
+    }
+    endpoint = eclinet_current( transport->endpoints );
+    if ( ( conn = calloc( 1, sizeof( eclitls_conn_t ) ) ) == NULL ) {
+        eclitransport_tcp.close( transport );
+        return TRANSPORT_SESSION_ERROR;
+    }
+    snprintf( conn->key, sizeof( conn->key ), "%s:%u", endpoint->host, endpoint->port );
+    if ( ( conn->ssl = SSL_new( tls_ctx ) ) == NULL ) {
+        free( conn );
+        eclitls_log_error( "SSL_new" );
+        eclitransport_tcp.close( transport );
+        return TRANSPORT_SESSION_ERROR;
+    }
+    SSL_set_fd( conn->ssl, transport->socketid );
+    SSL_set_app_data( conn->ssl, conn );
+    is_ip = inet_pton( AF_INET, endpoint->host, addr ) == 1 ||
+            inet_pton( AF_INET6, endpoint->host, addr ) == 1;
+    if ( is_ip ) {
+        X509_VERIFY_PARAM_set1_ip_asc( SSL_get0_param( conn->ssl ), endpoint->host );
+    }
+    else {
+        SSL_set_tlsext_host_name( conn->ssl, endpoint->host );
+        SSL_set1_host( conn->ssl, endpoint->host );
+    }
+    /* Offer cached ticket: abbreviated handshake, no certificate chain */
+    pthread_mutex_lock( &tls_lock );
+    cached = eclitls_session_slot( conn->key, 0 );
+    if ( cached != NULL && SSL_SESSION_is_resumable( cached->session ) ) {
+        SSL_set_session( conn->ssl, cached->session );
+    }
+    pthread_mutex_unlock( &tls_lock );
+    transport->ctx = conn;
+    /* Bound handshake like TCP connect, blocking without timeout after */
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = ( timeout_ms % 1000 ) * 1000;
+    setsockopt( transport->socketid, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof( tv ) );
+    setsockopt( transport->socketid, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof( tv ) );
+    result = SSL_connect( conn->ssl );
+    memset( &tv, 0, sizeof( tv ) );
+    setsockopt( transport->socketid, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof( tv ) );
+    setsockopt( transport->socketid, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof( tv ) );
+    if ( result != 1 ) {
+        eclitls_log_error( "SSL_connect" );
+        eclitls_close( transport );
+        errno = ECONNABORTED;
+        return TRANSPORT_SESSION_ERROR;
+    }
+    snprintf( buffer_str, sizeof( buffer_str ), "TLS %s with %s, %s handshake%s",
+              SSL_get_version( conn->ssl ), conn->key,
+              SSL_session_reused( conn->ssl ) ? "resumed" : "full",
+              eclitls_ktls( transport ) ? ", kernel TLS" : "" );
+    eclilog_show(__FILE__, __func__, buffer_str, LOG_DEBUG);
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Send buffer in TLS records.
+ *
+ * @param transport: transport instance.
+ * @param buffer: packet buffer.
+ * @param count: size of packet.
+ *
+ */
+static int32_t eclitls_send(ecli_transport_t *transport, const void *buffer, int32_t count) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    eclitls_conn_t *conn = transport->ctx;
+
+    if ( conn == NULL ) {
+        errno = EBADF;
+        return -1;
+    }
+    if ( count == 0 ) {
+        return 0;
+    }
+    /* Blocking socket without partial writes: all or error */
+    if ( SSL_write( conn->ssl, buffer, count ) != count ) {
+        eclitls_log_error( "SSL_write" );
+        return -1;
+    }
+
+    return count;
+}
+
+/**********************************************************************/
+/** Send vectors, small packets are gathered in one TLS record.
+ *
+ * @param transport: transport instance.
+ * @param iov: vectors.
+ * @param iovcnt: number of vectors.
+ *
+ */
+static int32_t eclitls_sendv(ecli_transport_t *transport, const struct iovec *iov, int32_t iovcnt) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    uint8_t  record[TLS_FILE_CHUNK];
+    uint32_t total = 0;
+    int32_t  i;
+
+    for ( i = 0; i < iovcnt; i++ ) {
+        total += iov[i].iov_len;
+    }
+    /* A record per vector costs a header, MAC and a syscall each */
+    if ( total <= sizeof( record ) ) {
+        total = 0;
+        for ( i = 0; i < iovcnt; i++ ) {
+            memcpy( record + total, iov[i].iov_base, iov[i].iov_len );
+            total += iov[i].iov_len;
+        }
+        return eclitls_send( transport, record, total );
+    }
+    total = 0;
+    for ( i = 0; i < iovcnt; i++ ) {
+        if ( eclitls_send( transport, iov[i].iov_base, iov[i].iov_len ) < 0 ) {
+            return -1;
+        }
+        total += iov[i].iov_len;
+    }
+
+    return total;
+}
+
+/**********************************************************************/
+/** Receive decrypted data.
+ *
+ * @param transport: transport instance.
+ * @param buffer: output buffer.
+ * @param count: buffer size.
+ * @param flags: MSG_WAITALL supported.
+ *
+ */
+static int32_t eclitls_recv(ecli_transport_t *transport, void *buffer, int32_t count, int32_t flags) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    eclitls_conn_t *conn = transport->ctx;
+    int32_t total = 0;
+    int32_t bytes = 0;
+
+    if ( conn == NULL ) {
+        errno = EBADF;
+        return -1;
+    }
+    do {
+        bytes = SSL_read( conn->ssl, ( uint8_t * ) buffer + total, count - total );
+        if ( bytes <= 0 ) {
+            switch ( SSL_get_error( conn->ssl, bytes ) ) {
+                case SSL_ERROR_ZERO_RETURN:
+                    return total;
+                case SSL_ERROR_SYSCALL:
+                    /* errno says EAGAIN on SO_RCVTIMEO timeout */
+                    return total ? total : ( errno ? -1 : 0 );
+                default:
+                    eclitls_log_error( "SSL_read" );
+                    return total ? total : -1;
+            }
+        }
+        total += bytes;
+    }
+    while ( ( flags & MSG_WAITALL ) && total < count );
+
+    return total;
+}
+
+/**********************************************************************/
+/** Send header and file contents, with sendfile when kernel TLS is
+ * active.
+ *
+ * @param transport: transport instance.
+ * @param header: packet header.
+ * @param header_len: header size.
+ * @param fd: file descriptor, read from current offset.
+ * @param count: file bytes to send.
+ *
+ */
+static int32_t eclitls_send_file(ecli_transport_t *transport, const void *header,
+                                 int32_t header_len, int32_t fd, uint32_t count) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    eclitls_conn_t *conn = transport->ctx;
+    uint8_t  chunk[TLS_FILE_CHUNK];
+    uint32_t sent   = 0;
+    int32_t  bytes  = 0;
+    off_t    offset = 0;
+
+    if ( conn == NULL || eclitls_send( transport, header, header_len ) != header_len ) {
+        return -1;
+    }
+    if ( eclitls_ktls( transport ) ) {
+        /* Kernel encrypts page cache data, no user space copy */
+        offset = lseek( fd, 0, SEEK_CUR );
+        while ( sent < count ) {
+            bytes = SSL_sendfile( conn->ssl, fd, offset + sent, count - sent, 0 );
+            if ( bytes <= 0 ) {
+                eclitls_log_error( "SSL_sendfile" );
+                return header_len + sent;
+            }
+            sent += bytes;
+        }
+        lseek( fd, offset + sent, SEEK_SET );
+    }
+    else {
+        while ( sent < count ) {
+            bytes = read( fd, chunk, ( count - sent ) < sizeof( chunk ) ?
+                                     ( count - sent ) : sizeof( chunk ) );
+            if ( bytes <= 0 || SSL_write( conn->ssl, chunk, bytes ) != bytes ) {
+                return header_len + sent;
+            }
+            sent += bytes;
+        }
+    }
+
+    return header_len + sent;
+}
+
+/**********************************************************************/
+/** Shutdown and free TLS session, then close socket.
+ *
+ * @param transport: transport instance.
+ *
+ */
+static void eclitls_close(ecli_transport_t *transport) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    eclitls_conn_t *conn = transport->ctx;
+
+    if ( conn != NULL ) {
+        transport->ctx = NULL;
+        SSL_shutdown( conn->ssl );
+        SSL_free( conn->ssl );
+        free( conn );
+        ERR_clear_error();
+    }
+    eclitransport_tcp.close( transport );
+}
+
+/**********************************************************************/
+/** Get socket under TLS session.
+ *
+ * @param transport: transport instance.
+ *
+ */
+static int32_t eclitls_fd(const ecli_transport_t *transport) {
+
+    return transport->socketid;
+}
+
+/**********************************************************************/
+/** Log OpenSSL error queue.
+ *
+ * @param what: failed operation.
+ *
+ */
+static void eclitls_log_error(const char *what) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    char buffer_str[TLS_MSG_LEN + TLS_PATH_LEN] = {0};
+    char error_str[TLS_MSG_LEN] = {0};
+    unsigned long error;
+
+    while ( ( error = ERR_get_error() ) != 0 ) {
+        ERR_error_string_n( error, error_str, sizeof( error_str ) );
+        snprintf( buffer_str, sizeof( buffer_str ), "TLS %s: %s", what, error_str );
+        eclilog_show(__FILE__, __func__, buffer_str, LOG_ERROR);
+    }
+}
+
+/**********************************************************************/
+/** Store new session ticket in cache (OpenSSL callback).
+ *
+ * @param ssl: TLS connection.
+ * @param session: new session, owned by cache if 1 is returned.
+ *
+ */
+static int eclitls_new_session(SSL *ssl, SSL_SESSION *session) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    eclitls_conn_t    *conn = SSL_get_app_data( ssl );
+    eclitls_session_t *slot;
+
+    if ( conn == NULL ) {
+        return 0;
+    }
+    pthread_mutex_lock( &tls_lock );
+    if ( ( slot = eclitls_session_slot( conn->key, 1 ) ) == NULL ) {
+        pthread_mutex_unlock( &tls_lock );
+        return 0;
+    }
+    if ( slot->session != NULL ) {
+        SSL_SESSION_free( slot->session );
+    }
+    strncpy( slot->key, conn->key, sizeof( slot->key ) - 1 );
+    slot->session = session;
+    if ( tls_session_file[0] ) {
+        eclitls_save_sessions( tls_session_file );
+    }
+    pthread_mutex_unlock( &tls_lock );
+
+    return 1;
+}
+
+/**********************************************************************/
+/** Find cached session slot for key, or a free / oldest one.
+ *
+ * @param key: "host:port".
+ * @param create: return a slot to store key if not found.
+ *
+ */
+static eclitls_session_t *eclitls_session_slot(const char *key, uint8_t create) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    eclitls_session_t *slot = NULL;
+    uint32_t i;
+
+    for ( i = 0; i < TLS_SESSION_CACHE; i++ ) {
+        if ( tls_sessions[i].session != NULL &&
+             strcmp( tls_sessions[i].key, key ) == 0 ) {
+            return &tls_sessions[i];
+        }
+    }
+    if ( !create ) {
+        return NULL;
+    }
+    /* Free slot, or the one with the oldest session */
+    for ( i = 0; i < TLS_SESSION_CACHE; i++ ) {
+        if ( tls_sessions[i].session == NULL ) {
+            return &tls_sessions[i];
+        }
+        if ( slot == NULL || SSL_SESSION_get_time( tls_sessions[i].session ) <
+                             SSL_SESSION_get_time( slot->session ) ) {
+            slot = &tls_sessions[i];
+        }
+    }
+
+    return slot;
+}
+
+/**********************************************************************/
+/** Load sessions persisted in file.
+ *
+ * @param path: session file.
+ *
+ */
+static void eclitls_load_sessions(const char *path) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    eclitls_session_t *slot;
+    SSL_SESSION *session;
+    char key[TLS_KEY_LEN];
+    char *newline;
+    FILE *fileptr = fopen( path, "r" );
+
+    if ( fileptr == NULL ) {
+        return;
+    }
+    /* "host:port" line followed by PEM session */
+    while ( fgets( key, sizeof( key ), fileptr ) != NULL ) {
+        if ( ( newline = strchr( key, '\n' ) ) != NULL ) {
+            *newline = '\0';
+        }
+        if ( ( session = PEM_read_SSL_SESSION( fileptr, NULL, NULL, NULL ) ) == NULL ) {
+            break;
+        }
+        if ( !SSL_SESSION_is_resumable( session ) ||
+             ( slot = eclitls_session_slot( key, 1 ) ) == NULL ) {
+            SSL_SESSION_free( session );
+            continue;
+        }
+        if ( slot->session != NULL ) {
+            SSL_SESSION_free( slot->session );
+        }
+        strncpy( slot->key, key, sizeof( slot->key ) - 1 );
+        slot->session = session;
+    }
+    ERR_clear_error();
+    fclose( fileptr );
+}
+
+/**********************************************************************/
+/** Persist cached sessions in file.
+ *
+ * @param path: session file.
+ *
+ */
+static void eclitls_save_sessions(const char *path) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    char     tmp_path[TLS_PATH_LEN + 8];
+    uint32_t i;
+    FILE     *fileptr;
+
+    snprintf( tmp_path, sizeof( tmp_path ), "%s.tmp", path );
+    if ( ( fileptr = fopen( tmp_path, "w" ) ) == NULL ) {
+        return;
+    }
+    for ( i = 0; i < TLS_SESSION_CACHE; i++ ) {
+        if ( tls_sessions[i].session != NULL ) {
+            fprintf( fileptr, "%s\n", tls_sessions[i].key );
+            PEM_write_SSL_SESSION( fileptr, tls_sessions[i].session );
+        }
+    }
+    fclose( fileptr );
+    /* Session keys are secrets */
+    chmod( tmp_path, 0600 );
+    rename( tmp_path, path );
+}
+
+/**********************************************************************/
+#else /* ECLI_TLS_OPENSSL */
+
+/**********************************************************************/
+/** Create TLS context and load persisted sessions.
+ *
+ * @param tls_conf: TLS configuration.
+ *
+ */
+int8_t eclitls_init(const ecli_tls_conf_t *tls_conf) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    eclilog_show(__FILE__, __func__, "TLS not built, use TLS=OPENSSL", LOG_ERROR);
+
+    return -1;
+}
+
+/**********************************************************************/
+/** Session of transport was resumed.
+ *
+ */
+uint8_t eclitls_resumed(const ecli_transport_t *transport) {
+    return 0;
+}
+
+/**********************************************************************/
+/** Kernel TLS send offload is active for transport.
+ *
+ */
+uint8_t eclitls_ktls(const ecli_transport_t *transport) {
+    return 0;
+}
+
+/**********************************************************************/
+/** No TLS session, nothing waiting.
+ *
+ */
+uint8_t eclitls_pending(const ecli_transport_t *transport) {
+    return 0;
+}
+
+/**********************************************************************/
+/** TLS connect, not built.
+ *
+ */
+static int8_t eclitls_connect(ecli_transport_t *transport, uint32_t timeout_ms) {
+    errno = EPROTONOSUPPORT;
+    return TRANSPORT_CONN_ERROR;
+}
+
+/**********************************************************************/
+/** Socket of TLS transport, never connected.
+ *
+ */
+static int32_t eclitls_fd(const ecli_transport_t *transport) {
+    return -1;
+}
+
+/**********************************************************************/
+/** Close TLS transport, nothing to do.
+ *
+ */
+static void eclitls_close(ecli_transport_t *transport) {
+}
+
+/**********************************************************************/
+
+const ecli_transport_ops_t eclitls_transport = {
+    .name      = "tls",
+    .connect   = eclitls_connect,
+    .close     = eclitls_close,
+    .fd        = eclitls_fd,
+};
+
+#endif /* ECLI_TLS_OPENSSL */
+
+/**********************************************************************/
@@ -0,0 +1,159 @@
+/***********************************************************************
+* FILENAME    :   libeclimqtttrace.c
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   Library code for packet lifecycle trace recorder.
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+/**********************************************************************/
+
+#include <libeclimqtttrace.h>
+#include <libeclimqttlog.h>
+#include <libeclimqttmetrics.h>
+
+/**********************************************************************/
+#define TRACE_PATH_LEN    512
+
+/**********************************************************************/
+/* Recorded event */
+typedef struct {
+    const char *name;
+    char       phase;
+    uint32_t   tid;
+    uint32_t   msg_id;
+    uint32_t   len;
+    uint64_t   ts_nsec;
+    uint32_t   ready;                   /* Set once the slot is filled */
+} eclitrace_event_t;
+
+/**********************************************************************/
+
+uint8_t eclitrace_enabled = 0;
+
+static eclitrace_event_t *trace_events  = NULL;
+static uint32_t          trace_count    = 0;
+static uint32_t          trace_dropped  = 0;
+static uint64_t          trace_start_ns = 0;
+static char              trace_path[TRACE_PATH_LEN];
+
+/**********************************************************************/
+/**********************************************************************/
+/** Start in-process recorder, events are written in file at exit.
+ *
+ * @param path: Chrome trace-event JSON file path.
+ *
+ */
+int8_t eclitrace_start(const char *path) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+#ifdef ECLI_TRACE_CHROME
+    if ( trace_events != NULL ) {
+        return 0;
+    }
+    trace_events = calloc( TRACE_MAX_EVENTS, sizeof( eclitrace_event_t ) );
+    if ( trace_events == NULL ) {
+        return -1;
+    }
+    strncpy( trace_path, path, sizeof( trace_path ) - 1 );
+    trace_start_ns = eclimetrics_now();
+    atexit( eclitrace_stop );
+    __atomic_store_n( &eclitrace_enabled, 1, __ATOMIC_RELEASE );
+
+    return 0;
+#else
+    eclilog_show(__FILE__, __func__, "Trace recorder not built, use TRACE=CHROME", LOG_INFO);
+
+    return -1;
+#endif
+}
+
+/**********************************************************************/
+/** Stop recorder and write recorded events in file.
+ *
+ */
+void eclitrace_stop(void) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    eclitrace_event_t *event;
+    uint32_t count    = 0;
+    uint32_t unfilled = 0;
+    uint32_t i        = 0;
+    uint32_t pid      = getpid();
+    uint8_t  first    = 1;
+    FILE     *out;
+
+    if ( !__atomic_exchange_n( &eclitrace_enabled, 0, __ATOMIC_ACQ_REL ) ) {
+        return;
+    }
+    count = __atomic_load_n( &trace_count, __ATOMIC_ACQUIRE );
+    if ( count > TRACE_MAX_EVENTS ) {
+        count = TRACE_MAX_EVENTS;
+    }
+    out = fopen( trace_path, "w" );
+    if ( out == NULL ) {
+        perror( trace_path );
+        return;
+    }
+    fprintf( out, "{\"traceEvents\":[\n" );
+    for ( i = 0; i < count; i++ ) {
+        event = &trace_events[i];
+        /* Slot reserved by a thread still filling it */
+        if ( !__atomic_load_n( &event->ready, __ATOMIC_ACQUIRE ) ) {
+            unfilled++;
+            continue;
+        }
+        fprintf( out, "%s{\"name\":\"%s\",\"cat\":\"mqtt\",\"ph\":\"%c\",\"ts\":%.3f,"
+                      "\"pid\":%u,\"tid\":%u,%s\"args\":{\"msg_id\":%u,\"len\":%u}}",
+                 first ? "" : ",\n", event->name, event->phase,
+                 ( event->ts_nsec - trace_start_ns ) / 1000.0, pid, event->tid,
+                 event->phase == 'i' ? "\"s\":\"t\"," : "",
+                 event->msg_id, event->len );
+        first = 0;
+    }
+    fprintf( out, "\n],\"otherData\":{\"dropped_events\":%u}}\n",
+             __atomic_load_n( &trace_dropped, __ATOMIC_RELAXED ) + unfilled );
+    fclose( out );
+}
+
+/**********************************************************************/
+/** Record an event (use TRACE_* macros instead).
+ *
+ * @param name: event name (static string).
+ * @param phase: 'B' begin, 'E' end, 'i' instant.
+ * @param msg_id: packet message id.
+ * @param len: packet or payload len.
+ *
+ */
+void eclitrace_record(const char *name, char phase, uint32_t msg_id, uint32_t len) {
+
+    static __thread uint32_t tid = 0;
+    eclitrace_event_t *event;
+    uint32_t index;
+
+    index = __atomic_fetch_add( &trace_count, 1, __ATOMIC_RELAXED );
+    if ( index >= TRACE_MAX_EVENTS ) {
+        __atomic_fetch_add( &trace_dropped, 1, __ATOMIC_RELAXED );
+        return;
+    }
+    if ( tid == 0 ) {
+        tid = syscall( SYS_gettid );
+    }
+    event = &trace_events[index];
+    event->name    = name;
+    event->phase   = phase;
+    event->tid     = tid;
+    event->msg_id  = msg_id;
+    event->len     = len;
+    event->ts_nsec = eclimetrics_now();
+    __atomic_store_n( &event->ready, 1, __ATOMIC_RELEASE );
+}
+
+/**********************************************************************/
@@ -0,0 +1,431 @@
+/***********************************************************************
+* FILENAME    :   libeclimqtttransport.c
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   Library code for broker transports (TCP, Unix domain
+*                 socket) behind a common operations table.
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+/**********************************************************************/
+
+#include <libeclimqtttransport.h>
+#include <libeclimqttlog.h>
+
+/**********************************************************************/
+/**********************************************************************/
+/** Connect TCP transport to best ranked broker of list.
+ *
+ * @param transport: transport instance.
+ * @param timeout_ms: connect timeout in msecs, 0 no timeout.
+ *
+ */
+static int8_t eclitransport_tcp_connect(ecli_transport_t *transport, uint32_t timeout_ms);
+
+/**********************************************************************/
+/** Connect Unix domain socket transport to broker socket path.
+ *
+ * @param transport: transport instance.
+ * @param timeout_ms: connect timeout in msecs, 0 no timeout.
+ *
+ */
+static int8_t eclitransport_unix_connect(ecli_transport_t *transport, uint32_t timeout_ms);
+
+/**********************************************************************/
+/** Send buffer on stream socket.
+ *
+ * @param transport: transport instance.
+ * @param buffer: packet buffer.
+ * @param count: size of packet.
+ *
+ */
+static int32_t eclitransport_sock_send(ecli_transport_t *transport, const void *buffer, int32_t count);
+
+/**********************************************************************/
+/** Send vectors on stream socket with one sendmsg, resuming short writes.
+ *
+ * @param transport: transport instance.
+ * @param iov: vectors.
+ * @param iovcnt: number of vectors (max TRANSPORT_MAX_IOV).
+ *
+ */
+static int32_t eclitransport_sock_sendv(ecli_transport_t *transport, const struct iovec *iov,
+                                        int32_t iovcnt);
+
+/**********************************************************************/
+/** Send vectors on stream socket without waiting (short write or EAGAIN).
+ *
+ * @param transport: transport instance.
+ * @param iov: vectors.
+ * @param iovcnt: number of vectors.
+ *
+ */
+static int32_t eclitransport_sock_writev(ecli_transport_t *transport, const struct iovec *iov,
+                                         int32_t iovcnt);
+
+/**********************************************************************/
+/** Receive from stream socket.
+ *
+ * @param transport: transport instance.
+ * @param buffer: output buffer.
+ * @param count: buffer size.
+ * @param flags: recv flags.
+ *
+ */
+static int32_t eclitransport_sock_recv(ecli_transport_t *transport, void *buffer, int32_t count,
+                                       int32_t flags);
+
+/**********************************************************************/
+/** Send header and file contents on stream socket (sendfile).
+ *
+ * @param transport: transport instance.
+ * @param header: packet header.
+ * @param header_len: size of header.
+ * @param fd: file descriptor, read from current offset.
+ * @param count: file bytes to send.
+ *
+ */
+static int32_t eclitransport_sock_send_file(ecli_transport_t *transport, const void *header,
+                                            int32_t header_len, int32_t fd, uint32_t count);
+
+/**********************************************************************/
+/** Close stream socket.
+ *
+ * @param transport: transport instance.
+ *
+ */
+static void eclitransport_sock_close(ecli_transport_t *transport);
+
+/**********************************************************************/
+/** Get stream socket.
+ *
+ * @param transport: transport instance.
+ *
+ */
+static int32_t eclitransport_sock_fd(const ecli_transport_t *transport);
+
+/**********************************************************************/
+
+const ecli_transport_ops_t eclitransport_tcp = {
+    .name      = "tcp",
+    .connect   = eclitransport_tcp_connect,
+    .send      = eclitransport_sock_send,
+    .sendv     = eclitransport_sock_sendv,
+    .writev    = eclitransport_sock_writev,
+    .recv      = eclitransport_sock_recv,
+    .send_file = eclitransport_sock_send_file,
+    .close     = eclitransport_sock_close,
+    .fd        = eclitransport_sock_fd,
+};
+
+const ecli_transport_ops_t eclitransport_unix = {
+    .name      = "unix",
+    .connect   = eclitransport_unix_connect,
+    .send      = eclitransport_sock_send,
+    .sendv     = eclitransport_sock_sendv,
+    .writev    = eclitransport_sock_writev,
+    .recv      = eclitransport_sock_recv,
+    .send_file = eclitransport_sock_send_file,
+    .close     = eclitransport_sock_close,
+    .fd        = eclitransport_sock_fd,
+};
+
+/**********************************************************************/
+/**********************************************************************/
+/** Set transport ops, transport is not connected.
+ *
+ * @param transport: transport instance.
+ * @param ops: transport operations.
+ *
+ */
+void eclitransport_init(ecli_transport_t *transport, const ecli_transport_ops_t *ops) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    memset( transport, 0, sizeof( ecli_transport_t ) );
+    transport->ops = ops;
+    transport->socketid = -1;
+}
+
+/**********************************************************************/
+/** Get peer description of connected transport ("host:port" or path).
+ *
+ * @param transport: transport instance.
+ * @param peer: output buffer.
+ * @param len: output buffer size.
+ *
+ */
+void eclitransport_peer(const ecli_transport_t *transport, char *peer, uint32_t len) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    const ecli_endpoint_t *endpoint = eclinet_current( transport->endpoints );
+
+    if ( transport->path[0] ) {
+        snprintf( peer, len, "%s%s", TRANSPORT_UNIX_PREFIX, transport->path );
+    }
+    else if ( endpoint != NULL ) {
+        snprintf( peer, len, "%s:%u", endpoint->host, endpoint->port );
+    }
+    else {
+        snprintf( peer, len, "-" );
+    }
+}
+
+/**********************************************************************/
+/**********************************************************************/
+/** Connect TCP transport to best ranked broker of list.
+ *
+ * @param transport: transport instance.
+ * @param timeout_ms: connect timeout in msecs, 0 no timeout.
+ *
+ */
+static int8_t eclitransport_tcp_connect(ecli_transport_t *transport, uint32_t timeout_ms) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    if ( eclinet_connect( transport->endpoints, timeout_ms, transport->stagger_ms,
+                          &transport->socketid ) < 0 ) {
+        transport->socketid = -1;
+        return TRANSPORT_CONN_ERROR;
+    }
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Connect Unix domain socket transport to broker socket path.
+ *
+ * @param transport: transport instance.
+ * @param timeout_ms: connect timeout in msecs, 0 no timeout.
+ *
+ */
+static int8_t eclitransport_unix_connect(ecli_transport_t *transport, uint32_t timeout_ms) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    struct sockaddr_un addr;
+    struct timeval     tv;
+    socklen_t          addr_len;
+    int32_t            error = 0;
+
+    memset( &addr, 0, sizeof( addr ) );
+    addr.sun_family = AF_UNIX;
+    strncpy( addr.sun_path, transport->path, sizeof( addr.sun_path ) - 1 );
+    addr_len = offsetof( struct sockaddr_un, sun_path ) + strlen( addr.sun_path ) + 1;
+    /* "@name" is a Linux abstract socket, no file and no trailing NUL */
+    if ( addr.sun_path[0] == '@' ) {
+        addr.sun_path[0] = '\0';
+        addr_len--;
+    }
+    if ( ( transport->socketid = socket( AF_UNIX, SOCK_STREAM, 0 ) ) < 0 ) {
+        return TRANSPORT_CONN_ERROR;
+    }
+    /* Blocking connect waits on a full listen backlog up to SO_SNDTIMEO */
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = ( timeout_ms % 1000 ) * 1000;
+    setsockopt( transport->socketid, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof( tv ) );
+    if ( connect( transport->socketid, ( const struct sockaddr * ) &addr, addr_len ) < 0 ) {
+        error = errno;
+        close( transport->socketid );
+        transport->socketid = -1;
+        errno = ( error == EAGAIN ) ? ETIMEDOUT : error;
+        return TRANSPORT_CONN_ERROR;
+    }
+    memset( &tv, 0, sizeof( tv ) );
+    setsockopt( transport->socketid, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof( tv ) );
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Send buffer on stream socket.
+ *
+ * @param transport: transport instance.
+ * @param buffer: packet buffer.
+ * @param count: size of packet.
+ *
+ */
+static int32_t eclitransport_sock_send(ecli_transport_t *transport, const void *buffer, int32_t count) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    struct iovec iov = { .iov_base = ( void * ) buffer, .iov_len = count };
+
+    return eclitransport_sock_sendv( transport, &iov, 1 );
+}
+
+/**********************************************************************/
+/** Send vectors on stream socket with one sendmsg, resuming short writes.
+ *
+ * @param transport: transport instance.
+ * @param iov: vectors.
+ * @param iovcnt: number of vectors (max TRANSPORT_MAX_IOV).
+ *
+ */
+static int32_t eclitransport_sock_sendv(ecli_transport_t *transport, const struct iovec *iov,
+                                        int32_t iovcnt) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    struct iovec  vec[TRANSPORT_MAX_IOV];
+    struct msghdr msg;
+    int32_t       first = 0;
+    int32_t       total = 0;
+    ssize_t       bytes = 0;
+
+    if ( iovcnt <= 0 || iovcnt > TRANSPORT_MAX_IOV ) {
+        errno = EINVAL;
+        return -1;
+    }
+    memcpy( vec, iov, iovcnt * sizeof( struct iovec ) );
+    memset( &msg, 0, sizeof( msg ) );
+    while ( first < iovcnt ) {
+        msg.msg_iov = vec + first;
+        msg.msg_iovlen = iovcnt - first;
+        if ( ( bytes = sendmsg( transport->socketid, &msg, 0 ) ) < 0 ) {
+            if ( errno == EINTR ) {
+                continue;
+            }
+            return -1;
+        }
+        total += bytes;
+        /* Drop sent vectors, a partly sent one goes on from its remainder */
+        while ( first < iovcnt && ( size_t ) bytes >= vec[first].iov_len ) {
+            bytes -= vec[first].iov_len;
+            first++;
+        }
+        if ( first < iovcnt ) {
+            vec[first].iov_base = ( uint8_t * ) vec[first].iov_base + bytes;
+            vec[first].iov_len -= bytes;
+        }
+    }
+
+    return total;
+}
+
+/**********************************************************************/
+/** Send vectors on stream socket without waiting (short write or EAGAIN).
+ *
+ * @param transport: transport instance.
+ * @param iov: vectors.
+ * @param iovcnt: number of vectors.
+ *
+ */
+static int32_t eclitransport_sock_writev(ecli_transport_t *transport, const struct iovec *iov,
+                                         int32_t iovcnt) {
+
+    struct msghdr msg;
+
+    memset( &msg, 0, sizeof( msg ) );
+    msg.msg_iov = ( struct iovec * ) iov;
+    msg.msg_iovlen = iovcnt;
+
+    return sendmsg( transport->socketid, &msg, MSG_DONTWAIT | MSG_NOSIGNAL );
+}
+
+/**********************************************************************/
+/** Receive from stream socket.
+ *
+ * @param transport: transport instance.
+ * @param buffer: output buffer.
+ * @param count: buffer size.
+ * @param flags: recv flags.
+ *
+ */
+static int32_t eclitransport_sock_recv(ecli_transport_t *transport, void *buffer, int32_t count,
+                                       int32_t flags) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    return recv( transport->socketid, buffer, count, flags );
+}
+
+/**********************************************************************/
+/** Send header and file contents on stream socket (sendfile).
+ *
+ * @param transport: transport instance.
+ * @param header: packet header.
+ * @param header_len: size of header.
+ * @param fd: file descriptor, read from current offset.
+ * @param count: file bytes to send.
+ *
+ */
+static int32_t eclitransport_sock_send_file(ecli_transport_t *transport, const void *header,
+                                            int32_t header_len, int32_t fd, uint32_t count) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    uint8_t  chunk[TRANSPORT_FILE_CHUNK];
+    uint32_t sent  = 0;
+    ssize_t  bytes = 0;
+
+    /* Header goes in the same segment as the first file bytes */
+    while ( sent < ( uint32_t ) header_len ) {
+        if ( ( bytes = send( transport->socketid, ( const uint8_t * ) header + sent,
+                             header_len - sent, MSG_MORE ) ) < 0 ) {
+            if ( errno == EINTR ) {
+                continue;
+            }
+            return -1;
+        }
+        sent += bytes;
+    }
+    sent = 0;
+    /* File pages go from page cache to socket, no user space copy */
+    while ( sent < count ) {
+        bytes = sendfile( transport->socketid, fd, NULL, count - sent );
+        if ( bytes <= 0 ) {
+            if ( bytes < 0 && errno == EINTR ) {
+                continue;
+            }
+            break;
+        }
+        sent += bytes;
+    }
+    /* Files sendfile can not map (pipes, some file systems) are copied */
+    if ( sent == 0 && bytes < 0 && ( errno == EINVAL || errno == ENOSYS ) ) {
+        while ( sent < count ) {
+            bytes = read( fd, chunk, ( count - sent ) < sizeof( chunk ) ?
+                                     ( count - sent ) : sizeof( chunk ) );
+            if ( bytes <= 0 || eclitransport_sock_send( transport, chunk, bytes ) != bytes ) {
+                break;
+            }
+            sent += bytes;
+        }
+    }
+
+    return header_len + sent;
+}
+
+/**********************************************************************/
+/** Close stream socket.
+ *
+ * @param transport: transport instance.
+ *
+ */
+static void eclitransport_sock_close(ecli_transport_t *transport) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    if ( transport->socketid >= 0 ) {
+        close( transport->socketid );
+        transport->socketid = -1;
+    }
+}
+
+/**********************************************************************/
+/** Get stream socket.
+ *
+ * @param transport: transport instance.
+ *
+ */
+static int32_t eclitransport_sock_fd(const ecli_transport_t *transport) {
+
+    return transport->socketid;
+}
+
+/**********************************************************************/
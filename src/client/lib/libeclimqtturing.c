@@ -0,0 +1,970 @@
+/***********************************************************************
+* FILENAME    :   libeclimqtturing.c
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   Library code for io_uring transport with batched
+*                 submission and multishot receive.
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+/**********************************************************************/
+
+#include <libeclimqtturing.h>
+#include <libeclimqttmetrics.h>
+#include <libeclimqttlog.h>
+
+/**********************************************************************/
+/* Raw syscalls, no liburing. Old toolchains without the uapi header
+   (or without provided buffer rings in it) build the fallback only */
+#if defined( __linux__ ) && defined( __has_include )
+#if __has_include( <linux/io_uring.h> )
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#if defined( IORING_RECV_MULTISHOT ) && defined( __NR_io_uring_setup )
+
+/**********************************************************************/
+#define URING_MSG_LEN     256
+/* user_data: connection pointer with operation in the low bits */
+#define URING_OP_SEND     0
+#define URING_OP_RECV     1
+#define URING_OP_CANCEL   2
+#define URING_OP_MASK     3
+#define URING_USER_DATA( conn, op )  ( ( uint64_t ) ( uintptr_t ) ( conn ) | ( op ) )
+
+/**********************************************************************/
+/* Session on the ring (transport ctx) */
+typedef struct {
+    const ecli_transport_ops_t *lower;          /* Socket connect / close / large sends */
+    int32_t  socketid;
+    uint8_t  tx[URING_TX_SIZE];                 /* Queued packets */
+    uint32_t tx_len;
+    uint32_t tx_inflight;                       /* Bytes of submitted send */
+    int32_t  tx_error;                          /* errno of failed send, for next call */
+    uint16_t rx_bids[URING_RX_BUFS];            /* Received buffers, in order */
+    uint32_t rx_lens[URING_RX_BUFS];
+    uint32_t rx_head;
+    uint32_t rx_count;
+    uint32_t rx_offset;                         /* Bytes read of first buffer */
+    int32_t  rx_error;                          /* errno, recv ended */
+    uint8_t  rx_eof;                            /* Broker closed */
+    uint8_t  rx_armed;                          /* recv in flight */
+} eclituring_conn_t;
+
+/* Ring */
+typedef struct {
+    int32_t  ring_fd;
+    uint8_t  *ring_ptr;                         /* SQ and CQ rings mapping */
+    size_t   ring_len;
+    size_t   sqes_len;
+    uint32_t *sq_head;
+    uint32_t *sq_tail;
+    uint32_t *sq_mask;
+    uint32_t *sq_array;
+    uint32_t sq_entries;
+    uint32_t sq_local_tail;                     /* Prepared SQEs end */
+    uint32_t pending;                           /* Prepared, not submitted */
+    struct io_uring_sqe *sqes;
+    uint32_t *cq_head;
+    uint32_t *cq_tail;
+    uint32_t *cq_mask;
+    struct io_uring_cqe *cqes;
+    struct io_uring_buf_ring *buf_ring;         /* Provided receive buffers */
+    uint8_t  *rx_bufs;
+    uint16_t buf_tail;
+    uint8_t  multishot;                         /* Kernel accepts multishot recv */
+    uint32_t batch;
+    uint64_t flush_ns;                          /* Max delay of a queued packet, 0 none */
+    uint32_t queued;                            /* Packets queued, every session */
+    uint64_t queued_ns;                         /* First packet queued */
+    uint32_t inflight_sends;
+    uint64_t enters;
+    uint64_t sends;
+    eclituring_conn_t *conns[URING_MAX_CONNS];
+} eclituring_ring_t;
+
+/**********************************************************************/
+
+static eclituring_ring_t uring;
+static uint8_t           uring_ready = 0;
+
+/**********************************************************************/
+/**********************************************************************/
+/** Connect TCP socket and put it on the ring.
+ *
+ * @param transport: transport instance.
+ * @param timeout_ms: connect timeout in msecs, 0 no timeout.
+ *
+ */
+static int8_t eclituring_tcp_connect(ecli_transport_t *transport, uint32_t timeout_ms);
+
+/**********************************************************************/
+/** Connect Unix domain socket and put it on the ring.
+ *
+ * @param transport: transport instance.
+ * @param timeout_ms: connect timeout in msecs, 0 no timeout.
+ *
+ */
+static int8_t eclituring_unix_connect(ecli_transport_t *transport, uint32_t timeout_ms);
+
+/**********************************************************************/
+/** Put connected socket on the ring and arm receive.
+ *
+ * @param transport: connected transport.
+ * @param lower: socket transport used to connect.
+ *
+ */
+static int8_t eclituring_attach(ecli_transport_t *transport, const ecli_transport_ops_t *lower);
+
+/**********************************************************************/
+/** Queue packet in session batch.
+ *
+ * @param transport: transport instance.
+ * @param buffer: packet buffer.
+ * @param count: size of packet.
+ *
+ */
+static int32_t eclituring_send(ecli_transport_t *transport, const void *buffer, int32_t count);
+
+/**********************************************************************/
+/** Queue packet parts in session batch.
+ *
+ * @param transport: transport instance.
+ * @param iov: vectors.
+ * @param iovcnt: number of vectors.
+ *
+ */
+static int32_t eclituring_sendv(ecli_transport_t *transport, const struct iovec *iov, int32_t iovcnt);
+
+/**********************************************************************/
+/** Read received data, waiting on the ring (queued sends go first).
+ *
+ * @param transport: transport instance.
+ * @param buffer: output buffer.
+ * @param count: buffer size.
+ * @param flags: MSG_WAITALL supported.
+ *
+ */
+static int32_t eclituring_recv(ecli_transport_t *transport, void *buffer, int32_t count, int32_t flags);
+
+/**********************************************************************/
+/** Send header and file, after queued packets (sendfile on socket).
+ *
+ * @param transport: transport instance.
+ * @param header: packet header.
+ * @param header_len: size of header.
+ * @param fd: file descriptor, read from current offset.
+ * @param count: file bytes to send.
+ *
+ */
+static int32_t eclituring_send_file(ecli_transport_t *transport, const void *header,
+                                    int32_t header_len, int32_t fd, uint32_t count);
+
+/**********************************************************************/
+/** Send queued packets, cancel receive and close socket.
+ *
+ * @param transport: transport instance.
+ *
+ */
+static void eclituring_close(ecli_transport_t *transport);
+
+/**********************************************************************/
+/** Get socket of session.
+ *
+ * @param transport: transport instance.
+ *
+ */
+static int32_t eclituring_fd(const ecli_transport_t *transport);
+
+/**********************************************************************/
+/** Get a free SQE, submitting prepared ones when the SQ is full.
+ *
+ */
+static struct io_uring_sqe *eclituring_sqe(void);
+
+/**********************************************************************/
+/** Submit prepared SQEs and wait for completions.
+ *
+ * @param min_complete: completions to wait for, 0 submit only.
+ * @param timeout_ms: wait timeout in msecs, 0 no timeout.
+ *
+ */
+static int32_t eclituring_enter(uint32_t min_complete, uint32_t timeout_ms);
+
+/**********************************************************************/
+/** Process completions.
+ *
+ */
+static void eclituring_reap(void);
+
+/**********************************************************************/
+/** Prepare send of session batch.
+ *
+ * @param conn: session.
+ *
+ */
+static void eclituring_prep_send(eclituring_conn_t *conn);
+
+/**********************************************************************/
+/** Prepare receive of session with a provided buffer.
+ *
+ * @param conn: session.
+ *
+ */
+static void eclituring_prep_recv(eclituring_conn_t *conn);
+
+/**********************************************************************/
+/** Give receive buffer back to the kernel.
+ *
+ * @param bid: buffer id.
+ *
+ */
+static void eclituring_recycle(uint16_t bid);
+
+/**********************************************************************/
+/** Unmap rings, free receive buffers and close ring (failed init).
+ *
+ */
+static void eclituring_unmap(void);
+
+/**********************************************************************/
+
+const ecli_transport_ops_t eclituring_tcp = {
+    .name      = "tcp+io_uring",
+    .connect   = eclituring_tcp_connect,
+    .send      = eclituring_send,
+    .sendv     = eclituring_sendv,
+    .recv      = eclituring_recv,
+    .send_file = eclituring_send_file,
+    .close     = eclituring_close,
+    .fd        = eclituring_fd,
+};
+
+const ecli_transport_ops_t eclituring_unix = {
+    .name      = "unix+io_uring",
+    .connect   = eclituring_unix_connect,
+    .send      = eclituring_send,
+    .sendv     = eclituring_sendv,
+    .recv      = eclituring_recv,
+    .send_file = eclituring_send_file,
+    .close     = eclituring_close,
+    .fd        = eclituring_fd,
+};
+
+/**********************************************************************/
+/**********************************************************************/
+/** Create ring and register receive buffers, fails when the kernel
+ * does not support what is needed (caller uses socket transports).
+ *
+ * @param batch: queued packets that trigger a submission.
+ * @param flush_us: max usecs a queued packet waits for the batch, 0 no limit.
+ *
+ */
+int8_t eclituring_init(uint32_t batch, uint32_t flush_us) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    struct io_uring_params  params;
+    struct io_uring_buf_reg reg;
+    char     buffer_str[URING_MSG_LEN] = {0};
+    uint8_t  *cq_ptr;
+    size_t   sq_len;
+    size_t   cq_len;
+    uint32_t i;
+
+    if ( uring_ready ) {
+        return 0;
+    }
+    memset( &uring, 0, sizeof( uring ) );
+    uring.ring_ptr = MAP_FAILED;
+    uring.sqes = MAP_FAILED;
+    uring.buf_ring = MAP_FAILED;
+    uring.batch = batch ? batch : URING_BATCH_DEFAULT;
+    uring.flush_ns = flush_us * 1000ULL;
+    /* Completion work runs when we wait, no interrupts to this task */
+    memset( &params, 0, sizeof( params ) );
+    params.flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+    uring.ring_fd = syscall( __NR_io_uring_setup, URING_ENTRIES, &params );
+    if ( uring.ring_fd < 0 && errno == EINVAL ) {
+        memset( &params, 0, sizeof( params ) );
+        uring.ring_fd = syscall( __NR_io_uring_setup, URING_ENTRIES, &params );
+    }
+    if ( uring.ring_fd < 0 ) {
+        snprintf( buffer_str, sizeof( buffer_str ), "io_uring_setup: %s", strerror( errno ) );
+        eclilog_show(__FILE__, __func__, buffer_str, LOG_DEBUG);
+        return -1;
+    }
+    /* Receive timeouts need the extended enter argument (5.11) */
+    if ( !( params.features & IORING_FEAT_SINGLE_MMAP ) ||
+         !( params.features & IORING_FEAT_EXT_ARG ) ) {
+        eclilog_show(__FILE__, __func__, "io_uring: kernel too old", LOG_DEBUG);
+        eclituring_unmap();
+        return -1;
+    }
+    sq_len = params.sq_off.array + params.sq_entries * sizeof( uint32_t );
+    cq_len = params.cq_off.cqes + params.cq_entries * sizeof( struct io_uring_cqe );
+    uring.ring_len = sq_len > cq_len ? sq_len : cq_len;
+    uring.sqes_len = params.sq_entries * sizeof( struct io_uring_sqe );
+    uring.ring_ptr = mmap( NULL, uring.ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                           uring.ring_fd, IORING_OFF_SQ_RING );
+    uring.sqes = mmap( NULL, uring.sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       uring.ring_fd, IORING_OFF_SQES );
+    if ( uring.ring_ptr == MAP_FAILED || uring.sqes == MAP_FAILED ) {
+        eclituring_unmap();
+        return -1;
+    }
+    cq_ptr = uring.ring_ptr;
+    uring.sq_head = ( uint32_t * ) ( uring.ring_ptr + params.sq_off.head );
+    uring.sq_tail = ( uint32_t * ) ( uring.ring_ptr + params.sq_off.tail );
+    uring.sq_mask = ( uint32_t * ) ( uring.ring_ptr + params.sq_off.ring_mask );
+    uring.sq_array = ( uint32_t * ) ( uring.ring_ptr + params.sq_off.array );
+    uring.sq_entries = params.sq_entries;
+    uring.sq_local_tail = *uring.sq_tail;
+    uring.cq_head = ( uint32_t * ) ( cq_ptr + params.cq_off.head );
+    uring.cq_tail = ( uint32_t * ) ( cq_ptr + params.cq_off.tail );
+    uring.cq_mask = ( uint32_t * ) ( cq_ptr + params.cq_off.ring_mask );
+    uring.cqes = ( struct io_uring_cqe * ) ( cq_ptr + params.cq_off.cqes );
+
+    /* Receive buffers: kernel picks one per completion, no buffer per socket */
+    uring.buf_ring = mmap( NULL, URING_RX_BUFS * sizeof( struct io_uring_buf ),
+                           PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    uring.rx_bufs = malloc( URING_RX_BUFS * URING_RX_BUF_SIZE );
+    if ( uring.buf_ring == MAP_FAILED || uring.rx_bufs == NULL ) {
+        eclituring_unmap();
+        return -1;
+    }
+    memset( &reg, 0, sizeof( reg ) );
+    reg.ring_addr = ( uint64_t ) ( uintptr_t ) uring.buf_ring;
+    reg.ring_entries = URING_RX_BUFS;
+    reg.bgid = URING_BGID;
+    if ( syscall( __NR_io_uring_register, uring.ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1 ) < 0 ) {
+        snprintf( buffer_str, sizeof( buffer_str ), "io_uring buffer ring: %s", strerror( errno ) );
+        eclilog_show(__FILE__, __func__, buffer_str, LOG_DEBUG);
+        eclituring_unmap();
+        return -1;
+    }
+    for ( i = 0; i < URING_RX_BUFS; i++ ) {
+        eclituring_recycle( i );
+    }
+    uring.multishot = 1;
+    uring_ready = 1;
+    snprintf( buffer_str, sizeof( buffer_str ), "io_uring: %u entries, batch %u, flush %u usecs, %u x %u rx buffers",
+              uring.sq_entries, uring.batch, flush_us, URING_RX_BUFS, URING_RX_BUF_SIZE );
+    eclilog_show(__FILE__, __func__, buffer_str, LOG_DEBUG);
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Submit queued sends of every session and wait for them.
+ *
+ */
+void eclituring_flush(void) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    uint32_t i;
+
+    if ( !uring_ready ) {
+        return;
+    }
+    for ( i = 0; i < URING_MAX_CONNS; i++ ) {
+        if ( uring.conns[i] != NULL ) {
+            eclituring_prep_send( uring.conns[i] );
+        }
+    }
+    uring.queued = 0;
+    /* One enter submits every session batch, sends on sockets with room
+       complete inline so this rarely waits */
+    while ( uring.pending || uring.inflight_sends ) {
+        if ( eclituring_enter( uring.inflight_sends, 0 ) < 0 && errno != EINTR ) {
+            break;
+        }
+        eclituring_reap();
+    }
+}
+
+/**********************************************************************/
+/** Get io_uring_enter calls and submitted sends so far.
+ *
+ * @param enters: io_uring_enter calls.
+ * @param sends: send operations (each one a batch of packets).
+ *
+ */
+void eclituring_stats(uint64_t *enters, uint64_t *sends) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    *enters = uring.enters;
+    *sends = uring.sends;
+}
+
+/**********************************************************************/
+/**********************************************************************/
+/** Connect TCP socket and put it on the ring.
+ *
+ * @param transport: transport instance.
+ * @param timeout_ms: connect timeout in msecs, 0 no timeout.
+ *
+ */
+static int8_t eclituring_tcp_connect(ecli_transport_t *transport, uint32_t timeout_ms) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    if ( eclitransport_tcp.connect( transport, timeout_ms ) < 0 ) {
+        return TRANSPORT_CONN_ERROR;
+    }
+
+    return eclituring_attach( transport, &eclitransport_tcp );
+}
+
+/**********************************************************************/
+/** Connect Unix domain socket and put it on the ring.
+ *
+ * @param transport: transport instance.
+ * @param timeout_ms: connect timeout in msecs, 0 no timeout.
+ *
+ */
+static int8_t eclituring_unix_connect(ecli_transport_t *transport, uint32_t timeout_ms) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    if ( eclitransport_unix.connect( transport, timeout_ms ) < 0 ) {
+        return TRANSPORT_CONN_ERROR;
+    }
+
+    return eclituring_attach( transport, &eclitransport_unix );
+}
+
+/**********************************************************************/
+/** Put connected socket on the ring and arm receive.
+ *
+ * @param transport: connected transport.
+ * @param lower: socket transport used to connect.
+ *
+ */
+static int8_t eclituring_attach(ecli_transport_t *transport, const ecli_transport_ops_t *lower) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    eclituring_conn_t *conn;
+    uint32_t i;
+
+    for ( i = 0; i < URING_MAX_CONNS && uring.conns[i] != NULL; i++ );
+    if ( !uring_ready || i == URING_MAX_CONNS ||
+         ( conn = calloc( 1, sizeof( eclituring_conn_t ) ) ) == NULL ) {
+        lower->close( transport );
+        errno = ENOMEM;
+        return TRANSPORT_CONN_ERROR;
+    }
+    conn->lower = lower;
+    conn->socketid = transport->socketid;
+    uring.conns[i] = conn;
+    transport->ctx = conn;
+    /* Submitted with the first send (CONNECT) */
+    eclituring_prep_recv( conn );
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Queue packet in session batch.
+ *
+ * @param transport: transport instance.
+ * @param buffer: packet buffer.
+ * @param count: size of packet.
+ *
+ */
+static int32_t eclituring_send(ecli_transport_t *transport, const void *buffer, int32_t count) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    struct iovec iov = { .iov_base = ( void * ) buffer, .iov_len = count };
+
+    return eclituring_sendv( transport, &iov, 1 );
+}
+
+/**********************************************************************/
+/** Queue packet parts in session batch.
+ *
+ * @param transport: transport instance.
+ * @param iov: vectors.
+ * @param iovcnt: number of vectors.
+ *
+ */
+static int32_t eclituring_sendv(ecli_transport_t *transport, const struct iovec *iov, int32_t iovcnt) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    eclituring_conn_t *conn = transport->ctx;
+    uint32_t count = 0;
+    int32_t  i;
+
+    if ( conn == NULL ) {
+        errno = EBADF;
+        return -1;
+    }
+    for ( i = 0; i < iovcnt; i++ ) {
+        count += iov[i].iov_len;
+    }
+    /* Batch buffer is in use until its send completes */
+    if ( conn->tx_inflight || count > URING_TX_SIZE - conn->tx_len ) {
+        eclituring_flush();
+    }
+    if ( conn->tx_error ) {
+        errno = conn->tx_error;
+        conn->tx_error = 0;
+        return -1;
+    }
+    /* Larger than a batch: straight to the socket, after queued ones */
+    if ( count > URING_TX_SIZE ) {
+        return conn->lower->sendv( transport, iov, iovcnt );
+    }
+    for ( i = 0; i < iovcnt; i++ ) {
+        memcpy( conn->tx + conn->tx_len, iov[i].iov_base, iov[i].iov_len );
+        conn->tx_len += iov[i].iov_len;
+    }
+    /* Batch full, or its first packet waited flush_us */
+    if ( uring.queued++ == 0 && uring.flush_ns ) {
+        uring.queued_ns = eclimetrics_now();
+    }
+    if ( uring.queued >= uring.batch ||
+         ( uring.flush_ns && eclimetrics_now() - uring.queued_ns >= uring.flush_ns ) ) {
+        eclituring_flush();
+    }
+
+    return count;
+}
+
+/**********************************************************************/
+/** Read received data, waiting on the ring (queued sends go first).
+ *
+ * @param transport: transport instance.
+ * @param buffer: output buffer.
+ * @param count: buffer size.
+ * @param flags: MSG_WAITALL supported.
+ *
+ */
+static int32_t eclituring_recv(ecli_transport_t *transport, void *buffer, int32_t count, int32_t flags) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    eclituring_conn_t *conn = transport->ctx;
+    int32_t  total = 0;
+    uint32_t bytes = 0;
+    uint32_t i;
+
+    if ( conn == NULL ) {
+        errno = EBADF;
+        return -1;
+    }
+    /* Request goes with the same enter that waits for the reply */
+    for ( i = 0; i < URING_MAX_CONNS; i++ ) {
+        if ( uring.conns[i] != NULL ) {
+            eclituring_prep_send( uring.conns[i] );
+        }
+    }
+    uring.queued = 0;
+    for ( ;; ) {
+        /* Copy from received buffers, giving consumed ones back */
+        while ( conn->rx_count && total < count ) {
+            uint16_t bid = conn->rx_bids[conn->rx_head];
+            uint32_t len = conn->rx_lens[conn->rx_head];
+            bytes = len - conn->rx_offset;
+            if ( bytes > ( uint32_t ) ( count - total ) ) {
+                bytes = count - total;
+            }
+            memcpy( ( uint8_t * ) buffer + total,
+                    uring.rx_bufs + bid * URING_RX_BUF_SIZE + conn->rx_offset, bytes );
+            total += bytes;
+            conn->rx_offset += bytes;
+            if ( conn->rx_offset == len ) {
+                eclituring_recycle( bid );
+                conn->rx_head = ( conn->rx_head + 1 ) % URING_RX_BUFS;
+                conn->rx_count--;
+                conn->rx_offset = 0;
+            }
+        }
+        if ( total == count || ( total && !( flags & MSG_WAITALL ) ) ) {
+            break;
+        }
+        if ( conn->tx_error && !total ) {
+            errno = conn->tx_error;
+            conn->tx_error = 0;
+            return -1;
+        }
+        if ( conn->rx_eof ) {
+            break;
+        }
+        if ( conn->rx_error ) {
+            errno = conn->rx_error;
+            return total ? total : -1;
+        }
+        /* Re-arm after buffer shortage or single shot completion */
+        if ( !conn->rx_armed ) {
+            eclituring_prep_recv( conn );
+        }
+        if ( eclituring_enter( 1, transport->recv_timeout_ms ) < 0 ) {
+            if ( errno == ETIME ) {
+                errno = EAGAIN;
+                return total ? total : -1;
+            }
+            if ( errno != EINTR ) {
+                return total ? total : -1;
+            }
+            /* Packets queued by a signal handler go out now */
+            for ( i = 0; i < URING_MAX_CONNS; i++ ) {
+                if ( uring.conns[i] != NULL ) {
+                    eclituring_prep_send( uring.conns[i] );
+                }
+            }
+        }
+        eclituring_reap();
+    }
+
+    return total;
+}
+
+/**********************************************************************/
+/** Send header and file, after queued packets (sendfile on socket).
+ *
+ * @param transport: transport instance.
+ * @param header: packet header.
+ * @param header_len: size of header.
+ * @param fd: file descriptor, read from current offset.
+ * @param count: file bytes to send.
+ *
+ */
+static int32_t eclituring_send_file(ecli_transport_t *transport, const void *header,
+                                    int32_t header_len, int32_t fd, uint32_t count) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    eclituring_conn_t *conn = transport->ctx;
+
+    if ( conn == NULL ) {
+        errno = EBADF;
+        return -1;
+    }
+    eclituring_flush();
+    if ( conn->tx_error ) {
+        errno = conn->tx_error;
+        conn->tx_error = 0;
+        return -1;
+    }
+
+    return conn->lower->send_file( transport, header, header_len, fd, count );
+}
+
+/**********************************************************************/
+/** Send queued packets, cancel receive and close socket.
+ *
+ * @param transport: transport instance.
+ *
+ */
+static void eclituring_close(ecli_transport_t *transport) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    eclituring_conn_t   *conn = transport->ctx;
+    struct io_uring_sqe *sqe;
+    uint32_t i;
+
+    if ( conn != NULL ) {
+        eclituring_flush();
+        /* Completions carry conn, wait for the last one before free */
+        if ( conn->rx_armed && ( sqe = eclituring_sqe() ) != NULL ) {
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = -1;
+            sqe->addr = URING_USER_DATA( conn, URING_OP_RECV );
+            sqe->user_data = URING_USER_DATA( conn, URING_OP_CANCEL );
+        }
+        while ( conn->rx_armed ) {
+            if ( eclituring_enter( 1, 0 ) < 0 && errno != EINTR ) {
+                break;
+            }
+            eclituring_reap();
+        }
+        while ( conn->rx_count ) {
+            eclituring_recycle( conn->rx_bids[conn->rx_head] );
+            conn->rx_head = ( conn->rx_head + 1 ) % URING_RX_BUFS;
+            conn->rx_count--;
+        }
+        for ( i = 0; i < URING_MAX_CONNS; i++ ) {
+            if ( uring.conns[i] == conn ) {
+                uring.conns[i] = NULL;
+            }
+        }
+        transport->ctx = NULL;
+        conn->lower->close( transport );
+        free( conn );
+    }
+    else {
+        eclitransport_tcp.close( transport );
+    }
+}
+
+/**********************************************************************/
+/** Get socket of session.
+ *
+ * @param transport: transport instance.
+ *
+ */
+static int32_t eclituring_fd(const ecli_transport_t *transport) {
+
+    return transport->socketid;
+}
+
+/**********************************************************************/
+/** Get a free SQE, submitting prepared ones when the SQ is full.
+ *
+ */
+static struct io_uring_sqe *eclituring_sqe(void) {
+
+    struct io_uring_sqe *sqe;
+    uint32_t index;
+
+    if ( uring.sq_local_tail - __atomic_load_n( uring.sq_head, __ATOMIC_ACQUIRE ) >= uring.sq_entries ) {
+        eclituring_enter( 0, 0 );
+        if ( uring.sq_local_tail - __atomic_load_n( uring.sq_head, __ATOMIC_ACQUIRE ) >= uring.sq_entries ) {
+            return NULL;
+        }
+    }
+    index = uring.sq_local_tail & *uring.sq_mask;
+    sqe = &uring.sqes[index];
+    memset( sqe, 0, sizeof( struct io_uring_sqe ) );
+    uring.sq_array[index] = index;
+    uring.sq_local_tail++;
+    uring.pending++;
+
+    return sqe;
+}
+
+/**********************************************************************/
+/** Submit prepared SQEs and wait for completions.
+ *
+ * @param min_complete: completions to wait for, 0 submit only.
+ * @param timeout_ms: wait timeout in msecs, 0 no timeout.
+ *
+ */
+static int32_t eclituring_enter(uint32_t min_complete, uint32_t timeout_ms) {
+
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec      ts;
+    uint32_t flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+    int32_t  result;
+
+    /* SQEs are visible to the kernel before the new tail */
+    __atomic_store_n( uring.sq_tail, uring.sq_local_tail, __ATOMIC_RELEASE );
+    memset( &arg, 0, sizeof( arg ) );
+    if ( min_complete && timeout_ms ) {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = ( timeout_ms % 1000 ) * 1000000L;
+        arg.ts = ( uint64_t ) ( uintptr_t ) &ts;
+        arg.sigmask_sz = _NSIG / 8;
+        flags |= IORING_ENTER_EXT_ARG;
+    }
+    uring.enters++;
+    result = syscall( __NR_io_uring_enter, uring.ring_fd, uring.pending, min_complete, flags,
+                      ( flags & IORING_ENTER_EXT_ARG ) ? ( void * ) &arg : NULL,
+                      ( flags & IORING_ENTER_EXT_ARG ) ? sizeof( arg ) : 0 );
+    /* Submitted count is returned even if the wait was interrupted */
+    if ( result > 0 ) {
+        uring.pending -= ( ( uint32_t ) result < uring.pending ) ? ( uint32_t ) result : uring.pending;
+    }
+
+    return result;
+}
+
+/**********************************************************************/
+/** Process completions.
+ *
+ */
+static void eclituring_reap(void) {
+
+    struct io_uring_cqe *cqe;
+    eclituring_conn_t   *conn;
+    uint32_t head = *uring.cq_head;
+    uint32_t tail = __atomic_load_n( uring.cq_tail, __ATOMIC_ACQUIRE );
+    uint32_t slot;
+    int32_t  sent;
+
+    for ( ; head != tail; head++ ) {
+        cqe = &uring.cqes[head & *uring.cq_mask];
+        conn = ( eclituring_conn_t * ) ( uintptr_t ) ( cqe->user_data & ~( uint64_t ) URING_OP_MASK );
+        switch ( cqe->user_data & URING_OP_MASK ) {
+            case URING_OP_SEND:
+                uring.inflight_sends--;
+                if ( cqe->res < 0 ) {
+                    conn->tx_error = -cqe->res;
+                }
+                else if ( ( uint32_t ) cqe->res < conn->tx_inflight ) {
+                    /* Kernels without MSG_WAITALL retry stop short, finish in place */
+                    sent = cqe->res;
+                    while ( sent < ( int32_t ) conn->tx_inflight ) {
+                        int32_t bytes = send( conn->socketid, conn->tx + sent,
+                                              conn->tx_inflight - sent, 0 );
+                        if ( bytes <= 0 ) {
+                            if ( bytes < 0 && errno == EINTR ) {
+                                continue;
+                            }
+                            conn->tx_error = bytes < 0 ? errno : EPIPE;
+                            break;
+                        }
+                        sent += bytes;
+                    }
+                }
+                conn->tx_len = 0;
+                conn->tx_inflight = 0;
+                break;
+            case URING_OP_RECV:
+                if ( cqe->res > 0 && ( cqe->flags & IORING_CQE_F_BUFFER ) ) {
+                    slot = ( conn->rx_head + conn->rx_count ) % URING_RX_BUFS;
+                    conn->rx_bids[slot] = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+                    conn->rx_lens[slot] = cqe->res;
+                    conn->rx_count++;
+                }
+                else if ( cqe->res == 0 ) {
+                    conn->rx_eof = 1;
+                }
+                else if ( cqe->res == -EINVAL && uring.multishot ) {
+                    /* Kernel before 6.0: one shot receives from now on */
+                    uring.multishot = 0;
+                }
+                else if ( cqe->res != -ENOBUFS && cqe->res != -ECANCELED ) {
+                    conn->rx_error = -cqe->res;
+                }
+                if ( !( cqe->flags & IORING_CQE_F_MORE ) ) {
+                    conn->rx_armed = 0;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    __atomic_store_n( uring.cq_head, head, __ATOMIC_RELEASE );
+}
+
+/**********************************************************************/
+/** Prepare send of session batch.
+ *
+ * @param conn: session.
+ *
+ */
+static void eclituring_prep_send(eclituring_conn_t *conn) {
+
+    struct io_uring_sqe *sqe;
+
+    if ( conn->tx_len == 0 || conn->tx_inflight || ( sqe = eclituring_sqe() ) == NULL ) {
+        return;
+    }
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = conn->socketid;
+    sqe->addr = ( uint64_t ) ( uintptr_t ) conn->tx;
+    sqe->len = conn->tx_len;
+    sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+    sqe->user_data = URING_USER_DATA( conn, URING_OP_SEND );
+    conn->tx_inflight = conn->tx_len;
+    uring.inflight_sends++;
+    uring.sends++;
+}
+
+/**********************************************************************/
+/** Prepare receive of session with a provided buffer.
+ *
+ * @param conn: session.
+ *
+ */
+static void eclituring_prep_recv(eclituring_conn_t *conn) {
+
+    struct io_uring_sqe *sqe;
+
+    if ( conn->rx_armed || ( sqe = eclituring_sqe() ) == NULL ) {
+        return;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->socketid;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    sqe->ioprio = uring.multishot ? IORING_RECV_MULTISHOT : 0;
+    sqe->user_data = URING_USER_DATA( conn, URING_OP_RECV );
+    conn->rx_armed = 1;
+}
+
+/**********************************************************************/
+/** Give receive buffer back to the kernel.
+ *
+ * @param bid: buffer id.
+ *
+ */
+static void eclituring_recycle(uint16_t bid) {
+
+    struct io_uring_buf *buf = &uring.buf_ring->bufs[uring.buf_tail & ( URING_RX_BUFS - 1 )];
+
+    buf->addr = ( uint64_t ) ( uintptr_t ) ( uring.rx_bufs + bid * URING_RX_BUF_SIZE );
+    buf->len = URING_RX_BUF_SIZE;
+    buf->bid = bid;
+    uring.buf_tail++;
+    __atomic_store_n( &uring.buf_ring->tail, uring.buf_tail, __ATOMIC_RELEASE );
+}
+
+/**********************************************************************/
+/** Unmap rings, free receive buffers and close ring (failed init).
+ *
+ */
+static void eclituring_unmap(void) {
+
+    if ( uring.buf_ring != MAP_FAILED ) {
+        munmap( uring.buf_ring, URING_RX_BUFS * sizeof( struct io_uring_buf ) );
+    }
+    if ( uring.sqes != MAP_FAILED ) {
+        munmap( uring.sqes, uring.sqes_len );
+    }
+    if ( uring.ring_ptr != MAP_FAILED ) {
+        munmap( uring.ring_ptr, uring.ring_len );
+    }
+    free( uring.rx_bufs );
+    close( uring.ring_fd );
+    memset( &uring, 0, sizeof( uring ) );
+}
+
+/**********************************************************************/
+#else /* IORING_RECV_MULTISHOT */
+
+/**********************************************************************/
+/** Create ring, io_uring not available in this build.
+ *
+ */
+int8_t eclituring_init(uint32_t batch, uint32_t flush_us) {
+    eclilog_show(__FILE__, __func__, "", LOG_TRACE);
+
+    errno = ENOSYS;
+
+    return -1;
+}
+
+/**********************************************************************/
+/** Submit queued sends, nothing to do.
+ *
+ */
+void eclituring_flush(void) {
+}
+
+/**********************************************************************/
+/** Get io_uring_enter calls and submitted sends so far.
+ *
+ */
+void eclituring_stats(uint64_t *enters, uint64_t *sends) {
+    *enters = 0;
+    *sends = 0;
+}
+
+/**********************************************************************/
+/* Never selected, eclituring_init fails */
+const ecli_transport_ops_t eclituring_tcp = { .name = "tcp+io_uring" };
+const ecli_transport_ops_t eclituring_unix = { .name = "unix+io_uring" };
+
+#endif /* IORING_RECV_MULTISHOT */
+
+/**********************************************************************/
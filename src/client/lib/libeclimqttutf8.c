@@ -0,0 +1,541 @@
+/***********************************************************************
+* FILENAME    :   libeclimqttutf8.c
+* AUTHOR      :   Arturo Plauchu (arturo.plauchu@gmail.com)
+* DATE        :   November 2018
+* DESCRIPTION :   Library code for UTF-8 validation of topics, filters
+*                 and text payloads with runtime CPU dispatch.
+* LICENSE     :   GPL v2.0
+*
+***********************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+/**********************************************************************/
+
+#include <libeclimqttutf8.h>
+
+/**********************************************************************/
+#define UTF8_IMPL_LEN         32
+#define UTF8_FORBID_MAX       3         /* ASCII bytes rejected per check */
+#define UTF8_FORBID_NONE      0xFF      /* Never in UTF-8, rejects nothing more */
+#define UTF8_LOW_BITS         0x0101010101010101ULL
+#define UTF8_HIGH_BITS        0x8080808080808080ULL
+#define UTF8_ZERO_BYTE(x)     ( ( ( x ) - UTF8_LOW_BITS ) & ~( x ) & UTF8_HIGH_BITS )
+/* Errors of a byte pair, found in all three lookups of the pair */
+#define UTF8_TOO_SHORT        0x01      /* Lead byte not followed by continuation */
+#define UTF8_TOO_LONG         0x02      /* Continuation after ASCII */
+#define UTF8_OVERLONG_3       0x04      /* E0 80..9F */
+#define UTF8_TOO_LARGE        0x08      /* F4 90..BF, F5..FF */
+#define UTF8_SURROGATE        0x10      /* ED A0..BF */
+#define UTF8_OVERLONG_2       0x20      /* C0..C1 */
+#define UTF8_TOO_LARGE_1000   0x40      /* F5..FF 80..8F */
+#define UTF8_OVERLONG_4       0x40      /* F0 80..8F */
+#define UTF8_TWO_CONTS        0x80      /* Continuation after continuation, unless 3rd or 4th byte */
+#define UTF8_CARRY            ( UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS )
+
+/**********************************************************************/
+/* Check buffer, forbid holds UTF8_FORBID_MAX ASCII bytes to reject */
+typedef int8_t (*ecliutf8_check_f)(const uint8_t *buffer, size_t len, const uint8_t *forbid);
+
+/**********************************************************************/
+/* Lookups of high nibble of first byte, low nibble of first byte and
+ * high nibble of second byte of each pair */
+static const uint8_t utf8_byte1_high[16] = {
+    /* 0_______ ASCII */
+    UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+    UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+    /* 10______ continuation */
+    UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+    /* 1100____ 1101____ two bytes lead */
+    UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+    UTF8_TOO_SHORT,
+    /* 1110____ three bytes lead */
+    UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+    /* 1111____ four bytes lead */
+    UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+};
+
+static const uint8_t utf8_byte1_low[16] = {
+    UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4,
+    UTF8_CARRY | UTF8_OVERLONG_2,
+    UTF8_CARRY,
+    UTF8_CARRY,
+    UTF8_CARRY | UTF8_TOO_LARGE,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+};
+
+static const uint8_t utf8_byte2_high[16] = {
+    /* ASCII after a lead byte */
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+    /* 1000____ */
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+    /* 1001____ */
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE,
+    /* 101_____ */
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+    /* Lead byte after a lead byte */
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+};
+
+/* Block ends with a sequence that goes on in next block (subtracted
+ * from last 32 or 16 bytes, not zero when cut) */
+static const uint8_t utf8_tail[32] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xEF, 0xDF, 0xBF,
+};
+
+static const uint8_t utf8_forbid_text[UTF8_FORBID_MAX] = { UTF8_FORBID_NONE, UTF8_FORBID_NONE, UTF8_FORBID_NONE };
+static const uint8_t utf8_forbid_topic[UTF8_FORBID_MAX] = { 0x00, UTF8_SINGLE_LEVEL, UTF8_MULTI_LEVEL };
+static const uint8_t utf8_forbid_filter[UTF8_FORBID_MAX] = { 0x00, UTF8_FORBID_NONE, UTF8_FORBID_NONE };
+
+/**********************************************************************/
+static pthread_once_t   utf8_once = PTHREAD_ONCE_INIT;
+static ecliutf8_check_f utf8_check;
+static const char       *utf8_name;
+static char             utf8_impl_str[UTF8_IMPL_LEN];
+
+/**********************************************************************/
+/**********************************************************************/
+/** Pick implementation, once
+ *
+ */
+static void ecliutf8_init(void);
+
+/**********************************************************************/
+/** Pick implementation for the running CPU
+ *
+ * @param portable: TRUE_FLAG for portable code only.
+ *
+ */
+static void ecliutf8_select(uint8_t portable);
+
+/**********************************************************************/
+/** Check UTF-8, 8 ASCII bytes per step (portable)
+ *
+ * @param buffer: data.
+ * @param len: data size.
+ * @param forbid: ASCII bytes to reject.
+ *
+ */
+static int8_t ecliutf8_check_scalar(const uint8_t *buffer, size_t len, const uint8_t *forbid);
+
+#if defined(__x86_64__)
+/**********************************************************************/
+/** Check bytes after the vector blocks, from the last character of the
+ * blocks (it may go on after them).
+ *
+ * @param buffer: data.
+ * @param pos: end of vector blocks.
+ * @param len: data size.
+ * @param forbid: ASCII bytes to reject.
+ *
+ */
+static int8_t ecliutf8_check_tail(const uint8_t *buffer, size_t pos, size_t len, const uint8_t *forbid);
+
+/**********************************************************************/
+/** Check UTF-8, 16 (SSSE3) or 32 (AVX2) bytes at once
+ *
+ * @param buffer: data.
+ * @param len: data size.
+ * @param forbid: ASCII bytes to reject.
+ *
+ */
+static int8_t ecliutf8_check_ssse3(const uint8_t *buffer, size_t len, const uint8_t *forbid);
+static int8_t ecliutf8_check_avx2(const uint8_t *buffer, size_t len, const uint8_t *forbid);
+#endif
+
+/**********************************************************************/
+/**********************************************************************/
+/** Check text payload, returns 0 when it is well-formed UTF-8, -1 if not.
+ *
+ * @param buffer: payload.
+ * @param len: payload size.
+ *
+ */
+int8_t ecliutf8_text(const void *buffer, size_t len) {
+
+    pthread_once( &utf8_once, ecliutf8_init );
+
+    return utf8_check( buffer, len, utf8_forbid_text );
+}
+
+/**********************************************************************/
+/** Check topic name (publish), returns 0 valid, -1 not.
+ *
+ * @param topic: topic, not NUL terminated.
+ * @param len: topic size.
+ *
+ */
+int8_t ecliutf8_topic(const char *topic, size_t len) {
+
+    pthread_once( &utf8_once, ecliutf8_init );
+    if ( len == 0 || len > UTF8_STRING_MAX ) {
+        return -1;
+    }
+
+    return utf8_check( ( const uint8_t * ) topic, len, utf8_forbid_topic );
+}
+
+/**********************************************************************/
+/** Check topic filter (subscribe), returns 0 valid, -1 not.
+ *
+ * @param filter: filter, not NUL terminated.
+ * @param len: filter size.
+ *
+ */
+int8_t ecliutf8_filter(const char *filter, size_t len) {
+
+    const char *end = filter + len;
+    const char *wild = filter;
+
+    pthread_once( &utf8_once, ecliutf8_init );
+    if ( len == 0 || len > UTF8_STRING_MAX ||
+         utf8_check( ( const uint8_t * ) filter, len, utf8_forbid_filter ) < 0 ) {
+        return -1;
+    }
+    /* Wildcards: whole level, # only the last one */
+    for ( wild = filter; wild < end; wild++ ) {
+        if ( *wild != UTF8_SINGLE_LEVEL && *wild != UTF8_MULTI_LEVEL ) {
+            continue;
+        }
+        if ( ( wild > filter && wild[-1] != UTF8_LEVEL_SEPARATOR ) ||
+             ( wild + 1 < end && ( wild[1] != UTF8_LEVEL_SEPARATOR || *wild == UTF8_MULTI_LEVEL ) ) ) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**********************************************************************/
+/** Topic name matches filter (+ and # wildcards, "a/#" also matches
+ * "a"), returns 1 when it does, 0 when not.
+ *
+ * @param filter: filter, NUL terminated.
+ * @param topic: topic, not NUL terminated.
+ * @param len: topic size.
+ *
+ */
+uint8_t ecliutf8_match(const char *filter, const char *topic, size_t len) {
+
+    size_t i = 0;
+
+    while ( *filter ) {
+        if ( *filter == UTF8_MULTI_LEVEL ) {
+            return 1;
+        }
+        if ( *filter == UTF8_SINGLE_LEVEL ) {
+            while ( i < len && topic[i] != UTF8_LEVEL_SEPARATOR ) {
+                i++;
+            }
+            filter++;
+            continue;
+        }
+        if ( i == len ) {
+            return filter[0] == UTF8_LEVEL_SEPARATOR && filter[1] == UTF8_MULTI_LEVEL &&
+                   filter[2] == '\0';
+        }
+        if ( topic[i] != *filter ) {
+            return 0;
+        }
+        i++;
+        filter++;
+    }
+
+    return i == len;
+}
+
+/**********************************************************************/
+/** Use portable code only (benchmark and comparison), or back to CPU
+ * dispatch.
+ *
+ * @param portable: TRUE_FLAG for portable code.
+ *
+ */
+void ecliutf8_portable(uint8_t portable) {
+
+    pthread_once( &utf8_once, ecliutf8_init );
+    ecliutf8_select( portable );
+}
+
+/**********************************************************************/
+/** Implementation in use, "utf8:<impl>".
+ *
+ */
+const char *ecliutf8_impl(void) {
+
+    pthread_once( &utf8_once, ecliutf8_init );
+    snprintf( utf8_impl_str, sizeof( utf8_impl_str ), "utf8:%s", utf8_name );
+
+    return utf8_impl_str;
+}
+
+/**********************************************************************/
+/**********************************************************************/
+/** Pick implementation, once
+ *
+ */
+static void ecliutf8_init(void) {
+
+    ecliutf8_select( 0 );
+}
+
+/**********************************************************************/
+/** Pick implementation for the running CPU
+ *
+ * @param portable: TRUE_FLAG for portable code only.
+ *
+ */
+static void ecliutf8_select(uint8_t portable) {
+
+    utf8_check = ecliutf8_check_scalar;
+    utf8_name = "scalar";
+    if ( portable ) {
+        return;
+    }
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if ( __builtin_cpu_supports( "avx2" ) ) {
+        utf8_check = ecliutf8_check_avx2;
+        utf8_name = "avx2";
+    }
+    else if ( __builtin_cpu_supports( "ssse3" ) ) {
+        utf8_check = ecliutf8_check_ssse3;
+        utf8_name = "ssse3";
+    }
+#endif
+}
+
+/**********************************************************************/
+/** Check UTF-8, 8 ASCII bytes per step (portable)
+ *
+ * @param buffer: data.
+ * @param len: data size.
+ * @param forbid: ASCII bytes to reject.
+ *
+ */
+static int8_t ecliutf8_check_scalar(const uint8_t *buffer, size_t len, const uint8_t *forbid) {
+
+    const uint8_t *end = buffer + len;
+    uint64_t word = 0;
+    uint64_t hit  = 0;
+    uint8_t  byte = 0;
+    uint8_t  need = 0;
+    uint8_t  low  = 0;
+    uint8_t  high = 0;
+    uint8_t  i    = 0;
+
+    while ( buffer < end ) {
+        if ( end - buffer >= 8 ) {
+            memcpy( &word, buffer, 8 );
+            if ( ( word & UTF8_HIGH_BITS ) == 0 ) {
+                hit = 0;
+                for ( i = 0; i < UTF8_FORBID_MAX; i++ ) {
+                    hit |= UTF8_ZERO_BYTE( word ^ ( UTF8_LOW_BITS * forbid[i] ) );
+                }
+                if ( hit ) {
+                    return -1;
+                }
+                buffer += 8;
+                continue;
+            }
+        }
+        byte = *buffer++;
+        if ( byte < 0x80 ) {
+            if ( byte == forbid[0] || byte == forbid[1] || byte == forbid[2] ) {
+                return -1;
+            }
+            continue;
+        }
+        /* Continuation bytes of lead byte, range of the first one */
+        low = 0x80;
+        high = 0xBF;
+        if ( byte >= 0xC2 && byte <= 0xDF ) {
+            need = 1;
+        }
+        else if ( byte >= 0xE0 && byte <= 0xEF ) {
+            need = 2;
+            low = ( byte == 0xE0 ) ? 0xA0 : 0x80;
+            high = ( byte == 0xED ) ? 0x9F : 0xBF;
+        }
+        else if ( byte >= 0xF0 && byte <= 0xF4 ) {
+            need = 3;
+            low = ( byte == 0xF0 ) ? 0x90 : 0x80;
+            high = ( byte == 0xF4 ) ? 0x8F : 0xBF;
+        }
+        else {
+            return -1;
+        }
+        if ( end - buffer < need || buffer[0] < low || buffer[0] > high ) {
+            return -1;
+        }
+        for ( i = 1; i < need; i++ ) {
+            if ( ( buffer[i] & 0xC0 ) != 0x80 ) {
+                return -1;
+            }
+        }
+        buffer += need;
+    }
+
+    return 0;
+}
+
+#if defined(__x86_64__)
+/**********************************************************************/
+/** Check bytes after the vector blocks, from the last character of the
+ * blocks (it may go on after them).
+ *
+ * @param buffer: data.
+ * @param pos: end of vector blocks.
+ * @param len: data size.
+ * @param forbid: ASCII bytes to reject.
+ *
+ */
+static int8_t ecliutf8_check_tail(const uint8_t *buffer, size_t pos, size_t len, const uint8_t *forbid) {
+
+    uint8_t back = 0;
+
+    while ( pos > 0 && back < 3 && ( buffer[pos - 1] & 0xC0 ) == 0x80 ) {
+        pos--;
+        back++;
+    }
+    if ( pos > 0 && buffer[pos - 1] >= 0xC0 ) {
+        pos--;
+    }
+
+    return ecliutf8_check_scalar( buffer + pos, len - pos, forbid );
+}
+
+/**********************************************************************/
+/** Check UTF-8, 16 (SSSE3) or 32 (AVX2) bytes at once
+ *
+ * @param buffer: data.
+ * @param len: data size.
+ * @param forbid: ASCII bytes to reject.
+ *
+ */
+__attribute__((target("ssse3")))
+static int8_t ecliutf8_check_ssse3(const uint8_t *buffer, size_t len, const uint8_t *forbid) {
+
+    const __m128i high_1  = _mm_loadu_si128( ( const __m128i * ) utf8_byte1_high );
+    const __m128i low_1   = _mm_loadu_si128( ( const __m128i * ) utf8_byte1_low );
+    const __m128i high_2  = _mm_loadu_si128( ( const __m128i * ) utf8_byte2_high );
+    const __m128i tail    = _mm_loadu_si128( ( const __m128i * ) ( utf8_tail + 16 ) );
+    const __m128i nibble  = _mm_set1_epi8( 0x0F );
+    const __m128i third   = _mm_set1_epi8( 0xE0 - 0x80 );
+    const __m128i fourth  = _mm_set1_epi8( 0xF0 - 0x80 );
+    const __m128i bit7    = _mm_set1_epi8( ( char ) 0x80 );
+    const __m128i forbid0 = _mm_set1_epi8( ( char ) forbid[0] );
+    const __m128i forbid1 = _mm_set1_epi8( ( char ) forbid[1] );
+    const __m128i forbid2 = _mm_set1_epi8( ( char ) forbid[2] );
+    __m128i input;
+    __m128i prev1;
+    __m128i special;
+    __m128i must23;
+    __m128i prev       = _mm_setzero_si128();
+    __m128i incomplete = _mm_setzero_si128();
+    __m128i error      = _mm_setzero_si128();
+    size_t  pos = 0;
+
+    for ( pos = 0; pos + 16 <= len; pos += 16 ) {
+        input = _mm_loadu_si128( ( const __m128i * ) ( buffer + pos ) );
+        error = _mm_or_si128( error, _mm_or_si128( _mm_cmpeq_epi8( input, forbid0 ),
+                              _mm_or_si128( _mm_cmpeq_epi8( input, forbid1 ), _mm_cmpeq_epi8( input, forbid2 ) ) ) );
+        if ( _mm_movemask_epi8( input ) == 0 ) {
+            /* ASCII block, only a sequence cut by it is an error */
+            error = _mm_or_si128( error, incomplete );
+            incomplete = _mm_setzero_si128();
+        }
+        else {
+            prev1 = _mm_alignr_epi8( input, prev, 15 );
+            special = _mm_and_si128(
+                _mm_and_si128( _mm_shuffle_epi8( high_1, _mm_and_si128( _mm_srli_epi16( prev1, 4 ), nibble ) ),
+                               _mm_shuffle_epi8( low_1, _mm_and_si128( prev1, nibble ) ) ),
+                _mm_shuffle_epi8( high_2, _mm_and_si128( _mm_srli_epi16( input, 4 ), nibble ) ) );
+            /* 3rd and 4th bytes must be continuations, after E0..FF and F0..FF */
+            must23 = _mm_or_si128( _mm_subs_epu8( _mm_alignr_epi8( input, prev, 14 ), third ),
+                                   _mm_subs_epu8( _mm_alignr_epi8( input, prev, 13 ), fourth ) );
+            error = _mm_or_si128( error, _mm_xor_si128( _mm_and_si128( must23, bit7 ), special ) );
+            incomplete = _mm_subs_epu8( input, tail );
+        }
+        prev = input;
+    }
+    if ( _mm_movemask_epi8( _mm_cmpeq_epi8( error, _mm_setzero_si128() ) ) != 0xFFFF ) {
+        return -1;
+    }
+
+    return ecliutf8_check_tail( buffer, pos, len, forbid );
+}
+
+/* Input shifted right n bytes, bytes of prev block in front */
+#define UTF8_PREV_AVX2(input, prev, n) \
+    _mm256_alignr_epi8( input, _mm256_permute2x128_si256( prev, input, 0x21 ), 16 - ( n ) )
+
+__attribute__((target("avx2")))
+static int8_t ecliutf8_check_avx2(const uint8_t *buffer, size_t len, const uint8_t *forbid) {
+
+    const __m256i high_1  = _mm256_broadcastsi128_si256( _mm_loadu_si128( ( const __m128i * ) utf8_byte1_high ) );
+    const __m256i low_1   = _mm256_broadcastsi128_si256( _mm_loadu_si128( ( const __m128i * ) utf8_byte1_low ) );
+    const __m256i high_2  = _mm256_broadcastsi128_si256( _mm_loadu_si128( ( const __m128i * ) utf8_byte2_high ) );
+    const __m256i tail    = _mm256_loadu_si256( ( const __m256i * ) utf8_tail );
+    const __m256i nibble  = _mm256_set1_epi8( 0x0F );
+    const __m256i third   = _mm256_set1_epi8( 0xE0 - 0x80 );
+    const __m256i fourth  = _mm256_set1_epi8( 0xF0 - 0x80 );
+    const __m256i bit7    = _mm256_set1_epi8( ( char ) 0x80 );
+    const __m256i forbid0 = _mm256_set1_epi8( ( char ) forbid[0] );
+    const __m256i forbid1 = _mm256_set1_epi8( ( char ) forbid[1] );
+    const __m256i forbid2 = _mm256_set1_epi8( ( char ) forbid[2] );
+    __m256i input;
+    __m256i prev1;
+    __m256i special;
+    __m256i must23;
+    __m256i prev       = _mm256_setzero_si256();
+    __m256i incomplete = _mm256_setzero_si256();
+    __m256i error      = _mm256_setzero_si256();
+    size_t  pos = 0;
+
+    for ( pos = 0; pos + 32 <= len; pos += 32 ) {
+        input = _mm256_loadu_si256( ( const __m256i * ) ( buffer + pos ) );
+        error = _mm256_or_si256( error, _mm256_or_si256( _mm256_cmpeq_epi8( input, forbid0 ),
+                                 _mm256_or_si256( _mm256_cmpeq_epi8( input, forbid1 ), _mm256_cmpeq_epi8( input, forbid2 ) ) ) );
+        if ( _mm256_movemask_epi8( input ) == 0 ) {
+            error = _mm256_or_si256( error, incomplete );
+            incomplete = _mm256_setzero_si256();
+        }
+        else {
+            prev1 = UTF8_PREV_AVX2( input, prev, 1 );
+            special = _mm256_and_si256(
+                _mm256_and_si256( _mm256_shuffle_epi8( high_1, _mm256_and_si256( _mm256_srli_epi16( prev1, 4 ), nibble ) ),
+                                  _mm256_shuffle_epi8( low_1, _mm256_and_si256( prev1, nibble ) ) ),
+                _mm256_shuffle_epi8( high_2, _mm256_and_si256( _mm256_srli_epi16( input, 4 ), nibble ) ) );
+            must23 = _mm256_or_si256( _mm256_subs_epu8( UTF8_PREV_AVX2( input, prev, 2 ), third ),
+                                      _mm256_subs_epu8( UTF8_PREV_AVX2( input, prev, 3 ), fourth ) );
+            error = _mm256_or_si256( error, _mm256_xor_si256( _mm256_and_si256( must23, bit7 ), special ) );
+            incomplete = _mm256_subs_epu8( input, tail );
+        }
+        prev = input;
+    }
+    if ( !_mm256_testz_si256( error, error ) ) {
+        return -1;
+    }
+
+    return ecliutf8_check_tail( buffer, pos, len, forbid );
+}
+#endif